@@ -14,6 +14,7 @@
 #include <Library/PcdLib.h>
 
 #include <Soc.h>
+#include <RK3588Pcie.h>
 
 // The total number of descriptors, including the final "end-of-table" descriptor.
 #define MAX_VIRTUAL_MEMORY_MAP_DESCRIPTORS 12
@@ -233,10 +234,11 @@ ArmPlatformGetVirtualMemoryMap (
   VirtualMemoryTable[Index].Length          = RK3588_PERIPH_SZ;
   VirtualMemoryTable[Index].Attributes      = ARM_MEMORY_REGION_ATTRIBUTE_NONSECURE_DEVICE;
 
-  //PCIe 64 BAR space
-  VirtualMemoryTable[++Index].PhysicalBase    = 0x940000000;
-  VirtualMemoryTable[Index].VirtualBase     = 0x940000000;
-  VirtualMemoryTable[Index].Length          = 0x100000000 + 0x1400000;
+  //PCIe 64 BAR space of all the root complexes, then their 64-bit DBI
+  VirtualMemoryTable[++Index].PhysicalBase    = PCIE_MMIO64_BASE (0);
+  VirtualMemoryTable[Index].VirtualBase     = PCIE_MMIO64_BASE (0);
+  VirtualMemoryTable[Index].Length          = PCIE_MMIO64_BASE (PCIE_SEGMENT_COUNT) - PCIE_MMIO64_BASE (0) +
+                                              PCIE_SEGMENT_COUNT * PCIE_DBI_SIZE;
   VirtualMemoryTable[Index].Attributes      = ARM_MEMORY_REGION_ATTRIBUTE_NONSECURE_DEVICE;
 
   // DDR - predefined 1GB size
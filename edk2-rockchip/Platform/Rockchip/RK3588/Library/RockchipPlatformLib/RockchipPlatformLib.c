@@ -9,6 +9,7 @@
 #include <Library/DebugLib.h>
 #include <Library/IoLib.h>
 #include <Soc.h>
+#include <RK3588Pcie.h>
 
 void DebugPrintHex(void *buf, UINT32 width, UINT32 len)
 {
@@ -242,10 +243,18 @@ Dwc3Force20ClkFor30Clk (UINT32 Address, BOOLEAN enable)
   }
 }
 
+/*
+ * PERST# and slot power of the PCIe root complexes. Only the 3x4 slot has
+ * them on GPIOs on this board, the other slots are powered and released
+ * with the board.
+ */
 void
 EFIAPI
-Pcie30IoInit(void)
+PcieIoInit(UINT32 Segment)
 {
+    if (Segment != PCIE_SEGMENT_PCIE30X4)
+        return;
+
     /* Set reset and power IO to gpio output mode */
     MmioWrite32(0xFD5F808C, 0xf << (8 + 16)); /* gpio4b6 to gpio mode -> reset */
     MmioWrite32(0xFEC50008, 0x40004000); /* output */ 
@@ -256,15 +265,21 @@ Pcie30IoInit(void)
 
 void
 EFIAPI
-Pcie30PowerEn(void)
+PciePowerEn(UINT32 Segment)
 {
+    if (Segment != PCIE_SEGMENT_PCIE30X4)
+        return;
+
     MmioWrite32(0xFEC40004, 0x80008); /* output high to enable power */
 }
 
 void
 EFIAPI
-Pcie30PeReset(BOOLEAN enable)
+PciePeReset(UINT32 Segment, BOOLEAN enable)
 {
+    if (Segment != PCIE_SEGMENT_PCIE30X4)
+        return;
+
     if(enable)
         MmioWrite32(0xFEC50000, 0x40000000); /* output low */
     else
@@ -0,0 +1,450 @@
+/** @file
+
+  "blkbench" shell command: time sequential reads through the BlockIo of a
+  mapped device, with the request size the boot loaders use or any other, or
+  the latency of single reads at random offsets.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/HiiLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/ShellCommandLib.h>
+#include <Library/ShellLib.h>
+#include <Library/SortLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/BlockIo.h>
+
+#define BLOCK_IO_BENCH_REQUEST_KB   64
+#define BLOCK_IO_BENCH_TOTAL_MB     64
+#define BLOCK_IO_BENCH_LATENCY_KB   4
+#define BLOCK_IO_BENCH_READS        1000
+
+CONST CHAR16 gShellBlockIoBenchFileName[] = L"ShellCommand";
+EFI_HANDLE gShellBlockIoBenchHiiHandle = NULL;
+
+STATIC CONST SHELL_PARAM_ITEM ParamList[] = {
+  {L"-s", TypeValue},
+  {L"-t", TypeValue},
+  {L"-l", TypeValue},
+  {L"-q", TypeFlag},
+  {L"-n", TypeValue},
+  {NULL , TypeMax}
+  };
+
+/**
+  Return the file name of the help text file if not using HII.
+
+  @return The string pointer to the file name.
+**/
+CONST CHAR16*
+EFIAPI
+ShellCommandGetManFileNameBlockIoBench (
+  VOID
+  )
+{
+  return gShellBlockIoBenchFileName;
+}
+
+/**
+  Find the BlockIo of a mapped device.
+
+  @param  Map                 The mapping name, with or without the colon.
+
+  @return The BlockIo, or NULL if the device has none.
+
+**/
+STATIC
+EFI_BLOCK_IO_PROTOCOL *
+BlockIoBenchGetBlockIo (
+  IN CONST CHAR16             *Map
+  )
+{
+  CHAR16                          *Name;
+  CONST EFI_DEVICE_PATH_PROTOCOL  *MapPath;
+  EFI_DEVICE_PATH_PROTOCOL        *DevicePath;
+  EFI_BLOCK_IO_PROTOCOL           *BlockIo;
+  EFI_HANDLE                      Handle;
+  EFI_STATUS                      Status;
+
+  Name = CatSPrint (NULL, L"%s%s", Map, (Map[StrLen (Map) - 1] == L':') ? L"" : L":");
+  if (Name == NULL) {
+    return NULL;
+  }
+
+  MapPath = gEfiShellProtocol->GetDevicePathFromMap (Name);
+  FreePool (Name);
+  if (MapPath == NULL) {
+    return NULL;
+  }
+
+  DevicePath = (EFI_DEVICE_PATH_PROTOCOL *) MapPath;
+  Status = gBS->LocateDevicePath (&gEfiBlockIoProtocolGuid, &DevicePath, &Handle);
+  if (EFI_ERROR (Status) || !IsDevicePathEnd (DevicePath)) {
+    return NULL;
+  }
+
+  Status = gBS->HandleProtocol (Handle, &gEfiBlockIoProtocolGuid, (VOID **) &BlockIo);
+  if (EFI_ERROR (Status)) {
+    return NULL;
+  }
+
+  return BlockIo;
+}
+
+/**
+  Read a range of a device sequentially and print the throughput.
+
+  @param  BlockIo             The BlockIo of the device.
+  @param  Lba                 The first block to read.
+  @param  RequestSize         The size of each read, in bytes.
+  @param  TotalSize           The size of the range, in bytes.
+
+  @retval SHELL_SUCCESS       The range was read.
+  @return Others              A read failed.
+
+**/
+STATIC
+SHELL_STATUS
+BlockIoBenchRun (
+  IN EFI_BLOCK_IO_PROTOCOL    *BlockIo,
+  IN EFI_LBA                  Lba,
+  IN UINTN                    RequestSize,
+  IN UINT64                   TotalSize
+  )
+{
+  EFI_BLOCK_IO_MEDIA          *Media;
+  VOID                        *Buffer;
+  UINT64                      Requests;
+  UINT64                      Index;
+  UINT64                      Start;
+  UINT64                      Microseconds;
+  EFI_STATUS                  Status;
+
+  Media       = BlockIo->Media;
+  RequestSize = ALIGN_VALUE (RequestSize, Media->BlockSize);
+  if (Lba > Media->LastBlock) {
+    Print (L"blkbench: LBA 0x%lx is beyond the end of the device\n", Lba);
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  TotalSize = MIN (TotalSize, MultU64x32 (Media->LastBlock - Lba + 1, Media->BlockSize));
+  Requests  = DivU64x64Remainder (TotalSize, RequestSize, NULL);
+  if (Requests == 0) {
+    Print (L"blkbench: Nothing to read\n");
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  Buffer = AllocateAlignedPages (EFI_SIZE_TO_PAGES (RequestSize), MAX (Media->IoAlign, EFI_PAGE_SIZE));
+  if (Buffer == NULL) {
+    Print (L"blkbench: Out of memory\n");
+    return SHELL_OUT_OF_RESOURCES;
+  }
+
+  Start = GetPerformanceCounter ();
+  for (Index = 0; Index < Requests; Index++) {
+    Status = BlockIo->ReadBlocks (BlockIo, Media->MediaId, Lba, RequestSize, Buffer);
+    if (EFI_ERROR (Status)) {
+      Print (L"blkbench: Read of LBA 0x%lx failed: %r\n", Lba, Status);
+      FreeAlignedPages (Buffer, EFI_SIZE_TO_PAGES (RequestSize));
+      return SHELL_DEVICE_ERROR;
+    }
+
+    Lba += RequestSize / Media->BlockSize;
+  }
+
+  Microseconds = MAX (DivU64x32 (GetTimeInNanoSecond (GetPerformanceCounter () - Start), 1000), 1);
+  FreeAlignedPages (Buffer, EFI_SIZE_TO_PAGES (RequestSize));
+
+  TotalSize = MultU64x64 (Requests, RequestSize);
+  Print (
+    L"%ld reads of %d KiB: %ld KiB in %ld us, %ld KiB/s, %ld us per read\n",
+    Requests,
+    RequestSize / SIZE_1KB,
+    TotalSize / SIZE_1KB,
+    Microseconds,
+    DivU64x64Remainder (MultU64x32 (TotalSize / SIZE_1KB, 1000000), Microseconds, NULL),
+    DivU64x64Remainder (Microseconds, Requests, NULL)
+    );
+
+  return SHELL_SUCCESS;
+}
+
+/**
+  Compare two latencies for PerformQuickSort ().
+
+  @param  Buffer1             The first latency.
+  @param  Buffer2             The second latency.
+
+  @retval <0                  The first latency is shorter.
+  @retval 0                   The latencies are equal.
+  @retval >0                  The first latency is longer.
+
+**/
+STATIC
+INTN
+EFIAPI
+BlockIoBenchCompareLatency (
+  IN CONST VOID               *Buffer1,
+  IN CONST VOID               *Buffer2
+  )
+{
+  UINT64                      Latency1;
+  UINT64                      Latency2;
+
+  Latency1 = *(CONST UINT64 *) Buffer1;
+  Latency2 = *(CONST UINT64 *) Buffer2;
+  if (Latency1 == Latency2) {
+    return 0;
+  }
+
+  return (Latency1 < Latency2) ? -1 : 1;
+}
+
+/**
+  Read a device one request at a time, at random request-aligned offsets
+  of a range, and print the distribution of the time each read took.
+
+  Only one read is outstanding at any time, so the times are the latency
+  of the device and of the driver completing it.
+
+  @param  BlockIo             The BlockIo of the device.
+  @param  Lba                 The first block of the range.
+  @param  RequestSize         The size of each read, in bytes.
+  @param  TotalSize           The size of the range, in bytes.
+  @param  Reads               The number of reads.
+
+  @retval SHELL_SUCCESS       The reads completed.
+  @return Others              A read failed.
+
+**/
+STATIC
+SHELL_STATUS
+BlockIoBenchLatency (
+  IN EFI_BLOCK_IO_PROTOCOL    *BlockIo,
+  IN EFI_LBA                  Lba,
+  IN UINTN                    RequestSize,
+  IN UINT64                   TotalSize,
+  IN UINTN                    Reads
+  )
+{
+  EFI_BLOCK_IO_MEDIA          *Media;
+  VOID                        *Buffer;
+  UINT64                      *Latencies;
+  UINT64                      Slots;
+  UINT64                      Seed;
+  UINT64                      Slot;
+  UINT64                      Sum;
+  UINT64                      Start;
+  EFI_LBA                     ReadLba;
+  UINTN                       Index;
+  EFI_STATUS                  Status;
+
+  Media       = BlockIo->Media;
+  RequestSize = ALIGN_VALUE (RequestSize, Media->BlockSize);
+  if (Lba > Media->LastBlock) {
+    Print (L"blkbench: LBA 0x%lx is beyond the end of the device\n", Lba);
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  TotalSize = MIN (TotalSize, MultU64x32 (Media->LastBlock - Lba + 1, Media->BlockSize));
+  Slots     = DivU64x64Remainder (TotalSize, RequestSize, NULL);
+  if ((Slots == 0) || (Reads == 0)) {
+    Print (L"blkbench: Nothing to read\n");
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  Latencies = AllocatePool (Reads * sizeof (UINT64));
+  Buffer    = AllocateAlignedPages (EFI_SIZE_TO_PAGES (RequestSize), MAX (Media->IoAlign, EFI_PAGE_SIZE));
+  if ((Latencies == NULL) || (Buffer == NULL)) {
+    Print (L"blkbench: Out of memory\n");
+    Status = EFI_OUT_OF_RESOURCES;
+    goto EXIT;
+  }
+
+  //
+  // A fixed xorshift sequence, so that runs before and after a driver
+  // change read the same blocks
+  //
+  Seed = 88172645463325252ULL;
+  Sum  = 0;
+  for (Index = 0; Index < Reads; Index++) {
+    Seed ^= LShiftU64 (Seed, 13);
+    Seed ^= RShiftU64 (Seed, 7);
+    Seed ^= LShiftU64 (Seed, 17);
+
+    DivU64x64Remainder (Seed, Slots, &Slot);
+    ReadLba = Lba + DivU64x32 (MultU64x64 (Slot, RequestSize), Media->BlockSize);
+
+    Start  = GetPerformanceCounter ();
+    Status = BlockIo->ReadBlocks (BlockIo, Media->MediaId, ReadLba, RequestSize, Buffer);
+    Latencies[Index] = GetTimeInNanoSecond (GetPerformanceCounter () - Start);
+    if (EFI_ERROR (Status)) {
+      Print (L"blkbench: Read of LBA 0x%lx failed: %r\n", ReadLba, Status);
+      goto EXIT;
+    }
+
+    Sum += Latencies[Index];
+  }
+
+  PerformQuickSort (Latencies, Reads, sizeof (UINT64), BlockIoBenchCompareLatency);
+
+  Print (
+    L"%d reads of %d KiB at queue depth 1, in us: min %ld, avg %ld, median %ld, 99%% %ld, max %ld\n",
+    Reads,
+    RequestSize / SIZE_1KB,
+    DivU64x32 (Latencies[0], 1000),
+    DivU64x64Remainder (Sum, MultU64x32 (Reads, 1000), NULL),
+    DivU64x32 (Latencies[Reads / 2], 1000),
+    DivU64x32 (Latencies[(Reads * 99) / 100], 1000),
+    DivU64x32 (Latencies[Reads - 1], 1000)
+    );
+
+EXIT:
+  if (Buffer != NULL) {
+    FreeAlignedPages (Buffer, EFI_SIZE_TO_PAGES (RequestSize));
+  }
+  if (Latencies != NULL) {
+    FreePool (Latencies);
+  }
+
+  if (Status == EFI_OUT_OF_RESOURCES) {
+    return SHELL_OUT_OF_RESOURCES;
+  }
+
+  return EFI_ERROR (Status) ? SHELL_DEVICE_ERROR : SHELL_SUCCESS;
+}
+
+SHELL_STATUS
+EFIAPI
+ShellCommandRunBlockIoBench (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS              Status;
+  LIST_ENTRY              *CheckPackage;
+  CHAR16                  *ProblemParam;
+  CONST CHAR16            *Map;
+  CONST CHAR16            *Value;
+  EFI_BLOCK_IO_PROTOCOL   *BlockIo;
+  UINTN                   RequestSize;
+  UINT64                  TotalSize;
+  EFI_LBA                 Lba;
+  BOOLEAN                 Latency;
+  UINTN                   Reads;
+
+  Status = ShellInitialize ();
+  if (EFI_ERROR (Status)) {
+    Print (L"blkbench: Cannot initialize Shell\n");
+    ASSERT_EFI_ERROR (Status);
+    return SHELL_ABORTED;
+  }
+
+  Status = ShellCommandLineParse (ParamList, &CheckPackage, &ProblemParam, TRUE);
+  if (EFI_ERROR (Status)) {
+    Print (L"blkbench: Error while parsing command line\n");
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  Map = ShellCommandLineGetRawValue (CheckPackage, 1);
+  if (Map == NULL) {
+    Print (L"blkbench: No device given\n");
+    ShellCommandLineFreeVarList (CheckPackage);
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  Latency = ShellCommandLineGetFlag (CheckPackage, L"-q");
+
+  RequestSize = (Latency ? BLOCK_IO_BENCH_LATENCY_KB : BLOCK_IO_BENCH_REQUEST_KB) * SIZE_1KB;
+  Value = ShellCommandLineGetValue (CheckPackage, L"-s");
+  if (Value != NULL) {
+    RequestSize = ShellStrToUintn (Value) * SIZE_1KB;
+  }
+
+  //
+  // Latencies are measured over the whole device unless told otherwise, so
+  // that few reads hit the cache of the drive
+  //
+  TotalSize = Latency ? MAX_UINT64 : BLOCK_IO_BENCH_TOTAL_MB * SIZE_1MB;
+  Value = ShellCommandLineGetValue (CheckPackage, L"-t");
+  if (Value != NULL) {
+    TotalSize = MultU64x32 (ShellStrToUintn (Value), SIZE_1MB);
+  }
+
+  Lba = 0;
+  Value = ShellCommandLineGetValue (CheckPackage, L"-l");
+  if (Value != NULL) {
+    Lba = ShellStrToUintn (Value);
+  }
+
+  Reads = BLOCK_IO_BENCH_READS;
+  Value = ShellCommandLineGetValue (CheckPackage, L"-n");
+  if (Value != NULL) {
+    Reads = ShellStrToUintn (Value);
+  }
+
+  if (RequestSize == 0) {
+    Print (L"blkbench: Invalid request size\n");
+    ShellCommandLineFreeVarList (CheckPackage);
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  BlockIo = BlockIoBenchGetBlockIo (Map);
+  ShellCommandLineFreeVarList (CheckPackage);
+  if (BlockIo == NULL) {
+    Print (L"blkbench: No BlockIo on the device\n");
+    return SHELL_NOT_FOUND;
+  }
+
+  if (Latency) {
+    return BlockIoBenchLatency (BlockIo, Lba, RequestSize, TotalSize, Reads);
+  }
+
+  return BlockIoBenchRun (BlockIo, Lba, RequestSize, TotalSize);
+}
+
+EFI_STATUS
+EFIAPI
+ShellBlockIoBenchLibConstructor (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  gShellBlockIoBenchHiiHandle = HiiAddPackages (
+                                  &gShellBlockIoBenchHiiGuid, gImageHandle,
+                                  UefiShellBlockIoBenchLibStrings, NULL
+                                  );
+  if (gShellBlockIoBenchHiiHandle == NULL) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  ShellCommandRegisterCommandName (
+     L"blkbench", ShellCommandRunBlockIoBench, ShellCommandGetManFileNameBlockIoBench, 0,
+     L"blkbench", TRUE , gShellBlockIoBenchHiiHandle, STRING_TOKEN (STR_GET_HELP_BLKBENCH)
+     );
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+ShellBlockIoBenchLibDestructor (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  if (gShellBlockIoBenchHiiHandle != NULL) {
+    HiiRemovePackages (gShellBlockIoBenchHiiHandle);
+  }
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,193 @@
+/** @file
+
+  "pcieprof" shell command: dump the counters PciExpressLib and PcieInitDxe
+  keep when PcdPcieProfileEnable is set.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/HiiLib.h>
+#include <Library/ShellCommandLib.h>
+#include <Library/ShellLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/PcieProfile.h>
+
+CONST CHAR16 gShellPcieProfileFileName[] = L"ShellCommand";
+EFI_HANDLE gShellPcieProfileHiiHandle = NULL;
+
+STATIC CONST SHELL_PARAM_ITEM ParamList[] = {
+  {L"-r", TypeFlag},
+  {NULL , TypeMax}
+  };
+
+STATIC CONST CHAR16 *mPhaseNames[PcieProfilePhaseMax] = {
+  L"Power",
+  L"Detect",
+  L"Training",
+  L"Settle",
+  L"Retrain"
+};
+
+/**
+  Return the file name of the help text file if not using HII.
+
+  @return The string pointer to the file name.
+**/
+CONST CHAR16*
+EFIAPI
+ShellCommandGetManFileNamePcieProfile (
+  VOID
+  )
+{
+  return gShellPcieProfileFileName;
+}
+
+/**
+  Print the link bring-up of the root ports and the config accesses of
+  every function.
+
+  @param  Profile             The counters.
+
+**/
+STATIC
+VOID
+PcieProfileDump (
+  IN ROCKCHIP_PCIE_PROFILE_PROTOCOL  *Profile
+  )
+{
+  PCIE_PROFILE_SEGMENT              *Segment;
+  PCIE_PROFILE_FUNCTION             *Function;
+  UINT64                            Reads;
+  UINT64                            Writes;
+  UINTN                             Index;
+  UINTN                             Phase;
+
+  Print (L"Seg  iATU  Power  Detect  Training  Settle  Retrain (us)\n");
+  for (Index = 0; Index < PCIE_PROFILE_MAX_SEGMENTS; Index++) {
+    Segment = &Profile->Segments[Index];
+    if ((Segment->AtuPrograms == 0) && (Segment->PhaseUs[PcieProfilePower] == 0)) {
+      continue;
+    }
+
+    Print (L"%3d %5ld", Index, Segment->AtuPrograms);
+    for (Phase = 0; Phase < PcieProfilePhaseMax; Phase++) {
+      Print (L" %*ld", StrLen (mPhaseNames[Phase]) + 1, Segment->PhaseUs[Phase]);
+    }
+
+    Print (L"\n");
+  }
+
+  if (Profile->FunctionCount == 0) {
+    return;
+  }
+
+  Reads  = 0;
+  Writes = 0;
+  Print (L"\nSeg Bus Dev Fn      Reads     Writes\n");
+  for (Index = 0; Index < Profile->FunctionCount; Index++) {
+    Function = &Profile->Functions[Index];
+    Print (
+      L"%3d  %02x  %02x %2d %10ld %10ld\n",
+      Function->Segment,
+      Function->Bus,
+      Function->Device,
+      Function->Function,
+      Function->Reads,
+      Function->Writes
+      );
+    Reads  += Function->Reads;
+    Writes += Function->Writes;
+  }
+
+  Print (L"Total        %10ld %10ld\n", Reads, Writes);
+  if (Profile->Dropped != 0) {
+    Print (L"%ld accesses not counted, too many functions\n", Profile->Dropped);
+  }
+}
+
+SHELL_STATUS
+EFIAPI
+ShellCommandRunPcieProfile (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS                      Status;
+  LIST_ENTRY                      *CheckPackage;
+  CHAR16                          *ProblemParam;
+  ROCKCHIP_PCIE_PROFILE_PROTOCOL  *Profile;
+  BOOLEAN                         Reset;
+
+  Status = ShellInitialize ();
+  if (EFI_ERROR (Status)) {
+    Print (L"pcieprof: Cannot initialize Shell\n");
+    ASSERT_EFI_ERROR (Status);
+    return SHELL_ABORTED;
+  }
+
+  Status = ShellCommandLineParse (ParamList, &CheckPackage, &ProblemParam, TRUE);
+  if (EFI_ERROR (Status)) {
+    Print (L"pcieprof: Error while parsing command line\n");
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  Reset = ShellCommandLineGetFlag (CheckPackage, L"-r");
+  ShellCommandLineFreeVarList (CheckPackage);
+
+  Status = gBS->LocateProtocol (&gRockchipPcieProfileProtocolGuid, NULL, (VOID **) &Profile);
+  if (EFI_ERROR (Status)) {
+    Print (L"pcieprof: No counters, is PcdPcieProfileEnable set?\n");
+    return SHELL_NOT_FOUND;
+  }
+
+  if (Reset) {
+    Profile->Reset (Profile);
+  } else {
+    PcieProfileDump (Profile);
+  }
+
+  return SHELL_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+ShellPcieProfileLibConstructor (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  gShellPcieProfileHiiHandle = HiiAddPackages (
+                                 &gShellPcieProfileHiiGuid, gImageHandle,
+                                 UefiShellPcieProfileLibStrings, NULL
+                                 );
+  if (gShellPcieProfileHiiHandle == NULL) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  ShellCommandRegisterCommandName (
+     L"pcieprof", ShellCommandRunPcieProfile, ShellCommandGetManFileNamePcieProfile, 0,
+     L"pcieprof", TRUE , gShellPcieProfileHiiHandle, STRING_TOKEN (STR_GET_HELP_PCIEPROF)
+     );
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+ShellPcieProfileLibDestructor (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  if (gShellPcieProfileHiiHandle != NULL) {
+    HiiRemovePackages (gShellPcieProfileHiiHandle);
+  }
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,260 @@
+/** @file
+
+  "usbprof" shell command: dump the counters the USB host controller
+  drivers keep when PcdUsbProfileEnable is set.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/HiiLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/ShellCommandLib.h>
+#include <Library/ShellLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/UsbProfile.h>
+
+CONST CHAR16 gShellUsbProfileFileName[] = L"ShellCommand";
+EFI_HANDLE gShellUsbProfileHiiHandle = NULL;
+
+STATIC CONST SHELL_PARAM_ITEM ParamList[] = {
+  {L"-r", TypeFlag},
+  {NULL , TypeMax}
+  };
+
+STATIC CONST CHAR16 *mTypeNames[UsbProfileTypeMax] = {
+  L"Control",
+  L"Bulk",
+  L"Interrupt"
+};
+
+/**
+  Return the file name of the help text file if not using HII.
+
+  @return The string pointer to the file name.
+**/
+CONST CHAR16*
+EFIAPI
+ShellCommandGetManFileNameUsbProfile (
+  VOID
+  )
+{
+  return gShellUsbProfileFileName;
+}
+
+/**
+  Convert counter ticks to microseconds.
+
+  @param  Profile             The counters the ticks come from.
+  @param  Ticks               The ticks.
+
+  @return The duration in microseconds.
+
+**/
+STATIC
+UINT64
+UsbProfileTicksToUs (
+  IN ROCKCHIP_USB_PROFILE_PROTOCOL  *Profile,
+  IN UINT64                         Ticks
+  )
+{
+  if (Profile->Frequency == 0) {
+    return 0;
+  }
+
+  return DivU64x64Remainder (MultU64x32 (Ticks, 1000000), Profile->Frequency, NULL);
+}
+
+/**
+  Print a timing as count, average, shortest and longest in microseconds.
+
+  @param  Profile             The counters the timing comes from.
+  @param  Name                The label of the timing.
+  @param  Timing              The timing.
+
+**/
+STATIC
+VOID
+UsbProfilePrintTiming (
+  IN ROCKCHIP_USB_PROFILE_PROTOCOL  *Profile,
+  IN CONST CHAR16                   *Name,
+  IN USB_PROFILE_TIMING             *Timing
+  )
+{
+  UINT64                            Average;
+
+  Average = 0;
+  if (Timing->Count != 0) {
+    Average = DivU64x64Remainder (Timing->Total, Timing->Count, NULL);
+  }
+
+  Print (
+    L"  %-10s %6ld x  avg %8ld us  min %8ld us  max %8ld us\n",
+    Name,
+    Timing->Count,
+    UsbProfileTicksToUs (Profile, Average),
+    UsbProfileTicksToUs (Profile, Timing->Min),
+    UsbProfileTicksToUs (Profile, Timing->Max)
+    );
+}
+
+/**
+  Print the counters of one host controller.
+
+  @param  Profile             The counters.
+
+**/
+STATIC
+VOID
+UsbProfileDump (
+  IN ROCKCHIP_USB_PROFILE_PROTOCOL  *Profile
+  )
+{
+  USB_PROFILE_DEVICE                *Device;
+  USB_PROFILE_TIMING                *Latency;
+  UINTN                             Index;
+  UINTN                             Type;
+
+  Print (L"%s @ 0x%lx\n", Profile->ControllerName, (UINT64) Profile->BaseAddress);
+  Print (L"  Polling    %ld us\n", UsbProfileTicksToUs (Profile, Profile->PollTicks));
+  UsbProfilePrintTiming (Profile, L"Debounce", &Profile->PortDebounce);
+  UsbProfilePrintTiming (Profile, L"Reset", &Profile->PortReset);
+  if (Profile->Dropped != 0) {
+    Print (L"  %ld transfers not counted, too many devices\n", Profile->Dropped);
+  }
+
+  if (Profile->DeviceCount == 0) {
+    return;
+  }
+
+  Print (L"  Dev  Type       Count       Bytes    Avg us    Min us    Max us  Errors\n");
+  for (Index = 0; Index < Profile->DeviceCount; Index++) {
+    Device = &Profile->Devices[Index];
+    for (Type = 0; Type < UsbProfileTypeMax; Type++) {
+      Latency = &Device->Latency[Type];
+      if (Latency->Count == 0) {
+        continue;
+      }
+
+      Print (
+        L"  %3d  %-9s %6ld %11ld %9ld %9ld %9ld  %6ld\n",
+        Device->DeviceAddress,
+        mTypeNames[Type],
+        Latency->Count,
+        Device->Bytes[Type],
+        UsbProfileTicksToUs (Profile, DivU64x64Remainder (Latency->Total, Latency->Count, NULL)),
+        UsbProfileTicksToUs (Profile, Latency->Min),
+        UsbProfileTicksToUs (Profile, Latency->Max),
+        Device->Errors
+        );
+    }
+  }
+}
+
+SHELL_STATUS
+EFIAPI
+ShellCommandRunUsbProfile (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS                      Status;
+  LIST_ENTRY                      *CheckPackage;
+  CHAR16                          *ProblemParam;
+  EFI_HANDLE                      *Handles;
+  UINTN                           HandleCount;
+  UINTN                           Index;
+  ROCKCHIP_USB_PROFILE_PROTOCOL   *Profile;
+  BOOLEAN                         Reset;
+
+  Status = ShellInitialize ();
+  if (EFI_ERROR (Status)) {
+    Print (L"usbprof: Cannot initialize Shell\n");
+    ASSERT_EFI_ERROR (Status);
+    return SHELL_ABORTED;
+  }
+
+  Status = ShellCommandLineParse (ParamList, &CheckPackage, &ProblemParam, TRUE);
+  if (EFI_ERROR (Status)) {
+    Print (L"usbprof: Error while parsing command line\n");
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  Reset = ShellCommandLineGetFlag (CheckPackage, L"-r");
+  ShellCommandLineFreeVarList (CheckPackage);
+
+  Status = gBS->LocateHandleBuffer (
+                  ByProtocol,
+                  &gRockchipUsbProfileProtocolGuid,
+                  NULL,
+                  &HandleCount,
+                  &Handles
+                  );
+  if (EFI_ERROR (Status)) {
+    Print (L"usbprof: No counters, is PcdUsbProfileEnable set?\n");
+    return SHELL_NOT_FOUND;
+  }
+
+  for (Index = 0; Index < HandleCount; Index++) {
+    Status = gBS->HandleProtocol (
+                    Handles[Index],
+                    &gRockchipUsbProfileProtocolGuid,
+                    (VOID **) &Profile
+                    );
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    if (Reset) {
+      Profile->Reset (Profile);
+    } else {
+      UsbProfileDump (Profile);
+    }
+  }
+
+  FreePool (Handles);
+
+  return SHELL_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+ShellUsbProfileLibConstructor (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  gShellUsbProfileHiiHandle = HiiAddPackages (
+                                &gShellUsbProfileHiiGuid, gImageHandle,
+                                UefiShellUsbProfileLibStrings, NULL
+                                );
+  if (gShellUsbProfileHiiHandle == NULL) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  ShellCommandRegisterCommandName (
+     L"usbprof", ShellCommandRunUsbProfile, ShellCommandGetManFileNameUsbProfile, 0,
+     L"usbprof", TRUE , gShellUsbProfileHiiHandle, STRING_TOKEN (STR_GET_HELP_USBPROF)
+     );
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+ShellUsbProfileLibDestructor (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  if (gShellUsbProfileHiiHandle != NULL) {
+    HiiRemovePackages (gShellUsbProfileHiiHandle);
+  }
+  return EFI_SUCCESS;
+}
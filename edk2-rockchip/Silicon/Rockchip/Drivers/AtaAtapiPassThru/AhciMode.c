@@ -111,6 +111,109 @@ AhciOrReg (
   AhciWriteReg (AhciBaseAddress, Offset, Data);
 }
 
+/**
+  Start a wait with the given timeout.
+
+  @param[out] Waiter            The waiter to initialize.
+  @param[in]  Timeout           The time out value, uses 100ns as a unit.
+                                0 means infinite wait.
+
+**/
+VOID
+AhciWaiterStart (
+  OUT AHCI_WAITER               *Waiter,
+  IN  UINT64                    Timeout
+  )
+{
+  UINT64     StartValue;
+  UINT64     EndValue;
+
+  GetPerformanceCounterProperties (&StartValue, &EndValue);
+
+  Waiter->CountUp  = (BOOLEAN) (EndValue >= StartValue);
+  Waiter->Timeout  = MultU64x32 (Timeout, 100);
+  Waiter->Interval = 0;
+  Waiter->Start    = GetPerformanceCounter ();
+}
+
+/**
+  Get the time elapsed since the start of a wait.
+
+  @param[in]  Waiter            The waiter started by AhciWaiterStart ().
+
+  @return The elapsed time in ns.
+
+**/
+STATIC
+UINT64
+AhciWaiterElapsed (
+  IN AHCI_WAITER                *Waiter
+  )
+{
+  UINT64     Current;
+
+  Current = GetPerformanceCounter ();
+  return GetTimeInNanoSecond (Waiter->CountUp ? Current - Waiter->Start : Waiter->Start - Current);
+}
+
+/**
+  Check whether the timeout of a wait expired, without waiting.
+
+  @param[in]  Waiter            The waiter started by AhciWaiterStart ().
+
+  @retval TRUE                  The timeout expired.
+  @retval FALSE                 The wait is infinite or the timeout did not expire.
+
+**/
+BOOLEAN
+AhciWaiterExpired (
+  IN AHCI_WAITER                *Waiter
+  )
+{
+  return (BOOLEAN) ((Waiter->Timeout != 0) && (AhciWaiterElapsed (Waiter) >= Waiter->Timeout));
+}
+
+/**
+  Wait before checking the condition again.
+
+  The condition is checked back-to-back for the first AHCI_WAIT_SPIN_TIME ns,
+  which is where fast devices complete. After that the stall between checks
+  grows exponentially up to AHCI_WAIT_MAX_INTERVAL us.
+
+  @param[in, out] Waiter        The waiter started by AhciWaiterStart ().
+
+  @retval TRUE                  The condition can be checked again.
+  @retval FALSE                 The timeout expired.
+
+**/
+STATIC
+BOOLEAN
+AhciWaiterNext (
+  IN OUT AHCI_WAITER            *Waiter
+  )
+{
+  UINT64     Elapsed;
+
+  Elapsed = AhciWaiterElapsed (Waiter);
+
+  if ((Waiter->Timeout != 0) && (Elapsed >= Waiter->Timeout)) {
+    return FALSE;
+  }
+
+  if (Elapsed < AHCI_WAIT_SPIN_TIME) {
+    return TRUE;
+  }
+
+  if (Waiter->Interval == 0) {
+    Waiter->Interval = 1;
+  } else if (Waiter->Interval < AHCI_WAIT_MAX_INTERVAL) {
+    Waiter->Interval = MIN (Waiter->Interval * 2, AHCI_WAIT_MAX_INTERVAL);
+  }
+
+  MicroSecondDelay (Waiter->Interval);
+  return TRUE;
+}
+
 /**
   Wait for the value of the specified MMIO register set to the test value.
 
@@ -134,17 +237,10 @@ AhciWaitMmioSet (
   IN  UINT64                    Timeout
   )
 {
-  UINT32     Value;
-  UINT64     Delay;
-  BOOLEAN    InfiniteWait;
+  UINT32       Value;
+  AHCI_WAITER  Waiter;
 
-  if (Timeout == 0) {
-    InfiniteWait = TRUE;
-  } else {
-    InfiniteWait = FALSE;
-  }
-
-  Delay = DivU64x32 (Timeout, 1000) + 1;
+  AhciWaiterStart (&Waiter, Timeout);
 
   do {
     //
@@ -155,15 +251,7 @@ AhciWaitMmioSet (
     if (Value == TestValue) {
       return EFI_SUCCESS;
     }
-
-    //
-    // Stall for 100 microseconds.
-    //
-    MicroSecondDelay (100);
-
-    Delay--;
-
-  } while (InfiniteWait || (Delay > 0));
+  } while (AhciWaiterNext (&Waiter));
 
   return EFI_TIMEOUT;
 }
@@ -189,17 +277,10 @@ AhciWaitMemSet (
   IN  UINT64                    Timeout
   )
 {
-  UINT32     Value;
-  UINT64     Delay;
-  BOOLEAN    InfiniteWait;
+  UINT32       Value;
+  AHCI_WAITER  Waiter;
 
-  if (Timeout == 0) {
-    InfiniteWait = TRUE;
-  } else {
-    InfiniteWait = FALSE;
-  }
-
-  Delay =  DivU64x32 (Timeout, 1000) + 1;
+  AhciWaiterStart (&Waiter, Timeout);
 
   do {
     //
@@ -216,15 +297,7 @@ AhciWaitMemSet (
     if (Value == TestValue) {
       return EFI_SUCCESS;
     }
-
-    //
-    // Stall for 100 microseconds.
-    //
-    MicroSecondDelay (100);
-
-    Delay--;
-
-  } while (InfiniteWait || (Delay > 0));
+  } while (AhciWaiterNext (&Waiter));
 
   return EFI_TIMEOUT;
 }
@@ -480,10 +553,10 @@ AhciBuildCommand (
 
   //
   // According to AHCI 1.3 spec, a PRDT entry can point to a maximum 4MB data block.
-  // It also limits that the maximum amount of the PRDT entry in the command table
-  // is 65535.
+  // The command table is allocated for AHCI_MAX_PRDT entries, the transfer
+  // functions reject anything larger.
   //
-  ASSERT (PrdtNumber <= 65535);
+  ASSERT (PrdtNumber <= AHCI_MAX_PRDT);
 
   Data64.Uint64 = (UINTN) (AhciRegisters->AhciRFis) + sizeof (EFI_AHCI_RECEIVED_FIS) * Port;
 
@@ -491,7 +564,11 @@ AhciBuildCommand (
 
   ZeroMem ((VOID *)((UINTN) BaseAddr), sizeof (EFI_AHCI_RECEIVED_FIS));
 
-  ZeroMem (AhciRegisters->AhciCommandTable, sizeof (EFI_AHCI_COMMAND_TABLE));
+  //
+  // Only clear the entries used by this command, the table lives in
+  // uncached memory.
+  //
+  ZeroMem (AhciRegisters->AhciCommandTable, AHCI_COMMAND_TABLE_SIZE (PrdtNumber));
 
   CommandFis->AhciCFisPmNum = PortMultiplier;
 
@@ -607,7 +684,7 @@ AhciWaitDeviceReady (
   IN UINT8                Port
    )
 {
-  UINT32      PhyDetectDelay;
+  AHCI_WAITER Waiter;
   UINT32      Data;
   UINT32      Offset;
 
@@ -615,7 +692,7 @@ AhciWaitDeviceReady (
   // According to SATA1.0a spec section 5.2, we need to wait for PxTFD.BSY and PxTFD.DRQ
   // and PxTFD.ERR to be zero. The maximum wait time is 16s which is defined at ATA spec.
   //
-  PhyDetectDelay = 16 * 1000;
+  AhciWaiterStart (&Waiter, EFI_TIMER_PERIOD_SECONDS (16));
   do {
     Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SERR;
     if (AhciReadReg(AhciBaseAddress, Offset) != 0) {
@@ -625,19 +702,12 @@ AhciWaitDeviceReady (
 
     Data = AhciReadReg (AhciBaseAddress, Offset) & EFI_AHCI_PORT_TFD_MASK;
     if (Data == 0) {
-      break;
+      return EFI_SUCCESS;
     }
+  } while (AhciWaiterNext (&Waiter));
 
-    MicroSecondDelay (1000);
-    PhyDetectDelay--;
-  } while (PhyDetectDelay > 0);
-
-  if (PhyDetectDelay == 0) {
-    DEBUG ((DEBUG_ERROR, "Port %d Device not ready (TFD=0x%X)\n", Port, Data));
-    return EFI_TIMEOUT;
-  } else {
-    return EFI_SUCCESS;
-  }
+  DEBUG ((DEBUG_ERROR, "Port %d Device not ready (TFD=0x%X)\n", Port, Data));
+  return EFI_TIMEOUT;
 }
 
 
@@ -804,28 +874,17 @@ AhciWaitUntilFisReceived (
   IN SATA_FIS_TYPE        FisType
   )
 {
-  EFI_STATUS  Status;
-  BOOLEAN     InfiniteWait;
-  UINT64      Delay;
+  EFI_STATUS   Status;
+  AHCI_WAITER  Waiter;
 
-  Delay =  DivU64x32 (Timeout, 1000) + 1;
-  if (Timeout == 0) {
-    InfiniteWait = TRUE;
-  } else {
-    InfiniteWait = FALSE;
-  }
+  AhciWaiterStart (&Waiter, Timeout);
 
   do {
     Status = AhciCheckFisReceived (AhciBaseAddress, Port, FisType);
     if (Status != EFI_NOT_READY) {
       return Status;
     }
-    //
-    // Stall for 100 microseconds.
-    //
-    MicroSecondDelay (100);
-    Delay--;
-  } while (InfiniteWait || (Delay > 0));
+  } while (AhciWaiterNext (&Waiter));
 
   return EFI_TIMEOUT;
 }
@@ -931,6 +990,10 @@ AhciPioTransfer (
   UINT32                        PrdCount;
   UINT32                        Retry;
 
+  if (DataCount > AHCI_MAX_TRANSFER_SIZE) {
+    return EFI_BAD_BUFFER_SIZE;
+  }
+
   if (Read) {
     Flag = MapOperationBusMasterWrite;
   } else {
@@ -941,7 +1004,7 @@ AhciPioTransfer (
   // construct command list and command table with pci bus address
   //
   MapLength = DataCount;
-  Status = DmaMap (
+  Status = DmaBufferMap (
                     Flag,
                     MemoryAddr,
                     &MapLength,
@@ -1027,7 +1090,7 @@ AhciPioTransfer (
     Timeout
     );
 
-  DmaUnmap ( Map );
+  DmaBufferUnmap (Map);
 
   AhciDumpPortStatus (AhciBaseAddress, AhciRegisters, Port, AtaStatusBlock);
 
@@ -1108,6 +1171,10 @@ AhciDmaTransfer (
     return EFI_INVALID_PARAMETER;
   }
 
+  if (DataCount > AHCI_MAX_TRANSFER_SIZE) {
+    return EFI_BAD_BUFFER_SIZE;
+  }
+
   //
   // Set Status to suppress incorrect compiler/analyzer warnings
   //
@@ -1125,7 +1192,7 @@ AhciDmaTransfer (
     }
 
     MapLength = DataCount;
-    Status = DmaMap (
+    Status = DmaBufferMap (
                       Flag,
                       MemoryAddr,
                       &MapLength,
@@ -1157,7 +1224,7 @@ AhciDmaTransfer (
     // Delay 100us to simulate the blocking time out checking.
     //
     OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
-    while (!IsListEmpty (&Instance->NonBlockingTaskList)) {
+    while (AtaPassThruTasksPending (Instance)) {
       AsyncNonBlockingTransferRoutine (NULL, Instance);
       //
       // Stall for 100us.
@@ -1233,13 +1300,13 @@ AhciDmaTransfer (
     if (Task->IsStart) {
       Status = AhciCheckFisReceived (AhciBaseAddress, Port, SataFisD2H);
       if (Status == EFI_DEVICE_ERROR) {
-        DEBUG ((DEBUG_ERROR, "DMA command failed at retry: %d\n", Task->RetryTimes));
+        DEBUG ((DEBUG_ERROR, "DMA command failed on port %d\n", Port));
         Status = AhciRecoverPortError (AhciBaseAddress, Port);
         //
         // If recovery passed mark the Task as not started and change the status
         // to EFI_NOT_READY. This will make the higher level call this function again
-        // and on next call the command will be re-issued due to IsStart being FALSE.
-        // This also makes the next condition decrement the RetryTimes.
+        // and on next call the command will be re-issued due to IsStart being FALSE,
+        // until the timeout of the task expires.
         //
         if (Status == EFI_SUCCESS) {
           Task->IsStart = FALSE;
@@ -1247,12 +1314,8 @@ AhciDmaTransfer (
         }
       }
 
-      if (Status == EFI_NOT_READY) {
-        if (!Task->InfiniteWait && Task->RetryTimes == 0) {
-          Status = EFI_TIMEOUT;
-        } else {
-          Task->RetryTimes--;
-        }
+      if ((Status == EFI_NOT_READY) && AhciWaiterExpired (&Task->Waiter)) {
+        Status = EFI_TIMEOUT;
       }
     }
   }
@@ -1279,9 +1342,10 @@ AhciDmaTransfer (
       Timeout
       );
 
-    DmaUnmap ((Task != NULL) ? Task->Map : Map);
+    DmaBufferUnmap ((Task != NULL) ? Task->Map : Map);
 
     if (Task != NULL) {
+      Task->Map = NULL;
       Task->Packet->Asb->AtaStatus = 0x01;
     }
   }
@@ -2005,6 +2069,94 @@ AhciDeviceSetFeature (
   return Status;
 }
 
+/**
+  Deallocate a range of logical blocks with DATA SET MANAGEMENT (TRIM).
+
+  The range is split into entries of up to 65535 blocks, packed 64 to a
+  512-byte payload block, and sent in commands carrying as many payload
+  blocks as the device accepts (IDENTIFY word 105).
+
+  @param  Instance            A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+  @param  Port                The number of port.
+  @param  PortMultiplier      The port multiplier port number.
+  @param  IdentifyData        The IDENTIFY data of the device.
+  @param  Lba                 The first logical block to deallocate.
+  @param  BlockCount          The number of logical blocks to deallocate.
+
+  @retval EFI_SUCCESS         The blocks were deallocated.
+  @retval EFI_OUT_OF_RESOURCES The payload could not be allocated.
+  @retval Others              The DATA SET MANAGEMENT command failed.
+
+**/
+EFI_STATUS
+EFIAPI
+AhciTrimBlocks (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE     *Instance,
+  IN UINT16                           Port,
+  IN UINT16                           PortMultiplier,
+  IN EFI_IDENTIFY_DATA                *IdentifyData,
+  IN EFI_LBA                          Lba,
+  IN UINT64                           BlockCount
+  )
+{
+  EFI_STATUS                          Status;
+  EFI_ATA_PASS_THRU_COMMAND_PACKET    Packet;
+  EFI_ATA_COMMAND_BLOCK               AtaCommandBlock;
+  EFI_ATA_STATUS_BLOCK                AtaStatusBlock;
+  UINT64                              *Payload;
+  UINT32                              PayloadBlocks;
+  UINT32                              UsedBlocks;
+  UINT32                              Index;
+  UINT64                              Length;
+
+  PayloadBlocks = ((UINT16 *) IdentifyData)[AHCI_IDENTIFY_DSM_MAX_BLOCKS];
+  PayloadBlocks = MIN (MAX (PayloadBlocks, 1), AHCI_DSM_MAX_PAYLOAD_BLOCKS);
+
+  Payload = AllocatePages (EFI_SIZE_TO_PAGES (PayloadBlocks * AHCI_DSM_BLOCK_SIZE));
+  if (Payload == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = EFI_SUCCESS;
+  while (BlockCount > 0) {
+    ZeroMem (Payload, PayloadBlocks * AHCI_DSM_BLOCK_SIZE);
+    for (Index = 0; (Index < PayloadBlocks * AHCI_DSM_RANGES_PER_BLOCK) && (BlockCount > 0); Index++) {
+      Length          = MIN (BlockCount, AHCI_DSM_MAX_RANGE_LENGTH);
+      Payload[Index]  = Lba | LShiftU64 (Length, 48);
+      Lba            += Length;
+      BlockCount     -= Length;
+    }
+    UsedBlocks = (Index + AHCI_DSM_RANGES_PER_BLOCK - 1) / AHCI_DSM_RANGES_PER_BLOCK;
+
+    ZeroMem (&AtaCommandBlock, sizeof (EFI_ATA_COMMAND_BLOCK));
+    ZeroMem (&AtaStatusBlock, sizeof (EFI_ATA_STATUS_BLOCK));
+
+    AtaCommandBlock.AtaCommand        = AHCI_ATA_CMD_DATA_SET_MANAGEMENT;
+    AtaCommandBlock.AtaFeatures       = AHCI_DSM_TRIM;
+    AtaCommandBlock.AtaSectorCount    = (UINT8) UsedBlocks;
+    AtaCommandBlock.AtaSectorCountExp = (UINT8) (UsedBlocks >> 8);
+    AtaCommandBlock.AtaDeviceHead     = BIT6;
+
+    ZeroMem (&Packet, sizeof (EFI_ATA_PASS_THRU_COMMAND_PACKET));
+    Packet.Asb               = &AtaStatusBlock;
+    Packet.Acb               = &AtaCommandBlock;
+    Packet.Timeout           = AHCI_DSM_TIMEOUT;
+    Packet.OutDataBuffer     = Payload;
+    Packet.OutTransferLength = UsedBlocks * AHCI_DSM_BLOCK_SIZE;
+    Packet.Protocol          = EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_OUT;
+    Packet.Length            = EFI_ATA_PASS_THRU_LENGTH_BYTES;
+
+    Status = AtaPassThruPassThruExecute (Port, PortMultiplier, &Packet, Instance, NULL);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "TRIM failed on port [%d] - %r\n", Port, Status));
+      break;
+    }
+  }
+
+  FreePages (Payload, EFI_SIZE_TO_PAGES (PayloadBlocks * AHCI_DSM_BLOCK_SIZE));
+  return Status;
+}
+
 /**
   This function is used to send out ATAPI commands conforms to the Packet Command
   with PIO Protocol.
@@ -2243,10 +2395,11 @@ AhciCreateTransferDescriptor (
 
   //
   // Allocate memory for command table
-  // According to AHCI 1.3 spec, a PRD table can contain maximum 65535 entries.
+  // According to AHCI 1.3 spec, a PRD table can contain maximum 65535 entries,
+  // but no command moves more than AHCI_MAX_TRANSFER_SIZE bytes.
   //
   Buffer = NULL;
-  MaxCommandTableSize = sizeof (EFI_AHCI_COMMAND_TABLE);
+  MaxCommandTableSize = AHCI_COMMAND_TABLE_SIZE (AHCI_MAX_PRDT);
 
   Status = DmaAllocateBuffer (
                     EfiBootServicesData,
@@ -2292,6 +2445,7 @@ AhciCreateTransferDescriptor (
     goto Error1;
   }
   AhciRegisters->AhciCommandTablePciAddr = (EFI_AHCI_COMMAND_TABLE *)(UINTN)AhciCommandTablePciAddr;
+  AhciRegisters->MaxCommandSlots         = MaxCommandSlotNumber;
 
   return EFI_SUCCESS;
   //
@@ -2389,6 +2543,455 @@ AhciReadLogExt (
            );
 }
 
+/**
+  Allocate the per-slot command tables used by queued commands. Without
+  them the controller still works, one command at a time.
+
+  @param  AhciRegisters         The pointer to the EFI_AHCI_REGISTERS.
+  @param  Support64Bit          Whether the HBA supports 64-bit addressing.
+
+  @retval EFI_SUCCESS           The tables are allocated.
+  @retval EFI_OUT_OF_RESOURCES  The tables could not be allocated.
+
+**/
+STATIC
+EFI_STATUS
+AhciCreateNcqDescriptor (
+  IN OUT EFI_AHCI_REGISTERS     *AhciRegisters,
+  IN     BOOLEAN                Support64Bit
+  )
+{
+  EFI_STATUS            Status;
+  UINTN                 Bytes;
+  VOID                  *Buffer;
+  UINT64                MaxNcqTableSize;
+  EFI_PHYSICAL_ADDRESS  AhciNcqTablePciAddr;
+
+  MaxNcqTableSize = AhciRegisters->MaxCommandSlots * sizeof (EFI_AHCI_NCQ_COMMAND_TABLE);
+  Status = DmaAllocateBuffer (
+             EfiBootServicesData,
+             EFI_SIZE_TO_PAGES ((UINTN) MaxNcqTableSize),
+             &Buffer
+             );
+  if (EFI_ERROR (Status)) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  ZeroMem (Buffer, (UINTN) MaxNcqTableSize);
+
+  Bytes  = (UINTN) MaxNcqTableSize;
+  Status = DmaMap (
+             MapOperationBusMasterCommonBuffer,
+             Buffer,
+             &Bytes,
+             &AhciNcqTablePciAddr,
+             &AhciRegisters->MapNcqTable
+             );
+  if (EFI_ERROR (Status) || (Bytes != MaxNcqTableSize)) {
+    DmaFreeBuffer (EFI_SIZE_TO_PAGES ((UINTN) MaxNcqTableSize), Buffer);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  if ((!Support64Bit) && (AhciNcqTablePciAddr > 0x100000000ULL)) {
+    DmaUnmap (AhciRegisters->MapNcqTable);
+    DmaFreeBuffer (EFI_SIZE_TO_PAGES ((UINTN) MaxNcqTableSize), Buffer);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  AhciRegisters->AhciNcqTable        = Buffer;
+  AhciRegisters->AhciNcqTablePciAddr = (EFI_AHCI_NCQ_COMMAND_TABLE *)(UINTN) AhciNcqTablePciAddr;
+  AhciRegisters->MaxNcqTableSize     = MaxNcqTableSize;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Start the command engine of a port for queued commands.
+
+  @param  AhciBaseAddress     The AHCI base address.
+  @param  Port                The number of port.
+
+**/
+STATIC
+VOID
+AhciNcqStartPort (
+  IN UINT32                     AhciBaseAddress,
+  IN UINT8                      Port
+  )
+{
+  UINT32     Offset;
+  UINT32     PortTfd;
+
+  AhciClearPortStatus (AhciBaseAddress, Port);
+  AhciEnableFisReceive (AhciBaseAddress, Port, ATA_ATAPI_TIMEOUT);
+
+  Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CMD;
+  AhciAndReg (AhciBaseAddress, Offset, (UINT32)~(EFI_AHCI_PORT_CMD_DLAE | EFI_AHCI_PORT_CMD_ATAPI));
+
+  Offset  = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_TFD;
+  PortTfd = AhciReadReg (AhciBaseAddress, Offset);
+  if (((PortTfd & (EFI_AHCI_PORT_TFD_BSY | EFI_AHCI_PORT_TFD_DRQ)) != 0) &&
+      ((AhciReadReg (AhciBaseAddress, EFI_AHCI_CAPABILITY_OFFSET) & BIT24) != 0)) {
+    Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CMD;
+    AhciOrReg (AhciBaseAddress, Offset, EFI_AHCI_PORT_CMD_CLO);
+    AhciWaitMmioSet (AhciBaseAddress, Offset, EFI_AHCI_PORT_CMD_CLO, 0, ATA_ATAPI_TIMEOUT);
+  }
+
+  Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CMD;
+  AhciOrReg (AhciBaseAddress, Offset, EFI_AHCI_PORT_CMD_ST);
+}
+
+/**
+  Stop the command engine of the queuing port once no command is left.
+
+  @param  AhciBaseAddress     The AHCI base address.
+  @param  AhciRegisters       The pointer to the EFI_AHCI_REGISTERS.
+
+**/
+STATIC
+VOID
+AhciNcqStopPort (
+  IN UINT32                     AhciBaseAddress,
+  IN EFI_AHCI_REGISTERS         *AhciRegisters
+  )
+{
+  AhciStopCommand (AhciBaseAddress, AhciRegisters->NcqPort, ATA_ATAPI_TIMEOUT);
+  AhciDisableFisReceive (AhciBaseAddress, AhciRegisters->NcqPort, ATA_ATAPI_TIMEOUT);
+}
+
+/**
+  Release the DMA mappings of the given slots.
+
+  @param  AhciRegisters       The pointer to the EFI_AHCI_REGISTERS.
+  @param  Slots               Bitmap of the slots.
+
+**/
+STATIC
+VOID
+AhciNcqReleaseSlots (
+  IN EFI_AHCI_REGISTERS         *AhciRegisters,
+  IN UINT32                     Slots
+  )
+{
+  UINT8      Slot;
+
+  for (Slot = 0; Slot < AHCI_MAX_COMMAND_SLOTS; Slot++) {
+    if ((Slots & (((UINT32) BIT0) << Slot)) != 0) {
+      DmaBufferUnmap (AhciRegisters->NcqSlot[Slot].Map);
+      AhciRegisters->NcqSlot[Slot].Map = NULL;
+    }
+  }
+
+  AhciRegisters->NcqActive &= ~Slots;
+}
+
+/**
+  Queue a READ/WRITE DMA EXT command as a READ/WRITE FPDMA QUEUED command
+  in a free command slot of the port.
+
+  @param[in]       AhciBaseAddress     The AHCI base address.
+  @param[in]       AhciRegisters       The pointer to the EFI_AHCI_REGISTERS.
+  @param[in]       Port                The number of port.
+  @param[in]       PortMultiplier      The number of port multiplier.
+  @param[in]       Read                The transfer direction.
+  @param[in]       AtaCommandBlock     The READ/WRITE DMA EXT command block.
+  @param[in, out]  AtaStatusBlock      Receives the status on completion.
+  @param[in, out]  MemoryAddr          The pointer to the data buffer.
+  @param[in]       DataCount           The data count to be transferred.
+  @param[in]       Context             Returned with the slot on completion.
+
+  @retval EFI_SUCCESS           The command was queued.
+  @retval EFI_NOT_READY         No slot is free, or another port is queuing.
+  @retval EFI_UNSUPPORTED       The device on the port can't queue commands.
+  @retval EFI_BAD_BUFFER_SIZE   The buffer could not be mapped.
+
+**/
+EFI_STATUS
+AhciNcqSubmit (
+  IN     UINT32                     AhciBaseAddress,
+  IN     EFI_AHCI_REGISTERS         *AhciRegisters,
+  IN     UINT8                      Port,
+  IN     UINT8                      PortMultiplier,
+  IN     BOOLEAN                    Read,
+  IN     EFI_ATA_COMMAND_BLOCK      *AtaCommandBlock,
+  IN OUT EFI_ATA_STATUS_BLOCK       *AtaStatusBlock,
+  IN OUT VOID                       *MemoryAddr,
+  IN     UINT32                     DataCount,
+  IN     VOID                       *Context
+  )
+{
+  EFI_STATUS                    Status;
+  EFI_AHCI_NCQ_COMMAND_TABLE    *Table;
+  EFI_AHCI_COMMAND_LIST         *CmdList;
+  EFI_AHCI_COMMAND_FIS          *CmdFis;
+  EFI_PHYSICAL_ADDRESS          PhyAddr;
+  VOID                          *Map;
+  UINTN                         MapLength;
+  UINT32                        FreeSlots;
+  UINT32                        SlotBit;
+  UINT32                        PrdtNumber;
+  UINT32                        PrdtIndex;
+  UINT32                        Offset;
+  UINTN                         RemainedData;
+  DATA_64                       Data64;
+  UINT8                         Slot;
+
+  if ((AhciRegisters->AhciNcqTable == NULL) || (AhciRegisters->NcqDepth[Port] == 0)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  if (DataCount > AHCI_MAX_TRANSFER_SIZE) {
+    return EFI_BAD_BUFFER_SIZE;
+  }
+
+  if ((AhciRegisters->NcqActive != 0) && (AhciRegisters->NcqPort != Port)) {
+    return EFI_NOT_READY;
+  }
+
+  //
+  // The tag of a queued command is its slot number, so only the first
+  // NcqDepth slots can be used.
+  //
+  FreeSlots = ~AhciRegisters->NcqActive;
+  if (AhciRegisters->NcqDepth[Port] < AHCI_MAX_COMMAND_SLOTS) {
+    FreeSlots &= (((UINT32) BIT0) << AhciRegisters->NcqDepth[Port]) - 1;
+  }
+  if (FreeSlots == 0) {
+    return EFI_NOT_READY;
+  }
+  Slot    = (UINT8) LowBitSet32 (FreeSlots);
+  SlotBit = ((UINT32) BIT0) << Slot;
+
+  MapLength = DataCount;
+  Status = DmaBufferMap (
+             Read ? MapOperationBusMasterWrite : MapOperationBusMasterRead,
+             MemoryAddr,
+             &MapLength,
+             &PhyAddr,
+             &Map
+             );
+  if (EFI_ERROR (Status) || (MapLength != DataCount)) {
+    return EFI_BAD_BUFFER_SIZE;
+  }
+
+  if (AhciRegisters->NcqActive == 0) {
+    AhciRegisters->NcqPort = Port;
+    AhciNcqStartPort (AhciBaseAddress, Port);
+  }
+
+  //
+  // FPDMA QUEUED takes the sector count in the feature registers and the
+  // tag in bits 7:3 of the sector count register.
+  //
+  Table  = &AhciRegisters->AhciNcqTable[Slot];
+  CmdFis = &Table->CommandFis;
+  ZeroMem (Table, sizeof (EFI_AHCI_NCQ_COMMAND_TABLE));
+
+  CmdFis->AhciCFisType       = EFI_AHCI_FIS_REGISTER_H2D;
+  CmdFis->AhciCFisCmdInd     = 0x1;
+  CmdFis->AhciCFisPmNum      = PortMultiplier;
+  CmdFis->AhciCFisCmd        = Read ? AHCI_ATA_CMD_READ_FPDMA_QUEUED : AHCI_ATA_CMD_WRITE_FPDMA_QUEUED;
+  CmdFis->AhciCFisFeature    = AtaCommandBlock->AtaSectorCount;
+  CmdFis->AhciCFisFeatureExp = AtaCommandBlock->AtaSectorCountExp;
+  CmdFis->AhciCFisSecNum     = AtaCommandBlock->AtaSectorNumber;
+  CmdFis->AhciCFisSecNumExp  = AtaCommandBlock->AtaSectorNumberExp;
+  CmdFis->AhciCFisClyLow     = AtaCommandBlock->AtaCylinderLow;
+  CmdFis->AhciCFisClyLowExp  = AtaCommandBlock->AtaCylinderLowExp;
+  CmdFis->AhciCFisClyHigh    = AtaCommandBlock->AtaCylinderHigh;
+  CmdFis->AhciCFisClyHighExp = AtaCommandBlock->AtaCylinderHighExp;
+  CmdFis->AhciCFisSecCount   = (UINT8) (Slot << 3);
+  CmdFis->AhciCFisDevHead    = BIT6;
+
+  PrdtNumber   = (UINT32) DivU64x32 ((UINT64) DataCount + EFI_AHCI_MAX_DATA_PER_PRDT - 1, EFI_AHCI_MAX_DATA_PER_PRDT);
+  ASSERT (PrdtNumber <= AHCI_MAX_PRDT);
+  RemainedData = DataCount;
+  for (PrdtIndex = 0; PrdtIndex < PrdtNumber; PrdtIndex++) {
+    Data64.Uint64 = PhyAddr + (UINT64) PrdtIndex * EFI_AHCI_MAX_DATA_PER_PRDT;
+    Table->PrdtTable[PrdtIndex].AhciPrdtDba  = Data64.Uint32.Lower32;
+    Table->PrdtTable[PrdtIndex].AhciPrdtDbau = Data64.Uint32.Upper32;
+    Table->PrdtTable[PrdtIndex].AhciPrdtDbc  = (UINT32) MIN (RemainedData, EFI_AHCI_MAX_DATA_PER_PRDT) - 1;
+    RemainedData -= MIN (RemainedData, EFI_AHCI_MAX_DATA_PER_PRDT);
+  }
+
+  CmdList = &AhciRegisters->AhciCmdList[Slot];
+  ZeroMem (CmdList, sizeof (EFI_AHCI_COMMAND_LIST));
+  CmdList->AhciCmdCfl   = EFI_AHCI_FIS_REGISTER_H2D_LENGTH / 4;
+  CmdList->AhciCmdW     = Read ? 0 : 1;
+  CmdList->AhciCmdPmp   = PortMultiplier;
+  CmdList->AhciCmdPrdtl = PrdtNumber;
+  Data64.Uint64 = (UINT64)(UINTN) &AhciRegisters->AhciNcqTablePciAddr[Slot];
+  CmdList->AhciCmdCtba  = Data64.Uint32.Lower32;
+  CmdList->AhciCmdCtbau = Data64.Uint32.Upper32;
+
+  AhciRegisters->NcqSlot[Slot].Map            = Map;
+  AhciRegisters->NcqSlot[Slot].AtaStatusBlock = AtaStatusBlock;
+  AhciRegisters->NcqSlot[Slot].Context        = Context;
+  AhciRegisters->NcqActive                   |= SlotBit;
+
+  //
+  // Write only the new bit: PxSACT and PxCI ignore zeroes, and a read-modify-write
+  // would set again the bit of a command that completed in between.
+  //
+  MemoryFence ();
+  Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SACT;
+  AhciWriteReg (AhciBaseAddress, Offset, SlotBit);
+  Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CI;
+  AhciWriteReg (AhciBaseAddress, Offset, SlotBit);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Collect the queued commands that finished. On a device error the port is
+  recovered and the NCQ error log tells which command failed, the others
+  were aborted by the device and can be queued again.
+
+  The slots reported keep their Context until they are reused.
+
+  @param[in]   AhciBaseAddress     The AHCI base address.
+  @param[in]   AhciRegisters       The pointer to the EFI_AHCI_REGISTERS.
+  @param[out]  Completed           Slots whose command completed successfully.
+  @param[out]  Failed              Slots whose command failed.
+  @param[out]  Aborted             Slots whose command was aborted and may be retried.
+
+**/
+VOID
+AhciNcqCollect (
+  IN     UINT32                     AhciBaseAddress,
+  IN     EFI_AHCI_REGISTERS         *AhciRegisters,
+  OUT    UINT32                     *Completed,
+  OUT    UINT32                     *Failed,
+  OUT    UINT32                     *Aborted
+  )
+{
+  EFI_STATUS                Status;
+  EFI_ATA_STATUS_BLOCK      *AtaStatusBlock;
+  UINT32                    Offset;
+  UINT32                    PortInterrupt;
+  UINT32                    SActive;
+  UINT32                    PortTfd;
+  UINT32                    Active;
+  UINT8                     Port;
+  UINT8                     Slot;
+  UINT8                     Log[512];
+
+  *Completed = 0;
+  *Failed    = 0;
+  *Aborted   = 0;
+
+  Active = AhciRegisters->NcqActive;
+  if (Active == 0) {
+    return;
+  }
+
+  Port   = AhciRegisters->NcqPort;
+  Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_IS;
+  PortInterrupt = AhciReadReg (AhciBaseAddress, Offset);
+
+  if ((PortInterrupt & EFI_AHCI_PORT_IS_ERROR_MASK) == 0) {
+    //
+    // Acknowledge the Set Device Bits FISes before sampling PxSACT, so that
+    // a completion arriving in between is seen on the next call.
+    //
+    AhciWriteReg (AhciBaseAddress, Offset, PortInterrupt);
+
+    Offset  = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SACT;
+    SActive = AhciReadReg (AhciBaseAddress, Offset);
+    *Completed = Active & ~SActive;
+    if (*Completed == 0) {
+      return;
+    }
+
+    Offset  = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_TFD;
+    PortTfd = AhciReadReg (AhciBaseAddress, Offset);
+    for (Slot = 0; Slot < AHCI_MAX_COMMAND_SLOTS; Slot++) {
+      if ((*Completed & (((UINT32) BIT0) << Slot)) != 0) {
+        AtaStatusBlock = AhciRegisters->NcqSlot[Slot].AtaStatusBlock;
+        ZeroMem (AtaStatusBlock, sizeof (EFI_ATA_STATUS_BLOCK));
+        AtaStatusBlock->AtaStatus = (UINT8) (PortTfd & ~EFI_AHCI_PORT_TFD_ERR);
+      }
+    }
+
+    AhciNcqReleaseSlots (AhciRegisters, *Completed);
+    if (AhciRegisters->NcqActive == 0) {
+      AhciNcqStopPort (AhciBaseAddress, AhciRegisters);
+    }
+    return;
+  }
+
+  //
+  // The device aborted every outstanding command. Recover the port as in
+  // AHCI 1.3.1 section 6.2.2.1, then ask the device which command failed.
+  //
+  DEBUG ((DEBUG_ERROR, "AHCI: queued command error on port %d, PxIS: %X\n", Port, PortInterrupt));
+  AhciRecoverPortError (AhciBaseAddress, Port);
+  AhciClearPortStatus (AhciBaseAddress, Port);
+  AhciNcqReleaseSlots (AhciRegisters, Active);
+  AhciNcqStopPort (AhciBaseAddress, AhciRegisters);
+
+  Status = AhciReadLogExt (AhciBaseAddress, AhciRegisters, Port, 0, Log, AHCI_NCQ_ERROR_LOG, 0);
+  if (EFI_ERROR (Status) || ((Log[0] & AHCI_NCQ_ERROR_LOG_NQ) != 0) ||
+      ((Active & (((UINT32) BIT0) << (Log[0] & AHCI_NCQ_ERROR_LOG_TAG_MASK))) == 0)) {
+    DEBUG ((DEBUG_ERROR, "AHCI: failed queued command unknown - %r\n", Status));
+    *Failed = Active;
+    return;
+  }
+
+  Slot = Log[0] & AHCI_NCQ_ERROR_LOG_TAG_MASK;
+  DEBUG ((DEBUG_ERROR, "AHCI: queued command %d failed, status %X error %X\n", Slot, Log[2], Log[3]));
+
+  AtaStatusBlock = AhciRegisters->NcqSlot[Slot].AtaStatusBlock;
+  ZeroMem (AtaStatusBlock, sizeof (EFI_ATA_STATUS_BLOCK));
+  AtaStatusBlock->AtaStatus = Log[2];
+  AtaStatusBlock->AtaError  = Log[3];
+
+  *Failed  = ((UINT32) BIT0) << Slot;
+  *Aborted = Active & ~*Failed;
+}
+
+/**
+  Abort all the queued commands, resetting the port if the device hangs.
+
+  @param[in]   AhciBaseAddress     The AHCI base address.
+  @param[in]   AhciRegisters       The pointer to the EFI_AHCI_REGISTERS.
+
+  @return The slots that were in flight.
+
+**/
+UINT32
+AhciNcqAbort (
+  IN     UINT32                     AhciBaseAddress,
+  IN     EFI_AHCI_REGISTERS         *AhciRegisters
+  )
+{
+  UINT32                    Active;
+  UINT32                    Offset;
+  EFI_STATUS                Status;
+
+  Active = AhciRegisters->NcqActive;
+  if (Active == 0) {
+    return 0;
+  }
+
+  Offset = EFI_AHCI_PORT_START + AhciRegisters->NcqPort * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CMD;
+  AhciAndReg (AhciBaseAddress, Offset, ~(UINT32)EFI_AHCI_PORT_CMD_ST);
+  Status = AhciWaitMmioSet (AhciBaseAddress, Offset, EFI_AHCI_PORT_CMD_CR, 0, ATA_ATAPI_TIMEOUT);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Ahci port %d is in hung state\n", AhciRegisters->NcqPort));
+  }
+
+  //
+  // The device keeps the aborted commands queued until it is reset
+  //
+  AhciResetPort (AhciBaseAddress, AhciRegisters->NcqPort);
+
+  AhciClearPortStatus (AhciBaseAddress, AhciRegisters->NcqPort);
+  AhciNcqReleaseSlots (AhciRegisters, Active);
+  AhciDisableFisReceive (AhciBaseAddress, AhciRegisters->NcqPort, ATA_ATAPI_TIMEOUT);
+
+  return Active;
+}
+
 /**
   Enable DEVSLP of the disk if supported.
 
@@ -2665,6 +3268,315 @@ AhciPuisEnable (
   return Status;
 }
 
+/**
+  Advance the link bring-up of a port as far as its current state allows.
+
+  The function never waits: it is called for every port from the 1ms loop of
+  AhciModeInitialization, so that the Phy detection, BSY clear and signature
+  waits of all ports overlap.
+
+  @param[in]      AhciBaseAddress  The AHCI base address.
+  @param[in]      Port             The port number.
+  @param[in, out] PortInit         The bring-up state of the port.
+
+  @retval TRUE                     The port is still waiting.
+  @retval FALSE                    The link is up or no device was found.
+
+**/
+STATIC
+BOOLEAN
+AhciPortInitPoll (
+  IN     UINT32                 AhciBaseAddress,
+  IN     UINT8                  Port,
+  IN OUT AHCI_PORT_INIT         *PortInit
+  )
+{
+  UINT32                        Offset;
+  UINT32                        Data;
+
+  while (TRUE) {
+    switch (PortInit->State) {
+      case AhciPortInitPhyDetect:
+        Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SSTS;
+        Data   = AhciReadReg (AhciBaseAddress, Offset) & EFI_AHCI_PORT_SSTS_DET_MASK;
+        if ((Data == EFI_AHCI_PORT_SSTS_DET_PCE) || (Data == EFI_AHCI_PORT_SSTS_DET)) {
+          PortInit->State   = AhciPortInitDeviceReady;
+          PortInit->Timeout = EFI_AHCI_BUS_DEVICE_READY_TIMEOUT;
+          continue;
+        }
+
+        if (PortInit->Timeout == 0) {
+          //
+          // No device detected at this port.
+          // Clear PxCMD.SUD for those ports at which there are no device present.
+          //
+          Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CMD;
+          AhciAndReg (AhciBaseAddress, Offset, (UINT32) ~(EFI_AHCI_PORT_CMD_SUD));
+          PortInit->State = AhciPortInitNone;
+          return FALSE;
+        }
+        break;
+
+      case AhciPortInitDeviceReady:
+        //
+        // According to SATA1.0a spec section 5.2, we need to wait for PxTFD.BSY and PxTFD.DRQ
+        // and PxTFD.ERR to be zero.
+        //
+        Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SERR;
+        Data   = AhciReadReg (AhciBaseAddress, Offset);
+        if (Data != 0) {
+          AhciWriteReg (AhciBaseAddress, Offset, Data);
+        }
+
+        Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_TFD;
+        Data   = AhciReadReg (AhciBaseAddress, Offset) & EFI_AHCI_PORT_TFD_MASK;
+        if (Data == 0) {
+          PortInit->State   = AhciPortInitSignature;
+          PortInit->Timeout = EFI_AHCI_BUS_DEVICE_READY_TIMEOUT;
+          continue;
+        }
+
+        if (PortInit->Timeout == 0) {
+          DEBUG ((DEBUG_ERROR, "Port %d Device not ready (TFD=0x%X)\n", Port, Data));
+          PortInit->State = AhciPortInitNone;
+          return FALSE;
+        }
+        break;
+
+      case AhciPortInitSignature:
+        //
+        // When the first D2H register FIS is received, the content of PxSIG register is updated.
+        //
+        Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SIG;
+        Data   = AhciReadReg (AhciBaseAddress, Offset);
+        if ((Data & 0x0000FFFF) == 0x00000101) {
+          PortInit->State = AhciPortInitLinkUp;
+          return FALSE;
+        }
+
+        if (PortInit->Timeout == 0) {
+          DEBUG ((DEBUG_ERROR, "Port %d no device signature (SIG=0x%X)\n", Port, Data));
+          PortInit->State = AhciPortInitNone;
+          return FALSE;
+        }
+        break;
+
+      default:
+        return FALSE;
+    }
+
+    PortInit->Timeout--;
+    return TRUE;
+  }
+}
+
+/**
+  Send IDENTIFY (PACKET) DEVICE to every port whose link is up, all at the
+  same time.
+
+  Each port gets its own command list and table for the command, and is
+  pointed back at the shared list afterwards. The ports that answered are
+  moved to AhciPortInitIdentified with their data in Identify, the others
+  stay in AhciPortInitLinkUp and are identified one at a time by the caller,
+  with the error recovery of AhciPioTransfer().
+
+  @param[in]      AhciBaseAddress  The AHCI base address.
+  @param[in]      AhciRegisters    The pointer to the EFI_AHCI_REGISTERS.
+  @param[in]      Support64Bit     Whether the HBA supports 64-bit addressing.
+  @param[in, out] PortInit         The bring-up state of the ports.
+  @param[out]     Identify         The IDENTIFY data of the ports.
+
+**/
+STATIC
+VOID
+AhciIdentifyPorts (
+  IN     UINT32                 AhciBaseAddress,
+  IN     EFI_AHCI_REGISTERS     *AhciRegisters,
+  IN     BOOLEAN                Support64Bit,
+  IN OUT AHCI_PORT_INIT         *PortInit,
+  OUT    EFI_IDENTIFY_DATA      *Identify
+  )
+{
+  EFI_STATUS                    Status;
+  EFI_ATA_COMMAND_BLOCK         AtaCommandBlock;
+  AHCI_PORT_IDENTIFY            *Area;
+  AHCI_WAITER                   Waiter;
+  EFI_PHYSICAL_ADDRESS          AreaPciAddr;
+  DATA_64                       Data64;
+  VOID                          *Buffer;
+  VOID                          *Map;
+  UINTN                         Bytes;
+  UINTN                         Pages;
+  UINTN                         Count;
+  UINTN                         Index;
+  UINT32                        Offset;
+  UINT32                        Data;
+  UINT8                         Port;
+  BOOLEAN                       Waiting;
+
+  Count = 0;
+  for (Port = 0; Port < EFI_AHCI_MAX_PORTS; Port++) {
+    if (PortInit[Port].State != AhciPortInitLinkUp) {
+      continue;
+    }
+
+    Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SIG;
+    Data   = AhciReadReg (AhciBaseAddress, Offset) & EFI_AHCI_ATAPI_SIG_MASK;
+    if ((Data == EFI_AHCI_ATAPI_DEVICE_SIG) || (Data == EFI_AHCI_ATA_DEVICE_SIG)) {
+      Count++;
+    } else {
+      PortInit[Port].State = AhciPortInitNone;
+    }
+  }
+
+  if (Count < 2) {
+    return;
+  }
+
+  Pages  = EFI_SIZE_TO_PAGES (Count * AHCI_PORT_IDENTIFY_SIZE);
+  Status = DmaAllocateBuffer (EfiBootServicesData, Pages, &Buffer);
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  ZeroMem (Buffer, EFI_PAGES_TO_SIZE (Pages));
+
+  Bytes  = EFI_PAGES_TO_SIZE (Pages);
+  Status = DmaMap (MapOperationBusMasterCommonBuffer, Buffer, &Bytes, &AreaPciAddr, &Map);
+  if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Pages))) {
+    if (!EFI_ERROR (Status)) {
+      DmaUnmap (Map);
+    }
+    DmaFreeBuffer (Pages, Buffer);
+    return;
+  }
+
+  if ((!Support64Bit) && (AreaPciAddr + Bytes > 0x100000000ULL)) {
+    goto Done;
+  }
+
+  //
+  // Build the command of every port in its own area and start it.
+  //
+  Index = 0;
+  for (Port = 0; Port < EFI_AHCI_MAX_PORTS; Port++) {
+    if (PortInit[Port].State != AhciPortInitLinkUp) {
+      continue;
+    }
+
+    Area          = (AHCI_PORT_IDENTIFY *) ((UINTN) Buffer + Index * AHCI_PORT_IDENTIFY_SIZE);
+    Data64.Uint64 = AreaPciAddr + Index * AHCI_PORT_IDENTIFY_SIZE;
+    Index++;
+
+    ZeroMem (&AtaCommandBlock, sizeof (EFI_ATA_COMMAND_BLOCK));
+    Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SIG;
+    if ((AhciReadReg (AhciBaseAddress, Offset) & EFI_AHCI_ATAPI_SIG_MASK) == EFI_AHCI_ATAPI_DEVICE_SIG) {
+      AtaCommandBlock.AtaCommand = ATA_CMD_IDENTIFY_DEVICE;
+    } else {
+      AtaCommandBlock.AtaCommand = ATA_CMD_IDENTIFY_DRIVE;
+    }
+    AtaCommandBlock.AtaSectorCount = 1;
+    AhciBuildCommandFis (&Area->CommandFis, &AtaCommandBlock);
+
+    Area->Prdt.AhciPrdtDba  = (UINT32) (Data64.Uint64 + OFFSET_OF (AHCI_PORT_IDENTIFY, Data));
+    Area->Prdt.AhciPrdtDbau = (UINT32) RShiftU64 (Data64.Uint64 + OFFSET_OF (AHCI_PORT_IDENTIFY, Data), 32);
+    Area->Prdt.AhciPrdtDbc  = sizeof (EFI_IDENTIFY_DATA) - 1;
+    Area->Prdt.AhciPrdtIoc  = 1;
+
+    Area->CmdList[0].AhciCmdCfl   = EFI_AHCI_FIS_REGISTER_H2D_LENGTH / 4;
+    Area->CmdList[0].AhciCmdPrdtl = 1;
+    Area->CmdList[0].AhciCmdCtba  = (UINT32) (Data64.Uint64 + OFFSET_OF (AHCI_PORT_IDENTIFY, CommandFis));
+    Area->CmdList[0].AhciCmdCtbau = (UINT32) RShiftU64 (Data64.Uint64 + OFFSET_OF (AHCI_PORT_IDENTIFY, CommandFis), 32);
+
+    ZeroMem ((UINT8 *) AhciRegisters->AhciRFis + sizeof (EFI_AHCI_RECEIVED_FIS) * Port, sizeof (EFI_AHCI_RECEIVED_FIS));
+
+    Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CLB;
+    AhciWriteReg (AhciBaseAddress, Offset, Data64.Uint32.Lower32);
+    Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CLBU;
+    AhciWriteReg (AhciBaseAddress, Offset, Data64.Uint32.Upper32);
+
+    Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CMD;
+    AhciAndReg (AhciBaseAddress, Offset, (UINT32)~(EFI_AHCI_PORT_CMD_DLAE | EFI_AHCI_PORT_CMD_ATAPI));
+
+    Status = AhciStartCommand (AhciBaseAddress, Port, 0, ATA_ATAPI_TIMEOUT);
+    if (!EFI_ERROR (Status)) {
+      PortInit[Port].State = AhciPortInitIdentify;
+    }
+  }
+
+  //
+  // Wait for all of them. A command that failed or timed out is retried
+  // by the caller.
+  //
+  AhciWaiterStart (&Waiter, ATA_ATAPI_TIMEOUT);
+  do {
+    Waiting = FALSE;
+    Index   = 0;
+    for (Port = 0; Port < EFI_AHCI_MAX_PORTS; Port++) {
+      if ((PortInit[Port].State != AhciPortInitLinkUp) &&
+          (PortInit[Port].State != AhciPortInitIdentify) &&
+          (PortInit[Port].State != AhciPortInitIdentified)) {
+        continue;
+      }
+
+      Area = (AHCI_PORT_IDENTIFY *) ((UINTN) Buffer + Index * AHCI_PORT_IDENTIFY_SIZE);
+      Index++;
+
+      if (PortInit[Port].State != AhciPortInitIdentify) {
+        continue;
+      }
+
+      Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_IS;
+      if ((AhciReadReg (AhciBaseAddress, Offset) & EFI_AHCI_PORT_IS_ERROR_MASK) != 0) {
+        PortInit[Port].State = AhciPortInitLinkUp;
+        continue;
+      }
+
+      Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CI;
+      if ((AhciReadReg (AhciBaseAddress, Offset) & BIT0) != 0) {
+        Waiting = TRUE;
+        continue;
+      }
+
+      Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_TFD;
+      Data   = AhciReadReg (AhciBaseAddress, Offset);
+      if (((Data & EFI_AHCI_PORT_TFD_ERR) == 0) &&
+          (*(volatile UINT32 *) &Area->CmdList[0].AhciCmdPrdbc == sizeof (EFI_IDENTIFY_DATA))) {
+        CopyMem (&Identify[Port], &Area->Data, sizeof (EFI_IDENTIFY_DATA));
+        PortInit[Port].State = AhciPortInitIdentified;
+      } else {
+        PortInit[Port].State = AhciPortInitLinkUp;
+      }
+    }
+  } while (Waiting && AhciWaiterNext (&Waiter));
+
+  //
+  // Stop the ports and give them back the shared command list.
+  //
+  for (Port = 0; Port < EFI_AHCI_MAX_PORTS; Port++) {
+    if (PortInit[Port].State == AhciPortInitIdentify) {
+      DEBUG ((DEBUG_WARN, "Port %d IDENTIFY timed out, retrying alone\n", Port));
+      PortInit[Port].State = AhciPortInitLinkUp;
+    } else if ((PortInit[Port].State != AhciPortInitLinkUp) &&
+               (PortInit[Port].State != AhciPortInitIdentified)) {
+      continue;
+    }
+
+    AhciStopCommand (AhciBaseAddress, Port, ATA_ATAPI_TIMEOUT);
+    AhciDisableFisReceive (AhciBaseAddress, Port, ATA_ATAPI_TIMEOUT);
+
+    Data64.Uint64 = (UINTN) (AhciRegisters->AhciCmdListPciAddr);
+    Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CLB;
+    AhciWriteReg (AhciBaseAddress, Offset, Data64.Uint32.Lower32);
+    Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CLBU;
+    AhciWriteReg (AhciBaseAddress, Offset, Data64.Uint32.Upper32);
+  }
+
+Done:
+  DmaUnmap (Map);
+  DmaFreeBuffer (Pages, Buffer);
+}
+
 /**
   Initialize ATA host controller at AHCI mode.
 
@@ -2695,7 +3607,9 @@ AhciModeInitialization (
   EFI_ATA_DEVICE_TYPE              DeviceType;
   EFI_ATA_COLLECTIVE_MODE          *SupportedModes;
   EFI_ATA_TRANSFER_MODE            TransferMode;
-  UINT32                           PhyDetectDelay;
+  AHCI_PORT_INIT                   PortInit[EFI_AHCI_MAX_PORTS];
+  EFI_IDENTIFY_DATA                *Identify;
+  BOOLEAN                          Waiting;
   UINT32                           Value;
   UINT32						   timeout;
 
@@ -2746,6 +3660,19 @@ AhciModeInitialization (
     return EFI_OUT_OF_RESOURCES;
   }
 
+  if ((Capability & EFI_AHCI_CAP_SNCQ) != 0) {
+    Status = AhciCreateNcqDescriptor (AhciRegisters, (BOOLEAN) ((Capability & EFI_AHCI_CAP_S64A) != 0));
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_WARN, "AHCI: no memory for queued commands, NCQ disabled\n"));
+    }
+  }
+
+  //
+  // Start the link of every implemented port first, then wait for all of them
+  // at once, so that the enumeration takes as long as the slowest device.
+  //
+  ZeroMem (PortInit, sizeof (PortInit));
+
   for (Port = 0; Port < EFI_AHCI_MAX_PORTS; Port ++) {
     if ((PortImplementBitMap & (((UINT32)BIT0) << Port)) != 0) {
       //
@@ -2756,7 +3683,7 @@ AhciModeInitialization (
         // Should never be here.
         //
         ASSERT (FALSE);
-        return EFI_SUCCESS;
+        break;
       }
 
       IdeInit->NotifyPhase (IdeInit, EfiIdeBeforeChannelEnumeration, Port);
@@ -2820,51 +3747,57 @@ AhciModeInitialization (
       //
       // Wait for the Phy to detect the presence of a device.
       //
-      PhyDetectDelay = EFI_AHCI_BUS_PHY_DETECT_TIMEOUT;
-      Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SSTS;
-      do {
-        Data = AhciReadReg (AhciBaseAddress, Offset) & EFI_AHCI_PORT_SSTS_DET_MASK;
-        if ((Data == EFI_AHCI_PORT_SSTS_DET_PCE) || (Data == EFI_AHCI_PORT_SSTS_DET)) {
-          break;
-        }
-
-        MicroSecondDelay (1000);
-        PhyDetectDelay--;
-      } while (PhyDetectDelay > 0);
+      PortInit[Port].State   = AhciPortInitPhyDetect;
+      PortInit[Port].Timeout = EFI_AHCI_BUS_PHY_DETECT_TIMEOUT;
+    }
+  }
 
-      if (PhyDetectDelay == 0) {
-        //
-        // No device detected at this port.
-        // Clear PxCMD.SUD for those ports at which there are no device present.
-        //
-        Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CMD;
-        AhciAndReg (AhciBaseAddress, Offset, (UINT32) ~(EFI_AHCI_PORT_CMD_SUD));
-        continue;
+  do {
+    Waiting = FALSE;
+    for (Port = 0; Port < EFI_AHCI_MAX_PORTS; Port ++) {
+      if (AhciPortInitPoll (AhciBaseAddress, Port, &PortInit[Port])) {
+        Waiting = TRUE;
       }
+    }
 
-      Status = AhciWaitDeviceReady (AhciBaseAddress, Port);
-      if (EFI_ERROR (Status)) {
-        continue;
-      }
+    if (Waiting) {
+      MicroSecondDelay (1000);
+    }
+  } while (Waiting);
 
-      //
-      // When the first D2H register FIS is received, the content of PxSIG register is updated.
-      //
+  //
+  // Identify all the devices at once, then configure them. The configuration
+  // goes through the command list shared by all ports, so it is done one
+  // port at a time.
+  //
+  Identify = AllocatePool (EFI_AHCI_MAX_PORTS * sizeof (EFI_IDENTIFY_DATA));
+  if (Identify != NULL) {
+    AhciIdentifyPorts (
+      AhciBaseAddress,
+      AhciRegisters,
+      (BOOLEAN) ((Capability & EFI_AHCI_CAP_S64A) != 0),
+      PortInit,
+      Identify
+      );
+  }
+
+  for (Port = 0; Port < EFI_AHCI_MAX_PORTS; Port ++) {
+    if ((PortInit[Port].State == AhciPortInitLinkUp) ||
+        (PortInit[Port].State == AhciPortInitIdentified)) {
       Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SIG;
-      Status = AhciWaitMmioSet (
-                 AhciBaseAddress,
-                 Offset,
-                 0x0000FFFF,
-                 0x00000101,
-                 EFI_TIMER_PERIOD_SECONDS(16)
-                 );
-      if (EFI_ERROR (Status)) {
+      Data = AhciReadReg (AhciBaseAddress, Offset);
+      if (PortInit[Port].State == AhciPortInitIdentified) {
+        CopyMem (&Buffer, &Identify[Port], sizeof (Buffer));
+        Status = EFI_SUCCESS;
+      } else if ((Data & EFI_AHCI_ATAPI_SIG_MASK) == EFI_AHCI_ATAPI_DEVICE_SIG) {
+        Status = AhciIdentifyPacket (AhciBaseAddress, AhciRegisters, Port, 0, &Buffer);
+      } else if ((Data & EFI_AHCI_ATAPI_SIG_MASK) == EFI_AHCI_ATA_DEVICE_SIG) {
+        Status = AhciIdentify (AhciBaseAddress, AhciRegisters, Port, 0, &Buffer);
+      } else {
         continue;
       }
 
-      Data = AhciReadReg (AhciBaseAddress, Offset);
       if ((Data & EFI_AHCI_ATAPI_SIG_MASK) == EFI_AHCI_ATAPI_DEVICE_SIG) {
-        Status = AhciIdentifyPacket (AhciBaseAddress, AhciRegisters, Port, 0, &Buffer);
 
         if (EFI_ERROR (Status)) {
           continue;
@@ -2872,8 +3805,6 @@ AhciModeInitialization (
 
         DeviceType = EfiIdeCdrom;
       } else if ((Data & EFI_AHCI_ATAPI_SIG_MASK) == EFI_AHCI_ATA_DEVICE_SIG) {
-        Status = AhciIdentify (AhciBaseAddress, AhciRegisters, Port, 0, &Buffer);
-
         if (EFI_ERROR (Status)) {
           REPORT_STATUS_CODE (EFI_PROGRESS_CODE, (EFI_PERIPHERAL_FIXED_MEDIA | EFI_P_EC_NOT_DETECTED));
           continue;
@@ -2972,6 +3903,19 @@ AhciModeInitialization (
         continue;
       }
 
+      //
+      // Queue READ/WRITE DMA EXT commands if both the HBA and the disk
+      // support NCQ. Word 75 holds the queue depth minus one.
+      //
+      if ((DeviceType == EfiIdeHarddisk) && (AhciRegisters->AhciNcqTable != NULL) &&
+          ((Buffer.AtaData.serial_ata_capabilities & BIT8) != 0)) {
+        AhciRegisters->NcqDepth[Port] = (UINT8) MIN (
+                                                  (Buffer.AtaData.queue_depth & 0x1F) + 1,
+                                                  AhciRegisters->MaxCommandSlots
+                                                  );
+        DEBUG ((DEBUG_INFO, "port [%d] NCQ queue depth %d\n", Port, AhciRegisters->NcqDepth[Port]));
+      }
+
       //
       // Found a ATA or ATAPI device, add it into the device list.
       //
@@ -3005,6 +3949,10 @@ AhciModeInitialization (
     }
   }
 
+  if (Identify != NULL) {
+    FreePool (Identify);
+  }
+
   return EFI_SUCCESS;
 }
 
@@ -13,6 +13,7 @@
 #define EFI_AHCI_CAPABILITY_OFFSET             0x0000
 #define   EFI_AHCI_CAP_SAM                     BIT18
 #define   EFI_AHCI_CAP_SSS                     BIT27
+#define   EFI_AHCI_CAP_SNCQ                    BIT30
 #define   EFI_AHCI_CAP_S64A                    BIT31
 #define EFI_AHCI_GHC_OFFSET                    0x0004
 #define   EFI_AHCI_GHC_RESET                   BIT0
@@ -27,6 +28,21 @@
 #define   AHCI_CAP2_SDS                        BIT3
 #define   AHCI_CAP2_SADM                       BIT4
 
+//
+// Polling policy of the AHCI wait helpers: spin on the condition for the
+// first AHCI_WAIT_SPIN_TIME ns, then stall between checks, doubling the
+// stall from 1us up to AHCI_WAIT_MAX_INTERVAL us.
+//
+#define AHCI_WAIT_SPIN_TIME                    10000
+#define AHCI_WAIT_MAX_INTERVAL                 100
+
+typedef struct {
+  UINT64  Start;              // Performance counter value at the start
+  UINT64  Timeout;            // In ns, 0 means infinite
+  UINT32  Interval;           // Current stall between checks in us
+  BOOLEAN CountUp;            // Direction of the performance counter
+} AHCI_WAITER;
+
 typedef struct {
   UINT32  Lower32;
   UINT32  Upper32;
@@ -43,6 +59,11 @@ typedef union {
 //
 #define  EFI_AHCI_BUS_PHY_DETECT_TIMEOUT       15
 //
+// Refer SATA1.0a spec section 5.2, the device may take up to 16s to clear BSY
+// and send its signature, in units of 1ms.
+//
+#define  EFI_AHCI_BUS_DEVICE_READY_TIMEOUT     16000
+//
 // Refer SATA1.0a spec, the FIS enable time should be less than 500ms.
 //
 #define  EFI_AHCI_PORT_CMD_FR_CLEAR_TIMEOUT    EFI_TIMER_PERIOD_MILLISECONDS(500)
@@ -194,6 +215,46 @@ typedef union {
 
 #define AHCI_COMMAND_RETRIES  5
 
+//
+// Native Command Queuing
+//
+#define AHCI_ATA_CMD_READ_FPDMA_QUEUED         0x60
+#define AHCI_ATA_CMD_WRITE_FPDMA_QUEUED        0x61
+#define AHCI_NCQ_ERROR_LOG                     0x10
+#define   AHCI_NCQ_ERROR_LOG_NQ                BIT7
+#define   AHCI_NCQ_ERROR_LOG_TAG_MASK          0x1F
+#define AHCI_MAX_COMMAND_SLOTS                 32
+
+//
+// DATA SET MANAGEMENT (TRIM). Each 512-byte payload block holds 64 ranges,
+// a 48-bit LBA with a 16-bit sector count in the upper bits.
+//
+#define AHCI_ATA_CMD_DATA_SET_MANAGEMENT       0x06
+#define   AHCI_DSM_TRIM                        BIT0
+#define AHCI_DSM_BLOCK_SIZE                    512
+#define AHCI_DSM_RANGES_PER_BLOCK              64
+#define AHCI_DSM_MAX_RANGE_LENGTH              0xFFFF
+#define AHCI_DSM_MAX_PAYLOAD_BLOCKS            8
+#define AHCI_DSM_TIMEOUT                       EFI_TIMER_PERIOD_SECONDS (30)
+
+//
+// IDENTIFY DEVICE words describing TRIM
+//
+#define AHCI_IDENTIFY_ADDITIONAL_SUPPORTED     69
+#define   AHCI_IDENTIFY_DRAT                   BIT14    // Deterministic read after TRIM
+#define   AHCI_IDENTIFY_RZAT                   BIT5     // Read zeroes after TRIM
+#define AHCI_IDENTIFY_DSM_MAX_BLOCKS           105
+#define AHCI_IDENTIFY_DSM_SUPPORTED            169
+#define   AHCI_IDENTIFY_DSM_TRIM               BIT0
+
+//
+// An ATA command moves at most 65536 sectors. With logical sectors of up to
+// 4KB that is 256MB, described by 64 PRDT entries of 4MB. Command tables are
+// allocated for that many entries instead of the 65535 the HBA allows.
+//
+#define AHCI_MAX_TRANSFER_SIZE                 (0x10000 * SIZE_4KB)
+#define AHCI_MAX_PRDT                          (AHCI_MAX_TRANSFER_SIZE / EFI_AHCI_MAX_DATA_PER_PRDT)
+
 #pragma pack(1)
 //
 // Command List structure includes total 32 entries.
@@ -252,6 +313,24 @@ typedef enum {
   SataFisDmaSetup
 } SATA_FIS_TYPE;
 
+//
+// Link bring-up state of a port during AhciModeInitialization
+//
+typedef enum {
+  AhciPortInitNone = 0,       // Not implemented, or no device was found
+  AhciPortInitPhyDetect,      // Waiting for the Phy to detect a device
+  AhciPortInitDeviceReady,    // Waiting for PxTFD.BSY/DRQ/ERR to clear
+  AhciPortInitSignature,      // Waiting for the first D2H FIS to update PxSIG
+  AhciPortInitLinkUp,         // Ready to be identified
+  AhciPortInitIdentify,       // IDENTIFY issued through the list of the port
+  AhciPortInitIdentified      // IDENTIFY data read, see AhciIdentifyPorts()
+} AHCI_PORT_INIT_STATE;
+
+typedef struct {
+  AHCI_PORT_INIT_STATE      State;
+  UINT32                    Timeout;          // Remaining time of the state in ms
+} AHCI_PORT_INIT;
+
 //
 // ACMD: ATAPI command (12 or 16 bytes)
 //
@@ -284,6 +363,41 @@ typedef struct {
   EFI_AHCI_COMMAND_PRDT     PrdtTable[65535];     // The scatter/gather list for data transfer
 } EFI_AHCI_COMMAND_TABLE;
 
+//
+// Size of a command table holding the given number of PRDT entries
+//
+#define AHCI_COMMAND_TABLE_SIZE(PrdtCount) \
+  (OFFSET_OF (EFI_AHCI_COMMAND_TABLE, PrdtTable) + (PrdtCount) * sizeof (EFI_AHCI_COMMAND_PRDT))
+
+//
+// Command table of a queued command. One of them exists per command slot.
+//
+typedef struct {
+  EFI_AHCI_COMMAND_FIS      CommandFis;
+  EFI_AHCI_ATAPI_COMMAND    AtapiCmd;
+  UINT8                     Reserved[0x30];
+  EFI_AHCI_COMMAND_PRDT     PrdtTable[AHCI_MAX_PRDT];
+} EFI_AHCI_NCQ_COMMAND_TABLE;
+
+//
+// Command list, command table and data of the IDENTIFY a port gets during
+// AhciModeInitialization. Every port has its own, so that the commands of
+// all ports run at the same time. The command table must be 128 byte aligned.
+//
+typedef struct {
+  EFI_AHCI_COMMAND_LIST     CmdList[AHCI_MAX_COMMAND_SLOTS];
+  EFI_AHCI_COMMAND_FIS      CommandFis;
+  EFI_AHCI_ATAPI_COMMAND    AtapiCmd;
+  UINT8                     Reserved[0x30];
+  EFI_AHCI_COMMAND_PRDT     Prdt;
+  EFI_IDENTIFY_DATA         Data;
+} AHCI_PORT_IDENTIFY;
+
+//
+// Stride of the AHCI_PORT_IDENTIFY areas, command lists are 1 KiB aligned
+//
+#define AHCI_PORT_IDENTIFY_SIZE    ALIGN_VALUE (sizeof (AHCI_PORT_IDENTIFY), SIZE_1KB)
+
 //
 // Received FIS structure
 //
@@ -310,6 +424,15 @@ typedef struct {
 
 #pragma pack()
 
+//
+// A queued command in flight
+//
+typedef struct {
+  VOID                      *Map;
+  EFI_ATA_STATUS_BLOCK      *AtaStatusBlock;
+  VOID                      *Context;
+} AHCI_NCQ_SLOT;
+
 typedef struct {
   EFI_AHCI_RECEIVED_FIS     *AhciRFis;
   EFI_AHCI_COMMAND_LIST     *AhciCmdList;
@@ -323,6 +446,21 @@ typedef struct {
   VOID                      *MapRFis;
   VOID                      *MapCmdList;
   VOID                      *MapCommandTable;
+
+  //
+  // Native Command Queuing. The command list is shared by all the ports, so
+  // queued commands run on one port at a time, and only while no other
+  // command is using the list.
+  //
+  EFI_AHCI_NCQ_COMMAND_TABLE *AhciNcqTable;
+  EFI_AHCI_NCQ_COMMAND_TABLE *AhciNcqTablePciAddr;
+  UINT64                    MaxNcqTableSize;
+  VOID                      *MapNcqTable;
+  UINT8                     MaxCommandSlots;
+  UINT8                     NcqDepth[EFI_AHCI_MAX_PORTS];   // 0 if the device can't queue
+  UINT8                     NcqPort;
+  UINT32                    NcqActive;                      // Bitmap of the slots in flight
+  AHCI_NCQ_SLOT             NcqSlot[AHCI_MAX_COMMAND_SLOTS];
 } EFI_AHCI_REGISTERS;
 
 /**
@@ -392,5 +530,106 @@ AhciStopCommand (
   IN  UINT64                    Timeout
   );
 
+/**
+  Start a wait with the given timeout.
+
+  @param[out] Waiter            The waiter to initialize.
+  @param[in]  Timeout           The time out value, uses 100ns as a unit.
+                                0 means infinite wait.
+
+**/
+VOID
+AhciWaiterStart (
+  OUT AHCI_WAITER               *Waiter,
+  IN  UINT64                    Timeout
+  );
+
+/**
+  Check whether the timeout of a wait expired, without waiting.
+
+  @param[in]  Waiter            The waiter started by AhciWaiterStart ().
+
+  @retval TRUE                  The timeout expired.
+  @retval FALSE                 The wait is infinite or the timeout did not expire.
+
+**/
+BOOLEAN
+AhciWaiterExpired (
+  IN AHCI_WAITER                *Waiter
+  );
+
+/**
+  Queue a READ/WRITE DMA EXT command as a READ/WRITE FPDMA QUEUED command
+  in a free command slot of the port.
+
+  @param[in]       AhciBaseAddress     The AHCI base address.
+  @param[in]       AhciRegisters       The pointer to the EFI_AHCI_REGISTERS.
+  @param[in]       Port                The number of port.
+  @param[in]       PortMultiplier      The number of port multiplier.
+  @param[in]       Read                The transfer direction.
+  @param[in]       AtaCommandBlock     The READ/WRITE DMA EXT command block.
+  @param[in, out]  AtaStatusBlock      Receives the status on completion.
+  @param[in, out]  MemoryAddr          The pointer to the data buffer.
+  @param[in]       DataCount           The data count to be transferred.
+  @param[in]       Context             Returned with the slot on completion.
+
+  @retval EFI_SUCCESS           The command was queued.
+  @retval EFI_NOT_READY         No slot is free, or another port is queuing.
+  @retval EFI_UNSUPPORTED       The device on the port can't queue commands.
+  @retval EFI_BAD_BUFFER_SIZE   The buffer could not be mapped.
+
+**/
+EFI_STATUS
+AhciNcqSubmit (
+  IN     UINT32                     AhciBaseAddress,
+  IN     EFI_AHCI_REGISTERS         *AhciRegisters,
+  IN     UINT8                      Port,
+  IN     UINT8                      PortMultiplier,
+  IN     BOOLEAN                    Read,
+  IN     EFI_ATA_COMMAND_BLOCK      *AtaCommandBlock,
+  IN OUT EFI_ATA_STATUS_BLOCK       *AtaStatusBlock,
+  IN OUT VOID                       *MemoryAddr,
+  IN     UINT32                     DataCount,
+  IN     VOID                       *Context
+  );
+
+/**
+  Collect the queued commands that finished. On a device error the port is
+  recovered and the NCQ error log tells which command failed, the others
+  were aborted by the device and can be queued again.
+
+  The slots reported keep their Context until they are reused.
+
+  @param[in]   AhciBaseAddress     The AHCI base address.
+  @param[in]   AhciRegisters       The pointer to the EFI_AHCI_REGISTERS.
+  @param[out]  Completed           Slots whose command completed successfully.
+  @param[out]  Failed              Slots whose command failed.
+  @param[out]  Aborted             Slots whose command was aborted and may be retried.
+
+**/
+VOID
+AhciNcqCollect (
+  IN     UINT32                     AhciBaseAddress,
+  IN     EFI_AHCI_REGISTERS         *AhciRegisters,
+  OUT    UINT32                     *Completed,
+  OUT    UINT32                     *Failed,
+  OUT    UINT32                     *Aborted
+  );
+
+/**
+  Abort all the queued commands, resetting the port if the device hangs.
+
+  @param[in]   AhciBaseAddress     The AHCI base address.
+  @param[in]   AhciRegisters       The pointer to the EFI_AHCI_REGISTERS.
+
+  @return The slots that were in flight.
+
+**/
+UINT32
+AhciNcqAbort (
+  IN     UINT32                     AhciBaseAddress,
+  IN     EFI_AHCI_REGISTERS         *AhciRegisters
+  );
+
 #endif
 
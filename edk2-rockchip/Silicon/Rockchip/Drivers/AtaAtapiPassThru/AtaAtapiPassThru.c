@@ -98,6 +98,16 @@ ATA_ATAPI_PASS_THRU_INSTANCE gAtaAtapiPassThruInstanceTemplate = {
   0,                  // PreviousLun
   NULL,               // Timer event
   {                   // NonBlocking TaskList
+    {
+      NULL,
+      NULL
+    }
+  },
+  0,                  // NonBlockingPort
+  0,                  // NcqBudget
+  NULL,               // BlockIo notify event
+  NULL,               // BlockIo notify registration
+  {                   // EraseBlock list
     NULL,
     NULL
   }
@@ -195,12 +205,27 @@ AtaPassThruPassThruExecute (
   EFI_ATA_PASS_THRU_CMD_PROTOCOL  Protocol;
   EFI_ATA_HC_WORK_MODE            Mode;
   EFI_STATUS                      Status;
+  EFI_TPL                         OldTpl;
 
   Protocol = Packet->Protocol;
 
   Mode = Instance->Mode;
   switch (Mode) {
     case EfiAtaAhciMode :
+      if (Task == NULL) {
+        //
+        // Blocking commands share the command list with the queued ones,
+        // wait for the device to complete them first.
+        // Delay 100us to simulate the blocking time out checking.
+        //
+        OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+        while (Instance->AhciRegisters.NcqActive != 0) {
+          AsyncNonBlockingTransferRoutine (NULL, Instance);
+          MicroSecondDelay (100);
+        }
+        gBS->RestoreTPL (OldTpl);
+      }
+
       if (PortMultiplierPort == 0xFFFF) {
         //
         // If there is no port multiplier, PortMultiplierPort will be 0xFFFF
@@ -305,6 +330,283 @@ AtaPassThruPassThruExecute (
   return Status;
 }
 
+/**
+  Check whether a non-blocking task can be sent as a queued command.
+
+  Only the READ/WRITE DMA EXT commands issued by the BlockIo2 path are
+  converted to FPDMA QUEUED, and only on ports without a port multiplier
+  whose disk reported NCQ support.
+
+  @param[in]  Instance  Pointer to the ATA_ATAPI_PASS_THRU_INSTANCE.
+  @param[in]  Task      Pointer to the ATA_NONBLOCK_TASK.
+
+  @retval TRUE          The task can be queued.
+  @retval FALSE         The task has to be executed on its own.
+
+**/
+STATIC
+BOOLEAN
+AtaPassThruIsNcqTask (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE *Instance,
+  IN ATA_NONBLOCK_TASK            *Task
+  )
+{
+  EFI_ATA_PASS_THRU_COMMAND_PACKET  *Packet;
+
+  Packet = Task->Packet;
+
+  if ((Instance->Mode != EfiAtaAhciMode) ||
+      (Task->Port >= EFI_AHCI_MAX_PORTS) ||
+      (Instance->AhciRegisters.NcqDepth[Task->Port] == 0)) {
+    return FALSE;
+  }
+
+  if ((Task->PortMultiplier != 0xFFFF) && (Task->PortMultiplier != 0)) {
+    return FALSE;
+  }
+
+  if (Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_IN) {
+    return (BOOLEAN) (Packet->Acb->AtaCommand == ATA_CMD_READ_DMA_EXT);
+  }
+
+  if (Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_OUT) {
+    return (BOOLEAN) (Packet->Acb->AtaCommand == ATA_CMD_WRITE_DMA_EXT);
+  }
+
+  return FALSE;
+}
+
+/**
+  Retire the queued commands the device has completed.
+
+  Completed tasks are removed from the list and signalled. If a command
+  failed or timed out, the whole list is destroyed with an error status, in
+  the same way as a failed non-queued task.
+
+  @param[in]  Instance  Pointer to the ATA_ATAPI_PASS_THRU_INSTANCE.
+
+**/
+STATIC
+VOID
+AtaPassThruRetireNcqTasks (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE *Instance
+  )
+{
+  EFI_AHCI_REGISTERS           *AhciRegisters;
+  LIST_ENTRY                   *TaskList;
+  LIST_ENTRY                   *Entry;
+  ATA_NONBLOCK_TASK            *Task;
+  UINT32                       Completed;
+  UINT32                       Failed;
+  UINT32                       Aborted;
+  UINT8                        Slot;
+
+  AhciRegisters = &Instance->AhciRegisters;
+  if (AhciRegisters->NcqActive == 0) {
+    return;
+  }
+
+  AhciNcqCollect (Instance->AhciBaseAddress, AhciRegisters, &Completed, &Failed, &Aborted);
+
+  if (Failed != 0) {
+    DEBUG ((DEBUG_ERROR, "AHCI: queued command failed on port %d (slots 0x%X)\n", AhciRegisters->NcqPort, Failed));
+    DestroyPortAsynTaskList (Instance, AhciRegisters->NcqPort, TRUE);
+    return;
+  }
+
+  for (Slot = 0; Slot < AHCI_MAX_COMMAND_SLOTS; Slot++) {
+    if (((Completed | Aborted) & (((UINT32) BIT0) << Slot)) == 0) {
+      continue;
+    }
+
+    Task = (ATA_NONBLOCK_TASK *) AhciRegisters->NcqSlot[Slot].Context;
+    if ((Completed & (((UINT32) BIT0) << Slot)) != 0) {
+      RemoveEntryList (&Task->Link);
+      gBS->SignalEvent (Task->Event);
+      FreePool (Task);
+    } else {
+      //
+      // Aborted by the failure of another command, send it again
+      //
+      Task->IsStart = FALSE;
+    }
+  }
+
+  if (AhciRegisters->NcqActive == 0) {
+    return;
+  }
+
+  TaskList = &Instance->NonBlockingTaskList[AhciRegisters->NcqPort];
+  for (Entry = GetFirstNode (TaskList); !IsNull (TaskList, Entry); Entry = GetNextNode (TaskList, Entry)) {
+    Task = ATA_NON_BLOCK_TASK_FROM_ENTRY (Entry);
+    if (Task->IsStart && AhciWaiterExpired (&Task->Waiter)) {
+      DEBUG ((DEBUG_ERROR, "AHCI: queued command timed out on port %d\n", AhciRegisters->NcqPort));
+      DestroyPortAsynTaskList (Instance, AhciRegisters->NcqPort, TRUE);
+      return;
+    }
+  }
+}
+
+/**
+  Start the timeout of a task when it is issued for the first time.
+
+  Re-issuing a command after an error recovery does not restart the timeout,
+  and the time a task spends queued behind others does not count.
+
+  @param[in]  Task      Pointer to the ATA_NONBLOCK_TASK.
+
+**/
+STATIC
+VOID
+AtaPassThruIssueTask (
+  IN ATA_NONBLOCK_TASK            *Task
+  )
+{
+  if (!Task->IsIssued) {
+    AhciWaiterStart (&Task->Waiter, Task->Packet->Timeout);
+    Task->IsIssued = TRUE;
+  }
+}
+
+/**
+  Queue as many eligible tasks of a port as the device accepts.
+
+  Tasks are taken in list order, starting from the head, and queuing stops
+  at the first task that cannot be queued so that the ordering between
+  queued and non-queued commands is kept.
+
+  @param[in]  Instance  Pointer to the ATA_ATAPI_PASS_THRU_INSTANCE.
+  @param[in]  Port      The port whose tasks are queued.
+
+**/
+STATIC
+VOID
+AtaPassThruQueueNcqTasks (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE *Instance,
+  IN UINT16                       Port
+  )
+{
+  LIST_ENTRY                       *TaskList;
+  LIST_ENTRY                       *Entry;
+  ATA_NONBLOCK_TASK                *Task;
+  EFI_ATA_PASS_THRU_COMMAND_PACKET *Packet;
+  BOOLEAN                          Read;
+  EFI_STATUS                       Status;
+
+  TaskList = &Instance->NonBlockingTaskList[Port];
+  for (Entry = GetFirstNode (TaskList); !IsNull (TaskList, Entry); Entry = GetNextNode (TaskList, Entry)) {
+    Task = ATA_NON_BLOCK_TASK_FROM_ENTRY (Entry);
+    if (Task->IsStart) {
+      continue;
+    }
+
+    if (!AtaPassThruIsNcqTask (Instance, Task)) {
+      return;
+    }
+
+    AtaPassThruIssueTask (Task);
+
+    Packet = Task->Packet;
+    Read   = (BOOLEAN) (Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_IN);
+    Status = AhciNcqSubmit (
+               Instance->AhciBaseAddress,
+               &Instance->AhciRegisters,
+               (UINT8) Task->Port,
+               0,
+               Read,
+               Packet->Acb,
+               Packet->Asb,
+               Read ? Packet->InDataBuffer : Packet->OutDataBuffer,
+               Read ? Packet->InTransferLength : Packet->OutTransferLength,
+               Task
+               );
+    if (Status == EFI_NOT_READY) {
+      return;
+    }
+
+    if (EFI_ERROR (Status)) {
+      DestroyPortAsynTaskList (Instance, Port, TRUE);
+      return;
+    }
+
+    Task->IsStart = TRUE;
+    if (Instance->NcqBudget > 0) {
+      Instance->NcqBudget--;
+    }
+  }
+}
+
+/**
+  Check whether a port other than the given one has tasks waiting.
+
+  @param[in]  Instance  Pointer to the ATA_ATAPI_PASS_THRU_INSTANCE.
+  @param[in]  Port      The port to leave out.
+
+  @retval TRUE          Another port has tasks.
+  @retval FALSE         No other port has tasks.
+
+**/
+STATIC
+BOOLEAN
+AtaPassThruOtherPortsPending (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE *Instance,
+  IN UINT16                       Port
+  )
+{
+  UINT16                       Index;
+
+  for (Index = 0; Index < EFI_AHCI_MAX_PORTS; Index++) {
+    if ((Index != Port) && !IsListEmpty (&Instance->NonBlockingTaskList[Index])) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Pick the task to execute next.
+
+  The port served last keeps the command list while its head task is in
+  progress. Otherwise the next port with pending tasks is served, so that a
+  busy disk cannot starve the others.
+
+  @param[in]  Instance  Pointer to the ATA_ATAPI_PASS_THRU_INSTANCE.
+
+  @return The task to execute, or NULL if no task is pending.
+
+**/
+STATIC
+ATA_NONBLOCK_TASK *
+AtaPassThruNextTask (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE *Instance
+  )
+{
+  LIST_ENTRY                   *TaskList;
+  ATA_NONBLOCK_TASK            *Task;
+  UINT16                       Index;
+  UINT16                       Port;
+
+  TaskList = &Instance->NonBlockingTaskList[Instance->NonBlockingPort];
+  if (!IsListEmpty (TaskList)) {
+    Task = ATA_NON_BLOCK_TASK_FROM_ENTRY (GetFirstNode (TaskList));
+    if (Task->IsStart) {
+      return Task;
+    }
+  }
+
+  for (Index = 1; Index <= EFI_AHCI_MAX_PORTS; Index++) {
+    Port     = (UINT16) ((Instance->NonBlockingPort + Index) % EFI_AHCI_MAX_PORTS);
+    TaskList = &Instance->NonBlockingTaskList[Port];
+    if (!IsListEmpty (TaskList)) {
+      Instance->NonBlockingPort = Port;
+      return ATA_NON_BLOCK_TASK_FROM_ENTRY (GetFirstNode (TaskList));
+    }
+  }
+
+  return NULL;
+}
+
 /**
   Call back function when the timer event is signaled.
 
@@ -320,26 +622,48 @@ AsyncNonBlockingTransferRoutine (
   VOID*      Context
   )
 {
-  LIST_ENTRY                   *Entry;
-  LIST_ENTRY                   *EntryHeader;
   ATA_NONBLOCK_TASK            *Task;
   EFI_STATUS                   Status;
   ATA_ATAPI_PASS_THRU_INSTANCE *Instance;
 
-  Instance   = (ATA_ATAPI_PASS_THRU_INSTANCE *) Context;
-  EntryHeader = &Instance->NonBlockingTaskList;
+  Instance = (ATA_ATAPI_PASS_THRU_INSTANCE *) Context;
+
   //
-  // Get the Tasks from the Tasks List and execute it, until there is
-  // no task in the list or the device is busy with task (EFI_NOT_READY).
+  // Execute the tasks of the ports in turn, until there is no task left
+  // or the device is busy with a task (EFI_NOT_READY).
   //
   while (TRUE) {
-    if (!IsListEmpty (EntryHeader)) {
-      Entry = GetFirstNode (EntryHeader);
-      Task  = ATA_NON_BLOCK_TASK_FROM_ENTRY (Entry);
-    } else {
+    //
+    // READ/WRITE DMA EXT tasks are queued to the disk while it supports NCQ.
+    // The other tasks wait until the queue is empty and run one at a time.
+    //
+    // Once the queuing port used its budget and another port has tasks, the
+    // queue is left to drain, and AtaPassThruNextTask() then moves on to
+    // the next port.
+    //
+    if (Instance->Mode == EfiAtaAhciMode) {
+      AtaPassThruRetireNcqTasks (Instance);
+      if (Instance->AhciRegisters.NcqActive != 0) {
+        if ((Instance->NcqBudget > 0) ||
+            !AtaPassThruOtherPortsPending (Instance, Instance->AhciRegisters.NcqPort)) {
+          AtaPassThruQueueNcqTasks (Instance, Instance->AhciRegisters.NcqPort);
+        }
+        return;
+      }
+    }
+
+    Task = AtaPassThruNextTask (Instance);
+    if (Task == NULL) {
       return;
     }
 
+    if (AtaPassThruIsNcqTask (Instance, Task)) {
+      Instance->NcqBudget = ATA_NCQ_PORT_BUDGET;
+      AtaPassThruQueueNcqTasks (Instance, Task->Port);
+      return;
+    }
+
+    AtaPassThruIssueTask (Task);
     Status = AtaPassThruPassThruExecute (
                Task->Port,
                Task->PortMultiplier,
@@ -349,12 +673,13 @@ AsyncNonBlockingTransferRoutine (
                );
 
     //
-    // If the data transfer meet a error, remove all tasks in the list since these tasks are
+    // If the data transfer meet a error, remove all tasks of the port since these tasks are
     // associated with one task from Ata Bus and signal the event with error status.
+    // The tasks of the other ports are not affected.
     //
     if ((Status != EFI_NOT_READY) && (Status != EFI_SUCCESS)) {
-      DestroyAsynTaskList (Instance, TRUE);
-      break;
+      DestroyPortAsynTaskList (Instance, Task->Port, TRUE);
+      continue;
     }
 
     //
@@ -362,12 +687,12 @@ AsyncNonBlockingTransferRoutine (
     // is not finished yet. Otherwise the operation is successful.
     //
     if (Status == EFI_NOT_READY) {
-      break;
-    } else {
-      RemoveEntryList (&Task->Link);
-      gBS->SignalEvent (Task->Event);
-      FreePool (Task);
+      return;
     }
+
+    RemoveEntryList (&Task->Link);
+    gBS->SignalEvent (Task->Event);
+    FreePool (Task);
   }
 }
 
@@ -536,6 +861,7 @@ AtaAtapiPassThruStart (
   ATA_ATAPI_PASS_THRU_INSTANCE      *Instance;
   UINT64                            EnabledPciAttributes;
   UINT64                            OriginalPciAttributes;
+  UINTN                             Index;
 
   Status                = EFI_SUCCESS;
   IdeControllerInit     = NULL;
@@ -582,7 +908,9 @@ AtaAtapiPassThruStart (
   Instance->AtaPassThru.Mode      = &Instance->AtaPassThruMode;
   Instance->ExtScsiPassThru.Mode  = &Instance->ExtScsiPassThruMode;
   InitializeListHead(&Instance->DeviceList);
-  InitializeListHead(&Instance->NonBlockingTaskList);
+  for (Index = 0; Index < EFI_AHCI_MAX_PORTS; Index++) {
+    InitializeListHead (&Instance->NonBlockingTaskList[Index]);
+  }
 
   Instance->TimerEvent = NULL;
 
@@ -621,6 +949,8 @@ AtaAtapiPassThruStart (
                   );
   ASSERT_EFI_ERROR (Status);
 
+  AtaEraseBlockStart (Instance);
+
   return Status;
 
 ErrorExit:
@@ -726,6 +1056,8 @@ AtaAtapiPassThruStop (
          Controller
          );
 
+  AtaEraseBlockStop (Instance);
+
   //
   // Close Non-Blocking timer and free Task list.
   //
@@ -757,6 +1089,13 @@ AtaAtapiPassThruStop (
   //
   if (Instance->Mode == EfiAtaAhciMode) {
     AhciRegisters = &Instance->AhciRegisters;
+    if (AhciRegisters->AhciNcqTable != NULL) {
+      DmaUnmap (AhciRegisters->MapNcqTable);
+      DmaFreeBuffer (
+        EFI_SIZE_TO_PAGES ((UINTN) AhciRegisters->MaxNcqTableSize),
+        AhciRegisters->AhciNcqTable
+        );
+    }
     PciIo->Unmap (
              PciIo,
              AhciRegisters->MapCommandTable
@@ -935,48 +1274,118 @@ DestroyDeviceInfoList (
 }
 
 /**
-  Destroy all pending non blocking tasks.
+  Destroy the pending non blocking tasks of a port.
+
+  The command the device is executing for the port, if any, is aborted first.
 
   @param[in]  Instance    A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+  @param[in]  Port        The port whose tasks are destroyed.
   @param[in]  IsSigEvent  Indicate whether signal the task event when remove the
                           task.
 
 **/
 VOID
 EFIAPI
-DestroyAsynTaskList (
+DestroyPortAsynTaskList (
   IN ATA_ATAPI_PASS_THRU_INSTANCE *Instance,
+  IN UINT16                        Port,
   IN BOOLEAN                       IsSigEvent
   )
 {
+  LIST_ENTRY           *TaskList;
   LIST_ENTRY           *Entry;
   LIST_ENTRY           *DelEntry;
   ATA_NONBLOCK_TASK    *Task;
   EFI_TPL              OldTpl;
 
-  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
-  if (!IsListEmpty (&Instance->NonBlockingTaskList)) {
+  OldTpl   = gBS->RaiseTPL (TPL_NOTIFY);
+  TaskList = &Instance->NonBlockingTaskList[Port];
+
+  //
+  // Take the queued commands back from the device before their buffers go
+  //
+  if ((Instance->Mode == EfiAtaAhciMode) && (Instance->AhciRegisters.NcqActive != 0) &&
+      (Instance->AhciRegisters.NcqPort == Port)) {
+    AhciNcqAbort (Instance->AhciBaseAddress, &Instance->AhciRegisters);
+  }
+
+  //
+  // Free the Subtask list.
+  //
+  for (Entry = TaskList->ForwardLink; Entry != TaskList; ) {
+    DelEntry = Entry;
+    Entry    = Entry->ForwardLink;
+    Task     = ATA_NON_BLOCK_TASK_FROM_ENTRY (DelEntry);
+
     //
-    // Free the Subtask list.
+    // A DMA command still in progress owns the command list and its buffer
     //
-    for (Entry = (&Instance->NonBlockingTaskList)->ForwardLink;
-        Entry != (&Instance->NonBlockingTaskList);
-       ) {
-      DelEntry = Entry;
-      Entry    = Entry->ForwardLink;
-      Task     = ATA_NON_BLOCK_TASK_FROM_ENTRY (DelEntry);
-
-      RemoveEntryList (DelEntry);
-      if (IsSigEvent) {
-        Task->Packet->Asb->AtaStatus = 0x01;
-        gBS->SignalEvent (Task->Event);
+    if (Task->Map != NULL) {
+      if (Task->IsStart) {
+        AhciStopCommand (Instance->AhciBaseAddress, (UINT8) Port, ATA_ATAPI_TIMEOUT);
+        AhciDisableFisReceive (Instance->AhciBaseAddress, (UINT8) Port, ATA_ATAPI_TIMEOUT);
       }
-      FreePool (Task);
+      DmaBufferUnmap (Task->Map);
     }
+
+    RemoveEntryList (DelEntry);
+    if (IsSigEvent) {
+      Task->Packet->Asb->AtaStatus = 0x01;
+      gBS->SignalEvent (Task->Event);
+    }
+    FreePool (Task);
   }
   gBS->RestoreTPL (OldTpl);
 }
 
+/**
+  Destroy all pending non blocking tasks.
+
+  @param[in]  Instance    A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+  @param[in]  IsSigEvent  Indicate whether signal the task event when remove the
+                          task.
+
+**/
+VOID
+EFIAPI
+DestroyAsynTaskList (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE *Instance,
+  IN BOOLEAN                       IsSigEvent
+  )
+{
+  UINT16               Port;
+
+  for (Port = 0; Port < EFI_AHCI_MAX_PORTS; Port++) {
+    DestroyPortAsynTaskList (Instance, Port, IsSigEvent);
+  }
+}
+
+/**
+  Check whether any non blocking task is pending.
+
+  @param[in]  Instance    A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+
+  @retval TRUE            At least one port has pending tasks.
+  @retval FALSE           No task is pending.
+
+**/
+BOOLEAN
+EFIAPI
+AtaPassThruTasksPending (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE *Instance
+  )
+{
+  UINT16               Port;
+
+  for (Port = 0; Port < EFI_AHCI_MAX_PORTS; Port++) {
+    if (!IsListEmpty (&Instance->NonBlockingTaskList[Port])) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
 /**
   Enumerate all attached ATA devices at IDE mode or AHCI mode separately.
 
@@ -1165,15 +1574,10 @@ AtaPassThruPassThru (
     Task->Packet         = Packet;
     Task->Event          = Event;
     Task->IsStart        = FALSE;
-    Task->RetryTimes     = DivU64x32(Packet->Timeout, 1000) + 1;
-    if (Packet->Timeout == 0) {
-      Task->InfiniteWait = TRUE;
-    } else {
-      Task->InfiniteWait = FALSE;
-    }
+    Task->IsIssued       = FALSE;
 
     OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
-    InsertTailList (&Instance->NonBlockingTaskList, &Task->Link);
+    InsertTailList (&Instance->NonBlockingTaskList[Port], &Task->Link);
     gBS->RestoreTPL (OldTpl);
 
     return EFI_SUCCESS;
@@ -1610,6 +2014,20 @@ AtaPassThruResetPort (
   IN UINT16                     Port
   )
 {
+  ATA_ATAPI_PASS_THRU_INSTANCE    *Instance;
+
+  Instance = ATA_PASS_THRU_PRIVATE_DATA_FROM_THIS (This);
+
+  if (Port >= EFI_AHCI_MAX_PORTS) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Cancel the non-blocking commands of the port, their events are signaled
+  // with an error status.
+  //
+  DestroyPortAsynTaskList (Instance, Port, TRUE);
+
   //
   // Return success directly then upper layer driver could think reset port operation is done.
   //
@@ -1666,6 +2084,13 @@ AtaPassThruResetDevice (
     return EFI_INVALID_PARAMETER;
   }
 
+  //
+  // Cancel the non-blocking commands of the device, their events are signaled
+  // with an error status. Only devices without a port multiplier are
+  // enumerated, so these are the commands of the port.
+  //
+  DestroyPortAsynTaskList (Instance, Port, TRUE);
+
   //
   // Return success directly then upper layer driver could think reset device operation is done.
   //
@@ -19,6 +19,8 @@
 #include <Protocol/AtaPassThru.h>
 #include <Protocol/ScsiPassThruExt.h>
 #include <Protocol/AtaAtapiPolicy.h>
+#include <Protocol/BlockIo.h>
+#include <Protocol/EraseBlock.h>
 
 #include <Library/DebugLib.h>
 #include <Library/BaseLib.h>
@@ -35,6 +37,7 @@
 #include <Library/NonDiscoverableDeviceRegistrationLib.h>
 #include <Protocol/NonDiscoverableDevice.h>
 #include <Library/DmaLib.h>
+#include <Library/DmaBufferLib.h>
 #include <Library/IoLib.h>
 
 #include "IdeMode.h"
@@ -49,6 +52,7 @@ extern EDKII_ATA_ATAPI_POLICY_PROTOCOL *mAtaAtapiPolicy;
 #define ATA_ATAPI_PASS_THRU_SIGNATURE  SIGNATURE_32 ('a', 'a', 'p', 't')
 #define ATA_ATAPI_DEVICE_SIGNATURE     SIGNATURE_32 ('a', 'd', 'e', 'v')
 #define ATA_NONBLOCKING_TASK_SIGNATURE  SIGNATURE_32 ('a', 't', 's', 'k')
+#define ATA_ERASE_BLOCK_SIGNATURE      SIGNATURE_32 ('a', 'e', 'r', 's')
 
 typedef struct _ATA_NONBLOCK_TASK ATA_NONBLOCK_TASK;
 
@@ -119,12 +123,52 @@ typedef struct {
   UINT64                            PreviousLun;
 
   //
-  // For Non-blocking.
+  // For Non-blocking. Tasks are queued per port and the ports are served in
+  // turn, starting after NonBlockingPort, the port served last. NcqBudget is
+  // the number of queued commands the queuing port may still add while the
+  // other ports wait.
   //
   EFI_EVENT                         TimerEvent;
-  LIST_ENTRY                        NonBlockingTaskList;
+  LIST_ENTRY                        NonBlockingTaskList[EFI_AHCI_MAX_PORTS];
+  UINT16                            NonBlockingPort;
+  UINTN                             NcqBudget;
+
+  //
+  // For EFI_ERASE_BLOCK_PROTOCOL, installed on the disk handles created by
+  // AtaBusDxe as their BlockIo appears.
+  //
+  EFI_EVENT                         BlockIoNotifyEvent;
+  VOID                              *BlockIoRegistration;
+  LIST_ENTRY                        EraseBlockList;
 } ATA_ATAPI_PASS_THRU_INSTANCE;
 
+//
+// EFI_ERASE_BLOCK_PROTOCOL instance of a disk supporting TRIM.
+//
+typedef struct {
+  UINT32                            Signature;
+  LIST_ENTRY                        Link;
+
+  EFI_HANDLE                        Handle;
+  EFI_ERASE_BLOCK_PROTOCOL          EraseBlock;
+  ATA_ATAPI_PASS_THRU_INSTANCE      *Instance;
+  EFI_ATA_DEVICE_INFO               *DeviceInfo;
+} ATA_ERASE_BLOCK_DEVICE;
+
+#define ATA_ERASE_BLOCK_DEVICE_FROM_THIS(a) \
+  CR (a, \
+      ATA_ERASE_BLOCK_DEVICE, \
+      EraseBlock, \
+      ATA_ERASE_BLOCK_SIGNATURE \
+      )
+
+#define ATA_ERASE_BLOCK_DEVICE_FROM_LINK(a) \
+  CR (a, \
+      ATA_ERASE_BLOCK_DEVICE, \
+      Link, \
+      ATA_ERASE_BLOCK_SIGNATURE \
+      )
+
 //
 // Task for Non-blocking mode.
 //
@@ -137,8 +181,8 @@ struct _ATA_NONBLOCK_TASK {
   EFI_ATA_PASS_THRU_COMMAND_PACKET  *Packet;
   BOOLEAN                           IsStart;
   EFI_EVENT                         Event;
-  UINT64                            RetryTimes;
-  BOOLEAN                           InfiniteWait;
+  BOOLEAN                           IsIssued;        // The timeout is running.
+  AHCI_WAITER                       Waiter;          // Timeout from the first issue.
   VOID                              *Map;            // Pointer to map.
   VOID                              *TableMap;       // Pointer to PRD table map.
   EFI_ATA_DMA_PRD                   *MapBaseAddress; //  Pointer to range Base address for Map.
@@ -152,6 +196,12 @@ struct _ATA_NONBLOCK_TASK {
 #define ATA_ATAPI_TIMEOUT           EFI_TIMER_PERIOD_SECONDS(3)
 #define ATA_SPINUP_TIMEOUT          EFI_TIMER_PERIOD_SECONDS(10)
 
+//
+// Commands a port may queue with NCQ in one turn once another port has
+// tasks waiting, two full queues.
+//
+#define ATA_NCQ_PORT_BUDGET         64
+
 #define IS_ALIGNED(addr, size)      (((UINTN) (addr) & (size - 1)) == 0)
 
 #define ATA_PASS_THRU_PRIVATE_DATA_FROM_THIS(a) \
@@ -508,6 +558,40 @@ DestroyAsynTaskList (
   IN BOOLEAN                       IsSigEvent
   );
 
+/**
+  Destroy the pending non blocking tasks of a port.
+
+  The command the device is executing for the port, if any, is aborted first.
+
+  @param[in]  Instance    A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+  @param[in]  Port        The port whose tasks are destroyed.
+  @param[in]  IsSigEvent  Indicate whether signal the task event when remove the
+                          task.
+
+**/
+VOID
+EFIAPI
+DestroyPortAsynTaskList (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE *Instance,
+  IN UINT16                        Port,
+  IN BOOLEAN                       IsSigEvent
+  );
+
+/**
+  Check whether any non blocking task is pending.
+
+  @param[in]  Instance    A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+
+  @retval TRUE            At least one port has pending tasks.
+  @retval FALSE           No task is pending.
+
+**/
+BOOLEAN
+EFIAPI
+AtaPassThruTasksPending (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE *Instance
+  );
+
 /**
   Enumerate all attached ATA devices at IDE mode or AHCI mode separately.
 
@@ -525,6 +609,34 @@ EnumerateAttachedDevice (
   IN  ATA_ATAPI_PASS_THRU_INSTANCE      *Instance
   );
 
+/**
+  Sends an ATA command to an ATA device that is attached to the ATA controller,
+  from the non-blocking task list or directly for blocking I/O.
+
+  @param[in]      Port               The port number of the ATA device to send the command.
+  @param[in]      PortMultiplierPort The port multiplier port number of the ATA device to send the command.
+                                     If there is no port multiplier, then specify 0xFFFF.
+  @param[in, out] Packet             A pointer to the ATA command to send to the ATA device specified by Port
+                                     and PortMultiplierPort.
+  @param[in]      Instance           Pointer to the ATA_ATAPI_PASS_THRU_INSTANCE.
+  @param[in]      Task               Optional. Pointer to the ATA_NONBLOCK_TASK
+                                     used by non-blocking mode.
+
+  @retval EFI_SUCCESS                The ATA command was sent by the host.
+  @retval EFI_NOT_READY              The non-blocking ATA command is still in progress.
+  @retval Others                     The ATA command failed.
+
+**/
+EFI_STATUS
+EFIAPI
+AtaPassThruPassThruExecute (
+  IN     UINT16                           Port,
+  IN     UINT16                           PortMultiplierPort,
+  IN OUT EFI_ATA_PASS_THRU_COMMAND_PACKET *Packet,
+  IN     ATA_ATAPI_PASS_THRU_INSTANCE     *Instance,
+  IN     ATA_NONBLOCK_TASK                *Task OPTIONAL
+  );
+
 /**
   Call back function when the timer event is signaled.
 
@@ -1074,6 +1186,54 @@ AhciModeInitialization (
   IN  ATA_ATAPI_PASS_THRU_INSTANCE    *Instance
   );
 
+/**
+  Deallocate a range of logical blocks with DATA SET MANAGEMENT (TRIM).
+
+  @param  Instance            A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+  @param  Port                The number of port.
+  @param  PortMultiplier      The port multiplier port number.
+  @param  IdentifyData        The IDENTIFY data of the device.
+  @param  Lba                 The first logical block to deallocate.
+  @param  BlockCount          The number of logical blocks to deallocate.
+
+  @retval EFI_SUCCESS         The blocks were deallocated.
+  @retval EFI_OUT_OF_RESOURCES The payload could not be allocated.
+  @retval Others              The DATA SET MANAGEMENT command failed.
+
+**/
+EFI_STATUS
+EFIAPI
+AhciTrimBlocks (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE     *Instance,
+  IN UINT16                           Port,
+  IN UINT16                           PortMultiplier,
+  IN EFI_IDENTIFY_DATA                *IdentifyData,
+  IN EFI_LBA                          Lba,
+  IN UINT64                           BlockCount
+  );
+
+/**
+  Start producing EFI_ERASE_BLOCK_PROTOCOL for the disks supporting TRIM.
+
+  @param[in]  Instance          A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+
+**/
+VOID
+AtaEraseBlockStart (
+  IN  ATA_ATAPI_PASS_THRU_INSTANCE    *Instance
+  );
+
+/**
+  Uninstall the EFI_ERASE_BLOCK_PROTOCOL instances produced for the controller.
+
+  @param[in]  Instance          A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+
+**/
+VOID
+AtaEraseBlockStop (
+  IN  ATA_ATAPI_PASS_THRU_INSTANCE    *Instance
+  );
+
 /**
   Start a non data transfer on specific port.
 
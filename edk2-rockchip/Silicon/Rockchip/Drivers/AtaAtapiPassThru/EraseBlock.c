@@ -0,0 +1,339 @@
+/** @file
+  EFI_ERASE_BLOCK_PROTOCOL for SATA disks supporting DATA SET MANAGEMENT (TRIM).
+
+  The disk handles are created by AtaBusDxe on top of the ATA pass thru
+  protocol, so the protocol is installed on them when their BlockIo appears.
+  Only disks reporting deterministic read after TRIM get it, so that erased
+  blocks read back the same data every time.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "AtaAtapiPassThru.h"
+
+/**
+  Erase a specified number of device blocks.
+
+  The blocks are deallocated with TRIM. The request completes before the
+  function returns, the event of a non-blocking request is signaled then.
+
+  @param[in]       This           Indicates a pointer to the calling context.
+  @param[in]       MediaId        The media ID that the erase request is for.
+  @param[in]       Lba            The starting logical block address to be erased.
+  @param[in, out]  Token          A pointer to the token associated with the transaction.
+  @param[in]       Size           The size in bytes to be erased. This must be a multiple
+                                  of the physical block size of the device.
+
+  @retval EFI_SUCCESS             The erase request was completed.
+  @retval EFI_WRITE_PROTECTED     The device can not be erased due to write protection.
+  @retval EFI_DEVICE_ERROR        The device reported an error while attempting to erase.
+  @retval EFI_NO_MEDIA            There is no media in the device.
+  @retval EFI_MEDIA_CHANGED       The MediaId is not for the current media.
+  @retval EFI_INVALID_PARAMETER   The erase request contains LBAs that are not valid.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AtaEraseBlocks (
+  IN     EFI_BLOCK_IO_PROTOCOL      *This,
+  IN     UINT32                     MediaId,
+  IN     EFI_LBA                    Lba,
+  IN OUT EFI_ERASE_BLOCK_TOKEN      *Token,
+  IN     UINTN                      Size
+  )
+{
+  ATA_ERASE_BLOCK_DEVICE            *Device;
+  EFI_BLOCK_IO_PROTOCOL             *BlockIo;
+  EFI_BLOCK_IO_MEDIA                *Media;
+  UINT64                            BlockCount;
+  EFI_STATUS                        Status;
+
+  Device = ATA_ERASE_BLOCK_DEVICE_FROM_THIS ((EFI_ERASE_BLOCK_PROTOCOL *) This);
+
+  //
+  // The media belongs to AtaBusDxe, which may have stopped managing the disk
+  //
+  Status = gBS->HandleProtocol (Device->Handle, &gEfiBlockIoProtocolGuid, (VOID **) &BlockIo);
+  if (EFI_ERROR (Status)) {
+    return EFI_NO_MEDIA;
+  }
+
+  Media = BlockIo->Media;
+  if (MediaId != Media->MediaId) {
+    return EFI_MEDIA_CHANGED;
+  }
+
+  if (!Media->MediaPresent) {
+    return EFI_NO_MEDIA;
+  }
+
+  if (Media->ReadOnly) {
+    return EFI_WRITE_PROTECTED;
+  }
+
+  if ((Size % Media->BlockSize) != 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  BlockCount = Size / Media->BlockSize;
+  if ((Lba > Media->LastBlock) || (BlockCount > Media->LastBlock - Lba + 1)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = EFI_SUCCESS;
+  if (BlockCount != 0) {
+    Status = AhciTrimBlocks (
+               Device->Instance,
+               Device->DeviceInfo->Port,
+               Device->DeviceInfo->PortMultiplier,
+               Device->DeviceInfo->IdentifyData,
+               Lba,
+               BlockCount
+               );
+  }
+
+  if (EFI_ERROR (Status)) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  if ((Token != NULL) && (Token->Event != NULL)) {
+    Token->TransactionStatus = EFI_SUCCESS;
+    gBS->SignalEvent (Token->Event);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Find the disk a device path created by AtaBusDxe refers to.
+
+  @param[in]  Instance          A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+  @param[in]  DevicePath        The device path of a BlockIo handle.
+
+  @return The device info of the disk, or NULL if the path is not the one of a
+          disk attached to this controller.
+
+**/
+STATIC
+EFI_ATA_DEVICE_INFO *
+AtaEraseBlockFindDevice (
+  IN  ATA_ATAPI_PASS_THRU_INSTANCE    *Instance,
+  IN  EFI_DEVICE_PATH_PROTOCOL        *DevicePath
+  )
+{
+  EFI_DEVICE_PATH_PROTOCOL            *ControllerPath;
+  EFI_DEVICE_PATH_PROTOCOL            *Node;
+  SATA_DEVICE_PATH                    *SataNode;
+  LIST_ENTRY                          *DeviceNode;
+  UINTN                               Size;
+  EFI_STATUS                          Status;
+
+  Status = gBS->HandleProtocol (
+                  Instance->ControllerHandle,
+                  &gEfiDevicePathProtocolGuid,
+                  (VOID **) &ControllerPath
+                  );
+  if (EFI_ERROR (Status)) {
+    return NULL;
+  }
+
+  //
+  // The disk path is the controller path followed by a single SATA node,
+  // partitions add more nodes after it.
+  //
+  Size = GetDevicePathSize (ControllerPath) - END_DEVICE_PATH_LENGTH;
+  if ((GetDevicePathSize (DevicePath) != Size + sizeof (SATA_DEVICE_PATH) + END_DEVICE_PATH_LENGTH) ||
+      (CompareMem (DevicePath, ControllerPath, Size) != 0)) {
+    return NULL;
+  }
+
+  Node = (EFI_DEVICE_PATH_PROTOCOL *) ((UINT8 *) DevicePath + Size);
+  if ((DevicePathType (Node) != MESSAGING_DEVICE_PATH) || (DevicePathSubType (Node) != MSG_SATA_DP)) {
+    return NULL;
+  }
+
+  SataNode   = (SATA_DEVICE_PATH *) Node;
+  DeviceNode = SearchDeviceInfoList (
+                 Instance,
+                 SataNode->HBAPortNumber,
+                 SataNode->PortMultiplierPortNumber,
+                 EfiIdeHarddisk
+                 );
+  if (DeviceNode == NULL) {
+    return NULL;
+  }
+
+  return ATA_ATAPI_DEVICE_INFO_FROM_THIS (DeviceNode);
+}
+
+/**
+  Check whether a disk can be erased with TRIM.
+
+  @param[in]  DeviceInfo        The device info of the disk.
+
+  @retval TRUE                  The disk supports TRIM with deterministic read after it.
+  @retval FALSE                 The disk cannot be erased with TRIM.
+
+**/
+STATIC
+BOOLEAN
+AtaEraseBlockSupported (
+  IN  EFI_ATA_DEVICE_INFO             *DeviceInfo
+  )
+{
+  UINT16                              *IdentifyWords;
+
+  IdentifyWords = (UINT16 *) DeviceInfo->IdentifyData;
+
+  if ((IdentifyWords[AHCI_IDENTIFY_DSM_SUPPORTED] & AHCI_IDENTIFY_DSM_TRIM) == 0) {
+    return FALSE;
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "port [%d] supports TRIM, deterministic read %a, read zeroes %a\n",
+    DeviceInfo->Port,
+    (IdentifyWords[AHCI_IDENTIFY_ADDITIONAL_SUPPORTED] & AHCI_IDENTIFY_DRAT) != 0 ? "yes" : "no",
+    (IdentifyWords[AHCI_IDENTIFY_ADDITIONAL_SUPPORTED] & AHCI_IDENTIFY_RZAT) != 0 ? "yes" : "no"
+    ));
+
+  return (BOOLEAN) ((IdentifyWords[AHCI_IDENTIFY_ADDITIONAL_SUPPORTED] & AHCI_IDENTIFY_DRAT) != 0);
+}
+
+/**
+  BlockIo notification: install EFI_ERASE_BLOCK_PROTOCOL on the new disks of
+  the controller that support TRIM.
+
+  @param[in]  Event             The event of the notification.
+  @param[in]  Context           A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+
+**/
+STATIC
+VOID
+EFIAPI
+AtaEraseBlockNotify (
+  IN  EFI_EVENT                       Event,
+  IN  VOID                            *Context
+  )
+{
+  ATA_ATAPI_PASS_THRU_INSTANCE        *Instance;
+  ATA_ERASE_BLOCK_DEVICE              *Device;
+  EFI_ATA_DEVICE_INFO                 *DeviceInfo;
+  EFI_DEVICE_PATH_PROTOCOL            *DevicePath;
+  EFI_HANDLE                          Handle;
+  UINTN                               BufferSize;
+  VOID                                *Interface;
+  EFI_STATUS                          Status;
+
+  Instance = (ATA_ATAPI_PASS_THRU_INSTANCE *) Context;
+
+  while (TRUE) {
+    BufferSize = sizeof (EFI_HANDLE);
+    Status = gBS->LocateHandle (
+                    ByRegisterNotify,
+                    NULL,
+                    Instance->BlockIoRegistration,
+                    &BufferSize,
+                    &Handle
+                    );
+    if (EFI_ERROR (Status)) {
+      break;
+    }
+
+    Status = gBS->HandleProtocol (Handle, &gEfiEraseBlockProtocolGuid, &Interface);
+    if (!EFI_ERROR (Status)) {
+      continue;
+    }
+
+    Status = gBS->HandleProtocol (Handle, &gEfiDevicePathProtocolGuid, (VOID **) &DevicePath);
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    DeviceInfo = AtaEraseBlockFindDevice (Instance, DevicePath);
+    if ((DeviceInfo == NULL) || !AtaEraseBlockSupported (DeviceInfo)) {
+      continue;
+    }
+
+    Device = AllocateZeroPool (sizeof (ATA_ERASE_BLOCK_DEVICE));
+    if (Device == NULL) {
+      break;
+    }
+
+    Device->Signature                         = ATA_ERASE_BLOCK_SIGNATURE;
+    Device->Handle                            = Handle;
+    Device->Instance                          = Instance;
+    Device->DeviceInfo                        = DeviceInfo;
+    Device->EraseBlock.Revision               = EFI_ERASE_BLOCK_PROTOCOL_REVISION;
+    Device->EraseBlock.EraseLengthGranularity = 1;
+    Device->EraseBlock.EraseBlocks            = AtaEraseBlocks;
+
+    Status = gBS->InstallProtocolInterface (
+                    &Handle,
+                    &gEfiEraseBlockProtocolGuid,
+                    EFI_NATIVE_INTERFACE,
+                    &Device->EraseBlock
+                    );
+    if (EFI_ERROR (Status)) {
+      FreePool (Device);
+      continue;
+    }
+
+    InsertTailList (&Instance->EraseBlockList, &Device->Link);
+  }
+}
+
+/**
+  Start producing EFI_ERASE_BLOCK_PROTOCOL for the disks supporting TRIM.
+
+  @param[in]  Instance          A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+
+**/
+VOID
+AtaEraseBlockStart (
+  IN  ATA_ATAPI_PASS_THRU_INSTANCE    *Instance
+  )
+{
+  InitializeListHead (&Instance->EraseBlockList);
+
+  Instance->BlockIoNotifyEvent = EfiCreateProtocolNotifyEvent (
+                                   &gEfiBlockIoProtocolGuid,
+                                   TPL_CALLBACK,
+                                   AtaEraseBlockNotify,
+                                   Instance,
+                                   &Instance->BlockIoRegistration
+                                   );
+}
+
+/**
+  Uninstall the EFI_ERASE_BLOCK_PROTOCOL instances produced for the controller.
+
+  @param[in]  Instance          A pointer to the ATA_ATAPI_PASS_THRU_INSTANCE instance.
+
+**/
+VOID
+AtaEraseBlockStop (
+  IN  ATA_ATAPI_PASS_THRU_INSTANCE    *Instance
+  )
+{
+  ATA_ERASE_BLOCK_DEVICE              *Device;
+
+  if (Instance->BlockIoNotifyEvent != NULL) {
+    gBS->CloseEvent (Instance->BlockIoNotifyEvent);
+    Instance->BlockIoNotifyEvent = NULL;
+  }
+
+  while (!IsListEmpty (&Instance->EraseBlockList)) {
+    Device = ATA_ERASE_BLOCK_DEVICE_FROM_LINK (GetFirstNode (&Instance->EraseBlockList));
+    RemoveEntryList (&Device->Link);
+    gBS->UninstallProtocolInterface (
+           Device->Handle,
+           &gEfiEraseBlockProtocolGuid,
+           &Device->EraseBlock
+           );
+    FreePool (Device);
+  }
+}
@@ -407,6 +407,10 @@ EhcGetRootHubPortStatus (
     }
   }
 
+  if ((PortStatus->PortChangeStatus & USB_PORT_STAT_C_CONNECTION) != 0) {
+    USB_PROFILE_PORT_CONNECT (Ehc->Profile, PortNumber);
+  }
+
 ON_EXIT:
   gBS->RestoreTPL (OldTpl);
   return Status;
@@ -491,6 +495,7 @@ EhcSetRootHubPortFeature (
     //
     // Set one to PortReset bit must also set zero to PortEnable bit
     //
+    USB_PROFILE_PORT_RESET_START (Ehc->Profile, PortNumber);
     State |= PORTSC_RESET;
     State &= ~PORTSC_ENABLED;
     EhcWriteOpReg (Ehc, Offset, State);
@@ -509,6 +514,12 @@ EhcSetRootHubPortFeature (
   case EfiUsbPortOwner:
     State |= PORTSC_OWNER;
     EhcWriteOpReg (Ehc, Offset, State);
+
+    //
+    // A full or low speed device goes to the companion, which may
+    // not be running yet
+    //
+    EfiEventGroupSignal (&gRockchipUsbCompanionReleaseGuid);
     break;
 
   default:
@@ -595,6 +606,7 @@ EhcClearRootHubPortFeature (
     //
     State &= ~PORTSC_RESET;
     EhcWriteOpReg (Ehc, Offset, State);
+    USB_PROFILE_PORT_RESET_DONE (Ehc->Profile, PortNumber);
     break;
 
   case EfiUsbPortOwner:
@@ -702,6 +714,7 @@ EhcControlTransfer (
   EFI_TPL                 OldTpl;
   UINT8                   Endpoint;
   EFI_STATUS              Status;
+  UINT64                  StartTick;
   //
   // Validate parameters
   //
@@ -736,6 +749,7 @@ EhcControlTransfer (
 
   OldTpl          = gBS->RaiseTPL (EHC_TPL);
   Ehc             = EHC_FROM_THIS (This);
+  StartTick       = USB_PROFILE_TIMESTAMP ();
 
   Status          = EFI_DEVICE_ERROR;
   *TransferResult = EFI_USB_ERR_SYSTEM;
@@ -797,6 +811,8 @@ EhcControlTransfer (
     Status = EFI_SUCCESS;
   }
 
+  USB_PROFILE_TRANSFER (Ehc->Profile, DeviceAddress, UsbProfileControl, Urb->Completed, StartTick, Status);
+
   EhcAckAllInterrupt (Ehc);
   EhcFreeUrb (Ehc, Urb);
 
@@ -862,6 +878,7 @@ EhcBulkTransfer (
   URB                     *Urb;
   EFI_TPL                 OldTpl;
   EFI_STATUS              Status;
+  UINT64                  StartTick;
 
   //
   // Validate the parameters
@@ -883,6 +900,7 @@ EhcBulkTransfer (
 
   OldTpl          = gBS->RaiseTPL (EHC_TPL);
   Ehc             = EHC_FROM_THIS (This);
+  StartTick       = USB_PROFILE_TIMESTAMP ();
 
   *TransferResult = EFI_USB_ERR_SYSTEM;
   Status          = EFI_DEVICE_ERROR;
@@ -936,6 +954,8 @@ EhcBulkTransfer (
     Status = EFI_SUCCESS;
   }
 
+  USB_PROFILE_TRANSFER (Ehc->Profile, DeviceAddress, UsbProfileBulk, Urb->Completed, StartTick, Status);
+
   EhcAckAllInterrupt (Ehc);
   EhcFreeUrb (Ehc, Urb);
 
@@ -1121,6 +1141,7 @@ EhcSyncInterruptTransfer (
   EFI_TPL                 OldTpl;
   URB                     *Urb;
   EFI_STATUS              Status;
+  UINT64                  StartTick;
 
   //
   // Validates parameters
@@ -1142,6 +1163,7 @@ EhcSyncInterruptTransfer (
 
   OldTpl          = gBS->RaiseTPL (EHC_TPL);
   Ehc             = EHC_FROM_THIS (This);
+  StartTick       = USB_PROFILE_TIMESTAMP ();
 
   *TransferResult = EFI_USB_ERR_SYSTEM;
   Status          = EFI_DEVICE_ERROR;
@@ -1191,6 +1213,8 @@ EhcSyncInterruptTransfer (
     Status = EFI_SUCCESS;
   }
 
+  USB_PROFILE_TRANSFER (Ehc->Profile, DeviceAddress, UsbProfileInterrupt, Urb->Completed, StartTick, Status);
+
   EhcFreeUrb (Ehc, Urb);
 ON_EXIT:
   gBS->RestoreTPL (OldTpl);
@@ -1372,6 +1396,10 @@ EhciInitialiseController (
       (EFI_DEVICE_PATH_PROTOCOL *) DevicePath,
       NULL);
 
+  if (USB_PROFILE_ENABLED) {
+    Ehc->Profile = UsbProfileCreate (Ehc->Controller, L"EHCI", Ehc->UsbHostControllerBaseAddress);
+  }
+
   //
   // Create AsyncRequest Polling Timer
   //
@@ -1425,6 +1453,7 @@ UNINSTALL_USBHC:
          &gEfiUsb2HcProtocolGuid,
          &Ehc->Usb2Hc
          );
+  UsbProfileDestroy (Ehc->Profile);
 
   EhcFreeSched (Ehc);
   gBS->CloseEvent (Ehc->PollTimer);
@@ -15,6 +15,7 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 
 #include <Protocol/Usb2HostController.h>
 #include <Library/DmaLib.h>
+#include <Library/DmaBufferLib.h>
 
 #include <Guid/EventGroup.h>
 
@@ -29,11 +30,13 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Library/PcdLib.h>
 #include <Library/ReportStatusCodeLib.h>
 #include <Library/IoLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UsbHcMemLib.h>
+#include <Library/UsbProfileLib.h>
 #include <Protocol/NonDiscoverableDevice.h>
 
 typedef struct _USB2_HC_DEV  USB2_HC_DEV;
 
-#include "UsbHcMem.h"
 #include "EhciReg.h"
 #include "EhciUrb.h"
 #include "EhciSched.h"
@@ -65,6 +68,20 @@ typedef struct _USB2_HC_DEV  USB2_HC_DEV;
 #define EHC_SYNC_POLL_INTERVAL       (1 * EHC_1_MILLISECOND)
 #define EHC_ASYNC_POLL_INTERVAL      EFI_TIMER_PERIOD_MILLISECONDS(1)
 
+//
+// Longest pause between two checks of a synchronous transfer. Polling
+// starts at 1us and doubles up to this, a quarter of a microframe.
+//
+#define EHC_XFER_POLL_INTERVAL       (32 * EHC_1_MICROSECOND)
+
+//
+// QH and QTD kept preallocated per controller. A control transfer
+// takes one QH and up to three QTDs, a 64KB bulk transfer one QH and
+// four or five QTDs; interrupt endpoints hold their QH while polled.
+//
+#define EHC_QH_POOL_SIZE             8
+#define EHC_QTD_POOL_SIZE            32
+
 //
 // EHCI debug port control status register bit definition
 //
@@ -143,6 +160,15 @@ struct _USB2_HC_DEV {
   EHC_QH                    *PeriodOne;
   LIST_ENTRY                AsyncIntTransfers;
 
+  //
+  // Free QH (linked through NextQh) and QTD (linked through QtdList)
+  // reused by EhcCreateQh/EhcCreateQtd before going to MemPool.
+  //
+  EHC_QH                    *FreeQh;
+  UINTN                     FreeQhCount;
+  LIST_ENTRY                FreeQtds;
+  UINTN                     FreeQtdCount;
+
   //
   // EHCI configuration data
   //
@@ -163,6 +189,11 @@ struct _USB2_HC_DEV {
   UINT8                     DebugPortNum;    // The port number of usb debug port
 
   BOOLEAN                   Support64BitDma; // Whether 64 bit DMA may be used with this device
+
+  //
+  // Timing counters, NULL unless PcdUsbProfileEnable is set
+  //
+  USB_PROFILE               *Profile;
 };
 
 #endif
@@ -134,7 +134,7 @@ EhcClearOpRegBit (
   @param  Offset       The offset of the operation register.
   @param  Bit          The bit of the register to wait for.
   @param  WaitToSet    Wait the bit to set or clear.
-  @param  Timeout      The time to wait before abort (in millisecond).
+  @param  Timeout      The time to wait before abort (in microsecond).
 
   @retval EFI_SUCCESS  The bit successfully changed by host controller.
   @retval EFI_TIMEOUT  The time out occurred.
@@ -149,17 +149,101 @@ EhcWaitOpRegBit (
   IN UINT32               Timeout
   )
 {
-  UINT32                  Index;
+  UINT64                  TimeoutTicks;
+  UINT64                  ElapsedTicks;
+  UINT64                  TimeTick;
+  UINTN                   PollInterval;
 
-  for (Index = 0; Index < Timeout / EHC_SYNC_POLL_INTERVAL + 1; Index++) {
+  //
+  // Most bits change within a microframe or two: start polling
+  // finely and back off, so that short waits don't cost 1ms.
+  //
+  TimeoutTicks = EhcConvertTimeToTicks (Timeout);
+  ElapsedTicks = 0;
+  TimeTick     = GetPerformanceCounter ();
+  PollInterval = EHC_1_MICROSECOND;
+
+  while (TRUE) {
     if (EHC_REG_BIT_IS_SET (Ehc, Offset, Bit) == WaitToSet) {
       return EFI_SUCCESS;
     }
 
-    gBS->Stall (EHC_SYNC_POLL_INTERVAL);
+    if (ElapsedTicks >= TimeoutTicks) {
+      return EFI_TIMEOUT;
+    }
+
+    gBS->Stall (PollInterval);
+    PollInterval  = MIN (PollInterval * 2, EHC_SYNC_POLL_INTERVAL);
+    ElapsedTicks += EhcGetElapsedTicks (&TimeTick);
   }
+}
+
+/**
+  Convert a time to performance counter ticks.
 
-  return EFI_TIMEOUT;
+  @param  Time         The time in microsecond.
+
+  @return The number of ticks the time lasts.
+
+**/
+UINT64
+EhcConvertTimeToTicks (
+  IN UINT64               Time
+  )
+{
+  UINT64                  Frequency;
+  UINT64                  Remainder;
+  UINT64                  Ticks;
+
+  Frequency = GetPerformanceCounterProperties (NULL, NULL);
+
+  //
+  // Split the time so that the multiplication can't overflow
+  //
+  Ticks = MultU64x64 (DivU64x64Remainder (Time, 1000000, &Remainder), Frequency);
+  Ticks += DivU64x64Remainder (MultU64x64 (Remainder, Frequency), 1000000, NULL);
+
+  return Ticks;
+}
+
+/**
+  Get the ticks elapsed since a previous reading of the performance
+  counter, and update that reading.
+
+  @param  PreviousTick The previous counter value, updated to the current one.
+
+  @return The number of ticks elapsed.
+
+**/
+UINT64
+EhcGetElapsedTicks (
+  IN OUT UINT64           *PreviousTick
+  )
+{
+  UINT64                  StartValue;
+  UINT64                  EndValue;
+  UINT64                  CurrentTick;
+  UINT64                  Delta;
+
+  CurrentTick = GetPerformanceCounter ();
+  GetPerformanceCounterProperties (&StartValue, &EndValue);
+
+  if (StartValue < EndValue) {
+    if (CurrentTick >= *PreviousTick) {
+      Delta = CurrentTick - *PreviousTick;
+    } else {
+      Delta = (EndValue - *PreviousTick) + (CurrentTick - StartValue);
+    }
+  } else {
+    if (CurrentTick <= *PreviousTick) {
+      Delta = *PreviousTick - CurrentTick;
+    } else {
+      Delta = (*PreviousTick - EndValue) + (StartValue - CurrentTick);
+    }
+  }
+
+  *PreviousTick = CurrentTick;
+  return Delta;
 }
 
 /**
@@ -167,7 +251,7 @@ EhcWaitOpRegBit (
   This function is used to synchronize with the hardware.
 
   @param  Ehc          The EHCI device.
-  @param  Timeout      The time to wait before abort (in millisecond, ms).
+  @param  Timeout      The time to wait before abort (in microsecond).
 
   @retval EFI_SUCCESS  Synchronized with the hardware.
   @retval EFI_TIMEOUT  Time out happened while waiting door bell to set.
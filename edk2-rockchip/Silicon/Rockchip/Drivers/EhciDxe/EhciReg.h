@@ -235,7 +235,7 @@ EhcClearLegacySupport (
   This function is used to synchronize with the hardware.
 
   @param  Ehc          The EHCI device.
-  @param  Timeout      The time to wait before abort (in millisecond, ms).
+  @param  Timeout      The time to wait before abort (in microsecond).
 
   @retval EFI_SUCCESS  Synchronized with the hardware.
   @retval EFI_TIMEOUT  Time out happened while waiting door bell to set.
@@ -248,6 +248,35 @@ EhcSetAndWaitDoorBell (
   );
 
 
+/**
+  Convert a time to performance counter ticks.
+
+  @param  Time         The time in microsecond.
+
+  @return The number of ticks the time lasts.
+
+**/
+UINT64
+EhcConvertTimeToTicks (
+  IN UINT64               Time
+  );
+
+
+/**
+  Get the ticks elapsed since a previous reading of the performance
+  counter, and update that reading.
+
+  @param  PreviousTick The previous counter value, updated to the current one.
+
+  @return The number of ticks elapsed.
+
+**/
+UINT64
+EhcGetElapsedTicks (
+  IN OUT UINT64           *PreviousTick
+  );
+
+
 /**
   Clear all the interrutp status bits, these bits are Write-Clean.
 
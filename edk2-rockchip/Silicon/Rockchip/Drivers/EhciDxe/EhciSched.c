@@ -64,7 +64,7 @@ EhcCreateHelpQ (
     return EFI_OUT_OF_RESOURCES;
   }
 
-  Addr           = UsbHcGetAddressForHostMem (Ehc->MemPool, Qh, sizeof (EHC_QH));
+  Addr           = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, Qh, sizeof (EHC_QH));
   QhHw              = &Qh->QhHw;
   QhHw->HorizonLink = QH_LINK (Addr + OFFSET_OF(EHC_QH, QhHw), EHC_TYPE_QH, FALSE);
   QhHw->Status      = QTD_STAT_HALTED;
@@ -172,6 +172,12 @@ EhcInitSched (
     goto ErrorExit1;
   }
 
+  Status = EhcInitQhQtdPool (Ehc);
+
+  if (EFI_ERROR (Status)) {
+    goto ErrorExit;
+  }
+
   Status = EhcCreateHelpQ (Ehc);
 
   if (EFI_ERROR (Status)) {
@@ -186,7 +192,7 @@ EhcInitSched (
     Status = EFI_OUT_OF_RESOURCES;
     goto ErrorExit;
   }
-  Addr  = UsbHcGetAddressForHostMem (Ehc->MemPool, Ehc->PeriodOne, sizeof (EHC_QH));
+  Addr  = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, Ehc->PeriodOne, sizeof (EHC_QH));
   for (Index = 0; Index < EHC_FRAME_LEN; Index++) {
     //
     // Store the pci bus address of the QH in period frame list which will be accessed by pci bus master.
@@ -203,7 +209,7 @@ EhcInitSched (
   // Only need to set the AsynListAddr register to
   // the reclamation header
   //
-  Addr = UsbHcGetAddressForHostMem (Ehc->MemPool, Ehc->ReclaimHead, sizeof (EHC_QH));
+  Addr = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, Ehc->ReclaimHead, sizeof (EHC_QH));
   EhcWriteOpReg (Ehc, EHC_ASYNC_HEAD_OFFSET, EHC_LOW_32BIT (Addr));
   return EFI_SUCCESS;
 
@@ -260,6 +266,14 @@ EhcFreeSched (
     Ehc->ShortReadStop = NULL;
   }
 
+  //
+  // The free QH/QTD live in the memory pool, released below
+  //
+  Ehc->FreeQh       = NULL;
+  Ehc->FreeQhCount  = 0;
+  Ehc->FreeQtdCount = 0;
+  InitializeListHead (&Ehc->FreeQtds);
+
   if (Ehc->MemPool != NULL) {
     UsbHcFreeMemPool (Ehc->MemPool);
     Ehc->MemPool = NULL;
@@ -313,9 +327,9 @@ EhcLinkQhToAsync (
   Qh->NextQh              = Head->NextQh;
   Head->NextQh            = Qh;
 
-  Addr = UsbHcGetAddressForHostMem (Ehc->MemPool, Qh->NextQh, sizeof (EHC_QH));
+  Addr = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, Qh->NextQh, sizeof (EHC_QH));
   Qh->QhHw.HorizonLink    = QH_LINK (Addr, EHC_TYPE_QH, FALSE);
-  Addr = UsbHcGetAddressForHostMem (Ehc->MemPool, Head->NextQh, sizeof (EHC_QH));
+  Addr = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, Head->NextQh, sizeof (EHC_QH));
   Head->QhHw.HorizonLink  = QH_LINK (Addr, EHC_TYPE_QH, FALSE);
 }
 
@@ -350,7 +364,7 @@ EhcUnlinkQhFromAsync (
   Head->NextQh            = Qh->NextQh;
   Qh->NextQh              = NULL;
 
-  Addr = UsbHcGetAddressForHostMem (Ehc->MemPool, Head->NextQh, sizeof (EHC_QH));
+  Addr = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, Head->NextQh, sizeof (EHC_QH));
   Head->QhHw.HorizonLink  = QH_LINK (Addr, EHC_TYPE_QH, FALSE);
 
   //
@@ -438,7 +452,7 @@ EhcLinkQhToPeriod (
       Prev->NextQh            = Qh;
 
       Qh->QhHw.HorizonLink    = Prev->QhHw.HorizonLink;
-      Addr = UsbHcGetAddressForHostMem (Ehc->MemPool, Qh, sizeof (EHC_QH));
+      Addr = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, Qh, sizeof (EHC_QH));
       Prev->QhHw.HorizonLink  = QH_LINK (Addr, EHC_TYPE_QH, FALSE);
       break;
     }
@@ -450,11 +464,11 @@ EhcLinkQhToPeriod (
     //
     if (Qh->NextQh == NULL) {
       Qh->NextQh              = Next;
-      Addr = UsbHcGetAddressForHostMem (Ehc->MemPool, Next, sizeof (EHC_QH));
+      Addr = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, Next, sizeof (EHC_QH));
       Qh->QhHw.HorizonLink    = QH_LINK (Addr, EHC_TYPE_QH, FALSE);
     }
 
-    Addr = UsbHcGetAddressForHostMem (Ehc->MemPool, Qh, sizeof (EHC_QH));
+    Addr = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, Qh, sizeof (EHC_QH));
 
     if (Prev == NULL) {
       ((UINT32*)Ehc->PeriodFrame)[Index]     = QH_LINK (Addr, EHC_TYPE_QH, FALSE);
@@ -616,7 +630,7 @@ EhcCheckUrbResult (
         // ShortReadStop. If it is a setup transfer, need to check the
         // Status Stage of the setup transfer to get the finial result
         //
-        Addr = UsbHcGetAddressForHostMem (Ehc->MemPool, Ehc->ShortReadStop, sizeof (EHC_QTD));
+        Addr = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, Ehc->ShortReadStop, sizeof (EHC_QTD));
         if (QtdHw->AltNext == QTD_LINK (Addr, FALSE)) {
           DEBUG ((EFI_D_VERBOSE, "EhcCheckUrbResult: Short packet read, break\n"));
 
@@ -665,13 +679,15 @@ EhcExecTransfer (
   )
 {
   EFI_STATUS              Status;
-  UINTN                   Index;
-  UINTN                   Loop;
+  UINT64                  TimeoutTicks;
+  UINT64                  ElapsedTicks;
+  UINT64                  TimeTick;
+  UINTN                   PollInterval;
   BOOLEAN                 Finished;
   BOOLEAN                 InfiniteLoop;
+  UINT64                  PollTick;
 
   Status       = EFI_SUCCESS;
-  Loop         = TimeOut * EHC_1_MILLISECOND;
   Finished     = FALSE;
   InfiniteLoop = FALSE;
 
@@ -684,16 +700,31 @@ EhcExecTransfer (
     InfiniteLoop = TRUE;
   }
 
-  for (Index = 0; InfiniteLoop || (Index < Loop); Index++) {
+  //
+  // The deadline is kept with the performance counter, so the time spent
+  // checking the QTDs counts too. Short transfers are caught within a few
+  // microseconds, longer ones are polled less often.
+  //
+  TimeoutTicks = EhcConvertTimeToTicks (MultU64x32 (TimeOut, EHC_1_MILLISECOND));
+  ElapsedTicks = 0;
+  TimeTick     = GetPerformanceCounter ();
+  PollInterval = EHC_1_MICROSECOND;
+  PollTick     = USB_PROFILE_TIMESTAMP ();
+
+  while (TRUE) {
     Finished = EhcCheckUrbResult (Ehc, Urb);
 
-    if (Finished) {
+    if (Finished || (!InfiniteLoop && (ElapsedTicks >= TimeoutTicks))) {
       break;
     }
 
-    gBS->Stall (EHC_1_MICROSECOND);
+    gBS->Stall (PollInterval);
+    PollInterval  = MIN (PollInterval * 2, EHC_XFER_POLL_INTERVAL);
+    ElapsedTicks += EhcGetElapsedTicks (&TimeTick);
   }
 
+  USB_PROFILE_POLL (Ehc->Profile, PollTick);
+
   if (!Finished) {
     DEBUG ((EFI_D_ERROR, "EhcExecTransfer: transfer not finished in %dms\n", (UINT32)TimeOut));
     EhcDumpQh (Urb->Qh, NULL, FALSE);
@@ -899,14 +930,14 @@ EhcFlushAsyncIntMap (
     MapOp = MapOperationBusMasterRead;
   }
 
-  Status = DmaUnmap (Urb->DataMap);
+  Status = DmaBufferUnmap (Urb->DataMap);
   if (EFI_ERROR (Status)) {
     goto ON_ERROR;
   }
 
   Urb->DataMap = NULL;
 
-  Status = DmaMap (MapOp, Urb->Data, &Len, &PhyAddr, &Map);
+  Status = DmaBufferMap (MapOp, Urb->Data, &Len, &PhyAddr, &Map);
   if (EFI_ERROR (Status) || (Len != Urb->DataLen)) {
     goto ON_ERROR;
   }
@@ -996,7 +1027,7 @@ EhcUpdateAsyncRequest (
       QhHw->PageHigh[Index] = 0;
     }
 
-    Addr = UsbHcGetAddressForHostMem (Ehc->MemPool, FirstQtd, sizeof (EHC_QTD));
+    Addr = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, FirstQtd, sizeof (EHC_QTD));
     QhHw->NextQtd = QTD_LINK (Addr, FALSE);
   }
 
@@ -12,6 +12,100 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include "Ehci.h"
 
 
+/**
+  Return a QTD to the free list of the controller, or to the memory
+  pool once the free list is full.
+
+  @param  Ehc                   The EHCI device.
+  @param  Qtd                   The QTD to free.
+
+**/
+VOID
+EhcFreeQtd (
+  IN USB2_HC_DEV          *Ehc,
+  IN EHC_QTD              *Qtd
+  )
+{
+  if (Ehc->FreeQtdCount >= EHC_QTD_POOL_SIZE) {
+    UsbHcFreeMem (Ehc->MemPool, Qtd, sizeof (EHC_QTD));
+    return;
+  }
+
+  InsertHeadList (&Ehc->FreeQtds, &Qtd->QtdList);
+  Ehc->FreeQtdCount++;
+}
+
+
+/**
+  Return a queue head to the free list of the controller, or to the
+  memory pool once the free list is full.
+
+  @param  Ehc                   The EHCI device.
+  @param  Qh                    The queue head to free.
+
+**/
+VOID
+EhcFreeQh (
+  IN USB2_HC_DEV          *Ehc,
+  IN EHC_QH               *Qh
+  )
+{
+  if (Ehc->FreeQhCount >= EHC_QH_POOL_SIZE) {
+    UsbHcFreeMem (Ehc->MemPool, Qh, sizeof (EHC_QH));
+    return;
+  }
+
+  Qh->NextQh  = Ehc->FreeQh;
+  Ehc->FreeQh = Qh;
+  Ehc->FreeQhCount++;
+}
+
+
+/**
+  Preallocate the QH and QTD handed out by EhcCreateQh and EhcCreateQtd,
+  so that the common transfers don't go through the memory pool.
+
+  @param  Ehc                   The EHCI device, with its memory pool created.
+
+  @retval EFI_OUT_OF_RESOURCES  Failed to allocate the QH or QTD.
+  @retval EFI_SUCCESS           The free lists are filled.
+
+**/
+EFI_STATUS
+EhcInitQhQtdPool (
+  IN USB2_HC_DEV          *Ehc
+  )
+{
+  EHC_QH                  *Qh;
+  EHC_QTD                 *Qtd;
+
+  Ehc->FreeQh       = NULL;
+  Ehc->FreeQhCount  = 0;
+  Ehc->FreeQtdCount = 0;
+  InitializeListHead (&Ehc->FreeQtds);
+
+  while (Ehc->FreeQhCount < EHC_QH_POOL_SIZE) {
+    Qh = UsbHcAllocateMem (Ehc->MemPool, sizeof (EHC_QH));
+    if (Qh == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    EhcFreeQh (Ehc, Qh);
+  }
+
+  while (Ehc->FreeQtdCount < EHC_QTD_POOL_SIZE) {
+    Qtd = UsbHcAllocateMem (Ehc->MemPool, sizeof (EHC_QTD));
+    if (Qtd == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    EhcFreeQtd (Ehc, Qtd);
+  }
+
+  return EFI_SUCCESS;
+}
+
+
 /**
   Create a single QTD to hold the data.
 
@@ -45,7 +139,14 @@ EhcCreateQtd (
 
   ASSERT (Ehc != NULL);
 
-  Qtd = UsbHcAllocateMem (Ehc->MemPool, sizeof (EHC_QTD));
+  if (!IsListEmpty (&Ehc->FreeQtds)) {
+    Qtd = EFI_LIST_CONTAINER (GetFirstNode (&Ehc->FreeQtds), EHC_QTD, QtdList);
+    RemoveEntryList (&Qtd->QtdList);
+    Ehc->FreeQtdCount--;
+    ZeroMem (Qtd, sizeof (EHC_QTD));
+  } else {
+    Qtd = UsbHcAllocateMem (Ehc->MemPool, sizeof (EHC_QTD));
+  }
 
   if (Qtd == NULL) {
     return NULL;
@@ -177,7 +278,14 @@ EhcCreateQh (
   EHC_QH                  *Qh;
   QH_HW                   *QhHw;
 
-  Qh = UsbHcAllocateMem (Ehci->MemPool, sizeof (EHC_QH));
+  if (Ehci->FreeQh != NULL) {
+    Qh                = Ehci->FreeQh;
+    Ehci->FreeQh      = Qh->NextQh;
+    Ehci->FreeQhCount--;
+    ZeroMem (Qh, sizeof (EHC_QH));
+  } else {
+    Qh = UsbHcAllocateMem (Ehci->MemPool, sizeof (EHC_QH));
+  }
 
   if (Qh == NULL) {
     return NULL;
@@ -304,7 +412,7 @@ EhcFreeQtds (
     Qtd = EFI_LIST_CONTAINER (Entry, EHC_QTD, QtdList);
 
     RemoveEntryList (&Qtd->QtdList);
-    UsbHcFreeMem (Ehc->MemPool, Qtd, sizeof (EHC_QTD));
+    EhcFreeQtd (Ehc, Qtd);
   }
 }
 
@@ -324,11 +432,11 @@ EhcFreeUrb (
 {
 
   if (Urb->RequestPhy != NULL) {
-    DmaUnmap (Urb->RequestMap);
+    DmaBufferUnmap (Urb->RequestMap);
   }
 
   if (Urb->DataMap != NULL) {
-    DmaUnmap (Urb->DataMap);
+    DmaBufferUnmap (Urb->DataMap);
   }
 
   if (Urb->Qh != NULL) {
@@ -337,7 +445,7 @@ EhcFreeUrb (
     // schedule data structures. Free all the associated QTDs
     //
     EhcFreeQtds (Ehc, &Urb->Qh->Qtds);
-    UsbHcFreeMem (Ehc->MemPool, Urb->Qh, sizeof (EHC_QH));
+    EhcFreeQh (Ehc, Urb->Qh);
   }
 
   gBS->FreePool (Urb);
@@ -386,7 +494,7 @@ EhcCreateQtds (
   StatusQtd = NULL;
   AlterNext = QTD_LINK (NULL, TRUE);
 
-  PhyAddr   = UsbHcGetAddressForHostMem (Ehc->MemPool, Ehc->ShortReadStop, sizeof (EHC_QTD));
+  PhyAddr   = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, Ehc->ShortReadStop, sizeof (EHC_QTD));
   if (Ep->Direction == EfiUsbDataIn) {
     AlterNext = QTD_LINK (PhyAddr, FALSE);
   }
@@ -423,7 +531,7 @@ EhcCreateQtds (
     }
 
     if (Ep->Direction == EfiUsbDataIn) {
-      PhyAddr   = UsbHcGetAddressForHostMem (Ehc->MemPool, StatusQtd, sizeof (EHC_QTD));
+      PhyAddr   = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, StatusQtd, sizeof (EHC_QTD));
       AlterNext = QTD_LINK (PhyAddr, FALSE);
     }
 
@@ -491,7 +599,7 @@ EhcCreateQtds (
     }
 
     NextQtd             = EFI_LIST_CONTAINER (Entry->ForwardLink, EHC_QTD, QtdList);
-    PhyAddr             = UsbHcGetAddressForHostMem (Ehc->MemPool, NextQtd, sizeof (EHC_QTD));
+    PhyAddr             = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, NextQtd, sizeof (EHC_QTD));
     Qtd->QtdHw.NextQtd  = QTD_LINK (PhyAddr, FALSE);
   }
 
@@ -499,7 +607,7 @@ EhcCreateQtds (
   // Link the QTDs to the queue head
   //
   NextQtd           = EFI_LIST_CONTAINER (Qh->Qtds.ForwardLink, EHC_QTD, QtdList);
-  PhyAddr           = UsbHcGetAddressForHostMem (Ehc->MemPool, NextQtd, sizeof (EHC_QTD));
+  PhyAddr           = UsbHcGetBusAddrForHostAddr (Ehc->MemPool, NextQtd, sizeof (EHC_QTD));
   Qh->QhHw.NextQtd  = QTD_LINK (PhyAddr, FALSE);
   return EFI_SUCCESS;
 
@@ -605,7 +713,7 @@ EhcCreateUrb (
   if (Request != NULL) {
     Len     = sizeof (EFI_USB_DEVICE_REQUEST);
     MapOp   = MapOperationBusMasterRead;
-    Status  = DmaMap (MapOp, Request, &Len, &PhyAddr, &Map);
+    Status  = DmaBufferMap (MapOp, Request, &Len, &PhyAddr, &Map);
 
     if (EFI_ERROR (Status) || (Len != sizeof (EFI_USB_DEVICE_REQUEST))) {
       goto ON_ERROR;
@@ -624,7 +732,7 @@ EhcCreateUrb (
       MapOp = MapOperationBusMasterRead;
     }
 
-    Status  = DmaMap (MapOp, Data, &Len, &PhyAddr, &Map);
+    Status  = DmaBufferMap (MapOp, Data, &Len, &PhyAddr, &Map);
 
     if (EFI_ERROR (Status) || (Len != DataLen)) {
       goto ON_ERROR;
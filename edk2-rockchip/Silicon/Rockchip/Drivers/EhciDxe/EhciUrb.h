@@ -232,6 +232,52 @@ struct _URB {
 
 
 
+/**
+  Return a QTD to the free list of the controller, or to the memory
+  pool once the free list is full.
+
+  @param  Ehc        The EHCI device.
+  @param  Qtd        The QTD to free.
+
+**/
+VOID
+EhcFreeQtd (
+  IN USB2_HC_DEV          *Ehc,
+  IN EHC_QTD              *Qtd
+  );
+
+
+/**
+  Return a queue head to the free list of the controller, or to the
+  memory pool once the free list is full.
+
+  @param  Ehc        The EHCI device.
+  @param  Qh         The queue head to free.
+
+**/
+VOID
+EhcFreeQh (
+  IN USB2_HC_DEV          *Ehc,
+  IN EHC_QH               *Qh
+  );
+
+
+/**
+  Preallocate the QH and QTD handed out by EhcCreateQh and EhcCreateQtd,
+  so that the common transfers don't go through the memory pool.
+
+  @param  Ehc        The EHCI device, with its memory pool created.
+
+  @retval EFI_OUT_OF_RESOURCES  Failed to allocate the QH or QTD.
+  @retval EFI_SUCCESS           The free lists are filled.
+
+**/
+EFI_STATUS
+EhcInitQhQtdPool (
+  IN USB2_HC_DEV          *Ehc
+  );
+
+
 /**
   Create a single QTD to hold the data.
 
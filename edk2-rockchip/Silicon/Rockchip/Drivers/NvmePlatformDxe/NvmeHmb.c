@@ -0,0 +1,389 @@
+/** @file
+  Host Memory Buffer for the DRAM-less NVMe SSDs.
+
+  NvmExpressDxe never enables the Host Memory Buffer feature, and the
+  controllers that ask for one run their flash translation layer out of a
+  few KiB of SRAM until they get it. The buffer given here comes from
+  DmaLib, which maps it uncached since the PCIe controllers do not snoop
+  the CPU caches. It is boot services data: the controller gives it back
+  when the driver stops, and before ExitBootServices, so that the OS finds
+  the feature disabled and can set up its own buffer.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "NvmePlatformDxe.h"
+
+STATIC LIST_ENTRY mHmbList = INITIALIZE_LIST_HEAD_VARIABLE (mHmbList);
+
+/**
+  Send an admin command to a controller and wait for its completion.
+
+  @param  PassThru              The NVM Express Pass Thru protocol.
+  @param  Command               The command.
+  @param  Buffer                The data buffer, or NULL.
+  @param  Length                The size of the data buffer.
+
+  @retval EFI_SUCCESS           The command completed successfully.
+  @return Others                See EFI_NVM_EXPRESS_PASS_THRU_PASSTHRU.
+
+**/
+STATIC
+EFI_STATUS
+NvmeAdminCommand (
+  IN EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL  *PassThru,
+  IN EFI_NVM_EXPRESS_COMMAND             *Command,
+  IN VOID                                *Buffer,
+  IN UINT32                              Length
+  )
+{
+  EFI_NVM_EXPRESS_PASS_THRU_COMMAND_PACKET  Packet;
+  EFI_NVM_EXPRESS_COMPLETION                Completion;
+
+  ZeroMem (&Packet, sizeof (Packet));
+  ZeroMem (&Completion, sizeof (Completion));
+
+  Packet.CommandTimeout = NVME_ADMIN_TIMEOUT;
+  Packet.TransferBuffer = Buffer;
+  Packet.TransferLength = Length;
+  Packet.QueueType      = NVME_ADMIN_QUEUE;
+  Packet.NvmeCmd        = Command;
+  Packet.NvmeCompletion = &Completion;
+
+  return PassThru->PassThru (PassThru, 0, &Packet, NULL);
+}
+
+/**
+  Read the Host Memory Buffer sizes a controller supports.
+
+  @param  PassThru              The NVM Express Pass Thru protocol.
+  @param  Preferred             The preferred size, in bytes.
+  @param  Minimum               The minimum size, in bytes.
+  @param  MinimumDescriptor     The smallest buffer a descriptor may
+                                describe, in bytes.
+
+  @retval EFI_SUCCESS           The sizes are read.
+  @return Others                The Identify command failed.
+
+**/
+STATIC
+EFI_STATUS
+NvmeHmbGetSizes (
+  IN  EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL  *PassThru,
+  OUT UINT64                              *Preferred,
+  OUT UINT64                              *Minimum,
+  OUT UINT64                              *MinimumDescriptor
+  )
+{
+  EFI_NVM_EXPRESS_COMMAND       Command;
+  UINT8                         *Data;
+  EFI_STATUS                    Status;
+
+  Data = AllocatePages (EFI_SIZE_TO_PAGES (NVME_IDENTIFY_DATA_SIZE));
+  if (Data == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  ZeroMem (&Command, sizeof (Command));
+  Command.Cdw0.Opcode = NVME_ADMIN_IDENTIFY_CMD;
+  Command.Cdw10       = NVME_IDENTIFY_CNS_CONTROLLER;
+  Command.Flags       = CDW10_VALID;
+
+  Status = NvmeAdminCommand (PassThru, &Command, Data, NVME_IDENTIFY_DATA_SIZE);
+  if (!EFI_ERROR (Status)) {
+    *Preferred         = MultU64x32 (ReadUnaligned32 ((UINT32 *)(Data + NVME_IDENTIFY_HMPRE)), SIZE_4KB);
+    *Minimum           = MultU64x32 (ReadUnaligned32 ((UINT32 *)(Data + NVME_IDENTIFY_HMMIN)), SIZE_4KB);
+    *MinimumDescriptor = MultU64x32 (ReadUnaligned32 ((UINT32 *)(Data + NVME_IDENTIFY_HMMINDS)), SIZE_4KB);
+  }
+
+  FreePages (Data, EFI_SIZE_TO_PAGES (NVME_IDENTIFY_DATA_SIZE));
+  return Status;
+}
+
+/**
+  Allocate and map a Host Memory Buffer, with its descriptor list in the
+  first page.
+
+  @param  Controller            The handle of the controller.
+  @param  PassThru              Its NVM Express Pass Thru protocol.
+  @param  Size                  The size of the buffer, in bytes.
+
+  @return The buffer, or NULL if it cannot be allocated.
+
+**/
+STATIC
+NVME_HMB *
+NvmeHmbAllocate (
+  IN EFI_HANDLE                          Controller,
+  IN EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL  *PassThru,
+  IN UINTN                               Size
+  )
+{
+  NVME_HMB                      *Hmb;
+  UINTN                         Bytes;
+  EFI_STATUS                    Status;
+
+  Hmb = AllocateZeroPool (sizeof (NVME_HMB));
+  if (Hmb == NULL) {
+    return NULL;
+  }
+
+  Hmb->Controller = Controller;
+  Hmb->PassThru   = PassThru;
+  Hmb->Pages      = 1 + EFI_SIZE_TO_PAGES (Size);
+
+  Status = DmaAllocateAlignedBuffer (
+             EfiBootServicesData,
+             Hmb->Pages,
+             EFI_PAGE_SIZE,
+             &Hmb->Buffer
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreeHmb;
+  }
+
+  Bytes  = EFI_PAGES_TO_SIZE (Hmb->Pages);
+  Status = DmaMap (
+             MapOperationBusMasterCommonBuffer,
+             Hmb->Buffer,
+             &Bytes,
+             &Hmb->DeviceAddress,
+             &Hmb->Mapping
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreeBuffer;
+  }
+
+  if (Bytes != EFI_PAGES_TO_SIZE (Hmb->Pages)) {
+    DmaUnmap (Hmb->Mapping);
+    goto FreeBuffer;
+  }
+
+  return Hmb;
+
+FreeBuffer:
+  DmaFreeBuffer (Hmb->Pages, Hmb->Buffer);
+FreeHmb:
+  FreePool (Hmb);
+  return NULL;
+}
+
+/**
+  Unmap and free a Host Memory Buffer.
+
+  @param  Hmb                   The buffer.
+
+**/
+STATIC
+VOID
+NvmeHmbFree (
+  IN NVME_HMB                   *Hmb
+  )
+{
+  DmaUnmap (Hmb->Mapping);
+  DmaFreeBuffer (Hmb->Pages, Hmb->Buffer);
+  FreePool (Hmb);
+}
+
+/**
+  Take the Host Memory Buffer back from a controller, with Set Features
+  and EHM cleared.
+
+  @param  Hmb                   The buffer.
+
+  @retval EFI_SUCCESS           The controller no longer uses the buffer.
+  @return Others                See EFI_NVM_EXPRESS_PASS_THRU_PASSTHRU.
+
+**/
+STATIC
+EFI_STATUS
+NvmeHmbDisable (
+  IN NVME_HMB                   *Hmb
+  )
+{
+  EFI_NVM_EXPRESS_COMMAND       Command;
+
+  ZeroMem (&Command, sizeof (Command));
+  Command.Cdw0.Opcode = NVME_ADMIN_SET_FEATURES_CMD;
+  Command.Cdw10       = NVME_FEATURE_HOST_MEMORY_BUFFER;
+  Command.Cdw11       = 0;
+  Command.Flags       = CDW10_VALID | CDW11_VALID;
+
+  return NvmeAdminCommand (Hmb->PassThru, &Command, NULL, 0);
+}
+
+/**
+  Find the Host Memory Buffer of a controller.
+
+  @param  Controller            The handle of the controller.
+
+  @return The buffer, or NULL if the controller has none.
+
+**/
+STATIC
+NVME_HMB *
+NvmeHmbFind (
+  IN EFI_HANDLE                 Controller
+  )
+{
+  LIST_ENTRY                    *Link;
+
+  for (Link = GetFirstNode (&mHmbList); !IsNull (&mHmbList, Link); Link = GetNextNode (&mHmbList, Link)) {
+    if (BASE_CR (Link, NVME_HMB, Link)->Controller == Controller) {
+      return BASE_CR (Link, NVME_HMB, Link);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Give a controller a Host Memory Buffer if it asks for one.
+
+  @param  Controller            The handle of the controller.
+  @param  PassThru              Its NVM Express Pass Thru protocol.
+
+**/
+VOID
+NvmeHmbSetup (
+  IN EFI_HANDLE                          Controller,
+  IN EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL  *PassThru
+  )
+{
+  EFI_NVM_EXPRESS_COMMAND       Command;
+  NVME_HMB_DESCRIPTOR           *Descriptor;
+  NVME_HMB                      *Hmb;
+  UINT64                        Preferred;
+  UINT64                        Minimum;
+  UINT64                        MinimumDescriptor;
+  UINT64                        Size;
+  EFI_STATUS                    Status;
+
+  if (PcdGet32 (PcdNvmeHmbMaxSize) == 0) {
+    return;
+  }
+
+  Status = NvmeHmbGetSizes (PassThru, &Preferred, &Minimum, &MinimumDescriptor);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: Identify Controller failed: %r\n", __FUNCTION__, Status));
+    return;
+  }
+
+  if ((Preferred == 0) || (NvmeHmbFind (Controller) != NULL)) {
+    return;
+  }
+
+  Size = MIN (Preferred, PcdGet32 (PcdNvmeHmbMaxSize)) & ~((UINT64)NVME_HMB_PAGE_SIZE - 1);
+  if ((Size < Minimum) || (Size < MinimumDescriptor)) {
+    DEBUG ((
+      DEBUG_WARN,
+      "%a: %ld KiB Host Memory Buffer is below the minimum of the controller, %ld KiB\n",
+      __FUNCTION__,
+      Size / SIZE_1KB,
+      MAX (Minimum, MinimumDescriptor) / SIZE_1KB
+      ));
+    return;
+  }
+
+  Hmb = NvmeHmbAllocate (Controller, PassThru, (UINTN)Size);
+  if (Hmb == NULL) {
+    DEBUG ((DEBUG_WARN, "%a: Cannot allocate %ld KiB Host Memory Buffer\n", __FUNCTION__, Size / SIZE_1KB));
+    return;
+  }
+
+  //
+  // The buffer is uncached, so the device sees the descriptor as soon as
+  // it is written.
+  //
+  Descriptor = Hmb->Buffer;
+  ZeroMem (Descriptor, EFI_PAGE_SIZE);
+  Descriptor->Address = Hmb->DeviceAddress + EFI_PAGE_SIZE;
+  Descriptor->Size    = (UINT32)(Size / NVME_HMB_PAGE_SIZE);
+  MemoryFence ();
+
+  ZeroMem (&Command, sizeof (Command));
+  Command.Cdw0.Opcode = NVME_ADMIN_SET_FEATURES_CMD;
+  Command.Cdw10       = NVME_FEATURE_HOST_MEMORY_BUFFER;
+  Command.Cdw11       = NVME_HMB_ENABLE;
+  Command.Cdw12       = Descriptor->Size;
+  Command.Cdw13       = (UINT32)Hmb->DeviceAddress;
+  Command.Cdw14       = (UINT32)RShiftU64 (Hmb->DeviceAddress, 32);
+  Command.Cdw15       = 1;
+  Command.Flags       = CDW10_VALID | CDW11_VALID | CDW12_VALID |
+                        CDW13_VALID | CDW14_VALID | CDW15_VALID;
+
+  Status = NvmeAdminCommand (PassThru, &Command, NULL, 0);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: Cannot enable the Host Memory Buffer: %r\n", __FUNCTION__, Status));
+    NvmeHmbFree (Hmb);
+    return;
+  }
+
+  InsertTailList (&mHmbList, &Hmb->Link);
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: %ld KiB Host Memory Buffer at 0x%lx, controller prefers %ld KiB\n",
+    __FUNCTION__,
+    Size / SIZE_1KB,
+    Hmb->DeviceAddress + EFI_PAGE_SIZE,
+    Preferred / SIZE_1KB
+    ));
+}
+
+/**
+  Take the Host Memory Buffer back from a controller the driver stops
+  managing, and free it.
+
+  @param  Controller            The handle of the controller.
+
+**/
+VOID
+NvmeHmbStop (
+  IN EFI_HANDLE                 Controller
+  )
+{
+  NVME_HMB                      *Hmb;
+  EFI_STATUS                    Status;
+
+  Hmb = NvmeHmbFind (Controller);
+  if (Hmb == NULL) {
+    return;
+  }
+
+  RemoveEntryList (&Hmb->Link);
+
+  //
+  // A controller that may still use the buffer keeps it.
+  //
+  Status = NvmeHmbDisable (Hmb);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Cannot disable the Host Memory Buffer, leaking it: %r\n", __FUNCTION__, Status));
+    return;
+  }
+
+  NvmeHmbFree (Hmb);
+}
+
+/**
+  Take the Host Memory Buffers back from every controller before the OS
+  gets the memory.
+
+**/
+VOID
+NvmeHmbExitBootServices (
+  VOID
+  )
+{
+  LIST_ENTRY                    *Link;
+  EFI_STATUS                    Status;
+
+  for (Link = GetFirstNode (&mHmbList); !IsNull (&mHmbList, Link); Link = GetNextNode (&mHmbList, Link)) {
+    Status = NvmeHmbDisable (BASE_CR (Link, NVME_HMB, Link));
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: Cannot disable the Host Memory Buffer: %r\n", __FUNCTION__, Status));
+    }
+  }
+}
@@ -0,0 +1,333 @@
+/** @file
+  Platform NVMe policy.
+
+  NvmExpressDxe drives the SSDs behind the PCIe root complexes as it would
+  on any platform. This driver binds to the NVM Express Pass Thru of the
+  controllers it produces, to give a Host Memory Buffer to the DRAM-less
+  ones and take it back when either driver stops, and watches its
+  namespaces to add sequential read-ahead to their BlockIo, as configured
+  by PcdNvmeHmbMaxSize and PcdNvmeReadAheadSize.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "NvmePlatformDxe.h"
+
+STATIC VOID                     *mBlockIoRegistration;
+STATIC EFI_EVENT                mBlockIoEvent;
+STATIC EFI_EVENT                mBeforeExitBootServicesEvent;
+STATIC EFI_EVENT                mExitBootServicesEvent;
+
+/**
+  Test whether the driver supports a controller: any handle with an NVM
+  Express Pass Thru that no other driver manages.
+
+  See EFI_DRIVER_BINDING_SUPPORTED for the parameters and return values.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+NvmePlatformDriverBindingSupported (
+  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN EFI_HANDLE                   Controller,
+  IN EFI_DEVICE_PATH_PROTOCOL     *RemainingDevicePath
+  )
+{
+  EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL  *PassThru;
+  EFI_STATUS                          Status;
+
+  Status = gBS->OpenProtocol (
+                  Controller,
+                  &gEfiNvmExpressPassThruProtocolGuid,
+                  (VOID **)&PassThru,
+                  This->DriverBindingHandle,
+                  Controller,
+                  EFI_OPEN_PROTOCOL_BY_DRIVER
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  gBS->CloseProtocol (
+         Controller,
+         &gEfiNvmExpressPassThruProtocolGuid,
+         This->DriverBindingHandle,
+         Controller
+         );
+  return EFI_SUCCESS;
+}
+
+/**
+  Give a new NVMe controller a Host Memory Buffer.
+
+  The Pass Thru stays open by driver until Stop(): NvmExpressDxe cannot
+  uninstall it without stopping this driver first, while the controller
+  still runs commands.
+
+  See EFI_DRIVER_BINDING_START for the parameters and return values.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+NvmePlatformDriverBindingStart (
+  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN EFI_HANDLE                   Controller,
+  IN EFI_DEVICE_PATH_PROTOCOL     *RemainingDevicePath
+  )
+{
+  EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL  *PassThru;
+  EFI_STATUS                          Status;
+
+  Status = gBS->OpenProtocol (
+                  Controller,
+                  &gEfiNvmExpressPassThruProtocolGuid,
+                  (VOID **)&PassThru,
+                  This->DriverBindingHandle,
+                  Controller,
+                  EFI_OPEN_PROTOCOL_BY_DRIVER
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  NvmeHmbSetup (Controller, PassThru);
+  return EFI_SUCCESS;
+}
+
+/**
+  Take the Host Memory Buffer back from an NVMe controller, and forget its
+  namespaces, which NvmExpressDxe has stopped by then.
+
+  See EFI_DRIVER_BINDING_STOP for the parameters and return values.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+NvmePlatformDriverBindingStop (
+  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN EFI_HANDLE                   Controller,
+  IN UINTN                        NumberOfChildren,
+  IN EFI_HANDLE                   *ChildHandleBuffer
+  )
+{
+  NvmeHmbStop (Controller);
+  NvmeReadAheadPrune ();
+
+  return gBS->CloseProtocol (
+                Controller,
+                &gEfiNvmExpressPassThruProtocolGuid,
+                This->DriverBindingHandle,
+                Controller
+                );
+}
+
+STATIC EFI_DRIVER_BINDING_PROTOCOL  mNvmePlatformDriverBinding = {
+  NvmePlatformDriverBindingSupported,
+  NvmePlatformDriverBindingStart,
+  NvmePlatformDriverBindingStop,
+  0x10,
+  NULL,
+  NULL
+};
+
+/**
+  Add read-ahead to the new NVMe namespaces.
+
+  @param  Event                 The protocol notify event.
+  @param  Context               Not used.
+
+**/
+STATIC
+VOID
+EFIAPI
+NvmeBlockIoNotify (
+  IN EFI_EVENT                  Event,
+  IN VOID                       *Context
+  )
+{
+  EFI_HANDLE                    Handle;
+  UINTN                         BufferSize;
+  EFI_STATUS                    Status;
+
+  while (TRUE) {
+    BufferSize = sizeof (EFI_HANDLE);
+    Status = gBS->LocateHandle (
+                    ByRegisterNotify,
+                    NULL,
+                    mBlockIoRegistration,
+                    &BufferSize,
+                    &Handle
+                    );
+    if (EFI_ERROR (Status)) {
+      break;
+    }
+
+    NvmeReadAheadAttach (Handle);
+  }
+}
+
+/**
+  Take the Host Memory Buffers back while the Pass Thru still works: in
+  the ExitBootServices group the timer is already stopped and the memory
+  map final, and NvmExpressDxe needs both to run a command.
+
+  @param  Event                 The BeforeExitBootServices event.
+  @param  Context               Not used.
+
+**/
+STATIC
+VOID
+EFIAPI
+NvmeBeforeExitBootServices (
+  IN EFI_EVENT                  Event,
+  IN VOID                       *Context
+  )
+{
+  NvmeHmbExitBootServices ();
+}
+
+/**
+  Log how the read-ahead did for the boot loader.
+
+  @param  Event                 The ExitBootServices event.
+  @param  Context               Not used.
+
+**/
+STATIC
+VOID
+EFIAPI
+NvmeExitBootServices (
+  IN EFI_EVENT                  Event,
+  IN VOID                       *Context
+  )
+{
+  NvmeReadAheadLogSummary ();
+}
+
+/**
+  Stop the driver on every controller, unhook the namespaces and close the
+  events.
+
+  @param  ImageHandle           The image of the driver.
+
+  @retval EFI_SUCCESS           The driver can be unloaded.
+  @return Others                A controller cannot be disconnected.
+
+**/
+EFI_STATUS
+EFIAPI
+NvmePlatformDxeUnload (
+  IN EFI_HANDLE                 ImageHandle
+  )
+{
+  EFI_HANDLE                    *Handles;
+  UINTN                         HandleCount;
+  UINTN                         Index;
+  EFI_STATUS                    Status;
+
+  Status = gBS->LocateHandleBuffer (
+                  ByProtocol,
+                  &gEfiNvmExpressPassThruProtocolGuid,
+                  NULL,
+                  &HandleCount,
+                  &Handles
+                  );
+  if (!EFI_ERROR (Status)) {
+    for (Index = 0; Index < HandleCount; Index++) {
+      Status = gBS->DisconnectController (Handles[Index], ImageHandle, NULL);
+      if (EFI_ERROR (Status)) {
+        FreePool (Handles);
+        return Status;
+      }
+    }
+
+    FreePool (Handles);
+  }
+
+  Status = gBS->UninstallMultipleProtocolInterfaces (
+                  ImageHandle,
+                  &gEfiDriverBindingProtocolGuid,
+                  &mNvmePlatformDriverBinding,
+                  NULL
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (mBlockIoEvent != NULL) {
+    gBS->CloseEvent (mBlockIoEvent);
+  }
+
+  if (mBeforeExitBootServicesEvent != NULL) {
+    gBS->CloseEvent (mBeforeExitBootServicesEvent);
+  }
+
+  if (mExitBootServicesEvent != NULL) {
+    gBS->CloseEvent (mExitBootServicesEvent);
+  }
+
+  NvmeReadAheadDetachAll ();
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+NvmePlatformDxeEntryPoint (
+  IN EFI_HANDLE                 ImageHandle,
+  IN EFI_SYSTEM_TABLE           *SystemTable
+  )
+{
+  EFI_STATUS                    Status;
+
+  if ((PcdGet32 (PcdNvmeHmbMaxSize) == 0) && (PcdGet32 (PcdNvmeReadAheadSize) == 0)) {
+    return EFI_SUCCESS;
+  }
+
+  Status = EfiLibInstallDriverBinding (
+             ImageHandle,
+             SystemTable,
+             &mNvmePlatformDriverBinding,
+             ImageHandle
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (PcdGet32 (PcdNvmeHmbMaxSize) != 0) {
+    gBS->CreateEventEx (
+           EVT_NOTIFY_SIGNAL,
+           TPL_CALLBACK,
+           NvmeBeforeExitBootServices,
+           NULL,
+           &gEfiEventBeforeExitBootServicesGuid,
+           &mBeforeExitBootServicesEvent
+           );
+  }
+
+  if (PcdGet32 (PcdNvmeReadAheadSize) != 0) {
+    mBlockIoEvent = EfiCreateProtocolNotifyEvent (
+                      &gEfiBlockIoProtocolGuid,
+                      TPL_CALLBACK,
+                      NvmeBlockIoNotify,
+                      NULL,
+                      &mBlockIoRegistration
+                      );
+
+    gBS->CreateEventEx (
+           EVT_NOTIFY_SIGNAL,
+           TPL_CALLBACK,
+           NvmeExitBootServices,
+           NULL,
+           &gEfiEventExitBootServicesGuid,
+           &mExitBootServicesEvent
+           );
+  }
+
+  return EFI_SUCCESS;
+}
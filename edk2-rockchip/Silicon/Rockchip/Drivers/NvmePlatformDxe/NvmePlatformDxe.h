@@ -0,0 +1,200 @@
+/** @file
+  Definitions of the platform NVMe policy driver.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _NVME_PLATFORM_DXE_H_
+#define _NVME_PLATFORM_DXE_H_
+
+#include <Uefi.h>
+
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include <Protocol/DevicePath.h>
+#include <Protocol/NvmExpressPassthru.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/DmaLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+//
+// NVMe admin commands and features used here.
+//
+#define NVME_ADMIN_IDENTIFY_CMD           0x06
+#define NVME_ADMIN_SET_FEATURES_CMD       0x09
+#define NVME_IDENTIFY_CNS_CONTROLLER      0x01
+#define NVME_FEATURE_HOST_MEMORY_BUFFER   0x0D
+#define NVME_HMB_ENABLE                   BIT0
+
+//
+// Byte offsets of the Host Memory Buffer fields of the Identify Controller
+// data, all of them in 4 KiB units.
+//
+#define NVME_IDENTIFY_HMPRE               272
+#define NVME_IDENTIFY_HMMIN               276
+#define NVME_IDENTIFY_HMMINDS             332
+#define NVME_IDENTIFY_DATA_SIZE           4096
+
+//
+// NvmExpressDxe runs the controllers with CC.MPS = 0, so the memory page
+// size the HMB is counted in is 4 KiB.
+//
+#define NVME_HMB_PAGE_SIZE                SIZE_4KB
+
+//
+// Timeout of the admin commands, in 100 ns units.
+//
+#define NVME_ADMIN_TIMEOUT                EFI_TIMER_PERIOD_SECONDS (5)
+
+//
+// Host Memory Buffer Descriptor Entry (NVMe 1.4, 5.21.1.13).
+//
+#pragma pack(1)
+typedef struct {
+  UINT64                          Address;
+  UINT32                          Size;     // In memory page size units
+  UINT32                          Reserved;
+} NVME_HMB_DESCRIPTOR;
+#pragma pack()
+
+//
+// The Host Memory Buffer given to a controller, while the controller uses
+// it.
+//
+typedef struct {
+  LIST_ENTRY                          Link;
+  EFI_HANDLE                          Controller;
+  EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL  *PassThru;
+  VOID                                *Buffer;  // Descriptor list, then the HMB
+  UINTN                               Pages;
+  EFI_PHYSICAL_ADDRESS                DeviceAddress;
+  VOID                                *Mapping;
+} NVME_HMB;
+
+#define NVME_READ_AHEAD_SIGNATURE         SIGNATURE_32 ('n', 'v', 'r', 'a')
+
+//
+// Read-ahead state of one NVMe namespace.
+//
+// The namespace BlockIo of NvmExpressDxe is hooked in place and
+// reinstalled, so the partition and disk drivers above it, and the boot
+// loaders reading the raw disk, go through NvmeReadAheadReadBlocks(). The
+// blocking BlockIo2 reads, without a token or without an event, share the
+// window; the non-blocking ones go straight to NvmExpressDxe. Writes and
+// resets through either BlockIo or BlockIo2 drop the window. The window and
+// the list of states are only used at TPL_CALLBACK.
+//
+// The state of a namespace NvmExpressDxe stops is dropped when this driver
+// stops the controller, or when the next namespace is hooked. The hooks
+// are removed when the driver unloads.
+//
+typedef struct {
+  UINT32                          Signature;
+  LIST_ENTRY                      Link;
+  EFI_HANDLE                      Handle;
+  EFI_BLOCK_IO_PROTOCOL           *BlockIo;
+  EFI_BLOCK_IO2_PROTOCOL          *BlockIo2;
+  EFI_BLOCK_READ                  ReadBlocks;
+  EFI_BLOCK_WRITE                 WriteBlocks;
+  EFI_BLOCK_RESET                 Reset;
+  EFI_BLOCK_READ_EX               ReadBlocksEx;
+  EFI_BLOCK_WRITE_EX              WriteBlocksEx;
+  EFI_BLOCK_RESET_EX              ResetEx;
+
+  UINT8                           *Window;
+  UINTN                           WindowSize;   // Bytes allocated
+  UINT32                          MediaId;
+  EFI_LBA                         WindowLba;
+  UINTN                           WindowBlocks; // Valid blocks, 0 when empty
+  EFI_LBA                         NextLba;      // End of the last read
+
+  UINT64                          Hits;
+  UINT64                          Fills;
+  UINT64                          Bypassed;
+} NVME_READ_AHEAD;
+
+/**
+  Give a controller a Host Memory Buffer if it asks for one.
+
+  @param  Controller            The handle of the controller.
+  @param  PassThru              Its NVM Express Pass Thru protocol.
+
+**/
+VOID
+NvmeHmbSetup (
+  IN EFI_HANDLE                          Controller,
+  IN EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL  *PassThru
+  );
+
+/**
+  Take the Host Memory Buffer back from a controller the driver stops
+  managing, and free it.
+
+  @param  Controller            The handle of the controller.
+
+**/
+VOID
+NvmeHmbStop (
+  IN EFI_HANDLE                 Controller
+  );
+
+/**
+  Take the Host Memory Buffers back from every controller before the OS
+  gets the memory.
+
+**/
+VOID
+NvmeHmbExitBootServices (
+  VOID
+  );
+
+/**
+  Hook the BlockIo of an NVMe namespace for sequential read-ahead.
+
+  @param  Handle                The handle with the BlockIo.
+
+**/
+VOID
+NvmeReadAheadAttach (
+  IN EFI_HANDLE                   Handle
+  );
+
+/**
+  Forget the namespaces NvmExpressDxe has stopped. Their BlockIo is freed
+  with them, so there is nothing to restore.
+
+**/
+VOID
+NvmeReadAheadPrune (
+  VOID
+  );
+
+/**
+  Unhook the BlockIo of every namespace, for the driver to unload.
+
+**/
+VOID
+NvmeReadAheadDetachAll (
+  VOID
+  );
+
+/**
+  Log the read-ahead counters of every namespace.
+
+**/
+VOID
+NvmeReadAheadLogSummary (
+  VOID
+  );
+
+#endif
@@ -0,0 +1,607 @@
+/** @file
+  Sequential read-ahead on the NVMe namespaces.
+
+  The boot loaders read their files through BlockIo a few clusters at a
+  time, so loading a kernel is thousands of small synchronous commands.
+  Once a read starts where the previous one ended, the next
+  PcdNvmeReadAheadSize bytes are read with one command into a window, and
+  the reads that follow are served from it.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "NvmePlatformDxe.h"
+
+STATIC LIST_ENTRY mReadAheadList = INITIALIZE_LIST_HEAD_VARIABLE (mReadAheadList);
+
+/**
+  Find the read-ahead state of a hooked BlockIo.
+
+  @param  BlockIo               The BlockIo.
+
+  @return The state, or NULL if the BlockIo is not hooked.
+
+**/
+STATIC
+NVME_READ_AHEAD *
+NvmeReadAheadFind (
+  IN EFI_BLOCK_IO_PROTOCOL      *BlockIo
+  )
+{
+  LIST_ENTRY                    *Link;
+  NVME_READ_AHEAD               *ReadAhead;
+
+  for (Link = GetFirstNode (&mReadAheadList); !IsNull (&mReadAheadList, Link); Link = GetNextNode (&mReadAheadList, Link)) {
+    ReadAhead = CR (Link, NVME_READ_AHEAD, Link, NVME_READ_AHEAD_SIGNATURE);
+    if (ReadAhead->BlockIo == BlockIo) {
+      return ReadAhead;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Find the read-ahead state of a hooked BlockIo2.
+
+  @param  BlockIo2              The BlockIo2.
+
+  @return The state, or NULL if the BlockIo2 is not hooked.
+
+**/
+STATIC
+NVME_READ_AHEAD *
+NvmeReadAheadFind2 (
+  IN EFI_BLOCK_IO2_PROTOCOL     *BlockIo2
+  )
+{
+  LIST_ENTRY                    *Link;
+  NVME_READ_AHEAD               *ReadAhead;
+
+  for (Link = GetFirstNode (&mReadAheadList); !IsNull (&mReadAheadList, Link); Link = GetNextNode (&mReadAheadList, Link)) {
+    ReadAhead = CR (Link, NVME_READ_AHEAD, Link, NVME_READ_AHEAD_SIGNATURE);
+    if (ReadAhead->BlockIo2 == BlockIo2) {
+      return ReadAhead;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Read blocks, from the read-ahead window when it holds them.
+
+  Called at TPL_CALLBACK, so that an event cannot read or refill the
+  window while it is in use.
+
+  @param  ReadAhead             The read-ahead state of the namespace.
+
+  See EFI_BLOCK_READ for the other parameters and the return values.
+
+**/
+STATIC
+EFI_STATUS
+NvmeReadAheadRead (
+  IN  NVME_READ_AHEAD           *ReadAhead,
+  IN  EFI_BLOCK_IO_PROTOCOL     *This,
+  IN  UINT32                    MediaId,
+  IN  EFI_LBA                   Lba,
+  IN  UINTN                     BufferSize,
+  OUT VOID                      *Buffer
+  )
+{
+  EFI_BLOCK_IO_MEDIA            *Media;
+  UINTN                         Blocks;
+  UINTN                         Count;
+  BOOLEAN                       Sequential;
+  EFI_STATUS                    Status;
+
+  //
+  // Leave the argument checks and the unusual requests to NvmExpressDxe.
+  //
+  Media = This->Media;
+  if ((Buffer == NULL) || (BufferSize == 0) ||
+      (MediaId != Media->MediaId) || ((BufferSize % Media->BlockSize) != 0) ||
+      (Lba > Media->LastBlock))
+  {
+    return ReadAhead->ReadBlocks (This, MediaId, Lba, BufferSize, Buffer);
+  }
+
+  Blocks = BufferSize / Media->BlockSize;
+  if ((ReadAhead->WindowBlocks != 0) && (ReadAhead->MediaId == MediaId) &&
+      (Lba >= ReadAhead->WindowLba) &&
+      (Lba + Blocks <= ReadAhead->WindowLba + ReadAhead->WindowBlocks))
+  {
+    CopyMem (
+      Buffer,
+      ReadAhead->Window + (UINTN)(Lba - ReadAhead->WindowLba) * Media->BlockSize,
+      BufferSize
+      );
+    ReadAhead->NextLba = Lba + Blocks;
+    ReadAhead->Hits++;
+    return EFI_SUCCESS;
+  }
+
+  Sequential         = (BOOLEAN)(Lba == ReadAhead->NextLba);
+  ReadAhead->NextLba = Lba + Blocks;
+  if (!Sequential || (BufferSize >= ReadAhead->WindowSize)) {
+    ReadAhead->Bypassed++;
+    return ReadAhead->ReadBlocks (This, MediaId, Lba, BufferSize, Buffer);
+  }
+
+  if (ReadAhead->Window == NULL) {
+    ReadAhead->Window = AllocateAlignedPages (
+                          EFI_SIZE_TO_PAGES (ReadAhead->WindowSize),
+                          MAX (Media->IoAlign, EFI_PAGE_SIZE)
+                          );
+    if (ReadAhead->Window == NULL) {
+      ReadAhead->Bypassed++;
+      return ReadAhead->ReadBlocks (This, MediaId, Lba, BufferSize, Buffer);
+    }
+  }
+
+  Count = ReadAhead->WindowSize / Media->BlockSize;
+  if (Count > Media->LastBlock - Lba + 1) {
+    Count = (UINTN)(Media->LastBlock - Lba + 1);
+  }
+
+  if (Count < Blocks) {
+    ReadAhead->Bypassed++;
+    return ReadAhead->ReadBlocks (This, MediaId, Lba, BufferSize, Buffer);
+  }
+
+  ReadAhead->WindowBlocks = 0;
+  Status = ReadAhead->ReadBlocks (This, MediaId, Lba, Count * Media->BlockSize, ReadAhead->Window);
+  if (EFI_ERROR (Status)) {
+    ReadAhead->Bypassed++;
+    return ReadAhead->ReadBlocks (This, MediaId, Lba, BufferSize, Buffer);
+  }
+
+  ReadAhead->MediaId      = MediaId;
+  ReadAhead->WindowLba    = Lba;
+  ReadAhead->WindowBlocks = Count;
+  ReadAhead->Fills++;
+
+  CopyMem (Buffer, ReadAhead->Window, BufferSize);
+  return EFI_SUCCESS;
+}
+
+/**
+  Read blocks, from the read-ahead window when it holds them.
+
+  See EFI_BLOCK_READ for the parameters and return values.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+NvmeReadAheadReadBlocks (
+  IN  EFI_BLOCK_IO_PROTOCOL     *This,
+  IN  UINT32                    MediaId,
+  IN  EFI_LBA                   Lba,
+  IN  UINTN                     BufferSize,
+  OUT VOID                      *Buffer
+  )
+{
+  NVME_READ_AHEAD               *ReadAhead;
+  EFI_TPL                       OldTpl;
+  EFI_STATUS                    Status;
+
+  OldTpl    = gBS->RaiseTPL (TPL_CALLBACK);
+  ReadAhead = NvmeReadAheadFind (This);
+  ASSERT (ReadAhead != NULL);
+
+  Status = NvmeReadAheadRead (ReadAhead, This, MediaId, Lba, BufferSize, Buffer);
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  Drop the read-ahead window and write blocks.
+
+  See EFI_BLOCK_WRITE for the parameters and return values.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+NvmeReadAheadWriteBlocks (
+  IN EFI_BLOCK_IO_PROTOCOL      *This,
+  IN UINT32                     MediaId,
+  IN EFI_LBA                    Lba,
+  IN UINTN                      BufferSize,
+  IN VOID                       *Buffer
+  )
+{
+  NVME_READ_AHEAD               *ReadAhead;
+  EFI_TPL                       OldTpl;
+  EFI_STATUS                    Status;
+
+  OldTpl    = gBS->RaiseTPL (TPL_CALLBACK);
+  ReadAhead = NvmeReadAheadFind (This);
+  ASSERT (ReadAhead != NULL);
+
+  ReadAhead->WindowBlocks = 0;
+  Status = ReadAhead->WriteBlocks (This, MediaId, Lba, BufferSize, Buffer);
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  Drop the read-ahead window and reset the device.
+
+  See EFI_BLOCK_RESET for the parameters and return values.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+NvmeReadAheadReset (
+  IN EFI_BLOCK_IO_PROTOCOL      *This,
+  IN BOOLEAN                    ExtendedVerification
+  )
+{
+  NVME_READ_AHEAD               *ReadAhead;
+  EFI_TPL                       OldTpl;
+  EFI_STATUS                    Status;
+
+  OldTpl    = gBS->RaiseTPL (TPL_CALLBACK);
+  ReadAhead = NvmeReadAheadFind (This);
+  ASSERT (ReadAhead != NULL);
+
+  ReadAhead->WindowBlocks = 0;
+  Status = ReadAhead->Reset (This, ExtendedVerification);
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  Read blocks, from the read-ahead window when it holds them and the
+  request is blocking. The non-blocking requests are passed on.
+
+  See EFI_BLOCK_READ_EX for the parameters and return values.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+NvmeReadAheadReadBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  OUT    VOID                   *Buffer
+  )
+{
+  NVME_READ_AHEAD               *ReadAhead;
+  EFI_TPL                       OldTpl;
+  EFI_STATUS                    Status;
+
+  OldTpl    = gBS->RaiseTPL (TPL_CALLBACK);
+  ReadAhead = NvmeReadAheadFind2 (This);
+  ASSERT (ReadAhead != NULL);
+
+  if ((Token != NULL) && (Token->Event != NULL)) {
+    Status = ReadAhead->ReadBlocksEx (This, MediaId, Lba, Token, BufferSize, Buffer);
+    gBS->RestoreTPL (OldTpl);
+    return Status;
+  }
+
+  //
+  // Both protocols of the namespace share its media, so the blocking read
+  // goes through the BlockIo, like NvmExpressDxe does itself.
+  //
+  Status = NvmeReadAheadRead (ReadAhead, ReadAhead->BlockIo, MediaId, Lba, BufferSize, Buffer);
+  if (Token != NULL) {
+    Token->TransactionStatus = Status;
+  }
+
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  Drop the read-ahead window and write blocks.
+
+  See EFI_BLOCK_WRITE_EX for the parameters and return values.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+NvmeReadAheadWriteBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  IN     VOID                   *Buffer
+  )
+{
+  NVME_READ_AHEAD               *ReadAhead;
+  EFI_TPL                       OldTpl;
+  EFI_STATUS                    Status;
+
+  OldTpl    = gBS->RaiseTPL (TPL_CALLBACK);
+  ReadAhead = NvmeReadAheadFind2 (This);
+  ASSERT (ReadAhead != NULL);
+
+  ReadAhead->WindowBlocks = 0;
+  Status = ReadAhead->WriteBlocksEx (This, MediaId, Lba, Token, BufferSize, Buffer);
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  Drop the read-ahead window and reset the device.
+
+  See EFI_BLOCK_RESET_EX for the parameters and return values.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+NvmeReadAheadResetEx (
+  IN EFI_BLOCK_IO2_PROTOCOL     *This,
+  IN BOOLEAN                    ExtendedVerification
+  )
+{
+  NVME_READ_AHEAD               *ReadAhead;
+  EFI_TPL                       OldTpl;
+  EFI_STATUS                    Status;
+
+  OldTpl    = gBS->RaiseTPL (TPL_CALLBACK);
+  ReadAhead = NvmeReadAheadFind2 (This);
+  ASSERT (ReadAhead != NULL);
+
+  ReadAhead->WindowBlocks = 0;
+  Status = ReadAhead->ResetEx (This, ExtendedVerification);
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  Free the read-ahead state of a namespace.
+
+  @param  ReadAhead             The state, off the list.
+
+**/
+STATIC
+VOID
+NvmeReadAheadFree (
+  IN NVME_READ_AHEAD            *ReadAhead
+  )
+{
+  if (ReadAhead->Window != NULL) {
+    FreeAlignedPages (ReadAhead->Window, EFI_SIZE_TO_PAGES (ReadAhead->WindowSize));
+  }
+
+  FreePool (ReadAhead);
+}
+
+/**
+  Test whether the BlockIo of a read-ahead state is still installed and
+  hooked.
+
+  @param  ReadAhead             The state.
+
+  @retval TRUE                  The hooks are in place.
+  @retval FALSE                 The namespace is gone. Its handle may have
+                                been reused, even with a BlockIo at the
+                                same address, without the hooks.
+
+**/
+STATIC
+BOOLEAN
+NvmeReadAheadIsAttached (
+  IN NVME_READ_AHEAD            *ReadAhead
+  )
+{
+  EFI_BLOCK_IO_PROTOCOL         *BlockIo;
+  EFI_STATUS                    Status;
+
+  Status = gBS->HandleProtocol (ReadAhead->Handle, &gEfiBlockIoProtocolGuid, (VOID **)&BlockIo);
+  return (BOOLEAN)(!EFI_ERROR (Status) && (BlockIo == ReadAhead->BlockIo) &&
+                   (BlockIo->ReadBlocks == NvmeReadAheadReadBlocks));
+}
+
+/**
+  Forget the namespaces NvmExpressDxe has stopped. Their BlockIo is freed
+  with them, so there is nothing to restore.
+
+**/
+VOID
+NvmeReadAheadPrune (
+  VOID
+  )
+{
+  LIST_ENTRY                    *Link;
+  LIST_ENTRY                    *Next;
+  NVME_READ_AHEAD               *ReadAhead;
+  EFI_TPL                       OldTpl;
+
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+  for (Link = GetFirstNode (&mReadAheadList); !IsNull (&mReadAheadList, Link); Link = Next) {
+    Next      = GetNextNode (&mReadAheadList, Link);
+    ReadAhead = CR (Link, NVME_READ_AHEAD, Link, NVME_READ_AHEAD_SIGNATURE);
+    if (!NvmeReadAheadIsAttached (ReadAhead)) {
+      RemoveEntryList (&ReadAhead->Link);
+      NvmeReadAheadFree (ReadAhead);
+    }
+  }
+
+  gBS->RestoreTPL (OldTpl);
+}
+
+/**
+  Hook the BlockIo of an NVMe namespace for sequential read-ahead.
+
+  @param  Handle                The handle with the BlockIo.
+
+**/
+VOID
+NvmeReadAheadAttach (
+  IN EFI_HANDLE                 Handle
+  )
+{
+  EFI_DEVICE_PATH_PROTOCOL      *DevicePath;
+  EFI_BLOCK_IO_PROTOCOL         *BlockIo;
+  EFI_BLOCK_IO2_PROTOCOL        *BlockIo2;
+  NVME_READ_AHEAD               *ReadAhead;
+  EFI_STATUS                    Status;
+
+  Status = gBS->HandleProtocol (Handle, &gEfiBlockIoProtocolGuid, (VOID **)&BlockIo);
+  if (EFI_ERROR (Status) || (BlockIo->Media->LogicalPartition) ||
+      (BlockIo->ReadBlocks == NvmeReadAheadReadBlocks))
+  {
+    return;
+  }
+
+  //
+  // Only the namespaces of NvmExpressDxe, whose device path ends with an
+  // NVMe namespace node.
+  //
+  DevicePath = DevicePathFromHandle (Handle);
+  if (DevicePath == NULL) {
+    return;
+  }
+
+  while (!IsDevicePathEnd (NextDevicePathNode (DevicePath))) {
+    DevicePath = NextDevicePathNode (DevicePath);
+  }
+
+  if ((DevicePathType (DevicePath) != MESSAGING_DEVICE_PATH) ||
+      (DevicePathSubType (DevicePath) != MSG_NVME_NAMESPACE_DP))
+  {
+    return;
+  }
+
+  //
+  // A namespace that was stopped may have left its state behind, with a
+  // BlockIo at the same address as this one.
+  //
+  NvmeReadAheadPrune ();
+
+  ReadAhead = AllocateZeroPool (sizeof (NVME_READ_AHEAD));
+  if (ReadAhead == NULL) {
+    return;
+  }
+
+  ReadAhead->Signature   = NVME_READ_AHEAD_SIGNATURE;
+  ReadAhead->Handle      = Handle;
+  ReadAhead->BlockIo     = BlockIo;
+  ReadAhead->WindowSize  = ALIGN_VALUE (PcdGet32 (PcdNvmeReadAheadSize), EFI_PAGE_SIZE);
+  ReadAhead->NextLba     = MAX_UINT64;
+  ReadAhead->ReadBlocks  = BlockIo->ReadBlocks;
+  ReadAhead->WriteBlocks = BlockIo->WriteBlocks;
+  ReadAhead->Reset       = BlockIo->Reset;
+  if (ReadAhead->WindowSize < BlockIo->Media->BlockSize) {
+    FreePool (ReadAhead);
+    return;
+  }
+
+  Status = gBS->HandleProtocol (Handle, &gEfiBlockIo2ProtocolGuid, (VOID **)&BlockIo2);
+  if (!EFI_ERROR (Status) && (BlockIo2->WriteBlocksEx != NvmeReadAheadWriteBlocksEx)) {
+    ReadAhead->BlockIo2      = BlockIo2;
+    ReadAhead->ReadBlocksEx  = BlockIo2->ReadBlocksEx;
+    ReadAhead->WriteBlocksEx = BlockIo2->WriteBlocksEx;
+    ReadAhead->ResetEx       = BlockIo2->Reset;
+    BlockIo2->ReadBlocksEx   = NvmeReadAheadReadBlocksEx;
+    BlockIo2->WriteBlocksEx  = NvmeReadAheadWriteBlocksEx;
+    BlockIo2->Reset          = NvmeReadAheadResetEx;
+  }
+
+  InsertTailList (&mReadAheadList, &ReadAhead->Link);
+  BlockIo->ReadBlocks  = NvmeReadAheadReadBlocks;
+  BlockIo->WriteBlocks = NvmeReadAheadWriteBlocks;
+  BlockIo->Reset       = NvmeReadAheadReset;
+
+  //
+  // Reconnect the drivers that already use the namespace, such as DiskIo,
+  // which opens BlockIo2 too, so that they start again on the hooked
+  // protocol.
+  //
+  gBS->ReinstallProtocolInterface (Handle, &gEfiBlockIoProtocolGuid, BlockIo, BlockIo);
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: %d KiB read-ahead on namespace %d of handle %p\n",
+    __FUNCTION__,
+    ReadAhead->WindowSize / SIZE_1KB,
+    ((NVME_NAMESPACE_DEVICE_PATH *)DevicePath)->NamespaceId,
+    Handle
+    ));
+}
+
+/**
+  Unhook the BlockIo of every namespace, for the driver to unload.
+
+**/
+VOID
+NvmeReadAheadDetachAll (
+  VOID
+  )
+{
+  NVME_READ_AHEAD               *ReadAhead;
+  BOOLEAN                       Attached;
+  EFI_TPL                       OldTpl;
+
+  while (!IsListEmpty (&mReadAheadList)) {
+    OldTpl    = gBS->RaiseTPL (TPL_CALLBACK);
+    ReadAhead = CR (GetFirstNode (&mReadAheadList), NVME_READ_AHEAD, Link, NVME_READ_AHEAD_SIGNATURE);
+    Attached  = NvmeReadAheadIsAttached (ReadAhead);
+    if (Attached) {
+      ReadAhead->BlockIo->ReadBlocks  = ReadAhead->ReadBlocks;
+      ReadAhead->BlockIo->WriteBlocks = ReadAhead->WriteBlocks;
+      ReadAhead->BlockIo->Reset       = ReadAhead->Reset;
+      if (ReadAhead->BlockIo2 != NULL) {
+        ReadAhead->BlockIo2->ReadBlocksEx  = ReadAhead->ReadBlocksEx;
+        ReadAhead->BlockIo2->WriteBlocksEx = ReadAhead->WriteBlocksEx;
+        ReadAhead->BlockIo2->Reset         = ReadAhead->ResetEx;
+      }
+    }
+
+    RemoveEntryList (&ReadAhead->Link);
+    gBS->RestoreTPL (OldTpl);
+
+    if (Attached) {
+      gBS->ReinstallProtocolInterface (
+             ReadAhead->Handle,
+             &gEfiBlockIoProtocolGuid,
+             ReadAhead->BlockIo,
+             ReadAhead->BlockIo
+             );
+    }
+
+    NvmeReadAheadFree (ReadAhead);
+  }
+}
+
+/**
+  Log the read-ahead counters of every namespace.
+
+**/
+VOID
+NvmeReadAheadLogSummary (
+  VOID
+  )
+{
+  LIST_ENTRY                    *Link;
+  NVME_READ_AHEAD               *ReadAhead;
+
+  for (Link = GetFirstNode (&mReadAheadList); !IsNull (&mReadAheadList, Link); Link = GetNextNode (&mReadAheadList, Link)) {
+    ReadAhead = CR (Link, NVME_READ_AHEAD, Link, NVME_READ_AHEAD_SIGNATURE);
+    DEBUG ((
+      DEBUG_INFO,
+      "NVMe read-ahead %p: %ld reads from the window, %ld window fills, %ld reads bypassed\n",
+      ReadAhead->BlockIo,
+      ReadAhead->Hits,
+      ReadAhead->Fills,
+      ReadAhead->Bypassed
+      ));
+  }
+}
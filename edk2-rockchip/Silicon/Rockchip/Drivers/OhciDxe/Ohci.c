@@ -310,6 +310,8 @@ OhciControlTransfer (
   UINT32                         StatusPidDir;
   UINTN                          TimeCount;
   OHCI_ED_RESULT                 EdResult;
+  UINT64                         StartTick;
+  UINT64                         PollTick;
 
   DMA_MAP_OPERATION              MapOp;
 
@@ -344,7 +346,8 @@ OhciControlTransfer (
     return EFI_INVALID_PARAMETER;
   }
 
-  Ohc = USB_OHCI_HC_DEV_FROM_THIS(This);
+  Ohc       = USB_OHCI_HC_DEV_FROM_THIS(This);
+  StartTick = USB_PROFILE_TIMESTAMP ();
 
   if (TransferDirection == EfiUsbDataIn) {
     DataPidDir = TD_IN_PID;
@@ -542,6 +545,7 @@ OhciControlTransfer (
 
 
   TimeCount = 0;
+  PollTick  = USB_PROFILE_TIMESTAMP ();
   Status = CheckIfDone (Ohc, CONTROL_LIST, Ed, HeadTd, &EdResult);
 
   while (Status == EFI_NOT_READY && TimeCount <= TimeOut) {
@@ -549,6 +553,7 @@ OhciControlTransfer (
     TimeCount++;
     Status = CheckIfDone (Ohc, CONTROL_LIST, Ed, HeadTd, &EdResult);
   }
+  USB_PROFILE_POLL (Ohc->Profile, PollTick);
   //
   // For debugging, dump ED & TD buffer after transferring
   //
@@ -594,6 +599,7 @@ FREE_ED_BUFF:
   UsbHcFreeMem(Ohc->MemPool, Ed, sizeof(ED_DESCRIPTOR));
 
 CTRL_EXIT:
+  USB_PROFILE_TRANSFER (Ohc->Profile, DeviceAddress, UsbProfileControl, *DataLength, StartTick, Status);
   return Status;
 }
 
@@ -670,6 +676,8 @@ OhciBulkTransfer(
   UINTN                          LeftLength;
   UINTN                          ActualSendLength;
   BOOLEAN                        FirstTD;
+  UINT64                         StartTick;
+  UINT64                         PollTick;
 
   Mapping = NULL;
   MapLength = 0;
@@ -684,7 +692,8 @@ OhciBulkTransfer(
     return EFI_INVALID_PARAMETER;
   }
 
-  Ohc = USB_OHCI_HC_DEV_FROM_THIS (This);
+  Ohc       = USB_OHCI_HC_DEV_FROM_THIS (This);
+  StartTick = USB_PROFILE_TIMESTAMP ();
 
   if ((EndPointAddress & 0x80) != 0) {
     DataPidDir = TD_IN_PID;
@@ -825,12 +834,14 @@ OhciBulkTransfer(
   gBS->Stall(20 * 1000);
 
   TimeCount = 0;
+  PollTick  = USB_PROFILE_TIMESTAMP ();
   Status = CheckIfDone (Ohc, BULK_LIST, Ed, HeadTd, &EdResult);
   while (Status == EFI_NOT_READY && TimeCount <= TimeOut) {
     gBS->Stall (1000);
     TimeCount++;
     Status = CheckIfDone (Ohc, BULK_LIST, Ed, HeadTd, &EdResult);
   }
+  USB_PROFILE_POLL (Ohc->Profile, PollTick);
 
   *TransferResult = ConvertErrorCode (EdResult.ErrorCode);
 
@@ -867,6 +878,7 @@ FREE_OHCI_TDBUFF:
 FREE_ED_BUFF:
   UsbHcFreeMem(Ohc->MemPool, Ed, sizeof(ED_DESCRIPTOR));
 
+  USB_PROFILE_TRANSFER (Ohc->Profile, DeviceAddress, UsbProfileBulk, *DataLength, StartTick, Status);
   return Status;
 }
 /**
@@ -1336,6 +1348,8 @@ OhciSyncInterruptTransfer (
   TD_DESCRIPTOR           *HeadTd;
   OHCI_ED_RESULT          EdResult;
   VOID                    *UCBuffer;
+  UINT64                  StartTick;
+  UINT64                  PollTick;
 
   if ((EndPointAddress & 0x80) == 0 || Data == NULL || DataLength == NULL || *DataLength == 0 ||
       (IsSlowDevice && MaxPacketLength > 8) || (!IsSlowDevice && MaxPacketLength > 64) ||
@@ -1343,7 +1357,8 @@ OhciSyncInterruptTransfer (
     return EFI_INVALID_PARAMETER;
   }
 
-  Ohc = USB_OHCI_HC_DEV_FROM_THIS (This);
+  Ohc       = USB_OHCI_HC_DEV_FROM_THIS (This);
+  StartTick = USB_PROFILE_TIMESTAMP ();
   UCBuffer = AllocatePool (*DataLength);
   if (UCBuffer == NULL) {
     return EFI_OUT_OF_RESOURCES;
@@ -1367,15 +1382,18 @@ OhciSyncInterruptTransfer (
              );
 
   if (!EFI_ERROR (Status)) {
+    PollTick = USB_PROFILE_TIMESTAMP ();
     Status = CheckIfDone (Ohc, INTERRUPT_LIST, Ed, HeadTd, &EdResult);
     while (Status == EFI_NOT_READY && TimeOut > 0) {
       gBS->Stall (1000);
       TimeOut--;
       Status = CheckIfDone (Ohc, INTERRUPT_LIST, Ed, HeadTd, &EdResult);
     }
+    USB_PROFILE_POLL (Ohc->Profile, PollTick);
 
     *TransferResult = ConvertErrorCode (EdResult.ErrorCode);
   }
+  USB_PROFILE_TRANSFER (Ohc->Profile, DeviceAddress, UsbProfileInterrupt, *DataLength, StartTick, Status);
   CopyMem(Data, UCBuffer, *DataLength);
   Status = OhciInterruptTransfer (
              Ohc,
@@ -1573,6 +1591,7 @@ OhciGetRootHubPortStatus (
   }
   if (OhciReadRootHubPortStatus (Ohc, PortNumber, RH_CONNECT_STATUS_CHANGE)) {
     PortStatus->PortChangeStatus |= USB_PORT_STAT_C_CONNECTION;
+    USB_PROFILE_PORT_CONNECT (Ohc->Profile, PortNumber);
   }
   if (OhciReadRootHubPortStatus (Ohc, PortNumber, RH_PORT_SUSPEND_STAT_CHANGE)) {
     PortStatus->PortChangeStatus |= USB_PORT_STAT_C_SUSPEND;
@@ -1644,6 +1663,7 @@ OhciSetRootHubPortFeature (
       break;
 
     case EfiUsbPortReset:
+      USB_PROFILE_PORT_RESET_START (Ohc->Profile, PortNumber);
       Status = OhciSetRootHubPortStatus (Ohc, PortNumber, RH_SET_PORT_RESET);
 
       //
@@ -1661,6 +1681,7 @@ OhciSetRootHubPortFeature (
         return EFI_DEVICE_ERROR;
       }
 
+      USB_PROFILE_PORT_RESET_DONE (Ohc->Profile, PortNumber);
       OhciSetRootHubPortStatus (Ohc, PortNumber, RH_PORT_RESET_STAT_CHANGE);
       break;
 
@@ -2001,6 +2022,7 @@ OhciFreeDev (
   )
 {
   OhciFreeFixedIntMemory (Ohc);
+  UsbProfileDestroy (Ohc->Profile);
 
   if (Ohc->HouseKeeperTimer != NULL) {
     gBS->CloseEvent (Ohc->HouseKeeperTimer);
@@ -2238,6 +2260,10 @@ OhciInitialiseController (
     goto UNINSTALL_USBHC;
   }
 
+  if (USB_PROFILE_ENABLED) {
+    Ohc->Profile = UsbProfileCreate (Ohc->Controller, L"OHCI", Ohc->UsbHcBaseAddress);
+  }
+
   Status = gBS->SetTimer (Ohc->HouseKeeperTimer, TimerPeriodic, 10 * 1000 * 10);
   if (EFI_ERROR (Status)) {
     goto FREE_OHC;
@@ -2265,12 +2291,21 @@ FREE_DEV_BUFFER:
   return Status;
 }
 
+//
+// Controllers already started, and whether the USB stack is connected yet
+//
+STATIC UINT32     mOhciStarted;
+STATIC BOOLEAN    mOhciEndOfDxe;
+STATIC EFI_EVENT  mOhciCompanionEvent;
+
+/**
+  Connect the USB bus driver to the OHCI controllers started so far.
+
+**/
 STATIC
 VOID
-EFIAPI
-OnEndOfDxe (
-  IN EFI_EVENT  Event,
-  IN VOID       *Context
+OhciConnectControllers (
+  VOID
   )
 {
   OHCI_DEVICE_PATH          *DevicePath;
@@ -2278,8 +2313,6 @@ OnEndOfDxe (
   EFI_HANDLE                DeviceHandle;
   EFI_STATUS                Status;
 
-  gBS->CloseEvent (Event);
-
   DevicePath = AllocateCopyPool (sizeof (OhciDevicePathProtocol),
                  &OhciDevicePathProtocol);
   if (DevicePath == NULL) {
@@ -2308,6 +2341,106 @@ OnEndOfDxe (
   gBS->FreePool (DevicePath);
 }
 
+STATIC
+VOID
+EFIAPI
+OnEndOfDxe (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  gBS->CloseEvent (Event);
+
+  mOhciEndOfDxe = TRUE;
+  OhciConnectControllers ();
+}
+
+/**
+  Check whether the EHCI controller paired with an OHCI companion has
+  released any of its root ports to it.
+
+  @param  OhciNum               The index of the OHCI controller.
+
+  @retval TRUE                  A port is owned by the companion.
+  @retval FALSE                 All the ports are kept by the EHCI controller.
+
+**/
+STATIC
+BOOLEAN
+OhciCompanionNeeded (
+  IN UINT32               OhciNum
+  )
+{
+  UINTN                   EhciBase;
+  UINTN                   OpBase;
+  UINT32                  NumPorts;
+  UINT32                  Port;
+
+  EhciBase = PcdGet32 (PcdEhciBaseAddress) + OhciNum * PcdGet32 (PcdEhciSize);
+  OpBase   = EhciBase + MmioRead8 (EhciBase + OHC_EHCI_CAPLENGTH_OFFSET);
+  NumPorts = MmioRead32 (EhciBase + OHC_EHCI_HCSPARAMS_OFFSET) & OHC_EHCI_HCSPARAMS_NPORTS;
+
+  for (Port = 0; Port < NumPorts; Port++) {
+    if ((MmioRead32 (OpBase + OHC_EHCI_PORTSC_OFFSET + 4 * Port) & OHC_EHCI_PORTSC_OWNER) != 0) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Start and connect the OHCI companions that EHCI released a full or low
+  speed device to.
+
+  @param  Event                 The companion release event group.
+  @param  Context               Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+OhciOnCompanionRelease (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS    Status;
+  UINT32        Index;
+  UINT32        OhciNum;
+  BOOLEAN       Started;
+
+  OhciNum = MIN (PcdGet32 (PcdNumOhciController), OHC_MAX_CONTROLLERS);
+  Started = FALSE;
+
+  for (Index = 0; Index < OhciNum; Index++) {
+    if (((mOhciStarted & (1U << Index)) != 0) || !OhciCompanionNeeded (Index)) {
+      continue;
+    }
+
+    Status = OhciInitialiseController (Index);
+    DEBUG ((DEBUG_INFO, "%a: companion %d Status = %r\n", __FUNCTION__, Index, Status));
+
+    //
+    // Don't retry a controller that failed, it would fail every time
+    //
+    mOhciStarted |= 1U << Index;
+    Started       = Started || !EFI_ERROR (Status);
+  }
+
+  if (mOhciStarted == (UINT32) (((UINT64) 1 << OhciNum) - 1)) {
+    gBS->CloseEvent (mOhciCompanionEvent);
+    mOhciCompanionEvent = NULL;
+  }
+
+  //
+  // Before the end of DXE, the controllers are connected along with the others
+  //
+  if (Started && mOhciEndOfDxe) {
+    OhciConnectControllers ();
+  }
+}
+
 EFI_STATUS
 EFIAPI
 OhciInitialise (
@@ -2320,14 +2453,29 @@ OhciInitialise (
   UINT32        Index;
   UINT32        OhciNum;
 
-  /* Initialize enabled chips */
-  OhciNum = PcdGet32(PcdNumOhciController);
-  for(Index = 0; Index < OhciNum; Index++) {
-    Status = OhciInitialiseController(
-          Index
-          );
-    DEBUG ((EFI_D_ERROR, "OhciInitialise OhciInitialiseController %d Status = %r\n",Index, Status));
+  if (FixedPcdGetBool (PcdOhciLazyStart)) {
+    //
+    // Leave the companions, their housekeeping timer and root hub idle
+    // until EHCI hands them a full or low speed device
+    //
+    Status = gBS->CreateEventEx (EVT_NOTIFY_SIGNAL,
+                    TPL_CALLBACK,
+                    OhciOnCompanionRelease,
+                    NULL,
+                    &gRockchipUsbCompanionReleaseGuid,
+                    &mOhciCompanionEvent);
+    ASSERT_EFI_ERROR (Status);
+  } else {
+    /* Initialize enabled chips */
+    OhciNum = PcdGet32(PcdNumOhciController);
+    for(Index = 0; Index < OhciNum; Index++) {
+      Status = OhciInitialiseController(
+            Index
+            );
+      DEBUG ((EFI_D_ERROR, "OhciInitialise OhciInitialiseController %d Status = %r\n",Index, Status));
+    }
   }
+
   Status = gBS->CreateEventEx (EVT_NOTIFY_SIGNAL,
                   TPL_CALLBACK,
                   OnEndOfDxe,
@@ -30,10 +30,11 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Library/IoLib.h>
 #include <Library/DebugLib.h>
 #include <Library/BaseMemoryLib.h>
+#include <Library/UsbHcMemLib.h>
+#include <Library/UsbProfileLib.h>
 
 typedef struct _USB_OHCI_HC_DEV USB_OHCI_HC_DEV;
 
-#include "UsbHcMem.h"
 #include "OhciReg.h"
 #include "OhciSched.h"
 #include "OhciUrb.h"
@@ -42,6 +43,18 @@ typedef struct _USB_OHCI_HC_DEV USB_OHCI_HC_DEV;
 
 #define USB_OHCI_HC_DEV_SIGNATURE     SIGNATURE_32('o','h','c','i')
 
+//
+// Registers of the EHCI controller paired with each OHCI companion,
+// telling which root ports it released to the companion
+//
+#define OHC_EHCI_CAPLENGTH_OFFSET     0x00
+#define OHC_EHCI_HCSPARAMS_OFFSET     0x04
+#define OHC_EHCI_HCSPARAMS_NPORTS     0x0F
+#define OHC_EHCI_PORTSC_OFFSET        0x44
+#define OHC_EHCI_PORTSC_OWNER         BIT13
+
+#define OHC_MAX_CONTROLLERS           32
+
 typedef struct _HCCA_MEMORY_BLOCK{
   UINT32                    HccaInterruptTable[32];    // 32-bit Physical Address to ED_DESCRIPTOR
   UINT16                    HccaFrameNumber;
@@ -80,6 +93,11 @@ struct _USB_OHCI_HC_DEV {
   EFI_EVENT                  ExitBootServiceEvent;
 
   EFI_UNICODE_STRING_TABLE  *ControllerNameTable;
+
+  //
+  // Timing counters, NULL unless PcdUsbProfileEnable is set
+  //
+  USB_PROFILE               *Profile;
 };
 
 #define USB_OHCI_HC_DEV_FROM_THIS(a)    CR(a, USB_OHCI_HC_DEV, UsbHc, USB_OHCI_HC_DEV_SIGNATURE)
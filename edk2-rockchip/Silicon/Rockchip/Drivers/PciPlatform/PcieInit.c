@@ -19,10 +19,32 @@
 #include <stdio.h>
 #include <Library/PcdLib.h>
 #include <Library/RockchipPlatformLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/PciExpressLib.h>
+#include <Library/PcieProfileLib.h>
+#include <Library/PrintLib.h>
+#include <Library/ReportStatusCodeLib.h>
+#include <Protocol/PciEnumerationComplete.h>
+#include <Protocol/Smbios.h>
+#include <RK3588Pcie.h>
 
 extern VOID PcieRegWrite(UINT32 Port, UINTN Offset, UINT32 Value);
 extern EFI_STATUS PciePortReset(UINT32 HostBridgeNum, UINT32 Port);
 
+/* Kept for the SMBIOS slot records, which are added once the protocol shows up */
+static struct rk_pcie *mPorts[PCIE_SEGMENT_COUNT];
+
+static CONST CHAR8 *mSlotNames[PCIE_SEGMENT_COUNT] = {
+	"PCIe3x4", "PCIe3x2", "PCIe2x1l0", "PCIe2x1l1", "PCIe2x1l2"
+};
+
+static CONST PCIE_PROFILE_PHASE mProfilePhases[] = {
+	[RK_PCIE_POWER_ON] = PcieProfilePower,
+	[RK_PCIE_DETECT] = PcieProfileDetect,
+	[RK_PCIE_TRAINING] = PcieProfileTraining,
+	[RK_PCIE_SETTLE] = PcieProfileSettle,
+	[RK_PCIE_RETRAIN] = PcieProfileRetrain,
+};
 
 static UINTN rk_pcie_read(UINTN addr, UINTN size, UINT32 *val)
 {
@@ -133,6 +155,14 @@ static void rk_pcie_setup_host(struct rk_pcie *rk_pcie)
 	MmioWrite32(rk_pcie->dbi_base + PCI_BASE_ADDRESS_0, PCI_BASE_ADDRESS_MEM_TYPE_64);
 	MmioWrite32(rk_pcie->dbi_base + PCI_BASE_ADDRESS_1, 0x0);
 
+	/*
+	 * Disable them through their masks: they are of no use to a root port,
+	 * and with Resizable BAR support the bus driver would size BAR0 to its
+	 * largest size and exhaust the windows.
+	 */
+	MmioWrite32(rk_pcie->dbi_base + PCIE_DBI2_OFFSET + PCI_BASE_ADDRESS_0, 0x0);
+	MmioWrite32(rk_pcie->dbi_base + PCIE_DBI2_OFFSET + PCI_BASE_ADDRESS_1, 0x0);
+
 	/* setup interrupt pins */
 	val = MmioRead32(rk_pcie->dbi_base + PCI_INTERRUPT_LINE);
 	val &= 0xffff00ff;
@@ -233,74 +263,219 @@ static int is_link_up(struct rk_pcie *priv)
 	return 0;
 }
 						 
-static int rk_pcie_link_up(struct rk_pcie *priv, UINT32 cap_speed)
+/* The generic timer counts up */
+static UINT64 rk_pcie_elapsed_ms(UINT64 start)
 {
-	int retries;
+	return DivU64x32(GetTimeInNanoSecond(GetPerformanceCounter() - start), 1000000);
+}
 
-	
-	if (is_link_up(priv)) {
-		DEBUG((EFI_D_ERROR, "PCI Link already up before configuration!\n"));
+static void rk_pcie_set_state(struct rk_pcie *priv, enum rk_pcie_state state)
+{
+	/* A link found up by rockchip_pcie_init_port() has no bring-up to count */
+	if (priv->state_start && priv->state < ARRAY_SIZE(mProfilePhases))
+		PCIE_PROFILE_LINK_PHASE(priv->segment, mProfilePhases[priv->state],
+			DivU64x32(GetTimeInNanoSecond(GetPerformanceCounter() - priv->state_start), 1000));
+
+	priv->state = state;
+	priv->state_start = GetPerformanceCounter();
+}
+
+/*
+ * Link Capabilities of the device below the root port, from its PCI Express
+ * capability. Returns 0 if there is none.
+ */
+static UINT32 rk_pcie_ep_link_cap(struct rk_pcie *priv)
+{
+	UINTN ep;
+	UINT16 cap;
+	UINT8 ptr;
+	int i;
+
+	ep = PCI_EXPRESS_LIB_ADDRESS(priv->first_busno + 1, 0, 0, 0);
+	if (PciExpressRead16(ep) == 0xffff ||
+	    !(PciExpressRead16(ep + PCI_STATUS) & PCI_STATUS_CAP_LIST))
+		return 0;
+
+	ptr = PciExpressRead8(ep + PCI_CAPABILITY_LIST) & ~3;
+	for (i = 0; ptr && i < PCI_FIND_CAP_TTL; i++) {
+		cap = PciExpressRead16(ep + ptr);
+		if ((cap & 0xff) == PCI_CAP_ID_EXP)
+			return PciExpressRead32(ep + ptr + PCI_EXP_LNKCAP);
+		ptr = (cap >> 8) & ~3;
+	}
+
+	return 0;
+}
+
+/*
+ * Compare the negotiated link with what both ends support, and start a
+ * retrain when it is below. Returns 1 if a retrain was started.
+ */
+static int rk_pcie_check_link(struct rk_pcie *priv)
+{
+	struct rk_pcie_link_report report;
+	UINT32 val;
+
+	report.segment = priv->segment;
+	report.speed = rk_pcie_get_link_speed(priv);
+	report.width = rk_pcie_get_link_width(priv);
+	report.target_speed = priv->gen;
+	report.target_width = priv->lane;
+	if (priv->ep_link_cap) {
+		report.target_speed = MIN(report.target_speed, priv->ep_link_cap & PCI_EXP_LNKCAP_SLS);
+		report.target_width = MIN(report.target_width, (priv->ep_link_cap & PCI_EXP_LNKCAP_MLW) >> 4);
+	}
+
+	priv->speed = report.speed;
+	priv->width = report.width;
+	if (report.speed >= report.target_speed && report.width >= report.target_width)
+		return 0;
+
+	if (priv->retrains < FixedPcdGet32(PcdPcieLinkRetrainCount)) {
+		priv->retrains++;
+		DEBUG((EFI_D_ERROR, "PCIe%d: Link is Gen%d-x%d instead of Gen%d-x%d, retrain %d\n",
+			priv->segment, report.speed, report.width,
+			report.target_speed, report.target_width, priv->retrains));
+
+		/* Target Link Speed, then Retrain Link */
+		rk_pcie_configure(priv, report.target_speed);
+		val = MmioRead32(priv->dbi_base + PCIE_LINK_STATUS_REG);
+		MmioWrite32(priv->dbi_base + PCIE_LINK_STATUS_REG, val | PCIE_LINK_CONTROL_RETRAIN);
 		return 1;
 	}
-					 
-	/* DW pre link configurations */
-	rk_pcie_configure(priv, cap_speed);
-			 
-	/* Release the device */
-	Pcie30PeReset(FALSE);
 
-	rk_pcie_disable_ltssm(priv);
+	priv->degraded = TRUE;
+	DEBUG((EFI_D_ERROR, "PCIe%d: Link degraded to Gen%d-x%d instead of Gen%d-x%d\n",
+		priv->segment, report.speed, report.width,
+		report.target_speed, report.target_width));
+	REPORT_STATUS_CODE_WITH_EXTENDED_DATA(EFI_ERROR_CODE | EFI_ERROR_MINOR,
+		EFI_IO_BUS_PCI | EFI_IOB_EC_INTERFACE_ERROR, &report, sizeof(report));
 
-	rk_pcie_link_status_clear(priv);
+	return 0;
+}
 
-	rk_pcie_enable_debug(priv);
+static void rk_pcie_link_done(struct rk_pcie *priv)
+{
+	DEBUG((EFI_D_ERROR, "PCIe%d Init sucessfully (Gen%d-x%d, Bus%d)\n", priv->segment,
+			priv->speed, priv->width, PCIE_BUS_BASE(priv->segment)));
+	rk_pcie_dbi_write_enable(priv, TRUE);
+	rk_pcie_set_state(priv, RK_PCIE_LINK_UP);
+}
+
+/*
+ * Advance the link bring-up of a controller without waiting.
+ * Returns 1 while the controller is still waiting for something.
+ */
+static int rk_pcie_link_step(struct rk_pcie *priv)
+{
+	UINT64 elapsed;
+	UINT32 ltssm;
+	UINT32 val;
+
+	elapsed = rk_pcie_elapsed_ms(priv->state_start);
+
+	switch (priv->state) {
+	case RK_PCIE_POWER_ON:
+		if (elapsed < PCIE_T_PVPERL_MS)
+			return 1;
+
+		/* Release the device and let the LTSSM look for it */
+		PciePeReset(priv->segment, FALSE);
+		rk_pcie_enable_ltssm(priv);
+		rk_pcie_set_state(priv, RK_PCIE_DETECT);
+		return 1;
+
+	case RK_PCIE_DETECT:
+		ltssm = rk_pcie_readl_apb(priv, PCIE_CLIENT_LTSSM_STATUS);
+		if ((ltssm & PCIE_LTSSM_STATE_MASK) > PCIE_LTSSM_DETECT_ACT) {
+			rk_pcie_set_state(priv, RK_PCIE_TRAINING);
+			return 1;
+		}
+		if (elapsed < PCIE_DETECT_TIMEOUT_MS)
+			return 1;
 
-	/* Enable LTSSM */
-	rk_pcie_enable_ltssm(priv);
+		DEBUG((EFI_D_ERROR, "PCIe%d: no device detected\n", priv->segment));
+		rk_pcie_set_state(priv, RK_PCIE_ABSENT);
+		return 0;
 
-	for (retries = 0; retries < 500; retries++) {
+	case RK_PCIE_TRAINING:
 		if (is_link_up(priv)) {
-			DEBUG((EFI_D_ERROR, "PCIe Link up, LTSSM is 0x%x\n", rk_pcie_readl_apb(priv, PCIE_CLIENT_LTSSM_STATUS)));
+			DEBUG((EFI_D_ERROR, "PCIe%d: Link up after %ldms, LTSSM is 0x%x\n", priv->segment,
+				elapsed, rk_pcie_readl_apb(priv, PCIE_CLIENT_LTSSM_STATUS)));
 			rk_pcie_debug_dump(priv);
-			/* Link maybe in Gen switch recovery but we need to wait more 1s */
-			msleep(1000);
-			return 0;
+			rk_pcie_set_state(priv, RK_PCIE_SETTLE);
+			return 1;
 		}
+		if (elapsed < PCIE_LINK_UP_TIMEOUT_MS)
+			return 1;
 
-		DEBUG((EFI_D_ERROR, "PCIe Linking... LTSSM is 0x%x\n", rk_pcie_readl_apb(priv, PCIE_CLIENT_LTSSM_STATUS)));
+		DEBUG((EFI_D_ERROR, "PCIe%d: Link Fail, LTSSM is 0x%x\n", priv->segment,
+			rk_pcie_readl_apb(priv, PCIE_CLIENT_LTSSM_STATUS)));
 		rk_pcie_debug_dump(priv);
-		msleep(1000);
-	}
-
-	DEBUG((EFI_D_ERROR, "PCIe-%d Link Fail\n", 0));
+		rk_pcie_set_state(priv, RK_PCIE_ABSENT);
+		return 0;
+
+	case RK_PCIE_SETTLE:
+		/* The link may still be in a speed change recovery */
+		if (elapsed < PCIE_T_RRS_MS)
+			return 1;
+
+		priv->ep_link_cap = rk_pcie_ep_link_cap(priv);
+		if (rk_pcie_check_link(priv)) {
+			rk_pcie_set_state(priv, RK_PCIE_RETRAIN);
+			return 1;
+		}
+		rk_pcie_link_done(priv);
+		return 0;
+
+	case RK_PCIE_RETRAIN:
+		val = MmioRead32(priv->dbi_base + PCIE_LINK_STATUS_REG);
+		if (((val & PCIE_LINK_STATUS_TRAINING) || !is_link_up(priv)) &&
+		    elapsed < PCIE_RETRAIN_TIMEOUT_MS)
+			return 1;
+
+		if (!is_link_up(priv)) {
+			DEBUG((EFI_D_ERROR, "PCIe%d: Link lost while retraining, LTSSM is 0x%x\n",
+				priv->segment, rk_pcie_readl_apb(priv, PCIE_CLIENT_LTSSM_STATUS)));
+			rk_pcie_set_state(priv, RK_PCIE_ABSENT);
+			return 0;
+		}
+		if (rk_pcie_check_link(priv)) {
+			rk_pcie_set_state(priv, RK_PCIE_RETRAIN);
+			return 1;
+		}
+		rk_pcie_link_done(priv);
+		return 0;
 
-	return -22;
+	default:
+		return 0;
+	}
 }
-						 
-static int rockchip_pcie_init_port(struct rk_pcie *priv)
-{
-	int ret;
-	UINT32 val;
 
+/*
+ * Power domain, clocks and resets are shared by all the root complexes, and
+ * the 3.0 PHY by the two 3.0 controllers: bring them up once. The combo PHYs
+ * of the 2.0 controllers are set up by the platform from PcdComboPhyMode.
+ */
+static void rockchip_pcie_init_soc(UINT32 mask)
+{
+	BOOLEAN pcie30;
+	UINT32 phy_mode;
 
-	/* RK3588 EVB1 PCIe3L4*/
-	Pcie30IoInit();
-	
-	/* Rest the device */
-	Pcie30PeReset(TRUE);
-	
-	/* Set power and maybe external ref clk input */
-	Pcie30PowerEn();
-	msleep(100000);
-
-	//DEBUG((EFI_D_ERROR, "0xFD5F8070 = 0x%x, 0xFEC4000c = 0x%x, 0xFEC50004 = 0x%x\n", 0));
+	pcie30 = (mask & (BIT(PCIE_SEGMENT_PCIE30X4) | BIT(PCIE_SEGMENT_PCIE30X2))) != 0;
 
 	/* Disable power domain */
 	MmioWrite32(0xFD8D8150, 0x1 << 23 | 0x1 << 21); //PD_PCIE & PD_PHP
-					 
-	/* FixMe init 3.0 PHY */
-	/* Phy mode: Aggregation NBNB */
-	MmioWrite32(0xfd5b8000 + RK3588_PCIE3PHY_GRF_CMN_CON0, (0x7 << 16) | PHY_MODE_PCIE_AGGREGATION);
+
+	if (pcie30) {
+		/* FixMe init 3.0 PHY */
+		/* Phy mode: 3x4 alone aggregates all lanes, with 3x2 each gets two */
+		if (mask & BIT(PCIE_SEGMENT_PCIE30X2))
+			phy_mode = PHY_MODE_PCIE_NANBNB;
+		else
+			phy_mode = PHY_MODE_PCIE_AGGREGATION;
+		MmioWrite32(0xfd5b8000 + RK3588_PCIE3PHY_GRF_CMN_CON0, (0x7 << 16) | phy_mode);
+	}
 
 	/* 开控制器和phy时钟,撤销复位        */
 	MmioWrite32(0xFD7C0A80, 0xffff0000);  //CRU_SOFTRST_CON32
@@ -311,7 +486,10 @@ static int rockchip_pcie_init_port(struct rk_pcie *priv)
 	MmioWrite32(0xFD7C0888, 0xffff0000);  //CRU_GATE_CON34
 	MmioWrite32(0xFD7C0898, 0xffff0000);  //CRU_GATE_CON38
 	MmioWrite32(0xFD7C089c, 0xffff0000);  //CRU_GATE_CON39
-	
+
+	if (!pcie30)
+		return;
+
 	MmioWrite32(0xFD7C8A00, (0x1 << 24));  //PHPTOPCRU_SOFTRST_CON00
 	MmioWrite32(0xFD7C8800, 0xffff0000);  //PHPTOPCRU_GATE_CON00
 
@@ -325,7 +503,16 @@ static int rockchip_pcie_init_port(struct rk_pcie *priv)
 
 	/* 撤销PHY复位 */
 	MmioWrite32(0xFD7C8A00, (0x1 << 26)); 
-	
+}
+
+/*
+ * Program the controller as a root complex, up to the point where the
+ * device can be released from reset. The rest is done by rk_pcie_link_step().
+ */
+static void rockchip_pcie_init_port(struct rk_pcie *priv, UINT64 power_on)
+{
+	UINT32 val;
+
 	/* 配置PHY:  3.0 PHY不用配置 */
 						 
 	/* LTSSM EN ctrl mode */
@@ -336,27 +523,202 @@ static int rockchip_pcie_init_port(struct rk_pcie *priv)
 	/* Set RC mode */
 	rk_pcie_dbi_write_enable(priv, TRUE);	
 	rk_pcie_writel_apb(priv, 0x0, 0xf00000);
-	MmioWrite32(0xf50002ec, 0xfffff0);
-	MmioWrite32(0xf50002f0, 0x13c0); //BAR0 resize 512G
-	//io -4 0xa400008bc 0x77f41
-
-
 	rk_pcie_writel_apb(priv, 0x0, 0xf00040);
 
 	rk_pcie_setup_host(priv);
-			 
-	ret = rk_pcie_link_up(priv, priv->gen);
-	if (ret < 0)
-		return ret;
 
-	DEBUG((EFI_D_ERROR, "PCIe Init sucessfully (Gen%d-x%d, Bus%d)\n",
-			rk_pcie_get_link_speed(priv),rk_pcie_get_link_width(priv)));
-	rk_pcie_dbi_write_enable(priv, TRUE);
-	msleep(10000);
+	if (is_link_up(priv)) {
+		DEBUG((EFI_D_ERROR, "PCI Link already up before configuration!\n"));
+		priv->speed = rk_pcie_get_link_speed(priv);
+		priv->width = rk_pcie_get_link_width(priv);
+		rk_pcie_set_state(priv, RK_PCIE_LINK_UP);
+		return;
+	}
 
-	return 0;
+	/* DW pre link configurations */
+	rk_pcie_configure(priv, priv->gen);
+
+	rk_pcie_disable_ltssm(priv);
+
+	rk_pcie_link_status_clear(priv);
+
+	rk_pcie_enable_debug(priv);
+
+	/* T_PVPERL counts from the power-on, which all the slots share */
+	priv->state = RK_PCIE_POWER_ON;
+	priv->state_start = power_on;
+}
+
+/*
+ * Describe the enabled root ports as SMBIOS type 9 slots, with the link
+ * they trained to in the designation.
+ */
+static VOID EFIAPI rk_pcie_add_smbios_slots(IN EFI_EVENT Event, IN VOID *Context)
+{
+	EFI_SMBIOS_PROTOCOL *smbios;
+	EFI_SMBIOS_HANDLE handle;
+	SMBIOS_TABLE_TYPE9 *slot;
+	struct rk_pcie *priv;
+	UINT8 record[sizeof(SMBIOS_TABLE_TYPE9) + PCIE_SLOT_NAME_MAX + 1];
+	CHAR8 *name;
+	EFI_STATUS status;
+	UINT32 seg;
+
+	status = gBS->LocateProtocol(&gEfiSmbiosProtocolGuid, NULL, (VOID **)&smbios);
+	if (EFI_ERROR(status))
+		return;
+
+	gBS->CloseEvent(Event);
+
+	slot = (SMBIOS_TABLE_TYPE9 *)record;
+	name = (CHAR8 *)record + sizeof(SMBIOS_TABLE_TYPE9);
+
+	for (seg = 0; seg < PCIE_SEGMENT_COUNT; seg++) {
+		priv = mPorts[seg];
+		if (priv == NULL)
+			continue;
+
+		/* The string area must end with two NULs */
+		ZeroMem(record, sizeof(record));
+		slot->Hdr.Type = EFI_SMBIOS_TYPE_SYSTEM_SLOTS;
+		slot->Hdr.Length = sizeof(SMBIOS_TABLE_TYPE9);
+		slot->SlotDesignation = 1;
+		slot->SlotType = PCIE_MAX_GEN(seg) == 3 ? SlotTypePciExpressGen3 : SlotTypePciExpressGen2;
+		slot->SlotDataBusWidth = priv->lane == 4 ? SlotDataBusWidth4X :
+					 priv->lane == 2 ? SlotDataBusWidth2X : SlotDataBusWidth1X;
+		slot->SlotLength = SlotLengthOther;
+		slot->SlotID = seg;
+		slot->SlotCharacteristics1.Provides33Volts = 1;
+		slot->SegmentGroupNum = seg;
+		slot->BusNum = PCIE_BUS_BASE(seg);
+		slot->DevFuncNum = 0;
+
+		if (priv->state == RK_PCIE_LINK_UP) {
+			slot->CurrentUsage = SlotUsageInUse;
+			AsciiSPrint(name, PCIE_SLOT_NAME_MAX, "%a (Gen%d x%d%a)", mSlotNames[seg],
+				priv->speed, priv->width, priv->degraded ? ", degraded" : "");
+		} else {
+			slot->CurrentUsage = SlotUsageAvailable;
+			AsciiSPrint(name, PCIE_SLOT_NAME_MAX, "%a", mSlotNames[seg]);
+		}
+
+		handle = SMBIOS_HANDLE_PI_RESERVED;
+		status = smbios->Add(smbios, NULL, &handle, &slot->Hdr);
+		if (EFI_ERROR(status))
+			DEBUG((EFI_D_ERROR, "PCIe%d: failed to add SMBIOS slot: %r\n", seg, status));
+	}
+}
+
+
+static void rk_pcie_writel_ob_unroll(struct rk_pcie *priv, UINT32 index,
+				     UINT32 reg, UINT32 val)
+{
+	UINT32 offset = PCIE_GET_ATU_OUTB_UNR_REG_OFFSET(index);
+
+	MmioWrite32(priv->dbi_base + offset + reg, val);
 }
 
+/* An outbound config region in shift mode: addr[27:12] is the bus/dev/func */
+static void rk_pcie_prog_ecam_atu(struct rk_pcie *priv, UINT32 index,
+				  UINT32 type, UINT64 cpu_addr, UINT64 size)
+{
+	UINT64 pci_addr = cpu_addr - PCIE_ECAM_BASE(priv->segment);
+
+	rk_pcie_writel_ob_unroll(priv, index, PCIE_ATU_UNR_LOWER_BASE, lower_32_bits(cpu_addr));
+	rk_pcie_writel_ob_unroll(priv, index, PCIE_ATU_UNR_UPPER_BASE, upper_32_bits(cpu_addr));
+	rk_pcie_writel_ob_unroll(priv, index, PCIE_ATU_UNR_LIMIT, lower_32_bits(cpu_addr + size - 1));
+	rk_pcie_writel_ob_unroll(priv, index, PCIE_ATU_UNR_LOWER_TARGET, lower_32_bits(pci_addr));
+	rk_pcie_writel_ob_unroll(priv, index, PCIE_ATU_UNR_UPPER_TARGET, upper_32_bits(pci_addr));
+	rk_pcie_writel_ob_unroll(priv, index, PCIE_ATU_UNR_REGION_CTRL1, type);
+	rk_pcie_writel_ob_unroll(priv, index, PCIE_ATU_UNR_REGION_CTRL2,
+				 PCIE_ATU_ENABLE | PCIE_ATU_CFG_SHIFT_MODE);
+}
+
+/*
+ * Hand the OS a configuration view it can use as plain ECAM (see MCFG and
+ * PcdPcieEcamCompliantSegmentsMask). The root port itself cannot be part of
+ * it, the DBI would alias it at every device number, so the view starts at
+ * the bus below it and the root port is left set up for the OS:
+ *  - bus root+1: device 0 only, as type 0 requests reach the link partner
+ *    whatever their device number. The other devices hit no iATU region,
+ *    and their unsupported requests read as all ones.
+ *  - the buses after it: type 1 requests, routed by the switches.
+ */
+static void rk_pcie_setup_ecam(struct rk_pcie *priv)
+{
+	UINT32 seg = priv->segment;
+	UINT64 ecam = PCIE_ECAM_BASE(seg);
+	UINT32 bus = priv->first_busno;
+	UINT64 base, limit;
+
+	MmioWrite32(priv->dbi_base + PCIE_AMBA_ERROR_RESPONSE,
+		    MmioRead32(priv->dbi_base + PCIE_AMBA_ERROR_RESPONSE) |
+		    PCIE_AMBA_ERROR_RESPONSE_GLOBAL);
+
+	MmioWrite32(priv->dbi_base + PCI_PRIMARY_BUS,
+		    (MmioRead32(priv->dbi_base + PCI_PRIMARY_BUS) & 0xff000000) |
+		    (PCIE_BUS_LIMIT(seg) << 16) | ((bus + 1) << 8) | bus);
+
+	base = PCIE_MEM_BASE(seg);
+	limit = base + PCIE_MEM_SIZE - 1;
+	MmioWrite32(priv->dbi_base + PCI_MEMORY_BASE,
+		    (limit & 0xfff00000) | ((base >> 16) & 0xfff0));
+
+	base = PCIE_MEM64_BASE(seg);
+	limit = base + PCIE_MEM64_SIZE(seg) - 1;
+	MmioWrite32(priv->dbi_base + PCI_PREF_MEMORY_BASE,
+		    (lower_32_bits(limit) & 0xfff00000) | (PCI_PREF_RANGE_TYPE_64 << 16) |
+		    ((lower_32_bits(base) >> 16) & 0xfff0) | PCI_PREF_RANGE_TYPE_64);
+	MmioWrite32(priv->dbi_base + PCI_PREF_BASE_UPPER32, upper_32_bits(base));
+	MmioWrite32(priv->dbi_base + PCI_PREF_LIMIT_UPPER32, upper_32_bits(limit));
+
+	rk_pcie_prog_ecam_atu(priv, PCIE_ATU_REGION_ECAM_DEV0, PCIE_ATU_TYPE_CFG0,
+			      ecam + (bus + 1) * SIZE_1MB, SIZE_32KB);
+	rk_pcie_prog_ecam_atu(priv, PCIE_ATU_REGION_ECAM_BUSES, PCIE_ATU_TYPE_CFG1,
+			      ecam + (bus + 2) * SIZE_1MB,
+			      (PCIE_BUS_LIMIT(seg) - bus - 1) * SIZE_1MB);
+}
+
+static VOID EFIAPI rk_pcie_exit_boot_services(IN EFI_EVENT Event, IN VOID *Context)
+{
+	UINT32 mask = FixedPcdGet32(PcdPcieEcamCompliantSegmentsMask);
+	UINT32 seg;
+
+	for (seg = 0; seg < PCIE_SEGMENT_COUNT; seg++) {
+		if (mPorts[seg] != NULL && (mask & BIT(seg)))
+			rk_pcie_setup_ecam(mPorts[seg]);
+	}
+}
+
+/*
+ * Once the PCI bus driver has assigned the bus numbers, tune the links of
+ * every hierarchy, before the device drivers start using them.
+ */
+static VOID EFIAPI rk_pcie_enumeration_complete(IN EFI_EVENT Event, IN VOID *Context)
+{
+	VOID *protocol;
+	UINT32 seg;
+
+	if (EFI_ERROR(gBS->LocateProtocol(&gEfiPciEnumerationCompleteProtocolGuid, NULL, &protocol)))
+		return;
+
+	gBS->CloseEvent(Event);
+
+	for (seg = 0; seg < PCIE_SEGMENT_COUNT; seg++) {
+		if (mPorts[seg] != NULL && mPorts[seg]->state == RK_PCIE_LINK_UP)
+			rk_pcie_config_links(mPorts[seg]);
+	}
+}
+
+/*
+ * EndOfDxe is signalled before the root bridges are connected, so the
+ * summary is logged again at ReadyToBoot, with the enumeration in it.
+ */
+static VOID EFIAPI rk_pcie_log_profile(IN EFI_EVENT Event, IN VOID *Context)
+{
+	gBS->CloseEvent(Event);
+	PcieProfileLogSummary();
+}
 
 EFI_STATUS
 PcieInitEntry (
@@ -364,33 +726,98 @@ PcieInitEntry (
   IN EFI_SYSTEM_TABLE           *SystemTable
   )
 {
-    EFI_STATUS         Status = EFI_SUCCESS;
 	struct rk_pcie *priv;
-	int ret;
+	VOID *registration;
+	EFI_EVENT event;
+	EFI_STATUS status;
+	UINT32 mask, seg;
+	UINT64 power_on;
+	int busy;
+
+	mask = FixedPcdGet32(PcdPcieRootBridgeMask);
+	if (!(mask & (BIT(PCIE_SEGMENT_COUNT) - 1)))
+		return EFI_NOT_FOUND;
 
+	for (seg = 0; seg < PCIE_SEGMENT_COUNT; seg++) {
+		if (!(mask & BIT(seg)))
+			continue;
 
-	priv  = (struct rk_pcie *)AllocatePool (sizeof (struct rk_pcie));
-	if (priv == NULL) {
-		DEBUG((EFI_D_ERROR, "Failed to allocate priv memory!\n"));
-  		return EFI_OUT_OF_RESOURCES;
+		PcieIoInit(seg);
+
+		/* Rest the device */
+		PciePeReset(seg, TRUE);
+
+		/* Set power and maybe external ref clk input */
+		PciePowerEn(seg);
 	}
+	power_on = GetPerformanceCounter();
 
+	rockchip_pcie_init_soc(mask);
 
-	memset(priv, 0, sizeof(struct rk_pcie));
+	for (seg = 0; seg < PCIE_SEGMENT_COUNT; seg++) {
+		mPorts[seg] = NULL;
+		if (!(mask & BIT(seg)))
+			continue;
 
-	/* 先调试3L4，配置Gen 3 */
-	priv->gen = 3;
-	priv->lane = 4;
-	priv->dbi_base = PcdGet64(PcdPcieRootPort3x4DbiBaseAddress);
-	priv->apb_base = PcdGet64(PcdPcieRootPort3x4ApbBaseAddress);
-	priv->cfg_base = PcdGet64(PcdPcieRootPort3x4CfgBaseAddress);
+		priv  = (struct rk_pcie *)AllocateZeroPool (sizeof (struct rk_pcie));
+		if (priv == NULL) {
+			DEBUG((EFI_D_ERROR, "Failed to allocate priv memory!\n"));
+			break;
+		}
 
-	DEBUG((EFI_D_ERROR, "dbi_base = 0x%lx   apb_base = 0x%lx  cfg_base = 0x%lx\n",
-		priv->dbi_base, priv->apb_base, priv->cfg_base));	
+		priv->segment = seg;
+		priv->gen = PCIE_MAX_GEN(seg);
+		priv->lane = PCIE_MAX_LANES(seg);
+		/* The 3.0 PHY lanes are split when both 3.0 controllers are used */
+		if (seg == PCIE_SEGMENT_PCIE30X4 && (mask & BIT(PCIE_SEGMENT_PCIE30X2)))
+			priv->lane = 2;
+		priv->dbi_base = PCIE_DBI_BASE(seg);
+		priv->apb_base = PCIE_APB_BASE(seg);
+		priv->cfg_base = PCIE_CFG_BASE(seg);
+		priv->first_busno = PCIE_BUS_BASE(seg);
+
+		DEBUG((EFI_D_ERROR, "PCIe%d: dbi_base = 0x%lx   apb_base = 0x%lx  cfg_base = 0x%lx\n",
+			seg, priv->dbi_base, priv->apb_base, priv->cfg_base));
+
+		rockchip_pcie_init_port(priv, power_on);
+		mPorts[seg] = priv;
+	}
 
-	ret = rockchip_pcie_init_port(priv);
-	if (ret < 0)
-		return EFI_NO_MEDIA;
+	/*
+	 * Train all the links together, so that their delays overlap. A root
+	 * bridge without a link stays, with nothing behind it: PciExpressLib
+	 * checks the link.
+	 */
+	do {
+		busy = 0;
+		for (seg = 0; seg < PCIE_SEGMENT_COUNT; seg++) {
+			if (mPorts[seg] != NULL)
+				busy |= rk_pcie_link_step(mPorts[seg]);
+		}
+		if (busy)
+			MicroSecondDelay(PCIE_LINK_POLL_US);
+	} while (busy);
+
+	rk_pcie_msi_init();
+
+	EfiCreateProtocolNotifyEvent(&gEfiSmbiosProtocolGuid, TPL_CALLBACK,
+		rk_pcie_add_smbios_slots, NULL, &registration);
+	EfiCreateProtocolNotifyEvent(&gEfiPciEnumerationCompleteProtocolGuid, TPL_CALLBACK,
+		rk_pcie_enumeration_complete, NULL, &registration);
+
+	if (PCIE_PROFILE_ENABLED) {
+		gBS->CreateEventEx(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, rk_pcie_log_profile,
+			NULL, &gEfiEndOfDxeEventGroupGuid, &event);
+		EfiCreateEventReadyToBootEx(TPL_CALLBACK, rk_pcie_log_profile, NULL, &event);
+	}
+
+	if (FixedPcdGet32(PcdPcieEcamCompliantSegmentsMask) & mask) {
+		status = gBS->CreateEventEx(EVT_NOTIFY_SIGNAL, TPL_NOTIFY,
+			rk_pcie_exit_boot_services, NULL,
+			&gEfiEventExitBootServicesGuid, &event);
+		if (EFI_ERROR(status))
+			DEBUG((EFI_D_ERROR, "PCIe: no ECAM view for the OS: %r\n", status));
+	}
 
-    return Status;
+	return EFI_SUCCESS;
 }
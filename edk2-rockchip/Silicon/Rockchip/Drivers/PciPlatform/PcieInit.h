@@ -39,15 +39,60 @@
 
 extern EFI_GUID gEfiPcieRootBridgeProtocolGuid;
 
+/*
+ * Link bring-up, stepped by rk_pcie_link_step() for all the controllers
+ * together. The delays are the minimum ones of the CEM and base specs.
+ */
+enum rk_pcie_state {
+	RK_PCIE_POWER_ON,	/* slot powered, PERST# asserted */
+	RK_PCIE_DETECT,		/* PERST# released, LTSSM looking for a receiver */
+	RK_PCIE_TRAINING,	/* receiver found, waiting for the link */
+	RK_PCIE_SETTLE,		/* link up, no config request yet */
+	RK_PCIE_RETRAIN,	/* link below what both ends support, retraining */
+	RK_PCIE_LINK_UP,
+	RK_PCIE_ABSENT,
+};
+
+#define PCIE_T_PVPERL_MS		100	/* power stable to PERST# inactive */
+/*
+ * The LTSSM enters Detect within 20ms of PERST# inactive (PCIe Base 4.0,
+ * 6.6.1), and spends up to 12ms in Detect.Quiet before each receiver
+ * detection (4.2.6.1.1). 50ms covers the first two detections.
+ */
+#define PCIE_DETECT_TIMEOUT_MS		50
+#define PCIE_LINK_UP_TIMEOUT_MS		500
+#define PCIE_T_RRS_MS			100	/* link up to first config request */
+#define PCIE_RETRAIN_TIMEOUT_MS		100
+#define PCIE_LINK_POLL_US		1000
+
 struct rk_pcie {
+	UINT32 segment;
+	enum rk_pcie_state state;
+	UINT64 state_start;	/* performance counter when state was entered */
 	UINTN dbi_base;
 	UINTN apb_base;
 	UINTN cfg_base;
 	UINT32 first_busno;
 	UINT32	gen;
 	UINT32	lane;
+	UINT32	ep_link_cap;	/* Link Capabilities of the device, 0 if unknown */
+	UINT32	speed;		/* negotiated link */
+	UINT32	width;
+	UINT32	retrains;
+	BOOLEAN	degraded;
+};
+
+/* Extended data of the status code reported for a degraded link */
+struct rk_pcie_link_report {
+	UINT32	segment;
+	UINT32	speed;
+	UINT32	width;
+	UINT32	target_speed;
+	UINT32	target_width;
 };
 
+#define PCIE_SLOT_NAME_MAX		48
+
 
 enum {
 	PCIBIOS_SUCCESSFUL = 0x0000,
@@ -64,6 +109,8 @@ enum {
 #define PCIE_CLIENT_LTSSM_STATUS	0x300
 #define SMLH_LINKUP			BIT(16)
 #define RDLH_LINKUP			BIT(17)
+#define PCIE_LTSSM_STATE_MASK		0x3f
+#define PCIE_LTSSM_DETECT_ACT		0x01	/* 0x00 is DETECT_QUIET */
 #define PCIE_CLIENT_DBG_FIFO_MODE_CON	0x310
 #define PCIE_CLIENT_DBG_FIFO_PTN_HIT_D0 0x320
 #define PCIE_CLIENT_DBG_FIFO_PTN_HIT_D1 0x324
@@ -79,6 +126,8 @@ enum {
 #define PCIE_LINK_STATUS_SPEED_MASK	(0xf << PCIE_LINK_STATUS_SPEED_OFF)
 #define PCIE_LINK_STATUS_WIDTH_OFF	20
 #define PCIE_LINK_STATUS_WIDTH_MASK	(0xf << PCIE_LINK_STATUS_WIDTH_OFF)
+#define PCIE_LINK_STATUS_TRAINING	BIT(27)
+#define PCIE_LINK_CONTROL_RETRAIN	BIT(5)
 
 #define PCIE_LINK_CAPABILITY		0x7c
 #define PCIE_LINK_CTL_2			0xa0
@@ -87,12 +136,17 @@ enum {
 #define LINK_SPEED_GEN_2		0x2
 #define LINK_SPEED_GEN_3		0x3
 
+#define PCIE_DBI2_OFFSET		0x100000	/* shadow registers, BAR masks */
+
 #define PCIE_MISC_CONTROL_1_OFF		0x8bc
 #define PCIE_DBI_RO_WR_EN		BIT(0)
 
 #define PCIE_LINK_WIDTH_SPEED_CONTROL	0x80c
 #define PORT_LOGIC_SPEED_CHANGE		BIT(17)
 
+#define PCIE_AMBA_ERROR_RESPONSE	0x8d0
+#define PCIE_AMBA_ERROR_RESPONSE_GLOBAL	BIT(0)	/* UR/CA read as all ones, OKAY */
+
 /*
  * iATU Unroll-specific register definitions
  * From 4.80 core version the address translation will be made by unroll.
@@ -108,12 +162,16 @@ enum {
 
 #define PCIE_ATU_REGION_INDEX1		(0x1 << 0)
 #define PCIE_ATU_REGION_INDEX0		(0x0 << 0)
+/* Regions 0-3 belong to PciExpressLib, the ECAM view takes the next two */
+#define PCIE_ATU_REGION_ECAM_DEV0	4
+#define PCIE_ATU_REGION_ECAM_BUSES	5
 #define PCIE_ATU_TYPE_MEM		(0x0 << 0)
 #define PCIE_ATU_TYPE_IO		(0x2 << 0)
 #define PCIE_ATU_TYPE_CFG0		(0x4 << 0)
 #define PCIE_ATU_TYPE_CFG1		(0x5 << 0)
 #define PCIE_ATU_ENABLE			(0x1 << 31)
 #define PCIE_ATU_BAR_MODE_ENABLE	(0x1 << 30)
+#define PCIE_ATU_CFG_SHIFT_MODE		(0x1 << 28)	/* bus/dev/func from addr[27:12] */
 #define PCIE_ATU_BUS(x)			(((x) & 0xff) << 24)
 #define PCIE_ATU_DEV(x)			(((x) & 0x1f) << 19)
 #define PCIE_ATU_FUNC(x)		(((x) & 0x7) << 16)
@@ -133,6 +191,11 @@ enum {
 #define PCI_BASE_ADDRESS_1      0x14    /* 32 bits [htype 0,1 only] */
 #define PCI_INTERRUPT_LINE      0x3c    /* 8 bits */
 #define PCI_PRIMARY_BUS         0x18    /* Primary bus number */
+#define PCI_MEMORY_BASE		0x20	/* Memory range behind */
+#define PCI_PREF_MEMORY_BASE	0x24	/* Prefetchable memory range behind */
+#define  PCI_PREF_RANGE_TYPE_64	0x01
+#define PCI_PREF_BASE_UPPER32	0x28	/* Upper half of prefetchable memory range */
+#define PCI_PREF_LIMIT_UPPER32	0x2c
 #define PCI_COMMAND             0x04    /* 16 bits */
 #define PCI_COMMAND_MEMORY     0x2     /* Enable response in Memory space */
 #define PCI_COMMAND_SERR		0x100	/* Enable SERR */
@@ -140,6 +203,68 @@ enum {
 #define  PCI_COMMAND_IO         0x1     /* Enable response in I/O space */
 #define PCI_CLASS_BRIDGE_PCI               0x0604
 #define PCI_CLASS_DEVICE       0x0a    /* Device class */
+#define PCI_STATUS		0x06	/* 16 bits */
+#define  PCI_STATUS_CAP_LIST	0x10	/* Support Capability List */
+#define PCI_CAPABILITY_LIST	0x34	/* Offset of first capability list entry */
+#define PCI_CAP_ID_EXP		0x10	/* PCI Express */
+#define PCI_FIND_CAP_TTL	48
+#define PCI_EXP_LNKCAP		0x0c	/* Link Capabilities */
+#define  PCI_EXP_LNKCAP_SLS	0x0000000f /* Supported Link Speeds */
+#define  PCI_EXP_LNKCAP_MLW	0x000003f0 /* Maximum Link Width */
+#define  PCI_EXP_LNKCAP_ASPMS	0x00000c00 /* ASPM Support */
+#define PCI_HEADER_TYPE		0x0e	/* 8 bits */
+#define  PCI_HEADER_TYPE_BRIDGE	1
+#define PCI_CFG_SPACE_SIZE	256
+#define PCI_FIND_EXT_CAP_TTL	((4096 - PCI_CFG_SPACE_SIZE) / 8)
+#define PCI_EXP_FLAGS		0x02	/* Capabilities register */
+#define  PCI_EXP_FLAGS_TYPE	0x00f0	/* Device/Port type */
+#define  PCI_EXP_TYPE_ROOT_PORT	0x4
+#define  PCI_EXP_TYPE_DOWNSTREAM 0x6
+#define PCI_EXP_DEVCAP		0x04	/* Device capabilities */
+#define  PCI_EXP_DEVCAP_PAYLOAD	0x00000007 /* Max_Payload_Size */
+#define PCI_EXP_DEVCTL		0x08	/* Device Control */
+#define  PCI_EXP_DEVCTL_PAYLOAD	0x00e0	/* Max_Payload_Size */
+#define  PCI_EXP_DEVCTL_READRQ	0x7000	/* Max_Read_Request_Size */
+#define PCI_EXP_LNKCTL		0x10	/* Link Control */
+#define  PCI_EXP_LNKCTL_ASPMC	0x0003	/* ASPM Control */
+#define  PCI_EXP_LNKCTL_ASPM_L0S 0x0001
+#define  PCI_EXP_LNKCTL_ASPM_L1	0x0002
+#define  PCI_EXP_LNKCTL_RL	0x0020	/* Retrain Link */
+#define  PCI_EXP_LNKCTL_CCC	0x0040	/* Common Clock Configuration */
+#define PCI_EXP_LNKSTA		0x12	/* Link Status */
+#define  PCI_EXP_LNKSTA_LT	0x0800	/* Link Training */
+#define  PCI_EXP_LNKSTA_SLC	0x1000	/* Slot Clock Configuration */
+#define PCI_EXP_DEVCAP2		0x24	/* Device Capabilities 2 */
+#define  PCI_EXP_DEVCAP2_LTR	0x00000800 /* Latency tolerance reporting */
+#define PCI_EXP_DEVCTL2		0x28	/* Device Control 2 */
+#define  PCI_EXP_DEVCTL2_LTR_EN	0x0400	/* Enable LTR mechanism */
+#define PCI_EXT_CAP_ID_L1SS	0x1e	/* L1 PM Substates */
+#define PCI_L1SS_CAP		0x04	/* Capabilities Register */
+#define PCI_L1SS_CTL1		0x08	/* Control 1 Register */
+#define  PCI_L1SS_CTL1_PCIPM_L1_2	0x00000001
+#define  PCI_L1SS_CTL1_PCIPM_L1_1	0x00000002
+#define  PCI_L1SS_CTL1_ASPM_L1_2	0x00000004
+#define  PCI_L1SS_CTL1_ASPM_L1_1	0x00000008
+#define  PCI_L1SS_CTL1_L1SS_MASK	0x0000000f
+#define  PCI_L1SS_CTL1_LTR_L12_TH_VALUE	0x03ff0000
+#define  PCI_L1SS_CTL1_LTR_L12_TH_SCALE	0xe0000000
+#define PCI_L1SS_CTL2		0x0c	/* Control 2 Register */
+
+/* PcdPcieAspmPolicy, the L0s and L1 bits are those of Link Control */
+#define PCIE_ASPM_POLICY_L1_1		BIT(2)
+#define PCIE_ASPM_POLICY_L1_2		BIT(3)
+
+#define PCIE_LINK_MAX_FUNCTIONS		32
+
+void rk_pcie_config_links(struct rk_pcie *priv);
+
+/* GICv3 distributor, for the message-based SPIs used as MSI vectors */
+#define GICD_TYPER			0x0004
+#define  GICD_TYPER_LINES		0x1f	/* ITLinesNumber */
+#define  GICD_TYPER_MBIS		BIT(16)
+#define GICD_SETSPI_NSR			0x0040
+
+void rk_pcie_msi_init(void);
 
 /* 3.0 PHY Register for RK3588 */
 #define PHP_GRF_PCIESEL_CON 0x100
@@ -148,6 +273,7 @@ enum {
 #define RK3588_PCIE3PHY_GRF_PHY1_STATUS1 0xa04
 #define RK3588_SRAM_INIT_DONE(reg) (reg & BIT(0))
 
+#define PHY_MODE_PCIE_NANBNB 0          /* PCIe3x2 + PCIe3x2 */
 #define PHY_MODE_PCIE_AGGREGATION 4     /* PCIe3x4 */
 
 #endif
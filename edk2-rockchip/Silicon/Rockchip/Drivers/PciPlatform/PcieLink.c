@@ -0,0 +1,367 @@
+/** @file
+*
+*  Link parameters of the PCIe hierarchy below a root port, programmed once
+*  the PCI bus driver has enumerated it: Common Clock Configuration, Max
+*  Payload and Read Request Sizes, and the ASPM policy of PcdPcieAspmPolicy.
+*
+*  Copyright (c) 2022, Rockchip Inc.
+*
+*  SPDX-License-Identifier: BSD-2-Clause-Patent
+*
+**/
+
+#include "PcieInit.h"
+#include <Library/IoLib.h>
+#include <Library/PcdLib.h>
+#include <Library/PciExpressLib.h>
+#include <RK3588Pcie.h>
+
+/* A PCI Express function of the hierarchy */
+struct rk_pcie_fn {
+	UINTN	addr;		/* PciExpressLib address of the function */
+	UINT16	exp;		/* PCI Express capability */
+	UINT16	l1ss;		/* L1 PM Substates capability, 0 if none */
+	int	parent;		/* downstream port above, -1 for the root port */
+	UINT8	type;		/* Device/Port Type */
+	BOOLEAN	bridge;
+};
+
+/* Ports with a link below them */
+#define rk_pcie_is_downstream(fn) \
+	((fn)->type == PCI_EXP_TYPE_ROOT_PORT || (fn)->type == PCI_EXP_TYPE_DOWNSTREAM)
+
+struct rk_pcie_tree {
+	UINTN	count;
+	BOOLEAN	overflow;	/* functions left out, PCIE_LINK_MAX_FUNCTIONS reached */
+	struct rk_pcie_fn fn[PCIE_LINK_MAX_FUNCTIONS];
+};
+
+static UINT16 rk_pcie_find_cap(UINTN addr, UINT8 id)
+{
+	UINT16 cap;
+	UINT8 ptr;
+	int i;
+
+	if (!(PciExpressRead16(addr + PCI_STATUS) & PCI_STATUS_CAP_LIST))
+		return 0;
+
+	ptr = PciExpressRead8(addr + PCI_CAPABILITY_LIST) & ~3;
+	for (i = 0; ptr && i < PCI_FIND_CAP_TTL; i++) {
+		cap = PciExpressRead16(addr + ptr);
+		if ((cap & 0xff) == id)
+			return ptr;
+		ptr = (cap >> 8) & ~3;
+	}
+
+	return 0;
+}
+
+static UINT16 rk_pcie_find_ext_cap(UINTN addr, UINT16 id)
+{
+	UINT32 header;
+	UINT16 pos = PCI_CFG_SPACE_SIZE;
+	int i;
+
+	for (i = 0; pos >= PCI_CFG_SPACE_SIZE && i < PCI_FIND_EXT_CAP_TTL; i++) {
+		header = PciExpressRead32(addr + pos);
+		if (header == 0 || header == 0xffffffff)
+			break;
+		if ((header & 0xffff) == id)
+			return pos;
+		pos = (header >> 20) & ~3;
+	}
+
+	return 0;
+}
+
+/* Collect the PCI Express functions on a bus and, depth first, below it */
+static void rk_pcie_scan_bus(struct rk_pcie_tree *tree, UINT32 bus, int parent,
+			     UINT32 limit)
+{
+	struct rk_pcie_fn *fn;
+	UINT32 dev, func, buses;
+	UINT8 header;
+	UINTN addr;
+	UINT16 exp;
+	int index;
+
+	for (dev = 0; dev < 32; dev++) {
+		for (func = 0; func < 8; func++) {
+			addr = PCI_EXPRESS_LIB_ADDRESS(bus, dev, func, 0);
+			if (PciExpressRead16(addr) == 0xffff) {
+				if (func == 0)
+					break;
+				continue;
+			}
+
+			header = PciExpressRead8(addr + PCI_HEADER_TYPE);
+			exp = rk_pcie_find_cap(addr, PCI_CAP_ID_EXP);
+			if (exp && tree->count == PCIE_LINK_MAX_FUNCTIONS) {
+				tree->overflow = TRUE;
+				return;
+			}
+			if (exp) {
+				index = tree->count++;
+				fn = &tree->fn[index];
+				fn->addr = addr;
+				fn->exp = exp;
+				fn->l1ss = rk_pcie_find_ext_cap(addr, PCI_EXT_CAP_ID_L1SS);
+				fn->parent = parent;
+				fn->type = (PciExpressRead16(addr + exp + PCI_EXP_FLAGS) &
+					    PCI_EXP_FLAGS_TYPE) >> 4;
+				fn->bridge = (header & 0x7f) == PCI_HEADER_TYPE_BRIDGE;
+
+				/* Conventional PCI below a PCIe bridge has no link to tune */
+				buses = PciExpressRead32(addr + PCI_PRIMARY_BUS);
+				if (fn->bridge && ((buses >> 8) & 0xff) > bus &&
+				    ((buses >> 8) & 0xff) <= limit)
+					rk_pcie_scan_bus(tree, (buses >> 8) & 0xff, index,
+							 (buses >> 16) & 0xff);
+			}
+
+			if (func == 0 && !(header & 0x80))
+				break;
+		}
+	}
+}
+
+/*
+ * Max Payload Size: the largest one every function supports, so that it
+ * holds on every path, peer to peer included. Max Read Request Size from
+ * PcdPcieMaxReadRequestSize, as it only bounds the requests of the function.
+ */
+static void rk_pcie_config_mps(struct rk_pcie_tree *tree)
+{
+	UINT32 mps = 5, mrrs = 0, size;
+	UINT16 ctl;
+	UINTN i;
+
+	for (i = 0; i < tree->count; i++)
+		mps = MIN(mps, PciExpressRead32(tree->fn[i].addr + tree->fn[i].exp + PCI_EXP_DEVCAP) &
+			  PCI_EXP_DEVCAP_PAYLOAD);
+
+	for (size = FixedPcdGet32(PcdPcieMaxReadRequestSize); size > 128 && mrrs < 5; size >>= 1)
+		mrrs++;
+
+	for (i = 0; i < tree->count; i++) {
+		ctl = PciExpressRead16(tree->fn[i].addr + tree->fn[i].exp + PCI_EXP_DEVCTL);
+		ctl &= ~(PCI_EXP_DEVCTL_PAYLOAD | PCI_EXP_DEVCTL_READRQ);
+		ctl |= (mps << 5) | (mrrs << 12);
+		PciExpressWrite16(tree->fn[i].addr + tree->fn[i].exp + PCI_EXP_DEVCTL, ctl);
+	}
+
+	DEBUG((EFI_D_INFO, "PCIe: MPS %d, MRRS %d for %d functions\n",
+		128 << mps, 128 << mrrs, (UINT32)tree->count));
+}
+
+/*
+ * Set Common Clock Configuration on both ends of the link below a
+ * downstream port when both use the reference clock of the slot, and
+ * retrain the link for the new N_FTS and latencies to apply.
+ */
+static void rk_pcie_config_common_clock(struct rk_pcie_tree *tree, int port)
+{
+	struct rk_pcie_fn *dp = &tree->fn[port];
+	UINTN i, timeout, children = 0;
+	UINT16 sta;
+
+	if (!(PciExpressRead16(dp->addr + dp->exp + PCI_EXP_LNKSTA) & PCI_EXP_LNKSTA_SLC))
+		return;
+
+	for (i = 0; i < tree->count; i++) {
+		if (tree->fn[i].parent != port)
+			continue;
+		if (!(PciExpressRead16(tree->fn[i].addr + tree->fn[i].exp + PCI_EXP_LNKSTA) &
+		      PCI_EXP_LNKSTA_SLC))
+			return;
+		children++;
+	}
+	if (!children)
+		return;
+
+	if (PciExpressRead16(dp->addr + dp->exp + PCI_EXP_LNKCTL) & PCI_EXP_LNKCTL_CCC)
+		return;
+
+	for (i = 0; i < tree->count; i++) {
+		if (tree->fn[i].parent == port)
+			PciExpressOr16(tree->fn[i].addr + tree->fn[i].exp + PCI_EXP_LNKCTL,
+				       PCI_EXP_LNKCTL_CCC);
+	}
+	PciExpressOr16(dp->addr + dp->exp + PCI_EXP_LNKCTL, PCI_EXP_LNKCTL_CCC | PCI_EXP_LNKCTL_RL);
+
+	for (timeout = 0; timeout < PCIE_RETRAIN_TIMEOUT_MS * 1000; timeout += 10) {
+		sta = PciExpressRead16(dp->addr + dp->exp + PCI_EXP_LNKSTA);
+		if (!(sta & PCI_EXP_LNKSTA_LT))
+			return;
+		MicroSecondDelay(10);
+	}
+
+	DEBUG((EFI_D_ERROR, "PCIe: %lx: link retrain for common clock timed out\n", dp->addr));
+}
+
+/* Encode a time in microseconds as T_POWER_ON value (bits 7:3) and scale */
+static UINT32 rk_pcie_encode_power_on(UINT32 us)
+{
+	if (us <= 2 * 31)
+		return ((us + 1) / 2) << 3;
+	if (us <= 10 * 31)
+		return ((us + 9) / 10) << 3 | 1;
+	return MIN((us + 99) / 100, 31) << 3 | 2;
+}
+
+static UINT32 rk_pcie_power_on_us(UINT32 cap)
+{
+	static CONST UINT32 scale[] = { 2, 10, 100, 0 };
+
+	return scale[(cap >> 16) & 3] * ((cap >> 19) & 0x1f);
+}
+
+/*
+ * L1 PM Substates, with the timing parameters both ends need for L1.2:
+ * Common_Mode_Restore_Time and T_POWER_ON are the largest the two report,
+ * and the LTR threshold is the time to get out of L1.2 (as Linux does).
+ */
+static UINT32 rk_pcie_config_l1ss(struct rk_pcie_fn *dp, struct rk_pcie_fn *up, UINT32 policy)
+{
+	UINT32 dcap, ucap, enable, cm, on_us, threshold, ctl1;
+
+	if (!dp->l1ss || !up->l1ss)
+		return 0;
+
+	dcap = PciExpressRead32(dp->addr + dp->l1ss + PCI_L1SS_CAP);
+	ucap = PciExpressRead32(up->addr + up->l1ss + PCI_L1SS_CAP);
+	enable = 0;
+	if (policy & PCIE_ASPM_POLICY_L1_1)
+		enable |= PCI_L1SS_CTL1_ASPM_L1_1 | PCI_L1SS_CTL1_PCIPM_L1_1;
+	if (policy & PCIE_ASPM_POLICY_L1_2)
+		enable |= PCI_L1SS_CTL1_ASPM_L1_2 | PCI_L1SS_CTL1_PCIPM_L1_2;
+	/* The capability and control bits are at the same positions */
+	enable &= dcap & ucap & PCI_L1SS_CTL1_L1SS_MASK;
+	if (!enable)
+		return 0;
+
+	/* L1.2 needs LTR on both ends */
+	if (enable & (PCI_L1SS_CTL1_ASPM_L1_2 | PCI_L1SS_CTL1_PCIPM_L1_2)) {
+		if (!(PciExpressRead32(dp->addr + dp->exp + PCI_EXP_DEVCAP2) & PCI_EXP_DEVCAP2_LTR) ||
+		    !(PciExpressRead32(up->addr + up->exp + PCI_EXP_DEVCAP2) & PCI_EXP_DEVCAP2_LTR)) {
+			enable &= ~(PCI_L1SS_CTL1_ASPM_L1_2 | PCI_L1SS_CTL1_PCIPM_L1_2);
+		} else {
+			PciExpressOr16(dp->addr + dp->exp + PCI_EXP_DEVCTL2, PCI_EXP_DEVCTL2_LTR_EN);
+			PciExpressOr16(up->addr + up->exp + PCI_EXP_DEVCTL2, PCI_EXP_DEVCTL2_LTR_EN);
+		}
+	}
+
+	cm = MAX((dcap >> 8) & 0xff, (ucap >> 8) & 0xff);
+	on_us = MAX(rk_pcie_power_on_us(dcap), rk_pcie_power_on_us(ucap));
+	/* In units of 1024ns, scale 2 of the LTR threshold */
+	threshold = ((2 + 4 + cm + on_us) * 1000 + 1023) / 1024;
+
+	/* Disabled on both ends while the parameters change */
+	PciExpressAnd32(up->addr + up->l1ss + PCI_L1SS_CTL1, ~PCI_L1SS_CTL1_L1SS_MASK);
+	PciExpressAnd32(dp->addr + dp->l1ss + PCI_L1SS_CTL1, ~PCI_L1SS_CTL1_L1SS_MASK);
+
+	PciExpressWrite32(dp->addr + dp->l1ss + PCI_L1SS_CTL2, rk_pcie_encode_power_on(on_us));
+	PciExpressWrite32(up->addr + up->l1ss + PCI_L1SS_CTL2, rk_pcie_encode_power_on(on_us));
+
+	ctl1 = (cm << 8) | (MIN(threshold, 0x3ff) << 16) | (2 << 29);
+	PciExpressWrite32(dp->addr + dp->l1ss + PCI_L1SS_CTL1, ctl1 | enable);
+	PciExpressWrite32(up->addr + up->l1ss + PCI_L1SS_CTL1,
+			  (PciExpressRead32(up->addr + up->l1ss + PCI_L1SS_CTL1) &
+			   ~(PCI_L1SS_CTL1_LTR_L12_TH_VALUE | PCI_L1SS_CTL1_LTR_L12_TH_SCALE)) |
+			  (ctl1 & (PCI_L1SS_CTL1_LTR_L12_TH_VALUE | PCI_L1SS_CTL1_LTR_L12_TH_SCALE)) |
+			  enable);
+
+	return enable;
+}
+
+/*
+ * ASPM of the link below a downstream port: the states of PcdPcieAspmPolicy
+ * that both ends support, enabled on the upstream end (the downstream port)
+ * first.
+ */
+static void rk_pcie_config_aspm(struct rk_pcie_tree *tree, int port, UINT32 policy)
+{
+	struct rk_pcie_fn *dp = &tree->fn[port];
+	UINT32 aspm, l1ss;
+	int first = -1;
+	UINTN i;
+
+	aspm = policy & (PCI_EXP_LNKCTL_ASPM_L0S | PCI_EXP_LNKCTL_ASPM_L1);
+	aspm &= (PciExpressRead32(dp->addr + dp->exp + PCI_EXP_LNKCAP) & PCI_EXP_LNKCAP_ASPMS) >> 10;
+	for (i = 0; i < tree->count; i++) {
+		if (tree->fn[i].parent != port)
+			continue;
+		aspm &= (PciExpressRead32(tree->fn[i].addr + tree->fn[i].exp + PCI_EXP_LNKCAP) &
+			 PCI_EXP_LNKCAP_ASPMS) >> 10;
+		if (first < 0)
+			first = i;
+	}
+	if (first < 0 || !aspm)
+		return;
+
+	/* L1 substates are entered from ASPM L1, and set up before it */
+	l1ss = 0;
+	if (aspm & PCI_EXP_LNKCTL_ASPM_L1)
+		l1ss = rk_pcie_config_l1ss(dp, &tree->fn[first], policy);
+
+	PciExpressAndThenOr16(dp->addr + dp->exp + PCI_EXP_LNKCTL,
+			      ~PCI_EXP_LNKCTL_ASPMC, aspm);
+	for (i = 0; i < tree->count; i++) {
+		if (tree->fn[i].parent == port)
+			PciExpressAndThenOr16(tree->fn[i].addr + tree->fn[i].exp + PCI_EXP_LNKCTL,
+					      ~PCI_EXP_LNKCTL_ASPMC, aspm);
+	}
+
+	DEBUG((EFI_D_INFO, "PCIe: %lx: ASPM%a%a, L1SS 0x%x\n", dp->addr,
+		aspm & PCI_EXP_LNKCTL_ASPM_L0S ? " L0s" : "",
+		aspm & PCI_EXP_LNKCTL_ASPM_L1 ? " L1" : "", l1ss));
+}
+
+void rk_pcie_config_links(struct rk_pcie *priv)
+{
+	static struct rk_pcie_tree tree;
+	UINT32 policy = FixedPcdGet32(PcdPcieAspmPolicy);
+	struct rk_pcie_fn *root;
+	UINT32 buses;
+	UINTN i;
+
+	/* The root port itself, on the DBI */
+	tree.count = 0;
+	tree.overflow = FALSE;
+	root = &tree.fn[tree.count++];
+	root->addr = PCI_EXPRESS_LIB_ADDRESS(priv->first_busno, 0, 0, 0);
+	root->exp = rk_pcie_find_cap(root->addr, PCI_CAP_ID_EXP);
+	root->l1ss = rk_pcie_find_ext_cap(root->addr, PCI_EXT_CAP_ID_L1SS);
+	root->parent = -1;
+	root->bridge = TRUE;
+	if (!root->exp)
+		return;
+	root->type = (PciExpressRead16(root->addr + root->exp + PCI_EXP_FLAGS) &
+		      PCI_EXP_FLAGS_TYPE) >> 4;
+
+	buses = PciExpressRead32(root->addr + PCI_PRIMARY_BUS);
+	if (((buses >> 8) & 0xff) != priv->first_busno + 1)
+		return;		/* not enumerated */
+	rk_pcie_scan_bus(&tree, priv->first_busno + 1, 0, PCIE_BUS_LIMIT(priv->segment));
+
+	/*
+	 * An MPS that some unseen function does not support, or a link set up
+	 * on one end only, is worse than the reset values: leave them all.
+	 */
+	if (tree.overflow) {
+		DEBUG((EFI_D_ERROR, "PCIe: segment %d has more than %d functions, "
+			"link parameters left as they are\n", priv->segment,
+			PCIE_LINK_MAX_FUNCTIONS));
+		return;
+	}
+
+	rk_pcie_config_mps(&tree);
+
+	for (i = 0; i < tree.count; i++) {
+		if (!rk_pcie_is_downstream(&tree.fn[i]))
+			continue;
+		rk_pcie_config_common_clock(&tree, i);
+		if (policy)
+			rk_pcie_config_aspm(&tree, i, policy);
+	}
+}
@@ -0,0 +1,160 @@
+/** @file
+*
+*  MSI for the firmware drivers of the PCIe endpoints.
+*
+*  The iMSI-RX of the DesignWare cores has no interrupt line to the GIC on
+*  RK3588: each controller only has its sys, pmc, msg, legacy and err
+*  lines, and is meant to send its MSIs to an ITS. The ITS is left to the
+*  OS, as LPIs cannot be turned off again once a redistributor has them
+*  enabled. The MSIs are sent to the GICD_SETSPI_NSR register of the
+*  distributor instead, each vector being one of the PcdPcieMsiSpiCount
+*  SPIs from PcdPcieMsiSpiBase, and dispatched through ArmGicDxe. This
+*  works the same for every segment, nothing is programmed in the root
+*  complexes.
+*
+*  Copyright (c) 2022, Rockchip Inc.
+*
+*  SPDX-License-Identifier: BSD-2-Clause-Patent
+*
+**/
+
+#include "PcieInit.h"
+#include <Library/IoLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Protocol/HardwareInterrupt2.h>
+#include <Protocol/PcieMsi.h>
+
+struct rk_pcie_msi_vector {
+	ROCKCHIP_PCIE_MSI_HANDLER handler;
+	VOID *context;
+};
+
+static struct rk_pcie_msi_vector *mMsiVectors;
+static UINT32 mMsiBase;
+static EFI_HARDWARE_INTERRUPT2_PROTOCOL *mGic;
+
+static VOID EFIAPI rk_pcie_msi_irq(IN HARDWARE_INTERRUPT_SOURCE source,
+				   IN EFI_SYSTEM_CONTEXT context)
+{
+	struct rk_pcie_msi_vector *vector = &mMsiVectors[source - mMsiBase];
+
+	/* Edge triggered: a message sent while the handler runs pends again */
+	mGic->EndOfInterrupt(mGic, source);
+	if (vector->handler != NULL)
+		vector->handler(source - mMsiBase, vector->context);
+}
+
+static EFI_STATUS EFIAPI rk_pcie_msi_register(IN ROCKCHIP_PCIE_MSI_PROTOCOL *This,
+					      IN ROCKCHIP_PCIE_MSI_HANDLER Handler,
+					      IN VOID *Context, OUT UINTN *Vector,
+					      OUT UINT64 *Address, OUT UINT32 *Data)
+{
+	EFI_STATUS status;
+	EFI_TPL tpl;
+	UINTN i;
+
+	if (Handler == NULL || Vector == NULL || Address == NULL || Data == NULL)
+		return EFI_INVALID_PARAMETER;
+
+	if (mGic == NULL &&
+	    EFI_ERROR(gBS->LocateProtocol(&gHardwareInterrupt2ProtocolGuid, NULL, (VOID **)&mGic))) {
+		mGic = NULL;
+		return EFI_NOT_READY;
+	}
+
+	tpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	for (i = 0; i < This->VectorCount; i++) {
+		if (mMsiVectors[i].handler == NULL)
+			break;
+	}
+	if (i == This->VectorCount) {
+		gBS->RestoreTPL(tpl);
+		return EFI_OUT_OF_RESOURCES;
+	}
+	mMsiVectors[i].handler = Handler;
+	mMsiVectors[i].context = Context;
+	gBS->RestoreTPL(tpl);
+
+	/* Registering a handler also enables the SPI */
+	status = mGic->SetTriggerType(mGic, mMsiBase + i, EFI_HARDWARE_INTERRUPT2_TRIGGER_EDGE_RISING);
+	if (!EFI_ERROR(status))
+		status = mGic->RegisterInterruptSource(mGic, mMsiBase + i, rk_pcie_msi_irq);
+	if (EFI_ERROR(status)) {
+		DEBUG((EFI_D_ERROR, "PCIe: cannot enable MSI SPI %d: %r\n", mMsiBase + i, status));
+		mMsiVectors[i].handler = NULL;
+		return status;
+	}
+
+	*Vector = i;
+	*Address = PcdGet64(PcdGicDistributorBase) + GICD_SETSPI_NSR;
+	*Data = mMsiBase + i;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI rk_pcie_msi_unregister(IN ROCKCHIP_PCIE_MSI_PROTOCOL *This,
+						IN UINTN Vector)
+{
+	if (Vector >= This->VectorCount || mMsiVectors[Vector].handler == NULL)
+		return EFI_INVALID_PARAMETER;
+
+	/* Unregistering disables the SPI */
+	mGic->RegisterInterruptSource(mGic, mMsiBase + Vector, NULL);
+	mMsiVectors[Vector].handler = NULL;
+	mMsiVectors[Vector].context = NULL;
+	return EFI_SUCCESS;
+}
+
+static ROCKCHIP_PCIE_MSI_PROTOCOL mMsiProtocol = {
+	ROCKCHIP_PCIE_MSI_PROTOCOL_REVISION,
+	0,
+	rk_pcie_msi_register,
+	rk_pcie_msi_unregister,
+};
+
+/*
+ * ArmGicDxe disables every SPI at ExitBootServices, so a device the OS has
+ * not taken over yet cannot raise one of these SPIs.
+ */
+void rk_pcie_msi_init(void)
+{
+	EFI_HANDLE handle = NULL;
+	EFI_STATUS status;
+	UINT32 typer, count, lines;
+
+	mMsiBase = FixedPcdGet32(PcdPcieMsiSpiBase);
+	count = FixedPcdGet32(PcdPcieMsiSpiCount);
+	if (count == 0)
+		return;
+
+	typer = MmioRead32(PcdGet64(PcdGicDistributorBase) + GICD_TYPER);
+	if (!(typer & GICD_TYPER_MBIS)) {
+		DEBUG((EFI_D_ERROR, "PCIe: the GIC has no message-based SPIs, no MSI\n"));
+		return;
+	}
+
+	/* INTIDs 1020 to 1023 are special */
+	lines = MIN(32 * ((typer & GICD_TYPER_LINES) + 1), 1020);
+	if (mMsiBase < 32 || mMsiBase + count > lines) {
+		DEBUG((EFI_D_ERROR, "PCIe: MSI SPIs %d-%d beyond the %d interrupts of the GIC\n",
+			mMsiBase, mMsiBase + count - 1, lines));
+		return;
+	}
+
+	mMsiVectors = AllocateZeroPool(count * sizeof(*mMsiVectors));
+	if (mMsiVectors == NULL)
+		return;
+
+	mMsiProtocol.VectorCount = count;
+	status = gBS->InstallMultipleProtocolInterfaces(&handle,
+		&gRockchipPcieMsiProtocolGuid, &mMsiProtocol, NULL);
+	if (EFI_ERROR(status)) {
+		FreePool(mMsiVectors);
+		mMsiVectors = NULL;
+		return;
+	}
+
+	DEBUG((EFI_D_INFO, "PCIe: %d MSI vectors on SPIs %d-%d\n",
+		count, mMsiBase, mMsiBase + count - 1));
+}
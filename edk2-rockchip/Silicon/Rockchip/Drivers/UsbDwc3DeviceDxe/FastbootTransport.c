@@ -0,0 +1,300 @@
+/** @file
+
+  FASTBOOT_TRANSPORT_PROTOCOL over the DWC3 peripheral controller.
+
+  Unlike the generic USB transport, this one watches the "DATA" responses
+  going to the host and tells the controller how much data follows, so that
+  downloads are received in large transfers instead of one packet at a time.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "UsbDwc3Device.h"
+
+#pragma pack(1)
+typedef struct {
+  USB_CONFIG_DESCRIPTOR         ConfigDescriptor;
+  USB_INTERFACE_DESCRIPTOR      InterfaceDescriptor;
+  USB_ENDPOINT_DESCRIPTOR       EndpointDescriptor1;
+  USB_ENDPOINT_DESCRIPTOR       EndpointDescriptor2;
+} FASTBOOT_CONFIG_DESCRIPTOR;
+#pragma pack()
+
+#define FASTBOOT_INTERFACE_CLASS        0xFF
+#define FASTBOOT_INTERFACE_SUB_CLASS    0x42
+#define FASTBOOT_INTERFACE_PROTOCOL     0x03
+
+#define FASTBOOT_BULK_IN_ENDPOINT       0x81
+#define FASTBOOT_BULK_OUT_ENDPOINT      0x01
+
+//
+// "DATA" followed by the download size in hexadecimal
+//
+#define FASTBOOT_DATA_RESPONSE          "DATA"
+#define FASTBOOT_DATA_RESPONSE_MAX      12
+
+STATIC USB_DEVICE_DESCRIPTOR mDeviceDescriptor = {
+  sizeof (USB_DEVICE_DESCRIPTOR),   // Length
+  USB_DESC_TYPE_DEVICE,             // DescriptorType
+  0x0200,                           // BcdUSB, adjusted at SuperSpeed
+  0xFF,                             // DeviceClass
+  0,                                // DeviceSubClass
+  0,                                // DeviceProtocol
+  64,                               // MaxPacketSize0, adjusted to the speed
+  0,                                // IdVendor, from PcdAndroidFastbootUsbVendorId
+  0,                                // IdProduct, from PcdAndroidFastbootUsbProductId
+  0,                                // BcdDevice
+  1,                                // StrManufacturer
+  2,                                // StrProduct
+  0,                                // StrSerialNumber
+  1                                 // NumConfigurations
+};
+
+STATIC FASTBOOT_CONFIG_DESCRIPTOR mConfigDescriptor = {
+  {
+    sizeof (USB_CONFIG_DESCRIPTOR),
+    USB_DESC_TYPE_CONFIG,
+    sizeof (FASTBOOT_CONFIG_DESCRIPTOR),
+    1,                              // NumInterfaces
+    1,                              // ConfigurationValue
+    0,                              // Configuration
+    0xC0,                           // Attributes: self powered
+    0x32                            // MaxPower: 100mA
+  },
+  {
+    sizeof (USB_INTERFACE_DESCRIPTOR),
+    USB_DESC_TYPE_INTERFACE,
+    0,                              // InterfaceNumber
+    0,                              // AlternateSetting
+    2,                              // NumEndpoints
+    FASTBOOT_INTERFACE_CLASS,
+    FASTBOOT_INTERFACE_SUB_CLASS,
+    FASTBOOT_INTERFACE_PROTOCOL,
+    3                               // Interface
+  },
+  {
+    sizeof (USB_ENDPOINT_DESCRIPTOR),
+    USB_DESC_TYPE_ENDPOINT,
+    FASTBOOT_BULK_IN_ENDPOINT,
+    USB_ENDPOINT_BULK,
+    512,                            // MaxPacketSize, adjusted to the speed
+    0                               // Interval
+  },
+  {
+    sizeof (USB_ENDPOINT_DESCRIPTOR),
+    USB_DESC_TYPE_ENDPOINT,
+    FASTBOOT_BULK_OUT_ENDPOINT,
+    USB_ENDPOINT_BULK,
+    512,                            // MaxPacketSize, adjusted to the speed
+    0                               // Interval
+  }
+};
+
+STATIC CONST CHAR16 *mStrings[] = {
+  L"Rockchip",
+  L"Android Fastboot",
+  L"fastboot"
+};
+
+//
+// Packets received and not yet collected by Receive ()
+//
+typedef struct {
+  LIST_ENTRY                    Link;
+  VOID                          *Buffer;
+  UINTN                         BufferSize;
+} FASTBOOT_PACKET;
+
+STATIC LIST_ENTRY               mPacketList = INITIALIZE_LIST_HEAD_VARIABLE (mPacketList);
+STATIC EFI_EVENT                mReceiveEvent;
+
+/**
+  Bulk OUT completion: queue the data for Receive ().
+
+  @param[in]  Size              Size of the data received.
+  @param[in]  Buffer            The data, owned by the transport from now on.
+
+**/
+STATIC
+VOID
+EFIAPI
+FastbootDataReceived (
+  IN UINTN                      Size,
+  IN VOID                       *Buffer
+  )
+{
+  FASTBOOT_PACKET               *Packet;
+
+  Packet = AllocatePool (sizeof (FASTBOOT_PACKET));
+  if (Packet == NULL) {
+    DEBUG ((EFI_D_ERROR, "Fastboot: out of memory, dropping %d bytes\n", Size));
+    FreePool (Buffer);
+    return;
+  }
+
+  Packet->Buffer     = Buffer;
+  Packet->BufferSize = Size;
+  InsertTailList (&mPacketList, &Packet->Link);
+
+  gBS->SignalEvent (mReceiveEvent);
+}
+
+/**
+  Bulk IN completion.
+
+  @param[in]  EndpointIndex     The endpoint the data was sent on.
+
+**/
+STATIC
+VOID
+EFIAPI
+FastbootDataSent (
+  IN UINT8                      EndpointIndex
+  )
+{
+}
+
+/**
+  Start the transport: connect to the host as a fastboot device.
+
+  @param[in]  ReceiveEvent      Signalled when data is available for Receive ().
+
+  @retval EFI_SUCCESS           The device is connected.
+  @return Others                The controller could not be started.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FastbootTransportStart (
+  IN EFI_EVENT                  ReceiveEvent
+  )
+{
+  VOID                          *Descriptors[1];
+
+  mReceiveEvent = ReceiveEvent;
+
+  mDeviceDescriptor.IdVendor  = FixedPcdGet32 (PcdAndroidFastbootUsbVendorId);
+  mDeviceDescriptor.IdProduct = FixedPcdGet32 (PcdAndroidFastbootUsbProductId);
+  Descriptors[0]              = &mConfigDescriptor;
+
+  return Dwc3DeviceStart (
+           &mDeviceDescriptor,
+           Descriptors,
+           mStrings,
+           ARRAY_SIZE (mStrings),
+           FastbootDataReceived,
+           FastbootDataSent
+           );
+}
+
+/**
+  Stop the transport and drop the data not collected yet.
+
+  @retval EFI_SUCCESS           The device is disconnected.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FastbootTransportStop (
+  VOID
+  )
+{
+  FASTBOOT_PACKET               *Packet;
+
+  Dwc3DeviceStop ();
+
+  while (!IsListEmpty (&mPacketList)) {
+    Packet = BASE_CR (GetFirstNode (&mPacketList), FASTBOOT_PACKET, Link);
+    RemoveEntryList (&Packet->Link);
+    FreePool (Packet->Buffer);
+    FreePool (Packet);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Send data to the host. A "DATA" response announces a download, whose
+  size is passed to the controller before the host can start sending it.
+
+  @param[in]  BufferSize        Size of the data.
+  @param[in]  Buffer            The data.
+  @param[in]  FatalErrorEvent   Unused, errors are returned synchronously.
+
+  @retval EFI_SUCCESS           The data was queued.
+  @return Others                See Dwc3DeviceSend ().
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FastbootTransportSend (
+  IN       UINTN                BufferSize,
+  IN CONST VOID                 *Buffer,
+  IN       EFI_EVENT            *FatalErrorEvent
+  )
+{
+  CHAR8                         Response[FASTBOOT_DATA_RESPONSE_MAX + 1];
+  UINTN                         Prefix;
+
+  Prefix = sizeof (FASTBOOT_DATA_RESPONSE) - 1;
+  if ((BufferSize > Prefix) && (BufferSize <= FASTBOOT_DATA_RESPONSE_MAX) &&
+      (CompareMem (Buffer, FASTBOOT_DATA_RESPONSE, Prefix) == 0)) {
+    CopyMem (Response, Buffer, BufferSize);
+    Response[BufferSize] = '\0';
+    Dwc3DeviceExpectRx (AsciiStrHexToUintn (Response + Prefix));
+  }
+
+  return Dwc3DeviceSend (FASTBOOT_BULK_IN_ENDPOINT, BufferSize, Buffer);
+}
+
+/**
+  Collect the oldest data received from the host.
+
+  @param[out] BufferSize        Size of the data.
+  @param[out] Buffer            The data, to be freed with FreePool ().
+
+  @retval EFI_SUCCESS           Data was returned.
+  @retval EFI_NOT_READY         No data is available.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FastbootTransportReceive (
+  OUT UINTN                     *BufferSize,
+  OUT VOID                      **Buffer
+  )
+{
+  FASTBOOT_PACKET               *Packet;
+  EFI_TPL                       OldTpl;
+
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+
+  if (IsListEmpty (&mPacketList)) {
+    gBS->RestoreTPL (OldTpl);
+    return EFI_NOT_READY;
+  }
+
+  Packet = BASE_CR (GetFirstNode (&mPacketList), FASTBOOT_PACKET, Link);
+  RemoveEntryList (&Packet->Link);
+
+  gBS->RestoreTPL (OldTpl);
+
+  *Buffer     = Packet->Buffer;
+  *BufferSize = Packet->BufferSize;
+  FreePool (Packet);
+
+  return EFI_SUCCESS;
+}
+
+FASTBOOT_TRANSPORT_PROTOCOL mDwc3FastbootTransport = {
+  FastbootTransportStart,
+  FastbootTransportStop,
+  FastbootTransportSend,
+  FastbootTransportReceive
+};
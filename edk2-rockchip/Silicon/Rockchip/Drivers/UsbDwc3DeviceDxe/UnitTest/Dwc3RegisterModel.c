@@ -0,0 +1,409 @@
+/** @file
+
+  Register model of a DWC3 controller in device mode, for the host-based
+  tests of UsbDwc3DeviceDxe. It provides the IoLib and DmaLib functions the
+  driver uses.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "../UsbDwc3Device.h"
+#include "Dwc3RegisterModel.h"
+
+#define DWC3_MODEL_ENDPOINTS            32
+
+typedef struct {
+  BOOLEAN                   Started;
+  EFI_PHYSICAL_ADDRESS      Trb;         ///< Bus address of the next TRB
+} DWC3_MODEL_ENDPOINT;
+
+STATIC UINTN                mBase;
+STATIC UINT32               mRegs[DWC3_MODEL_REGS_SIZE / sizeof (UINT32)];
+STATIC UINT32               mEventCount;
+STATIC UINT32               mEventWrite;
+STATIC UINT32               mFailStatus;
+STATIC BOOLEAN              mStuck;
+STATIC DWC3_MODEL_ENDPOINT  mEndpoints[DWC3_MODEL_ENDPOINTS];
+
+DWC3_MODEL_COMMAND          mDwc3ModelCommands[DWC3_MODEL_MAX_COMMANDS];
+UINTN                       mDwc3ModelCommandCount;
+UINTN                       mDwc3ModelMappings;
+
+/**
+  Host address of a bus address.
+
+  @param[in]  Bus               The bus address.
+
+  @return The host address.
+
+**/
+STATIC
+VOID *
+Dwc3ModelHost (
+  IN EFI_PHYSICAL_ADDRESS       Bus
+  )
+{
+  return (VOID *) (UINTN) (Bus - DWC3_MODEL_DMA_OFFSET);
+}
+
+VOID
+Dwc3ModelReset (
+  IN UINTN                      Base
+  )
+{
+  mBase                  = Base;
+  mEventCount            = 0;
+  mEventWrite            = 0;
+  mFailStatus            = 0;
+  mStuck                 = FALSE;
+  mDwc3ModelCommandCount = 0;
+  ZeroMem (mRegs, sizeof (mRegs));
+  ZeroMem (mEndpoints, sizeof (mEndpoints));
+  ZeroMem (mDwc3ModelCommands, sizeof (mDwc3ModelCommands));
+
+  mRegs[DWC3_GCTL / sizeof (UINT32)] = DWC3_GCTL_PRTCAPDIR (DWC3_GCTL_PRTCAP_HOST);
+  mRegs[DWC3_DSTS / sizeof (UINT32)] = DWC3_DSTS_DEVCTRLHLT;
+}
+
+UINT32
+Dwc3ModelRegister (
+  IN UINTN                      Offset
+  )
+{
+  ASSERT (Offset < DWC3_MODEL_REGS_SIZE);
+  return mRegs[Offset / sizeof (UINT32)];
+}
+
+VOID
+Dwc3ModelSetRegister (
+  IN UINTN                      Offset,
+  IN UINT32                     Value
+  )
+{
+  ASSERT (Offset < DWC3_MODEL_REGS_SIZE);
+  mRegs[Offset / sizeof (UINT32)] = Value;
+}
+
+VOID
+Dwc3ModelFailCommands (
+  IN UINT32                     Status,
+  IN BOOLEAN                    Stuck
+  )
+{
+  mFailStatus = Status;
+  mStuck      = Stuck;
+}
+
+UINTN
+Dwc3ModelFindCommand (
+  IN UINT8                      PhysEp,
+  IN UINT32                     Command,
+  IN UINTN                      From
+  )
+{
+  UINTN                         Index;
+
+  for (Index = From; Index < mDwc3ModelCommandCount; Index++) {
+    if ((mDwc3ModelCommands[Index].PhysEp == PhysEp) &&
+        ((mDwc3ModelCommands[Index].Command & 0xF) == Command)) {
+      return Index;
+    }
+  }
+
+  return DWC3_MODEL_MAX_COMMANDS;
+}
+
+DWC3_TRB *
+Dwc3ModelNextTrb (
+  IN UINT8                      PhysEp
+  )
+{
+  DWC3_MODEL_ENDPOINT           *Ep;
+  DWC3_TRB                      *Trb;
+
+  Ep = &mEndpoints[PhysEp];
+  if (Ep->Trb == 0) {
+    return NULL;
+  }
+
+  Trb = Dwc3ModelHost (Ep->Trb);
+  if (((Trb->Control >> 4) & 0x3F) == DWC3_TRBCTL_LINK_TRB) {
+    Ep->Trb = Trb->BufferLo | LShiftU64 (Trb->BufferHi, 32);
+    Trb     = Dwc3ModelHost (Ep->Trb);
+  }
+
+  return Trb;
+}
+
+DWC3_TRB *
+Dwc3ModelCompleteTrb (
+  IN UINT8                      PhysEp,
+  IN UINT32                     Residue
+  )
+{
+  DWC3_TRB                      *Trb;
+
+  Trb = Dwc3ModelNextTrb (PhysEp);
+  if ((Trb == NULL) || ((Trb->Control & DWC3_TRB_CTRL_HWO) == 0)) {
+    return NULL;
+  }
+
+  ASSERT (Residue <= (Trb->Size & DWC3_TRB_SIZE_MASK));
+  Trb->Size     = (Trb->Size & ~DWC3_TRB_SIZE_MASK) | Residue;
+  Trb->Control &= ~DWC3_TRB_CTRL_HWO;
+
+  mEndpoints[PhysEp].Trb += sizeof (DWC3_TRB);
+  return Trb;
+}
+
+VOID *
+Dwc3ModelTrbBuffer (
+  IN DWC3_TRB                   *Trb
+  )
+{
+  return Dwc3ModelHost (Trb->BufferLo | LShiftU64 (Trb->BufferHi, 32));
+}
+
+EFI_STATUS
+Dwc3ModelPostEvent (
+  IN UINT32                     Event
+  )
+{
+  UINT32                        *Buffer;
+  UINT32                        Size;
+
+  Buffer = Dwc3ModelHost (
+             Dwc3ModelRegister (DWC3_GEVNTADRLO (0)) |
+             LShiftU64 (Dwc3ModelRegister (DWC3_GEVNTADRHI (0)), 32)
+             );
+  Size   = Dwc3ModelRegister (DWC3_GEVNTSIZ (0)) & DWC3_GEVNTCOUNT_MASK;
+  if (Size == 0) {
+    return EFI_NOT_READY;
+  }
+
+  if (mEventCount + sizeof (UINT32) > Size) {
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  Buffer[mEventWrite / sizeof (UINT32)] = Event;
+  mEventWrite  = (mEventWrite + sizeof (UINT32)) % Size;
+  mEventCount += sizeof (UINT32);
+  return EFI_SUCCESS;
+}
+
+/**
+  Execute an endpoint command written to DEPCMD.
+
+  @param[in]  PhysEp            Physical endpoint number.
+  @param[in]  Value             The value written.
+
+  @return The value DEPCMD reads back.
+
+**/
+STATIC
+UINT32
+Dwc3ModelEndpointCommand (
+  IN UINT8                      PhysEp,
+  IN UINT32                     Value
+  )
+{
+  DWC3_MODEL_COMMAND            *Command;
+
+  ASSERT (mDwc3ModelCommandCount < DWC3_MODEL_MAX_COMMANDS);
+  Command         = &mDwc3ModelCommands[mDwc3ModelCommandCount++];
+  Command->PhysEp  = PhysEp;
+  Command->Command = Value;
+  Command->Param0  = mRegs[DWC3_DEPCMDPAR0 (PhysEp) / sizeof (UINT32)];
+  Command->Param1  = mRegs[DWC3_DEPCMDPAR1 (PhysEp) / sizeof (UINT32)];
+  Command->Param2  = mRegs[DWC3_DEPCMDPAR2 (PhysEp) / sizeof (UINT32)];
+
+  if (mStuck) {
+    return Value;
+  }
+
+  Value &= ~(UINT32) DWC3_DEPCMD_CMDACT;
+  if (mFailStatus != 0) {
+    Value      |= mFailStatus << 12;
+    mFailStatus = 0;
+    return Value;
+  }
+
+  switch (Value & 0xF) {
+  case DWC3_DEPCMD_STARTTRANSFER:
+    //
+    // The transfer resource index is reported in the parameter bits
+    //
+    mEndpoints[PhysEp].Started = TRUE;
+    mEndpoints[PhysEp].Trb     = Command->Param1 | LShiftU64 (Command->Param0, 32);
+    Value = (Value & ~(UINT32) DWC3_DEPCMD_PARAM (0x7F)) | DWC3_DEPCMD_PARAM (PhysEp);
+    break;
+
+  case DWC3_DEPCMD_ENDTRANSFER:
+    mEndpoints[PhysEp].Started = FALSE;
+    break;
+
+  default:
+    break;
+  }
+
+  return Value;
+}
+
+/**
+  Offset of an MMIO address in the register file.
+
+  @param[in]  Address           The MMIO address.
+
+  @return The offset.
+
+**/
+STATIC
+UINTN
+Dwc3ModelOffset (
+  IN UINTN                      Address
+  )
+{
+  ASSERT ((Address >= mBase) && (Address - mBase < DWC3_MODEL_REGS_SIZE));
+  ASSERT ((Address & 3) == 0);
+  return Address - mBase;
+}
+
+UINT32
+EFIAPI
+MmioRead32 (
+  IN UINTN                      Address
+  )
+{
+  UINTN                         Offset;
+
+  Offset = Dwc3ModelOffset (Address);
+  if (Offset == DWC3_GEVNTCOUNT (0)) {
+    return mEventCount;
+  }
+
+  return mRegs[Offset / sizeof (UINT32)];
+}
+
+UINT32
+EFIAPI
+MmioWrite32 (
+  IN UINTN                      Address,
+  IN UINT32                     Value
+  )
+{
+  UINTN                         Offset;
+  UINT32                        Stored;
+
+  Offset = Dwc3ModelOffset (Address);
+  Stored = Value;
+
+  if (Offset == DWC3_DCTL) {
+    //
+    // The soft reset and run/stop changes complete at once
+    //
+    Stored &= ~(UINT32) DWC3_DCTL_CSFTRST;
+    if ((Value & DWC3_DCTL_RUN_STOP) != 0) {
+      mRegs[DWC3_DSTS / sizeof (UINT32)] &= ~(UINT32) DWC3_DSTS_DEVCTRLHLT;
+    } else {
+      mRegs[DWC3_DSTS / sizeof (UINT32)] |= DWC3_DSTS_DEVCTRLHLT;
+    }
+  } else if (Offset == DWC3_GEVNTCOUNT (0)) {
+    //
+    // Software writes the number of bytes of events it consumed
+    //
+    ASSERT (Value <= mEventCount);
+    mEventCount -= MIN (Value, mEventCount);
+    return Value;
+  } else if ((Offset >= DWC3_DEPCMD (0)) && (Offset <= DWC3_DEPCMD (DWC3_MODEL_ENDPOINTS - 1)) &&
+             ((Offset - DWC3_DEPCMD (0)) % 0x10 == 0) && ((Value & DWC3_DEPCMD_CMDACT) != 0)) {
+    Stored = Dwc3ModelEndpointCommand ((UINT8) ((Offset - DWC3_DEPCMD (0)) / 0x10), Value);
+  } else if (Offset == DWC3_GEVNTADRLO (0)) {
+    mEventWrite = 0;
+  }
+
+  mRegs[Offset / sizeof (UINT32)] = Stored;
+  return Value;
+}
+
+UINT32
+EFIAPI
+MmioOr32 (
+  IN UINTN                      Address,
+  IN UINT32                     OrData
+  )
+{
+  return MmioWrite32 (Address, MmioRead32 (Address) | OrData);
+}
+
+UINT32
+EFIAPI
+MmioAnd32 (
+  IN UINTN                      Address,
+  IN UINT32                     AndData
+  )
+{
+  return MmioWrite32 (Address, MmioRead32 (Address) & AndData);
+}
+
+UINT32
+EFIAPI
+MmioAndThenOr32 (
+  IN UINTN                      Address,
+  IN UINT32                     AndData,
+  IN UINT32                     OrData
+  )
+{
+  return MmioWrite32 (Address, (MmioRead32 (Address) & AndData) | OrData);
+}
+
+EFI_STATUS
+EFIAPI
+DmaMap (
+  IN     DMA_MAP_OPERATION        Operation,
+  IN     VOID                     *HostAddress,
+  IN OUT UINTN                    *NumberOfBytes,
+  OUT    PHYSICAL_ADDRESS         *DeviceAddress,
+  OUT    VOID                     **Mapping
+  )
+{
+  *DeviceAddress = (UINTN) HostAddress + DWC3_MODEL_DMA_OFFSET;
+  *Mapping       = HostAddress;
+  mDwc3ModelMappings++;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+DmaUnmap (
+  IN  VOID                         *Mapping
+  )
+{
+  ASSERT (mDwc3ModelMappings > 0);
+  mDwc3ModelMappings--;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+DmaAllocateBuffer (
+  IN  EFI_MEMORY_TYPE              MemoryType,
+  IN  UINTN                        Pages,
+  OUT VOID                         **HostAddress
+  )
+{
+  *HostAddress = AllocateAlignedPages (Pages, EFI_PAGE_SIZE);
+  return (*HostAddress == NULL) ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+DmaFreeBuffer (
+  IN  UINTN                        Pages,
+  IN  VOID                         *HostAddress
+  )
+{
+  FreeAlignedPages (HostAddress, Pages);
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,171 @@
+/** @file
+
+  Register model of a DWC3 controller in device mode, for the host-based
+  tests of UsbDwc3DeviceDxe.
+
+  The model implements the MMIO and DMA accesses of the driver. It completes
+  soft resets and run/stop changes at once, executes endpoint commands and
+  logs them, walks the TRBs the driver queues and writes events to the event
+  buffer the driver programmed. DMA buffers are mapped DWC3_MODEL_DMA_OFFSET
+  above their host address.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _DWC3_REGISTER_MODEL_H_
+#define _DWC3_REGISTER_MODEL_H_
+
+#define DWC3_MODEL_REGS_SIZE            0x10000
+#define DWC3_MODEL_DMA_OFFSET           BASE_1TB
+#define DWC3_MODEL_MAX_COMMANDS         256
+
+//
+// Event encodings, see UsbDwc3Device.h for their decoding
+//
+#define DWC3_MODEL_DEVICE_EVENT(Type)             (BIT0 | ((Type) << 8))
+#define DWC3_MODEL_EP_EVENT(PhysEp, Type, Status) (((PhysEp) << 1) | ((Type) << 6) | ((Status) << 12))
+
+typedef struct {
+  UINT8                     PhysEp;
+  UINT32                    Command;     ///< DEPCMD as written, with CMDACT
+  UINT32                    Param0;
+  UINT32                    Param1;
+  UINT32                    Param2;
+} DWC3_MODEL_COMMAND;
+
+extern DWC3_MODEL_COMMAND   mDwc3ModelCommands[DWC3_MODEL_MAX_COMMANDS];
+extern UINTN                mDwc3ModelCommandCount;
+
+//
+// Mappings made by DmaMap () and not unmapped yet
+//
+extern UINTN                mDwc3ModelMappings;
+
+/**
+  Put the model in its power-on state, with its registers at Base.
+
+  @param[in]  Base              MMIO base of the controller.
+
+**/
+VOID
+Dwc3ModelReset (
+  IN UINTN                      Base
+  );
+
+/**
+  Read a register without side effects.
+
+  @param[in]  Offset            Offset of the register.
+
+  @return The register value.
+
+**/
+UINT32
+Dwc3ModelRegister (
+  IN UINTN                      Offset
+  );
+
+/**
+  Set a register without side effects, like the status the controller
+  reports.
+
+  @param[in]  Offset            Offset of the register.
+  @param[in]  Value             The value.
+
+**/
+VOID
+Dwc3ModelSetRegister (
+  IN UINTN                      Offset,
+  IN UINT32                     Value
+  );
+
+/**
+  Make the next endpoint command fail with a status, or never complete.
+
+  @param[in]  Status            DEPCMD status of the next command, 0 for success.
+  @param[in]  Stuck             TRUE to leave CMDACT set on every command.
+
+**/
+VOID
+Dwc3ModelFailCommands (
+  IN UINT32                     Status,
+  IN BOOLEAN                    Stuck
+  );
+
+/**
+  Find a logged endpoint command.
+
+  @param[in]  PhysEp            Physical endpoint number.
+  @param[in]  Command           DWC3_DEPCMD_* command type.
+  @param[in]  From              First log index to look at.
+
+  @return The log index of the command, or DWC3_MODEL_MAX_COMMANDS.
+
+**/
+UINTN
+Dwc3ModelFindCommand (
+  IN UINT8                      PhysEp,
+  IN UINT32                     Command,
+  IN UINTN                      From
+  );
+
+/**
+  Complete the next TRB of an endpoint that the driver handed to the
+  controller, as the controller does when a transfer ends.
+
+  @param[in]  PhysEp            Physical endpoint number.
+  @param[in]  Residue           Bytes of the TRB not transferred.
+
+  @return The completed TRB, or NULL if the endpoint has no TRB with HWO set.
+
+**/
+DWC3_TRB *
+Dwc3ModelCompleteTrb (
+  IN UINT8                      PhysEp,
+  IN UINT32                     Residue
+  );
+
+/**
+  Get the next TRB of an endpoint that the controller would process.
+
+  @param[in]  PhysEp            Physical endpoint number.
+
+  @return The TRB, or NULL if the endpoint was never started.
+
+**/
+DWC3_TRB *
+Dwc3ModelNextTrb (
+  IN UINT8                      PhysEp
+  );
+
+/**
+  Host address of the buffer of a TRB.
+
+  @param[in]  Trb               The TRB.
+
+  @return The buffer.
+
+**/
+VOID *
+Dwc3ModelTrbBuffer (
+  IN DWC3_TRB                   *Trb
+  );
+
+/**
+  Write an event to the event buffer and account for it in GEVNTCOUNT.
+
+  @param[in]  Event             The event.
+
+  @retval EFI_SUCCESS           The event was written.
+  @retval EFI_BUFFER_TOO_SMALL  The event buffer is full.
+  @retval EFI_NOT_READY         No event buffer is programmed.
+
+**/
+EFI_STATUS
+Dwc3ModelPostEvent (
+  IN UINT32                     Event
+  );
+
+#endif
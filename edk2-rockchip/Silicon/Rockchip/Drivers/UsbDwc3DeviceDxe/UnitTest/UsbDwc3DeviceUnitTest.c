@@ -0,0 +1,1105 @@
+/** @file
+
+  Host-based unit tests of UsbDwc3DeviceDxe against a register model of the
+  controller: controller start and stop, endpoint commands and their
+  failures, enumeration at HighSpeed and SuperSpeed, the event buffer and
+  the bulk TRB rings.
+
+  The driver runs from its entry point with mock boot services. Its poll
+  timer is fired by hand after the model posts events.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Library/UnitTestLib.h>
+
+#include "../UsbDwc3Device.h"
+#include "Dwc3RegisterModel.h"
+
+#define UNIT_TEST_APP_NAME     "UsbDwc3DeviceDxe Unit Tests"
+#define UNIT_TEST_APP_VERSION  "1.0"
+
+#define FASTBOOT_BULK_OUT      DWC3_PHYS_EP (0x01)
+#define FASTBOOT_BULK_IN       DWC3_PHYS_EP (0x81)
+
+#define TEST_DEVICE_ADDRESS    5
+
+//
+// An event type the driver does not handle
+//
+#define TEST_DEVT_IGNORED      6
+
+EFI_BOOT_SERVICES      *gBS;
+
+EFI_STATUS
+EFIAPI
+UsbDwc3DeviceEntryPoint (
+  IN EFI_HANDLE                 ImageHandle,
+  IN EFI_SYSTEM_TABLE           *SystemTable
+  );
+
+STATIC EFI_BOOT_SERVICES  mBootServices;
+STATIC UINTN              mStallMicroseconds;
+STATIC EFI_EVENT_NOTIFY   mTimerNotify;
+STATIC VOID               *mTimerContext;
+STATIC EFI_TIMER_DELAY    mTimerType;
+STATIC UINT64             mTimerPeriod;
+STATIC UINTN              mReceiveSignals;
+STATIC UINTN              mInstalledProtocols;
+STATIC UINTN              mIdleMappings;
+
+//
+// Storage of the event handles given to the driver
+//
+STATIC UINT8              mPollTimer;
+STATIC UINT8              mExitBootServicesEvent;
+STATIC UINT8              mReceiveEvent;
+
+STATIC
+EFI_STATUS
+EFIAPI
+MockStall (
+  IN UINTN                      Microseconds
+  )
+{
+  mStallMicroseconds += Microseconds;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+MockSetTimer (
+  IN EFI_EVENT                  Event,
+  IN EFI_TIMER_DELAY            Type,
+  IN UINT64                     TriggerTime
+  )
+{
+  if (Event != &mPollTimer) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  mTimerType   = Type;
+  mTimerPeriod = TriggerTime;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_TPL
+EFIAPI
+MockRaiseTpl (
+  IN EFI_TPL                    NewTpl
+  )
+{
+  return TPL_APPLICATION;
+}
+
+STATIC
+VOID
+EFIAPI
+MockRestoreTpl (
+  IN EFI_TPL                    OldTpl
+  )
+{
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+MockCreateEvent (
+  IN  UINT32                    Type,
+  IN  EFI_TPL                   NotifyTpl,
+  IN  EFI_EVENT_NOTIFY          NotifyFunction,
+  IN  VOID                      *NotifyContext,
+  OUT EFI_EVENT                 *Event
+  )
+{
+  if ((Type & EVT_TIMER) == 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  mTimerNotify  = NotifyFunction;
+  mTimerContext = NotifyContext;
+  *Event        = &mPollTimer;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+MockCreateEventEx (
+  IN       UINT32               Type,
+  IN       EFI_TPL              NotifyTpl,
+  IN       EFI_EVENT_NOTIFY     NotifyFunction OPTIONAL,
+  IN CONST VOID                 *NotifyContext OPTIONAL,
+  IN CONST EFI_GUID             *EventGroup OPTIONAL,
+  OUT      EFI_EVENT            *Event
+  )
+{
+  *Event = &mExitBootServicesEvent;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+MockCloseEvent (
+  IN EFI_EVENT                  Event
+  )
+{
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+MockSignalEvent (
+  IN EFI_EVENT                  Event
+  )
+{
+  if (Event == &mReceiveEvent) {
+    mReceiveSignals++;
+  }
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+MockInstallMultipleProtocolInterfaces (
+  IN OUT EFI_HANDLE             *Handle,
+  ...
+  )
+{
+  VA_LIST                       Args;
+  EFI_GUID                      *Protocol;
+
+  VA_START (Args, Handle);
+  for (Protocol = VA_ARG (Args, EFI_GUID *); Protocol != NULL; Protocol = VA_ARG (Args, EFI_GUID *)) {
+    VA_ARG (Args, VOID *);
+    mInstalledProtocols++;
+  }
+  VA_END (Args);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Fire the poll timer of the driver, which drains the event buffer.
+
+**/
+STATIC
+VOID
+Tick (
+  VOID
+  )
+{
+  mTimerNotify (&mPollTimer, mTimerContext);
+}
+
+/**
+  Post an event and let the driver handle it.
+
+  @param[in]  Event             The event.
+
+  @retval TRUE                  The event was posted and handled.
+  @retval FALSE                 The event buffer was full.
+
+**/
+STATIC
+BOOLEAN
+PostEvent (
+  IN UINT32                     Event
+  )
+{
+  if (EFI_ERROR (Dwc3ModelPostEvent (Event))) {
+    return FALSE;
+  }
+
+  Tick ();
+  return TRUE;
+}
+
+/**
+  Check that a TRB was handed to the controller with a type and a size.
+
+  @param[in]  Trb               The TRB.
+  @param[in]  Type              The expected DWC3_TRBCTL_* type.
+  @param[in]  Size              The expected size.
+
+**/
+STATIC
+BOOLEAN
+TrbIsQueued (
+  IN DWC3_TRB                   *Trb,
+  IN UINT32                     Type,
+  IN UINT32                     Size
+  )
+{
+  return (BOOLEAN) ((Trb != NULL) &&
+                    ((Trb->Control & DWC3_TRB_CTRL_HWO) != 0) &&
+                    ((Trb->Control & DWC3_TRB_CTRL_TRBCTL (0x3F)) == DWC3_TRB_CTRL_TRBCTL (Type)) &&
+                    ((Trb->Size & DWC3_TRB_SIZE_MASK) == Size));
+}
+
+/**
+  Run a control transfer from the host through the SETUP, data and status
+  stages, as the controller reports them.
+
+  @param[in]      RequestType   bmRequestType.
+  @param[in]      Request       bRequest.
+  @param[in]      Value         wValue.
+  @param[in]      Index         wIndex.
+  @param[in]      Length        wLength.
+  @param[out]     Data          Receives the IN data, may be NULL.
+  @param[out]     DataLength    Receives the length of the IN data, may be NULL.
+
+  @retval EFI_SUCCESS           The transfer completed.
+  @retval EFI_UNSUPPORTED       The device stalled the request.
+  @retval EFI_DEVICE_ERROR      The driver did not queue the expected TRB.
+
+**/
+STATIC
+EFI_STATUS
+ControlTransfer (
+  IN  UINT8                     RequestType,
+  IN  UINT8                     Request,
+  IN  UINT16                    Value,
+  IN  UINT16                    Index,
+  IN  UINT16                    Length,
+  OUT VOID                      *Data OPTIONAL,
+  OUT UINTN                     *DataLength OPTIONAL
+  )
+{
+  USB_DEVICE_REQUEST            Setup;
+  DWC3_TRB                      *Trb;
+  UINTN                         From;
+  UINT8                         DataEp;
+  UINT8                         StatusEp;
+  UINT32                        Size;
+
+  Trb = Dwc3ModelNextTrb (DWC3_EP0_OUT);
+  if (!TrbIsQueued (Trb, DWC3_TRBCTL_CONTROL_SETUP, sizeof (Setup))) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  Setup.RequestType = RequestType;
+  Setup.Request     = Request;
+  Setup.Value       = Value;
+  Setup.Index       = Index;
+  Setup.Length      = Length;
+  CopyMem (Dwc3ModelTrbBuffer (Trb), &Setup, sizeof (Setup));
+  Dwc3ModelCompleteTrb (DWC3_EP0_OUT, 0);
+
+  From = mDwc3ModelCommandCount;
+  if (!PostEvent (DWC3_MODEL_EP_EVENT (DWC3_EP0_OUT, DWC3_DEPEVT_XFERCOMPLETE, 0))) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (Dwc3ModelFindCommand (DWC3_EP0_OUT, DWC3_DEPCMD_SETSTALL, From) != DWC3_MODEL_MAX_COMMANDS) {
+    return EFI_UNSUPPORTED;
+  }
+
+  StatusEp = DWC3_EP0_IN;
+  if (Length != 0) {
+    DataEp   = ((RequestType & USB_ENDPOINT_DIR_IN) != 0) ? DWC3_EP0_IN : DWC3_EP0_OUT;
+    StatusEp = DataEp ^ 1;
+    Trb      = Dwc3ModelNextTrb (DataEp);
+    if ((Trb == NULL) || (Dwc3ModelFindCommand (DataEp, DWC3_DEPCMD_STARTTRANSFER, From) == DWC3_MODEL_MAX_COMMANDS)) {
+      return EFI_DEVICE_ERROR;
+    }
+
+    Size = Trb->Size & DWC3_TRB_SIZE_MASK;
+    if (!TrbIsQueued (Trb, DWC3_TRBCTL_CONTROL_DATA, Size)) {
+      return EFI_DEVICE_ERROR;
+    }
+
+    if (Data != NULL) {
+      CopyMem (Data, Dwc3ModelTrbBuffer (Trb), Size);
+    }
+    if (DataLength != NULL) {
+      *DataLength = Size;
+    }
+
+    Dwc3ModelCompleteTrb (DataEp, 0);
+    PostEvent (DWC3_MODEL_EP_EVENT (DataEp, DWC3_DEPEVT_XFERCOMPLETE, 0));
+  }
+
+  From = mDwc3ModelCommandCount;
+  PostEvent (DWC3_MODEL_EP_EVENT (StatusEp, DWC3_DEPEVT_XFERNOTREADY, DWC3_DEPEVT_STATUS_CONTROL_STATUS));
+  Trb = Dwc3ModelNextTrb (StatusEp);
+  if ((Dwc3ModelFindCommand (StatusEp, DWC3_DEPCMD_STARTTRANSFER, From) == DWC3_MODEL_MAX_COMMANDS) ||
+      !TrbIsQueued (Trb, (Length != 0) ? DWC3_TRBCTL_CONTROL_STATUS3 : DWC3_TRBCTL_CONTROL_STATUS2, 0)) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  Dwc3ModelCompleteTrb (StatusEp, 0);
+  PostEvent (DWC3_MODEL_EP_EVENT (StatusEp, DWC3_DEPEVT_XFERCOMPLETE, 0));
+
+  //
+  // The control endpoint waits for the next SETUP packet again
+  //
+  if (!TrbIsQueued (Dwc3ModelNextTrb (DWC3_EP0_OUT), DWC3_TRBCTL_CONTROL_SETUP, sizeof (Setup))) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Connect at a speed, reset the bus, address and configure the device.
+
+  @param[in]  Speed             DWC3_DSTS_HIGHSPEED or DWC3_DSTS_SUPERSPEED.
+
+  @return The status of the first control transfer that failed.
+
+**/
+STATIC
+EFI_STATUS
+Enumerate (
+  IN UINT8                      Speed
+  )
+{
+  EFI_STATUS                    Status;
+
+  Dwc3ModelSetRegister (DWC3_DSTS, Speed);
+  PostEvent (DWC3_MODEL_DEVICE_EVENT (DWC3_DEVT_USBRST));
+  PostEvent (DWC3_MODEL_DEVICE_EVENT (DWC3_DEVT_CONNECTDONE));
+
+  Status = ControlTransfer (USB_REQ_TYPE_STANDARD, USB_REQ_SET_ADDRESS, TEST_DEVICE_ADDRESS, 0, 0, NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return ControlTransfer (USB_REQ_TYPE_STANDARD, USB_REQ_SET_CONFIG, 1, 0, 0, NULL, NULL);
+}
+
+/**
+  Put the model in its power-on state.
+
+  @param[in]  Context           Unused.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+ResetModel (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  Dwc3ModelReset (mDwc3Device->Base);
+  mStallMicroseconds = 0;
+  mReceiveSignals    = 0;
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Start the fastboot transport on a model in its power-on state.
+
+  @param[in]  Context           Unused.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+StartDevice (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  ResetModel (Context);
+  if (EFI_ERROR (mDwc3FastbootTransport.Start (&mReceiveEvent))) {
+    return UNIT_TEST_ERROR_PREREQUISITE_NOT_MET;
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Stop the fastboot transport.
+
+  @param[in]  Context           Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+StopDevice (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  mDwc3FastbootTransport.Stop ();
+}
+
+/**
+  Start switches the core to device mode, programs the event buffer,
+  configures the control endpoints and waits for a SETUP packet.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+StartProgramsController (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  DWC3_DEVICE                   *Dev;
+  DWC3_MODEL_COMMAND            *Command;
+
+  Dev = mDwc3Device;
+  UT_ASSERT_TRUE (Dev->Running);
+
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_GCTL) & DWC3_GCTL_PRTCAPDIR_MASK, DWC3_GCTL_PRTCAPDIR (DWC3_GCTL_PRTCAP_DEVICE));
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_GEVNTADRLO (0)), (UINT32) Dev->DmaPhys);
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_GEVNTADRHI (0)), (UINT32) RShiftU64 (Dev->DmaPhys, 32));
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_GEVNTSIZ (0)), DWC3_EVENT_BUFFER_SIZE);
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_DCFG) & DWC3_DCFG_SPEED_MASK, DWC3_DCFG_SUPERSPEED);
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_DEVTEN), DWC3_DEVTEN_DISCONNEVTEN | DWC3_DEVTEN_USBRSTEN | DWC3_DEVTEN_CONNECTDONEEN);
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_DALEPENA), (1 << DWC3_EP0_OUT) | (1 << DWC3_EP0_IN));
+  UT_ASSERT_NOT_EQUAL (Dwc3ModelRegister (DWC3_DCTL) & DWC3_DCTL_RUN_STOP, 0);
+
+  //
+  // DEPSTARTCFG, then DEPCFG and SETTRANSFRESOURCE on both control
+  // endpoints, then the SETUP transfer
+  //
+  UT_ASSERT_EQUAL (mDwc3ModelCommandCount, 6);
+  Command = mDwc3ModelCommands;
+  UT_ASSERT_EQUAL (Command[0].PhysEp, DWC3_EP0_OUT);
+  UT_ASSERT_EQUAL (Command[0].Command, DWC3_DEPCMD_DEPSTARTCFG | DWC3_DEPCMD_PARAM (0) | DWC3_DEPCMD_CMDACT);
+  UT_ASSERT_EQUAL (Dwc3ModelFindCommand (DWC3_EP0_OUT, DWC3_DEPCMD_DEPCFG, 0), 1);
+  UT_ASSERT_EQUAL (Dwc3ModelFindCommand (DWC3_EP0_OUT, DWC3_DEPCMD_SETTRANSFRESOURCE, 0), 2);
+  UT_ASSERT_EQUAL (Dwc3ModelFindCommand (DWC3_EP0_IN, DWC3_DEPCMD_DEPCFG, 0), 3);
+  UT_ASSERT_EQUAL (Dwc3ModelFindCommand (DWC3_EP0_IN, DWC3_DEPCMD_SETTRANSFRESOURCE, 0), 4);
+  UT_ASSERT_EQUAL (Command[1].Param0, DWC3_DEPCFG_EP_TYPE (USB_ENDPOINT_CONTROL) | DWC3_DEPCFG_MAX_PACKET_SIZE (512));
+  UT_ASSERT_EQUAL (Command[3].Param0, DWC3_DEPCFG_EP_TYPE (USB_ENDPOINT_CONTROL) | DWC3_DEPCFG_MAX_PACKET_SIZE (512) | DWC3_DEPCFG_FIFO_NUMBER (0));
+  UT_ASSERT_EQUAL (Command[3].Param1, DWC3_DEPCFG_XFER_COMPLETE_EN | DWC3_DEPCFG_XFER_NOT_READY_EN | DWC3_DEPCFG_EP_NUMBER (DWC3_EP0_IN));
+  UT_ASSERT_EQUAL (Command[4].Param0, 1);
+
+  UT_ASSERT_EQUAL (Command[5].PhysEp, DWC3_EP0_OUT);
+  UT_ASSERT_EQUAL (Command[5].Command & 0xF, DWC3_DEPCMD_STARTTRANSFER);
+  UT_ASSERT_EQUAL (Command[5].Param0, (UINT32) RShiftU64 (Dev->Ep0TrbPhys, 32));
+  UT_ASSERT_EQUAL (Command[5].Param1, (UINT32) Dev->Ep0TrbPhys);
+  UT_ASSERT_TRUE (TrbIsQueued (Dwc3ModelNextTrb (DWC3_EP0_OUT), DWC3_TRBCTL_CONTROL_SETUP, sizeof (USB_DEVICE_REQUEST)));
+  UT_ASSERT_NOT_EQUAL (Dev->Ep0Trb->Control & DWC3_TRB_CTRL_LST, 0);
+
+  UT_ASSERT_EQUAL (mTimerType, TimerPeriodic);
+  UT_ASSERT_EQUAL (mTimerPeriod, DWC3_POLL_INTERVAL);
+
+  UT_ASSERT_STATUS_EQUAL (mDwc3FastbootTransport.Start (&mReceiveEvent), EFI_ALREADY_STARTED);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Stop halts the controller, gives it back to host mode and cancels the
+  poll timer.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+StopReturnsToHost (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  mDwc3FastbootTransport.Stop ();
+
+  UT_ASSERT_FALSE (mDwc3Device->Running);
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_DCTL) & DWC3_DCTL_RUN_STOP, 0);
+  UT_ASSERT_NOT_EQUAL (Dwc3ModelRegister (DWC3_DSTS) & DWC3_DSTS_DEVCTRLHLT, 0);
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_GCTL) & (DWC3_GCTL_PRTCAPDIR_MASK | DWC3_GCTL_CORESOFTRESET), DWC3_GCTL_PRTCAPDIR (DWC3_GCTL_PRTCAP_HOST));
+  UT_ASSERT_TRUE (mStallMicroseconds >= DWC3_ROLE_SWITCH_DELAY);
+  UT_ASSERT_EQUAL (mTimerType, TimerCancel);
+  UT_ASSERT_EQUAL (mDwc3ModelMappings, mIdleMappings);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  An endpoint command that reports a failure fails the start.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+CommandFailureFailsStart (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  Dwc3ModelFailCommands (1, FALSE);
+
+  UT_ASSERT_STATUS_EQUAL (mDwc3FastbootTransport.Start (&mReceiveEvent), EFI_DEVICE_ERROR);
+  UT_ASSERT_FALSE (mDwc3Device->Running);
+  UT_ASSERT_EQUAL (mDwc3ModelCommandCount, 1);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  An endpoint command that never completes times out after
+  DWC3_CMD_TIMEOUT microseconds.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+CommandTimeout (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  Dwc3ModelFailCommands (0, TRUE);
+
+  UT_ASSERT_STATUS_EQUAL (
+    Dwc3SendEpCmd (mDwc3Device, FASTBOOT_BULK_IN, DWC3_DEPCMD_SETSTALL, 0, 0, 0),
+    EFI_TIMEOUT
+    );
+  UT_ASSERT_EQUAL (mStallMicroseconds, DWC3_CMD_TIMEOUT);
+  UT_ASSERT_EQUAL (mDwc3ModelCommandCount, 1);
+  UT_ASSERT_EQUAL (mDwc3ModelCommands[0].Command, DWC3_DEPCMD_SETSTALL | DWC3_DEPCMD_CMDACT);
+
+  UT_ASSERT_STATUS_EQUAL (mDwc3FastbootTransport.Start (&mReceiveEvent), EFI_DEVICE_ERROR);
+  UT_ASSERT_FALSE (mDwc3Device->Running);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  SET_CONFIGURATION at HighSpeed configures both bulk endpoints, enables
+  them and queues receives on a ring that links back to its start.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+ConfigureEnablesBulk (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  DWC3_DEVICE                   *Dev;
+  DWC3_ENDPOINT                 *Ep;
+  DWC3_TRB                      *Link;
+  UINTN                         Index;
+  UINTN                         Start;
+
+  Dev = mDwc3Device;
+  UT_ASSERT_NOT_EFI_ERROR (Enumerate (DWC3_DSTS_HIGHSPEED));
+
+  UT_ASSERT_EQUAL (Dev->Configuration, 1);
+  UT_ASSERT_EQUAL ((Dwc3ModelRegister (DWC3_DCFG) & DWC3_DCFG_DEVADDR_MASK), DWC3_DCFG_DEVADDR (TEST_DEVICE_ADDRESS));
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_DALEPENA), 0xF);
+
+  //
+  // Non-control transfer resources are allocated from index 2
+  //
+  Index = Dwc3ModelFindCommand (DWC3_EP0_OUT, DWC3_DEPCMD_DEPSTARTCFG, 1);
+  UT_ASSERT_NOT_EQUAL (Index, DWC3_MODEL_MAX_COMMANDS);
+  UT_ASSERT_EQUAL (mDwc3ModelCommands[Index].Command, DWC3_DEPCMD_DEPSTARTCFG | DWC3_DEPCMD_PARAM (2) | DWC3_DEPCMD_CMDACT);
+
+  Index = Dwc3ModelFindCommand (FASTBOOT_BULK_OUT, DWC3_DEPCMD_DEPCFG, 0);
+  UT_ASSERT_NOT_EQUAL (Index, DWC3_MODEL_MAX_COMMANDS);
+  UT_ASSERT_EQUAL (mDwc3ModelCommands[Index].Param0, DWC3_DEPCFG_EP_TYPE (USB_ENDPOINT_BULK) | DWC3_DEPCFG_MAX_PACKET_SIZE (512));
+  UT_ASSERT_EQUAL (mDwc3ModelCommands[Index].Param1, DWC3_DEPCFG_XFER_COMPLETE_EN | DWC3_DEPCFG_XFER_IN_PROGRESS_EN | DWC3_DEPCFG_EP_NUMBER (FASTBOOT_BULK_OUT));
+  UT_ASSERT_EQUAL (mDwc3ModelCommands[Index + 1].Command & 0xF, DWC3_DEPCMD_SETTRANSFRESOURCE);
+
+  Index = Dwc3ModelFindCommand (FASTBOOT_BULK_IN, DWC3_DEPCMD_DEPCFG, 0);
+  UT_ASSERT_NOT_EQUAL (Index, DWC3_MODEL_MAX_COMMANDS);
+  UT_ASSERT_EQUAL (mDwc3ModelCommands[Index].Param0, DWC3_DEPCFG_EP_TYPE (USB_ENDPOINT_BULK) | DWC3_DEPCFG_MAX_PACKET_SIZE (512) | DWC3_DEPCFG_FIFO_NUMBER (1));
+
+  //
+  // Two receives: the first starts the transfer at the ring, the second
+  // updates it with the resource index the controller returned
+  //
+  Ep    = &Dev->Bulk[DWC3_BULK_OUT];
+  Start = Dwc3ModelFindCommand (FASTBOOT_BULK_OUT, DWC3_DEPCMD_STARTTRANSFER, 0);
+  UT_ASSERT_NOT_EQUAL (Start, DWC3_MODEL_MAX_COMMANDS);
+  UT_ASSERT_EQUAL (mDwc3ModelCommands[Start].Param0, (UINT32) RShiftU64 (Ep->TrbsPhys, 32));
+  UT_ASSERT_EQUAL (mDwc3ModelCommands[Start].Param1, (UINT32) Ep->TrbsPhys);
+  UT_ASSERT_EQUAL (Ep->ResourceIndex, FASTBOOT_BULK_OUT);
+
+  Index = Dwc3ModelFindCommand (FASTBOOT_BULK_OUT, DWC3_DEPCMD_UPDATETRANSFER, Start);
+  UT_ASSERT_NOT_EQUAL (Index, DWC3_MODEL_MAX_COMMANDS);
+  UT_ASSERT_EQUAL (mDwc3ModelCommands[Index].Command, DWC3_DEPCMD_UPDATETRANSFER | DWC3_DEPCMD_PARAM (FASTBOOT_BULK_OUT) | DWC3_DEPCMD_CMDACT);
+  UT_ASSERT_EQUAL (Dwc3ModelFindCommand (FASTBOOT_BULK_OUT, DWC3_DEPCMD_UPDATETRANSFER, Index + 1), DWC3_MODEL_MAX_COMMANDS);
+
+  for (Index = 0; Index < DWC3_RX_QUEUE_DEPTH; Index++) {
+    UT_ASSERT_TRUE (TrbIsQueued (&Ep->Trbs[Index], DWC3_TRBCTL_NORMAL, 512));
+    UT_ASSERT_EQUAL (
+      Ep->Trbs[Index].Control & (DWC3_TRB_CTRL_IOC | DWC3_TRB_CTRL_ISP_IMI | DWC3_TRB_CTRL_CSP),
+      DWC3_TRB_CTRL_IOC | DWC3_TRB_CTRL_ISP_IMI | DWC3_TRB_CTRL_CSP
+      );
+  }
+  UT_ASSERT_EQUAL (Ep->Trbs[DWC3_RX_QUEUE_DEPTH].Control, 0);
+
+  Link = &Ep->Trbs[DWC3_RING_TRBS - 1];
+  UT_ASSERT_TRUE (TrbIsQueued (Link, DWC3_TRBCTL_LINK_TRB, 0));
+  UT_ASSERT_EQUAL (Link->BufferLo | LShiftU64 (Link->BufferHi, 32), Ep->TrbsPhys);
+
+  UT_ASSERT_EQUAL (mDwc3ModelMappings, mIdleMappings + DWC3_RX_QUEUE_DEPTH);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  At SuperSpeed the control endpoints are reconfigured for 512 byte
+  packets, the bulk endpoints burst and the configuration descriptor gets
+  endpoint companion descriptors.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+SuperSpeedEnumeration (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  USB_DEVICE_DESCRIPTOR         Device;
+  UINT8                         Config[DWC3_EP0_BUFFER_SIZE];
+  UINTN                         Length;
+  UINTN                         Index;
+  UINTN                         Offset;
+  UINTN                         Companions;
+
+  UT_ASSERT_NOT_EFI_ERROR (Enumerate (DWC3_DSTS_SUPERSPEED));
+
+  Index = Dwc3ModelFindCommand (DWC3_EP0_IN, DWC3_DEPCMD_DEPCFG, 5);
+  UT_ASSERT_NOT_EQUAL (Index, DWC3_MODEL_MAX_COMMANDS);
+  UT_ASSERT_EQUAL (
+    mDwc3ModelCommands[Index].Param0,
+    DWC3_DEPCFG_EP_TYPE (USB_ENDPOINT_CONTROL) | DWC3_DEPCFG_MAX_PACKET_SIZE (512) | DWC3_DEPCFG_ACTION_MODIFY
+    );
+
+  Index = Dwc3ModelFindCommand (FASTBOOT_BULK_IN, DWC3_DEPCMD_DEPCFG, 0);
+  UT_ASSERT_NOT_EQUAL (Index, DWC3_MODEL_MAX_COMMANDS);
+  UT_ASSERT_EQUAL (
+    mDwc3ModelCommands[Index].Param0,
+    DWC3_DEPCFG_EP_TYPE (USB_ENDPOINT_BULK) | DWC3_DEPCFG_MAX_PACKET_SIZE (1024) |
+    DWC3_DEPCFG_BURST_SIZE (DWC3_BULK_MAX_BURST) | DWC3_DEPCFG_FIFO_NUMBER (1)
+    );
+  UT_ASSERT_TRUE (TrbIsQueued (&mDwc3Device->Bulk[DWC3_BULK_OUT].Trbs[0], DWC3_TRBCTL_NORMAL, 1024));
+
+  UT_ASSERT_NOT_EFI_ERROR (
+    ControlTransfer (USB_ENDPOINT_DIR_IN, USB_REQ_GET_DESCRIPTOR, USB_DESC_TYPE_DEVICE << 8, 0, sizeof (Device), &Device, &Length)
+    );
+  UT_ASSERT_EQUAL (Length, sizeof (Device));
+  UT_ASSERT_EQUAL (Device.BcdUSB, 0x0300);
+  UT_ASSERT_EQUAL (Device.MaxPacketSize0, 9);
+  UT_ASSERT_EQUAL (Device.IdVendor, FixedPcdGet32 (PcdAndroidFastbootUsbVendorId));
+
+  UT_ASSERT_NOT_EFI_ERROR (
+    ControlTransfer (USB_ENDPOINT_DIR_IN, USB_REQ_GET_DESCRIPTOR, USB_DESC_TYPE_CONFIG << 8, 0, sizeof (Config), Config, &Length)
+    );
+  UT_ASSERT_EQUAL (Length, ((USB_CONFIG_DESCRIPTOR *) Config)->TotalLength);
+
+  Companions = 0;
+  for (Offset = 0; Offset < Length; Offset += Config[Offset]) {
+    UT_ASSERT_NOT_EQUAL (Config[Offset], 0);
+    if (Config[Offset + 1] == USB_DESC_TYPE_ENDPOINT) {
+      UT_ASSERT_EQUAL (((USB_ENDPOINT_DESCRIPTOR *) &Config[Offset])->MaxPacketSize, 1024);
+      UT_ASSERT_EQUAL (Config[Offset + Config[Offset] + 1], DWC3_DESC_TYPE_SS_EP_COMPANION);
+      UT_ASSERT_EQUAL (Config[Offset + Config[Offset] + 2], DWC3_BULK_MAX_BURST);
+      Companions++;
+    }
+  }
+  UT_ASSERT_EQUAL (Companions, 2);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  SET_FEATURE and CLEAR_FEATURE of ENDPOINT_HALT stall and clear the bulk
+  endpoint, and GET_STATUS reports it.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+EndpointHalt (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  UINT8                         Status[2];
+  UINTN                         From;
+
+  UT_ASSERT_NOT_EFI_ERROR (Enumerate (DWC3_DSTS_HIGHSPEED));
+
+  From = mDwc3ModelCommandCount;
+  UT_ASSERT_NOT_EFI_ERROR (
+    ControlTransfer (USB_TARGET_ENDPOINT, USB_REQ_SET_FEATURE, USB_FEATURE_ENDPOINT_HALT, 0x81, 0, NULL, NULL)
+    );
+  UT_ASSERT_NOT_EQUAL (Dwc3ModelFindCommand (FASTBOOT_BULK_IN, DWC3_DEPCMD_SETSTALL, From), DWC3_MODEL_MAX_COMMANDS);
+
+  UT_ASSERT_NOT_EFI_ERROR (
+    ControlTransfer (USB_ENDPOINT_DIR_IN | USB_TARGET_ENDPOINT, USB_REQ_GET_STATUS, 0, 0x81, 2, Status, NULL)
+    );
+  UT_ASSERT_EQUAL (Status[0], BIT0);
+
+  From = mDwc3ModelCommandCount;
+  UT_ASSERT_NOT_EFI_ERROR (
+    ControlTransfer (USB_TARGET_ENDPOINT, USB_REQ_CLEAR_FEATURE, USB_FEATURE_ENDPOINT_HALT, 0x81, 0, NULL, NULL)
+    );
+  UT_ASSERT_NOT_EQUAL (Dwc3ModelFindCommand (FASTBOOT_BULK_IN, DWC3_DEPCMD_CLEARSTALL, From), DWC3_MODEL_MAX_COMMANDS);
+
+  UT_ASSERT_NOT_EFI_ERROR (
+    ControlTransfer (USB_ENDPOINT_DIR_IN | USB_TARGET_ENDPOINT, USB_REQ_GET_STATUS, 0, 0x81, 2, Status, NULL)
+    );
+  UT_ASSERT_EQUAL (Status[0], 0);
+
+  UT_ASSERT_STATUS_EQUAL (
+    ControlTransfer (USB_TARGET_ENDPOINT, USB_REQ_SET_FEATURE, USB_FEATURE_ENDPOINT_HALT, 0x82, 0, NULL, NULL),
+    EFI_UNSUPPORTED
+    );
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Requests other than standard ones stall the control endpoint, which then
+  waits for the next SETUP packet.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+VendorRequestStalls (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  UINTN                         Stall;
+
+  UT_ASSERT_STATUS_EQUAL (
+    ControlTransfer (USB_REQ_TYPE_VENDOR | USB_ENDPOINT_DIR_IN, 0x01, 0, 0, 4, NULL, NULL),
+    EFI_UNSUPPORTED
+    );
+
+  Stall = Dwc3ModelFindCommand (DWC3_EP0_OUT, DWC3_DEPCMD_SETSTALL, 0);
+  UT_ASSERT_NOT_EQUAL (Dwc3ModelFindCommand (DWC3_EP0_OUT, DWC3_DEPCMD_STARTTRANSFER, Stall), DWC3_MODEL_MAX_COMMANDS);
+  UT_ASSERT_TRUE (TrbIsQueued (Dwc3ModelNextTrb (DWC3_EP0_OUT), DWC3_TRBCTL_CONTROL_SETUP, sizeof (USB_DEVICE_REQUEST)));
+
+  UT_ASSERT_NOT_EFI_ERROR (
+    ControlTransfer (USB_ENDPOINT_DIR_IN, USB_REQ_GET_CONFIG, 0, 0, 1, NULL, NULL)
+    );
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Every event handled is acknowledged through GEVNTCOUNT.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+EventsAreAcknowledged (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  UINTN                         Index;
+
+  for (Index = 0; Index < 10; Index++) {
+    UT_ASSERT_NOT_EFI_ERROR (Dwc3ModelPostEvent (DWC3_MODEL_DEVICE_EVENT (TEST_DEVT_IGNORED)));
+  }
+  UT_ASSERT_EQUAL (MmioRead32 (mDwc3Device->Base + DWC3_GEVNTCOUNT (0)), 10 * sizeof (UINT32));
+
+  Tick ();
+  UT_ASSERT_EQUAL (MmioRead32 (mDwc3Device->Base + DWC3_GEVNTCOUNT (0)), 0);
+  UT_ASSERT_EQUAL (mDwc3Device->EventPos, 10 * sizeof (UINT32));
+
+  //
+  // Nothing pending: the poll does not touch the buffer
+  //
+  Tick ();
+  UT_ASSERT_EQUAL (mDwc3Device->EventPos, 10 * sizeof (UINT32));
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Events that wrap around the end of the event buffer are read in order.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+EventBufferWraps (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  UINTN                         Index;
+  UINTN                         Events;
+
+  Events = DWC3_EVENT_BUFFER_SIZE / sizeof (UINT32);
+
+  //
+  // The buffer holds exactly Events entries
+  //
+  for (Index = 0; Index < Events; Index++) {
+    UT_ASSERT_NOT_EFI_ERROR (Dwc3ModelPostEvent (DWC3_MODEL_DEVICE_EVENT (TEST_DEVT_IGNORED)));
+  }
+  UT_ASSERT_STATUS_EQUAL (Dwc3ModelPostEvent (DWC3_MODEL_DEVICE_EVENT (TEST_DEVT_IGNORED)), EFI_BUFFER_TOO_SMALL);
+  Tick ();
+  UT_ASSERT_EQUAL (mDwc3Device->EventPos, 0);
+
+  for (Index = 0; Index < Events - 24; Index++) {
+    UT_ASSERT_NOT_EFI_ERROR (Dwc3ModelPostEvent (DWC3_MODEL_DEVICE_EVENT (TEST_DEVT_IGNORED)));
+  }
+  Tick ();
+
+  //
+  // The connection event is written past the end, at the start of the buffer
+  //
+  Dwc3ModelSetRegister (DWC3_DSTS, DWC3_DSTS_SUPERSPEED);
+  for (Index = 0; Index < 30; Index++) {
+    UT_ASSERT_NOT_EFI_ERROR (Dwc3ModelPostEvent (DWC3_MODEL_DEVICE_EVENT (TEST_DEVT_IGNORED)));
+  }
+  UT_ASSERT_NOT_EFI_ERROR (Dwc3ModelPostEvent (DWC3_MODEL_DEVICE_EVENT (DWC3_DEVT_CONNECTDONE)));
+  UT_ASSERT_EQUAL (mDwc3Device->Events[6], DWC3_MODEL_DEVICE_EVENT (DWC3_DEVT_CONNECTDONE));
+  Tick ();
+
+  UT_ASSERT_EQUAL (mDwc3Device->EventPos, 7 * sizeof (UINT32));
+  UT_ASSERT_EQUAL (mDwc3Device->Speed, DWC3_DSTS_SUPERSPEED);
+  UT_ASSERT_EQUAL (MmioRead32 (mDwc3Device->Base + DWC3_GEVNTCOUNT (0)), 0);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  A bulk OUT transfer is delivered through Receive () and the ring is
+  refilled before the consumer gets the data.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+BulkReceive (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  STATIC CONST CHAR8            Command[] = "getvar:version";
+  DWC3_ENDPOINT                 *Ep;
+  DWC3_TRB                      *Trb;
+  UINTN                         From;
+  UINTN                         Size;
+  VOID                          *Buffer;
+
+  UT_ASSERT_NOT_EFI_ERROR (Enumerate (DWC3_DSTS_HIGHSPEED));
+  Ep = &mDwc3Device->Bulk[DWC3_BULK_OUT];
+
+  UT_ASSERT_STATUS_EQUAL (mDwc3FastbootTransport.Receive (&Size, &Buffer), EFI_NOT_READY);
+
+  Trb = Dwc3ModelNextTrb (FASTBOOT_BULK_OUT);
+  UT_ASSERT_TRUE (TrbIsQueued (Trb, DWC3_TRBCTL_NORMAL, 512));
+  CopyMem (Dwc3ModelTrbBuffer (Trb), Command, sizeof (Command) - 1);
+  Dwc3ModelCompleteTrb (FASTBOOT_BULK_OUT, 512 - (sizeof (Command) - 1));
+
+  From = mDwc3ModelCommandCount;
+  UT_ASSERT_TRUE (PostEvent (DWC3_MODEL_EP_EVENT (FASTBOOT_BULK_OUT, DWC3_DEPEVT_XFERINPROGRESS, 0)));
+
+  UT_ASSERT_EQUAL (mReceiveSignals, 1);
+  UT_ASSERT_EQUAL (Ep->Dequeue, 1);
+  UT_ASSERT_TRUE (TrbIsQueued (&Ep->Trbs[DWC3_RX_QUEUE_DEPTH], DWC3_TRBCTL_NORMAL, 512));
+  UT_ASSERT_NOT_EQUAL (Dwc3ModelFindCommand (FASTBOOT_BULK_OUT, DWC3_DEPCMD_UPDATETRANSFER, From), DWC3_MODEL_MAX_COMMANDS);
+  UT_ASSERT_EQUAL (mDwc3ModelMappings, mIdleMappings + DWC3_RX_QUEUE_DEPTH);
+
+  UT_ASSERT_NOT_EFI_ERROR (mDwc3FastbootTransport.Receive (&Size, &Buffer));
+  UT_ASSERT_EQUAL (Size, sizeof (Command) - 1);
+  UT_ASSERT_MEM_EQUAL (Buffer, Command, Size);
+  FreePool (Buffer);
+
+  UT_ASSERT_STATUS_EQUAL (mDwc3FastbootTransport.Receive (&Size, &Buffer), EFI_NOT_READY);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  A "DATA" response sizes the receives to the download, up to
+  DWC3_RX_MAX_SIZE each, and bulk IN transfers complete.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+DownloadSizesReceives (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  STATIC CONST CHAR8            Response[] = "DATA00300000";
+  DWC3_DEVICE                   *Dev;
+  DWC3_TRB                      *Trb;
+  UINTN                         Size;
+  VOID                          *Buffer;
+
+  Dev = mDwc3Device;
+
+  UT_ASSERT_STATUS_EQUAL (mDwc3FastbootTransport.Send (sizeof (Response) - 1, Response, NULL), EFI_NOT_READY);
+  UT_ASSERT_NOT_EFI_ERROR (Enumerate (DWC3_DSTS_HIGHSPEED));
+
+  UT_ASSERT_NOT_EFI_ERROR (mDwc3FastbootTransport.Send (sizeof (Response) - 1, Response, NULL));
+  UT_ASSERT_EQUAL (Dev->RxExpected, 0x300000);
+  UT_ASSERT_EQUAL (Dev->RxPosted, DWC3_RX_QUEUE_DEPTH * 512);
+
+  UT_ASSERT_NOT_EQUAL (Dwc3ModelFindCommand (FASTBOOT_BULK_IN, DWC3_DEPCMD_STARTTRANSFER, 0), DWC3_MODEL_MAX_COMMANDS);
+  Trb = Dwc3ModelNextTrb (FASTBOOT_BULK_IN);
+  UT_ASSERT_TRUE (TrbIsQueued (Trb, DWC3_TRBCTL_NORMAL, sizeof (Response) - 1));
+  UT_ASSERT_MEM_EQUAL (Dwc3ModelTrbBuffer (Trb), Response, sizeof (Response) - 1);
+
+  Dwc3ModelCompleteTrb (FASTBOOT_BULK_IN, 0);
+  UT_ASSERT_TRUE (PostEvent (DWC3_MODEL_EP_EVENT (FASTBOOT_BULK_IN, DWC3_DEPEVT_XFERCOMPLETE, 0)));
+  UT_ASSERT_FALSE (Dev->Bulk[DWC3_BULK_IN].Started);
+  UT_ASSERT_EQUAL (mDwc3ModelMappings, mIdleMappings + DWC3_RX_QUEUE_DEPTH);
+
+  //
+  // The first packet of the download completes a queued receive, the
+  // refill covers the next megabyte
+  //
+  Dwc3ModelCompleteTrb (FASTBOOT_BULK_OUT, 0);
+  UT_ASSERT_TRUE (PostEvent (DWC3_MODEL_EP_EVENT (FASTBOOT_BULK_OUT, DWC3_DEPEVT_XFERINPROGRESS, 0)));
+  UT_ASSERT_TRUE (TrbIsQueued (&Dev->Bulk[DWC3_BULK_OUT].Trbs[DWC3_RX_QUEUE_DEPTH], DWC3_TRBCTL_NORMAL, DWC3_RX_MAX_SIZE));
+  UT_ASSERT_EQUAL (Dev->RxExpected, 0x300000 - 512);
+  UT_ASSERT_EQUAL (Dev->RxPosted, 512 + DWC3_RX_MAX_SIZE);
+
+  UT_ASSERT_NOT_EFI_ERROR (mDwc3FastbootTransport.Receive (&Size, &Buffer));
+  UT_ASSERT_EQUAL (Size, 512);
+  FreePool (Buffer);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  A bus reset ends the bulk transfers, disables the bulk endpoints, frees
+  their buffers and clears the device address.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+BusResetEndsTransfers (
+  IN UNIT_TEST_CONTEXT          Context
+  )
+{
+  UINTN                         From;
+  UINTN                         Index;
+
+  UT_ASSERT_NOT_EFI_ERROR (Enumerate (DWC3_DSTS_HIGHSPEED));
+  UT_ASSERT_EQUAL (mDwc3ModelMappings, mIdleMappings + DWC3_RX_QUEUE_DEPTH);
+
+  From = mDwc3ModelCommandCount;
+  UT_ASSERT_TRUE (PostEvent (DWC3_MODEL_DEVICE_EVENT (DWC3_DEVT_USBRST)));
+
+  Index = Dwc3ModelFindCommand (FASTBOOT_BULK_OUT, DWC3_DEPCMD_ENDTRANSFER, From);
+  UT_ASSERT_NOT_EQUAL (Index, DWC3_MODEL_MAX_COMMANDS);
+  UT_ASSERT_EQUAL (
+    mDwc3ModelCommands[Index].Command,
+    DWC3_DEPCMD_ENDTRANSFER | DWC3_DEPCMD_HIPRI_FORCERM | DWC3_DEPCMD_PARAM (FASTBOOT_BULK_OUT) | DWC3_DEPCMD_CMDACT
+    );
+
+  //
+  // Nothing was started on the bulk IN endpoint
+  //
+  UT_ASSERT_EQUAL (Dwc3ModelFindCommand (FASTBOOT_BULK_IN, DWC3_DEPCMD_ENDTRANSFER, From), DWC3_MODEL_MAX_COMMANDS);
+
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_DALEPENA), (1 << DWC3_EP0_OUT) | (1 << DWC3_EP0_IN));
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_DCFG) & DWC3_DCFG_DEVADDR_MASK, 0);
+  UT_ASSERT_EQUAL (mDwc3ModelMappings, mIdleMappings);
+  UT_ASSERT_EQUAL (mDwc3Device->Configuration, 0);
+  UT_ASSERT_FALSE (mDwc3Device->Bulk[DWC3_BULK_OUT].Enabled);
+
+  //
+  // The host can enumerate the device again
+  //
+  UT_ASSERT_NOT_EFI_ERROR (Enumerate (DWC3_DSTS_HIGHSPEED));
+  UT_ASSERT_EQUAL (Dwc3ModelRegister (DWC3_DALEPENA), 0xF);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Initialize the unit test framework, suites and test cases of
+  UsbDwc3DeviceDxe, then run them.
+
+  @retval EFI_SUCCESS           All the tests were executed.
+  @retval EFI_OUT_OF_RESOURCES  There are not enough resources for the tests.
+  @return Others                The driver could not be loaded.
+
+**/
+EFI_STATUS
+EFIAPI
+UnitTestingEntry (
+  VOID
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework;
+  UNIT_TEST_SUITE_HANDLE      ControllerSuite;
+  UNIT_TEST_SUITE_HANDLE      Ep0Suite;
+  UNIT_TEST_SUITE_HANDLE      EventSuite;
+  UNIT_TEST_SUITE_HANDLE      BulkSuite;
+
+  Framework = NULL;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_APP_NAME, UNIT_TEST_APP_VERSION));
+
+  mBootServices.Stall                             = MockStall;
+  mBootServices.SetTimer                          = MockSetTimer;
+  mBootServices.RaiseTPL                          = MockRaiseTpl;
+  mBootServices.RestoreTPL                        = MockRestoreTpl;
+  mBootServices.CreateEvent                       = MockCreateEvent;
+  mBootServices.CreateEventEx                     = MockCreateEventEx;
+  mBootServices.CloseEvent                        = MockCloseEvent;
+  mBootServices.SignalEvent                       = MockSignalEvent;
+  mBootServices.InstallMultipleProtocolInterfaces = MockInstallMultipleProtocolInterfaces;
+  gBS = &mBootServices;
+
+  Status = UsbDwc3DeviceEntryPoint (NULL, NULL);
+  if (EFI_ERROR (Status) || (mDwc3Device == NULL) || (mTimerNotify == NULL) || (mInstalledProtocols != 2)) {
+    DEBUG ((DEBUG_ERROR, "UsbDwc3DeviceEntryPoint failed. Status = %r\n", Status));
+    return EFI_ERROR (Status) ? Status : EFI_DEVICE_ERROR;
+  }
+
+  //
+  // The entry point maps the event buffer and the control and ring page
+  //
+  mIdleMappings = mDwc3ModelMappings;
+
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_APP_NAME, gEfiCallerBaseName, UNIT_TEST_APP_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&ControllerSuite, Framework, "Controller Tests", "UsbDwc3DeviceDxe.Controller", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    goto EXIT;
+  }
+
+  AddTestCase (ControllerSuite, "Start programs the controller", "Start", StartProgramsController, StartDevice, StopDevice, NULL);
+  AddTestCase (ControllerSuite, "Stop returns the core to host mode", "Stop", StopReturnsToHost, StartDevice, StopDevice, NULL);
+  AddTestCase (ControllerSuite, "A failed endpoint command fails the start", "CommandFailure", CommandFailureFailsStart, ResetModel, StopDevice, NULL);
+  AddTestCase (ControllerSuite, "Endpoint commands time out", "CommandTimeout", CommandTimeout, ResetModel, StopDevice, NULL);
+
+  Status = CreateUnitTestSuite (&Ep0Suite, Framework, "Control Endpoint Tests", "UsbDwc3DeviceDxe.Ep0", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    goto EXIT;
+  }
+
+  AddTestCase (Ep0Suite, "SET_CONFIGURATION enables the bulk endpoints", "Configure", ConfigureEnablesBulk, StartDevice, StopDevice, NULL);
+  AddTestCase (Ep0Suite, "SuperSpeed enumeration", "SuperSpeed", SuperSpeedEnumeration, StartDevice, StopDevice, NULL);
+  AddTestCase (Ep0Suite, "Endpoint halt feature", "Halt", EndpointHalt, StartDevice, StopDevice, NULL);
+  AddTestCase (Ep0Suite, "Vendor requests stall", "Stall", VendorRequestStalls, StartDevice, StopDevice, NULL);
+
+  Status = CreateUnitTestSuite (&EventSuite, Framework, "Event Buffer Tests", "UsbDwc3DeviceDxe.Event", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    goto EXIT;
+  }
+
+  AddTestCase (EventSuite, "Events are acknowledged", "Acknowledge", EventsAreAcknowledged, StartDevice, StopDevice, NULL);
+  AddTestCase (EventSuite, "The event buffer wraps", "Wrap", EventBufferWraps, StartDevice, StopDevice, NULL);
+
+  Status = CreateUnitTestSuite (&BulkSuite, Framework, "Bulk Endpoint Tests", "UsbDwc3DeviceDxe.Bulk", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    goto EXIT;
+  }
+
+  AddTestCase (BulkSuite, "Bulk OUT data is received", "Receive", BulkReceive, StartDevice, StopDevice, NULL);
+  AddTestCase (BulkSuite, "Downloads size the receives", "Download", DownloadSizesReceives, StartDevice, StopDevice, NULL);
+  AddTestCase (BulkSuite, "A bus reset ends the transfers", "Reset", BusResetEndsTransfers, StartDevice, StopDevice, NULL);
+
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
+
+/**
+  Standard POSIX C entry point for host based unit test execution.
+**/
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  return UnitTestingEntry ();
+}
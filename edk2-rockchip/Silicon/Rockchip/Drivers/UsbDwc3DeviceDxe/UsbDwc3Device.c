@@ -0,0 +1,1279 @@
+/** @file
+
+  DWC3 USB peripheral controller driver: controller bring-up, event
+  handling, bulk TRB rings and USB_DEVICE_PROTOCOL.
+
+  The controller is shared with XhciDxe, which drives it in host mode. It is
+  switched to device mode when a consumer starts this driver, and back to
+  host mode when the consumer stops it or boot services are exited.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "UsbDwc3Device.h"
+
+DWC3_DEVICE  *mDwc3Device;
+
+/**
+  Issue an endpoint command and wait for the controller to accept it.
+
+  @param[in]  Dev               The controller.
+  @param[in]  PhysEp            Physical endpoint number.
+  @param[in]  Command           DWC3_DEPCMD_* command with its parameter bits.
+  @param[in]  Param0            DEPCMDPAR0 value.
+  @param[in]  Param1            DEPCMDPAR1 value.
+  @param[in]  Param2            DEPCMDPAR2 value.
+
+  @retval EFI_SUCCESS           The command completed.
+  @retval EFI_DEVICE_ERROR      The command failed.
+  @retval EFI_TIMEOUT           The command did not complete in time.
+
+**/
+EFI_STATUS
+Dwc3SendEpCmd (
+  IN DWC3_DEVICE                *Dev,
+  IN UINT8                      PhysEp,
+  IN UINT32                     Command,
+  IN UINT32                     Param0,
+  IN UINT32                     Param1,
+  IN UINT32                     Param2
+  )
+{
+  UINT32                        Reg;
+  UINTN                         Timeout;
+
+  MmioWrite32 (Dev->Base + DWC3_DEPCMDPAR0 (PhysEp), Param0);
+  MmioWrite32 (Dev->Base + DWC3_DEPCMDPAR1 (PhysEp), Param1);
+  MmioWrite32 (Dev->Base + DWC3_DEPCMDPAR2 (PhysEp), Param2);
+  MmioWrite32 (Dev->Base + DWC3_DEPCMD (PhysEp), Command | DWC3_DEPCMD_CMDACT);
+
+  for (Timeout = 0; Timeout < DWC3_CMD_TIMEOUT; Timeout++) {
+    Reg = MmioRead32 (Dev->Base + DWC3_DEPCMD (PhysEp));
+    if ((Reg & DWC3_DEPCMD_CMDACT) == 0) {
+      if (DWC3_DEPCMD_STATUS (Reg) != 0) {
+        DEBUG ((EFI_D_ERROR, "Dwc3SendEpCmd: ep %d command 0x%x failed, status %d\n",
+          PhysEp, Command & 0xF, DWC3_DEPCMD_STATUS (Reg)));
+        return EFI_DEVICE_ERROR;
+      }
+      return EFI_SUCCESS;
+    }
+    gBS->Stall (1);
+  }
+
+  DEBUG ((EFI_D_ERROR, "Dwc3SendEpCmd: ep %d command 0x%x timed out\n", PhysEp, Command & 0xF));
+  return EFI_TIMEOUT;
+}
+
+/**
+  Configure a physical endpoint.
+
+  @param[in]  Dev               The controller.
+  @param[in]  PhysEp            Physical endpoint number.
+  @param[in]  Type              USB_ENDPOINT_CONTROL or USB_ENDPOINT_BULK.
+  @param[in]  MaxPacket         Maximum packet size.
+  @param[in]  Burst             Maximum burst, 0 below SuperSpeed.
+  @param[in]  Action            DWC3_DEPCFG_ACTION_INIT or DWC3_DEPCFG_ACTION_MODIFY.
+
+  @retval EFI_SUCCESS           The endpoint is configured.
+  @return Others                An endpoint command failed.
+
+**/
+STATIC
+EFI_STATUS
+Dwc3ConfigureEndpoint (
+  IN DWC3_DEVICE                *Dev,
+  IN UINT8                      PhysEp,
+  IN UINT8                      Type,
+  IN UINT16                     MaxPacket,
+  IN UINT8                      Burst,
+  IN UINT32                     Action
+  )
+{
+  EFI_STATUS                    Status;
+  UINT32                        Param0;
+  UINT32                        Param1;
+
+  Param0 = DWC3_DEPCFG_EP_TYPE (Type) | DWC3_DEPCFG_MAX_PACKET_SIZE (MaxPacket) |
+           DWC3_DEPCFG_BURST_SIZE (Burst) | Action;
+  if ((PhysEp & 1) != 0) {
+    Param0 |= DWC3_DEPCFG_FIFO_NUMBER (PhysEp >> 1);
+  }
+
+  Param1 = DWC3_DEPCFG_XFER_COMPLETE_EN | DWC3_DEPCFG_EP_NUMBER (PhysEp);
+  if (Type == USB_ENDPOINT_CONTROL) {
+    Param1 |= DWC3_DEPCFG_XFER_NOT_READY_EN;
+  } else {
+    Param1 |= DWC3_DEPCFG_XFER_IN_PROGRESS_EN;
+  }
+
+  Status = Dwc3SendEpCmd (Dev, PhysEp, DWC3_DEPCMD_DEPCFG, Param0, Param1, 0);
+  if (EFI_ERROR (Status) || (Action != DWC3_DEPCFG_ACTION_INIT)) {
+    return Status;
+  }
+
+  return Dwc3SendEpCmd (Dev, PhysEp, DWC3_DEPCMD_SETTRANSFRESOURCE, 1, 0, 0);
+}
+
+/**
+  Bulk packet size of the connected speed.
+
+  @param[in]  Dev               The controller.
+
+  @return The maximum packet size.
+
+**/
+STATIC
+UINT16
+Dwc3BulkMaxPacket (
+  IN DWC3_DEVICE                *Dev
+  )
+{
+  switch (Dev->Speed) {
+  case DWC3_DSTS_SUPERSPEED:
+    return 1024;
+  case DWC3_DSTS_HIGHSPEED:
+    return 512;
+  default:
+    return 64;
+  }
+}
+
+/**
+  Build the configuration descriptor for the connected speed: bulk packet
+  sizes are adjusted and, at SuperSpeed, endpoint companion descriptors are
+  inserted after every endpoint descriptor.
+
+  @param[in]  Dev               The controller.
+
+**/
+STATIC
+VOID
+Dwc3BuildSpeedConfig (
+  IN DWC3_DEVICE                *Dev
+  )
+{
+  UINT8                         *Src;
+  UINT8                         *Dst;
+  UINTN                         Offset;
+  UINTN                         Total;
+  UINTN                         Endpoints;
+  USB_ENDPOINT_DESCRIPTOR       *Endpoint;
+  BOOLEAN                       SuperSpeed;
+
+  if (Dev->SpeedConfig != NULL) {
+    FreePool (Dev->SpeedConfig);
+    Dev->SpeedConfig = NULL;
+  }
+
+  Src        = (UINT8 *) Dev->ConfigDescriptor;
+  Total      = Dev->ConfigDescriptor->TotalLength;
+  SuperSpeed = (BOOLEAN) (Dev->Speed == DWC3_DSTS_SUPERSPEED);
+
+  Endpoints = 0;
+  for (Offset = 0; (Offset + 2 <= Total) && (Src[Offset] != 0); Offset += Src[Offset]) {
+    if (Src[Offset + 1] == USB_DESC_TYPE_ENDPOINT) {
+      Endpoints++;
+    }
+  }
+
+  Dst = AllocatePool (Total + (SuperSpeed ? Endpoints * 6 : 0));
+  if (Dst == NULL) {
+    return;
+  }
+
+  Dev->SpeedConfig       = Dst;
+  Dev->SpeedConfigLength = 0;
+  for (Offset = 0; (Offset + 2 <= Total) && (Src[Offset] != 0); Offset += Src[Offset]) {
+    CopyMem (Dst, Src + Offset, Src[Offset]);
+
+    if (Src[Offset + 1] == USB_DESC_TYPE_ENDPOINT) {
+      Endpoint = (USB_ENDPOINT_DESCRIPTOR *) Dst;
+      if ((Endpoint->Attributes & USB_ENDPOINT_TYPE_MASK) == USB_ENDPOINT_BULK) {
+        Endpoint->MaxPacketSize = Dwc3BulkMaxPacket (Dev);
+      }
+
+      if (SuperSpeed) {
+        Dst += Src[Offset];
+        Dev->SpeedConfigLength += Src[Offset];
+        Dst[0] = 6;
+        Dst[1] = DWC3_DESC_TYPE_SS_EP_COMPANION;
+        Dst[2] = ((Endpoint->Attributes & USB_ENDPOINT_TYPE_MASK) == USB_ENDPOINT_BULK) ? DWC3_BULK_MAX_BURST : 0;
+        Dst[3] = 0;
+        Dst[4] = 0;
+        Dst[5] = 0;
+        Dst += 6;
+        Dev->SpeedConfigLength += 6;
+        continue;
+      }
+    }
+
+    Dst += Src[Offset];
+    Dev->SpeedConfigLength += Src[Offset];
+  }
+
+  ((USB_CONFIG_DESCRIPTOR *) Dev->SpeedConfig)->TotalLength = (UINT16) Dev->SpeedConfigLength;
+}
+
+/**
+  Reset a bulk TRB ring to empty, with the last TRB linking to the first.
+
+  @param[in]  Ep                The endpoint.
+
+**/
+STATIC
+VOID
+Dwc3InitRing (
+  IN DWC3_ENDPOINT              *Ep
+  )
+{
+  DWC3_TRB                      *Link;
+
+  ZeroMem (Ep->Trbs, DWC3_RING_TRBS * sizeof (DWC3_TRB));
+  ZeroMem (Ep->Requests, sizeof (Ep->Requests));
+
+  Link           = &Ep->Trbs[DWC3_RING_TRBS - 1];
+  Link->BufferLo = (UINT32) Ep->TrbsPhys;
+  Link->BufferHi = (UINT32) RShiftU64 (Ep->TrbsPhys, 32);
+  Link->Control  = DWC3_TRB_CTRL_TRBCTL (DWC3_TRBCTL_LINK_TRB) | DWC3_TRB_CTRL_HWO;
+
+  Ep->Enqueue = 0;
+  Ep->Dequeue = 0;
+}
+
+/**
+  Number of TRBs queued on a bulk ring and not completed yet.
+
+  @param[in]  Ep                The endpoint.
+
+  @return The number of busy TRBs.
+
+**/
+STATIC
+UINTN
+Dwc3RingBusy (
+  IN DWC3_ENDPOINT              *Ep
+  )
+{
+  return (Ep->Enqueue + (DWC3_RING_TRBS - 1) - Ep->Dequeue) % (DWC3_RING_TRBS - 1);
+}
+
+/**
+  Queue a buffer on a bulk endpoint, starting the transfer on the first one.
+
+  @param[in]  Dev               The controller.
+  @param[in]  Ep                The endpoint.
+  @param[in]  Buffer            The pool buffer, owned by the ring until completed.
+  @param[in]  Length            Length of the transfer.
+  @param[in]  Posted            Bytes of the expected download this receive covers.
+
+  @retval EFI_SUCCESS           The buffer is queued.
+  @retval EFI_OUT_OF_RESOURCES  The ring is full.
+  @return Others                The buffer could not be mapped or the command failed.
+
+**/
+STATIC
+EFI_STATUS
+Dwc3QueueTrb (
+  IN DWC3_DEVICE                *Dev,
+  IN DWC3_ENDPOINT              *Ep,
+  IN VOID                       *Buffer,
+  IN UINTN                      Length,
+  IN UINTN                      Posted
+  )
+{
+  EFI_STATUS                    Status;
+  DWC3_TRB                      *Trb;
+  DWC3_REQUEST                  *Request;
+  EFI_PHYSICAL_ADDRESS          Phys;
+  EFI_PHYSICAL_ADDRESS          TrbPhys;
+  UINTN                         MapLength;
+  VOID                          *Mapping;
+  UINT32                        Control;
+  BOOLEAN                       In;
+
+  if (Dwc3RingBusy (Ep) >= DWC3_RING_TRBS - 2) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  In = (BOOLEAN) ((Ep->Number & 1) != 0);
+
+  //
+  // A zero-length packet still needs a mapped buffer for the TRB
+  //
+  MapLength = MAX (Length, 1);
+  Status = DmaMap (
+             In ? MapOperationBusMasterRead : MapOperationBusMasterWrite,
+             Buffer,
+             &MapLength,
+             &Phys,
+             &Mapping
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+  if (MapLength != MAX (Length, 1)) {
+    DmaUnmap (Mapping);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Request          = &Ep->Requests[Ep->Enqueue];
+  Request->Buffer  = Buffer;
+  Request->Mapping = Mapping;
+  Request->Length  = Length;
+  Request->Posted  = Posted;
+
+  Control = DWC3_TRB_CTRL_TRBCTL (DWC3_TRBCTL_NORMAL) | DWC3_TRB_CTRL_IOC;
+  if (!In) {
+    //
+    // A short packet ends the receive, the next one goes to the next TRB
+    //
+    Control |= DWC3_TRB_CTRL_ISP_IMI | DWC3_TRB_CTRL_CSP;
+  }
+
+  Trb           = &Ep->Trbs[Ep->Enqueue];
+  TrbPhys       = Ep->TrbsPhys + Ep->Enqueue * sizeof (DWC3_TRB);
+  Trb->BufferLo = (UINT32) Phys;
+  Trb->BufferHi = (UINT32) RShiftU64 (Phys, 32);
+  Trb->Size     = (UINT32) Length & DWC3_TRB_SIZE_MASK;
+  MemoryFence ();
+  Trb->Control  = Control | DWC3_TRB_CTRL_HWO;
+  MemoryFence ();
+
+  Ep->Enqueue = (Ep->Enqueue + 1) % (DWC3_RING_TRBS - 1);
+
+  if (Ep->Started) {
+    return Dwc3SendEpCmd (
+             Dev,
+             Ep->Number,
+             DWC3_DEPCMD_UPDATETRANSFER | DWC3_DEPCMD_PARAM (Ep->ResourceIndex),
+             0,
+             0,
+             0
+             );
+  }
+
+  Status = Dwc3SendEpCmd (
+             Dev,
+             Ep->Number,
+             DWC3_DEPCMD_STARTTRANSFER,
+             (UINT32) RShiftU64 (TrbPhys, 32),
+             (UINT32) TrbPhys,
+             0
+             );
+  if (!EFI_ERROR (Status)) {
+    Ep->Started       = TRUE;
+    Ep->ResourceIndex = DWC3_DEPCMD_GET_RSC_IDX (MmioRead32 (Dev->Base + DWC3_DEPCMD (Ep->Number)));
+  }
+
+  return Status;
+}
+
+/**
+  Keep DWC3_RX_QUEUE_DEPTH receives queued on the bulk OUT endpoint. While a
+  download is expected each receive covers up to DWC3_RX_MAX_SIZE bytes of it,
+  otherwise a receive is a single packet.
+
+  @param[in]  Dev               The controller.
+
+**/
+STATIC
+VOID
+Dwc3QueueRx (
+  IN DWC3_DEVICE                *Dev
+  )
+{
+  DWC3_ENDPOINT                 *Ep;
+  VOID                          *Buffer;
+  UINTN                         Length;
+  UINTN                         Posted;
+
+  Ep = &Dev->Bulk[DWC3_BULK_OUT];
+
+  while (Ep->Enabled && (Dwc3RingBusy (Ep) < DWC3_RX_QUEUE_DEPTH)) {
+    if (Dev->RxExpected > Dev->RxPosted) {
+      Posted = MIN (Dev->RxExpected - Dev->RxPosted, DWC3_RX_MAX_SIZE);
+      Length = ALIGN_VALUE (Posted, Ep->MaxPacket);
+    } else {
+      Posted = 0;
+      Length = Ep->MaxPacket;
+    }
+
+    Buffer = AllocatePool (Length);
+    if (Buffer == NULL) {
+      DEBUG ((EFI_D_ERROR, "Dwc3QueueRx: out of memory\n"));
+      return;
+    }
+
+    if (EFI_ERROR (Dwc3QueueTrb (Dev, Ep, Buffer, Length, Posted))) {
+      FreePool (Buffer);
+      return;
+    }
+
+    Dev->RxPosted += Posted;
+  }
+}
+
+/**
+  Announce that the host is about to send Size bytes of bulk data, so that
+  receives are sized to the data instead of to a single packet.
+
+  @param[in]  Size              Number of bytes expected.
+
+**/
+VOID
+Dwc3DeviceExpectRx (
+  IN UINTN                      Size
+  )
+{
+  DWC3_DEVICE                   *Dev;
+  DWC3_ENDPOINT                 *Ep;
+  UINTN                         Index;
+  EFI_TPL                       OldTpl;
+
+  Dev    = mDwc3Device;
+  Ep     = &Dev->Bulk[DWC3_BULK_OUT];
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+
+  //
+  // The receives queued already take the first bytes of the download
+  //
+  Dev->RxExpected = Size;
+  Dev->RxPosted   = 0;
+  for (Index = Ep->Dequeue; Index != Ep->Enqueue; Index = (Index + 1) % (DWC3_RING_TRBS - 1)) {
+    Ep->Requests[Index].Posted = Ep->Requests[Index].Length;
+    Dev->RxPosted             += Ep->Requests[Index].Length;
+  }
+
+  gBS->RestoreTPL (OldTpl);
+}
+
+/**
+  Retire the completed TRBs of a bulk endpoint.
+
+  @param[in]  Dev               The controller.
+  @param[in]  Ep                The endpoint.
+
+**/
+STATIC
+VOID
+Dwc3BulkComplete (
+  IN DWC3_DEVICE                *Dev,
+  IN DWC3_ENDPOINT              *Ep
+  )
+{
+  DWC3_TRB                      *Trb;
+  DWC3_REQUEST                  Request;
+  UINTN                         Actual;
+
+  while (Ep->Dequeue != Ep->Enqueue) {
+    Trb = &Ep->Trbs[Ep->Dequeue];
+    if ((Trb->Control & DWC3_TRB_CTRL_HWO) != 0) {
+      break;
+    }
+
+    CopyMem (&Request, &Ep->Requests[Ep->Dequeue], sizeof (Request));
+    Actual      = Request.Length - (Trb->Size & DWC3_TRB_SIZE_MASK);
+    Ep->Dequeue = (Ep->Dequeue + 1) % (DWC3_RING_TRBS - 1);
+    DmaUnmap (Request.Mapping);
+
+    if ((Ep->Number & 1) != 0) {
+      FreePool (Request.Buffer);
+      if (Dev->TxCallback != NULL) {
+        Dev->TxCallback (Ep->Address & DWC3_ENDPOINT_NUMBER_MASK);
+      }
+      continue;
+    }
+
+    Dev->RxPosted   -= MIN (Request.Posted, Dev->RxPosted);
+    Dev->RxExpected -= MIN (Actual, Dev->RxExpected);
+    if (Dev->RxExpected == 0) {
+      Dev->RxPosted = 0;
+    }
+
+    //
+    // Refill first, so that the controller always has a buffer to
+    // receive into while the consumer deals with this one.
+    //
+    Dwc3QueueRx (Dev);
+
+    if ((Actual == 0) || (Dev->RxCallback == NULL)) {
+      FreePool (Request.Buffer);
+    } else {
+      Dev->RxCallback (Actual, Request.Buffer);
+    }
+  }
+}
+
+/**
+  Configure the bulk endpoints for the connected speed and start receiving.
+
+  @param[in]  Dev               The controller.
+
+  @retval EFI_SUCCESS           The endpoints are enabled.
+  @return Others                An endpoint command failed.
+
+**/
+EFI_STATUS
+Dwc3EnableBulk (
+  IN DWC3_DEVICE                *Dev
+  )
+{
+  EFI_STATUS                    Status;
+  DWC3_ENDPOINT                 *Ep;
+  UINTN                         Index;
+
+  if (!Dev->StartConfigIssued) {
+    //
+    // Transfer resources of the non-control endpoints start at index 2
+    //
+    Status = Dwc3SendEpCmd (Dev, DWC3_EP0_OUT, DWC3_DEPCMD_DEPSTARTCFG | DWC3_DEPCMD_PARAM (2), 0, 0, 0);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+    Dev->StartConfigIssued = TRUE;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (Dev->Bulk); Index++) {
+    Ep            = &Dev->Bulk[Index];
+    Ep->MaxPacket = Dwc3BulkMaxPacket (Dev);
+    Status = Dwc3ConfigureEndpoint (
+               Dev,
+               Ep->Number,
+               USB_ENDPOINT_BULK,
+               Ep->MaxPacket,
+               (Dev->Speed == DWC3_DSTS_SUPERSPEED) ? DWC3_BULK_MAX_BURST : 0,
+               DWC3_DEPCFG_ACTION_INIT
+               );
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    MmioOr32 (Dev->Base + DWC3_DALEPENA, 1 << Ep->Number);
+    Dwc3InitRing (Ep);
+    Ep->Started             = FALSE;
+    Ep->Enabled             = TRUE;
+    Dev->BulkHalted[Index]  = FALSE;
+  }
+
+  Dev->RxExpected = 0;
+  Dev->RxPosted   = 0;
+  Dwc3QueueRx (Dev);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  End the transfers on the bulk endpoints and release their buffers.
+
+  @param[in]  Dev               The controller.
+
+**/
+VOID
+Dwc3DisableBulk (
+  IN DWC3_DEVICE                *Dev
+  )
+{
+  DWC3_ENDPOINT                 *Ep;
+  DWC3_REQUEST                  *Request;
+  UINTN                         Index;
+
+  for (Index = 0; Index < ARRAY_SIZE (Dev->Bulk); Index++) {
+    Ep = &Dev->Bulk[Index];
+    if (!Ep->Enabled) {
+      continue;
+    }
+
+    if (Ep->Started) {
+      Dwc3SendEpCmd (
+        Dev,
+        Ep->Number,
+        DWC3_DEPCMD_ENDTRANSFER | DWC3_DEPCMD_HIPRI_FORCERM | DWC3_DEPCMD_PARAM (Ep->ResourceIndex),
+        0,
+        0,
+        0
+        );
+      //
+      // The controller needs up to 100us to retire the TRBs it holds
+      //
+      gBS->Stall (100);
+      Ep->Started = FALSE;
+    }
+
+    MmioAnd32 (Dev->Base + DWC3_DALEPENA, ~(UINT32) (1 << Ep->Number));
+
+    while (Ep->Dequeue != Ep->Enqueue) {
+      Request = &Ep->Requests[Ep->Dequeue];
+      DmaUnmap (Request->Mapping);
+      FreePool (Request->Buffer);
+      Ep->Dequeue = (Ep->Dequeue + 1) % (DWC3_RING_TRBS - 1);
+    }
+
+    Ep->Enabled = FALSE;
+  }
+
+  Dev->RxExpected = 0;
+  Dev->RxPosted   = 0;
+}
+
+/**
+  Set or clear the halt feature of a bulk endpoint.
+
+  @param[in]  Dev               The controller.
+  @param[in]  Address           Endpoint address as in descriptors.
+  @param[in]  Halt              TRUE to stall the endpoint.
+
+  @retval EFI_SUCCESS           The feature was changed.
+  @retval EFI_NOT_FOUND         Address is not one of the bulk endpoints.
+
+**/
+EFI_STATUS
+Dwc3SetBulkHalt (
+  IN DWC3_DEVICE                *Dev,
+  IN UINT8                      Address,
+  IN BOOLEAN                    Halt
+  )
+{
+  UINTN                         Index;
+
+  for (Index = 0; Index < ARRAY_SIZE (Dev->Bulk); Index++) {
+    if (Dev->Bulk[Index].Enabled && (Dev->Bulk[Index].Address == Address)) {
+      Dev->BulkHalted[Index] = Halt;
+      return Dwc3SendEpCmd (
+               Dev,
+               Dev->Bulk[Index].Number,
+               Halt ? DWC3_DEPCMD_SETSTALL : DWC3_DEPCMD_CLEARSTALL,
+               0,
+               0,
+               0
+               );
+    }
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+/**
+  Handle a device event.
+
+  @param[in]  Dev               The controller.
+  @param[in]  Event             The device event.
+
+**/
+STATIC
+VOID
+Dwc3HandleDeviceEvent (
+  IN DWC3_DEVICE                *Dev,
+  IN UINT32                     Event
+  )
+{
+  switch (DWC3_DEVT_TYPE (Event)) {
+  case DWC3_DEVT_DISCONN:
+    DEBUG ((EFI_D_INFO, "Dwc3: disconnected\n"));
+    Dwc3DisableBulk (Dev);
+    Dev->Configuration = 0;
+    break;
+
+  case DWC3_DEVT_USBRST:
+    Dwc3DisableBulk (Dev);
+    Dev->Configuration     = 0;
+    Dev->StartConfigIssued = FALSE;
+    MmioAnd32 (Dev->Base + DWC3_DCFG, ~(UINT32) DWC3_DCFG_DEVADDR_MASK);
+    break;
+
+  case DWC3_DEVT_CONNECTDONE:
+    Dev->Speed        = (UINT8) (MmioRead32 (Dev->Base + DWC3_DSTS) & DWC3_DSTS_CONNECTSPD);
+    Dev->Ep0MaxPacket = (Dev->Speed == DWC3_DSTS_SUPERSPEED) ? 512 : 64;
+    DEBUG ((EFI_D_INFO, "Dwc3: connected, speed %d\n", Dev->Speed));
+
+    Dwc3ConfigureEndpoint (Dev, DWC3_EP0_OUT, USB_ENDPOINT_CONTROL, Dev->Ep0MaxPacket, 0, DWC3_DEPCFG_ACTION_MODIFY);
+    Dwc3ConfigureEndpoint (Dev, DWC3_EP0_IN, USB_ENDPOINT_CONTROL, Dev->Ep0MaxPacket, 0, DWC3_DEPCFG_ACTION_MODIFY);
+    Dwc3BuildSpeedConfig (Dev);
+    break;
+
+  default:
+    break;
+  }
+}
+
+/**
+  Drain the event buffer.
+
+  @param[in]  Dev               The controller.
+
+**/
+STATIC
+VOID
+Dwc3ProcessEvents (
+  IN DWC3_DEVICE                *Dev
+  )
+{
+  UINT32                        Count;
+  UINT32                        Event;
+  UINT8                         PhysEp;
+  UINT8                         Type;
+
+  Count = MmioRead32 (Dev->Base + DWC3_GEVNTCOUNT (0)) & DWC3_GEVNTCOUNT_MASK;
+
+  while (Count > 0) {
+    Event         = Dev->Events[Dev->EventPos / sizeof (UINT32)];
+    Dev->EventPos = (Dev->EventPos + sizeof (UINT32)) % DWC3_EVENT_BUFFER_SIZE;
+    Count        -= sizeof (UINT32);
+    MmioWrite32 (Dev->Base + DWC3_GEVNTCOUNT (0), sizeof (UINT32));
+
+    if (DWC3_EVENT_IS_DEVICE (Event)) {
+      Dwc3HandleDeviceEvent (Dev, Event);
+      continue;
+    }
+
+    PhysEp = (UINT8) DWC3_DEPEVT_EP (Event);
+    Type   = (UINT8) DWC3_DEPEVT_TYPE (Event);
+    if (PhysEp <= DWC3_EP0_IN) {
+      Dwc3Ep0HandleEvent (Dev, Event);
+      continue;
+    }
+
+    if ((Type != DWC3_DEPEVT_XFERCOMPLETE) && (Type != DWC3_DEPEVT_XFERINPROGRESS)) {
+      continue;
+    }
+
+    if (PhysEp == Dev->Bulk[DWC3_BULK_OUT].Number) {
+      Dwc3BulkComplete (Dev, &Dev->Bulk[DWC3_BULK_OUT]);
+      if (Type == DWC3_DEPEVT_XFERCOMPLETE) {
+        Dev->Bulk[DWC3_BULK_OUT].Started = FALSE;
+      }
+    } else if (PhysEp == Dev->Bulk[DWC3_BULK_IN].Number) {
+      Dwc3BulkComplete (Dev, &Dev->Bulk[DWC3_BULK_IN]);
+      if (Type == DWC3_DEPEVT_XFERCOMPLETE) {
+        Dev->Bulk[DWC3_BULK_IN].Started = FALSE;
+      }
+    }
+  }
+}
+
+/**
+  Periodic event buffer poll.
+
+  @param[in]  Event             The poll timer.
+  @param[in]  Context           The controller.
+
+**/
+STATIC
+VOID
+EFIAPI
+Dwc3PollTimer (
+  IN EFI_EVENT                  Event,
+  IN VOID                       *Context
+  )
+{
+  Dwc3ProcessEvents ((DWC3_DEVICE *) Context);
+}
+
+/**
+  Switch the core to device mode and reset it.
+
+  @param[in]  Dev               The controller.
+
+  @retval EFI_SUCCESS           The core is in device mode.
+  @retval EFI_TIMEOUT           The soft reset did not complete.
+
+**/
+STATIC
+EFI_STATUS
+Dwc3CoreInit (
+  IN DWC3_DEVICE                *Dev
+  )
+{
+  UINTN                         Timeout;
+
+  MmioAndThenOr32 (
+    Dev->Base + DWC3_GCTL,
+    ~(UINT32) DWC3_GCTL_PRTCAPDIR_MASK,
+    DWC3_GCTL_PRTCAPDIR (DWC3_GCTL_PRTCAP_DEVICE)
+    );
+
+  MmioOr32 (Dev->Base + DWC3_DCTL, DWC3_DCTL_CSFTRST);
+  for (Timeout = 0; Timeout < DWC3_RESET_TIMEOUT; Timeout++) {
+    if ((MmioRead32 (Dev->Base + DWC3_DCTL) & DWC3_DCTL_CSFTRST) == 0) {
+      break;
+    }
+    gBS->Stall (1);
+  }
+  if (Timeout == DWC3_RESET_TIMEOUT) {
+    return EFI_TIMEOUT;
+  }
+
+  Dev->EventPos = 0;
+  ZeroMem (Dev->Events, DWC3_EVENT_BUFFER_SIZE);
+  MmioWrite32 (Dev->Base + DWC3_GEVNTADRLO (0), (UINT32) Dev->DmaPhys);
+  MmioWrite32 (Dev->Base + DWC3_GEVNTADRHI (0), (UINT32) RShiftU64 (Dev->DmaPhys, 32));
+  MmioWrite32 (Dev->Base + DWC3_GEVNTSIZ (0), DWC3_EVENT_BUFFER_SIZE);
+  MmioWrite32 (Dev->Base + DWC3_GEVNTCOUNT (0), 0);
+
+  MmioAndThenOr32 (
+    Dev->Base + DWC3_DCFG,
+    ~(UINT32) (DWC3_DCFG_SPEED_MASK | DWC3_DCFG_DEVADDR_MASK | DWC3_DCFG_LPM_CAP),
+    DWC3_DCFG_SUPERSPEED
+    );
+
+  MmioWrite32 (
+    Dev->Base + DWC3_DEVTEN,
+    DWC3_DEVTEN_DISCONNEVTEN | DWC3_DEVTEN_USBRSTEN | DWC3_DEVTEN_CONNECTDONEEN
+    );
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Restart the controller in device mode and respond to enumeration.
+
+  @param[in]  DeviceDescriptor  The device descriptor.
+  @param[in]  Descriptors       Descriptors[0] is the complete configuration
+                                descriptor, only one configuration is supported.
+  @param[in]  Strings           Optional string descriptors, Strings[N - 1] is
+                                string index N.
+  @param[in]  StringCount       Number of entries in Strings.
+  @param[in]  RxCallback        Called for every bulk OUT transfer received.
+  @param[in]  TxCallback        Called for every bulk IN transfer sent.
+
+  @retval EFI_SUCCESS           The controller is running.
+  @retval EFI_ALREADY_STARTED   The controller is already in use.
+  @retval EFI_UNSUPPORTED       The configuration has no bulk IN/OUT pair.
+  @retval EFI_DEVICE_ERROR      The controller could not be started.
+
+**/
+EFI_STATUS
+Dwc3DeviceStart (
+  IN USB_DEVICE_DESCRIPTOR      *DeviceDescriptor,
+  IN VOID                       **Descriptors,
+  IN CONST CHAR16               **Strings,
+  IN UINTN                      StringCount,
+  IN USB_DEVICE_RX_CALLBACK     RxCallback,
+  IN USB_DEVICE_TX_CALLBACK     TxCallback
+  )
+{
+  DWC3_DEVICE                   *Dev;
+  USB_CONFIG_DESCRIPTOR         *Config;
+  USB_ENDPOINT_DESCRIPTOR       *Endpoint;
+  UINT8                         *Desc;
+  UINTN                         Offset;
+  UINTN                         Timeout;
+  EFI_STATUS                    Status;
+
+  Dev = mDwc3Device;
+  if (Dev->Running) {
+    return EFI_ALREADY_STARTED;
+  }
+
+  if ((DeviceDescriptor == NULL) || (Descriptors == NULL) || (Descriptors[0] == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Find the bulk endpoint pair of the configuration
+  //
+  Config = (USB_CONFIG_DESCRIPTOR *) Descriptors[0];
+  Desc   = (UINT8 *) Config;
+  Dev->Bulk[DWC3_BULK_OUT].Address = 0;
+  Dev->Bulk[DWC3_BULK_IN].Address  = 0;
+  for (Offset = 0; (Offset + 2 <= Config->TotalLength) && (Desc[Offset] != 0); Offset += Desc[Offset]) {
+    if (Desc[Offset + 1] != USB_DESC_TYPE_ENDPOINT) {
+      continue;
+    }
+    Endpoint = (USB_ENDPOINT_DESCRIPTOR *) (Desc + Offset);
+    if ((Endpoint->Attributes & USB_ENDPOINT_TYPE_MASK) != USB_ENDPOINT_BULK) {
+      continue;
+    }
+    if ((Endpoint->EndpointAddress & USB_ENDPOINT_DIR_IN) != 0) {
+      Dev->Bulk[DWC3_BULK_IN].Address = Endpoint->EndpointAddress;
+    } else {
+      Dev->Bulk[DWC3_BULK_OUT].Address = Endpoint->EndpointAddress;
+    }
+  }
+
+  if ((Dev->Bulk[DWC3_BULK_OUT].Address == 0) || (Dev->Bulk[DWC3_BULK_IN].Address == 0)) {
+    DEBUG ((EFI_D_ERROR, "Dwc3DeviceStart: configuration has no bulk endpoint pair\n"));
+    return EFI_UNSUPPORTED;
+  }
+
+  Dev->Bulk[DWC3_BULK_OUT].Number = (UINT8) DWC3_PHYS_EP (Dev->Bulk[DWC3_BULK_OUT].Address);
+  Dev->Bulk[DWC3_BULK_IN].Number  = (UINT8) DWC3_PHYS_EP (Dev->Bulk[DWC3_BULK_IN].Address);
+
+  if (Dev->ConfigDescriptor != NULL) {
+    FreePool (Dev->ConfigDescriptor);
+  }
+  Dev->ConfigDescriptor = AllocateCopyPool (Config->TotalLength, Config);
+  if (Dev->ConfigDescriptor == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  CopyMem (&Dev->DeviceDescriptor, DeviceDescriptor, sizeof (USB_DEVICE_DESCRIPTOR));
+  Dev->Strings           = Strings;
+  Dev->StringCount       = StringCount;
+  Dev->RxCallback        = RxCallback;
+  Dev->TxCallback        = TxCallback;
+  Dev->Configuration     = 0;
+  Dev->StartConfigIssued = FALSE;
+  Dev->Speed             = DWC3_DSTS_HIGHSPEED;
+  Dev->Ep0MaxPacket      = 512;
+  Dwc3BuildSpeedConfig (Dev);
+
+  Status = Dwc3CoreInit (Dev);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "Dwc3DeviceStart: core reset failed - %r\n", Status));
+    return EFI_DEVICE_ERROR;
+  }
+
+  //
+  // Control endpoint: transfer resources start at index 0
+  //
+  Status = Dwc3SendEpCmd (Dev, DWC3_EP0_OUT, DWC3_DEPCMD_DEPSTARTCFG | DWC3_DEPCMD_PARAM (0), 0, 0, 0);
+  if (!EFI_ERROR (Status)) {
+    Status = Dwc3ConfigureEndpoint (Dev, DWC3_EP0_OUT, USB_ENDPOINT_CONTROL, Dev->Ep0MaxPacket, 0, DWC3_DEPCFG_ACTION_INIT);
+  }
+  if (!EFI_ERROR (Status)) {
+    Status = Dwc3ConfigureEndpoint (Dev, DWC3_EP0_IN, USB_ENDPOINT_CONTROL, Dev->Ep0MaxPacket, 0, DWC3_DEPCFG_ACTION_INIT);
+  }
+  if (EFI_ERROR (Status)) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  MmioWrite32 (Dev->Base + DWC3_DALEPENA, (1 << DWC3_EP0_OUT) | (1 << DWC3_EP0_IN));
+  Dwc3Ep0StartSetup (Dev);
+
+  //
+  // Connect to the host
+  //
+  MmioOr32 (Dev->Base + DWC3_DCTL, DWC3_DCTL_RUN_STOP);
+  for (Timeout = 0; Timeout < DWC3_RESET_TIMEOUT; Timeout++) {
+    if ((MmioRead32 (Dev->Base + DWC3_DSTS) & DWC3_DSTS_DEVCTRLHLT) == 0) {
+      break;
+    }
+    gBS->Stall (1);
+  }
+  if (Timeout == DWC3_RESET_TIMEOUT) {
+    DEBUG ((EFI_D_ERROR, "Dwc3DeviceStart: controller did not start\n"));
+    return EFI_DEVICE_ERROR;
+  }
+
+  Dev->Running = TRUE;
+  return gBS->SetTimer (Dev->PollTimer, TimerPeriodic, DWC3_POLL_INTERVAL);
+}
+
+/**
+  Soft reset the core and switch it back to host mode. The reset is held
+  while the clocks of the new role settle, like Linux does for a role
+  switch of the DRD cores.
+
+  @param[in]  Dev               The controller.
+
+**/
+STATIC
+VOID
+Dwc3CoreReturnToHost (
+  IN DWC3_DEVICE                *Dev
+  )
+{
+  MmioOr32 (Dev->Base + DWC3_GCTL, DWC3_GCTL_CORESOFTRESET);
+  gBS->Stall (DWC3_ROLE_SWITCH_DELAY);
+  MmioAnd32 (Dev->Base + DWC3_GCTL, ~(UINT32) DWC3_GCTL_CORESOFTRESET);
+
+  MmioAndThenOr32 (
+    Dev->Base + DWC3_GCTL,
+    ~(UINT32) DWC3_GCTL_PRTCAPDIR_MASK,
+    DWC3_GCTL_PRTCAPDIR (DWC3_GCTL_PRTCAP_HOST)
+    );
+}
+
+/**
+  Disconnect from the host and stop the controller.
+
+**/
+VOID
+Dwc3DeviceStop (
+  VOID
+  )
+{
+  DWC3_DEVICE                   *Dev;
+  UINTN                         Timeout;
+  EFI_TPL                       OldTpl;
+
+  Dev = mDwc3Device;
+  if (!Dev->Running) {
+    return;
+  }
+
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+
+  gBS->SetTimer (Dev->PollTimer, TimerCancel, 0);
+  Dwc3DisableBulk (Dev);
+
+  MmioAnd32 (Dev->Base + DWC3_DCTL, ~(UINT32) DWC3_DCTL_RUN_STOP);
+  for (Timeout = 0; Timeout < DWC3_RESET_TIMEOUT; Timeout++) {
+    if ((MmioRead32 (Dev->Base + DWC3_DSTS) & DWC3_DSTS_DEVCTRLHLT) != 0) {
+      break;
+    }
+    gBS->Stall (1);
+  }
+
+  //
+  // Give the core back to XhciDxe. The device mode lost its host registers,
+  // its root port monitor sees the core in host mode again and restarts
+  // the controller.
+  //
+  Dwc3CoreReturnToHost (Dev);
+
+  Dev->Running       = FALSE;
+  Dev->Configuration = 0;
+  Dev->RxCallback    = NULL;
+  Dev->TxCallback    = NULL;
+
+  gBS->RestoreTPL (OldTpl);
+}
+
+/**
+  Queue data on the bulk IN endpoint. The data is copied, Buffer may be
+  reused as soon as the function returns.
+
+  @param[in]  EndpointIndex     Endpoint number of the bulk IN endpoint.
+  @param[in]  Size              Size in bytes of data.
+  @param[in]  Buffer            Pointer to data.
+
+  @retval EFI_SUCCESS           The data was queued.
+  @retval EFI_NOT_READY         The host did not configure the device yet.
+  @retval EFI_OUT_OF_RESOURCES  The transmit ring or memory is exhausted.
+
+**/
+EFI_STATUS
+Dwc3DeviceSend (
+  IN UINT8                      EndpointIndex,
+  IN UINTN                      Size,
+  IN CONST VOID                 *Buffer
+  )
+{
+  DWC3_DEVICE                   *Dev;
+  DWC3_ENDPOINT                 *Ep;
+  VOID                          *Copy;
+  EFI_STATUS                    Status;
+  EFI_TPL                       OldTpl;
+
+  Dev = mDwc3Device;
+  Ep  = &Dev->Bulk[DWC3_BULK_IN];
+
+  if ((EndpointIndex & DWC3_ENDPOINT_NUMBER_MASK) != (Ep->Address & DWC3_ENDPOINT_NUMBER_MASK)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Size > DWC3_TRB_SIZE_MASK) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Copy = AllocatePool (MAX (Size, 1));
+  if (Copy == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  CopyMem (Copy, Buffer, Size);
+
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+
+  if (!Ep->Enabled) {
+    Status = EFI_NOT_READY;
+  } else {
+    Status = Dwc3QueueTrb (Dev, Ep, Copy, Size, 0);
+  }
+
+  gBS->RestoreTPL (OldTpl);
+
+  if (EFI_ERROR (Status)) {
+    FreePool (Copy);
+  }
+
+  return Status;
+}
+
+/**
+  USB_DEVICE_PROTOCOL.Start (), see Dwc3DeviceStart ().
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+Dwc3UsbDeviceStart (
+  IN USB_DEVICE_DESCRIPTOR      *DeviceDescriptor,
+  IN VOID                       **Descriptors,
+  IN USB_DEVICE_RX_CALLBACK     RxCallback,
+  IN USB_DEVICE_TX_CALLBACK     TxCallback
+  )
+{
+  return Dwc3DeviceStart (DeviceDescriptor, Descriptors, NULL, 0, RxCallback, TxCallback);
+}
+
+/**
+  USB_DEVICE_PROTOCOL.Send (), see Dwc3DeviceSend ().
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+Dwc3UsbDeviceSend (
+  IN       UINT8                EndpointIndex,
+  IN       UINTN                Size,
+  IN CONST VOID                 *Buffer
+  )
+{
+  return Dwc3DeviceSend (EndpointIndex, Size, Buffer);
+}
+
+STATIC USB_DEVICE_PROTOCOL mUsbDevice = {
+  Dwc3UsbDeviceStart,
+  Dwc3UsbDeviceSend
+};
+
+/**
+  Give the controller back to the host mode driver when the OS takes over.
+
+  @param[in]  Event             The exit boot services event.
+  @param[in]  Context           The controller.
+
+**/
+STATIC
+VOID
+EFIAPI
+Dwc3ExitBootServices (
+  IN EFI_EVENT                  Event,
+  IN VOID                       *Context
+  )
+{
+  DWC3_DEVICE                   *Dev;
+
+  Dev = (DWC3_DEVICE *) Context;
+  if (!Dev->Running) {
+    return;
+  }
+
+  Dwc3DeviceStop ();
+}
+
+/**
+  The entry point of the driver.
+
+  @param[in]  ImageHandle       The firmware allocated handle for the EFI image.
+  @param[in]  SystemTable       A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS           The protocols are installed.
+  @return Others                The driver could not be initialized.
+
+**/
+EFI_STATUS
+EFIAPI
+UsbDwc3DeviceEntryPoint (
+  IN EFI_HANDLE                 ImageHandle,
+  IN EFI_SYSTEM_TABLE           *SystemTable
+  )
+{
+  DWC3_DEVICE                   *Dev;
+  EFI_STATUS                    Status;
+  UINTN                         Bytes;
+  UINT8                         *Page;
+
+  if (PcdGet32 (PcdDwc3DeviceController) >= PcdGet32 (PcdNumDwc3Controller)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Dev = AllocateZeroPool (sizeof (DWC3_DEVICE));
+  if (Dev == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Dev->Signature = DWC3_DEVICE_SIGNATURE;
+  Dev->Base      = PcdGet32 (PcdDwc3BaseAddress) +
+                   PcdGet32 (PcdDwc3DeviceController) * PcdGet32 (PcdDwc3Size);
+
+  //
+  // First page: event buffer. Second page: control TRB at 0, control
+  // buffer at 512, bulk OUT ring at 1024 and bulk IN ring at 1536.
+  //
+  Status = DmaAllocateBuffer (EfiBootServicesData, 2, &Dev->DmaBuffer);
+  if (EFI_ERROR (Status)) {
+    goto ON_ERROR;
+  }
+
+  Bytes  = EFI_PAGES_TO_SIZE (2);
+  Status = DmaMap (MapOperationBusMasterCommonBuffer, Dev->DmaBuffer, &Bytes, &Dev->DmaPhys, &Dev->DmaMapping);
+  if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (2))) {
+    if (!EFI_ERROR (Status)) {
+      DmaUnmap (Dev->DmaMapping);
+    }
+    Dev->DmaMapping = NULL;
+    DmaFreeBuffer (2, Dev->DmaBuffer);
+    Status = EFI_OUT_OF_RESOURCES;
+    goto ON_ERROR;
+  }
+  ZeroMem (Dev->DmaBuffer, EFI_PAGES_TO_SIZE (2));
+
+  Page                          = (UINT8 *) Dev->DmaBuffer + EFI_PAGE_SIZE;
+  Dev->Events                   = Dev->DmaBuffer;
+  Dev->Ep0Trb                   = (DWC3_TRB *) Page;
+  Dev->Ep0TrbPhys               = Dev->DmaPhys + EFI_PAGE_SIZE;
+  Dev->Ep0Buffer                = Page + 512;
+  Dev->Ep0BufferPhys            = Dev->Ep0TrbPhys + 512;
+  Dev->Bulk[DWC3_BULK_OUT].Trbs     = (DWC3_TRB *) (Page + 1024);
+  Dev->Bulk[DWC3_BULK_OUT].TrbsPhys = Dev->Ep0TrbPhys + 1024;
+  Dev->Bulk[DWC3_BULK_IN].Trbs      = (DWC3_TRB *) (Page + 1536);
+  Dev->Bulk[DWC3_BULK_IN].TrbsPhys  = Dev->Ep0TrbPhys + 1536;
+
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_CALLBACK,
+                  Dwc3PollTimer,
+                  Dev,
+                  &Dev->PollTimer
+                  );
+  if (EFI_ERROR (Status)) {
+    goto ON_ERROR;
+  }
+
+  Status = gBS->CreateEventEx (
+                  EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  Dwc3ExitBootServices,
+                  Dev,
+                  &gEfiEventExitBootServicesGuid,
+                  &Dev->ExitBootServicesEvent
+                  );
+  if (EFI_ERROR (Status)) {
+    goto ON_ERROR;
+  }
+
+  mDwc3Device = Dev;
+
+  Status = gBS->InstallMultipleProtocolInterfaces (
+                  &ImageHandle,
+                  &gUsbDeviceProtocolGuid,
+                  &mUsbDevice,
+                  &gAndroidFastbootTransportProtocolGuid,
+                  &mDwc3FastbootTransport,
+                  NULL
+                  );
+  if (!EFI_ERROR (Status)) {
+    return EFI_SUCCESS;
+  }
+
+  mDwc3Device = NULL;
+
+ON_ERROR:
+  DEBUG ((EFI_D_ERROR, "UsbDwc3DeviceEntryPoint: failed - %r\n", Status));
+  if (Dev->ExitBootServicesEvent != NULL) {
+    gBS->CloseEvent (Dev->ExitBootServicesEvent);
+  }
+  if (Dev->PollTimer != NULL) {
+    gBS->CloseEvent (Dev->PollTimer);
+  }
+  if (Dev->DmaMapping != NULL) {
+    DmaUnmap (Dev->DmaMapping);
+    DmaFreeBuffer (2, Dev->DmaBuffer);
+  }
+  FreePool (Dev);
+  return Status;
+}
@@ -0,0 +1,446 @@
+/** @file
+
+  DWC3 USB peripheral controller driver, producing USB_DEVICE_PROTOCOL and
+  a FASTBOOT_TRANSPORT_PROTOCOL that sizes bulk receives to the download.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _USB_DWC3_DEVICE_H_
+#define _USB_DWC3_DEVICE_H_
+
+#include <Uefi.h>
+
+#include <IndustryStandard/Usb.h>
+
+#include <Protocol/AndroidFastbootTransport.h>
+#include <Protocol/UsbDevice.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DmaLib.h>
+#include <Library/IoLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+//
+// Global registers, offsets from the controller base
+//
+#define DWC3_GCTL                       0xC110
+#define DWC3_GCTL_PRTCAPDIR_MASK        (3 << 12)
+#define DWC3_GCTL_CORESOFTRESET         BIT11
+#define DWC3_GCTL_PRTCAPDIR(N)          ((N) << 12)
+#define DWC3_GCTL_PRTCAP_HOST           1
+#define DWC3_GCTL_PRTCAP_DEVICE         2
+#define DWC3_GEVNTADRLO(N)              (0xC400 + ((N) * 0x10))
+#define DWC3_GEVNTADRHI(N)              (0xC404 + ((N) * 0x10))
+#define DWC3_GEVNTSIZ(N)                (0xC408 + ((N) * 0x10))
+#define DWC3_GEVNTSIZ_INTMASK           BIT31
+#define DWC3_GEVNTCOUNT(N)              (0xC40C + ((N) * 0x10))
+#define DWC3_GEVNTCOUNT_MASK            0xFFFC
+
+//
+// Device registers
+//
+#define DWC3_DCFG                       0xC700
+#define DWC3_DCFG_SPEED_MASK            0x7
+#define DWC3_DCFG_SUPERSPEED            4
+#define DWC3_DCFG_HIGHSPEED             0
+#define DWC3_DCFG_DEVADDR_MASK          (0x7F << 3)
+#define DWC3_DCFG_DEVADDR(N)            ((N) << 3)
+#define DWC3_DCFG_LPM_CAP               BIT22
+
+#define DWC3_DCTL                       0xC704
+#define DWC3_DCTL_RUN_STOP              BIT31
+#define DWC3_DCTL_CSFTRST               BIT30
+
+#define DWC3_DEVTEN                     0xC708
+#define DWC3_DEVTEN_DISCONNEVTEN        BIT0
+#define DWC3_DEVTEN_USBRSTEN            BIT1
+#define DWC3_DEVTEN_CONNECTDONEEN       BIT2
+
+#define DWC3_DSTS                       0xC70C
+#define DWC3_DSTS_CONNECTSPD            0x7
+#define DWC3_DSTS_SUPERSPEED            4
+#define DWC3_DSTS_HIGHSPEED             0
+#define DWC3_DSTS_DEVCTRLHLT            BIT22
+
+#define DWC3_DALEPENA                   0xC720
+
+#define DWC3_DEPCMDPAR2(N)              (0xC800 + ((N) * 0x10))
+#define DWC3_DEPCMDPAR1(N)              (0xC804 + ((N) * 0x10))
+#define DWC3_DEPCMDPAR0(N)              (0xC808 + ((N) * 0x10))
+#define DWC3_DEPCMD(N)                  (0xC80C + ((N) * 0x10))
+
+//
+// Endpoint commands
+//
+#define DWC3_DEPCMD_DEPCFG              0x01
+#define DWC3_DEPCMD_SETTRANSFRESOURCE   0x02
+#define DWC3_DEPCMD_SETSTALL            0x04
+#define DWC3_DEPCMD_CLEARSTALL          0x05
+#define DWC3_DEPCMD_STARTTRANSFER       0x06
+#define DWC3_DEPCMD_UPDATETRANSFER      0x07
+#define DWC3_DEPCMD_ENDTRANSFER         0x08
+#define DWC3_DEPCMD_DEPSTARTCFG         0x09
+#define DWC3_DEPCMD_CMDACT              BIT10
+#define DWC3_DEPCMD_HIPRI_FORCERM       BIT11
+#define DWC3_DEPCMD_STATUS(N)           (((N) >> 12) & 0xF)
+#define DWC3_DEPCMD_PARAM(N)            ((N) << 16)
+#define DWC3_DEPCMD_GET_RSC_IDX(N)      (((N) >> 16) & 0x7F)
+
+#define DWC3_DEPCFG_EP_TYPE(N)          ((N) << 1)
+#define DWC3_DEPCFG_MAX_PACKET_SIZE(N)  (((N) & 0x7FF) << 3)
+#define DWC3_DEPCFG_FIFO_NUMBER(N)      ((N) << 17)
+#define DWC3_DEPCFG_BURST_SIZE(N)       ((N) << 22)
+#define DWC3_DEPCFG_ACTION_INIT         (0U << 30)
+#define DWC3_DEPCFG_ACTION_MODIFY       (2U << 30)
+#define DWC3_DEPCFG_XFER_COMPLETE_EN    BIT8
+#define DWC3_DEPCFG_XFER_IN_PROGRESS_EN BIT9
+#define DWC3_DEPCFG_XFER_NOT_READY_EN   BIT10
+#define DWC3_DEPCFG_EP_NUMBER(N)        (((N) & 0x1F) << 25)
+
+//
+// Transfer Request Block
+//
+typedef struct {
+  UINT32                    BufferLo;
+  UINT32                    BufferHi;
+  UINT32                    Size;
+  UINT32                    Control;
+} DWC3_TRB;
+
+#define DWC3_TRB_SIZE_MASK              0x00FFFFFF
+#define DWC3_TRB_CTRL_HWO               BIT0
+#define DWC3_TRB_CTRL_LST               BIT1
+#define DWC3_TRB_CTRL_CHN               BIT2
+#define DWC3_TRB_CTRL_CSP               BIT3
+#define DWC3_TRB_CTRL_TRBCTL(N)         ((N) << 4)
+#define DWC3_TRB_CTRL_ISP_IMI           BIT10
+#define DWC3_TRB_CTRL_IOC               BIT11
+
+#define DWC3_TRBCTL_NORMAL              1
+#define DWC3_TRBCTL_CONTROL_SETUP       2
+#define DWC3_TRBCTL_CONTROL_STATUS2     3
+#define DWC3_TRBCTL_CONTROL_STATUS3     4
+#define DWC3_TRBCTL_CONTROL_DATA        5
+#define DWC3_TRBCTL_LINK_TRB            8
+
+//
+// Event buffer entries
+//
+#define DWC3_EVENT_IS_DEVICE(E)         (((E) & BIT0) != 0)
+#define DWC3_DEPEVT_EP(E)               (((E) >> 1) & 0x1F)
+#define DWC3_DEPEVT_TYPE(E)             (((E) >> 6) & 0xF)
+#define DWC3_DEPEVT_STATUS(E)           (((E) >> 12) & 0xF)
+#define DWC3_DEPEVT_XFERCOMPLETE        1
+#define DWC3_DEPEVT_XFERINPROGRESS      2
+#define DWC3_DEPEVT_XFERNOTREADY        3
+#define DWC3_DEPEVT_STATUS_CONTROL_STATUS 2
+
+#define DWC3_DEVT_TYPE(E)               (((E) >> 8) & 0xF)
+#define DWC3_DEVT_DISCONN               0
+#define DWC3_DEVT_USBRST                1
+#define DWC3_DEVT_CONNECTDONE           2
+
+#define DWC3_EVENT_BUFFER_SIZE          EFI_PAGE_SIZE
+
+//
+// Physical endpoints used: control OUT/IN, then one bulk OUT/IN pair.
+// Physical endpoint numbers are (EndpointNumber << 1) | IsIn.
+//
+#define DWC3_EP0_OUT                    0
+#define DWC3_EP0_IN                     1
+#define DWC3_BULK_OUT                   0
+#define DWC3_BULK_IN                    1
+#define DWC3_ENDPOINT_NUMBER_MASK       0x0F
+#define DWC3_PHYS_EP(Address)           ((((Address) & DWC3_ENDPOINT_NUMBER_MASK) << 1) | (((Address) & USB_ENDPOINT_DIR_IN) ? 1 : 0))
+
+//
+// Bulk TRB ring, the last TRB links back to the first one. Receives are
+// double-buffered, and each of them spans up to DWC3_RX_MAX_SIZE bytes
+// while a download of known size is in progress.
+//
+#define DWC3_RING_TRBS                  32
+#define DWC3_RX_QUEUE_DEPTH             2
+#define DWC3_RX_MAX_SIZE                SIZE_1MB
+#define DWC3_BULK_MAX_BURST             15
+
+#define DWC3_EP0_BUFFER_SIZE            512
+#define DWC3_CMD_TIMEOUT                1000     // in microseconds
+#define DWC3_RESET_TIMEOUT              100000   // in microseconds
+#define DWC3_ROLE_SWITCH_DELAY          100000   // in microseconds
+#define DWC3_POLL_INTERVAL              EFI_TIMER_PERIOD_MILLISECONDS (1)
+
+#define DWC3_STRING_LANGUAGE            0x0409
+
+//
+// USB 3.x additions to IndustryStandard/Usb.h
+//
+#define DWC3_DESC_TYPE_BOS              0x0F
+#define DWC3_DESC_TYPE_DEVICE_CAP       0x10
+#define DWC3_DESC_TYPE_SS_EP_COMPANION  0x30
+#define DWC3_REQ_SET_SEL                0x30
+#define DWC3_REQ_SET_ISOCH_DELAY        0x31
+
+typedef enum {
+  Dwc3Ep0Setup,
+  Dwc3Ep0Data,
+  Dwc3Ep0WaitStatus,
+  Dwc3Ep0Status
+} DWC3_EP0_STATE;
+
+//
+// A buffer queued on a bulk TRB
+//
+typedef struct {
+  VOID                      *Buffer;
+  VOID                      *Mapping;
+  UINTN                     Length;
+  //
+  // Bytes of the expected download this receive was sized for
+  //
+  UINTN                     Posted;
+} DWC3_REQUEST;
+
+typedef struct {
+  UINT8                     Number;        ///< Physical endpoint number
+  UINT8                     Address;       ///< Endpoint address as in descriptors
+  UINT16                    MaxPacket;
+  BOOLEAN                   Enabled;
+  BOOLEAN                   Started;
+  UINT32                    ResourceIndex;
+  DWC3_TRB                  *Trbs;
+  EFI_PHYSICAL_ADDRESS      TrbsPhys;
+  UINTN                     Enqueue;
+  UINTN                     Dequeue;
+  DWC3_REQUEST              Requests[DWC3_RING_TRBS];
+} DWC3_ENDPOINT;
+
+#define DWC3_DEVICE_SIGNATURE           SIGNATURE_32 ('D', 'W', 'C', 'D')
+
+typedef struct {
+  UINT32                    Signature;
+  UINTN                     Base;
+  BOOLEAN                   Running;
+  EFI_EVENT                 PollTimer;
+  EFI_EVENT                 ExitBootServicesEvent;
+
+  //
+  // DMA memory: event buffer in the first page, TRBs and the
+  // control buffer in the second one.
+  //
+  VOID                      *DmaBuffer;
+  VOID                      *DmaMapping;
+  EFI_PHYSICAL_ADDRESS      DmaPhys;
+  UINT32                    *Events;
+  UINTN                     EventPos;
+  DWC3_TRB                  *Ep0Trb;
+  EFI_PHYSICAL_ADDRESS      Ep0TrbPhys;
+  UINT8                     *Ep0Buffer;
+  EFI_PHYSICAL_ADDRESS      Ep0BufferPhys;
+
+  UINT8                     Speed;
+  UINT16                    Ep0MaxPacket;
+  DWC3_EP0_STATE            Ep0State;
+  USB_DEVICE_REQUEST        Ep0Request;
+  BOOLEAN                   Ep0ThreeStage;
+  UINT8                     Ep0StatusEp;
+  BOOLEAN                   StartConfigIssued;
+  UINT8                     Configuration;
+
+  DWC3_ENDPOINT             Bulk[2];
+  BOOLEAN                   BulkHalted[2];
+
+  //
+  // Download accounting, see Dwc3DeviceExpectRx ()
+  //
+  UINTN                     RxExpected;
+  UINTN                     RxPosted;
+
+  //
+  // What the consumer of USB_DEVICE_PROTOCOL handed to Start ()
+  //
+  USB_DEVICE_DESCRIPTOR     DeviceDescriptor;
+  USB_CONFIG_DESCRIPTOR     *ConfigDescriptor;
+  CONST CHAR16              **Strings;
+  UINTN                     StringCount;
+  USB_DEVICE_RX_CALLBACK    RxCallback;
+  USB_DEVICE_TX_CALLBACK    TxCallback;
+
+  //
+  // Configuration descriptor adjusted to the connected speed
+  //
+  UINT8                     *SpeedConfig;
+  UINTN                     SpeedConfigLength;
+} DWC3_DEVICE;
+
+extern DWC3_DEVICE                  *mDwc3Device;
+extern FASTBOOT_TRANSPORT_PROTOCOL  mDwc3FastbootTransport;
+
+/**
+  Restart the controller in device mode and respond to enumeration.
+
+  @param[in]  DeviceDescriptor  The device descriptor.
+  @param[in]  Descriptors       Descriptors[0] is the complete configuration
+                                descriptor, only one configuration is supported.
+  @param[in]  Strings           Optional string descriptors, Strings[N - 1] is
+                                string index N.
+  @param[in]  StringCount       Number of entries in Strings.
+  @param[in]  RxCallback        Called for every bulk OUT transfer received.
+  @param[in]  TxCallback        Called for every bulk IN transfer sent.
+
+  @retval EFI_SUCCESS           The controller is running.
+  @retval EFI_ALREADY_STARTED   The controller is already in use.
+  @retval EFI_UNSUPPORTED       The configuration has no bulk IN/OUT pair.
+  @retval EFI_DEVICE_ERROR      The controller could not be started.
+
+**/
+EFI_STATUS
+Dwc3DeviceStart (
+  IN USB_DEVICE_DESCRIPTOR      *DeviceDescriptor,
+  IN VOID                       **Descriptors,
+  IN CONST CHAR16               **Strings,
+  IN UINTN                      StringCount,
+  IN USB_DEVICE_RX_CALLBACK     RxCallback,
+  IN USB_DEVICE_TX_CALLBACK     TxCallback
+  );
+
+/**
+  Disconnect from the host and stop the controller.
+
+**/
+VOID
+Dwc3DeviceStop (
+  VOID
+  );
+
+/**
+  Queue data on the bulk IN endpoint. The data is copied, Buffer may be
+  reused as soon as the function returns.
+
+  @param[in]  EndpointIndex     Endpoint number of the bulk IN endpoint.
+  @param[in]  Size              Size in bytes of data.
+  @param[in]  Buffer            Pointer to data.
+
+  @retval EFI_SUCCESS           The data was queued.
+  @retval EFI_NOT_READY         The host did not configure the device yet.
+  @retval EFI_OUT_OF_RESOURCES  The transmit ring or memory is exhausted.
+
+**/
+EFI_STATUS
+Dwc3DeviceSend (
+  IN UINT8                      EndpointIndex,
+  IN UINTN                      Size,
+  IN CONST VOID                 *Buffer
+  );
+
+/**
+  Announce that the host is about to send Size bytes of bulk data, so that
+  receives are sized to the data instead of to a single packet.
+
+  @param[in]  Size              Number of bytes expected.
+
+**/
+VOID
+Dwc3DeviceExpectRx (
+  IN UINTN                      Size
+  );
+
+/**
+  Issue an endpoint command and wait for the controller to accept it.
+
+  @param[in]  Dev               The controller.
+  @param[in]  PhysEp            Physical endpoint number.
+  @param[in]  Command           DWC3_DEPCMD_* command with its parameter bits.
+  @param[in]  Param0            DEPCMDPAR0 value.
+  @param[in]  Param1            DEPCMDPAR1 value.
+  @param[in]  Param2            DEPCMDPAR2 value.
+
+  @retval EFI_SUCCESS           The command completed.
+  @retval EFI_DEVICE_ERROR      The command failed.
+  @retval EFI_TIMEOUT           The command did not complete in time.
+
+**/
+EFI_STATUS
+Dwc3SendEpCmd (
+  IN DWC3_DEVICE                *Dev,
+  IN UINT8                      PhysEp,
+  IN UINT32                     Command,
+  IN UINT32                     Param0,
+  IN UINT32                     Param1,
+  IN UINT32                     Param2
+  );
+
+/**
+  Configure the bulk endpoints for the connected speed and start receiving.
+
+  @param[in]  Dev               The controller.
+
+  @retval EFI_SUCCESS           The endpoints are enabled.
+  @return Others                An endpoint command failed.
+
+**/
+EFI_STATUS
+Dwc3EnableBulk (
+  IN DWC3_DEVICE                *Dev
+  );
+
+/**
+  End the transfers on the bulk endpoints and release their buffers.
+
+  @param[in]  Dev               The controller.
+
+**/
+VOID
+Dwc3DisableBulk (
+  IN DWC3_DEVICE                *Dev
+  );
+
+/**
+  Set or clear the halt feature of a bulk endpoint.
+
+  @param[in]  Dev               The controller.
+  @param[in]  Address           Endpoint address as in descriptors.
+  @param[in]  Halt              TRUE to stall the endpoint.
+
+  @retval EFI_SUCCESS           The feature was changed.
+  @retval EFI_NOT_FOUND         Address is not one of the bulk endpoints.
+
+**/
+EFI_STATUS
+Dwc3SetBulkHalt (
+  IN DWC3_DEVICE                *Dev,
+  IN UINT8                      Address,
+  IN BOOLEAN                    Halt
+  );
+
+/**
+  Queue the control endpoint for the next SETUP packet.
+
+  @param[in]  Dev               The controller.
+
+**/
+VOID
+Dwc3Ep0StartSetup (
+  IN DWC3_DEVICE                *Dev
+  );
+
+/**
+  Handle an event of physical endpoint 0 or 1.
+
+  @param[in]  Dev               The controller.
+  @param[in]  Event             The endpoint event.
+
+**/
+VOID
+Dwc3Ep0HandleEvent (
+  IN DWC3_DEVICE                *Dev,
+  IN UINT32                     Event
+  );
+
+#endif
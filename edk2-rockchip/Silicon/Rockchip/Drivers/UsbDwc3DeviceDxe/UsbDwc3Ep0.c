@@ -0,0 +1,441 @@
+/** @file
+
+  DWC3 USB peripheral controller driver: control endpoint and the standard
+  device requests.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "UsbDwc3Device.h"
+
+//
+// BOS descriptor: USB 2.0 extension and SuperSpeed device capability
+//
+STATIC CONST UINT8 mDwc3Bos[] = {
+  5, DWC3_DESC_TYPE_BOS, 22, 0, 2,
+  7, DWC3_DESC_TYPE_DEVICE_CAP, 0x02, 0x00, 0x00, 0x00, 0x00,
+  10, DWC3_DESC_TYPE_DEVICE_CAP, 0x03, 0x00, 0x0E, 0x00, 0x01, 0x0A, 0x20, 0x00
+};
+
+/**
+  Queue the single control TRB.
+
+  @param[in]  Dev               The controller.
+  @param[in]  PhysEp            DWC3_EP0_OUT or DWC3_EP0_IN.
+  @param[in]  TrbControl        DWC3_TRBCTL_* type of the TRB.
+  @param[in]  Length            Length of the transfer.
+
+  @retval EFI_SUCCESS           The transfer was started.
+  @return Others                The command failed.
+
+**/
+STATIC
+EFI_STATUS
+Dwc3Ep0StartTrb (
+  IN DWC3_DEVICE                *Dev,
+  IN UINT8                      PhysEp,
+  IN UINT32                     TrbControl,
+  IN UINTN                      Length
+  )
+{
+  DWC3_TRB                      *Trb;
+
+  Trb           = Dev->Ep0Trb;
+  Trb->BufferLo = (UINT32) Dev->Ep0BufferPhys;
+  Trb->BufferHi = (UINT32) RShiftU64 (Dev->Ep0BufferPhys, 32);
+  Trb->Size     = (UINT32) Length;
+  MemoryFence ();
+  Trb->Control  = DWC3_TRB_CTRL_TRBCTL (TrbControl) | DWC3_TRB_CTRL_LST |
+                  DWC3_TRB_CTRL_IOC | DWC3_TRB_CTRL_ISP_IMI | DWC3_TRB_CTRL_HWO;
+  MemoryFence ();
+
+  return Dwc3SendEpCmd (
+           Dev,
+           PhysEp,
+           DWC3_DEPCMD_STARTTRANSFER,
+           (UINT32) RShiftU64 (Dev->Ep0TrbPhys, 32),
+           (UINT32) Dev->Ep0TrbPhys,
+           0
+           );
+}
+
+/**
+  Queue the control endpoint for the next SETUP packet.
+
+  @param[in]  Dev               The controller.
+
+**/
+VOID
+Dwc3Ep0StartSetup (
+  IN DWC3_DEVICE                *Dev
+  )
+{
+  Dev->Ep0State = Dwc3Ep0Setup;
+  Dwc3Ep0StartTrb (Dev, DWC3_EP0_OUT, DWC3_TRBCTL_CONTROL_SETUP, sizeof (USB_DEVICE_REQUEST));
+}
+
+/**
+  Stall the current control transfer and wait for the next SETUP packet.
+
+  @param[in]  Dev               The controller.
+
+**/
+STATIC
+VOID
+Dwc3Ep0Stall (
+  IN DWC3_DEVICE                *Dev
+  )
+{
+  Dwc3SendEpCmd (Dev, DWC3_EP0_OUT, DWC3_DEPCMD_SETSTALL, 0, 0, 0);
+  Dwc3Ep0StartSetup (Dev);
+}
+
+/**
+  Build a string descriptor in the control buffer.
+
+  @param[in]  Dev               The controller.
+  @param[in]  Index             String index.
+  @param[out] Length            Length of the descriptor.
+
+  @retval EFI_SUCCESS           The descriptor is in the control buffer.
+  @retval EFI_NOT_FOUND         There is no such string.
+
+**/
+STATIC
+EFI_STATUS
+Dwc3Ep0GetString (
+  IN  DWC3_DEVICE               *Dev,
+  IN  UINT8                     Index,
+  OUT UINTN                     *Length
+  )
+{
+  CONST CHAR16                  *String;
+  UINTN                         Chars;
+  UINT8                         *Buffer;
+
+  Buffer = Dev->Ep0Buffer;
+
+  if (Index == 0) {
+    Buffer[0] = 4;
+    Buffer[1] = USB_DESC_TYPE_STRING;
+    WriteUnaligned16 ((UINT16 *) (Buffer + 2), DWC3_STRING_LANGUAGE);
+    *Length = 4;
+    return EFI_SUCCESS;
+  }
+
+  if ((Dev->Strings == NULL) || (Index > Dev->StringCount) || (Dev->Strings[Index - 1] == NULL)) {
+    return EFI_NOT_FOUND;
+  }
+
+  String = Dev->Strings[Index - 1];
+  Chars  = MIN (StrLen (String), (MAX_UINT8 - 2) / sizeof (CHAR16));
+
+  Buffer[0] = (UINT8) (2 + Chars * sizeof (CHAR16));
+  Buffer[1] = USB_DESC_TYPE_STRING;
+  CopyMem (Buffer + 2, String, Chars * sizeof (CHAR16));
+  *Length = Buffer[0];
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Put the requested descriptor in the control buffer.
+
+  @param[in]  Dev               The controller.
+  @param[in]  Request           The GET_DESCRIPTOR request.
+  @param[out] Length            Length of the descriptor.
+
+  @retval EFI_SUCCESS           The descriptor is in the control buffer.
+  @retval EFI_NOT_FOUND         The descriptor is not supported.
+
+**/
+STATIC
+EFI_STATUS
+Dwc3Ep0GetDescriptor (
+  IN  DWC3_DEVICE               *Dev,
+  IN  USB_DEVICE_REQUEST        *Request,
+  OUT UINTN                     *Length
+  )
+{
+  USB_DEVICE_DESCRIPTOR         *Device;
+
+  switch (Request->Value >> 8) {
+  case USB_DESC_TYPE_DEVICE:
+    Device = (USB_DEVICE_DESCRIPTOR *) Dev->Ep0Buffer;
+    CopyMem (Device, &Dev->DeviceDescriptor, sizeof (USB_DEVICE_DESCRIPTOR));
+    if (Dev->Speed == DWC3_DSTS_SUPERSPEED) {
+      Device->BcdUSB         = 0x0300;
+      Device->MaxPacketSize0 = 9;
+    } else {
+      Device->MaxPacketSize0 = 64;
+    }
+    *Length = sizeof (USB_DEVICE_DESCRIPTOR);
+    return EFI_SUCCESS;
+
+  case USB_DESC_TYPE_CONFIG:
+    if ((Dev->SpeedConfig == NULL) || (Dev->SpeedConfigLength > DWC3_EP0_BUFFER_SIZE)) {
+      return EFI_NOT_FOUND;
+    }
+    CopyMem (Dev->Ep0Buffer, Dev->SpeedConfig, Dev->SpeedConfigLength);
+    *Length = Dev->SpeedConfigLength;
+    return EFI_SUCCESS;
+
+  case USB_DESC_TYPE_STRING:
+    return Dwc3Ep0GetString (Dev, (UINT8) Request->Value, Length);
+
+  case DWC3_DESC_TYPE_BOS:
+    CopyMem (Dev->Ep0Buffer, mDwc3Bos, sizeof (mDwc3Bos));
+    *Length = sizeof (mDwc3Bos);
+    return EFI_SUCCESS;
+
+  default:
+    //
+    // No device qualifier: the device only runs at one speed at a time
+    //
+    return EFI_NOT_FOUND;
+  }
+}
+
+/**
+  Handle a standard request. For requests with an IN data stage the data is
+  left in the control buffer.
+
+  @param[in]  Dev               The controller.
+  @param[in]  Request           The SETUP packet.
+  @param[out] Length            Length of the IN data.
+
+  @retval EFI_SUCCESS           The request was handled.
+  @retval EFI_UNSUPPORTED       The request must be stalled.
+
+**/
+STATIC
+EFI_STATUS
+Dwc3Ep0StandardRequest (
+  IN  DWC3_DEVICE               *Dev,
+  IN  USB_DEVICE_REQUEST        *Request,
+  OUT UINTN                     *Length
+  )
+{
+  EFI_STATUS                    Status;
+  UINT8                         Recipient;
+  UINTN                         Index;
+
+  *Length   = 0;
+  Recipient = Request->RequestType & 0x1F;
+
+  switch (Request->Request) {
+  case USB_REQ_GET_DESCRIPTOR:
+    return Dwc3Ep0GetDescriptor (Dev, Request, Length);
+
+  case USB_REQ_SET_ADDRESS:
+    if (Request->Value > 127) {
+      return EFI_UNSUPPORTED;
+    }
+    //
+    // The controller applies the address once the status stage completes
+    //
+    MmioAndThenOr32 (
+      Dev->Base + DWC3_DCFG,
+      ~(UINT32) DWC3_DCFG_DEVADDR_MASK,
+      DWC3_DCFG_DEVADDR (Request->Value)
+      );
+    return EFI_SUCCESS;
+
+  case USB_REQ_SET_CONFIG:
+    if (Request->Value == 0) {
+      Dwc3DisableBulk (Dev);
+      Dev->Configuration = 0;
+      return EFI_SUCCESS;
+    }
+    if (Request->Value != Dev->ConfigDescriptor->ConfigurationValue) {
+      return EFI_UNSUPPORTED;
+    }
+    if (Dev->Configuration == 0) {
+      Status = Dwc3EnableBulk (Dev);
+      if (EFI_ERROR (Status)) {
+        return EFI_UNSUPPORTED;
+      }
+    }
+    Dev->Configuration = (UINT8) Request->Value;
+    return EFI_SUCCESS;
+
+  case USB_REQ_GET_CONFIG:
+    Dev->Ep0Buffer[0] = Dev->Configuration;
+    *Length = 1;
+    return EFI_SUCCESS;
+
+  case USB_REQ_GET_STATUS:
+    Dev->Ep0Buffer[0] = 0;
+    Dev->Ep0Buffer[1] = 0;
+    if (Recipient == USB_TARGET_DEVICE) {
+      //
+      // Self powered
+      //
+      Dev->Ep0Buffer[0] = BIT0;
+    } else if (Recipient == USB_TARGET_ENDPOINT) {
+      for (Index = 0; Index < ARRAY_SIZE (Dev->Bulk); Index++) {
+        if (Dev->BulkHalted[Index] && (Dev->Bulk[Index].Address == (UINT8) Request->Index)) {
+          Dev->Ep0Buffer[0] = BIT0;
+        }
+      }
+    }
+    *Length = 2;
+    return EFI_SUCCESS;
+
+  case USB_REQ_CLEAR_FEATURE:
+  case USB_REQ_SET_FEATURE:
+    if (Recipient != USB_TARGET_ENDPOINT) {
+      //
+      // Remote wakeup and U1/U2 enables: nothing to do
+      //
+      return EFI_SUCCESS;
+    }
+    if ((Request->Value != USB_FEATURE_ENDPOINT_HALT) || ((Request->Index & DWC3_ENDPOINT_NUMBER_MASK) == 0)) {
+      return (Request->Request == USB_REQ_CLEAR_FEATURE) ? EFI_SUCCESS : EFI_UNSUPPORTED;
+    }
+    Status = Dwc3SetBulkHalt (Dev, (UINT8) Request->Index, (BOOLEAN) (Request->Request == USB_REQ_SET_FEATURE));
+    return EFI_ERROR (Status) ? EFI_UNSUPPORTED : EFI_SUCCESS;
+
+  case USB_REQ_GET_INTERFACE:
+    Dev->Ep0Buffer[0] = 0;
+    *Length = 1;
+    return EFI_SUCCESS;
+
+  case USB_REQ_SET_INTERFACE:
+    return (Request->Value == 0) ? EFI_SUCCESS : EFI_UNSUPPORTED;
+
+  case DWC3_REQ_SET_SEL:
+    //
+    // The exit latencies are only needed for U1/U2, which are not enabled
+    //
+    return (Request->Length == 6) ? EFI_SUCCESS : EFI_UNSUPPORTED;
+
+  case DWC3_REQ_SET_ISOCH_DELAY:
+    return EFI_SUCCESS;
+
+  default:
+    return EFI_UNSUPPORTED;
+  }
+}
+
+/**
+  Handle a received SETUP packet and start the next stage.
+
+  @param[in]  Dev               The controller.
+
+**/
+STATIC
+VOID
+Dwc3Ep0HandleSetup (
+  IN DWC3_DEVICE                *Dev
+  )
+{
+  USB_DEVICE_REQUEST            *Request;
+  EFI_STATUS                    Status;
+  UINTN                         Length;
+
+  Request = &Dev->Ep0Request;
+  CopyMem (Request, Dev->Ep0Buffer, sizeof (USB_DEVICE_REQUEST));
+
+  if ((Request->RequestType & (BIT6 | BIT5)) != USB_REQ_TYPE_STANDARD) {
+    Dwc3Ep0Stall (Dev);
+    return;
+  }
+
+  Status = Dwc3Ep0StandardRequest (Dev, Request, &Length);
+  if (EFI_ERROR (Status)) {
+    Dwc3Ep0Stall (Dev);
+    return;
+  }
+
+  Dev->Ep0ThreeStage = (BOOLEAN) (Request->Length != 0);
+  if (!Dev->Ep0ThreeStage) {
+    Dev->Ep0State = Dwc3Ep0WaitStatus;
+    return;
+  }
+
+  Dev->Ep0State = Dwc3Ep0Data;
+  if ((Request->RequestType & USB_ENDPOINT_DIR_IN) != 0) {
+    Status = Dwc3Ep0StartTrb (Dev, DWC3_EP0_IN, DWC3_TRBCTL_CONTROL_DATA, MIN (Length, Request->Length));
+  } else if (Request->Length <= DWC3_EP0_BUFFER_SIZE) {
+    //
+    // OUT data stages must be received in whole packets
+    //
+    Status = Dwc3Ep0StartTrb (
+               Dev,
+               DWC3_EP0_OUT,
+               DWC3_TRBCTL_CONTROL_DATA,
+               ALIGN_VALUE (Request->Length, Dev->Ep0MaxPacket)
+               );
+  } else {
+    Status = EFI_UNSUPPORTED;
+  }
+
+  if (EFI_ERROR (Status)) {
+    Dwc3Ep0Stall (Dev);
+  }
+}
+
+/**
+  Handle an event of physical endpoint 0 or 1.
+
+  @param[in]  Dev               The controller.
+  @param[in]  Event             The endpoint event.
+
+**/
+VOID
+Dwc3Ep0HandleEvent (
+  IN DWC3_DEVICE                *Dev,
+  IN UINT32                     Event
+  )
+{
+  switch (DWC3_DEPEVT_TYPE (Event)) {
+  case DWC3_DEPEVT_XFERCOMPLETE:
+    switch (Dev->Ep0State) {
+    case Dwc3Ep0Setup:
+      Dwc3Ep0HandleSetup (Dev);
+      break;
+
+    case Dwc3Ep0Data:
+      //
+      // The only OUT data stage accepted is SET_SEL, which is ignored
+      //
+      Dev->Ep0State = Dwc3Ep0WaitStatus;
+      break;
+
+    case Dwc3Ep0Status:
+      Dwc3Ep0StartSetup (Dev);
+      break;
+
+    default:
+      break;
+    }
+    break;
+
+  case DWC3_DEPEVT_XFERNOTREADY:
+    if ((Dev->Ep0State != Dwc3Ep0WaitStatus) ||
+        (DWC3_DEPEVT_STATUS (Event) != DWC3_DEPEVT_STATUS_CONTROL_STATUS)) {
+      break;
+    }
+
+    //
+    // The status stage goes in the direction the host asks for
+    //
+    Dev->Ep0StatusEp = (UINT8) DWC3_DEPEVT_EP (Event);
+    Dev->Ep0State    = Dwc3Ep0Status;
+    if (EFI_ERROR (Dwc3Ep0StartTrb (
+                     Dev,
+                     Dev->Ep0StatusEp,
+                     Dev->Ep0ThreeStage ? DWC3_TRBCTL_CONTROL_STATUS3 : DWC3_TRBCTL_CONTROL_STATUS2,
+                     0
+                     ))) {
+      Dwc3Ep0Stall (Dev);
+    }
+    break;
+
+  default:
+    break;
+  }
+}
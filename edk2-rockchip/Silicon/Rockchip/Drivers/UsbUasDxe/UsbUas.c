@@ -0,0 +1,1485 @@
+/** @file
+  USB Attached SCSI (UAS) driver.
+
+  The driver binds to USB mass storage interfaces that have a UAS alternate
+  setting. On SuperSpeed devices the status and data pipes get bulk streams
+  from the host controller and up to USB_UAS_MAX_QUEUE_DEPTH commands are kept
+  in flight, each one on the stream that matches its tag. Without streams the
+  device is driven one command at a time through EFI_USB_IO_PROTOCOL.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "UsbUas.h"
+
+EFI_STATUS
+EFIAPI
+UsbUasDriverBindingSupported (
+  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN EFI_HANDLE                   Controller,
+  IN EFI_DEVICE_PATH_PROTOCOL     *RemainingDevicePath
+  );
+
+EFI_STATUS
+EFIAPI
+UsbUasDriverBindingStart (
+  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN EFI_HANDLE                   Controller,
+  IN EFI_DEVICE_PATH_PROTOCOL     *RemainingDevicePath
+  );
+
+EFI_STATUS
+EFIAPI
+UsbUasDriverBindingStop (
+  IN  EFI_DRIVER_BINDING_PROTOCOL *This,
+  IN  EFI_HANDLE                  Controller,
+  IN  UINTN                       NumberOfChildren,
+  IN  EFI_HANDLE                  *ChildHandleBuffer
+  );
+
+//
+// The version is higher than the one of the USB mass storage driver, so
+// that devices which support both protocols are driven through UAS.
+//
+EFI_DRIVER_BINDING_PROTOCOL gUsbUasDriverBinding = {
+  UsbUasDriverBindingSupported,
+  UsbUasDriverBindingStart,
+  UsbUasDriverBindingStop,
+  0x20,
+  NULL,
+  NULL
+};
+
+/**
+  Find the UAS alternate setting of an interface and its pipes.
+
+  @param  UsbIo             The USB IO protocol of the interface.
+  @param  InterfaceNumber   The interface number.
+  @param  AlternateSetting  Returns the UAS alternate setting.
+  @param  Pipes             Returns the endpoint addresses indexed by pipe ID - 1.
+
+  @retval EFI_SUCCESS       The UAS alternate setting was found.
+  @retval EFI_UNSUPPORTED   The interface has no usable UAS alternate setting.
+  @retval Others            The configuration descriptor could not be read.
+
+**/
+STATIC
+EFI_STATUS
+UasParseConfigDescriptor (
+  IN  EFI_USB_IO_PROTOCOL   *UsbIo,
+  IN  UINT8                 InterfaceNumber,
+  OUT UINT8                 *AlternateSetting,
+  OUT UINT8                 *Pipes
+  )
+{
+  EFI_USB_CONFIG_DESCRIPTOR     ConfigDesc;
+  EFI_USB_DEVICE_REQUEST        Request;
+  EFI_USB_INTERFACE_DESCRIPTOR  *IfDesc;
+  USB_UAS_PIPE_USAGE_DESCRIPTOR *PipeDesc;
+  EFI_USB_DESCRIPTOR_HEADER     *Desc;
+  EFI_STATUS                    Status;
+  UINT8                         *Buffer;
+  UINT32                        Result;
+  UINTN                         Offset;
+  UINT8                         Endpoint;
+  BOOLEAN                       InUas;
+  BOOLEAN                       Found;
+
+  Status = UsbIo->UsbGetConfigDescriptor (UsbIo, &ConfigDesc);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Buffer = AllocateZeroPool (ConfigDesc.TotalLength);
+  if (Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // The configuration value of the devices we drive is the descriptor index
+  // plus one, and the USB bus driver always selects the first configuration.
+  //
+  Request.RequestType = USB_DEV_GET_DESCRIPTOR_REQ_TYPE;
+  Request.Request     = USB_REQ_GET_DESCRIPTOR;
+  Request.Value       = (UINT16) ((USB_DESC_TYPE_CONFIG << 8) | (ConfigDesc.ConfigurationValue - 1));
+  Request.Index       = 0;
+  Request.Length      = ConfigDesc.TotalLength;
+
+  Status = UsbIo->UsbControlTransfer (
+                    UsbIo,
+                    &Request,
+                    EfiUsbDataIn,
+                    USB_UAS_GENERIC_TIMEOUT,
+                    Buffer,
+                    ConfigDesc.TotalLength,
+                    &Result
+                    );
+  if (EFI_ERROR (Status)) {
+    FreePool (Buffer);
+    return Status;
+  }
+
+  InUas    = FALSE;
+  Found    = FALSE;
+  Endpoint = 0;
+  Offset   = 0;
+
+  while (Offset + sizeof (EFI_USB_DESCRIPTOR_HEADER) <= ConfigDesc.TotalLength) {
+    Desc = (EFI_USB_DESCRIPTOR_HEADER *) (Buffer + Offset);
+    if ((Desc->Len < sizeof (EFI_USB_DESCRIPTOR_HEADER)) ||
+        (Offset + Desc->Len > ConfigDesc.TotalLength)) {
+      break;
+    }
+
+    if ((Desc->Type == USB_DESC_TYPE_INTERFACE) &&
+        (Desc->Len >= sizeof (EFI_USB_INTERFACE_DESCRIPTOR))) {
+      if (Found) {
+        break;
+      }
+
+      IfDesc = (EFI_USB_INTERFACE_DESCRIPTOR *) Desc;
+      InUas  = (BOOLEAN) ((IfDesc->InterfaceNumber == InterfaceNumber) &&
+                          (IfDesc->InterfaceClass == USB_UAS_CLASS) &&
+                          (IfDesc->InterfaceSubClass == USB_UAS_SUBCLASS_SCSI) &&
+                          (IfDesc->InterfaceProtocol == USB_UAS_PROTOCOL) &&
+                          (IfDesc->NumEndpoints >= 4));
+      if (InUas) {
+        *AlternateSetting = IfDesc->AlternateSetting;
+        ZeroMem (Pipes, USB_UAS_PIPE_DATA_OUT);
+        Found = TRUE;
+      }
+      Endpoint = 0;
+    } else if (InUas && (Desc->Type == USB_DESC_TYPE_ENDPOINT)) {
+      Endpoint = ((EFI_USB_ENDPOINT_DESCRIPTOR *) Desc)->EndpointAddress;
+    } else if (InUas && (Desc->Type == USB_UAS_DESC_TYPE_PIPE_USAGE) &&
+               (Desc->Len >= sizeof (USB_UAS_PIPE_USAGE_DESCRIPTOR))) {
+      PipeDesc = (USB_UAS_PIPE_USAGE_DESCRIPTOR *) Desc;
+      if ((Endpoint != 0) &&
+          (PipeDesc->PipeId >= USB_UAS_PIPE_COMMAND) &&
+          (PipeDesc->PipeId <= USB_UAS_PIPE_DATA_OUT)) {
+        Pipes[PipeDesc->PipeId - 1] = Endpoint;
+      }
+    }
+
+    Offset += Desc->Len;
+  }
+
+  FreePool (Buffer);
+
+  if (!Found ||
+      (Pipes[USB_UAS_PIPE_COMMAND - 1] == 0) ||
+      (Pipes[USB_UAS_PIPE_STATUS - 1] == 0) ||
+      (Pipes[USB_UAS_PIPE_DATA_IN - 1] == 0) ||
+      (Pipes[USB_UAS_PIPE_DATA_OUT - 1] == 0)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Select an alternate setting of the UAS interface.
+
+  @param  UasDevice         The UAS device.
+  @param  AlternateSetting  The alternate setting.
+
+  @return The status of the SET_INTERFACE request.
+
+**/
+STATIC
+EFI_STATUS
+UasSetInterface (
+  IN USB_UAS_DEVICE     *UasDevice,
+  IN UINT8              AlternateSetting
+  )
+{
+  EFI_USB_DEVICE_REQUEST  Request;
+  UINT32                  Result;
+
+  Request.RequestType = USB_DEV_SET_INTERFACE_REQ_TYPE;
+  Request.Request     = USB_REQ_SET_INTERFACE;
+  Request.Value       = AlternateSetting;
+  Request.Index       = UasDevice->InterfaceNumber;
+  Request.Length      = 0;
+
+  return UasDevice->UsbIo->UsbControlTransfer (
+                             UasDevice->UsbIo,
+                             &Request,
+                             EfiUsbNoData,
+                             USB_UAS_GENERIC_TIMEOUT,
+                             NULL,
+                             0,
+                             &Result
+                             );
+}
+
+/**
+  Run a single bulk transfer through EFI_USB_IO_PROTOCOL.
+
+  @param  UasDevice       The UAS device.
+  @param  Endpoint        The bulk endpoint address.
+  @param  Data            The data buffer.
+  @param  DataLength      On input, the size of Data. On output, the number of
+                          bytes transferred.
+  @param  Timeout         The timeout, in milliseconds.
+
+  @return The status of the bulk transfer.
+
+**/
+STATIC
+EFI_STATUS
+UasBulkTransfer (
+  IN     USB_UAS_DEVICE     *UasDevice,
+  IN     UINT8              Endpoint,
+  IN     VOID               *Data,
+  IN OUT UINTN              *DataLength,
+  IN     UINTN              Timeout
+  )
+{
+  EFI_STATUS  Status;
+  UINT32      Result;
+
+  Result = 0;
+  Status = UasDevice->UsbIo->UsbBulkTransfer (
+                               UasDevice->UsbIo,
+                               Endpoint,
+                               Data,
+                               DataLength,
+                               Timeout,
+                               &Result
+                               );
+  if ((Result & EFI_USB_ERR_STALL) != 0) {
+    UsbClearEndpointHalt (UasDevice->UsbIo, Endpoint, &Result);
+  }
+
+  return Status;
+}
+
+/**
+  Decode the status IU received for a command.
+
+  @param  Command         The command slot.
+
+  @retval EFI_SUCCESS     The command completed with GOOD status.
+  @retval Others          The command failed.
+
+**/
+STATIC
+EFI_STATUS
+UasDecodeStatus (
+  IN USB_UAS_COMMAND    *Command
+  )
+{
+  USB_UAS_SENSE_IU      *SenseIu;
+  EFI_SCSI_SENSE_DATA   *Sense;
+  UINTN                 SenseLength;
+
+  SenseIu = (USB_UAS_SENSE_IU *) Command->StatusBuffer;
+
+  if ((Command->StatusLength < OFFSET_OF (USB_UAS_SENSE_IU, SenseData)) ||
+      (SwapBytes16 (SenseIu->Tag) != Command->Tag)) {
+    DEBUG ((EFI_D_ERROR, "UasDecodeStatus: bad status IU for tag %d\n", Command->Tag));
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (SenseIu->IuId == USB_UAS_IU_RESPONSE) {
+    DEBUG ((EFI_D_ERROR, "UasDecodeStatus: tag %d response code 0x%x\n",
+      Command->Tag, ((USB_UAS_RESPONSE_IU *) SenseIu)->ResponseCode));
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (SenseIu->IuId != USB_UAS_IU_SENSE) {
+    DEBUG ((EFI_D_ERROR, "UasDecodeStatus: unexpected IU 0x%x for tag %d\n",
+      SenseIu->IuId, Command->Tag));
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (SenseIu->Status == USB_UAS_STATUS_GOOD) {
+    return EFI_SUCCESS;
+  }
+
+  SenseLength = SwapBytes16 (SenseIu->SenseLength);
+  if ((SenseIu->Status == USB_UAS_STATUS_CHECK_CONDITION) &&
+      (SenseLength >= OFFSET_OF (EFI_SCSI_SENSE_DATA, Addnl_Sense_Code_Qualifier)) &&
+      (Command->StatusLength >= OFFSET_OF (USB_UAS_SENSE_IU, SenseData) + OFFSET_OF (EFI_SCSI_SENSE_DATA, Addnl_Sense_Code_Qualifier))) {
+    Sense             = (EFI_SCSI_SENSE_DATA *) SenseIu->SenseData;
+    Command->SenseKey = Sense->Sense_Key;
+    Command->Asc      = Sense->Addnl_Sense_Code;
+  }
+
+  DEBUG ((EFI_D_VERBOSE, "UasDecodeStatus: tag %d status 0x%x sense %x/%x\n",
+    Command->Tag, SenseIu->Status, Command->SenseKey, Command->Asc));
+
+  return EFI_DEVICE_ERROR;
+}
+
+/**
+  Run a command one IU at a time through EFI_USB_IO_PROTOCOL, for devices
+  without bulk streams. The device announces the data phase with a Read Ready
+  or Write Ready IU on the status pipe.
+
+  @param  UasDevice       The UAS device.
+  @param  Command         The command slot.
+  @param  Timeout         The timeout, in milliseconds.
+
+  @return The status of the command.
+
+**/
+STATIC
+EFI_STATUS
+UasRunCommandSync (
+  IN USB_UAS_DEVICE     *UasDevice,
+  IN USB_UAS_COMMAND    *Command,
+  IN UINTN              Timeout
+  )
+{
+  USB_UAS_READY_IU  *ReadyIu;
+  EFI_STATUS        Status;
+  UINTN             Length;
+
+  Length = sizeof (USB_UAS_COMMAND_IU);
+  Status = UasBulkTransfer (UasDevice, UasDevice->CommandPipe, Command->CommandIu, &Length, Timeout);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  ReadyIu = (USB_UAS_READY_IU *) Command->StatusBuffer;
+
+  Command->StatusLength = USB_UAS_STATUS_BUFFER_SIZE;
+  Status = UasBulkTransfer (UasDevice, UasDevice->StatusPipe, Command->StatusBuffer,
+             &Command->StatusLength, Timeout);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((Command->StatusLength >= sizeof (USB_UAS_READY_IU)) &&
+      ((ReadyIu->IuId == USB_UAS_IU_READ_READY) || (ReadyIu->IuId == USB_UAS_IU_WRITE_READY))) {
+    if ((Command->DataLength == 0) ||
+        (Command->DataIn != (BOOLEAN) (ReadyIu->IuId == USB_UAS_IU_READ_READY))) {
+      return EFI_DEVICE_ERROR;
+    }
+
+    Length = Command->DataLength;
+    Status = UasBulkTransfer (
+               UasDevice,
+               Command->DataIn ? UasDevice->DataInPipe : UasDevice->DataOutPipe,
+               Command->Data,
+               &Length,
+               Timeout
+               );
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+    Command->DataTransferred = Length;
+
+    Command->StatusLength = USB_UAS_STATUS_BUFFER_SIZE;
+    Status = UasBulkTransfer (UasDevice, UasDevice->StatusPipe, Command->StatusBuffer,
+               &Command->StatusLength, Timeout);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  return UasDecodeStatus (Command);
+}
+
+/**
+  Release the stream transfers of a command that are still outstanding.
+
+  @param  UasDevice       The UAS device.
+  @param  Command         The command slot.
+
+**/
+STATIC
+VOID
+UasCancelTransfers (
+  IN USB_UAS_DEVICE     *UasDevice,
+  IN USB_UAS_COMMAND    *Command
+  )
+{
+  ROCKCHIP_USB_STREAM_PROTOCOL  *UsbStream;
+
+  UsbStream = UasDevice->UsbStream;
+
+  if (Command->CommandTransfer != NULL) {
+    UsbStream->Cancel (UsbStream, Command->CommandTransfer);
+    Command->CommandTransfer = NULL;
+  }
+  if (Command->DataTransfer != NULL) {
+    UsbStream->Cancel (UsbStream, Command->DataTransfer);
+    Command->DataTransfer = NULL;
+  }
+  if (Command->StatusTransfer != NULL) {
+    UsbStream->Cancel (UsbStream, Command->StatusTransfer);
+    Command->StatusTransfer = NULL;
+  }
+}
+
+/**
+  Release a command slot.
+
+  @param  UasDevice       The UAS device.
+  @param  Command         The command slot.
+
+**/
+STATIC
+VOID
+UasReleaseCommand (
+  IN USB_UAS_DEVICE     *UasDevice,
+  IN USB_UAS_COMMAND    *Command
+  )
+{
+  gBS->SetTimer (Command->TimeoutEvent, TimerCancel, 0);
+  Command->InUse   = FALSE;
+  Command->Request = NULL;
+}
+
+/**
+  Wait for a stream transfer to complete, and cancel it on timeout.
+
+  @param  UasDevice       The UAS device.
+  @param  Transfer        The transfer handle, set to NULL on return.
+  @param  DataLength      Returns the number of bytes transferred.
+  @param  Timeout         The timeout, in milliseconds.
+
+  @return The status of the transfer, EFI_TIMEOUT if it was cancelled.
+
+**/
+STATIC
+EFI_STATUS
+UasWaitTransfer (
+  IN     USB_UAS_DEVICE     *UasDevice,
+  IN OUT VOID               **Transfer,
+  OUT    UINTN              *DataLength,
+  IN     UINTN              Timeout
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Elapsed;
+  UINT32      Result;
+
+  for (Elapsed = 0; Elapsed <= Timeout; Elapsed++) {
+    Status = UasDevice->UsbStream->Poll (UasDevice->UsbStream, *Transfer, DataLength, &Result);
+    if (Status != EFI_NOT_READY) {
+      *Transfer = NULL;
+      return Status;
+    }
+    gBS->Stall (1000);
+  }
+
+  UasDevice->UsbStream->Cancel (UasDevice->UsbStream, *Transfer);
+  *Transfer = NULL;
+  return EFI_TIMEOUT;
+}
+
+/**
+  Run a task management function and check the Response IU of the device.
+
+  @param  UasDevice       The UAS device.
+  @param  Function        The task management function, USB_UAS_TMF_*.
+  @param  ManagedTag      The tag of the task to manage, 0 if the function
+                          applies to the logical unit.
+
+  @retval EFI_SUCCESS     The device completed the function.
+  @retval Others          The function failed or was not answered.
+
+**/
+STATIC
+EFI_STATUS
+UasTaskManagement (
+  IN USB_UAS_DEVICE     *UasDevice,
+  IN UINT8              Function,
+  IN UINT16             ManagedTag
+  )
+{
+  ROCKCHIP_USB_STREAM_PROTOCOL  *UsbStream;
+  USB_UAS_TASK_MANAGEMENT_IU    *TaskIu;
+  USB_UAS_RESPONSE_IU           *Response;
+  VOID                          *IuTransfer;
+  VOID                          *StatusTransfer;
+  EFI_STATUS                    Status;
+  UINTN                         Length;
+  UINTN                         StatusLength;
+  UINT16                        Tag;
+
+  Tag    = (UINT16) (UasDevice->QueueDepth + 1);
+  TaskIu = UasDevice->TaskIu;
+  ZeroMem (TaskIu, sizeof (USB_UAS_TASK_MANAGEMENT_IU));
+  TaskIu->IuId       = USB_UAS_IU_TASK_MANAGEMENT;
+  TaskIu->Tag        = SwapBytes16 (Tag);
+  TaskIu->Function   = Function;
+  TaskIu->ManagedTag = SwapBytes16 (ManagedTag);
+
+  StatusLength = 0;
+  UsbStream    = UasDevice->UsbStream;
+  if (UsbStream == NULL) {
+    Length = sizeof (USB_UAS_TASK_MANAGEMENT_IU);
+    Status = UasBulkTransfer (UasDevice, UasDevice->CommandPipe, TaskIu, &Length, USB_UAS_GENERIC_TIMEOUT);
+    if (!EFI_ERROR (Status)) {
+      StatusLength = USB_UAS_STATUS_BUFFER_SIZE;
+      Status = UasBulkTransfer (UasDevice, UasDevice->StatusPipe, UasDevice->TaskStatus,
+                 &StatusLength, USB_UAS_GENERIC_TIMEOUT);
+    }
+  } else {
+    //
+    // As for a command, the Response IU is queued on the stream of the tag
+    // before the IU is sent.
+    //
+    IuTransfer     = NULL;
+    StatusTransfer = NULL;
+    Status = UsbStream->Submit (
+                          UsbStream,
+                          UasDevice->DeviceAddress,
+                          UasDevice->StatusPipe,
+                          Tag,
+                          UasDevice->TaskStatus,
+                          USB_UAS_STATUS_BUFFER_SIZE,
+                          &StatusTransfer
+                          );
+    if (!EFI_ERROR (Status)) {
+      Status = UsbStream->Submit (
+                            UsbStream,
+                            UasDevice->DeviceAddress,
+                            UasDevice->CommandPipe,
+                            0,
+                            TaskIu,
+                            sizeof (USB_UAS_TASK_MANAGEMENT_IU),
+                            &IuTransfer
+                            );
+    }
+    if (!EFI_ERROR (Status)) {
+      Status = UasWaitTransfer (UasDevice, &IuTransfer, &Length, USB_UAS_GENERIC_TIMEOUT);
+    }
+    if (!EFI_ERROR (Status)) {
+      Status = UasWaitTransfer (UasDevice, &StatusTransfer, &StatusLength, USB_UAS_GENERIC_TIMEOUT);
+    }
+    if (StatusTransfer != NULL) {
+      UsbStream->Cancel (UsbStream, StatusTransfer);
+    }
+  }
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Response = (USB_UAS_RESPONSE_IU *) UasDevice->TaskStatus;
+  if ((StatusLength < sizeof (USB_UAS_RESPONSE_IU)) ||
+      (Response->IuId != USB_UAS_IU_RESPONSE) ||
+      (SwapBytes16 (Response->Tag) != Tag)) {
+    DEBUG ((EFI_D_ERROR, "UasTaskManagement: bad response IU for function 0x%x\n", Function));
+    return EFI_DEVICE_ERROR;
+  }
+
+  if ((Response->ResponseCode != USB_UAS_RESPONSE_TMF_COMPLETE) &&
+      (Response->ResponseCode != USB_UAS_RESPONSE_TMF_SUCCEEDED)) {
+    DEBUG ((EFI_D_ERROR, "UasTaskManagement: function 0x%x response code 0x%x\n",
+      Function, Response->ResponseCode));
+    return EFI_DEVICE_ERROR;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Start a command on a free slot.
+
+  @param  UasDevice       The UAS device.
+  @param  Command         The free command slot.
+  @param  Cdb             The SCSI command descriptor block.
+  @param  CdbLength       The length of Cdb, at most 16 bytes.
+  @param  Data            The data buffer, NULL if there is no data phase.
+  @param  DataLength      The length of Data.
+  @param  DataIn          TRUE if the data is read from the device.
+  @param  Timeout         The command timeout, in milliseconds.
+
+  @retval EFI_SUCCESS     The command was started. Its result is collected
+                          with UasCheckCommand.
+  @retval Others          The command could not be started.
+
+**/
+EFI_STATUS
+UasStartCommand (
+  IN USB_UAS_DEVICE     *UasDevice,
+  IN USB_UAS_COMMAND    *Command,
+  IN UINT8              *Cdb,
+  IN UINT8              CdbLength,
+  IN VOID               *Data,
+  IN UINTN              DataLength,
+  IN BOOLEAN            DataIn,
+  IN UINTN              Timeout
+  )
+{
+  ROCKCHIP_USB_STREAM_PROTOCOL  *UsbStream;
+  USB_UAS_COMMAND_IU            *CommandIu;
+  EFI_STATUS                    Status;
+
+  ASSERT (!Command->InUse);
+  ASSERT (CdbLength <= sizeof (CommandIu->Cdb));
+
+  CommandIu = Command->CommandIu;
+  ZeroMem (CommandIu, sizeof (USB_UAS_COMMAND_IU));
+  CommandIu->IuId = USB_UAS_IU_COMMAND;
+  CommandIu->Tag  = SwapBytes16 (Command->Tag);
+  CopyMem (CommandIu->Cdb, Cdb, CdbLength);
+
+  Command->InUse           = TRUE;
+  Command->Data            = Data;
+  Command->DataLength      = (Data == NULL) ? 0 : DataLength;
+  Command->DataIn          = DataIn;
+  Command->Status          = EFI_NOT_READY;
+  Command->DataTransferred = 0;
+  Command->StatusLength    = 0;
+  Command->SenseKey        = 0;
+  Command->Asc             = 0;
+
+  UsbStream = UasDevice->UsbStream;
+  if (UsbStream == NULL) {
+    //
+    // Without streams the command runs to completion here, the result is
+    // handed out by the next UasCheckCommand.
+    //
+    Command->Status = UasRunCommandSync (UasDevice, Command, Timeout);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Queue the status and data transfers on the stream of the tag before
+  // sending the command, the device may answer as soon as it has the IU.
+  //
+  Status = UsbStream->Submit (
+                        UsbStream,
+                        UasDevice->DeviceAddress,
+                        UasDevice->StatusPipe,
+                        Command->Tag,
+                        Command->StatusBuffer,
+                        USB_UAS_STATUS_BUFFER_SIZE,
+                        &Command->StatusTransfer
+                        );
+  if (EFI_ERROR (Status)) {
+    goto ON_ERROR;
+  }
+
+  if (Command->DataLength != 0) {
+    Status = UsbStream->Submit (
+                          UsbStream,
+                          UasDevice->DeviceAddress,
+                          DataIn ? UasDevice->DataInPipe : UasDevice->DataOutPipe,
+                          Command->Tag,
+                          Data,
+                          DataLength,
+                          &Command->DataTransfer
+                          );
+    if (EFI_ERROR (Status)) {
+      goto ON_ERROR;
+    }
+  }
+
+  Status = UsbStream->Submit (
+                        UsbStream,
+                        UasDevice->DeviceAddress,
+                        UasDevice->CommandPipe,
+                        0,
+                        CommandIu,
+                        sizeof (USB_UAS_COMMAND_IU),
+                        &Command->CommandTransfer
+                        );
+  if (EFI_ERROR (Status)) {
+    goto ON_ERROR;
+  }
+
+  gBS->SetTimer (Command->TimeoutEvent, TimerRelative, EFI_TIMER_PERIOD_MILLISECONDS (Timeout));
+  return EFI_SUCCESS;
+
+ON_ERROR:
+  DEBUG ((EFI_D_ERROR, "UasStartCommand: failed to queue tag %d - %r\n", Command->Tag, Status));
+  UasCancelTransfers (UasDevice, Command);
+  UasReleaseCommand (UasDevice, Command);
+  return Status;
+}
+
+/**
+  Poll one stream transfer of a command.
+
+  @param  UasDevice       The UAS device.
+  @param  Command         The command slot.
+  @param  Transfer        The transfer handle, set to NULL once completed.
+  @param  DataLength      Returns the number of bytes transferred. Optional.
+
+**/
+STATIC
+VOID
+UasPollTransfer (
+  IN     USB_UAS_DEVICE     *UasDevice,
+  IN     USB_UAS_COMMAND    *Command,
+  IN OUT VOID               **Transfer,
+  OUT    UINTN              *DataLength  OPTIONAL
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Length;
+  UINT32      Result;
+
+  if (*Transfer == NULL) {
+    return;
+  }
+
+  Status = UasDevice->UsbStream->Poll (UasDevice->UsbStream, *Transfer, &Length, &Result);
+  if (Status == EFI_NOT_READY) {
+    return;
+  }
+
+  *Transfer = NULL;
+  if (DataLength != NULL) {
+    *DataLength = Length;
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "UasPollTransfer: tag %d transfer error 0x%x\n", Command->Tag, Result));
+    Command->Status = Status;
+  }
+}
+
+/**
+  Check whether a started command has completed, and release its slot if so.
+
+  @param  UasDevice       The UAS device.
+  @param  Command         The command slot.
+
+  @retval EFI_NOT_READY   The command is still running.
+  @retval Others          The final status of the command.
+
+**/
+EFI_STATUS
+UasCheckCommand (
+  IN USB_UAS_DEVICE     *UasDevice,
+  IN USB_UAS_COMMAND    *Command
+  )
+{
+  EFI_STATUS  Status;
+
+  ASSERT (Command->InUse);
+
+  if (UasDevice->UsbStream != NULL) {
+    UasPollTransfer (UasDevice, Command, &Command->CommandTransfer, NULL);
+    UasPollTransfer (UasDevice, Command, &Command->DataTransfer, &Command->DataTransferred);
+    UasPollTransfer (UasDevice, Command, &Command->StatusTransfer, &Command->StatusLength);
+
+    if ((Command->CommandTransfer != NULL) ||
+        (Command->DataTransfer != NULL) ||
+        (Command->StatusTransfer != NULL)) {
+      if (!EFI_ERROR (gBS->CheckEvent (Command->TimeoutEvent))) {
+        DEBUG ((EFI_D_ERROR, "UasCheckCommand: tag %d timed out\n", Command->Tag));
+        UasAbortCommand (UasDevice, Command);
+        return EFI_TIMEOUT;
+      }
+      if (Command->Status == EFI_NOT_READY) {
+        return EFI_NOT_READY;
+      }
+
+      //
+      // One of the transfers failed, the others will not complete.
+      //
+      UasCancelTransfers (UasDevice, Command);
+    }
+
+    if (Command->Status == EFI_NOT_READY) {
+      Command->Status = UasDecodeStatus (Command);
+    }
+  } else if (Command->Status == EFI_TIMEOUT) {
+    //
+    // The IU exchange of the command timed out, the device may still run it.
+    //
+    UasAbortCommand (UasDevice, Command);
+    return EFI_TIMEOUT;
+  }
+
+  Status = Command->Status;
+  UasReleaseCommand (UasDevice, Command);
+  return Status;
+}
+
+/**
+  Abort a started command and release its slot.
+
+  @param  UasDevice       The UAS device.
+  @param  Command         The command slot.
+
+**/
+VOID
+UasAbortCommand (
+  IN USB_UAS_DEVICE     *UasDevice,
+  IN USB_UAS_COMMAND    *Command
+  )
+{
+  EFI_STATUS  Status;
+
+  if (!Command->InUse) {
+    return;
+  }
+
+  if (UasDevice->UsbStream != NULL) {
+    UasCancelTransfers (UasDevice, Command);
+  }
+
+  //
+  // The device may still run the command and complete it on the stream of
+  // its tag, so the slot is only released once the device dropped the task.
+  //
+  Status = UasTaskManagement (UasDevice, USB_UAS_TMF_ABORT_TASK, Command->Tag);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "UasAbortCommand: ABORT TASK for tag %d failed - %r\n", Command->Tag, Status));
+    UasResetLogicalUnit (UasDevice);
+  }
+
+  UasReleaseCommand (UasDevice, Command);
+}
+
+/**
+  Execute a command and wait for it to complete.
+
+  @param  UasDevice       The UAS device.
+  @param  Cdb             The SCSI command descriptor block.
+  @param  CdbLength       The length of Cdb, at most 16 bytes.
+  @param  Data            The data buffer, NULL if there is no data phase.
+  @param  DataLength      On input, the length of Data. On output, the number
+                          of bytes transferred.
+  @param  DataIn          TRUE if the data is read from the device.
+  @param  Timeout         The command timeout, in milliseconds.
+  @param  SenseKey        Returns the sense key on CHECK CONDITION. Optional.
+
+  @retval EFI_SUCCESS     The command completed with GOOD status.
+  @retval Others          The command failed.
+
+**/
+EFI_STATUS
+UasExecuteCommand (
+  IN     USB_UAS_DEVICE     *UasDevice,
+  IN     UINT8              *Cdb,
+  IN     UINT8              CdbLength,
+  IN     VOID               *Data,
+  IN OUT UINTN              *DataLength,
+  IN     BOOLEAN            DataIn,
+  IN     UINTN              Timeout,
+  OUT    UINT8              *SenseKey  OPTIONAL
+  )
+{
+  USB_UAS_COMMAND   *Command;
+  EFI_STATUS        Status;
+  EFI_TPL           OldTpl;
+  UINTN             Index;
+  UINTN             Stale;
+
+  OldTpl  = gBS->RaiseTPL (USB_UAS_TPL);
+  Command = NULL;
+
+  //
+  // Wait for a slot, completing queued block requests meanwhile.
+  //
+  while (TRUE) {
+    Stale = 0;
+    for (Index = 0; Index < UasDevice->QueueDepth; Index++) {
+      if (UasDevice->Commands[Index].Stale) {
+        Stale++;
+      } else if (!UasDevice->Commands[Index].InUse) {
+        Command = &UasDevice->Commands[Index];
+        break;
+      }
+    }
+    if (Command != NULL) {
+      break;
+    }
+    if (Stale == UasDevice->QueueDepth) {
+      gBS->RestoreTPL (OldTpl);
+      return EFI_DEVICE_ERROR;
+    }
+    UasProcessRequests (UasDevice);
+  }
+
+  Status = UasStartCommand (
+             UasDevice,
+             Command,
+             Cdb,
+             CdbLength,
+             Data,
+             (DataLength == NULL) ? 0 : *DataLength,
+             DataIn,
+             Timeout
+             );
+  if (!EFI_ERROR (Status)) {
+    while ((Status = UasCheckCommand (UasDevice, Command)) == EFI_NOT_READY) {
+      UasProcessRequests (UasDevice);
+    }
+  }
+
+  if (DataLength != NULL) {
+    *DataLength = Command->DataTransferred;
+  }
+  if (SenseKey != NULL) {
+    *SenseKey = Command->SenseKey;
+  }
+
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  Set up the pipes: allocate bulk streams on a SuperSpeed device if the host
+  controller supports them, and size the command queue accordingly.
+
+  @param  UasDevice       The UAS device.
+
+**/
+STATIC
+VOID
+UasInitPipes (
+  IN USB_UAS_DEVICE     *UasDevice
+  )
+{
+  ROCKCHIP_USB_STREAM_PROTOCOL  *UsbStream;
+  EFI_DEVICE_PATH_PROTOCOL      *RemainingDevicePath;
+  EFI_HANDLE                    HcHandle;
+  EFI_STATUS                    Status;
+  UINT8                         Endpoints[3];
+  UINT8                         Speed;
+  UINT16                        NumStreams;
+
+  UasDevice->UsbStream  = NULL;
+  UasDevice->QueueDepth = 1;
+
+  RemainingDevicePath = UasDevice->DevicePath;
+  Status = gBS->LocateDevicePath (&gRockchipUsbStreamProtocolGuid, &RemainingDevicePath, &HcHandle);
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  Status = gBS->HandleProtocol (HcHandle, &gRockchipUsbStreamProtocolGuid, (VOID **) &UsbStream);
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  Status = UsbStream->GetDevice (UsbStream, RemainingDevicePath, &UasDevice->DeviceAddress, &Speed);
+  if (EFI_ERROR (Status) || (Speed != EFI_USB_SPEED_SUPER)) {
+    return;
+  }
+
+  Endpoints[0] = UasDevice->StatusPipe;
+  Endpoints[1] = UasDevice->DataInPipe;
+  Endpoints[2] = UasDevice->DataOutPipe;
+  NumStreams   = USB_UAS_MAX_QUEUE_DEPTH + 1;
+
+  Status = UsbStream->AllocateStreams (
+                        UsbStream,
+                        UasDevice->DeviceAddress,
+                        Endpoints,
+                        ARRAY_SIZE (Endpoints),
+                        &NumStreams
+                        );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_INFO, "UasInitPipes: no bulk streams - %r, using one command at a time\n", Status));
+    return;
+  }
+
+  //
+  // One stream is kept for task management.
+  //
+  if (NumStreams < 2) {
+    UsbStream->FreeStreams (UsbStream, UasDevice->DeviceAddress, Endpoints, ARRAY_SIZE (Endpoints));
+    DEBUG ((EFI_D_INFO, "UasInitPipes: %d stream, using one command at a time\n", NumStreams));
+    return;
+  }
+
+  UasDevice->UsbStream  = UsbStream;
+  UasDevice->NumStreams = NumStreams;
+  UasDevice->QueueDepth = MIN (NumStreams - 1, USB_UAS_MAX_QUEUE_DEPTH);
+
+  DEBUG ((EFI_D_INFO, "UasInitPipes: %d streams, queue depth %d\n", NumStreams, UasDevice->QueueDepth));
+}
+
+/**
+  Return the streams to the host controller.
+
+  @param  UasDevice       The UAS device.
+
+**/
+STATIC
+VOID
+UasFreePipes (
+  IN USB_UAS_DEVICE     *UasDevice
+  )
+{
+  UINT8   Endpoints[3];
+
+  if (UasDevice->UsbStream == NULL) {
+    return;
+  }
+
+  Endpoints[0] = UasDevice->StatusPipe;
+  Endpoints[1] = UasDevice->DataInPipe;
+  Endpoints[2] = UasDevice->DataOutPipe;
+
+  UasDevice->UsbStream->FreeStreams (
+                          UasDevice->UsbStream,
+                          UasDevice->DeviceAddress,
+                          Endpoints,
+                          ARRAY_SIZE (Endpoints)
+                          );
+  UasDevice->UsbStream = NULL;
+}
+
+/**
+  Reset the status and data pipes, once no task is left on the device.
+
+  Clearing the halt feature resets the endpoints of the device, with all
+  their streams. On the host side, configuring the streams again resets
+  the endpoint contexts and starts every stream on an empty ring.
+
+  @param  UasDevice       The UAS device.
+
+**/
+STATIC
+VOID
+UasResetPipes (
+  IN USB_UAS_DEVICE     *UasDevice
+  )
+{
+  UINT32  Result;
+
+  UsbClearEndpointHalt (UasDevice->UsbIo, UasDevice->StatusPipe, &Result);
+  UsbClearEndpointHalt (UasDevice->UsbIo, UasDevice->DataInPipe, &Result);
+  UsbClearEndpointHalt (UasDevice->UsbIo, UasDevice->DataOutPipe, &Result);
+
+  if (UasDevice->UsbStream != NULL) {
+    UasFreePipes (UasDevice);
+    UasInitPipes (UasDevice);
+  }
+}
+
+/**
+  Reset the logical unit and the pipes. The commands still in flight are
+  cancelled and finish with EFI_ABORTED on their next UasCheckCommand.
+
+  @param  UasDevice       The UAS device.
+
+  @retval EFI_SUCCESS     The logical unit was reset.
+  @retval Others          The device did not take the reset, the slots of
+                          the cancelled commands are stale.
+
+**/
+EFI_STATUS
+UasResetLogicalUnit (
+  IN USB_UAS_DEVICE     *UasDevice
+  )
+{
+  USB_UAS_COMMAND   *Command;
+  EFI_STATUS        Status;
+  UINTN             Index;
+
+  for (Index = 0; Index < ARRAY_SIZE (UasDevice->Commands); Index++) {
+    Command = &UasDevice->Commands[Index];
+    if (!Command->InUse) {
+      continue;
+    }
+    if (UasDevice->UsbStream != NULL) {
+      UasCancelTransfers (UasDevice, Command);
+    }
+    if ((Command->Status == EFI_NOT_READY) || (Command->Status == EFI_TIMEOUT)) {
+      Command->Status = EFI_ABORTED;
+    }
+  }
+
+  Status = UasTaskManagement (UasDevice, USB_UAS_TMF_LOGICAL_UNIT_RESET, 0);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "UasResetLogicalUnit: LOGICAL UNIT RESET failed - %r\n", Status));
+    for (Index = 0; Index < ARRAY_SIZE (UasDevice->Commands); Index++) {
+      if (UasDevice->Commands[Index].InUse) {
+        UasDevice->Commands[Index].Stale = TRUE;
+      }
+    }
+    return Status;
+  }
+
+  UasResetPipes (UasDevice);
+
+  for (Index = 0; Index < ARRAY_SIZE (UasDevice->Commands); Index++) {
+    UasDevice->Commands[Index].Stale = FALSE;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Free the resources of a UAS device.
+
+  @param  UasDevice       The UAS device.
+
+**/
+STATIC
+VOID
+UasFreeDevice (
+  IN USB_UAS_DEVICE     *UasDevice
+  )
+{
+  USB_UAS_COMMAND   *Command;
+  UINTN             Index;
+
+  if (UasDevice->PollTimer != NULL) {
+    gBS->CloseEvent (UasDevice->PollTimer);
+  }
+
+  for (Index = 0; Index < USB_UAS_MAX_QUEUE_DEPTH; Index++) {
+    Command = &UasDevice->Commands[Index];
+    if (Command->TimeoutEvent != NULL) {
+      gBS->CloseEvent (Command->TimeoutEvent);
+    }
+    if (Command->CommandIu != NULL) {
+      FreePool (Command->CommandIu);
+    }
+    if (Command->StatusBuffer != NULL) {
+      FreePool (Command->StatusBuffer);
+    }
+  }
+
+  if (UasDevice->TaskIu != NULL) {
+    FreePool (UasDevice->TaskIu);
+  }
+  if (UasDevice->TaskStatus != NULL) {
+    FreePool (UasDevice->TaskStatus);
+  }
+
+  FreePool (UasDevice);
+}
+
+/**
+  Tests to see if this driver supports a given controller.
+
+  @param  This                 The driver binding protocol.
+  @param  Controller           The handle of the controller to test.
+  @param  RemainingDevicePath  The remaining device path.
+
+  @retval EFI_SUCCESS          The driver supports this controller.
+  @retval other                This driver does not support this controller.
+
+**/
+EFI_STATUS
+EFIAPI
+UsbUasDriverBindingSupported (
+  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN EFI_HANDLE                   Controller,
+  IN EFI_DEVICE_PATH_PROTOCOL     *RemainingDevicePath
+  )
+{
+  EFI_USB_INTERFACE_DESCRIPTOR  IfDesc;
+  EFI_USB_IO_PROTOCOL           *UsbIo;
+  EFI_STATUS                    Status;
+  UINT8                         AlternateSetting;
+  UINT8                         Pipes[USB_UAS_PIPE_DATA_OUT];
+
+  Status = gBS->OpenProtocol (
+                  Controller,
+                  &gEfiUsbIoProtocolGuid,
+                  (VOID **) &UsbIo,
+                  This->DriverBindingHandle,
+                  Controller,
+                  EFI_OPEN_PROTOCOL_BY_DRIVER
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = UsbIo->UsbGetInterfaceDescriptor (UsbIo, &IfDesc);
+  if (EFI_ERROR (Status)) {
+    goto ON_EXIT;
+  }
+
+  //
+  // Only look at the full configuration of mass storage interfaces.
+  //
+  if (IfDesc.InterfaceClass != USB_UAS_CLASS) {
+    Status = EFI_UNSUPPORTED;
+    goto ON_EXIT;
+  }
+
+  Status = UasParseConfigDescriptor (UsbIo, IfDesc.InterfaceNumber, &AlternateSetting, Pipes);
+
+ON_EXIT:
+  gBS->CloseProtocol (
+         Controller,
+         &gEfiUsbIoProtocolGuid,
+         This->DriverBindingHandle,
+         Controller
+         );
+  return Status;
+}
+
+/**
+  Starts the UAS device with this driver.
+
+  @param  This                 The driver binding protocol.
+  @param  Controller           The USB interface handle to start.
+  @param  RemainingDevicePath  The remaining device path.
+
+  @retval EFI_SUCCESS          The device was started and BlockIo installed.
+  @retval other                The device could not be started.
+
+**/
+EFI_STATUS
+EFIAPI
+UsbUasDriverBindingStart (
+  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN EFI_HANDLE                   Controller,
+  IN EFI_DEVICE_PATH_PROTOCOL     *RemainingDevicePath
+  )
+{
+  EFI_USB_INTERFACE_DESCRIPTOR  IfDesc;
+  USB_UAS_DEVICE                *UasDevice;
+  USB_UAS_COMMAND               *Command;
+  EFI_USB_IO_PROTOCOL           *UsbIo;
+  EFI_STATUS                    Status;
+  UINT8                         Pipes[USB_UAS_PIPE_DATA_OUT];
+  UINTN                         Index;
+
+  Status = gBS->OpenProtocol (
+                  Controller,
+                  &gEfiUsbIoProtocolGuid,
+                  (VOID **) &UsbIo,
+                  This->DriverBindingHandle,
+                  Controller,
+                  EFI_OPEN_PROTOCOL_BY_DRIVER
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  UasDevice = AllocateZeroPool (sizeof (USB_UAS_DEVICE));
+  if (UasDevice == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto ON_CLOSE;
+  }
+
+  UasDevice->Signature  = USB_UAS_DEVICE_SIGNATURE;
+  UasDevice->Controller = Controller;
+  UasDevice->UsbIo      = UsbIo;
+  InitializeListHead (&UasDevice->Requests);
+
+  Status = gBS->HandleProtocol (Controller, &gEfiDevicePathProtocolGuid, (VOID **) &UasDevice->DevicePath);
+  if (EFI_ERROR (Status)) {
+    goto ON_ERROR;
+  }
+
+  Status = UsbIo->UsbGetInterfaceDescriptor (UsbIo, &IfDesc);
+  if (EFI_ERROR (Status)) {
+    goto ON_ERROR;
+  }
+  UasDevice->InterfaceNumber = IfDesc.InterfaceNumber;
+
+  Status = UasParseConfigDescriptor (UsbIo, IfDesc.InterfaceNumber, &UasDevice->AlternateSetting, Pipes);
+  if (EFI_ERROR (Status)) {
+    goto ON_ERROR;
+  }
+  UasDevice->CommandPipe = Pipes[USB_UAS_PIPE_COMMAND - 1];
+  UasDevice->StatusPipe  = Pipes[USB_UAS_PIPE_STATUS - 1];
+  UasDevice->DataInPipe  = Pipes[USB_UAS_PIPE_DATA_IN - 1];
+  UasDevice->DataOutPipe = Pipes[USB_UAS_PIPE_DATA_OUT - 1];
+
+  for (Index = 0; Index < USB_UAS_MAX_QUEUE_DEPTH; Index++) {
+    Command               = &UasDevice->Commands[Index];
+    Command->Tag          = (UINT16) (Index + 1);
+    Command->CommandIu    = AllocateZeroPool (sizeof (USB_UAS_COMMAND_IU));
+    Command->StatusBuffer = AllocateZeroPool (USB_UAS_STATUS_BUFFER_SIZE);
+    if ((Command->CommandIu == NULL) || (Command->StatusBuffer == NULL)) {
+      Status = EFI_OUT_OF_RESOURCES;
+      goto ON_ERROR;
+    }
+
+    Status = gBS->CreateEvent (EVT_TIMER, TPL_CALLBACK, NULL, NULL, &Command->TimeoutEvent);
+    if (EFI_ERROR (Status)) {
+      goto ON_ERROR;
+    }
+  }
+
+  UasDevice->TaskIu     = AllocateZeroPool (sizeof (USB_UAS_TASK_MANAGEMENT_IU));
+  UasDevice->TaskStatus = AllocateZeroPool (USB_UAS_STATUS_BUFFER_SIZE);
+  if ((UasDevice->TaskIu == NULL) || (UasDevice->TaskStatus == NULL)) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto ON_ERROR;
+  }
+
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  USB_UAS_TPL,
+                  UasPollTimer,
+                  UasDevice,
+                  &UasDevice->PollTimer
+                  );
+  if (EFI_ERROR (Status)) {
+    goto ON_ERROR;
+  }
+
+  if (IfDesc.AlternateSetting != UasDevice->AlternateSetting) {
+    Status = UasSetInterface (UasDevice, UasDevice->AlternateSetting);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((EFI_D_ERROR, "UsbUasDriverBindingStart: failed to select UAS setting - %r\n", Status));
+      goto ON_ERROR;
+    }
+  }
+
+  UasInitPipes (UasDevice);
+
+  Status = UasInitMedia (UasDevice);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "UsbUasDriverBindingStart: no usable logical unit - %r\n", Status));
+    goto ON_RESTORE;
+  }
+
+  UasDevice->BlockIo.Revision    = EFI_BLOCK_IO_PROTOCOL_REVISION3;
+  UasDevice->BlockIo.Media       = &UasDevice->Media;
+  UasDevice->BlockIo.Reset       = UasBlockIoReset;
+  UasDevice->BlockIo.ReadBlocks  = UasBlockIoReadBlocks;
+  UasDevice->BlockIo.WriteBlocks = UasBlockIoWriteBlocks;
+  UasDevice->BlockIo.FlushBlocks = UasBlockIoFlushBlocks;
+
+  UasDevice->BlockIo2.Media          = &UasDevice->Media;
+  UasDevice->BlockIo2.Reset          = UasBlockIo2Reset;
+  UasDevice->BlockIo2.ReadBlocksEx   = UasBlockIo2ReadBlocksEx;
+  UasDevice->BlockIo2.WriteBlocksEx  = UasBlockIo2WriteBlocksEx;
+  UasDevice->BlockIo2.FlushBlocksEx  = UasBlockIo2FlushBlocksEx;
+
+  Status = gBS->InstallMultipleProtocolInterfaces (
+                  &Controller,
+                  &gEfiBlockIoProtocolGuid,
+                  &UasDevice->BlockIo,
+                  &gEfiBlockIo2ProtocolGuid,
+                  &UasDevice->BlockIo2,
+                  NULL
+                  );
+  if (EFI_ERROR (Status)) {
+    goto ON_RESTORE;
+  }
+
+  gBS->SetTimer (UasDevice->PollTimer, TimerPeriodic, USB_UAS_POLL_INTERVAL);
+
+  DEBUG ((EFI_D_INFO, "UsbUasDriverBindingStart: %lu blocks of %u bytes, %a\n",
+    UasDevice->Media.LastBlock + 1, UasDevice->Media.BlockSize,
+    (UasDevice->UsbStream != NULL) ? "streams" : "no streams"));
+  return EFI_SUCCESS;
+
+ON_RESTORE:
+  UasFreePipes (UasDevice);
+  if (IfDesc.AlternateSetting != UasDevice->AlternateSetting) {
+    UasSetInterface (UasDevice, IfDesc.AlternateSetting);
+  }
+
+ON_ERROR:
+  UasFreeDevice (UasDevice);
+
+ON_CLOSE:
+  gBS->CloseProtocol (
+         Controller,
+         &gEfiUsbIoProtocolGuid,
+         This->DriverBindingHandle,
+         Controller
+         );
+  return Status;
+}
+
+/**
+  Stop controlling the device.
+
+  @param  This                The driver binding protocol.
+  @param  Controller          The controller to release.
+  @param  NumberOfChildren    The number of children of this device that
+                              opened the controller BY_CHILD.
+  @param  ChildHandleBuffer   The array of child handle.
+
+  @retval EFI_SUCCESS         The controller is released.
+  @retval Others              Failed to release the controller.
+
+**/
+EFI_STATUS
+EFIAPI
+UsbUasDriverBindingStop (
+  IN  EFI_DRIVER_BINDING_PROTOCOL *This,
+  IN  EFI_HANDLE                  Controller,
+  IN  UINTN                       NumberOfChildren,
+  IN  EFI_HANDLE                  *ChildHandleBuffer
+  )
+{
+  EFI_BLOCK_IO_PROTOCOL   *BlockIo;
+  USB_UAS_DEVICE          *UasDevice;
+  EFI_STATUS              Status;
+  EFI_TPL                 OldTpl;
+
+  Status = gBS->OpenProtocol (
+                  Controller,
+                  &gEfiBlockIoProtocolGuid,
+                  (VOID **) &BlockIo,
+                  This->DriverBindingHandle,
+                  Controller,
+                  EFI_OPEN_PROTOCOL_GET_PROTOCOL
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  UasDevice = USB_UAS_DEVICE_FROM_BLOCK_IO (BlockIo);
+
+  Status = gBS->UninstallMultipleProtocolInterfaces (
+                  Controller,
+                  &gEfiBlockIoProtocolGuid,
+                  &UasDevice->BlockIo,
+                  &gEfiBlockIo2ProtocolGuid,
+                  &UasDevice->BlockIo2,
+                  NULL
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  gBS->SetTimer (UasDevice->PollTimer, TimerCancel, 0);
+
+  OldTpl = gBS->RaiseTPL (USB_UAS_TPL);
+  UasAbortRequests (UasDevice);
+  gBS->RestoreTPL (OldTpl);
+
+  UasFreePipes (UasDevice);
+  UasSetInterface (UasDevice, 0);
+  UasFreeDevice (UasDevice);
+
+  gBS->CloseProtocol (
+         Controller,
+         &gEfiUsbIoProtocolGuid,
+         This->DriverBindingHandle,
+         Controller
+         );
+  return EFI_SUCCESS;
+}
+
+/**
+  Entry point of the UAS driver.
+
+  @param  ImageHandle     The driver image handle.
+  @param  SystemTable     The system table.
+
+  @retval EFI_SUCCESS     The driver binding protocol was installed.
+  @retval Others          The driver binding protocol could not be installed.
+
+**/
+EFI_STATUS
+EFIAPI
+UsbUasEntryPoint (
+  IN EFI_HANDLE           ImageHandle,
+  IN EFI_SYSTEM_TABLE     *SystemTable
+  )
+{
+  return EfiLibInstallDriverBindingComponentName2 (
+           ImageHandle,
+           SystemTable,
+           &gUsbUasDriverBinding,
+           ImageHandle,
+           &gUsbUasComponentName,
+           &gUsbUasComponentName2
+           );
+}
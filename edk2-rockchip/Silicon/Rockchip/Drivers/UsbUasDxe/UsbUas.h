@@ -0,0 +1,553 @@
+/** @file
+  Definitions of the USB Attached SCSI (UAS) driver.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _EFI_USB_UAS_H_
+#define _EFI_USB_UAS_H_
+
+#include <Uefi.h>
+
+#include <IndustryStandard/Scsi.h>
+#include <IndustryStandard/Usb.h>
+
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include <Protocol/DevicePath.h>
+#include <Protocol/UsbIo.h>
+#include <Protocol/UsbStream.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiDriverEntryPoint.h>
+#include <Library/UefiLib.h>
+
+//
+// USB Mass Storage Class, SCSI transparent command set, UAS protocol.
+//
+#define USB_UAS_CLASS                 0x08
+#define USB_UAS_SUBCLASS_SCSI         0x06
+#define USB_UAS_PROTOCOL              0x62
+
+//
+// UAS 4.3 Pipe Usage class specific descriptor and its pipe IDs.
+//
+#define USB_UAS_DESC_TYPE_PIPE_USAGE  0x24
+#define USB_UAS_PIPE_COMMAND          0x01
+#define USB_UAS_PIPE_STATUS           0x02
+#define USB_UAS_PIPE_DATA_IN          0x03
+#define USB_UAS_PIPE_DATA_OUT         0x04
+
+//
+// UAS 6.2 Information Unit IDs.
+//
+#define USB_UAS_IU_COMMAND            0x01
+#define USB_UAS_IU_SENSE              0x03
+#define USB_UAS_IU_RESPONSE           0x04
+#define USB_UAS_IU_TASK_MANAGEMENT    0x05
+#define USB_UAS_IU_READ_READY         0x06
+#define USB_UAS_IU_WRITE_READY        0x07
+
+//
+// SCSI status codes of the Sense IU.
+//
+#define USB_UAS_STATUS_GOOD             0x00
+#define USB_UAS_STATUS_CHECK_CONDITION  0x02
+
+//
+// UAS 6.2.7 task management functions, and the response codes of the
+// Response IU that reports their outcome.
+//
+#define USB_UAS_TMF_ABORT_TASK          0x01
+#define USB_UAS_TMF_LOGICAL_UNIT_RESET  0x08
+
+#define USB_UAS_RESPONSE_TMF_COMPLETE   0x00
+#define USB_UAS_RESPONSE_TMF_SUCCEEDED  0x08
+
+//
+// The number of commands kept in flight when the pipes have bulk streams.
+// Every command uses the stream ID equal to its tag, and the stream after
+// the last command is kept for task management.
+//
+#define USB_UAS_MAX_QUEUE_DEPTH       32
+
+//
+// The largest transfer of a single READ or WRITE command.
+//
+#define USB_UAS_MAX_TRANSFER_SIZE     SIZE_1MB
+
+//
+// The status buffer holds a Sense IU with the largest sense data we ask for.
+//
+#define USB_UAS_STATUS_BUFFER_SIZE    0x60
+
+//
+// Timeouts, in milliseconds.
+//
+#define USB_UAS_GENERIC_TIMEOUT       (5 * 1000)
+#define USB_UAS_IO_TIMEOUT            (30 * 1000)
+
+//
+// Interval of the timer that completes non-blocking BlockIo2 requests.
+// The unit is 100ns, takes 1ms as interval.
+//
+#define USB_UAS_POLL_INTERVAL         EFI_TIMER_PERIOD_MILLISECONDS (1)
+
+//
+// The number of times TEST UNIT READY is retried while the device reports
+// a unit attention or becoming ready.
+//
+#define USB_UAS_READY_RETRIES         10
+
+#pragma pack(1)
+typedef struct {
+  UINT8     Length;
+  UINT8     DescriptorType;
+  UINT8     PipeId;
+  UINT8     Reserved;
+} USB_UAS_PIPE_USAGE_DESCRIPTOR;
+
+//
+// UAS 6.2.2 Command IU with a 16 byte CDB.
+//
+typedef struct {
+  UINT8     IuId;
+  UINT8     Reserved1;
+  UINT16    Tag;                ///< Big endian
+  UINT8     Attribute;
+  UINT8     Reserved2;
+  UINT8     AddCdbLength;
+  UINT8     Reserved3;
+  UINT8     Lun[8];
+  UINT8     Cdb[16];
+} USB_UAS_COMMAND_IU;
+
+//
+// UAS 6.2.7 Task Management IU.
+//
+typedef struct {
+  UINT8     IuId;
+  UINT8     Reserved1;
+  UINT16    Tag;                ///< Big endian
+  UINT8     Function;
+  UINT8     Reserved2;
+  UINT16    ManagedTag;         ///< Big endian
+  UINT8     Lun[8];
+} USB_UAS_TASK_MANAGEMENT_IU;
+
+//
+// UAS 6.2.3 Read Ready IU and 6.2.4 Write Ready IU.
+//
+typedef struct {
+  UINT8     IuId;
+  UINT8     Reserved;
+  UINT16    Tag;                ///< Big endian
+} USB_UAS_READY_IU;
+
+//
+// UAS 6.2.5 Sense IU.
+//
+typedef struct {
+  UINT8     IuId;
+  UINT8     Reserved1;
+  UINT16    Tag;                ///< Big endian
+  UINT16    StatusQualifier;
+  UINT8     Status;
+  UINT8     Reserved2[7];
+  UINT16    SenseLength;        ///< Big endian
+  UINT8     SenseData[1];
+} USB_UAS_SENSE_IU;
+
+//
+// UAS 6.2.6 Response IU.
+//
+typedef struct {
+  UINT8     IuId;
+  UINT8     Reserved;
+  UINT16    Tag;                ///< Big endian
+  UINT8     AdditionalInfo[3];
+  UINT8     ResponseCode;
+} USB_UAS_RESPONSE_IU;
+#pragma pack()
+
+#define USB_UAS_DEVICE_SIGNATURE    SIGNATURE_32 ('u', 'a', 's', 'd')
+#define USB_UAS_REQUEST_SIGNATURE   SIGNATURE_32 ('u', 'a', 's', 'r')
+
+typedef struct _USB_UAS_DEVICE  USB_UAS_DEVICE;
+typedef struct _USB_UAS_REQUEST USB_UAS_REQUEST;
+
+//
+// A command slot. Slot N carries tag N + 1, which is also its stream ID.
+// A slot is stale when the device may still complete the command it last
+// ran: neither ABORT TASK nor LOGICAL UNIT RESET went through, so its tag
+// is not used again until a logical unit reset succeeds.
+//
+typedef struct {
+  BOOLEAN                   InUse;
+  BOOLEAN                   Stale;
+  UINT16                    Tag;
+  USB_UAS_COMMAND_IU        *CommandIu;
+  UINT8                     *StatusBuffer;
+  EFI_EVENT                 TimeoutEvent;
+  //
+  // Data phase of the command
+  //
+  VOID                      *Data;
+  UINTN                     DataLength;
+  BOOLEAN                   DataIn;
+  //
+  // Outstanding stream transfers, NULL once completed
+  //
+  VOID                      *CommandTransfer;
+  VOID                      *DataTransfer;
+  VOID                      *StatusTransfer;
+  UINTN                     StatusLength;
+  //
+  // Result of the command
+  //
+  EFI_STATUS                Status;
+  UINTN                     DataTransferred;
+  UINT8                     SenseKey;
+  UINT8                     Asc;
+  //
+  // The block request the command belongs to, NULL for internal commands
+  //
+  USB_UAS_REQUEST           *Request;
+} USB_UAS_COMMAND;
+
+//
+// A block read, write or flush. It is split in commands of at most
+// USB_UAS_MAX_TRANSFER_SIZE bytes that are queued as slots become free.
+//
+struct _USB_UAS_REQUEST {
+  UINT32                    Signature;
+  LIST_ENTRY                Link;
+  EFI_BLOCK_IO2_TOKEN       *Token;
+  BOOLEAN                   Write;
+  BOOLEAN                   Flush;
+  EFI_LBA                   Lba;
+  UINT8                     *Buffer;
+  UINTN                     RemainingBlocks;
+  UINTN                     Outstanding;
+  EFI_STATUS                Status;
+  BOOLEAN                   Finished;
+};
+
+struct _USB_UAS_DEVICE {
+  UINT32                        Signature;
+  EFI_HANDLE                    Controller;
+  EFI_USB_IO_PROTOCOL           *UsbIo;
+  EFI_DEVICE_PATH_PROTOCOL      *DevicePath;
+
+  //
+  // The host controller's stream protocol, NULL if the device is driven
+  // one command at a time through EFI_USB_IO_PROTOCOL.
+  //
+  ROCKCHIP_USB_STREAM_PROTOCOL  *UsbStream;
+  UINT8                         DeviceAddress;
+  UINT16                        NumStreams;
+
+  UINT8                         InterfaceNumber;
+  UINT8                         AlternateSetting;
+  UINT8                         CommandPipe;
+  UINT8                         StatusPipe;
+  UINT8                         DataInPipe;
+  UINT8                         DataOutPipe;
+
+  UINTN                         QueueDepth;
+  USB_UAS_COMMAND               Commands[USB_UAS_MAX_QUEUE_DEPTH];
+  //
+  // Task management runs one function at a time, with the tag and stream
+  // ID QueueDepth + 1.
+  //
+  USB_UAS_TASK_MANAGEMENT_IU    *TaskIu;
+  UINT8                         *TaskStatus;
+  LIST_ENTRY                    Requests;
+  EFI_EVENT                     PollTimer;
+
+  EFI_BLOCK_IO_PROTOCOL         BlockIo;
+  EFI_BLOCK_IO2_PROTOCOL        BlockIo2;
+  EFI_BLOCK_IO_MEDIA            Media;
+};
+
+#define USB_UAS_DEVICE_FROM_BLOCK_IO(a) \
+  CR (a, USB_UAS_DEVICE, BlockIo, USB_UAS_DEVICE_SIGNATURE)
+
+#define USB_UAS_DEVICE_FROM_BLOCK_IO2(a) \
+  CR (a, USB_UAS_DEVICE, BlockIo2, USB_UAS_DEVICE_SIGNATURE)
+
+#define USB_UAS_REQUEST_FROM_LINK(a) \
+  CR (a, USB_UAS_REQUEST, Link, USB_UAS_REQUEST_SIGNATURE)
+
+//
+// UAS keeps its state at TPL_CALLBACK, the level of the poll timer.
+//
+#define USB_UAS_TPL                 TPL_CALLBACK
+
+extern EFI_DRIVER_BINDING_PROTOCOL   gUsbUasDriverBinding;
+extern EFI_COMPONENT_NAME_PROTOCOL   gUsbUasComponentName;
+extern EFI_COMPONENT_NAME2_PROTOCOL  gUsbUasComponentName2;
+
+//
+// UsbUas.c
+//
+
+/**
+  Start a command on a free slot.
+
+  @param  UasDevice       The UAS device.
+  @param  Command         The free command slot.
+  @param  Cdb             The SCSI command descriptor block.
+  @param  CdbLength       The length of Cdb, at most 16 bytes.
+  @param  Data            The data buffer, NULL if there is no data phase.
+  @param  DataLength      The length of Data.
+  @param  DataIn          TRUE if the data is read from the device.
+  @param  Timeout         The command timeout, in milliseconds.
+
+  @retval EFI_SUCCESS     The command was started. Its result is collected
+                          with UasCheckCommand.
+  @retval Others          The command could not be started.
+
+**/
+EFI_STATUS
+UasStartCommand (
+  IN USB_UAS_DEVICE     *UasDevice,
+  IN USB_UAS_COMMAND    *Command,
+  IN UINT8              *Cdb,
+  IN UINT8              CdbLength,
+  IN VOID               *Data,
+  IN UINTN              DataLength,
+  IN BOOLEAN            DataIn,
+  IN UINTN              Timeout
+  );
+
+/**
+  Check whether a started command has completed, and release its slot if so.
+
+  @param  UasDevice       The UAS device.
+  @param  Command         The command slot.
+
+  @retval EFI_NOT_READY   The command is still running.
+  @retval Others          The final status of the command.
+
+**/
+EFI_STATUS
+UasCheckCommand (
+  IN USB_UAS_DEVICE     *UasDevice,
+  IN USB_UAS_COMMAND    *Command
+  );
+
+/**
+  Abort a started command and release its slot. The device is sent ABORT
+  TASK for the tag, or LOGICAL UNIT RESET if that fails.
+
+  @param  UasDevice       The UAS device.
+  @param  Command         The command slot.
+
+**/
+VOID
+UasAbortCommand (
+  IN USB_UAS_DEVICE     *UasDevice,
+  IN USB_UAS_COMMAND    *Command
+  );
+
+/**
+  Reset the logical unit and the pipes. The commands still in flight are
+  cancelled and finish with EFI_ABORTED on their next UasCheckCommand.
+
+  @param  UasDevice       The UAS device.
+
+  @retval EFI_SUCCESS     The logical unit was reset.
+  @retval Others          The device did not take the reset, the slots of
+                          the cancelled commands are stale.
+
+**/
+EFI_STATUS
+UasResetLogicalUnit (
+  IN USB_UAS_DEVICE     *UasDevice
+  );
+
+/**
+  Execute a command and wait for it to complete.
+
+  @param  UasDevice       The UAS device.
+  @param  Cdb             The SCSI command descriptor block.
+  @param  CdbLength       The length of Cdb, at most 16 bytes.
+  @param  Data            The data buffer, NULL if there is no data phase.
+  @param  DataLength      On input, the length of Data. On output, the number
+                          of bytes transferred.
+  @param  DataIn          TRUE if the data is read from the device.
+  @param  Timeout         The command timeout, in milliseconds.
+  @param  SenseKey        Returns the sense key on CHECK CONDITION. Optional.
+
+  @retval EFI_SUCCESS     The command completed with GOOD status.
+  @retval Others          The command failed.
+
+**/
+EFI_STATUS
+UasExecuteCommand (
+  IN     USB_UAS_DEVICE     *UasDevice,
+  IN     UINT8              *Cdb,
+  IN     UINT8              CdbLength,
+  IN     VOID               *Data,
+  IN OUT UINTN              *DataLength,
+  IN     BOOLEAN            DataIn,
+  IN     UINTN              Timeout,
+  OUT    UINT8              *SenseKey  OPTIONAL
+  );
+
+//
+// UsbUasBlockIo.c
+//
+
+/**
+  Identify the logical unit and fill in the block media.
+
+  @param  UasDevice       The UAS device.
+
+  @retval EFI_SUCCESS     The media information was read.
+  @retval Others          The logical unit is not a usable block device.
+
+**/
+EFI_STATUS
+UasInitMedia (
+  IN USB_UAS_DEVICE     *UasDevice
+  );
+
+/**
+  Complete finished commands, finish the block requests they belong to and
+  queue further commands of the pending requests.
+
+  @param  UasDevice       The UAS device.
+
+**/
+VOID
+UasProcessRequests (
+  IN USB_UAS_DEVICE     *UasDevice
+  );
+
+/**
+  Timer callback that drives the non-blocking requests.
+
+  @param  Event           The poll timer.
+  @param  Context         The UAS device.
+
+**/
+VOID
+EFIAPI
+UasPollTimer (
+  IN EFI_EVENT          Event,
+  IN VOID               *Context
+  );
+
+/**
+  Fail every queued and running request, used when the device goes away.
+
+  @param  UasDevice       The UAS device.
+
+**/
+VOID
+UasAbortRequests (
+  IN USB_UAS_DEVICE     *UasDevice
+  );
+
+EFI_STATUS
+EFIAPI
+UasBlockIoReset (
+  IN EFI_BLOCK_IO_PROTOCOL  *This,
+  IN BOOLEAN                ExtendedVerification
+  );
+
+EFI_STATUS
+EFIAPI
+UasBlockIoReadBlocks (
+  IN  EFI_BLOCK_IO_PROTOCOL *This,
+  IN  UINT32                MediaId,
+  IN  EFI_LBA               Lba,
+  IN  UINTN                 BufferSize,
+  OUT VOID                  *Buffer
+  );
+
+EFI_STATUS
+EFIAPI
+UasBlockIoWriteBlocks (
+  IN  EFI_BLOCK_IO_PROTOCOL *This,
+  IN  UINT32                MediaId,
+  IN  EFI_LBA               Lba,
+  IN  UINTN                 BufferSize,
+  IN  VOID                  *Buffer
+  );
+
+EFI_STATUS
+EFIAPI
+UasBlockIoFlushBlocks (
+  IN EFI_BLOCK_IO_PROTOCOL  *This
+  );
+
+EFI_STATUS
+EFIAPI
+UasBlockIo2Reset (
+  IN EFI_BLOCK_IO2_PROTOCOL *This,
+  IN BOOLEAN                ExtendedVerification
+  );
+
+EFI_STATUS
+EFIAPI
+UasBlockIo2ReadBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  OUT    VOID                   *Buffer
+  );
+
+EFI_STATUS
+EFIAPI
+UasBlockIo2WriteBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  IN     VOID                   *Buffer
+  );
+
+EFI_STATUS
+EFIAPI
+UasBlockIo2FlushBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token
+  );
+
+//
+// ComponentName.c
+//
+
+EFI_STATUS
+EFIAPI
+UsbUasComponentNameGetDriverName (
+  IN  EFI_COMPONENT_NAME_PROTOCOL  *This,
+  IN  CHAR8                        *Language,
+  OUT CHAR16                       **DriverName
+  );
+
+EFI_STATUS
+EFIAPI
+UsbUasComponentNameGetControllerName (
+  IN  EFI_COMPONENT_NAME_PROTOCOL  *This,
+  IN  EFI_HANDLE                   ControllerHandle,
+  IN  EFI_HANDLE                   ChildHandle        OPTIONAL,
+  IN  CHAR8                        *Language,
+  OUT CHAR16                       **ControllerName
+  );
+
+#endif
@@ -0,0 +1,665 @@
+/** @file
+  Block IO and Block IO 2 protocols of the USB Attached SCSI (UAS) driver.
+
+  Every read, write or flush becomes a request on the device's queue. The
+  requests are split in commands of at most USB_UAS_MAX_TRANSFER_SIZE bytes,
+  which are spread over the free command slots, so that a large read keeps
+  the whole device queue busy. Non-blocking requests are driven by a
+  periodic timer, blocking ones by the caller polling the queue.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "UsbUas.h"
+
+/**
+  Find a free command slot.
+
+  @param  UasDevice       The UAS device.
+
+  @return The free slot, or NULL if all slots are busy.
+
+**/
+STATIC
+USB_UAS_COMMAND *
+UasGetFreeCommand (
+  IN USB_UAS_DEVICE     *UasDevice
+  )
+{
+  UINTN   Index;
+
+  for (Index = 0; Index < UasDevice->QueueDepth; Index++) {
+    if (!UasDevice->Commands[Index].InUse && !UasDevice->Commands[Index].Stale) {
+      return &UasDevice->Commands[Index];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Check whether any command slot is in use.
+
+  @param  UasDevice       The UAS device.
+
+  @retval TRUE            At least one command is running.
+  @retval FALSE           The device queue is empty.
+
+**/
+STATIC
+BOOLEAN
+UasCommandsPending (
+  IN USB_UAS_DEVICE     *UasDevice
+  )
+{
+  UINTN   Index;
+
+  for (Index = 0; Index < ARRAY_SIZE (UasDevice->Commands); Index++) {
+    if (UasDevice->Commands[Index].InUse) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Build the CDB of the next command of a block request.
+
+  @param  UasDevice       The UAS device.
+  @param  Request         The block request.
+  @param  Cdb             Returns the CDB, 16 bytes.
+  @param  CdbLength       Returns the length of the CDB.
+  @param  NumberOfBlocks  Returns the number of blocks the command transfers.
+
+**/
+STATIC
+VOID
+UasBuildRequestCdb (
+  IN  USB_UAS_DEVICE    *UasDevice,
+  IN  USB_UAS_REQUEST   *Request,
+  OUT UINT8             *Cdb,
+  OUT UINT8             *CdbLength,
+  OUT UINTN             *NumberOfBlocks
+  )
+{
+  UINTN   Blocks;
+  UINT64  Lba;
+
+  ZeroMem (Cdb, 16);
+
+  if (Request->Flush) {
+    Cdb[0]          = EFI_SCSI_OP_SYNC_CACHE;
+    *CdbLength      = 10;
+    *NumberOfBlocks = 1;
+    return;
+  }
+
+  Blocks = MIN (Request->RemainingBlocks, USB_UAS_MAX_TRANSFER_SIZE / UasDevice->Media.BlockSize);
+  Lba    = Request->Lba;
+
+  if (UasDevice->Media.LastBlock > MAX_UINT32) {
+    Cdb[0] = Request->Write ? EFI_SCSI_OP_WRITE16 : EFI_SCSI_OP_READ16;
+    WriteUnaligned64 ((UINT64 *) &Cdb[2], SwapBytes64 (Lba));
+    WriteUnaligned32 ((UINT32 *) &Cdb[10], SwapBytes32 ((UINT32) Blocks));
+    *CdbLength = 16;
+  } else {
+    Blocks = MIN (Blocks, MAX_UINT16);
+    Cdb[0] = Request->Write ? EFI_SCSI_OP_WRITE10 : EFI_SCSI_OP_READ10;
+    WriteUnaligned32 ((UINT32 *) &Cdb[2], SwapBytes32 ((UINT32) Lba));
+    WriteUnaligned16 ((UINT16 *) &Cdb[7], SwapBytes16 ((UINT16) Blocks));
+    *CdbLength = 10;
+  }
+
+  *NumberOfBlocks = Blocks;
+}
+
+/**
+  Finish a block request whose commands have all completed.
+
+  @param  Request         The block request.
+
+**/
+STATIC
+VOID
+UasFinishRequest (
+  IN USB_UAS_REQUEST    *Request
+  )
+{
+  RemoveEntryList (&Request->Link);
+  Request->Finished = TRUE;
+
+  if (Request->Token != NULL) {
+    Request->Token->TransactionStatus = Request->Status;
+    gBS->SignalEvent (Request->Token->Event);
+    FreePool (Request);
+  }
+}
+
+/**
+  Complete finished commands, finish the block requests they belong to and
+  queue further commands of the pending requests.
+
+  @param  UasDevice       The UAS device.
+
+**/
+VOID
+UasProcessRequests (
+  IN USB_UAS_DEVICE     *UasDevice
+  )
+{
+  USB_UAS_COMMAND   *Command;
+  USB_UAS_REQUEST   *Request;
+  LIST_ENTRY        *Entry;
+  LIST_ENTRY        *Next;
+  EFI_STATUS        Status;
+  UINT8             Cdb[16];
+  UINT8             CdbLength;
+  UINTN             Blocks;
+  UINTN             Index;
+
+  //
+  // Reap the commands of the block requests. All the slots are looked at,
+  // the queue gets shorter if the streams are lost when the pipes are reset.
+  //
+  for (Index = 0; Index < ARRAY_SIZE (UasDevice->Commands); Index++) {
+    Command = &UasDevice->Commands[Index];
+    if (!Command->InUse || (Command->Request == NULL)) {
+      continue;
+    }
+
+    Request = Command->Request;
+    Status  = UasCheckCommand (UasDevice, Command);
+    if (Status == EFI_NOT_READY) {
+      continue;
+    }
+
+    Request->Outstanding--;
+    if (EFI_ERROR (Status) && !EFI_ERROR (Request->Status)) {
+      DEBUG ((EFI_D_ERROR, "UasProcessRequests: %a failed - %r, sense %x/%x\n",
+        Request->Flush ? "flush" : (Request->Write ? "write" : "read"),
+        Status, Command->SenseKey, Command->Asc));
+      Request->Status          = EFI_DEVICE_ERROR;
+      Request->RemainingBlocks = 0;
+    }
+  }
+
+  //
+  // Queue further commands in request order. A flush waits until all
+  // earlier requests are done, and holds back the requests behind it.
+  //
+  for (Entry = GetFirstNode (&UasDevice->Requests);
+       !IsNull (&UasDevice->Requests, Entry);
+       Entry = GetNextNode (&UasDevice->Requests, Entry)) {
+    Request = USB_UAS_REQUEST_FROM_LINK (Entry);
+
+    if (Request->Flush && (Request->RemainingBlocks != 0) &&
+        ((Entry != GetFirstNode (&UasDevice->Requests)) || UasCommandsPending (UasDevice))) {
+      break;
+    }
+
+    while (Request->RemainingBlocks != 0) {
+      Command = UasGetFreeCommand (UasDevice);
+      if (Command == NULL) {
+        //
+        // Nothing will free a slot if they are all stale.
+        //
+        if (!UasCommandsPending (UasDevice)) {
+          Request->Status          = EFI_DEVICE_ERROR;
+          Request->RemainingBlocks = 0;
+        }
+        break;
+      }
+
+      UasBuildRequestCdb (UasDevice, Request, Cdb, &CdbLength, &Blocks);
+
+      Status = UasStartCommand (
+                 UasDevice,
+                 Command,
+                 Cdb,
+                 CdbLength,
+                 Request->Flush ? NULL : Request->Buffer,
+                 Request->Flush ? 0 : Blocks * UasDevice->Media.BlockSize,
+                 (BOOLEAN) !Request->Write,
+                 USB_UAS_IO_TIMEOUT
+                 );
+      if (EFI_ERROR (Status)) {
+        Request->Status          = EFI_DEVICE_ERROR;
+        Request->RemainingBlocks = 0;
+        break;
+      }
+
+      Command->Request = Request;
+      Request->Outstanding++;
+      Request->RemainingBlocks -= Blocks;
+      if (!Request->Flush) {
+        Request->Lba    += Blocks;
+        Request->Buffer += Blocks * UasDevice->Media.BlockSize;
+      }
+    }
+
+    if (Request->RemainingBlocks != 0) {
+      break;
+    }
+  }
+
+  //
+  // Complete the requests that have nothing left in flight.
+  //
+  for (Entry = GetFirstNode (&UasDevice->Requests);
+       !IsNull (&UasDevice->Requests, Entry);
+       Entry = Next) {
+    Next    = GetNextNode (&UasDevice->Requests, Entry);
+    Request = USB_UAS_REQUEST_FROM_LINK (Entry);
+    if ((Request->RemainingBlocks == 0) && (Request->Outstanding == 0)) {
+      UasFinishRequest (Request);
+    }
+  }
+}
+
+/**
+  Timer callback that drives the non-blocking requests.
+
+  @param  Event           The poll timer.
+  @param  Context         The UAS device.
+
+**/
+VOID
+EFIAPI
+UasPollTimer (
+  IN EFI_EVENT          Event,
+  IN VOID               *Context
+  )
+{
+  USB_UAS_DEVICE    *UasDevice;
+
+  UasDevice = (USB_UAS_DEVICE *) Context;
+  if (!IsListEmpty (&UasDevice->Requests)) {
+    UasProcessRequests (UasDevice);
+  }
+}
+
+/**
+  Fail every queued and running request, used when the device goes away.
+
+  @param  UasDevice       The UAS device.
+
+**/
+VOID
+UasAbortRequests (
+  IN USB_UAS_DEVICE     *UasDevice
+  )
+{
+  USB_UAS_REQUEST   *Request;
+  UINTN             Index;
+
+  //
+  // A logical unit reset drops all the tasks at once, the cancelled
+  // commands are then released by UasCheckCommand.
+  //
+  if (UasCommandsPending (UasDevice)) {
+    UasResetLogicalUnit (UasDevice);
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (UasDevice->Commands); Index++) {
+    if (UasDevice->Commands[Index].InUse) {
+      UasCheckCommand (UasDevice, &UasDevice->Commands[Index]);
+    }
+  }
+
+  while (!IsListEmpty (&UasDevice->Requests)) {
+    Request = USB_UAS_REQUEST_FROM_LINK (GetFirstNode (&UasDevice->Requests));
+    Request->Status      = EFI_ABORTED;
+    Request->Outstanding = 0;
+    UasFinishRequest (Request);
+  }
+}
+
+/**
+  Queue a block request, and wait for it to complete if it has no token.
+
+  @param  UasDevice       The UAS device.
+  @param  MediaId         The media ID the caller expects.
+  @param  Lba             The starting block.
+  @param  Token           The Block IO 2 token, NULL for a blocking request.
+  @param  BufferSize      The size of Buffer, in bytes.
+  @param  Buffer          The data buffer.
+  @param  Write           TRUE to write, FALSE to read.
+  @param  Flush           TRUE to flush the device cache, Lba and Buffer are
+                          ignored.
+
+  @retval EFI_SUCCESS     The request was queued, or completed successfully.
+  @retval Others          The request was rejected or failed.
+
+**/
+STATIC
+EFI_STATUS
+UasSubmitRequest (
+  IN USB_UAS_DEVICE       *UasDevice,
+  IN UINT32               MediaId,
+  IN EFI_LBA              Lba,
+  IN EFI_BLOCK_IO2_TOKEN  *Token,
+  IN UINTN                BufferSize,
+  IN VOID                 *Buffer,
+  IN BOOLEAN              Write,
+  IN BOOLEAN              Flush
+  )
+{
+  EFI_BLOCK_IO_MEDIA  *Media;
+  USB_UAS_REQUEST     LocalRequest;
+  USB_UAS_REQUEST     *Request;
+  EFI_STATUS          Status;
+  EFI_TPL             OldTpl;
+  UINTN               NumberOfBlocks;
+
+  Media = &UasDevice->Media;
+
+  if (!Flush) {
+    if (MediaId != Media->MediaId) {
+      return EFI_MEDIA_CHANGED;
+    }
+
+    if (Write && Media->ReadOnly) {
+      return EFI_WRITE_PROTECTED;
+    }
+
+    if (Buffer == NULL) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    if ((BufferSize % Media->BlockSize) != 0) {
+      return EFI_BAD_BUFFER_SIZE;
+    }
+
+    if ((Media->IoAlign > 1) && (((UINTN) Buffer & (Media->IoAlign - 1)) != 0)) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    NumberOfBlocks = BufferSize / Media->BlockSize;
+    if ((Lba > Media->LastBlock) ||
+        (NumberOfBlocks > Media->LastBlock - Lba + 1)) {
+      return EFI_INVALID_PARAMETER;
+    }
+  } else {
+    NumberOfBlocks = 1;
+  }
+
+  if (NumberOfBlocks == 0) {
+    if (Token != NULL) {
+      Token->TransactionStatus = EFI_SUCCESS;
+      gBS->SignalEvent (Token->Event);
+    }
+    return EFI_SUCCESS;
+  }
+
+  if (Token != NULL) {
+    Request = AllocateZeroPool (sizeof (USB_UAS_REQUEST));
+    if (Request == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+    Token->TransactionStatus = EFI_NOT_READY;
+  } else {
+    Request = &LocalRequest;
+    ZeroMem (Request, sizeof (USB_UAS_REQUEST));
+  }
+
+  Request->Signature       = USB_UAS_REQUEST_SIGNATURE;
+  Request->Token           = Token;
+  Request->Write           = Write;
+  Request->Flush           = Flush;
+  Request->Lba             = Lba;
+  Request->Buffer          = Buffer;
+  Request->RemainingBlocks = NumberOfBlocks;
+  Request->Status          = EFI_SUCCESS;
+
+  OldTpl = gBS->RaiseTPL (USB_UAS_TPL);
+
+  InsertTailList (&UasDevice->Requests, &Request->Link);
+  UasProcessRequests (UasDevice);
+
+  if (Token != NULL) {
+    gBS->RestoreTPL (OldTpl);
+    return EFI_SUCCESS;
+  }
+
+  while (!Request->Finished) {
+    UasProcessRequests (UasDevice);
+  }
+  Status = Request->Status;
+
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  Identify the logical unit and fill in the block media.
+
+  @param  UasDevice       The UAS device.
+
+  @retval EFI_SUCCESS     The media information was read.
+  @retval Others          The logical unit is not a usable block device.
+
+**/
+EFI_STATUS
+UasInitMedia (
+  IN USB_UAS_DEVICE     *UasDevice
+  )
+{
+  EFI_SCSI_INQUIRY_DATA   Inquiry;
+  EFI_BLOCK_IO_MEDIA      *Media;
+  EFI_STATUS              Status;
+  UINT8                   Cdb[16];
+  UINT8                   Capacity[32];
+  UINT8                   SenseKey;
+  UINTN                   Length;
+  UINTN                   Retry;
+
+  Media = &UasDevice->Media;
+
+  ZeroMem (Cdb, sizeof (Cdb));
+  Cdb[0] = EFI_SCSI_OP_INQUIRY;
+  Cdb[4] = sizeof (EFI_SCSI_INQUIRY_DATA);
+  Length = sizeof (EFI_SCSI_INQUIRY_DATA);
+  ZeroMem (&Inquiry, sizeof (Inquiry));
+  Status = UasExecuteCommand (UasDevice, Cdb, 6, &Inquiry, &Length, TRUE, USB_UAS_GENERIC_TIMEOUT, NULL);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((Inquiry.Peripheral_Type & 0x1F) != EFI_SCSI_TYPE_DISK) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Media->RemovableMedia = (BOOLEAN) (Inquiry.Rmb != 0);
+
+  //
+  // Let the device report its pending unit attentions and spin up.
+  //
+  ZeroMem (Cdb, sizeof (Cdb));
+  Cdb[0] = EFI_SCSI_OP_TEST_UNIT_READY;
+  for (Retry = 0; Retry < USB_UAS_READY_RETRIES; Retry++) {
+    Status = UasExecuteCommand (UasDevice, Cdb, 6, NULL, NULL, FALSE, USB_UAS_GENERIC_TIMEOUT, &SenseKey);
+    if (!EFI_ERROR (Status)) {
+      break;
+    }
+    if ((SenseKey != EFI_SCSI_SK_UNIT_ATTENTION) && (SenseKey != EFI_SCSI_SK_NOT_READY)) {
+      return Status;
+    }
+    gBS->Stall (100 * 1000);
+  }
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  ZeroMem (Cdb, sizeof (Cdb));
+  ZeroMem (Capacity, sizeof (Capacity));
+  Cdb[0] = EFI_SCSI_OP_READ_CAPACITY;
+  Length = 8;
+  Status = UasExecuteCommand (UasDevice, Cdb, 10, Capacity, &Length, TRUE, USB_UAS_GENERIC_TIMEOUT, NULL);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Media->LastBlock = SwapBytes32 (ReadUnaligned32 ((UINT32 *) &Capacity[0]));
+  Media->BlockSize = SwapBytes32 (ReadUnaligned32 ((UINT32 *) &Capacity[4]));
+
+  if (Media->LastBlock == MAX_UINT32) {
+    ZeroMem (Cdb, sizeof (Cdb));
+    ZeroMem (Capacity, sizeof (Capacity));
+    Cdb[0]  = EFI_SCSI_OP_READ_CAPACITY16;
+    Cdb[1]  = 0x10;
+    Cdb[13] = sizeof (Capacity);
+    Length  = sizeof (Capacity);
+    Status = UasExecuteCommand (UasDevice, Cdb, 16, Capacity, &Length, TRUE, USB_UAS_GENERIC_TIMEOUT, NULL);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    Media->LastBlock = SwapBytes64 (ReadUnaligned64 ((UINT64 *) &Capacity[0]));
+    Media->BlockSize = SwapBytes32 (ReadUnaligned32 ((UINT32 *) &Capacity[8]));
+    Media->LogicalBlocksPerPhysicalBlock = 1 << (Capacity[13] & 0x0F);
+    Media->LowestAlignedLba = ((Capacity[14] & 0x3F) << 8) | Capacity[15];
+  } else {
+    Media->LogicalBlocksPerPhysicalBlock = 1;
+  }
+
+  if ((Media->BlockSize == 0) || (Media->BlockSize > USB_UAS_MAX_TRANSFER_SIZE)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Media->MediaId          = 1;
+  Media->MediaPresent     = TRUE;
+  Media->LogicalPartition = FALSE;
+  Media->ReadOnly         = FALSE;
+  Media->WriteCaching     = FALSE;
+  Media->IoAlign          = 0;
+  Media->OptimalTransferLengthGranularity = 0;
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+UasBlockIoReset (
+  IN EFI_BLOCK_IO_PROTOCOL  *This,
+  IN BOOLEAN                ExtendedVerification
+  )
+{
+  USB_UAS_DEVICE  *UasDevice;
+  EFI_TPL         OldTpl;
+
+  UasDevice = USB_UAS_DEVICE_FROM_BLOCK_IO (This);
+
+  OldTpl = gBS->RaiseTPL (USB_UAS_TPL);
+  UasAbortRequests (UasDevice);
+  gBS->RestoreTPL (OldTpl);
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+UasBlockIoReadBlocks (
+  IN  EFI_BLOCK_IO_PROTOCOL *This,
+  IN  UINT32                MediaId,
+  IN  EFI_LBA               Lba,
+  IN  UINTN                 BufferSize,
+  OUT VOID                  *Buffer
+  )
+{
+  return UasSubmitRequest (USB_UAS_DEVICE_FROM_BLOCK_IO (This), MediaId, Lba, NULL,
+           BufferSize, Buffer, FALSE, FALSE);
+}
+
+EFI_STATUS
+EFIAPI
+UasBlockIoWriteBlocks (
+  IN  EFI_BLOCK_IO_PROTOCOL *This,
+  IN  UINT32                MediaId,
+  IN  EFI_LBA               Lba,
+  IN  UINTN                 BufferSize,
+  IN  VOID                  *Buffer
+  )
+{
+  return UasSubmitRequest (USB_UAS_DEVICE_FROM_BLOCK_IO (This), MediaId, Lba, NULL,
+           BufferSize, Buffer, TRUE, FALSE);
+}
+
+EFI_STATUS
+EFIAPI
+UasBlockIoFlushBlocks (
+  IN EFI_BLOCK_IO_PROTOCOL  *This
+  )
+{
+  return UasSubmitRequest (USB_UAS_DEVICE_FROM_BLOCK_IO (This), 0, 0, NULL,
+           0, NULL, FALSE, TRUE);
+}
+
+EFI_STATUS
+EFIAPI
+UasBlockIo2Reset (
+  IN EFI_BLOCK_IO2_PROTOCOL *This,
+  IN BOOLEAN                ExtendedVerification
+  )
+{
+  USB_UAS_DEVICE  *UasDevice;
+
+  UasDevice = USB_UAS_DEVICE_FROM_BLOCK_IO2 (This);
+  return UasBlockIoReset (&UasDevice->BlockIo, ExtendedVerification);
+}
+
+EFI_STATUS
+EFIAPI
+UasBlockIo2ReadBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  OUT    VOID                   *Buffer
+  )
+{
+  if ((Token != NULL) && (Token->Event == NULL)) {
+    Token = NULL;
+  }
+
+  return UasSubmitRequest (USB_UAS_DEVICE_FROM_BLOCK_IO2 (This), MediaId, Lba, Token,
+           BufferSize, Buffer, FALSE, FALSE);
+}
+
+EFI_STATUS
+EFIAPI
+UasBlockIo2WriteBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  IN     VOID                   *Buffer
+  )
+{
+  if ((Token != NULL) && (Token->Event == NULL)) {
+    Token = NULL;
+  }
+
+  return UasSubmitRequest (USB_UAS_DEVICE_FROM_BLOCK_IO2 (This), MediaId, Lba, Token,
+           BufferSize, Buffer, TRUE, FALSE);
+}
+
+EFI_STATUS
+EFIAPI
+UasBlockIo2FlushBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token
+  )
+{
+  if ((Token != NULL) && (Token->Event == NULL)) {
+    Token = NULL;
+  }
+
+  return UasSubmitRequest (USB_UAS_DEVICE_FROM_BLOCK_IO2 (This), 0, 0, Token,
+           0, NULL, FALSE, TRUE);
+}
@@ -100,6 +100,18 @@ EFI_USB2_HC_PROTOCOL gXhciUsb2HcTemplate = {
   0x0
 };
 
+//
+// Template for Xhci's USB bulk stream protocol instance.
+//
+ROCKCHIP_USB_STREAM_PROTOCOL gXhciUsbStreamTemplate = {
+  XhcStreamGetDevice,
+  XhcStreamAllocate,
+  XhcStreamFree,
+  XhcStreamSubmit,
+  XhcStreamPoll,
+  XhcStreamCancel
+};
+
 /**
   Retrieves the capability of root hub ports.
 
@@ -218,6 +230,11 @@ XhcReset (
     XhcFreeSched (Xhc);
 
     XhcInitSched (Xhc);
+
+    //
+    // The host controller reset resets all root ports as well.
+    //
+    ZeroMem (Xhc->RootPorts, Xhc->HcSParams1.Data.MaxPorts * sizeof (XHC_ROOT_PORT));
     break;
 
   case EFI_USB_HC_RESET_GLOBAL_WITH_DEBUG:
@@ -356,6 +373,224 @@ XhcSetState (
   return Status;
 }
 
+/**
+  Advance the pre-reset state machine of one root port.
+
+  A newly connected device is debounced, reset and given its reset recovery
+  time here, so that all root ports of all controllers do this in parallel
+  instead of one after another in the bus driver. The bus driver claims the
+  finished reset in XhcSetRootHubPortFeature(), and the device is addressed
+  from XhcGetRootHubPortStatus() as before.
+
+  @param  Xhc                   The XHCI Instance.
+  @param  PortNumber            The root port to advance.
+  @param  Elapsed               Milliseconds since the port was last advanced.
+
+**/
+STATIC
+VOID
+XhcStepRootPort (
+  IN USB_XHCI_INSTANCE  *Xhc,
+  IN UINT8              PortNumber,
+  IN UINT32             Elapsed
+  )
+{
+  XHC_ROOT_PORT           *RootPort;
+  UINT32                  Offset;
+  UINT32                  State;
+  BOOLEAN                 ResetDone;
+
+  RootPort = &Xhc->RootPorts[PortNumber];
+  Offset   = (UINT32) (XHC_PORTSC_OFFSET + (0x10 * PortNumber));
+  State    = XhcReadOpReg (Xhc, Offset);
+
+  //
+  // A disconnect cancels whatever the port was doing, the next
+  // connect starts over with a debounce.
+  //
+  if (!XHC_BIT_IS_SET (State, XHC_PORTSC_CCS)) {
+    RootPort->State       = XhcPortIdle;
+    RootPort->ResetChange = FALSE;
+    return;
+  }
+
+  //
+  // Mask off the port status change bits, these bits are
+  // write clean bit
+  //
+  ResetDone = XHC_BIT_IS_SET (State, XHC_PORTSC_PRC);
+  State    &= ~ (BIT1 | BIT17 | BIT18 | BIT19 | BIT20 | BIT21 | BIT22 | BIT23);
+
+  switch (RootPort->State) {
+  case XhcPortIdle:
+    RootPort->State     = XhcPortDebounce;
+    RootPort->Remaining = XHC_PORT_DEBOUNCE_TIME;
+    USB_PROFILE_PORT_CONNECT (Xhc->Profile, PortNumber);
+    break;
+
+  case XhcPortDebounce:
+    if (RootPort->Remaining > Elapsed) {
+      RootPort->Remaining -= Elapsed;
+      break;
+    }
+
+    //
+    // 4.3.1 Resetting a Root Hub Port
+    // 1) Write the PORTSC register with the Port Reset (PR) bit set to '1'.
+    //
+    USB_PROFILE_PORT_RESET_START (Xhc->Profile, PortNumber);
+    XhcWriteOpReg (Xhc, Offset, State | XHC_PORTSC_RESET);
+    RootPort->State     = XhcPortResetting;
+    RootPort->Remaining = XHC_PORT_RESET_TIMEOUT;
+    break;
+
+  case XhcPortResetting:
+    if (ResetDone) {
+      USB_PROFILE_PORT_RESET_DONE (Xhc->Profile, PortNumber);
+      XhcWriteOpReg (Xhc, Offset, State | XHC_PORTSC_PRC);
+      RootPort->State     = XhcPortRecovery;
+      RootPort->Remaining = XHC_PORT_RECOVERY_TIME;
+    } else if (RootPort->Remaining > Elapsed) {
+      RootPort->Remaining -= Elapsed;
+    } else {
+      DEBUG ((EFI_D_ERROR, "XhcStepRootPort: port %d reset timed out\n", PortNumber));
+      RootPort->State = XhcPortFailed;
+    }
+    break;
+
+  case XhcPortRecovery:
+    if (RootPort->Remaining > Elapsed) {
+      RootPort->Remaining -= Elapsed;
+      break;
+    }
+
+    RootPort->State = XHC_BIT_IS_SET (State, XHC_PORTSC_PED) ? XhcPortReady : XhcPortFailed;
+    break;
+
+  default:
+    break;
+  }
+}
+
+/**
+  Set up a core again that UsbDwc3DeviceDxe gave back. Its soft reset lost
+  the schedule, so the controller is reset and started afresh. The devices
+  of the bus driver are gone with their slots, the connect change of the
+  root ports makes it remove and enumerate them again.
+
+  @param  Xhc                   The XHCI Instance.
+
+**/
+STATIC
+VOID
+XhcRestart (
+  IN USB_XHCI_INSTANCE    *Xhc
+  )
+{
+  EFI_STATUS              Status;
+
+  if (!XhcIsHalt (Xhc)) {
+    XhcHaltHC (Xhc, XHC_GENERIC_TIMEOUT);
+  }
+
+  Status = XhcResetHC (Xhc, XHC_RESET_TIMEOUT);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "XhcRestart: reset failed - %r\n", Status));
+    return;
+  }
+
+  XhciDelAllAsyncIntTransfers (Xhc);
+  XhcFreeSched (Xhc);
+  XhcInitSched (Xhc);
+  ZeroMem (Xhc->RootPorts, Xhc->HcSParams1.Data.MaxPorts * sizeof (XHC_ROOT_PORT));
+
+  Status = XhcRunHC (Xhc, XHC_GENERIC_TIMEOUT);
+  DEBUG ((EFI_D_INFO, "XhcRestart: status %r\n", Status));
+}
+
+/**
+  Root port periodic check handler, advances the pre-reset of every root port.
+
+  @param  Event                 Root port timer event.
+  @param  Context               Pointer to USB_XHCI_INSTANCE.
+
+**/
+VOID
+EFIAPI
+XhcMonitorRootPorts (
+  IN EFI_EVENT            Event,
+  IN VOID                 *Context
+  )
+{
+  USB_XHCI_INSTANCE       *Xhc;
+  UINT8                   Index;
+
+  Xhc = (USB_XHCI_INSTANCE *) Context;
+
+  if (!XhcIsHostMode (Xhc)) {
+    Xhc->Lent = TRUE;
+    return;
+  }
+
+  if (Xhc->Lent) {
+    Xhc->Lent = FALSE;
+    XhcRestart (Xhc);
+  }
+
+  //
+  // Ports are only reset while the controller runs, a halted
+  // controller leaves all of them to the bus driver.
+  //
+  if (XhcIsHalt (Xhc)) {
+    return;
+  }
+
+  for (Index = 0; Index < Xhc->HcSParams1.Data.MaxPorts; Index++) {
+    XhcStepRootPort (Xhc, Index, XHC_PORT_POLL_TIME);
+  }
+}
+
+/**
+  Claim the pre-reset of a root port for a reset requested by the bus driver.
+
+  A pre-reset that is still in flight is driven to completion first, the
+  timer can not do it at XHC_TPL. Either way the port belongs to the bus
+  driver afterwards and is not pre-reset again until it is reconnected.
+
+  @param  Xhc                   The XHCI Instance.
+  @param  PortNumber            The root port to reset.
+
+  @retval TRUE                  The port was reset already, the reset change
+                                is reported by the next port status request.
+  @retval FALSE                 The port must be reset by the caller.
+
+**/
+STATIC
+BOOLEAN
+XhcClaimRootPortReset (
+  IN USB_XHCI_INSTANCE  *Xhc,
+  IN UINT8              PortNumber
+  )
+{
+  XHC_ROOT_PORT           *RootPort;
+
+  RootPort = &Xhc->RootPorts[PortNumber];
+
+  while ((RootPort->State == XhcPortResetting) || (RootPort->State == XhcPortRecovery)) {
+    gBS->Stall (XHC_1_MILLISECOND);
+    XhcStepRootPort (Xhc, PortNumber, 1);
+  }
+
+  if (RootPort->State == XhcPortReady) {
+    RootPort->State       = XhcPortEnumerated;
+    RootPort->ResetChange = TRUE;
+    return TRUE;
+  }
+
+  RootPort->State = XhcPortEnumerated;
+  return FALSE;
+}
+
 /**
   Retrieves the current status of a USB root hub port.
 
@@ -404,12 +639,28 @@ XhcGetRootHubPortStatus (
     goto ON_EXIT;
   }
 
+  //
+  // The core was lent to UsbDwc3DeviceDxe, its host registers are gone
+  //
+  if (!XhcIsHostMode (Xhc)) {
+    Status = EFI_DEVICE_ERROR;
+    goto ON_EXIT;
+  }
+
   Offset                       = (UINT32) (XHC_PORTSC_OFFSET + (0x10 * PortNumber));
   PortStatus->PortStatus       = 0;
   PortStatus->PortChangeStatus = 0;
 
   State = XhcReadOpReg (Xhc, Offset);
 
+  //
+  // The reset change of a pre-reset in flight belongs to the root port
+  // monitor, don't report or clear it here.
+  //
+  if (Xhc->RootPorts[PortNumber].State == XhcPortResetting) {
+    State &= ~XHC_PORTSC_PRC;
+  }
+
   //
   // According to XHCI 1.1 spec November 2017,
   // bit 10~13 of the root port status register identifies the speed of the attached device.
@@ -457,6 +708,18 @@ XhcGetRootHubPortStatus (
     }
   }
 
+  if ((PortStatus->PortChangeStatus & USB_PORT_STAT_C_CONNECTION) != 0) {
+    USB_PROFILE_PORT_CONNECT (Xhc->Profile, PortNumber);
+  }
+
+  //
+  // Report the reset change of a pre-reset claimed by XhcSetRootHubPortFeature().
+  //
+  if (Xhc->RootPorts[PortNumber].ResetChange) {
+    PortStatus->PortChangeStatus |= USB_PORT_STAT_C_RESET;
+    Xhc->RootPorts[PortNumber].ResetChange = FALSE;
+  }
+
   MapSize = sizeof (mUsbClearPortChangeMap) / sizeof (USB_CLEAR_PORT_MAP);
 
   for (Index = 0; Index < MapSize; Index++) {
@@ -545,6 +808,14 @@ XhcSetRootHubPortFeature (
 
   case EfiUsbPortReset:
     DEBUG ((EFI_D_INFO, "XhcUsbPortReset!\n"));
+    //
+    // Ports connected while the controller runs have been reset by the
+    // root port monitor already, don't reset the device a second time.
+    //
+    if (XhcClaimRootPortReset (Xhc, PortNumber)) {
+      break;
+    }
+
     //
     // Make sure Host Controller not halt before reset it
     //
@@ -561,9 +832,11 @@ XhcSetRootHubPortFeature (
     // 4.3.1 Resetting a Root Hub Port
     // 1) Write the PORTSC register with the Port Reset (PR) bit set to '1'.
     //
+    USB_PROFILE_PORT_RESET_START (Xhc->Profile, PortNumber);
     State |= XHC_PORTSC_RESET;
     XhcWriteOpReg (Xhc, Offset, State);
     XhcWaitOpRegBit(Xhc, Offset, XHC_PORTSC_PRC, TRUE, XHC_GENERIC_TIMEOUT);
+    USB_PROFILE_PORT_RESET_DONE (Xhc->Profile, PortNumber);
     break;
 
   case EfiUsbPortPower:
@@ -767,8 +1040,10 @@ XhcTransfer (
   EFI_STATUS              Status;
   EFI_STATUS              RecoveryStatus;
   URB                     *Urb;
+  UINT64                  StartTick;
 
   ASSERT ((Type == XHC_CTRL_TRANSFER) || (Type == XHC_BULK_TRANSFER) || (Type == XHC_INT_TRANSFER_SYNC));
+  StartTick = USB_PROFILE_TIMESTAMP ();
   Urb = XhcCreateUrb (
           Xhc,
           DeviceAddress,
@@ -819,6 +1094,16 @@ XhcTransfer (
     }
   }
 
+  USB_PROFILE_TRANSFER (
+    Xhc->Profile,
+    DeviceAddress,
+    (Type == XHC_CTRL_TRANSFER) ? UsbProfileControl :
+    (Type == XHC_BULK_TRANSFER) ? UsbProfileBulk : UsbProfileInterrupt,
+    Urb->Completed,
+    StartTick,
+    Status
+    );
+
   XhcFreeUrb (Xhc, Urb);
   return Status;
 }
@@ -1029,12 +1314,18 @@ XhcControlTransfer (
         }
     } else if (DescriptorType == USB_DESC_TYPE_CONFIG) {
       ASSERT (Data != NULL);
-      if (*DataLength == ((UINT16 *)Data)[1]) {
+      Index = (UINT8)Request->Value;
+      //
+      // Class drivers may read the configuration descriptor again (e.g. for class
+      // specific descriptors), keep the copy and the alternate settings saved at
+      // enumeration time.
+      //
+      if ((*DataLength == ((UINT16 *)Data)[1]) &&
+          (Index < Xhc->UsbDevContext[SlotId].DevDesc.NumConfigurations) &&
+          (Xhc->UsbDevContext[SlotId].ConfDesc[Index] == NULL)) {
         //
         // Get configuration value from request, Store the configuration descriptor for Configure_Endpoint cmd.
         //
-        Index = (UINT8)Request->Value;
-        ASSERT (Index < Xhc->UsbDevContext[SlotId].DevDesc.NumConfigurations);
         Xhc->UsbDevContext[SlotId].ConfDesc[Index] = AllocateZeroPool(*DataLength);
         CopyMem (Xhc->UsbDevContext[SlotId].ConfDesc[Index], Data, *DataLength);
         //
@@ -1638,6 +1929,403 @@ XhcAsyncIsochronousTransfer (
   return EFI_UNSUPPORTED;
 }
 
+/**
+  Translate the USB device path nodes below the host controller into the
+  logical device address of the device.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  RemainingDevicePath   The USB() device path nodes that follow the
+                                host controller device path.
+  @param  DeviceAddress         Returns the logical device address.
+  @param  DeviceSpeed           Returns the device speed (EFI_USB_SPEED_*).
+
+  @retval EFI_SUCCESS           The device was found.
+  @retval EFI_INVALID_PARAMETER The device path is not a USB device path.
+  @retval EFI_NOT_FOUND         No enabled device matches the device path.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamGetDevice (
+  IN  ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN  EFI_DEVICE_PATH_PROTOCOL      *RemainingDevicePath,
+  OUT UINT8                         *DeviceAddress,
+  OUT UINT8                         *DeviceSpeed
+  )
+{
+  USB_XHCI_INSTANCE         *Xhc;
+  EFI_DEVICE_PATH_PROTOCOL  *Node;
+  USB_DEV_ROUTE             RouteChart;
+  UINT8                     Port;
+  UINT8                     SlotId;
+  EFI_TPL                   OldTpl;
+
+  if ((RemainingDevicePath == NULL) || (DeviceAddress == NULL) || (DeviceSpeed == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Build the route string the same way XhcPollPortStatusChange does: the
+  // first node is a zero-based root port, every further node a hub port.
+  //
+  RouteChart.Dword = 0;
+  for (Node = RemainingDevicePath; !IsDevicePathEnd (Node); Node = NextDevicePathNode (Node)) {
+    if ((DevicePathType (Node) != MESSAGING_DEVICE_PATH) ||
+        (DevicePathSubType (Node) != MSG_USB_DP)) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    Port = ((USB_DEVICE_PATH *) Node)->ParentPortNumber;
+    if (RouteChart.Dword == 0) {
+      RouteChart.Route.RootPortNum = Port + 1;
+      RouteChart.Route.TierNum     = 1;
+    } else {
+      //
+      // UsbBus numbers hub ports from zero, the route string from one.
+      //
+      Port++;
+      if (Port < 14) {
+        RouteChart.Route.RouteString |= Port << (4 * (RouteChart.Route.TierNum - 1));
+      } else {
+        RouteChart.Route.RouteString |= 15 << (4 * (RouteChart.Route.TierNum - 1));
+      }
+      RouteChart.Route.TierNum++;
+    }
+  }
+
+  if (RouteChart.Dword == 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  OldTpl = gBS->RaiseTPL (XHC_TPL);
+  Xhc    = XHC_FROM_STREAM_THIS (This);
+  SlotId = XhcRouteStringToSlotId (Xhc, RouteChart);
+  if (SlotId != 0) {
+    *DeviceAddress = Xhc->UsbDevContext[SlotId].BusDevAddr;
+    //
+    // The slot context speed is the EFI_USB_SPEED_* value plus one, and has
+    // the same place in SLOT_CONTEXT and SLOT_CONTEXT_64.
+    //
+    *DeviceSpeed   = (UINT8) (((DEVICE_CONTEXT *) Xhc->UsbDevContext[SlotId].OutputContext)->Slot.Speed - 1);
+  }
+  gBS->RestoreTPL (OldTpl);
+
+  return (SlotId != 0) ? EFI_SUCCESS : EFI_NOT_FOUND;
+}
+
+/**
+  Translate a list of endpoint addresses into device context indexes.
+
+  @param  EndpointAddresses     The endpoint addresses, direction in bit 7.
+  @param  NumberOfEndpoints     The number of entries in EndpointAddresses.
+  @param  Dcis                  Returns the device context indexes.
+
+  @retval EFI_SUCCESS           The endpoints were translated.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+
+**/
+STATIC
+EFI_STATUS
+XhcStreamEndpointsToDcis (
+  IN  UINT8                         *EndpointAddresses,
+  IN  UINTN                         NumberOfEndpoints,
+  OUT UINT8                         *Dcis
+  )
+{
+  UINTN                     Index;
+
+  if ((EndpointAddresses == NULL) || (NumberOfEndpoints == 0) || (NumberOfEndpoints > 30)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  for (Index = 0; Index < NumberOfEndpoints; Index++) {
+    Dcis[Index] = XhcEndpointToDci (
+                    (UINT8) (EndpointAddresses[Index] & 0x0F),
+                    (UINT8) (XHCI_IS_DATAIN (EndpointAddresses[Index]) ? EfiUsbDataIn : EfiUsbDataOut)
+                    );
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Allocate the same number of streams on a set of bulk endpoints.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  DeviceAddress         The logical device address.
+  @param  EndpointAddresses     The bulk endpoint addresses, direction in bit 7.
+  @param  NumberOfEndpoints     The number of entries in EndpointAddresses.
+  @param  NumberOfStreams       On input, the number of streams wanted. On
+                                output, the number of streams allocated.
+
+  @retval EFI_SUCCESS           The streams were allocated.
+  @retval EFI_UNSUPPORTED       The controller or an endpoint has no stream support.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_OUT_OF_RESOURCES  The stream rings could not be allocated.
+  @retval EFI_DEVICE_ERROR      The Configure Endpoint command failed.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamAllocate (
+  IN     ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN     UINT8                         DeviceAddress,
+  IN     UINT8                         *EndpointAddresses,
+  IN     UINTN                         NumberOfEndpoints,
+  IN OUT UINT16                        *NumberOfStreams
+  )
+{
+  USB_XHCI_INSTANCE         *Xhc;
+  EFI_STATUS                Status;
+  UINT8                     Dcis[30];
+  UINT8                     SlotId;
+  EFI_TPL                   OldTpl;
+
+  Status = XhcStreamEndpointsToDcis (EndpointAddresses, NumberOfEndpoints, Dcis);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  OldTpl = gBS->RaiseTPL (XHC_TPL);
+  Xhc    = XHC_FROM_STREAM_THIS (This);
+  SlotId = XhcBusDevAddrToSlotId (Xhc, DeviceAddress);
+  if (SlotId == 0) {
+    Status = EFI_INVALID_PARAMETER;
+  } else {
+    Status = XhcAllocateEndpointStreams (Xhc, SlotId, Dcis, NumberOfEndpoints, NumberOfStreams);
+  }
+  gBS->RestoreTPL (OldTpl);
+
+  return Status;
+}
+
+/**
+  Free the streams of a set of bulk endpoints and return them to a single
+  transfer ring.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  DeviceAddress         The logical device address.
+  @param  EndpointAddresses     The bulk endpoint addresses, direction in bit 7.
+  @param  NumberOfEndpoints     The number of entries in EndpointAddresses.
+
+  @retval EFI_SUCCESS           The streams were freed.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_DEVICE_ERROR      The Configure Endpoint command failed.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamFree (
+  IN ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN UINT8                         DeviceAddress,
+  IN UINT8                         *EndpointAddresses,
+  IN UINTN                         NumberOfEndpoints
+  )
+{
+  USB_XHCI_INSTANCE         *Xhc;
+  EFI_STATUS                Status;
+  UINT8                     Dcis[30];
+  UINT8                     SlotId;
+  EFI_TPL                   OldTpl;
+
+  Status = XhcStreamEndpointsToDcis (EndpointAddresses, NumberOfEndpoints, Dcis);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  OldTpl = gBS->RaiseTPL (XHC_TPL);
+  Xhc    = XHC_FROM_STREAM_THIS (This);
+  SlotId = XhcBusDevAddrToSlotId (Xhc, DeviceAddress);
+  if (SlotId == 0) {
+    Status = EFI_INVALID_PARAMETER;
+  } else {
+    Status = XhcReleaseEndpointStreams (Xhc, SlotId, Dcis, NumberOfEndpoints);
+  }
+  gBS->RestoreTPL (OldTpl);
+
+  return Status;
+}
+
+/**
+  Queue a bulk transfer without waiting for it to complete.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  DeviceAddress         The logical device address.
+  @param  EndpointAddress       The bulk endpoint address, direction in bit 7.
+  @param  StreamId              The stream to queue the transfer on, or 0 for
+                                an endpoint without streams.
+  @param  Data                  The data buffer.
+  @param  DataLength            The size, in bytes, of the data buffer.
+  @param  Transfer              Returns the handle of the queued transfer.
+
+  @retval EFI_SUCCESS           The transfer was queued.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_OUT_OF_RESOURCES  The transfer could not be queued.
+  @retval EFI_DEVICE_ERROR      The host controller is halted.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamSubmit (
+  IN  ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN  UINT8                         DeviceAddress,
+  IN  UINT8                         EndpointAddress,
+  IN  UINT16                        StreamId,
+  IN  VOID                          *Data,
+  IN  UINTN                         DataLength,
+  OUT VOID                          **Transfer
+  )
+{
+  USB_XHCI_INSTANCE         *Xhc;
+  URB                       *Urb;
+  EFI_STATUS                Status;
+  UINT8                     SlotId;
+  UINT8                     Dci;
+  EFI_TPL                   OldTpl;
+
+  if ((Data == NULL) || (DataLength == 0) || (Transfer == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  OldTpl = gBS->RaiseTPL (XHC_TPL);
+  Xhc    = XHC_FROM_STREAM_THIS (This);
+  Status = EFI_SUCCESS;
+
+  if (XhcIsHalt (Xhc) || XhcIsSysError (Xhc)) {
+    DEBUG ((EFI_D_ERROR, "XhcStreamSubmit: HC is halted\n"));
+    Status = EFI_DEVICE_ERROR;
+    goto ON_EXIT;
+  }
+
+  SlotId = XhcBusDevAddrToSlotId (Xhc, DeviceAddress);
+  if (SlotId == 0) {
+    Status = EFI_INVALID_PARAMETER;
+    goto ON_EXIT;
+  }
+
+  Urb = XhcCreateStreamUrb (Xhc, DeviceAddress, EndpointAddress, StreamId, Data, DataLength);
+  if (Urb == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto ON_EXIT;
+  }
+
+  InsertTailList (&Xhc->StreamTransfers, &Urb->UrbList);
+
+  Dci = XhcEndpointToDci (Urb->Ep.EpAddr, (UINT8) (Urb->Ep.Direction));
+  XhcRingStreamDoorBell (Xhc, SlotId, Dci, StreamId);
+  *Transfer = Urb;
+
+ON_EXIT:
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  Check a queued transfer. Once the transfer has completed its resources are
+  released and the handle must not be used again.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  Transfer              The handle returned by Submit.
+  @param  DataLength            Returns the number of bytes transferred.
+  @param  TransferResult        Returns the EFI_USB_ERR_* result bits.
+
+  @retval EFI_NOT_READY         The transfer is still pending.
+  @retval EFI_SUCCESS           The transfer completed successfully.
+  @retval EFI_DEVICE_ERROR      The transfer completed with an error.
+  @retval EFI_INVALID_PARAMETER Transfer is invalid.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamPoll (
+  IN  ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN  VOID                          *Transfer,
+  OUT UINTN                         *DataLength,
+  OUT UINT32                        *TransferResult
+  )
+{
+  USB_XHCI_INSTANCE         *Xhc;
+  URB                       *Urb;
+  EFI_STATUS                Status;
+  EFI_STATUS                RecoveryStatus;
+  EFI_TPL                   OldTpl;
+
+  Urb = (URB *) Transfer;
+  if ((Urb == NULL) || (Urb->Signature != XHC_URB_SIG) ||
+      (DataLength == NULL) || (TransferResult == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  OldTpl = gBS->RaiseTPL (XHC_TPL);
+  Xhc    = XHC_FROM_STREAM_THIS (This);
+
+  if (!XhcCheckUrbResult (Xhc, Urb)) {
+    gBS->RestoreTPL (OldTpl);
+    return EFI_NOT_READY;
+  }
+
+  *TransferResult = Urb->Result;
+  *DataLength     = Urb->Completed;
+  Status          = (Urb->Result == EFI_USB_NOERROR) ? EFI_SUCCESS : EFI_DEVICE_ERROR;
+
+  if ((Urb->Result == EFI_USB_ERR_STALL) || (Urb->Result == EFI_USB_ERR_BABBLE)) {
+    RecoveryStatus = XhcRecoverHaltedEndpoint (Xhc, Urb);
+    if (EFI_ERROR (RecoveryStatus)) {
+      DEBUG ((DEBUG_ERROR, "XhcStreamPoll: XhcRecoverHaltedEndpoint failed!\n"));
+    }
+  }
+
+  RemoveEntryList (&Urb->UrbList);
+  XhcFreeUrb (Xhc, Urb);
+  gBS->RestoreTPL (OldTpl);
+
+  return Status;
+}
+
+/**
+  Remove a pending transfer from its ring and release it.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  Transfer              The handle returned by Submit.
+
+  @retval EFI_SUCCESS           The transfer was cancelled.
+  @retval EFI_INVALID_PARAMETER Transfer is invalid.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamCancel (
+  IN ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN VOID                          *Transfer
+  )
+{
+  USB_XHCI_INSTANCE         *Xhc;
+  URB                       *Urb;
+  EFI_STATUS                Status;
+  EFI_TPL                   OldTpl;
+
+  Urb = (URB *) Transfer;
+  if ((Urb == NULL) || (Urb->Signature != XHC_URB_SIG)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  OldTpl = gBS->RaiseTPL (XHC_TPL);
+  Xhc    = XHC_FROM_STREAM_THIS (This);
+
+  if (!Urb->Finished) {
+    Status = XhcDequeueTrbFromEndpoint (Xhc, Urb);
+    if (EFI_ERROR (Status) && (Status != EFI_ALREADY_STARTED)) {
+      DEBUG ((DEBUG_ERROR, "XhcStreamCancel: XhcDequeueTrbFromEndpoint failed, Status = %r\n", Status));
+    }
+  }
+
+  RemoveEntryList (&Urb->UrbList);
+  XhcFreeUrb (Xhc, Urb);
+  gBS->RestoreTPL (OldTpl);
+
+  return EFI_SUCCESS;
+}
+
 /**
   Create and initialize a USB_XHCI_INSTANCE structure.
 
@@ -1671,8 +2359,10 @@ XhcCreateUsbHc (
   Xhc->UsbHcBaseAddress= PcdGet32(PcdXhciBaseAddress) + XhciNum * PcdGet32(PcdXhciSize);;
 
   CopyMem (&Xhc->Usb2Hc, &gXhciUsb2HcTemplate, sizeof (EFI_USB2_HC_PROTOCOL));
+  CopyMem (&Xhc->UsbStream, &gXhciUsbStreamTemplate, sizeof (ROCKCHIP_USB_STREAM_PROTOCOL));
 
   InitializeListHead (&Xhc->AsyncIntTransfers);
+  InitializeListHead (&Xhc->StreamTransfers);
 
   //
   // Be caution that the Offset passed to XhcReadCapReg() should be Dword align
@@ -1717,6 +2407,27 @@ XhcCreateUsbHc (
                   &Xhc->PollTimer
                   );
 
+  if (EFI_ERROR (Status)) {
+    goto ON_ERROR;
+  }
+  Xhc->PollInterval = XHC_ASYNC_TIMER_INTERVAL;
+
+  //
+  // Create Root Port Polling Timer
+  //
+  Xhc->RootPorts = AllocateZeroPool (Xhc->HcSParams1.Data.MaxPorts * sizeof (XHC_ROOT_PORT));
+  if (Xhc->RootPorts == NULL) {
+    goto ON_ERROR;
+  }
+
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  XhcMonitorRootPorts,
+                  Xhc,
+                  &Xhc->PortTimer
+                  );
+
   if (EFI_ERROR (Status)) {
     goto ON_ERROR;
   }
@@ -1724,6 +2435,12 @@ XhcCreateUsbHc (
   return Xhc;
 
 ON_ERROR:
+  if (Xhc->RootPorts != NULL) {
+    FreePool (Xhc->RootPorts);
+  }
+  if (Xhc->PollTimer != NULL) {
+    gBS->CloseEvent (Xhc->PollTimer);
+  }
   FreePool (Xhc);
   return NULL;
 }
@@ -1754,25 +2471,47 @@ XhcExitBootService (
   // and uninstall the XHCI protocl.
   //
   gBS->SetTimer (Xhc->PollTimer, TimerCancel, 0);
-  XhcHaltHC (Xhc, XHC_GENERIC_TIMEOUT);
+  gBS->SetTimer (Xhc->PortTimer, TimerCancel, 0);
+  if (XhcIsHostMode (Xhc)) {
+    XhcHaltHC (Xhc, XHC_GENERIC_TIMEOUT);
+  }
 
   if (Xhc->PollTimer != NULL) {
     gBS->CloseEvent (Xhc->PollTimer);
   }
 
+  if (Xhc->PortTimer != NULL) {
+    gBS->CloseEvent (Xhc->PortTimer);
+  }
+
   XhcClearBiosOwnership (Xhc);
 }
 
+/**
+  Create and install an XHCI instance, then start resetting the controller.
+  The reset is finished by XhciInitialiseController(), so that all the
+  controllers reset at the same time.
+
+  @param  XhciNum               Index of the controller.
+  @param  Xhc                   The created XHCI instance.
+
+  @retval EFI_SUCCESS           The controller is being reset.
+  @return Others                The controller could not be created.
+
+**/
+STATIC
 EFI_STATUS
-EFIAPI
-XhciInitialiseController (
-  IN UINT32        XhciNum
+XhciCreateController (
+  IN  UINT32             XhciNum,
+  OUT USB_XHCI_INSTANCE  **Xhc
   )
 {
   EFI_STATUS              Status;
   XHCI_DEVICE_PATH        *DevicePath;
-  USB_XHCI_INSTANCE       *Xhc;
   STATIC INTN Bus = 0;
+
+  *Xhc = NULL;
+
   DevicePath = AllocateCopyPool (sizeof(XhciDevicePathProtocol),
                                  &XhciDevicePathProtocol);
   if (DevicePath == NULL) {
@@ -1782,18 +2521,39 @@ XhciInitialiseController (
   //
   // Create then install USB2_HC_PROTOCOL
   //
-  Xhc = XhcCreateUsbHc (XhciNum);
+  *Xhc = XhcCreateUsbHc (XhciNum);
+  if (*Xhc == NULL) {
+    FreePool (DevicePath);
+    return EFI_OUT_OF_RESOURCES;
+  }
 
   Status = gBS->InstallMultipleProtocolInterfaces(
-     &Xhc->Controller,
+     &(*Xhc)->Controller,
      &gEfiUsb2HcProtocolGuid,
-     &Xhc->Usb2Hc,
+     &(*Xhc)->Usb2Hc,
+     &gRockchipUsbStreamProtocolGuid,
+     &(*Xhc)->UsbStream,
      &gEfiDevicePathProtocolGuid,
      (EFI_DEVICE_PATH_PROTOCOL *) DevicePath,
      NULL);
-  XhcSetBiosOwnership (Xhc);
+  if (USB_PROFILE_ENABLED) {
+    (*Xhc)->Profile = UsbProfileCreate ((*Xhc)->Controller, L"XHCI", (*Xhc)->UsbHcBaseAddress);
+  }
+  XhcSetBiosOwnership (*Xhc);
+  Bus++;
 
-  XhcResetHC (Xhc, XHC_RESET_TIMEOUT);
+  return XhcStartResetHC (*Xhc, XHC_RESET_TIMEOUT);
+}
+
+EFI_STATUS
+EFIAPI
+XhciInitialiseController (
+  IN USB_XHCI_INSTANCE  *Xhc
+  )
+{
+  EFI_STATUS              Status;
+
+  XhcWaitResetHC (Xhc, XHC_RESET_TIMEOUT);
   ASSERT (XhcIsHalt (Xhc));
 
   //
@@ -1815,13 +2575,25 @@ XhciInitialiseController (
   //
   // Start the asynchronous interrupt monitor
   //
-  Status = gBS->SetTimer (Xhc->PollTimer, TimerPeriodic, XHC_ASYNC_TIMER_INTERVAL);
+  Status = gBS->SetTimer (Xhc->PollTimer, TimerPeriodic, Xhc->PollInterval);
   if (EFI_ERROR (Status)) {
     DEBUG ((EFI_D_ERROR, "Xhc failed to start async interrupt monitor\n"));
     XhcHaltHC (Xhc, XHC_GENERIC_TIMEOUT);
     goto FREE_POOL;
   }
 
+  //
+  // Start the root port monitor, it debounces and resets connected
+  // devices while the other controllers and drivers come up.
+  //
+  Status = gBS->SetTimer (Xhc->PortTimer, TimerPeriodic, XHC_PORT_TIMER_INTERVAL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "Xhc failed to start root port monitor\n"));
+    gBS->SetTimer (Xhc->PollTimer, TimerCancel, 0);
+    XhcHaltHC (Xhc, XHC_GENERIC_TIMEOUT);
+    goto FREE_POOL;
+  }
+
   //
   // Create event to stop the HC when exit boot service.
   //
@@ -1837,13 +2609,15 @@ XhciInitialiseController (
   if (EFI_ERROR (Status)) {
     goto FREE_POOL;
   }
-  Bus++;
 
   return EFI_SUCCESS;
 
 FREE_POOL:
   gBS->CloseEvent (Xhc->PollTimer);
+  gBS->CloseEvent (Xhc->PortTimer);
+  UsbProfileDestroy (Xhc->Profile);
   XhcFreeSched (Xhc);
+  FreePool (Xhc->RootPorts);
   FreePool (Xhc);
   return Status;
 }
@@ -1903,14 +2677,42 @@ XhciInitialise (
   EFI_STATUS  Status;
   UINT32  Index;
   UINT32  XhciNum;
+  USB_XHCI_INSTANCE  **XhcList;
 
   /* Initialize enabled chips */
   XhciNum = PcdGet32(PcdNumXhciController);
+  XhcList = AllocateZeroPool (XhciNum * sizeof (USB_XHCI_INSTANCE *));
+  if (XhcList == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Reset all the controllers together, then wait for each of them.
+  //
+  for(Index = 0; Index < XhciNum; Index++) {
+    Status = XhciCreateController(Index, &XhcList[Index]);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((EFI_D_ERROR, "XhciCreateController %d Status = %r\n",Index, Status));
+      XhcList[Index] = NULL;
+    }
+  }
+
+  //
+  // Some XHCI host controllers require to have extra 1ms delay before
+  // accessing any MMIO register during reset.
+  //
+  gBS->Stall (XHC_1_MILLISECOND);
+
   for(Index = 0; Index < XhciNum; Index++) {
-    Status = XhciInitialiseController(Index);
+    if (XhcList[Index] == NULL) {
+      continue;
+    }
+    Status = XhciInitialiseController(XhcList[Index]);
     DEBUG ((EFI_D_ERROR, "XhciInitialiseController %d Status = %r\n",Index, Status));
   }
 
+  FreePool (XhcList);
+
   Status = gBS->CreateEventEx (EVT_NOTIFY_SIGNAL,
                     TPL_CALLBACK,
                     OnEndOfDxe,
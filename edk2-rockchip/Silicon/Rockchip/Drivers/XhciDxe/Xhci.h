@@ -14,6 +14,7 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Uefi.h>
 
 #include <Protocol/Usb2HostController.h>
+#include <Protocol/UsbStream.h>
 #include <Guid/EventGroup.h>
 
 #include <Library/RockchipPlatformLib.h>
@@ -23,12 +24,16 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/DmaLib.h>
+#include <Library/DmaBufferLib.h>
 #include <Library/PcdLib.h>
 #include <Library/IoLib.h>
 
 #include <Library/UefiLib.h>
 #include <Library/DebugLib.h>
 #include <Library/ReportStatusCodeLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/UsbHcMemLib.h>
+#include <Library/UsbProfileLib.h>
 
 #include <IndustryStandard/Pci.h>
 
@@ -37,7 +42,6 @@ typedef struct _USB_DEV_CONTEXT      USB_DEV_CONTEXT;
 
 #include "XhciReg.h"
 #include "XhciSched.h"
-#include "UsbHcMem.h"
 
 //
 // The unit is microsecond, setting it as 1us.
@@ -67,6 +71,27 @@ typedef struct _USB_DEV_CONTEXT      USB_DEV_CONTEXT;
 // The unit is 100us, takes 1ms as interval.
 //
 #define XHC_ASYNC_TIMER_INTERVAL     EFI_TIMER_PERIOD_MILLISECONDS(1)
+//
+// The async transfer timer backs off while no interrupt transfer completes:
+// the interval doubles every XHC_ASYNC_IDLE_POLLS idle polls up to 16ms, and
+// drops back to XHC_ASYNC_TIMER_INTERVAL on the next completion.
+//
+#define XHC_ASYNC_TIMER_MAX_INTERVAL EFI_TIMER_PERIOD_MILLISECONDS(16)
+#define XHC_ASYNC_IDLE_POLLS         (64)
+
+//
+// Root port pre-reset timing, see XhcMonitorRootPorts(). The units are
+// millisecond: 100ms connect debounce (USB 2.0 spec TATTDB), up to 500ms
+// for the reset to complete and 10ms reset recovery (TRSTRCY).
+//
+#define XHC_PORT_DEBOUNCE_TIME       (100)
+#define XHC_PORT_RESET_TIMEOUT       (500)
+#define XHC_PORT_RECOVERY_TIME       (10)
+//
+// XHC root port monitor timer interval, the unit is millisecond.
+//
+#define XHC_PORT_POLL_TIME           (5)
+#define XHC_PORT_TIMER_INTERVAL      EFI_TIMER_PERIOD_MILLISECONDS(XHC_PORT_POLL_TIME)
 
 //
 // XHC raises TPL to TPL_NOTIFY to serialize all its operations
@@ -98,6 +123,7 @@ typedef struct _USB_DEV_CONTEXT      USB_DEV_CONTEXT;
 
 #define XHCI_INSTANCE_SIG              SIGNATURE_32 ('x', 'h', 'c', 'i')
 #define XHC_FROM_THIS(a)               CR(a, USB_XHCI_INSTANCE, Usb2Hc, XHCI_INSTANCE_SIG)
+#define XHC_FROM_STREAM_THIS(a)        CR(a, USB_XHCI_INSTANCE, UsbStream, XHCI_INSTANCE_SIG)
 
 #define USB_DESC_TYPE_HUB              0x29
 #define USB_DESC_TYPE_HUB_SUPER_SPEED  0x2a
@@ -180,6 +206,16 @@ struct _USB_DEV_CONTEXT {
   //
   VOID                      *EndpointTransferRing[31];
   //
+  // The bulk stream state for every endpoint, NULL while the endpoint uses
+  // the single transfer ring above.
+  //
+  XHC_STREAM_INFO           *EndpointStreams[31];
+  //
+  // The MaxStreams exponent from the SuperSpeed Endpoint Companion descriptor
+  // of every bulk endpoint, 0 if the endpoint has no streams.
+  //
+  UINT8                     EndpointMaxStreams[31];
+  //
   // The device descriptor which is stored to support XHCI's Evaluate_Context cmd.
   //
   EFI_USB_DEVICE_DESCRIPTOR DevDesc;
@@ -201,11 +237,38 @@ struct _USB_DEV_CONTEXT {
   UINT8                     *ActiveAlternateSetting;
 };
 
+//
+// State of the pre-reset a root port goes through after a device is
+// connected, so that debounce and reset of all root ports overlap.
+//
+typedef enum {
+  XhcPortIdle,        ///< Nothing connected, or controller not running
+  XhcPortDebounce,    ///< Waiting for the connection to be stable
+  XhcPortResetting,   ///< Port reset issued, waiting for PRC
+  XhcPortRecovery,    ///< Reset recovery time after PRC
+  XhcPortReady,       ///< Reset done, not yet claimed by the bus driver
+  XhcPortEnumerated,  ///< Handed over to the bus driver
+  XhcPortFailed       ///< Pre-reset failed, the bus driver resets it itself
+} XHC_PORT_STATE;
+
+typedef struct {
+  XHC_PORT_STATE            State;
+  //
+  // Milliseconds left in the current state
+  //
+  UINT32                    Remaining;
+  //
+  // Report USB_PORT_STAT_C_RESET on the next port status request
+  //
+  BOOLEAN                   ResetChange;
+} XHC_ROOT_PORT;
+
 struct _USB_XHCI_INSTANCE {
   UINT32                    Signature;
   USBHC_MEM_POOL            *MemPool;
 
   EFI_USB2_HC_PROTOCOL      Usb2Hc;
+  ROCKCHIP_USB_STREAM_PROTOCOL UsbStream;
   EFI_HANDLE                Controller;
 
   EFI_DEVICE_PATH_PROTOCOL  *DevicePath;
@@ -216,7 +279,20 @@ struct _USB_XHCI_INSTANCE {
   //
   EFI_EVENT                 ExitBootServiceEvent;
   EFI_EVENT                 PollTimer;
+  UINT64                    PollInterval;
+  UINTN                     IdlePolls;
+  EFI_EVENT                 PortTimer;
+  XHC_ROOT_PORT             *RootPorts;
+  //
+  // The core was seen in device mode, its host registers and schedule
+  // are lost and must be set up again once it is back in host mode.
+  //
+  BOOLEAN                   Lent;
   LIST_ENTRY                AsyncIntTransfers;
+  //
+  // Bulk URBs queued through ROCKCHIP_USB_STREAM_PROTOCOL
+  //
+  LIST_ENTRY                StreamTransfers;
 
   UINT8                     CapLength;    ///< Capability Register Length
   XHC_HCSPARAMS1            HcSParams1;   ///< Structural Parameters 1
@@ -260,6 +336,11 @@ struct _USB_XHCI_INSTANCE {
   BOOLEAN                   Support64BitDma; // Whether 64 bit DMA may be used with this device
 
   UINT32                    UsbHcBaseAddress;
+
+  //
+  // Timing counters, NULL unless PcdUsbProfileEnable is set
+  //
+  USB_PROFILE               *Profile;
 };
 
 /**
@@ -659,4 +740,149 @@ XhcAsyncIsochronousTransfer (
   IN     VOID                                *Context
   );
 
+/**
+  Translate the USB device path nodes below the host controller into the
+  logical device address of the device.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  RemainingDevicePath   The USB() device path nodes that follow the
+                                host controller device path.
+  @param  DeviceAddress         Returns the logical device address.
+  @param  DeviceSpeed           Returns the device speed (EFI_USB_SPEED_*).
+
+  @retval EFI_SUCCESS           The device was found.
+  @retval EFI_INVALID_PARAMETER The device path is not a USB device path.
+  @retval EFI_NOT_FOUND         No enabled device matches the device path.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamGetDevice (
+  IN  ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN  EFI_DEVICE_PATH_PROTOCOL      *RemainingDevicePath,
+  OUT UINT8                         *DeviceAddress,
+  OUT UINT8                         *DeviceSpeed
+  );
+
+/**
+  Allocate the same number of streams on a set of bulk endpoints.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  DeviceAddress         The logical device address.
+  @param  EndpointAddresses     The bulk endpoint addresses, direction in bit 7.
+  @param  NumberOfEndpoints     The number of entries in EndpointAddresses.
+  @param  NumberOfStreams       On input, the number of streams wanted. On
+                                output, the number of streams allocated.
+
+  @retval EFI_SUCCESS           The streams were allocated.
+  @retval EFI_UNSUPPORTED       The controller or an endpoint has no stream support.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_OUT_OF_RESOURCES  The stream rings could not be allocated.
+  @retval EFI_DEVICE_ERROR      The Configure Endpoint command failed.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamAllocate (
+  IN     ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN     UINT8                         DeviceAddress,
+  IN     UINT8                         *EndpointAddresses,
+  IN     UINTN                         NumberOfEndpoints,
+  IN OUT UINT16                        *NumberOfStreams
+  );
+
+/**
+  Free the streams of a set of bulk endpoints and return them to a single
+  transfer ring.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  DeviceAddress         The logical device address.
+  @param  EndpointAddresses     The bulk endpoint addresses, direction in bit 7.
+  @param  NumberOfEndpoints     The number of entries in EndpointAddresses.
+
+  @retval EFI_SUCCESS           The streams were freed.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_DEVICE_ERROR      The Configure Endpoint command failed.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamFree (
+  IN ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN UINT8                         DeviceAddress,
+  IN UINT8                         *EndpointAddresses,
+  IN UINTN                         NumberOfEndpoints
+  );
+
+/**
+  Queue a bulk transfer without waiting for it to complete.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  DeviceAddress         The logical device address.
+  @param  EndpointAddress       The bulk endpoint address, direction in bit 7.
+  @param  StreamId              The stream to queue the transfer on, or 0 for
+                                an endpoint without streams.
+  @param  Data                  The data buffer.
+  @param  DataLength            The size, in bytes, of the data buffer.
+  @param  Transfer              Returns the handle of the queued transfer.
+
+  @retval EFI_SUCCESS           The transfer was queued.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_OUT_OF_RESOURCES  The transfer could not be queued.
+  @retval EFI_DEVICE_ERROR      The host controller is halted.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamSubmit (
+  IN  ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN  UINT8                         DeviceAddress,
+  IN  UINT8                         EndpointAddress,
+  IN  UINT16                        StreamId,
+  IN  VOID                          *Data,
+  IN  UINTN                         DataLength,
+  OUT VOID                          **Transfer
+  );
+
+/**
+  Check a queued transfer. Once the transfer has completed its resources are
+  released and the handle must not be used again.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  Transfer              The handle returned by Submit.
+  @param  DataLength            Returns the number of bytes transferred.
+  @param  TransferResult        Returns the EFI_USB_ERR_* result bits.
+
+  @retval EFI_NOT_READY         The transfer is still pending.
+  @retval EFI_SUCCESS           The transfer completed successfully.
+  @retval EFI_DEVICE_ERROR      The transfer completed with an error.
+  @retval EFI_INVALID_PARAMETER Transfer is invalid.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamPoll (
+  IN  ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN  VOID                          *Transfer,
+  OUT UINTN                         *DataLength,
+  OUT UINT32                        *TransferResult
+  );
+
+/**
+  Remove a pending transfer from its ring and release it.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  Transfer              The handle returned by Submit.
+
+  @retval EFI_SUCCESS           The transfer was cancelled.
+  @retval EFI_INVALID_PARAMETER Transfer is invalid.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcStreamCancel (
+  IN ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN VOID                          *Transfer
+  );
+
 #endif
@@ -498,6 +498,27 @@ XhcIsSysError (
   return XHC_REG_BIT_IS_SET (Xhc, XHC_USBSTS_OFFSET, XHC_USBSTS_HSE);
 }
 
+/**
+  Whether the DWC3 core behind the XHCI instance is in host mode. It is
+  switched to device mode while UsbDwc3DeviceDxe uses it.
+
+  @param  Xhc      The XHCI Instance.
+
+  @retval TRUE     The core is in host mode.
+  @retval FALSE    The core is in device mode.
+
+**/
+BOOLEAN
+XhcIsHostMode (
+  IN USB_XHCI_INSTANCE    *Xhc
+  )
+{
+  UINT32                  Gctl;
+
+  Gctl = MmioRead32 (Xhc->UsbHcBaseAddress + XHC_DWC3_GCTL_OFFSET);
+  return (BOOLEAN) (XHC_DWC3_GCTL_PRTCAPDIR (Gctl) == XHC_DWC3_PRTCAP_HOST);
+}
+
 /**
   Set USBCMD Host System Error Enable(HSEE) Bit if PCICMD SERR# Enable Bit is set.
 
@@ -522,25 +543,26 @@ XhcSetHsee (
 }
 
 /**
-  Reset the XHCI host controller.
+  Start resetting the XHCI host controller without waiting for the reset
+  to complete. This lets several controllers reset at the same time, the
+  caller finishes each of them with XhcWaitResetHC().
 
   @param  Xhc          The XHCI Instance.
-  @param  Timeout      Time to wait before abort (in millisecond, ms).
+  @param  Timeout      Time to wait for the controller to halt (in millisecond, ms).
 
-  @retval EFI_SUCCESS  The XHCI host controller is reset.
-  @return Others       Failed to reset the XHCI before Timeout.
+  @retval EFI_SUCCESS  The reset is in progress, or was skipped because the
+                       debug capability owns the controller.
+  @return Others       Failed to halt the XHCI before Timeout.
 
 **/
 EFI_STATUS
-XhcResetHC (
+XhcStartResetHC (
   IN USB_XHCI_INSTANCE    *Xhc,
   IN UINT32               Timeout
   )
 {
   EFI_STATUS              Status;
 
-  Status = EFI_SUCCESS;
-
   DEBUG ((EFI_D_INFO, "XhcResetHC!\n"));
   //
   // Host can only be reset when it is halt. If not so, halt it
@@ -556,26 +578,78 @@ XhcResetHC (
   if ((Xhc->DebugCapSupOffset == 0xFFFFFFFF) || ((XhcReadExtCapReg (Xhc, Xhc->DebugCapSupOffset) & 0xFF) != XHC_CAP_USB_DEBUG) ||
       ((XhcReadExtCapReg (Xhc, Xhc->DebugCapSupOffset + XHC_DC_DCCTRL) & BIT0) == 0)) {
     XhcSetOpRegBit (Xhc, XHC_USBCMD_OFFSET, XHC_USBCMD_RESET);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Wait for a reset started by XhcStartResetHC() to complete.
+
+  Some XHCI host controllers require to have extra 1ms delay before accessing
+  any MMIO register during reset, the caller must have stalled for at least
+  XHC_1_MILLISECOND since the reset was started.
+
+  @param  Xhc          The XHCI Instance.
+  @param  Timeout      Time to wait before abort (in millisecond, ms).
+
+  @retval EFI_SUCCESS  The XHCI host controller is reset.
+  @return Others       Failed to reset the XHCI before Timeout.
+
+**/
+EFI_STATUS
+XhcWaitResetHC (
+  IN USB_XHCI_INSTANCE    *Xhc,
+  IN UINT32               Timeout
+  )
+{
+  EFI_STATUS              Status;
+
+  Status = XhcWaitOpRegBit (Xhc, XHC_USBCMD_OFFSET, XHC_USBCMD_RESET, FALSE, Timeout);
+
+  if (!EFI_ERROR (Status)) {
     //
-    // Some XHCI host controllers require to have extra 1ms delay before accessing any MMIO register during reset.
-    // Otherwise there may have the timeout case happened.
-    // The below is a workaround to solve such problem.
+    // The USBCMD HSEE Bit will be reset to default 0 by USBCMD HCRST.
+    // Set USBCMD HSEE Bit if PCICMD SERR# Enable Bit is set.
     //
-    gBS->Stall (XHC_1_MILLISECOND);
-    Status = XhcWaitOpRegBit (Xhc, XHC_USBCMD_OFFSET, XHC_USBCMD_RESET, FALSE, Timeout);
-
-    if (!EFI_ERROR (Status)) {
-      //
-      // The USBCMD HSEE Bit will be reset to default 0 by USBCMD HCRST.
-      // Set USBCMD HSEE Bit if PCICMD SERR# Enable Bit is set.
-      //
-      XhcSetHsee (Xhc);
-    }
+    XhcSetHsee (Xhc);
   }
 
   return Status;
 }
 
+/**
+  Reset the XHCI host controller.
+
+  @param  Xhc          The XHCI Instance.
+  @param  Timeout      Time to wait before abort (in millisecond, ms).
+
+  @retval EFI_SUCCESS  The XHCI host controller is reset.
+  @return Others       Failed to reset the XHCI before Timeout.
+
+**/
+EFI_STATUS
+XhcResetHC (
+  IN USB_XHCI_INSTANCE    *Xhc,
+  IN UINT32               Timeout
+  )
+{
+  EFI_STATUS              Status;
+
+  Status = XhcStartResetHC (Xhc, Timeout);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // Some XHCI host controllers require to have extra 1ms delay before accessing any MMIO register during reset.
+  // Otherwise there may have the timeout case happened.
+  // The below is a workaround to solve such problem.
+  //
+  gBS->Stall (XHC_1_MILLISECOND);
+  return XhcWaitResetHC (Xhc, Timeout);
+}
+
 
 /**
   Halt the XHCI host controller.
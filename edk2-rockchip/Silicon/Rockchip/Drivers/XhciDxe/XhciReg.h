@@ -56,6 +56,14 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #define XHC_CONFIG_OFFSET                  0x0038 // Configure Register Offset
 #define XHC_PORTSC_OFFSET                  0x0400 // Port Status and Control Register Offset
 
+//
+// DWC3 global control register, relative to the controller base. The port
+// capability direction tells whether the core is in host or device mode.
+//
+#define XHC_DWC3_GCTL_OFFSET               0xC110
+#define XHC_DWC3_GCTL_PRTCAPDIR(Gctl)      (((Gctl) >> 12) & 0x3)
+#define XHC_DWC3_PRTCAP_HOST               1
+
 //
 // Runtime registers offset
 //
@@ -485,6 +493,54 @@ XhcIsSysError (
   IN USB_XHCI_INSTANCE    *Xhc
   );
 
+/**
+  Whether the DWC3 core behind the XHCI instance is in host mode. It is
+  switched to device mode while UsbDwc3DeviceDxe uses it.
+
+  @param  Xhc      The XHCI Instance.
+
+  @retval TRUE     The core is in host mode.
+  @retval FALSE    The core is in device mode.
+
+**/
+BOOLEAN
+XhcIsHostMode (
+  IN USB_XHCI_INSTANCE    *Xhc
+  );
+
+/**
+  Start resetting the XHCI host controller without waiting for the reset
+  to complete.
+
+  @param  Xhc          The XHCI Instance.
+  @param  Timeout      Time to wait for the controller to halt (in millisecond, ms).
+
+  @retval EFI_SUCCESS  The reset is in progress.
+  @return Others       Failed to halt the XHCI before Timeout.
+
+**/
+EFI_STATUS
+XhcStartResetHC (
+  IN USB_XHCI_INSTANCE    *Xhc,
+  IN UINT32               Timeout
+  );
+
+/**
+  Wait for a reset started by XhcStartResetHC() to complete.
+
+  @param  Xhc          The XHCI Instance.
+  @param  Timeout      Time to wait before abort (in millisecond, ms).
+
+  @retval EFI_SUCCESS  The XHCI host controller is reset.
+  @return Others       Failed to reset the XHCI before Timeout.
+
+**/
+EFI_STATUS
+XhcWaitResetHC (
+  IN USB_XHCI_INSTANCE    *Xhc,
+  IN UINT32               Timeout
+  );
+
 /**
   Reset the XHCI host controller.
 
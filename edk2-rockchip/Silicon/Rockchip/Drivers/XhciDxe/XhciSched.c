@@ -198,7 +198,7 @@ XhcFreeUrb (
   }
 
   if (Urb->DataMap != NULL) {
-    DmaUnmap (Urb->DataMap);
+    DmaBufferUnmap (Urb->DataMap);
   }
 
   FreePool (Urb);
@@ -232,6 +232,7 @@ XhcCreateTransferTrb (
   EFI_PHYSICAL_ADDRESS          PhyAddr;
   VOID                          *Map;
   EFI_STATUS                    Status;
+  XHC_STREAM_INFO               *Streams;
 
   SlotId = XhcBusDevAddrToSlotId (Xhc, Urb->Ep.BusAddr);
   if (SlotId == 0) {
@@ -246,7 +247,21 @@ XhcCreateTransferTrb (
 
   Dci       = XhcEndpointToDci (Urb->Ep.EpAddr, (UINT8)(Urb->Ep.Direction));
   ASSERT (Dci < 32);
-  EPRing    = (TRANSFER_RING *)(UINTN) Xhc->UsbDevContext[SlotId].EndpointTransferRing[Dci-1];
+  Streams   = Xhc->UsbDevContext[SlotId].EndpointStreams[Dci-1];
+  if (Streams != NULL) {
+    //
+    // An endpoint with streams has no single transfer ring the xHC reads from,
+    // every TD has to go to the ring of a valid stream.
+    //
+    if ((Urb->StreamId == 0) || (Urb->StreamId > Streams->NumStreams)) {
+      return EFI_INVALID_PARAMETER;
+    }
+    EPRing  = &Streams->StreamRings[Urb->StreamId - 1];
+  } else if (Urb->StreamId != 0) {
+    return EFI_INVALID_PARAMETER;
+  } else {
+    EPRing  = (TRANSFER_RING *)(UINTN) Xhc->UsbDevContext[SlotId].EndpointTransferRing[Dci-1];
+  }
   Urb->Ring = EPRing;
   OutputContext = Xhc->UsbDevContext[SlotId].OutputContext;
   if (Xhc->HcCParams.Data.Csz == 0) {
@@ -266,7 +281,7 @@ XhcCreateTransferTrb (
     }
 
     Len = Urb->DataLen;
-    Status  = DmaMap (MapOp, Urb->Data, &Len, &PhyAddr, &Map);
+    Status  = DmaBufferMap (MapOp, Urb->Data, &Len, &PhyAddr, &Map);
 
     if (EFI_ERROR (Status) || (Len != Urb->DataLen)) {
       DEBUG ((EFI_D_ERROR, "XhcCreateTransferTrb: Fail to map Urb->Data.\n"));
@@ -483,7 +498,7 @@ XhcInitSched (
   //
   // Initialize memory management.
   //
-  Xhc->MemPool = UsbHcInitMemPool ();
+  Xhc->MemPool = UsbHcInitMemPool (FALSE, 0);
   ASSERT (Xhc->MemPool != NULL);
 
   //
@@ -588,7 +603,8 @@ XhcInitSched (
   // Note: The Command Ring is 64 byte aligned, so the low order 6 bits of the Command Ring Pointer shall
   // always be '0'.
   //
-  CreateTransferRing (Xhc, CMD_RING_TRB_NUMBER, &Xhc->CmdRing);
+  Status = CreateTransferRing (Xhc, CMD_RING_TRB_NUMBER, &Xhc->CmdRing);
+  ASSERT_EFI_ERROR (Status);
   //
   // The xHC uses the Enqueue Pointer to determine when a Transfer Ring is empty. As it fetches TRBs from a
   // Transfer Ring it checks for a Cycle bit transition. If a transition detected, the ring is empty.
@@ -681,7 +697,7 @@ XhcRecoverHaltedEndpoint (
   //
   // 3)Ring the doorbell to transit from stop to active
   //
-  XhcRingDoorBell (Xhc, SlotId, Dci);
+  XhcRingStreamDoorBell (Xhc, SlotId, Dci, Urb->StreamId);
 
 Done:
   return Status;
@@ -753,7 +769,7 @@ XhcDequeueTrbFromEndpoint (
   //
   // 3)Ring the doorbell to transit from stop to active
   //
-  XhcRingDoorBell (Xhc, SlotId, Dci);
+  XhcRingStreamDoorBell (Xhc, SlotId, Dci, Urb->StreamId);
 
 Done:
   return Status;
@@ -866,8 +882,11 @@ CreateEventRing (
   @param  TrbNum            The number of TRB in the ring.
   @param  TransferRing           The created transfer ring.
 
+  @retval EFI_SUCCESS           The transfer ring was created.
+  @retval EFI_OUT_OF_RESOURCES  The ring could not be allocated.
+
 **/
-VOID
+EFI_STATUS
 CreateTransferRing (
   IN  USB_XHCI_INSTANCE     *Xhc,
   IN  UINTN                 TrbNum,
@@ -879,7 +898,9 @@ CreateTransferRing (
   EFI_PHYSICAL_ADDRESS  PhyAddr;
 
   Buf = UsbHcAllocateMem (Xhc->MemPool, sizeof (TRB_TEMPLATE) * TrbNum);
-  ASSERT (Buf != NULL);
+  if (Buf == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
   ASSERT (((UINTN) Buf & 0x3F) == 0);
   ZeroMem (Buf, sizeof (TRB_TEMPLATE) * TrbNum);
 
@@ -906,6 +927,8 @@ CreateTransferRing (
   // Set Cycle bit as other TRB PCS init value
   //
   EndTrb->CycleBit = 0;
+
+  return EFI_SUCCESS;
 }
 
 /**
@@ -1066,6 +1089,37 @@ IsAsyncIntTrb (
   return FALSE;
 }
 
+/**
+  Check if the Trb is a transaction of the URBs queued on bulk streams.
+
+  @param Xhc    The XHCI Instance.
+  @param Trb    The TRB to be checked.
+  @param Urb    The pointer to the matched Urb.
+
+  @retval TRUE  The Trb is matched with a transaction of the queued stream URBs.
+  @retval FALSE The Trb is not matched with any queued stream URBs.
+
+**/
+BOOLEAN
+IsStreamTrb (
+  IN  USB_XHCI_INSTANCE   *Xhc,
+  IN  TRB_TEMPLATE        *Trb,
+  OUT URB                 **Urb
+  )
+{
+  LIST_ENTRY              *Entry;
+  URB                     *CheckedUrb;
+
+  BASE_LIST_FOR_EACH (Entry, &Xhc->StreamTransfers) {
+    CheckedUrb = EFI_LIST_CONTAINER (Entry, URB, UrbList);
+    if (!CheckedUrb->Finished && IsTransferRingTrb (Xhc, Trb, CheckedUrb)) {
+      *Urb = CheckedUrb;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
 
 /**
   Check the URB's execution result and update the URB's
@@ -1139,7 +1193,7 @@ XhcCheckUrbResult (
 
     //
     // Update the status of URB including the pending URB, the URB that is currently checked,
-    // and URBs in the XHCI's async interrupt transfer list.
+    // and URBs in the XHCI's async interrupt and bulk stream transfer lists.
     // This way is used to avoid that those completed async transfer events don't get
     // handled in time and are flushed by newer coming events.
     //
@@ -1149,6 +1203,8 @@ XhcCheckUrbResult (
       CheckedUrb = Urb;
     } else if (IsAsyncIntTrb (Xhc, TRBPtr, &AsyncUrb)) {
       CheckedUrb = AsyncUrb;
+    } else if (IsStreamTrb (Xhc, TRBPtr, &AsyncUrb)) {
+      CheckedUrb = AsyncUrb;
     } else {
       continue;
     }
@@ -1282,6 +1338,7 @@ XhcExecTransfer (
   BOOLEAN                 Finished;
   EFI_EVENT               TimeoutEvent;
   BOOLEAN                 IndefiniteTimeout;
+  UINT64                  PollTick;
 
   Status            = EFI_SUCCESS;
   Finished          = FALSE;
@@ -1328,6 +1385,7 @@ XhcExecTransfer (
 RINGDOORBELL:
   XhcRingDoorBell (Xhc, SlotId, Dci);
 
+  PollTick = USB_PROFILE_TIMESTAMP ();
   do {
     Finished = XhcCheckUrbResult (Xhc, Urb);
     if (Finished) {
@@ -1335,6 +1393,7 @@ RINGDOORBELL:
     }
     gBS->Stall (XHC_1_MICROSECOND);
   } while (IndefiniteTimeout || EFI_ERROR(gBS->CheckEvent (TimeoutEvent)));
+  USB_PROFILE_POLL (Xhc->Profile, PollTick);
 
 DONE:
   if (EFI_ERROR(Status)) {
@@ -1399,6 +1458,7 @@ XhciDelAsyncIntTransfer (
 
       RemoveEntryList (&Urb->UrbList);
       FreePool (Urb->Data);
+      FreePool (Urb->ProcBuf);
       XhcFreeUrb (Xhc, Urb);
       return EFI_SUCCESS;
     }
@@ -1437,6 +1497,7 @@ XhciDelAllAsyncIntTransfers (
 
     RemoveEntryList (&Urb->UrbList);
     FreePool (Urb->Data);
+    FreePool (Urb->ProcBuf);
     XhcFreeUrb (Xhc, Urb);
   }
 }
@@ -1470,6 +1531,7 @@ XhciInsertAsyncIntTransfer (
   )
 {
   VOID      *Data;
+  VOID      *ProcBuf;
   URB       *Urb;
 
   Data = AllocateZeroPool (DataLen);
@@ -1478,6 +1540,13 @@ XhciInsertAsyncIntTransfer (
     return NULL;
   }
 
+  ProcBuf = AllocateZeroPool (DataLen);
+  if (ProcBuf == NULL) {
+    DEBUG ((DEBUG_ERROR, "%a: failed to allocate buffer\n", __FUNCTION__));
+    FreePool (Data);
+    return NULL;
+  }
+
   Urb = XhcCreateUrb (
           Xhc,
           BusAddr,
@@ -1494,9 +1563,12 @@ XhciInsertAsyncIntTransfer (
   if (Urb == NULL) {
     DEBUG ((DEBUG_ERROR, "%a: failed to create URB\n", __FUNCTION__));
     FreePool (Data);
+    FreePool (ProcBuf);
     return NULL;
   }
 
+  Urb->ProcBuf = ProcBuf;
+
   //
   // New asynchronous transfer must inserted to the head.
   // Check the comments in XhcMoniteAsyncRequests
@@ -1565,7 +1637,7 @@ XhcFlushAsyncIntMap (
   }
 
   if (Urb->DataMap != NULL) {
-    Status = DmaUnmap (Urb->DataMap);
+    Status = DmaBufferUnmap (Urb->DataMap);
     if (EFI_ERROR (Status)) {
       goto ON_ERROR;
     }
@@ -1573,7 +1645,7 @@ XhcFlushAsyncIntMap (
 
   Urb->DataMap = NULL;
 
-  Status = DmaMap (MapOp, Urb->Data, &Len, &PhyAddr, &Map);
+  Status = DmaBufferMap (MapOp, Urb->Data, &Len, &PhyAddr, &Map);
   if (EFI_ERROR (Status) || (Len != Urb->DataLen)) {
     goto ON_ERROR;
   }
@@ -1608,10 +1680,21 @@ XhcMonitorAsyncRequests (
   UINT8                   SlotId;
   EFI_STATUS              Status;
   EFI_TPL                 OldTpl;
+  BOOLEAN                 Completed;
+  UINT64                  Interval;
 
   OldTpl = gBS->RaiseTPL (XHC_TPL);
 
-  Xhc    = (USB_XHCI_INSTANCE*) Context;
+  Xhc       = (USB_XHCI_INSTANCE*) Context;
+  Completed = FALSE;
+
+  //
+  // The event ring is not there while the core runs in device mode
+  //
+  if (!XhcIsHostMode (Xhc)) {
+    gBS->RestoreTPL (OldTpl);
+    return;
+  }
 
   BASE_LIST_FOR_EACH_SAFE (Entry, Next, &Xhc->AsyncIntTransfers) {
     Urb = EFI_LIST_CONTAINER (Entry, URB, UrbList);
@@ -1640,25 +1723,24 @@ XhcMonitorAsyncRequests (
     }
 
     //
-    // Allocate a buffer then copy the transferred data for user.
-    // If failed to allocate the buffer, update the URB for next
-    // round of transfer. Ignore the data of this round.
+    // Copy the transferred data for user into the URB's own buffer,
+    // the DMA buffer is refilled by the next round of transfer.
+    // If more data than expected was received, update the URB for
+    // next round of transfer. Ignore the data of this round.
     //
     ProcBuf = NULL;
     if (Urb->Result == EFI_USB_NOERROR) {
       //
       // Make sure the data received from HW is no more than expected.
       //
-      if (Urb->Completed <= Urb->DataLen) {
-        ProcBuf = AllocateZeroPool (Urb->Completed);
-      }
-
-      if (ProcBuf == NULL) {
+      if (Urb->Completed > Urb->DataLen) {
         XhcUpdateAsyncRequest (Xhc, Urb);
         continue;
       }
 
+      ProcBuf = Urb->ProcBuf;
       CopyMem (ProcBuf, Urb->Data, Urb->Completed);
+      Completed = TRUE;
     }
 
     //
@@ -1681,12 +1763,28 @@ XhcMonitorAsyncRequests (
       OldTpl = gBS->RaiseTPL (XHC_TPL);
     }
 
-    if (ProcBuf != NULL) {
-      gBS->FreePool (ProcBuf);
-    }
-
     XhcUpdateAsyncRequest (Xhc, Urb);
   }
+
+  //
+  // Poll quickly while interrupt data is arriving and back off when idle.
+  // Transfers completing meanwhile wait in the event ring, so backing off
+  // only adds latency to the first report after an idle period.
+  //
+  Interval = Xhc->PollInterval;
+  if (Completed) {
+    Xhc->IdlePolls = 0;
+    Interval       = XHC_ASYNC_TIMER_INTERVAL;
+  } else if (++Xhc->IdlePolls >= XHC_ASYNC_IDLE_POLLS) {
+    Xhc->IdlePolls = 0;
+    Interval       = MIN (Interval * 2, XHC_ASYNC_TIMER_MAX_INTERVAL);
+  }
+
+  if (Interval != Xhc->PollInterval) {
+    Xhc->PollInterval = Interval;
+    gBS->SetTimer (Xhc->PollTimer, TimerPeriodic, Interval);
+  }
+
   gBS->RestoreTPL (OldTpl);
 }
 
@@ -2085,6 +2183,475 @@ RingIntTransferDoorBell (
   return EFI_SUCCESS;
 }
 
+/**
+  Ring the door bell of an endpoint stream.
+
+  @param  Xhc           The XHCI Instance.
+  @param  SlotId        The slot id of the target device.
+  @param  Dci           The device context index of the target endpoint.
+  @param  StreamId      The stream of the endpoint, 0 if it has no streams.
+
+  @retval EFI_SUCCESS   Successfully ring the door bell.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcRingStreamDoorBell (
+  IN USB_XHCI_INSTANCE    *Xhc,
+  IN UINT8                SlotId,
+  IN UINT8                Dci,
+  IN UINT16               StreamId
+  )
+{
+  if ((SlotId == 0) || (StreamId == 0)) {
+    return XhcRingDoorBell (Xhc, SlotId, Dci);
+  }
+
+  //
+  // 5.6 Doorbell Registers, DB Stream ID lives in bits 31:16.
+  //
+  XhcWriteDoorBellReg (Xhc, SlotId * sizeof (UINT32), Dci | ((UINT32) StreamId << 16));
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Create a bulk URB on an endpoint stream and put its TRBs on the stream's
+  transfer ring. The door bell is not rung.
+
+  @param  Xhc                   The XHCI Instance.
+  @param  BusAddr               Device address.
+  @param  EpAddr                Endpoint address, direction in bit 7.
+  @param  StreamId              The stream of the endpoint, 0 if it has no streams.
+  @param  Data                  The user data to transfer.
+  @param  DataLen               The length of data buffer.
+
+  @return Created URB or NULL
+
+**/
+URB*
+XhcCreateStreamUrb (
+  IN USB_XHCI_INSTANCE                  *Xhc,
+  IN UINT8                              BusAddr,
+  IN UINT8                              EpAddr,
+  IN UINT16                             StreamId,
+  IN VOID                               *Data,
+  IN UINTN                              DataLen
+  )
+{
+  USB_ENDPOINT                  *Ep;
+  EFI_STATUS                    Status;
+  URB                           *Urb;
+
+  Urb = AllocateZeroPool (sizeof (URB));
+  if (Urb == NULL) {
+    return NULL;
+  }
+
+  Urb->Signature = XHC_URB_SIG;
+  InitializeListHead (&Urb->UrbList);
+
+  Ep            = &Urb->Ep;
+  Ep->BusAddr   = BusAddr;
+  Ep->EpAddr    = (UINT8)(EpAddr & 0x0F);
+  Ep->Direction = ((EpAddr & 0x80) != 0) ? EfiUsbDataIn : EfiUsbDataOut;
+  Ep->Type      = XHC_BULK_TRANSFER;
+
+  Urb->Data     = Data;
+  Urb->DataLen  = DataLen;
+  Urb->StreamId = StreamId;
+
+  Status = XhcCreateTransferTrb (Xhc, Urb);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "XhcCreateStreamUrb: XhcCreateTransferTrb Failed, Status = %r\n", Status));
+    XhcFreeUrb (Xhc, Urb);
+    Urb = NULL;
+  }
+
+  return Urb;
+}
+
+/**
+  Point bulk endpoints either at their stream context arrays or back at their
+  single transfer rings through XHCI's Configure_Endpoint cmd.
+
+  @param  Xhc                   The XHCI Instance.
+  @param  SlotId                The slot id of the device.
+  @param  Dcis                  The device context indexes of the endpoints.
+  @param  NumDci                The number of entries in Dcis.
+  @param  Enable                TRUE to use the stream context arrays.
+
+  @retval EFI_SUCCESS           The endpoints were reconfigured.
+  @retval Others                The Configure Endpoint command failed.
+
+**/
+STATIC
+EFI_STATUS
+XhcConfigureEndpointStreams (
+  IN USB_XHCI_INSTANCE          *Xhc,
+  IN UINT8                      SlotId,
+  IN UINT8                      *Dcis,
+  IN UINTN                      NumDci,
+  IN BOOLEAN                    Enable
+  )
+{
+  EFI_STATUS                    Status;
+  USB_DEV_CONTEXT               *DevContext;
+  INPUT_CONTRL_CONTEXT          *InputControl;
+  ENDPOINT_CONTEXT              *EpContext;
+  ENDPOINT_CONTEXT              *OutputEpContext;
+  XHC_STREAM_INFO               *Streams;
+  TRANSFER_RING                 *Ring;
+  EFI_PHYSICAL_ADDRESS          PhyAddr;
+  UINTN                         InputSize;
+  UINTN                         Index;
+  UINT8                         Dci;
+  CMD_TRB_CONFIG_ENDPOINT       CmdTrbCfgEP;
+  EVT_TRB_COMMAND_COMPLETION    *EvtTrb;
+
+  DevContext = &Xhc->UsbDevContext[SlotId];
+
+  //
+  // XHCI 4.6.6 Configure Endpoint
+  // Setting both the Drop and the Add Context flags of an endpoint reloads its
+  // Endpoint Context, the other endpoints of the slot are not affected.
+  //
+  if (Xhc->HcCParams.Data.Csz == 0) {
+    InputSize = sizeof (INPUT_CONTEXT);
+    ZeroMem (DevContext->InputContext, InputSize);
+    CopyMem (
+      &((INPUT_CONTEXT *) DevContext->InputContext)->Slot,
+      &((DEVICE_CONTEXT *) DevContext->OutputContext)->Slot,
+      sizeof (SLOT_CONTEXT)
+      );
+  } else {
+    InputSize = sizeof (INPUT_CONTEXT_64);
+    ZeroMem (DevContext->InputContext, InputSize);
+    CopyMem (
+      &((INPUT_CONTEXT_64 *) DevContext->InputContext)->Slot,
+      &((DEVICE_CONTEXT_64 *) DevContext->OutputContext)->Slot,
+      sizeof (SLOT_CONTEXT_64)
+      );
+  }
+  InputControl = (INPUT_CONTRL_CONTEXT *) DevContext->InputContext;
+
+  for (Index = 0; Index < NumDci; Index++) {
+    Dci = Dcis[Index];
+    //
+    // The first eight dwords of ENDPOINT_CONTEXT and ENDPOINT_CONTEXT_64 share
+    // the same layout.
+    //
+    if (Xhc->HcCParams.Data.Csz == 0) {
+      EpContext       = &((INPUT_CONTEXT *) DevContext->InputContext)->EP[Dci - 1];
+      OutputEpContext = &((DEVICE_CONTEXT *) DevContext->OutputContext)->EP[Dci - 1];
+    } else {
+      EpContext       = (ENDPOINT_CONTEXT *) &((INPUT_CONTEXT_64 *) DevContext->InputContext)->EP[Dci - 1];
+      OutputEpContext = (ENDPOINT_CONTEXT *) &((DEVICE_CONTEXT_64 *) DevContext->OutputContext)->EP[Dci - 1];
+    }
+    CopyMem (EpContext, OutputEpContext, sizeof (ENDPOINT_CONTEXT));
+    EpContext->EPState = 0;
+
+    Streams = DevContext->EndpointStreams[Dci - 1];
+    if (Enable && (Streams != NULL)) {
+      //
+      // 6.2.3 MaxPStreams is the log2 of the primary stream array size minus one
+      // when LSA is set, and the TR Dequeue Pointer holds the array address.
+      //
+      PhyAddr = UsbHcGetBusAddrForHostAddr (
+                  Xhc->MemPool,
+                  Streams->StreamCtxArray,
+                  Streams->ArraySize * sizeof (STREAM_CONTEXT)
+                  );
+      EpContext->MaxPStreams = (UINT32) HighBitSet32 ((UINT32) Streams->ArraySize) - 1;
+      EpContext->LSA         = 1;
+      EpContext->HID         = 0;
+    } else {
+      //
+      // Resume the single transfer ring where software left it.
+      //
+      Ring    = (TRANSFER_RING *) DevContext->EndpointTransferRing[Dci - 1];
+      PhyAddr = UsbHcGetBusAddrForHostAddr (Xhc->MemPool, Ring->RingEnqueue, sizeof (TRB_TEMPLATE));
+      PhyAddr &= ~((EFI_PHYSICAL_ADDRESS) 0x0F);
+      PhyAddr |= (EFI_PHYSICAL_ADDRESS) Ring->RingPCS;
+      EpContext->MaxPStreams = 0;
+      EpContext->LSA         = 0;
+    }
+    EpContext->PtrLo = XHC_LOW_32BIT (PhyAddr);
+    EpContext->PtrHi = XHC_HIGH_32BIT (PhyAddr);
+
+    InputControl->Dword1 |= (BIT0 << Dci);
+    InputControl->Dword2 |= (BIT0 << Dci);
+  }
+  InputControl->Dword2 |= BIT0;
+
+  ZeroMem (&CmdTrbCfgEP, sizeof (CmdTrbCfgEP));
+  PhyAddr = UsbHcGetBusAddrForHostAddr (Xhc->MemPool, DevContext->InputContext, InputSize);
+  CmdTrbCfgEP.PtrLo    = XHC_LOW_32BIT (PhyAddr);
+  CmdTrbCfgEP.PtrHi    = XHC_HIGH_32BIT (PhyAddr);
+  CmdTrbCfgEP.CycleBit = 1;
+  CmdTrbCfgEP.Type     = TRB_TYPE_CON_ENDPOINT;
+  CmdTrbCfgEP.SlotId   = DevContext->SlotId;
+  DEBUG ((EFI_D_INFO, "XhcConfigureEndpointStreams: Slot %d, %a streams\n", SlotId, Enable ? "enable" : "disable"));
+  Status = XhcCmdTransfer (
+             Xhc,
+             (TRB_TEMPLATE *) (UINTN) &CmdTrbCfgEP,
+             XHC_GENERIC_TIMEOUT,
+             (TRB_TEMPLATE **) (UINTN) &EvtTrb
+             );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "XhcConfigureEndpointStreams: Config Endpoint Failed, Status = %r\n", Status));
+  }
+
+  return Status;
+}
+
+/**
+  Allocate a stream context array and the stream transfer rings for a bulk
+  endpoint and switch the endpoint to them with a Configure Endpoint command.
+
+  @param  Xhc                   The XHCI Instance.
+  @param  SlotId                The slot id of the device.
+  @param  Dcis                  The device context indexes of the endpoints.
+  @param  NumDci                The number of entries in Dcis.
+  @param  NumStreams            On input, the number of streams wanted. On
+                                output, the number of streams allocated.
+
+  @retval EFI_SUCCESS           The streams are ready to use.
+  @retval EFI_UNSUPPORTED       The controller or an endpoint has no stream support.
+  @retval EFI_OUT_OF_RESOURCES  The stream rings could not be allocated.
+  @retval Others                The Configure Endpoint command failed.
+
+**/
+EFI_STATUS
+XhcAllocateEndpointStreams (
+  IN     USB_XHCI_INSTANCE      *Xhc,
+  IN     UINT8                  SlotId,
+  IN     UINT8                  *Dcis,
+  IN     UINTN                  NumDci,
+  IN OUT UINT16                 *NumStreams
+  )
+{
+  EFI_STATUS                    Status;
+  USB_DEV_CONTEXT               *DevContext;
+  XHC_STREAM_INFO               *Streams;
+  STREAM_CONTEXT                *StreamCtx;
+  EFI_PHYSICAL_ADDRESS          PhyAddr;
+  UINTN                         ArraySize;
+  UINTN                         Count;
+  UINTN                         Index;
+  UINTN                         StreamIndex;
+  UINT8                         Dci;
+
+  if ((NumStreams == NULL) || (*NumStreams == 0) || (Dcis == NULL) || (NumDci == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // MaxPSASize of zero means the xHC has no stream support at all.
+  //
+  if (Xhc->HcCParams.Data.MaxPsaSize == 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  DevContext = &Xhc->UsbDevContext[SlotId];
+
+  //
+  // Stream ID 0 is reserved, so an array of ArraySize entries serves
+  // ArraySize - 1 streams. The smallest primary array has 4 entries.
+  //
+  ArraySize = GetPowerOfTwo32 ((UINT32) *NumStreams + 1);
+  if (ArraySize < (UINTN) *NumStreams + 1) {
+    ArraySize <<= 1;
+  }
+  ArraySize = MIN (ArraySize, (UINTN) 1 << (Xhc->HcCParams.Data.MaxPsaSize + 1));
+  ArraySize = MAX (ArraySize, 4);
+  Count     = MIN ((UINTN) *NumStreams, ArraySize - 1);
+
+  for (Index = 0; Index < NumDci; Index++) {
+    Dci = Dcis[Index];
+    if ((Dci < 2) || (Dci > 31) ||
+        (DevContext->EndpointTransferRing[Dci - 1] == NULL) ||
+        (DevContext->EndpointStreams[Dci - 1] != NULL)) {
+      return EFI_INVALID_PARAMETER;
+    }
+    if (DevContext->EndpointMaxStreams[Dci - 1] == 0) {
+      return EFI_UNSUPPORTED;
+    }
+    Count = MIN (Count, (UINTN) 1 << DevContext->EndpointMaxStreams[Dci - 1]);
+  }
+
+  Status = EFI_SUCCESS;
+  for (Index = 0; Index < NumDci; Index++) {
+    Dci     = Dcis[Index];
+    Streams = AllocateZeroPool (sizeof (XHC_STREAM_INFO));
+    if (Streams == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      break;
+    }
+
+    Streams->StreamRings    = AllocateZeroPool (Count * sizeof (TRANSFER_RING));
+    Streams->StreamCtxArray = UsbHcAllocateMem (Xhc->MemPool, ArraySize * sizeof (STREAM_CONTEXT));
+    if ((Streams->StreamRings == NULL) || (Streams->StreamCtxArray == NULL)) {
+      if (Streams->StreamRings != NULL) {
+        FreePool (Streams->StreamRings);
+      }
+      if (Streams->StreamCtxArray != NULL) {
+        UsbHcFreeMem (Xhc->MemPool, Streams->StreamCtxArray, ArraySize * sizeof (STREAM_CONTEXT));
+      }
+      FreePool (Streams);
+      Status = EFI_OUT_OF_RESOURCES;
+      break;
+    }
+    ZeroMem (Streams->StreamCtxArray, ArraySize * sizeof (STREAM_CONTEXT));
+    Streams->ArraySize  = ArraySize;
+    Streams->NumStreams = (UINT16) Count;
+
+    //
+    // Attach the streams first, so that the rings created before a failure
+    // are released with them below.
+    //
+    DevContext->EndpointStreams[Dci - 1] = Streams;
+
+    StreamCtx = (STREAM_CONTEXT *) Streams->StreamCtxArray;
+    for (StreamIndex = 0; StreamIndex < Count; StreamIndex++) {
+      Status = CreateTransferRing (Xhc, STREAM_RING_TRB_NUMBER, &Streams->StreamRings[StreamIndex]);
+      if (EFI_ERROR (Status)) {
+        break;
+      }
+      PhyAddr = UsbHcGetBusAddrForHostAddr (
+                  Xhc->MemPool,
+                  Streams->StreamRings[StreamIndex].RingSeg0,
+                  sizeof (TRB_TEMPLATE) * STREAM_RING_TRB_NUMBER
+                  );
+      StreamCtx[StreamIndex + 1].DCS   = Streams->StreamRings[StreamIndex].RingPCS;
+      StreamCtx[StreamIndex + 1].SCT   = STREAM_CTX_TYPE_PRIMARY_RING;
+      StreamCtx[StreamIndex + 1].PtrLo = XHC_LOW_32BIT (PhyAddr) >> 4;
+      StreamCtx[StreamIndex + 1].PtrHi = XHC_HIGH_32BIT (PhyAddr);
+    }
+
+    if (EFI_ERROR (Status)) {
+      break;
+    }
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = XhcConfigureEndpointStreams (Xhc, SlotId, Dcis, NumDci, TRUE);
+  }
+
+  if (EFI_ERROR (Status)) {
+    for (Index = 0; Index < NumDci; Index++) {
+      XhcFreeEndpointStreams (Xhc, SlotId, Dcis[Index]);
+    }
+    return Status;
+  }
+
+  DEBUG ((EFI_D_INFO, "XhcAllocateEndpointStreams: Slot %d, %d streams on %d endpoints\n", SlotId, Count, NumDci));
+  *NumStreams = (UINT16) Count;
+  return EFI_SUCCESS;
+}
+
+/**
+  Switch bulk endpoints back from streams to their single transfer ring and
+  release the stream resources.
+
+  @param  Xhc                   The XHCI Instance.
+  @param  SlotId                The slot id of the device.
+  @param  Dcis                  The device context indexes of the endpoints.
+  @param  NumDci                The number of entries in Dcis.
+
+  @retval EFI_SUCCESS           The endpoints no longer use streams.
+  @retval Others                The Configure Endpoint command failed.
+
+**/
+EFI_STATUS
+XhcReleaseEndpointStreams (
+  IN USB_XHCI_INSTANCE          *Xhc,
+  IN UINT8                      SlotId,
+  IN UINT8                      *Dcis,
+  IN UINTN                      NumDci
+  )
+{
+  EFI_STATUS                    Status;
+  UINTN                         Index;
+
+  for (Index = 0; Index < NumDci; Index++) {
+    if ((Dcis[Index] < 2) || (Dcis[Index] > 31) ||
+        (Xhc->UsbDevContext[SlotId].EndpointStreams[Dcis[Index] - 1] == NULL)) {
+      return EFI_INVALID_PARAMETER;
+    }
+  }
+
+  Status = XhcConfigureEndpointStreams (Xhc, SlotId, Dcis, NumDci, FALSE);
+
+  //
+  // Release the streams even if the command failed, the slot is unusable
+  // for streams either way.
+  //
+  for (Index = 0; Index < NumDci; Index++) {
+    XhcFreeEndpointStreams (Xhc, SlotId, Dcis[Index]);
+  }
+
+  return Status;
+}
+
+/**
+  Free the stream resources of an endpoint without touching the hardware.
+  URBs still queued on the streams are completed with EFI_USB_ERR_SYSTEM.
+
+  @param  Xhc                   The XHCI Instance.
+  @param  SlotId                The slot id of the device.
+  @param  Dci                   The device context index of the endpoint.
+
+**/
+VOID
+XhcFreeEndpointStreams (
+  IN USB_XHCI_INSTANCE          *Xhc,
+  IN UINT8                      SlotId,
+  IN UINT8                      Dci
+  )
+{
+  XHC_STREAM_INFO               *Streams;
+  LIST_ENTRY                    *Entry;
+  LIST_ENTRY                    *Next;
+  URB                           *Urb;
+  UINTN                         Index;
+
+  Streams = Xhc->UsbDevContext[SlotId].EndpointStreams[Dci - 1];
+  if (Streams == NULL) {
+    return;
+  }
+
+  //
+  // The owner of an URB still queued on these rings keeps its handle, so the
+  // URB is only detached from the list and finished with an error.
+  //
+  BASE_LIST_FOR_EACH_SAFE (Entry, Next, &Xhc->StreamTransfers) {
+    Urb = EFI_LIST_CONTAINER (Entry, URB, UrbList);
+    if ((Urb->Ring >= Streams->StreamRings) &&
+        (Urb->Ring < Streams->StreamRings + Streams->NumStreams)) {
+      RemoveEntryList (&Urb->UrbList);
+      InitializeListHead (&Urb->UrbList);
+      Urb->Result  |= EFI_USB_ERR_SYSTEM;
+      Urb->Finished = TRUE;
+    }
+  }
+
+  for (Index = 0; Index < Streams->NumStreams; Index++) {
+    if (Streams->StreamRings[Index].RingSeg0 != NULL) {
+      UsbHcFreeMem (
+        Xhc->MemPool,
+        Streams->StreamRings[Index].RingSeg0,
+        sizeof (TRB_TEMPLATE) * Streams->StreamRings[Index].TrbNumber
+        );
+    }
+  }
+
+  UsbHcFreeMem (Xhc->MemPool, Streams->StreamCtxArray, Streams->ArraySize * sizeof (STREAM_CONTEXT));
+  FreePool (Streams->StreamRings);
+  FreePool (Streams);
+  Xhc->UsbDevContext[SlotId].EndpointStreams[Dci - 1] = NULL;
+}
+
 /**
   Assign and initialize the device slot for a new device.
 
@@ -2583,6 +3150,7 @@ XhcDisableSlotCmd (
   // Free the slot related data structure
   //
   for (Index = 0; Index < 31; Index++) {
+    XhcFreeEndpointStreams (Xhc, SlotId, (UINT8) (Index + 1));
     if (Xhc->UsbDevContext[SlotId].EndpointTransferRing[Index] != NULL) {
       RingSeg = ((TRANSFER_RING *)(UINTN)Xhc->UsbDevContext[SlotId].EndpointTransferRing[Index])->RingSeg0;
       if (RingSeg != NULL) {
@@ -2690,6 +3258,7 @@ XhcDisableSlotCmd64 (
   // Free the slot related data structure
   //
   for (Index = 0; Index < 31; Index++) {
+    XhcFreeEndpointStreams (Xhc, SlotId, (UINT8) (Index + 1));
     if (Xhc->UsbDevContext[SlotId].EndpointTransferRing[Index] != NULL) {
       RingSeg = ((TRANSFER_RING *)(UINTN)Xhc->UsbDevContext[SlotId].EndpointTransferRing[Index])->RingSeg0;
       if (RingSeg != NULL) {
@@ -2735,6 +3304,8 @@ XhcDisableSlotCmd64 (
   @param SlotId         The slot id to be configured.
   @param DeviceSpeed    The device's speed.
   @param InputContext   The pointer to the input context.
+  @param ConfigDesc     The pointer to the usb device configuration descriptor
+                        the interface descriptor is part of.
   @param IfDesc         The pointer to the usb device interface descriptor.
 
   @return The maximum device context index of endpoint.
@@ -2747,6 +3318,7 @@ XhcInitializeEndpointContext (
   IN UINT8                      SlotId,
   IN UINT8                      DeviceSpeed,
   IN INPUT_CONTEXT              *InputContext,
+  IN USB_CONFIG_DESCRIPTOR      *ConfigDesc,
   IN USB_INTERFACE_DESCRIPTOR   *IfDesc
   )
 {
@@ -2760,6 +3332,7 @@ XhcInitializeEndpointContext (
   EFI_PHYSICAL_ADDRESS          PhyAddr;
   UINT8                         Interval;
   TRANSFER_RING                 *EndpointTransferRing;
+  USB_SS_ENDPOINT_COMPANION_DESCRIPTOR  *CompDesc;
 
   MaxDci = 0;
 
@@ -2788,14 +3361,27 @@ XhcInitializeEndpointContext (
     InputContext->InputControlContext.Dword2 |= (BIT0 << Dci);
     InputContext->EP[Dci-1].MaxPacketSize     = EpDesc->MaxPacketSize;
 
+    CompDesc = NULL;
     if (DeviceSpeed == EFI_USB_SPEED_SUPER) {
       //
       // 6.2.3.4, shall be set to the value defined in the bMaxBurst field of the SuperSpeed Endpoint Companion Descriptor.
+      // USB 3.2 spec 9.6.7, the companion descriptor immediately follows its endpoint descriptor.
+      // It is only read when it lies within the configuration descriptor.
       //
-      InputContext->EP[Dci-1].MaxBurstSize = 0x0;
+      CompDesc = (USB_SS_ENDPOINT_COMPANION_DESCRIPTOR *)((UINTN)EpDesc + EpDesc->Length);
+      if (((UINTN)CompDesc + sizeof (USB_SS_ENDPOINT_COMPANION_DESCRIPTOR) > (UINTN)ConfigDesc + ConfigDesc->TotalLength) ||
+          (CompDesc->DescriptorType != USB_DESC_TYPE_SS_ENDPOINT_COMPANION) ||
+          (CompDesc->Length < sizeof (USB_SS_ENDPOINT_COMPANION_DESCRIPTOR))) {
+        CompDesc = NULL;
+      }
+    }
+
+    if (CompDesc != NULL) {
+      InputContext->EP[Dci-1].MaxBurstSize = CompDesc->MaxBurst;
     } else {
       InputContext->EP[Dci-1].MaxBurstSize = 0x0;
     }
+    Xhc->UsbDevContext[SlotId].EndpointMaxStreams[Dci-1] = 0;
 
     switch (EpDesc->Attributes & USB_ENDPOINT_TYPE_MASK) {
       case USB_ENDPOINT_BULK:
@@ -2808,6 +3394,13 @@ XhcInitializeEndpointContext (
         }
 
         InputContext->EP[Dci-1].AverageTRBLength = 0x1000;
+        //
+        // Bulk streams are enabled later on request of the class driver, only
+        // remember how many streams the endpoint supports.
+        //
+        if (CompDesc != NULL) {
+          Xhc->UsbDevContext[SlotId].EndpointMaxStreams[Dci-1] = CompDesc->Attributes & 0x1F;
+        }
         if (Xhc->UsbDevContext[SlotId].EndpointTransferRing[Dci-1] == NULL) {
           EndpointTransferRing = AllocateZeroPool(sizeof (TRANSFER_RING));
           Xhc->UsbDevContext[SlotId].EndpointTransferRing[Dci-1] = (VOID *) EndpointTransferRing;
@@ -2927,6 +3520,8 @@ XhcInitializeEndpointContext (
   @param SlotId         The slot id to be configured.
   @param DeviceSpeed    The device's speed.
   @param InputContext   The pointer to the input context.
+  @param ConfigDesc     The pointer to the usb device configuration descriptor
+                        the interface descriptor is part of.
   @param IfDesc         The pointer to the usb device interface descriptor.
 
   @return The maximum device context index of endpoint.
@@ -2939,6 +3534,7 @@ XhcInitializeEndpointContext64 (
   IN UINT8                      SlotId,
   IN UINT8                      DeviceSpeed,
   IN INPUT_CONTEXT_64           *InputContext,
+  IN USB_CONFIG_DESCRIPTOR      *ConfigDesc,
   IN USB_INTERFACE_DESCRIPTOR   *IfDesc
   )
 {
@@ -2952,6 +3548,7 @@ XhcInitializeEndpointContext64 (
   EFI_PHYSICAL_ADDRESS          PhyAddr;
   UINT8                         Interval;
   TRANSFER_RING                 *EndpointTransferRing;
+  USB_SS_ENDPOINT_COMPANION_DESCRIPTOR  *CompDesc;
 
   MaxDci = 0;
 
@@ -2980,14 +3577,27 @@ XhcInitializeEndpointContext64 (
     InputContext->InputControlContext.Dword2 |= (BIT0 << Dci);
     InputContext->EP[Dci-1].MaxPacketSize     = EpDesc->MaxPacketSize;
 
+    CompDesc = NULL;
     if (DeviceSpeed == EFI_USB_SPEED_SUPER) {
       //
       // 6.2.3.4, shall be set to the value defined in the bMaxBurst field of the SuperSpeed Endpoint Companion Descriptor.
+      // USB 3.2 spec 9.6.7, the companion descriptor immediately follows its endpoint descriptor.
+      // It is only read when it lies within the configuration descriptor.
       //
-      InputContext->EP[Dci-1].MaxBurstSize = 0x0;
+      CompDesc = (USB_SS_ENDPOINT_COMPANION_DESCRIPTOR *)((UINTN)EpDesc + EpDesc->Length);
+      if (((UINTN)CompDesc + sizeof (USB_SS_ENDPOINT_COMPANION_DESCRIPTOR) > (UINTN)ConfigDesc + ConfigDesc->TotalLength) ||
+          (CompDesc->DescriptorType != USB_DESC_TYPE_SS_ENDPOINT_COMPANION) ||
+          (CompDesc->Length < sizeof (USB_SS_ENDPOINT_COMPANION_DESCRIPTOR))) {
+        CompDesc = NULL;
+      }
+    }
+
+    if (CompDesc != NULL) {
+      InputContext->EP[Dci-1].MaxBurstSize = CompDesc->MaxBurst;
     } else {
       InputContext->EP[Dci-1].MaxBurstSize = 0x0;
     }
+    Xhc->UsbDevContext[SlotId].EndpointMaxStreams[Dci-1] = 0;
 
     switch (EpDesc->Attributes & USB_ENDPOINT_TYPE_MASK) {
       case USB_ENDPOINT_BULK:
@@ -3000,6 +3610,13 @@ XhcInitializeEndpointContext64 (
         }
 
         InputContext->EP[Dci-1].AverageTRBLength = 0x1000;
+        //
+        // Bulk streams are enabled later on request of the class driver, only
+        // remember how many streams the endpoint supports.
+        //
+        if (CompDesc != NULL) {
+          Xhc->UsbDevContext[SlotId].EndpointMaxStreams[Dci-1] = CompDesc->Attributes & 0x1F;
+        }
         if (Xhc->UsbDevContext[SlotId].EndpointTransferRing[Dci-1] == NULL) {
           EndpointTransferRing = AllocateZeroPool(sizeof (TRANSFER_RING));
           Xhc->UsbDevContext[SlotId].EndpointTransferRing[Dci-1] = (VOID *) EndpointTransferRing;
@@ -3166,7 +3783,7 @@ XhcSetConfigCmd (
       continue;
     }
 
-    Dci = XhcInitializeEndpointContext (Xhc, SlotId, DeviceSpeed, InputContext, IfDesc);
+    Dci = XhcInitializeEndpointContext (Xhc, SlotId, DeviceSpeed, InputContext, ConfigDesc, IfDesc);
     if (Dci > MaxDci) {
       MaxDci = Dci;
     }
@@ -3256,7 +3873,7 @@ XhcSetConfigCmd64 (
       continue;
     }
 
-    Dci = XhcInitializeEndpointContext64 (Xhc, SlotId, DeviceSpeed, InputContext, IfDesc);
+    Dci = XhcInitializeEndpointContext64 (Xhc, SlotId, DeviceSpeed, InputContext, ConfigDesc, IfDesc);
     if (Dci > MaxDci) {
       MaxDci = Dci;
     }
@@ -3447,6 +4064,14 @@ XhcSetTrDequeuePointer (
   PhyAddr = UsbHcGetBusAddrForHostAddr (Xhc->MemPool, Urb->Ring->RingEnqueue, sizeof (CMD_SET_TR_DEQ_POINTER));
   CmdSetTRDeq.PtrLo    = XHC_LOW_32BIT (PhyAddr) | Urb->Ring->RingPCS;
   CmdSetTRDeq.PtrHi    = XHC_HIGH_32BIT (PhyAddr);
+  if (Urb->StreamId != 0) {
+    //
+    // 6.4.3.9 The dequeue pointer of a stream is selected by Stream ID, and the
+    // Stream Context Type lives in bits 3:1 of the pointer.
+    //
+    CmdSetTRDeq.PtrLo   |= STREAM_CTX_TYPE_PRIMARY_RING << 1;
+    CmdSetTRDeq.StreamID = Urb->StreamId;
+  }
   CmdSetTRDeq.CycleBit = 1;
   CmdSetTRDeq.Type     = TRB_TYPE_SET_TR_DEQUE;
   CmdSetTRDeq.Endpoint = Dci;
@@ -3596,6 +4221,7 @@ XhcSetInterface (
       // XHCI 4.3.6 - Setting Alternate Interfaces
       // 2) Free Transfer Rings of all endpoints that will be affected by the Alternate Interface setting.
       //
+      XhcFreeEndpointStreams (Xhc, SlotId, Dci);
       if (Xhc->UsbDevContext[SlotId].EndpointTransferRing[Dci - 1] != NULL) {
         RingSeg = ((TRANSFER_RING *)(UINTN)Xhc->UsbDevContext[SlotId].EndpointTransferRing[Dci - 1])->RingSeg0;
         if (RingSeg != NULL) {
@@ -3628,7 +4254,7 @@ XhcSetInterface (
     //   b. Initialize the Transfer Ring Segment(s) by clearing all fields of all TRBs to '0'.
     //   c. Initialize the Endpoint Context data structure.
     //
-    Dci = XhcInitializeEndpointContext (Xhc, SlotId, DeviceSpeed, InputContext, IfDescSet);
+    Dci = XhcInitializeEndpointContext (Xhc, SlotId, DeviceSpeed, InputContext, ConfigDesc, IfDescSet);
     if (Dci > MaxDci) {
       MaxDci = Dci;
     }
@@ -3798,6 +4424,7 @@ XhcSetInterface64 (
       // XHCI 4.3.6 - Setting Alternate Interfaces
       // 2) Free Transfer Rings of all endpoints that will be affected by the Alternate Interface setting.
       //
+      XhcFreeEndpointStreams (Xhc, SlotId, Dci);
       if (Xhc->UsbDevContext[SlotId].EndpointTransferRing[Dci - 1] != NULL) {
         RingSeg = ((TRANSFER_RING *)(UINTN)Xhc->UsbDevContext[SlotId].EndpointTransferRing[Dci - 1])->RingSeg0;
         if (RingSeg != NULL) {
@@ -3830,7 +4457,7 @@ XhcSetInterface64 (
     //   b. Initialize the Transfer Ring Segment(s) by clearing all fields of all TRBs to '0'.
     //   c. Initialize the Endpoint Context data structure.
     //
-    Dci = XhcInitializeEndpointContext64 (Xhc, SlotId, DeviceSpeed, InputContext, IfDescSet);
+    Dci = XhcInitializeEndpointContext64 (Xhc, SlotId, DeviceSpeed, InputContext, ConfigDesc, IfDescSet);
     if (Dci > MaxDci) {
       MaxDci = Dci;
     }
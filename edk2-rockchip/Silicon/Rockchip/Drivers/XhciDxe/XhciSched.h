@@ -64,6 +64,24 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #define ED_BULK_IN                            6
 #define ED_INTERRUPT_IN                       7
 
+//
+// 6.2.4.1 Stream Context Type (SCT), a primary transfer ring.
+//
+#define STREAM_CTX_TYPE_PRIMARY_RING          1
+
+//
+// The number of TRBs in every stream's transfer ring. Every stream usually
+// holds a single outstanding TD, so the rings are smaller than TR_RING_TRB_NUMBER.
+//
+#define STREAM_RING_TRB_NUMBER                0x40
+
+//
+// USB 3.x SuperSpeed Endpoint Companion descriptor type.
+//
+#ifndef USB_DESC_TYPE_SS_ENDPOINT_COMPANION
+#define USB_DESC_TYPE_SS_ENDPOINT_COMPANION   0x30
+#endif
+
 //
 // 6.4.5 TRB Completion Codes
 //
@@ -191,10 +209,30 @@ typedef struct _URB {
   BOOLEAN                         StartDone;
   BOOLEAN                         EndDone;
   BOOLEAN                         Finished;
+  //
+  // The bulk stream the URB is queued on, 0 if the endpoint has no streams
+  //
+  UINT16                          StreamId;
+  //
+  // Copy of Data handed to the callback of an asynchronous interrupt
+  // transfer, allocated with the URB to keep the pool out of the poll.
+  //
+  VOID                            *ProcBuf;
 
   TRB_TEMPLATE                    *EvtTrb;
 } URB;
 
+//
+// Bulk stream state of an endpoint. The stream context array has ArraySize
+// entries, entry 0 is reserved and StreamRings[N - 1] serves stream ID N.
+//
+typedef struct _XHC_STREAM_INFO {
+  UINT16                          NumStreams;
+  UINTN                           ArraySize;
+  VOID                            *StreamCtxArray;
+  TRANSFER_RING                   *StreamRings;
+} XHC_STREAM_INFO;
+
 //
 // 6.5 Event Ring Segment Table
 // The Event Ring Segment Table is used to define multi-segment Event Rings and to enable runtime
@@ -697,6 +735,36 @@ typedef struct _ENDPOINT_CONTEXT_64 {
 } ENDPOINT_CONTEXT_64;
 
 
+//
+// 6.2.4.1 Stream Context
+// A Stream Context Array holds the dequeue pointer of every stream of an endpoint.
+//
+typedef struct _STREAM_CONTEXT {
+  UINT32                  DCS:1;
+  UINT32                  SCT:3;
+  UINT32                  PtrLo:28;
+
+  UINT32                  PtrHi;
+
+  UINT32                  StoppedEDTLA:24;
+  UINT32                  RsvdO1:8;
+
+  UINT32                  RsvdO2;
+} STREAM_CONTEXT;
+
+//
+// The SuperSpeed Endpoint Companion descriptor, USB 3.2 spec 9.6.7.
+//
+#pragma pack(1)
+typedef struct {
+  UINT8                   Length;
+  UINT8                   DescriptorType;
+  UINT8                   MaxBurst;
+  UINT8                   Attributes;
+  UINT16                  BytesPerInterval;
+} USB_SS_ENDPOINT_COMPANION_DESCRIPTOR;
+#pragma pack()
+
 //
 // 6.2.5.1 Input Control Context
 //
@@ -1300,8 +1368,11 @@ XhcCheckNewEvent (
   @param  TrbNum            The number of TRB in the ring.
   @param  TransferRing           The created transfer ring.
 
+  @retval EFI_SUCCESS           The transfer ring was created.
+  @retval EFI_OUT_OF_RESOURCES  The ring could not be allocated.
+
 **/
-VOID
+EFI_STATUS
 CreateTransferRing (
   IN  USB_XHCI_INSTANCE     *Xhc,
   IN  UINTN                 TrbNum,
@@ -1485,4 +1556,127 @@ XhcCreateTransferTrb (
   IN URB                          *Urb
   );
 
+/**
+  Check the URB's execution result and update the URB's
+  result accordingly.
+
+  @param  Xhc             The XHCI Instance.
+  @param  Urb             The URB to check result.
+
+  @return Whether the result of URB transfer is finialized.
+
+**/
+BOOLEAN
+XhcCheckUrbResult (
+  IN  USB_XHCI_INSTANCE   *Xhc,
+  IN  URB                 *Urb
+  );
+
+/**
+  Ring the door bell of an endpoint stream.
+
+  @param  Xhc           The XHCI Instance.
+  @param  SlotId        The slot id of the target device.
+  @param  Dci           The device context index of the target endpoint.
+  @param  StreamId      The stream of the endpoint, 0 if it has no streams.
+
+  @retval EFI_SUCCESS   Successfully ring the door bell.
+
+**/
+EFI_STATUS
+EFIAPI
+XhcRingStreamDoorBell (
+  IN USB_XHCI_INSTANCE    *Xhc,
+  IN UINT8                SlotId,
+  IN UINT8                Dci,
+  IN UINT16               StreamId
+  );
+
+/**
+  Create a bulk URB on an endpoint stream and put its TRBs on the stream's
+  transfer ring. The door bell is not rung.
+
+  @param  Xhc                   The XHCI Instance.
+  @param  BusAddr               Device address.
+  @param  EpAddr                Endpoint address, direction in bit 7.
+  @param  StreamId              The stream of the endpoint, 0 if it has no streams.
+  @param  Data                  The user data to transfer.
+  @param  DataLen               The length of data buffer.
+
+  @return Created URB or NULL
+
+**/
+URB*
+XhcCreateStreamUrb (
+  IN USB_XHCI_INSTANCE                  *Xhc,
+  IN UINT8                              BusAddr,
+  IN UINT8                              EpAddr,
+  IN UINT16                             StreamId,
+  IN VOID                               *Data,
+  IN UINTN                              DataLen
+  );
+
+/**
+  Allocate a stream context array and the stream transfer rings for a bulk
+  endpoint and switch the endpoint to them with a Configure Endpoint command.
+
+  @param  Xhc                   The XHCI Instance.
+  @param  SlotId                The slot id of the device.
+  @param  Dcis                  The device context indexes of the endpoints.
+  @param  NumDci                The number of entries in Dcis.
+  @param  NumStreams            On input, the number of streams wanted. On
+                                output, the number of streams allocated.
+
+  @retval EFI_SUCCESS           The streams are ready to use.
+  @retval EFI_UNSUPPORTED       The controller or an endpoint has no stream support.
+  @retval EFI_OUT_OF_RESOURCES  The stream rings could not be allocated.
+  @retval Others                The Configure Endpoint command failed.
+
+**/
+EFI_STATUS
+XhcAllocateEndpointStreams (
+  IN     USB_XHCI_INSTANCE      *Xhc,
+  IN     UINT8                  SlotId,
+  IN     UINT8                  *Dcis,
+  IN     UINTN                  NumDci,
+  IN OUT UINT16                 *NumStreams
+  );
+
+/**
+  Switch bulk endpoints back from streams to their single transfer ring and
+  release the stream resources.
+
+  @param  Xhc                   The XHCI Instance.
+  @param  SlotId                The slot id of the device.
+  @param  Dcis                  The device context indexes of the endpoints.
+  @param  NumDci                The number of entries in Dcis.
+
+  @retval EFI_SUCCESS           The endpoints no longer use streams.
+  @retval Others                The Configure Endpoint command failed.
+
+**/
+EFI_STATUS
+XhcReleaseEndpointStreams (
+  IN USB_XHCI_INSTANCE          *Xhc,
+  IN UINT8                      SlotId,
+  IN UINT8                      *Dcis,
+  IN UINTN                      NumDci
+  );
+
+/**
+  Free the stream resources of an endpoint without touching the hardware.
+  URBs still queued on the streams are completed with EFI_USB_ERR_SYSTEM.
+
+  @param  Xhc                   The XHCI Instance.
+  @param  SlotId                The slot id of the device.
+  @param  Dci                   The device context index of the endpoint.
+
+**/
+VOID
+XhcFreeEndpointStreams (
+  IN USB_XHCI_INSTANCE          *Xhc,
+  IN UINT8                      SlotId,
+  IN UINT8                      Dci
+  );
+
 #endif
@@ -0,0 +1,89 @@
+/** @file
+
+  Streaming DMA mappings for the Rockchip storage and USB drivers.
+
+  DmaBufferMap() and DmaBufferUnmap() take the same arguments as DmaMap()
+  and DmaUnmap(), and are used for the data buffers of transfers. They do
+  the cache maintenance of the exact range being mapped, skip it for
+  uncached buffers, and bounce unaligned buffers the device writes through
+  a few uncached buffers allocated once, instead of allocating and
+  remapping pages for every transfer. Anything else is passed to DmaLib.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _DMA_BUFFER_LIB_H_
+#define _DMA_BUFFER_LIB_H_
+
+#include <Library/DmaLib.h>
+
+//
+// Counters of the calling module since it was loaded
+//
+typedef struct {
+  UINT64                        Maps;
+  UINT64                        DirectMaps;           // Cache maintenance only
+  UINT64                        UncachedMaps;         // No cache maintenance
+  UINT64                        BouncedMaps;          // Through a preallocated bounce buffer
+  UINT64                        FallbackMaps;         // Passed to DmaMap()
+  UINT64                        BounceAllocsAvoided;  // Pages DmaMap() would have allocated and remapped
+  UINT64                        CopyBytes;            // Copied out of bounce buffers
+  UINT64                        MaintenanceBytesAvoided;
+  UINT64                        RegionLookupsAvoided; // GCD lookups answered by the region cache
+} DMA_BUFFER_STATS;
+
+/**
+  Map a buffer for a bus master transfer.
+
+  @param  Operation             The kind of transfer.
+  @param  HostAddress           The buffer.
+  @param  NumberOfBytes         On input the size of the buffer, on output
+                                the size that was mapped.
+  @param  DeviceAddress         The address the device uses.
+  @param  Mapping               Passed to DmaBufferUnmap() when the
+                                transfer is done.
+
+  @retval EFI_SUCCESS           The buffer is mapped.
+  @return Others                See DmaMap().
+
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferMap (
+  IN     DMA_MAP_OPERATION      Operation,
+  IN     VOID                   *HostAddress,
+  IN OUT UINTN                  *NumberOfBytes,
+  OUT    PHYSICAL_ADDRESS       *DeviceAddress,
+  OUT    VOID                   **Mapping
+  );
+
+/**
+  Complete a transfer mapped with DmaBufferMap().
+
+  @param  Mapping               The mapping returned by DmaBufferMap().
+
+  @retval EFI_SUCCESS           The mapping is released.
+  @retval EFI_INVALID_PARAMETER Mapping is not a mapping.
+
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferUnmap (
+  IN VOID                       *Mapping
+  );
+
+/**
+  Read the counters of the calling module.
+
+  @param  Stats                 Receives the counters.
+
+**/
+VOID
+EFIAPI
+DmaBufferGetStats (
+  OUT DMA_BUFFER_STATS          *Stats
+  );
+
+#endif
@@ -0,0 +1,107 @@
+/** @file
+
+  Counters for the PCIe configuration accesses and link bring-up, published
+  through ROCKCHIP_PCIE_PROFILE_PROTOCOL.
+
+  PciExpressLib and PcieInitDxe call the library through the PCIE_PROFILE_*
+  macros, which reduce to nothing unless PcdPcieProfileEnable is set.
+  Modules using them must list the PCD as a FeaturePcd. PcieProfileLibNull
+  is the instance for the modules that cannot use boot services.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _PCIE_PROFILE_LIB_H_
+#define _PCIE_PROFILE_LIB_H_
+
+#include <Uefi/UefiBaseType.h>
+#include <Library/PcdLib.h>
+#include <Protocol/PcieProfile.h>
+
+#define PCIE_PROFILE_ENABLED  FeaturePcdGet (PcdPcieProfileEnable)
+
+//
+// Kinds of configuration access, a read-modify-write counts as both
+//
+#define PCIE_PROFILE_READ     0x1
+#define PCIE_PROFILE_WRITE    0x2
+#define PCIE_PROFILE_MODIFY   (PCIE_PROFILE_READ | PCIE_PROFILE_WRITE)
+
+#define PCIE_PROFILE_CONFIG_ACCESS(Segment, Bus, Device, Function, Access) \
+          do { \
+            if (PCIE_PROFILE_ENABLED) { \
+              PcieProfileConfigAccess ((Segment), (Bus), (Device), (Function), (Access)); \
+            } \
+          } while (FALSE)
+
+#define PCIE_PROFILE_ATU_PROGRAM(Segment) \
+          do { \
+            if (PCIE_PROFILE_ENABLED) { \
+              PcieProfileAtuProgram (Segment); \
+            } \
+          } while (FALSE)
+
+#define PCIE_PROFILE_LINK_PHASE(Segment, Phase, Microseconds) \
+          do { \
+            if (PCIE_PROFILE_ENABLED) { \
+              PcieProfilePhase ((Segment), (Phase), (Microseconds)); \
+            } \
+          } while (FALSE)
+
+/**
+  Account a configuration access.
+
+  @param  Segment             The PCI segment of the function.
+  @param  Bus                 The bus of the function.
+  @param  Device              The device of the function.
+  @param  Function            The function.
+  @param  Access              PCIE_PROFILE_READ, PCIE_PROFILE_WRITE or both.
+
+**/
+VOID
+PcieProfileConfigAccess (
+  IN UINTN                  Segment,
+  IN UINTN                  Bus,
+  IN UINTN                  Device,
+  IN UINTN                  Function,
+  IN UINTN                  Access
+  );
+
+/**
+  Account the programming of an outbound iATU region.
+
+  @param  Segment             The PCI segment of the root complex.
+
+**/
+VOID
+PcieProfileAtuProgram (
+  IN UINTN                  Segment
+  );
+
+/**
+  Account the time a root port spent in a phase of its link bring-up.
+
+  @param  Segment             The PCI segment of the root port.
+  @param  Phase               The phase.
+  @param  Microseconds        The time spent in it.
+
+**/
+VOID
+PcieProfilePhase (
+  IN UINTN                  Segment,
+  IN PCIE_PROFILE_PHASE     Phase,
+  IN UINT64                 Microseconds
+  );
+
+/**
+  Log the counters with DEBUG_INFO.
+
+**/
+VOID
+PcieProfileLogSummary (
+  VOID
+  );
+
+#endif
@@ -94,14 +94,14 @@ Dwc3Force20ClkFor30Clk (UINT32 Address, BOOLEAN enable);
 
 void
 EFIAPI
-Pcie30IoInit(void);
+PcieIoInit(UINT32 Segment);
 
 void
 EFIAPI
-Pcie30PowerEn(void);
+PciePowerEn(UINT32 Segment);
 
 void
 EFIAPI
-Pcie30PeReset(BOOLEAN enable);
+PciePeReset(UINT32 Segment, BOOLEAN enable);
 
 #endif
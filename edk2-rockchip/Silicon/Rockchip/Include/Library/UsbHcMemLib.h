@@ -1,41 +1,27 @@
 /** @file
 
-  This file contains the definination for host controller memory management routines.
+  Memory management routines shared by the XHCI, EHCI and OHCI host
+  controller drivers. The pool hands out DMA-able memory for rings, queue
+  heads and transfer descriptors in USBHC_MEM_UNIT sized units.
 
-Copyright (c) 2013 - 2018, Intel Corporation. All rights reserved.<BR>
-SPDX-License-Identifier: BSD-2-Clause-Patent
+  Copyright (c) 2013 - 2018, Intel Corporation. All rights reserved.<BR>
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
 
 **/
 
-#ifndef _EFI_XHCI_MEM_H_
-#define _EFI_XHCI_MEM_H_
+#ifndef _USB_HC_MEM_LIB_H_
+#define _USB_HC_MEM_LIB_H_
 
-#define USB_HC_BIT(a)                  ((UINTN)(1 << (a)))
-
-#define USB_HC_BIT_IS_SET(Data, Bit)   \
-          ((BOOLEAN)(((Data) & USB_HC_BIT(Bit)) == USB_HC_BIT(Bit)))
-
-typedef struct _USBHC_MEM_BLOCK USBHC_MEM_BLOCK;
-struct _USBHC_MEM_BLOCK {
-  UINT8                   *Bits;    // Bit array to record which unit is allocated
-  UINTN                   BitsLen;
-  UINT8                   *Buf;
-  UINT8                   *BufHost;
-  UINTN                   BufLen;   // Memory size in bytes
-  VOID                    *Mapping;
-  USBHC_MEM_BLOCK         *Next;
-};
+#define USB_HC_HIGH_32BIT(Addr64)    \
+          ((UINT32)(RShiftU64((UINTN)(Addr64), 32) & 0XFFFFFFFF))
 
 //
 // USBHC_MEM_POOL is used to manage the memory used by USB
-// host controller. XHCI requires the control memory and transfer
-// data to be on the same 4G memory.
+// host controller. EHCI and XHCI require the control memory
+// and transfer data to be on the same 4G memory.
 //
-typedef struct _USBHC_MEM_POOL {
-  BOOLEAN                 Check4G;
-  UINT32                  Which4G;
-  USBHC_MEM_BLOCK         *Head;
-} USBHC_MEM_POOL;
+typedef struct _USBHC_MEM_POOL USBHC_MEM_POOL;
 
 //
 // Memory allocation unit, must be 2^n, n>4
@@ -47,38 +33,26 @@ typedef struct _USBHC_MEM_POOL {
 
 #define USBHC_MEM_ROUND(Len)  (((Len) + USBHC_MEM_UNIT_MASK) & (~USBHC_MEM_UNIT_MASK))
 
-//
-// Advance the byte and bit to the next bit, adjust byte accordingly.
-//
-#define NEXT_BIT(Byte, Bit)   \
-          do {                \
-            (Bit)++;          \
-            if ((Bit) > 7) {  \
-              (Byte)++;       \
-              (Bit) = 0;      \
-            }                 \
-          } while (0)
-
-
-
 /**
   Initialize the memory management pool for the host controller.
 
-  @param  PciIo               The PciIo that can be used to access the host controller.
+  @param  Check4G             Whether the host controller requires allocated memory
+                              from one 4G address space.
+  @param  Which4G             The 4G memory area each memory allocated should be from.
 
-  @retval EFI_SUCCESS         The memory pool is initialized.
-  @retval EFI_OUT_OF_RESOURCE Fail to init the memory pool.
+  @return The memory pool, or NULL if it could not be initialized.
 
 **/
 USBHC_MEM_POOL *
 UsbHcInitMemPool (
+  IN BOOLEAN              Check4G,
+  IN UINT32               Which4G
   );
 
-
 /**
   Release the memory management pool.
 
-  @param   Pool               The USB memory pool to free.
+  @param  Pool              The USB memory pool to free.
 
   @retval EFI_SUCCESS       The memory pool is freed.
   @retval EFI_DEVICE_ERROR  Failed to free the memory pool.
@@ -89,7 +63,6 @@ UsbHcFreeMemPool (
   IN USBHC_MEM_POOL       *Pool
   );
 
-
 /**
   Allocate some memory from the host controller's memory pool
   which can be used to communicate with host controller.
@@ -106,7 +79,6 @@ UsbHcAllocateMem (
   IN  UINTN               Size
   );
 
-
 /**
   Free the allocated memory back to the memory pool.
 
@@ -123,13 +95,13 @@ UsbHcFreeMem (
   );
 
 /**
-  Calculate the corresponding pci bus address according to the Mem parameter.
+  Calculate the corresponding bus address according to the Mem parameter.
 
   @param  Pool           The memory pool of the host controller.
   @param  Mem            The pointer to host memory.
   @param  Size           The size of the memory region.
 
-  @return                The pci memory address
+  @return                The bus memory address
 
 **/
 EFI_PHYSICAL_ADDRESS
@@ -140,10 +112,10 @@ UsbHcGetBusAddrForHostAddr (
   );
 
 /**
-  Calculate the corresponding host address according to the pci address.
+  Calculate the corresponding host address according to the bus address.
 
   @param  Pool           The memory pool of the host controller.
-  @param  Mem            The pointer to pci memory.
+  @param  Mem            The pointer to bus memory.
   @param  Size           The size of the memory region.
 
   @return                The host memory address
@@ -157,15 +129,15 @@ UsbHcGetHostAddrForBusAddr (
   );
 
 /**
-  Allocates pages at a specified alignment that are suitable for an EfiPciIoOperationBusMasterCommonBuffer mapping.
+  Allocates pages at a specified alignment that are suitable for a
+  MapOperationBusMasterCommonBuffer mapping.
 
   If Alignment is not a power of two and Alignment is not zero, then ASSERT().
 
-  @param  PciIo                 The PciIo that can be used to access the host controller.
   @param  Pages                 The number of pages to allocate.
   @param  Alignment             The requested alignment of the allocation.  Must be a power of two.
-  @param  HostAddress           The system memory address to map to the PCI controller.
-  @param  DeviceAddress         The resulting map address for the bus master PCI controller to
+  @param  HostAddress           The system memory address to map to the host controller.
+  @param  DeviceAddress         The resulting map address for the bus master controller to
                                 use to access the hosts HostAddress.
   @param  Mapping               A resulting value to pass to Unmap().
 
@@ -173,7 +145,6 @@ UsbHcGetHostAddrForBusAddr (
   @retval EFI_INVALID_PARAMETER Pages or Alignment is not valid.
   @retval EFI_OUT_OF_RESOURCES  Do not have enough resources to allocate memory.
 
-
 **/
 EFI_STATUS
 UsbHcAllocateAlignedPages (
@@ -187,8 +158,7 @@ UsbHcAllocateAlignedPages (
 /**
   Frees memory that was allocated with UsbHcAllocateAlignedPages().
 
-  @param  PciIo                 The PciIo that can be used to access the host controller.
-  @param  HostAddress           The system memory address to map to the PCI controller.
+  @param  HostAddress           The system memory address to map to the host controller.
   @param  Pages                 The number of pages to free.
   @param  Mapping               The mapping value returned from Map().
 
@@ -0,0 +1,178 @@
+/** @file
+
+  Timing counters for the USB host controller drivers, published through
+  ROCKCHIP_USB_PROFILE_PROTOCOL.
+
+  The drivers call the library through the USB_PROFILE_* macros, which
+  reduce to nothing unless PcdUsbProfileEnable is set: the timestamps are
+  not even taken. Modules using them must list the PCD as a FeaturePcd.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _USB_PROFILE_LIB_H_
+#define _USB_PROFILE_LIB_H_
+
+#include <Library/PcdLib.h>
+#include <Protocol/UsbProfile.h>
+
+typedef struct _USB_PROFILE USB_PROFILE;
+
+#define USB_PROFILE_ENABLED   FeaturePcdGet (PcdUsbProfileEnable)
+
+#define USB_PROFILE_TIMESTAMP() \
+          (USB_PROFILE_ENABLED ? UsbProfileTimestamp () : 0)
+
+#define USB_PROFILE_TRANSFER(Profile, DeviceAddress, Type, Bytes, StartTick, Status) \
+          do { \
+            if (USB_PROFILE_ENABLED) { \
+              UsbProfileTransfer ((Profile), (DeviceAddress), (Type), (Bytes), (StartTick), (Status)); \
+            } \
+          } while (FALSE)
+
+#define USB_PROFILE_POLL(Profile, StartTick) \
+          do { \
+            if (USB_PROFILE_ENABLED) { \
+              UsbProfilePoll ((Profile), (StartTick)); \
+            } \
+          } while (FALSE)
+
+#define USB_PROFILE_PORT_CONNECT(Profile, Port) \
+          do { \
+            if (USB_PROFILE_ENABLED) { \
+              UsbProfilePortConnect ((Profile), (Port)); \
+            } \
+          } while (FALSE)
+
+#define USB_PROFILE_PORT_RESET_START(Profile, Port) \
+          do { \
+            if (USB_PROFILE_ENABLED) { \
+              UsbProfilePortResetStart ((Profile), (Port)); \
+            } \
+          } while (FALSE)
+
+#define USB_PROFILE_PORT_RESET_DONE(Profile, Port) \
+          do { \
+            if (USB_PROFILE_ENABLED) { \
+              UsbProfilePortResetDone ((Profile), (Port)); \
+            } \
+          } while (FALSE)
+
+/**
+  Create the counters of a host controller and install
+  ROCKCHIP_USB_PROFILE_PROTOCOL on its handle.
+
+  @param  Controller          The host controller handle.
+  @param  ControllerName      The kind of controller, "XHCI", "EHCI" or "OHCI".
+  @param  BaseAddress         The MMIO base of the controller.
+
+  @return The counters, or NULL if they could not be created. The other
+          functions accept NULL and do nothing then.
+
+**/
+USB_PROFILE *
+UsbProfileCreate (
+  IN EFI_HANDLE             Controller,
+  IN CONST CHAR16           *ControllerName,
+  IN UINTN                  BaseAddress
+  );
+
+/**
+  Uninstall the protocol and free the counters of a host controller.
+
+  @param  Profile             The counters returned by UsbProfileCreate.
+
+**/
+VOID
+UsbProfileDestroy (
+  IN USB_PROFILE            *Profile
+  );
+
+/**
+  Read the ARM generic counter.
+
+  @return The current counter value.
+
+**/
+UINT64
+UsbProfileTimestamp (
+  VOID
+  );
+
+/**
+  Account a completed synchronous transfer.
+
+  @param  Profile             The counters of the controller.
+  @param  DeviceAddress       The device the transfer was for.
+  @param  Type                The kind of transfer.
+  @param  Bytes               The number of bytes transferred.
+  @param  StartTick           The counter value when the transfer was submitted.
+  @param  Status              The result of the transfer.
+
+**/
+VOID
+UsbProfileTransfer (
+  IN USB_PROFILE            *Profile,
+  IN UINT8                  DeviceAddress,
+  IN USB_PROFILE_TYPE       Type,
+  IN UINTN                  Bytes,
+  IN UINT64                 StartTick,
+  IN EFI_STATUS             Status
+  );
+
+/**
+  Account the time spent polling for the completion of a transfer.
+
+  @param  Profile             The counters of the controller.
+  @param  StartTick           The counter value when polling started.
+
+**/
+VOID
+UsbProfilePoll (
+  IN USB_PROFILE            *Profile,
+  IN UINT64                 StartTick
+  );
+
+/**
+  Note that a device was connected to a root port, the debounce time runs
+  from there until the port is reset.
+
+  @param  Profile             The counters of the controller.
+  @param  Port                The root port, zero based.
+
+**/
+VOID
+UsbProfilePortConnect (
+  IN USB_PROFILE            *Profile,
+  IN UINTN                  Port
+  );
+
+/**
+  Note that the reset of a root port starts.
+
+  @param  Profile             The counters of the controller.
+  @param  Port                The root port, zero based.
+
+**/
+VOID
+UsbProfilePortResetStart (
+  IN USB_PROFILE            *Profile,
+  IN UINTN                  Port
+  );
+
+/**
+  Note that the reset of a root port completed.
+
+  @param  Profile             The counters of the controller.
+  @param  Port                The root port, zero based.
+
+**/
+VOID
+UsbProfilePortResetDone (
+  IN USB_PROFILE            *Profile,
+  IN UINTN                  Port
+  );
+
+#endif
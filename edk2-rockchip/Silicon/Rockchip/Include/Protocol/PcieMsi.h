@@ -0,0 +1,100 @@
+/** @file
+  Rockchip PCIe MSI protocol.
+
+  Installed by PcieInitDxe when the GIC accepts message-based SPIs. A
+  firmware driver registers a handler and gets a vector, whose address and
+  data it writes into the MSI or MSI-X capability of its function. The
+  memory write of the MSI then sets the SPI of the vector pending, and
+  ArmGicDxe calls the handler.
+
+  Handlers run in interrupt context, at TPL_HIGH_LEVEL. They should only
+  signal an event or note the completion, and must cope with being called
+  without a message pending.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _ROCKCHIP_PCIE_MSI_PROTOCOL_H_
+#define _ROCKCHIP_PCIE_MSI_PROTOCOL_H_
+
+#define ROCKCHIP_PCIE_MSI_PROTOCOL_GUID \
+  { 0x8e5c2d17, 0x4b9a, 0x4f31, { 0xa6, 0x0e, 0x93, 0x7d, 0x1c, 0x52, 0xe8, 0x4b } }
+
+#define ROCKCHIP_PCIE_MSI_PROTOCOL_REVISION  0x00010000
+
+typedef struct _ROCKCHIP_PCIE_MSI_PROTOCOL ROCKCHIP_PCIE_MSI_PROTOCOL;
+
+/**
+  Called when the MSI of a vector is received.
+
+  @param  Vector                The vector.
+  @param  Context               The context given when registering.
+
+**/
+typedef
+VOID
+(EFIAPI *ROCKCHIP_PCIE_MSI_HANDLER)(
+  IN UINTN                      Vector,
+  IN VOID                       *Context
+  );
+
+/**
+  Allocate a vector and register its handler. The vector is enabled on
+  return.
+
+  @param  This                  The protocol.
+  @param  Handler               Called when the MSI is received.
+  @param  Context               Passed to the handler.
+  @param  Vector                The vector, for Unregister().
+  @param  Address               The MSI Message Address to program.
+  @param  Data                  The MSI Message Data to program.
+
+  @retval EFI_SUCCESS           The vector is allocated and enabled.
+  @retval EFI_INVALID_PARAMETER A parameter is NULL.
+  @retval EFI_OUT_OF_RESOURCES  All the vectors are in use.
+  @retval EFI_NOT_READY         The interrupt controller driver is not
+                                loaded yet.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *ROCKCHIP_PCIE_MSI_REGISTER)(
+  IN  ROCKCHIP_PCIE_MSI_PROTOCOL  *This,
+  IN  ROCKCHIP_PCIE_MSI_HANDLER   Handler,
+  IN  VOID                        *Context,
+  OUT UINTN                       *Vector,
+  OUT UINT64                      *Address,
+  OUT UINT32                      *Data
+  );
+
+/**
+  Disable a vector and free it. The driver must have disabled the MSI of
+  its function first.
+
+  @param  This                  The protocol.
+  @param  Vector                The vector returned by Register().
+
+  @retval EFI_SUCCESS           The vector is freed.
+  @retval EFI_INVALID_PARAMETER The vector is not allocated.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *ROCKCHIP_PCIE_MSI_UNREGISTER)(
+  IN ROCKCHIP_PCIE_MSI_PROTOCOL   *This,
+  IN UINTN                        Vector
+  );
+
+struct _ROCKCHIP_PCIE_MSI_PROTOCOL {
+  UINT32                          Revision;
+  UINTN                           VectorCount;
+  ROCKCHIP_PCIE_MSI_REGISTER      Register;
+  ROCKCHIP_PCIE_MSI_UNREGISTER    Unregister;
+};
+
+extern EFI_GUID gRockchipPcieMsiProtocolGuid;
+
+#endif
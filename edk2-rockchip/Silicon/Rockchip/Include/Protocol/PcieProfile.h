@@ -0,0 +1,79 @@
+/** @file
+  Rockchip PCIe profiling protocol.
+
+  Installed once, by the first module that counts something, when built
+  with PcdPcieProfileEnable. Every module linking PciExpressLib counts its
+  configuration accesses and iATU programming there, and PcieInitDxe adds
+  the time each root port spent in the phases of the link bring-up, so
+  that they can be dumped from the shell. All durations are in
+  microseconds.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _ROCKCHIP_PCIE_PROFILE_PROTOCOL_H_
+#define _ROCKCHIP_PCIE_PROFILE_PROTOCOL_H_
+
+#define ROCKCHIP_PCIE_PROFILE_PROTOCOL_GUID \
+  { 0x3f0b6a52, 0x91c4, 0x4e27, { 0xb8, 0x1d, 0x6e, 0x02, 0xa7, 0x5c, 0x39, 0xd4 } }
+
+//
+// Functions tracked, accesses to more functions are only counted in Dropped
+//
+#define PCIE_PROFILE_MAX_FUNCTIONS      64
+#define PCIE_PROFILE_MAX_SEGMENTS       8
+
+typedef struct _ROCKCHIP_PCIE_PROFILE_PROTOCOL ROCKCHIP_PCIE_PROFILE_PROTOCOL;
+
+//
+// Phases of the link bring-up of a root port
+//
+typedef enum {
+  PcieProfilePower,             // Slot powered, PERST# asserted
+  PcieProfileDetect,            // PERST# released, LTSSM looking for a receiver
+  PcieProfileTraining,          // Receiver found, waiting for the link
+  PcieProfileSettle,            // Link up, no config request yet
+  PcieProfileRetrain,           // Link below what both ends support
+  PcieProfilePhaseMax
+} PCIE_PROFILE_PHASE;
+
+typedef struct {
+  UINT8                         Segment;
+  UINT8                         Bus;
+  UINT8                         Device;
+  UINT8                         Function;
+  UINT64                        Reads;
+  UINT64                        Writes;
+} PCIE_PROFILE_FUNCTION;
+
+typedef struct {
+  UINT64                        AtuPrograms;    // Outbound iATU regions written
+  UINT64                        PhaseUs[PcieProfilePhaseMax];
+} PCIE_PROFILE_SEGMENT;
+
+/**
+  Clear all the counters.
+
+  @param  This                  The ROCKCHIP_PCIE_PROFILE_PROTOCOL instance.
+
+**/
+typedef
+VOID
+(EFIAPI *ROCKCHIP_PCIE_PROFILE_RESET)(
+  IN ROCKCHIP_PCIE_PROFILE_PROTOCOL  *This
+  );
+
+struct _ROCKCHIP_PCIE_PROFILE_PROTOCOL {
+  UINT64                        Dropped;
+  UINTN                         FunctionCount;
+  PCIE_PROFILE_FUNCTION         Functions[PCIE_PROFILE_MAX_FUNCTIONS];
+  PCIE_PROFILE_SEGMENT          Segments[PCIE_PROFILE_MAX_SEGMENTS];
+  ROCKCHIP_PCIE_PROFILE_RESET   Reset;
+};
+
+extern EFI_GUID gRockchipPcieProfileProtocolGuid;
+
+#endif
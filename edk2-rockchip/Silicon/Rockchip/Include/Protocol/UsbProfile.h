@@ -0,0 +1,81 @@
+/** @file
+  Rockchip USB profiling protocol.
+
+  Installed by the XHCI, EHCI and OHCI drivers on their host controller
+  handle when built with PcdUsbProfileEnable. It exposes the counters the
+  driver keeps about its transfers and root ports, so that they can be
+  dumped from the shell. All durations are in ticks of the ARM generic
+  counter, whose frequency is given by the protocol.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _ROCKCHIP_USB_PROFILE_PROTOCOL_H_
+#define _ROCKCHIP_USB_PROFILE_PROTOCOL_H_
+
+#define ROCKCHIP_USB_PROFILE_PROTOCOL_GUID \
+  { 0x7263eb14, 0xf332, 0x4c34, { 0xac, 0xce, 0x14, 0x96, 0xc4, 0x60, 0xad, 0xc8 } }
+
+//
+// Devices tracked per controller, transfers to more devices are only
+// counted in Dropped
+//
+#define USB_PROFILE_MAX_DEVICES         32
+
+typedef struct _ROCKCHIP_USB_PROFILE_PROTOCOL ROCKCHIP_USB_PROFILE_PROTOCOL;
+
+typedef enum {
+  UsbProfileControl,
+  UsbProfileBulk,
+  UsbProfileInterrupt,
+  UsbProfileTypeMax
+} USB_PROFILE_TYPE;
+
+//
+// Number, total, shortest and longest duration of a kind of operation
+//
+typedef struct {
+  UINT64                        Count;
+  UINT64                        Total;
+  UINT64                        Min;
+  UINT64                        Max;
+} USB_PROFILE_TIMING;
+
+typedef struct {
+  UINT8                         DeviceAddress;
+  UINT64                        Errors;
+  UINT64                        Bytes[UsbProfileTypeMax];
+  USB_PROFILE_TIMING            Latency[UsbProfileTypeMax];
+} USB_PROFILE_DEVICE;
+
+/**
+  Clear all the counters of the controller.
+
+  @param  This                  The ROCKCHIP_USB_PROFILE_PROTOCOL instance.
+
+**/
+typedef
+VOID
+(EFIAPI *ROCKCHIP_USB_PROFILE_RESET)(
+  IN ROCKCHIP_USB_PROFILE_PROTOCOL  *This
+  );
+
+struct _ROCKCHIP_USB_PROFILE_PROTOCOL {
+  CONST CHAR16                  *ControllerName;
+  UINTN                         BaseAddress;
+  UINT64                        Frequency;      // Counter ticks per second
+  UINT64                        PollTicks;      // Stalled waiting for transfers
+  USB_PROFILE_TIMING            PortDebounce;   // Connect seen to reset started
+  USB_PROFILE_TIMING            PortReset;      // Reset started to reset done
+  UINT64                        Dropped;
+  UINTN                         DeviceCount;
+  USB_PROFILE_DEVICE            Devices[USB_PROFILE_MAX_DEVICES];
+  ROCKCHIP_USB_PROFILE_RESET    Reset;
+};
+
+extern EFI_GUID gRockchipUsbProfileProtocolGuid;
+
+#endif
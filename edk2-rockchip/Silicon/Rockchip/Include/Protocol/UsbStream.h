@@ -0,0 +1,185 @@
+/** @file
+  Rockchip USB bulk stream protocol.
+
+  EFI_USB2_HC_PROTOCOL has no notion of USB 3.x bulk streams. This protocol is
+  installed by the XHCI driver on the host controller handle, next to
+  EFI_USB2_HC_PROTOCOL, and lets class drivers such as USB Attached SCSI
+  allocate streams on the bulk endpoints of a device and keep several
+  transfers outstanding on them at the same time.
+
+  Devices are addressed with the same logical device address that the USB bus
+  driver uses with EFI_USB2_HC_PROTOCOL.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _ROCKCHIP_USB_STREAM_PROTOCOL_H_
+#define _ROCKCHIP_USB_STREAM_PROTOCOL_H_
+
+#include <Protocol/DevicePath.h>
+
+#define ROCKCHIP_USB_STREAM_PROTOCOL_GUID \
+  { 0x5e2a7c6d, 0x4f13, 0x4b9a, { 0x8d, 0x61, 0x2c, 0x7f, 0x90, 0x3e, 0xa1, 0x54 } }
+
+typedef struct _ROCKCHIP_USB_STREAM_PROTOCOL ROCKCHIP_USB_STREAM_PROTOCOL;
+
+/**
+  Translate the USB device path nodes below the host controller into the
+  logical device address of the device.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  RemainingDevicePath   The USB() device path nodes that follow the
+                                host controller device path.
+  @param  DeviceAddress         Returns the logical device address.
+  @param  DeviceSpeed           Returns the device speed (EFI_USB_SPEED_*).
+
+  @retval EFI_SUCCESS           The device was found.
+  @retval EFI_INVALID_PARAMETER The device path is not a USB device path.
+  @retval EFI_NOT_FOUND         No enabled device matches the device path.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *ROCKCHIP_USB_STREAM_GET_DEVICE)(
+  IN  ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN  EFI_DEVICE_PATH_PROTOCOL      *RemainingDevicePath,
+  OUT UINT8                         *DeviceAddress,
+  OUT UINT8                         *DeviceSpeed
+  );
+
+/**
+  Allocate the same number of streams on a set of bulk endpoints.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  DeviceAddress         The logical device address.
+  @param  EndpointAddresses     The bulk endpoint addresses, direction in bit 7.
+  @param  NumberOfEndpoints     The number of entries in EndpointAddresses.
+  @param  NumberOfStreams       On input, the number of streams wanted. On
+                                output, the number of streams allocated. Valid
+                                stream IDs are 1 .. NumberOfStreams.
+
+  @retval EFI_SUCCESS           The streams were allocated.
+  @retval EFI_UNSUPPORTED       The controller or an endpoint has no stream support.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_OUT_OF_RESOURCES  The stream rings could not be allocated.
+  @retval EFI_DEVICE_ERROR      The Configure Endpoint command failed.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *ROCKCHIP_USB_STREAM_ALLOCATE)(
+  IN     ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN     UINT8                         DeviceAddress,
+  IN     UINT8                         *EndpointAddresses,
+  IN     UINTN                         NumberOfEndpoints,
+  IN OUT UINT16                        *NumberOfStreams
+  );
+
+/**
+  Free the streams of a set of bulk endpoints and return them to a single
+  transfer ring.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  DeviceAddress         The logical device address.
+  @param  EndpointAddresses     The bulk endpoint addresses, direction in bit 7.
+  @param  NumberOfEndpoints     The number of entries in EndpointAddresses.
+
+  @retval EFI_SUCCESS           The streams were freed.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_DEVICE_ERROR      The Configure Endpoint command failed.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *ROCKCHIP_USB_STREAM_FREE)(
+  IN ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN UINT8                         DeviceAddress,
+  IN UINT8                         *EndpointAddresses,
+  IN UINTN                         NumberOfEndpoints
+  );
+
+/**
+  Queue a bulk transfer without waiting for it to complete.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  DeviceAddress         The logical device address.
+  @param  EndpointAddress       The bulk endpoint address, direction in bit 7.
+  @param  StreamId              The stream to queue the transfer on, or 0 for
+                                an endpoint without streams.
+  @param  Data                  The data buffer. It must stay valid until the
+                                transfer is completed or cancelled.
+  @param  DataLength            The size, in bytes, of the data buffer.
+  @param  Transfer              Returns the handle of the queued transfer.
+
+  @retval EFI_SUCCESS           The transfer was queued.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_OUT_OF_RESOURCES  The transfer could not be queued.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *ROCKCHIP_USB_STREAM_SUBMIT)(
+  IN  ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN  UINT8                         DeviceAddress,
+  IN  UINT8                         EndpointAddress,
+  IN  UINT16                        StreamId,
+  IN  VOID                          *Data,
+  IN  UINTN                         DataLength,
+  OUT VOID                          **Transfer
+  );
+
+/**
+  Check a queued transfer. Once the transfer has completed its resources are
+  released and the handle must not be used again.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  Transfer              The handle returned by Submit.
+  @param  DataLength            Returns the number of bytes transferred.
+  @param  TransferResult        Returns the EFI_USB_ERR_* result bits.
+
+  @retval EFI_NOT_READY         The transfer is still pending.
+  @retval EFI_SUCCESS           The transfer completed successfully.
+  @retval EFI_DEVICE_ERROR      The transfer completed with an error.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *ROCKCHIP_USB_STREAM_POLL)(
+  IN  ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN  VOID                          *Transfer,
+  OUT UINTN                         *DataLength,
+  OUT UINT32                        *TransferResult
+  );
+
+/**
+  Remove a pending transfer from its ring and release it.
+
+  @param  This                  The ROCKCHIP_USB_STREAM_PROTOCOL instance.
+  @param  Transfer              The handle returned by Submit.
+
+  @retval EFI_SUCCESS           The transfer was cancelled.
+  @retval EFI_INVALID_PARAMETER Transfer is invalid.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *ROCKCHIP_USB_STREAM_CANCEL)(
+  IN ROCKCHIP_USB_STREAM_PROTOCOL  *This,
+  IN VOID                          *Transfer
+  );
+
+struct _ROCKCHIP_USB_STREAM_PROTOCOL {
+  ROCKCHIP_USB_STREAM_GET_DEVICE    GetDevice;
+  ROCKCHIP_USB_STREAM_ALLOCATE      AllocateStreams;
+  ROCKCHIP_USB_STREAM_FREE          FreeStreams;
+  ROCKCHIP_USB_STREAM_SUBMIT        Submit;
+  ROCKCHIP_USB_STREAM_POLL          Poll;
+  ROCKCHIP_USB_STREAM_CANCEL        Cancel;
+};
+
+extern EFI_GUID gRockchipUsbStreamProtocolGuid;
+
+#endif
@@ -0,0 +1,501 @@
+/** @file
+
+  Streaming DMA mappings for the Rockchip storage and USB drivers.
+
+  NonCoherentDmaLib cleans and invalidates the whole buffer on every map,
+  looks up its memory attributes in the GCD every time, and bounces an
+  unaligned buffer the device writes through pages it allocates and
+  remaps uncached for that one transfer. Here:
+
+  - a buffer the device reads is only cleaned, a buffer it writes is
+    cleaned and invalidated when mapped and invalidated when unmapped,
+    over the exact range of the buffer;
+  - uncached buffers get no cache maintenance at all;
+  - the cacheable GCD regions last seen are remembered, repeated buffers
+    (the same few BlockIo and URB buffers, in practice) are not looked up
+    again;
+  - unaligned buffers the device writes are bounced through uncached
+    buffers allocated on first use and kept for the life of the module.
+
+  Common buffers, buffers beyond the DMA limit and transfers that do not
+  fit a bounce buffer are passed to DmaLib. The mapping records are kept
+  in a static array, which tells them apart from DmaLib mappings.
+
+  The counters of each module are printed when boot services are exited,
+  and can be read with DmaBufferGetStats().
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Guid/EventGroup.h>
+
+#include <Library/ArmLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/CacheMaintenanceLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DmaBufferLib.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#define DMA_BUFFER_MAP_SIGNATURE    SIGNATURE_32 ('d', 'm', 'b', 'm')
+
+//
+// Transfers in flight at the same time, per module
+//
+#define DMA_BUFFER_MAX_MAPS         32
+
+//
+// Cacheable GCD regions remembered
+//
+#define DMA_BUFFER_MAX_REGIONS      4
+
+#define DMA_BUFFER_BOUNCE_COUNT     FixedPcdGet32 (PcdDmaBounceBufferCount)
+#define DMA_BUFFER_BOUNCE_SIZE      FixedPcdGet32 (PcdDmaBounceBufferSize)
+
+typedef struct {
+  UINT32                    Signature;
+  DMA_MAP_OPERATION         Operation;
+  BOOLEAN                   Cached;
+  VOID                      *HostAddress;
+  UINTN                     NumberOfBytes;
+  //
+  // Index of the bounce buffer, or MAX_UINTN when mapped in place
+  //
+  UINTN                     Bounce;
+} DMA_BUFFER_MAP;
+
+typedef struct {
+  VOID                      *Buffer;
+  PHYSICAL_ADDRESS          DeviceAddress;
+  VOID                      *Mapping;
+  BOOLEAN                   Busy;
+} DMA_BUFFER_BOUNCE;
+
+typedef struct {
+  EFI_PHYSICAL_ADDRESS      Base;
+  UINT64                    Length;
+} DMA_BUFFER_REGION;
+
+STATIC DMA_BUFFER_MAP       mMaps[DMA_BUFFER_MAX_MAPS];
+STATIC DMA_BUFFER_BOUNCE    mBounce[DMA_BUFFER_BOUNCE_COUNT];
+STATIC DMA_BUFFER_REGION    mRegions[DMA_BUFFER_MAX_REGIONS];
+STATIC UINTN                mNextRegion;
+STATIC UINTN                mAlignmentMask;
+STATIC DMA_BUFFER_STATS     mStats;
+STATIC EFI_EVENT            mExitBootServicesEvent;
+
+/**
+  Tell whether a buffer is in cacheable memory.
+
+  Only cacheable regions are remembered: a region remapped uncached since
+  it was looked up gets unneeded but harmless cache maintenance, while the
+  opposite would lose data.
+
+  @param  Address               The start of the buffer.
+  @param  Length                The size of the buffer.
+
+  @retval TRUE                  The buffer needs cache maintenance.
+  @retval FALSE                 The whole buffer is uncached.
+
+**/
+STATIC
+BOOLEAN
+DmaBufferIsCached (
+  IN EFI_PHYSICAL_ADDRESS   Address,
+  IN UINTN                  Length
+  )
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR   Descriptor;
+  EFI_STATUS                        Status;
+  UINTN                             Index;
+
+  for (Index = 0; Index < DMA_BUFFER_MAX_REGIONS; Index++) {
+    if ((mRegions[Index].Length != 0) &&
+        (Address >= mRegions[Index].Base) &&
+        (Address + Length <= mRegions[Index].Base + mRegions[Index].Length)) {
+      mStats.RegionLookupsAvoided++;
+      return TRUE;
+    }
+  }
+
+  Status = gDS->GetMemorySpaceDescriptor (Address, &Descriptor);
+  if (EFI_ERROR (Status) ||
+      (Address + Length > Descriptor.BaseAddress + Descriptor.Length)) {
+    return TRUE;
+  }
+
+  if ((Descriptor.Attributes & (EFI_MEMORY_WB | EFI_MEMORY_WT)) == 0) {
+    return FALSE;
+  }
+
+  mRegions[mNextRegion].Base   = Descriptor.BaseAddress;
+  mRegions[mNextRegion].Length = Descriptor.Length;
+  mNextRegion = (mNextRegion + 1) % DMA_BUFFER_MAX_REGIONS;
+
+  return TRUE;
+}
+
+/**
+  Take a free bounce buffer, allocating it on first use.
+
+  @return The index of the bounce buffer, or MAX_UINTN if none is free.
+
+**/
+STATIC
+UINTN
+DmaBufferGetBounce (
+  VOID
+  )
+{
+  DMA_BUFFER_BOUNCE         *Bounce;
+  EFI_STATUS                Status;
+  UINTN                     Bytes;
+  UINTN                     Index;
+
+  for (Index = 0; Index < DMA_BUFFER_BOUNCE_COUNT; Index++) {
+    Bounce = &mBounce[Index];
+    if (Bounce->Busy) {
+      continue;
+    }
+
+    if (Bounce->Buffer == NULL) {
+      Status = DmaAllocateBuffer (
+                 EfiBootServicesData,
+                 EFI_SIZE_TO_PAGES (DMA_BUFFER_BOUNCE_SIZE),
+                 &Bounce->Buffer
+                 );
+      if (EFI_ERROR (Status)) {
+        Bounce->Buffer = NULL;
+        return MAX_UINTN;
+      }
+
+      Bytes  = DMA_BUFFER_BOUNCE_SIZE;
+      Status = DmaMap (
+                 MapOperationBusMasterCommonBuffer,
+                 Bounce->Buffer,
+                 &Bytes,
+                 &Bounce->DeviceAddress,
+                 &Bounce->Mapping
+                 );
+      if (EFI_ERROR (Status) || (Bytes != DMA_BUFFER_BOUNCE_SIZE)) {
+        DmaFreeBuffer (EFI_SIZE_TO_PAGES (DMA_BUFFER_BOUNCE_SIZE), Bounce->Buffer);
+        Bounce->Buffer = NULL;
+        return MAX_UINTN;
+      }
+    }
+
+    Bounce->Busy = TRUE;
+    return Index;
+  }
+
+  return MAX_UINTN;
+}
+
+/**
+  Map a buffer for a bus master transfer.
+
+  @param  Operation             The kind of transfer.
+  @param  HostAddress           The buffer.
+  @param  NumberOfBytes         On input the size of the buffer, on output
+                                the size that was mapped.
+  @param  DeviceAddress         The address the device uses.
+  @param  Mapping               Passed to DmaBufferUnmap() when the
+                                transfer is done.
+
+  @retval EFI_SUCCESS           The buffer is mapped.
+  @return Others                See DmaMap().
+
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferMap (
+  IN     DMA_MAP_OPERATION      Operation,
+  IN     VOID                   *HostAddress,
+  IN OUT UINTN                  *NumberOfBytes,
+  OUT    PHYSICAL_ADDRESS       *DeviceAddress,
+  OUT    VOID                   **Mapping
+  )
+{
+  DMA_BUFFER_MAP            *Map;
+  EFI_PHYSICAL_ADDRESS      Address;
+  EFI_TPL                   OldTpl;
+  UINTN                     Length;
+  UINTN                     Index;
+  BOOLEAN                   Aligned;
+
+  if ((HostAddress == NULL) || (NumberOfBytes == NULL) ||
+      (DeviceAddress == NULL) || (Mapping == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (mAlignmentMask == 0) {
+    mAlignmentMask = ArmCacheWritebackGranule () - 1;
+  }
+
+  Address = (EFI_PHYSICAL_ADDRESS) (UINTN) HostAddress;
+  Length  = *NumberOfBytes;
+  Aligned = ((Address & mAlignmentMask) == 0) && ((Length & mAlignmentMask) == 0);
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  mStats.Maps++;
+
+  Map = NULL;
+  if ((Operation == MapOperationBusMasterRead) ||
+      (Operation == MapOperationBusMasterWrite)) {
+    if ((Length != 0) &&
+        (Address + PcdGet64 (PcdDmaDeviceOffset) + Length - 1 <= PcdGet64 (PcdDmaDeviceLimit))) {
+      for (Index = 0; Index < DMA_BUFFER_MAX_MAPS; Index++) {
+        if (mMaps[Index].Signature == 0) {
+          Map = &mMaps[Index];
+          break;
+        }
+      }
+    }
+  }
+
+  if (Map != NULL) {
+    Map->Cached = DmaBufferIsCached (Address, Length);
+    Map->Bounce = MAX_UINTN;
+
+    if (Map->Cached && (Operation == MapOperationBusMasterWrite) && !Aligned) {
+      //
+      // Cleaning or invalidating the lines shared with neighbouring data
+      // would corrupt either, the device writes to a bounce buffer instead
+      //
+      if (Length <= DMA_BUFFER_BOUNCE_SIZE) {
+        Map->Bounce = DmaBufferGetBounce ();
+      }
+
+      if (Map->Bounce == MAX_UINTN) {
+        Map = NULL;
+      }
+    }
+  }
+
+  if (Map == NULL) {
+    mStats.FallbackMaps++;
+    gBS->RestoreTPL (OldTpl);
+    return DmaMap (Operation, HostAddress, NumberOfBytes, DeviceAddress, Mapping);
+  }
+
+  Map->Signature     = DMA_BUFFER_MAP_SIGNATURE;
+  Map->Operation     = Operation;
+  Map->HostAddress   = HostAddress;
+  Map->NumberOfBytes = Length;
+
+  if (Map->Bounce != MAX_UINTN) {
+    mStats.BouncedMaps++;
+    mStats.BounceAllocsAvoided++;
+    *DeviceAddress = mBounce[Map->Bounce].DeviceAddress;
+  } else {
+    *DeviceAddress = Address + PcdGet64 (PcdDmaDeviceOffset);
+    if (!Map->Cached) {
+      mStats.UncachedMaps++;
+      mStats.MaintenanceBytesAvoided += Length;
+    } else {
+      mStats.DirectMaps++;
+      if (Operation == MapOperationBusMasterRead) {
+        mStats.MaintenanceBytesAvoided += Length;
+      }
+    }
+  }
+
+  gBS->RestoreTPL (OldTpl);
+
+  if (Map->Cached && (Map->Bounce == MAX_UINTN)) {
+    if (Operation == MapOperationBusMasterRead) {
+      WriteBackDataCacheRange (HostAddress, Length);
+    } else {
+      WriteBackInvalidateDataCacheRange (HostAddress, Length);
+    }
+  }
+
+  *Mapping = Map;
+  return EFI_SUCCESS;
+}
+
+/**
+  Complete a transfer mapped with DmaBufferMap().
+
+  @param  Mapping               The mapping returned by DmaBufferMap().
+
+  @retval EFI_SUCCESS           The mapping is released.
+  @retval EFI_INVALID_PARAMETER Mapping is not a mapping.
+
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferUnmap (
+  IN VOID                       *Mapping
+  )
+{
+  DMA_BUFFER_MAP            *Map;
+  EFI_TPL                   OldTpl;
+
+  if (Mapping == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (((UINTN) Mapping < (UINTN) &mMaps[0]) ||
+      ((UINTN) Mapping >= (UINTN) &mMaps[DMA_BUFFER_MAX_MAPS])) {
+    return DmaUnmap (Mapping);
+  }
+
+  Map = (DMA_BUFFER_MAP *) Mapping;
+  if (Map->Signature != DMA_BUFFER_MAP_SIGNATURE) {
+    ASSERT (FALSE);
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Map->Bounce != MAX_UINTN) {
+    if (Map->Operation == MapOperationBusMasterWrite) {
+      CopyMem (Map->HostAddress, mBounce[Map->Bounce].Buffer, Map->NumberOfBytes);
+    }
+  } else if (Map->Cached && (Map->Operation == MapOperationBusMasterWrite)) {
+    //
+    // Drop the lines speculatively loaded while the device was writing
+    //
+    InvalidateDataCacheRange (Map->HostAddress, Map->NumberOfBytes);
+  }
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  if (Map->Bounce != MAX_UINTN) {
+    mStats.CopyBytes += Map->NumberOfBytes;
+    mBounce[Map->Bounce].Busy = FALSE;
+  }
+  Map->Signature = 0;
+  gBS->RestoreTPL (OldTpl);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Read the counters of the calling module.
+
+  @param  Stats                 Receives the counters.
+
+**/
+VOID
+EFIAPI
+DmaBufferGetStats (
+  OUT DMA_BUFFER_STATS          *Stats
+  )
+{
+  EFI_TPL                   OldTpl;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  CopyMem (Stats, &mStats, sizeof (DMA_BUFFER_STATS));
+  gBS->RestoreTPL (OldTpl);
+}
+
+/**
+  Print the counters of the module when boot services are exited.
+
+  @param  Event                 The ExitBootServices event.
+  @param  Context               Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+DmaBufferExitBootServices (
+  IN EFI_EVENT                  Event,
+  IN VOID                       *Context
+  )
+{
+  if (mStats.Maps == 0) {
+    return;
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: %ld maps, %ld direct, %ld uncached, %ld bounced, %ld passed to DmaLib\n",
+    gEfiCallerBaseName,
+    mStats.Maps,
+    mStats.DirectMaps,
+    mStats.UncachedMaps,
+    mStats.BouncedMaps,
+    mStats.FallbackMaps
+    ));
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: %ld bounce allocations and %ld bytes of cache maintenance avoided, "
+    "%ld bytes copied, %ld GCD lookups avoided\n",
+    gEfiCallerBaseName,
+    mStats.BounceAllocsAvoided,
+    mStats.MaintenanceBytesAvoided,
+    mStats.CopyBytes,
+    mStats.RegionLookupsAvoided
+    ));
+}
+
+/**
+  Register the printing of the counters.
+
+  @param  ImageHandle           The image handle of the module.
+  @param  SystemTable           The system table.
+
+  @retval EFI_SUCCESS           Always, the counters are not essential.
+
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferLibConstructor (
+  IN EFI_HANDLE                 ImageHandle,
+  IN EFI_SYSTEM_TABLE           *SystemTable
+  )
+{
+  EFI_STATUS                Status;
+
+  Status = gBS->CreateEventEx (
+                  EVT_NOTIFY_SIGNAL,
+                  TPL_CALLBACK,
+                  DmaBufferExitBootServices,
+                  NULL,
+                  &gEfiEventExitBootServicesGuid,
+                  &mExitBootServicesEvent
+                  );
+  if (EFI_ERROR (Status)) {
+    mExitBootServicesEvent = NULL;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Release the event and the bounce buffers when the module is unloaded.
+
+  @param  ImageHandle           The image handle of the module.
+  @param  SystemTable           The system table.
+
+  @retval EFI_SUCCESS           Always.
+
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferLibDestructor (
+  IN EFI_HANDLE                 ImageHandle,
+  IN EFI_SYSTEM_TABLE           *SystemTable
+  )
+{
+  UINTN                     Index;
+
+  if (mExitBootServicesEvent != NULL) {
+    gBS->CloseEvent (mExitBootServicesEvent);
+  }
+
+  for (Index = 0; Index < DMA_BUFFER_BOUNCE_COUNT; Index++) {
+    if (mBounce[Index].Buffer != NULL) {
+      DmaUnmap (mBounce[Index].Mapping);
+      DmaFreeBuffer (EFI_SIZE_TO_PAGES (DMA_BUFFER_BOUNCE_SIZE), mBounce[Index].Buffer);
+      mBounce[Index].Buffer = NULL;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
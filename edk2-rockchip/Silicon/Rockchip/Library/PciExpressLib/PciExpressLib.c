@@ -8,7 +8,8 @@
   Copyright (c) 2022, Rockchip Corporation. All rights reserved.<BR>
 
   On the Rockchisp SoCs, ECAM is not usable, so we have to rewrite the whole
-  library. 
+  library. The ECAM-like view given to the OS (PcdPcieEcamCompliantSegmentsMask)
+  is only set up at ExitBootServices, and does not cover the root port.
 
   SPDX-License-Identifier: BSD-2-Clause-Patent
 
@@ -22,10 +23,10 @@
 #include <Library/IoLib.h>
 #include <Library/DebugLib.h>
 #include <Library/PcdLib.h>
+#include <Library/PcieProfileLib.h>
 #include <Library/TimerLib.h>
 
-/* We are not ECAM compatible, so single bus multiple dev is a bit problem */
-#define DROP_DEV1 1
+#include <RK3588Pcie.h>
 
 /**
   Assert the validity of a PCI address. A valid PCI address should contain 1's
@@ -69,7 +70,7 @@
    Value returned for reads on configuration space of unimplemented
    device functions.
 **/
-//STATIC UINTN mDummyConfigData = 0xFFFFFFFF;
+STATIC UINT32 mDummyConfigData = 0xFFFFFFFF;
 
 /**
   Registers a PCI device so PCI configuration registers may be accessed after
@@ -145,85 +146,154 @@ PciExpressRegisterForRuntimeAccess (
 #define upper_32_bits(n) ((UINT32)(((n) >> 16) >> 16))
 #define lower_32_bits(n) ((UINT32)(n))
 
-STATIC VOID rk_pcie_writel_ob_unroll(UINT32 index,
+/* Client registers, offset from apb_base */
+#define PCIE_CLIENT_LTSSM_STATUS	0x300
+#define SMLH_LINKUP			(0x1 << 16)
+#define RDLH_LINKUP			(0x1 << 17)
+
+STATIC VOID rk_pcie_writel_ob_unroll(UINT32 seg, UINT32 index,
 				     UINT32 reg, UINT32 val)
 {
 	UINT32 offset = PCIE_GET_ATU_OUTB_UNR_REG_OFFSET(index);
-	UINTN base = PcdGet64 (PcdPcieRootPort3x4DbiBaseAddress);
 
-	MmioWrite32(base + offset + reg, val);
+	MmioWrite32(PCIE_DBI_BASE(seg) + offset + reg, val);
 }
 
-STATIC UINT32 rk_pcie_readl_ob_unroll(UINT32 index, UINT32 reg)
+STATIC UINT32 rk_pcie_readl_ob_unroll(UINT32 seg, UINT32 index, UINT32 reg)
 {
 	UINT32 offset = PCIE_GET_ATU_OUTB_UNR_REG_OFFSET(index);
-	UINTN base = PcdGet64 (PcdPcieRootPort3x4DbiBaseAddress);
 
-	return MmioRead32(base + offset + reg);
+	return MmioRead32(PCIE_DBI_BASE(seg) + offset + reg);
 }
 
-STATIC VOID rk_pcie_prog_outbound_atu_unroll(
+STATIC VOID rk_pcie_prog_outbound_atu_unroll(UINT32 seg,
 UINT32 index, UINT32 type, UINT64 cpu_addr, UINT64 pci_addr, UINT32 size)
 {
 	UINT32 retries, val;
 
-	DEBUG((EFI_D_INFO, "%s: ATU programmed with: index: %d, type: %d, cpu addr: %8llx, pci addr: %8llx, size: %8x\n",
-			__func__, index, type, cpu_addr, pci_addr, size));
+	PCIE_PROFILE_ATU_PROGRAM(seg);
 
- 	rk_pcie_writel_ob_unroll(index, PCIE_ATU_UNR_LOWER_BASE, lower_32_bits(cpu_addr));
-	rk_pcie_writel_ob_unroll(index, PCIE_ATU_UNR_UPPER_BASE, upper_32_bits(cpu_addr));
-	rk_pcie_writel_ob_unroll(index, PCIE_ATU_UNR_LIMIT, lower_32_bits(cpu_addr + size - 1));
-	rk_pcie_writel_ob_unroll(index, PCIE_ATU_UNR_LOWER_TARGET, lower_32_bits(pci_addr));
-	rk_pcie_writel_ob_unroll(index, PCIE_ATU_UNR_UPPER_TARGET, upper_32_bits(pci_addr));
-	rk_pcie_writel_ob_unroll(index, PCIE_ATU_UNR_REGION_CTRL1, type);
-	rk_pcie_writel_ob_unroll(index, PCIE_ATU_UNR_REGION_CTRL2, PCIE_ATU_ENABLE);
+ 	rk_pcie_writel_ob_unroll(seg, index, PCIE_ATU_UNR_LOWER_BASE, lower_32_bits(cpu_addr));
+	rk_pcie_writel_ob_unroll(seg, index, PCIE_ATU_UNR_UPPER_BASE, upper_32_bits(cpu_addr));
+	rk_pcie_writel_ob_unroll(seg, index, PCIE_ATU_UNR_LIMIT, lower_32_bits(cpu_addr + size - 1));
+	rk_pcie_writel_ob_unroll(seg, index, PCIE_ATU_UNR_LOWER_TARGET, lower_32_bits(pci_addr));
+	rk_pcie_writel_ob_unroll(seg, index, PCIE_ATU_UNR_UPPER_TARGET, upper_32_bits(pci_addr));
+	rk_pcie_writel_ob_unroll(seg, index, PCIE_ATU_UNR_REGION_CTRL1, type);
+	rk_pcie_writel_ob_unroll(seg, index, PCIE_ATU_UNR_REGION_CTRL2, PCIE_ATU_ENABLE);
 
 	/*
 	 * Make sure ATU enable takes effect before any subsequent config
 	 * and I/O accesses.
 	 */
 	 for (retries = 0; retries < LINK_WAIT_MAX_IATU_RETRIES; retries++) {
-		val = rk_pcie_readl_ob_unroll(index, PCIE_ATU_UNR_REGION_CTRL2);
+		val = rk_pcie_readl_ob_unroll(seg, index, PCIE_ATU_UNR_REGION_CTRL2);
 		if (val & PCIE_ATU_ENABLE)
 			return;
 
 		MicroSecondDelay(LINK_WAIT_IATU * 100);
 	}
 
-	DEBUG((DEBUG_ERROR, "outbound iATU is not being enabled\n"));
+	DEBUG((DEBUG_ERROR, "PCIe%d: outbound iATU %d is not being enabled\n", seg, index));
+}
+
+/*
+ * Per root complex state. The MEM, IO and MEM64 windows never change, so
+ * they are programmed on the first config access only. The CFG window
+ * follows the target bus/dev/func and is reprogrammed when that changes.
+ *
+ * Every module linking this library has its own copy of this state, so a
+ * cached CFG target is checked against the one read back from the iATU
+ * before being trusted: another module may have moved the window since.
+ */
+struct rk_pcie_rc {
+	BOOLEAN windows_programmed;
+	BOOLEAN cfg_valid;
+	UINT32 cfg_target;
+};
+
+STATIC struct rk_pcie_rc mRootComplex[PCIE_SEGMENT_COUNT];
+
+STATIC VOID rk_pcie_prog_static_windows(UINT32 seg)
+{
+	DEBUG((DEBUG_INFO, "PCIe%d: MEM %lx+%x, IO %lx+%x, MEM64 %lx+%lx\n", seg,
+		(UINT64)PCIE_MEM_BASE(seg), PCIE_MEM_SIZE,
+		(UINT64)PCIE_IO_BASE(seg), PCIE_IO_SIZE,
+		(UINT64)PCIE_MEM64_BASE(seg), (UINT64)PCIE_MEM64_SIZE(seg)));
+
+	rk_pcie_prog_outbound_atu_unroll(seg, PCIE_ATU_REGION_INDEX0, PCIE_ATU_TYPE_MEM,
+		PCIE_MEM_BASE(seg), PCIE_MEM_BASE(seg), PCIE_MEM_SIZE);
+	rk_pcie_prog_outbound_atu_unroll(seg, PCIE_ATU_REGION_INDEX2, PCIE_ATU_TYPE_IO,
+		PCIE_IO_BASE(seg), 0x0, PCIE_IO_SIZE);
+	rk_pcie_prog_outbound_atu_unroll(seg, PCIE_ATU_REGION_INDEX3, PCIE_ATU_TYPE_MEM,
+		PCIE_MEM64_BASE(seg), PCIE_MEM64_BASE(seg), (UINT32)PCIE_MEM64_SIZE(seg));
+
+	mRootComplex[seg].windows_programmed = TRUE;
+}
+
+STATIC BOOLEAN rk_pcie_link_up(UINT32 seg)
+{
+	UINT32 val;
+
+	val = MmioRead32(PCIE_APB_BASE(seg) + PCIE_CLIENT_LTSSM_STATUS);
+
+	return (val & (RDLH_LINKUP | SMLH_LINKUP)) == (RDLH_LINKUP | SMLH_LINKUP);
 }
 
-STATIC UINTN set_cfg_address(UINTN Address)
+/*
+ * Translate a config address into the CPU address to access, and count the
+ * access (PcdPcieProfileEnable). The segment is found from the bus number,
+ * see RK3588Pcie.h. Functions that cannot exist
+ * get the address of mDummyConfigData, which reads as all ones:
+ *  - anything on a disabled root complex or past the last one
+ *  - devices other than 0 on the root bus: the DBI would alias the root port
+ *  - devices other than 0 below the root port: the link partner ignores the
+ *    device number of type 0 requests and would answer for all of them
+ *  - anything below the root port while the link is down
+ */
+STATIC UINTN set_cfg_address(UINTN Address, UINTN access)
 {
  	UINT8 bus, dev, func;
- 	UINT32 reg;
- 	UINTN va_address, d;
- 	UINT32 atu_type;
+ 	UINT32 reg, seg;
+ 	UINTN va_address;
+ 	UINT32 atu_type, target;
+ 	struct rk_pcie_rc *rc;
 
  	bus = GET_BUS_NUM (Address);
  	dev = GET_DEV_NUM(Address);
  	func =  GET_FUNC_NUM (Address);
  	reg = GET_REG_NUM(Address);
 
-	DEBUG((EFI_D_INFO, "set_cfg_address: bus %d, dev %d, func %d, reg 0x%x\n", bus, dev, func, reg));
-	
-	rk_pcie_prog_outbound_atu_unroll(PCIE_ATU_REGION_INDEX0, PCIE_ATU_TYPE_MEM,
-		PcdGet32(PcdPcieRootPort3x4MemBaseAddress), PcdGet32(PcdPcieRootPort3x4MemBaseAddress), PcdGet32(PcdPcieRootPort3x4MemSize));
-	
-			//rk_pcie_prog_outbound_atu_unroll(PCIE_ATU_REGION_INDEX0, PCIE_ATU_TYPE_MEM, 0xf0200000,0xf0210000, 0x4000);
-	       	//rk_pcie_prog_outbound_atu_unroll(PCIE_ATU_REGION_INDEX2, PCIE_ATU_TYPE_MEM, 0xf0200000,0xf0200000, 0x100000);
-	rk_pcie_prog_outbound_atu_unroll(PCIE_ATU_REGION_INDEX2, PCIE_ATU_TYPE_IO,
-		PcdGet32(PcdPcieRootPort3x4IoBaseAddress), 0x0, PcdGet32(PcdPcieRootPort3x4IoSize));
-	rk_pcie_prog_outbound_atu_unroll(PCIE_ATU_REGION_INDEX3, PCIE_ATU_TYPE_MEM,
-		PcdGet64(PcdPcieRootPort3x4MemBaseAddress64), PcdGet64(PcdPcieRootPort3x4MemBaseAddress64), PcdGet64(PcdPcieRootPort3x4MemSize64));
+	seg = PCIE_SEGMENT_FROM_BUS(bus);
+	PCIE_PROFILE_CONFIG_ACCESS(seg, bus, dev, func, access);
+	if (seg >= PCIE_SEGMENT_COUNT ||
+	    (FixedPcdGet32(PcdPcieRootBridgeMask) & (1 << seg)) == 0)
+		goto no_device;
+
+	rc = &mRootComplex[seg];
+	if (!rc->windows_programmed)
+		rk_pcie_prog_static_windows(seg);
 
 	/* Use dbi_base for own configuration read and write */
-	if (!bus) {
-		va_address = PcdGet64 (PcdPcieRootPort3x4DbiBaseAddress);
+	if (bus == PCIE_BUS_BASE(seg)) {
+		if (dev)
+			goto no_device;
+		va_address = PCIE_DBI_BASE(seg);
 		goto out;
 	}
- 
-	if (bus == 1)
+
+	if (bus == PCIE_BUS_BASE(seg) + 1 && dev)
+		goto no_device;
+
+	va_address = PCIE_CFG_BASE(seg);
+	target = (bus << 16 | dev << 8 | func) << 8;
+	if (rc->cfg_valid && target == rc->cfg_target &&
+	    rk_pcie_readl_ob_unroll(seg, PCIE_ATU_REGION_INDEX1, PCIE_ATU_UNR_LOWER_TARGET) == target)
+		goto out;
+
+	if (!rk_pcie_link_up(seg))
+		goto no_device;
+
+	if (bus == PCIE_BUS_BASE(seg) + 1)
 		/*
 		 * For local bus whose primary bus number is root bridge,
 		 * change TLP Type field to 4.
@@ -233,14 +303,19 @@ STATIC UINTN set_cfg_address(UINTN Address)
 		/* Otherwise, change TLP Type field to 5. */
 		atu_type = PCIE_ATU_TYPE_CFG1;
 
-	d = bus << 16 | dev << 8 | func;
-	va_address = PcdGet64 (PcdPcieRootPort3x4CfgBaseAddress);
-	rk_pcie_prog_outbound_atu_unroll(PCIE_ATU_REGION_INDEX1, atu_type, va_address, d << 8, 0x100000);
+	rk_pcie_prog_outbound_atu_unroll(seg, PCIE_ATU_REGION_INDEX1, atu_type, va_address, target, PCIE_CFG_SIZE);
+	rc->cfg_target = target;
+	rc->cfg_valid = TRUE;
 
 out:
 	va_address += reg ;
   
 	return va_address;
+
+no_device:
+	/* Writes may have landed here, so restore the all ones */
+	mDummyConfigData = 0xFFFFFFFF;
+	return (UINTN)&mDummyConfigData + (reg & 0x3);
 }
 
 /**
@@ -267,11 +342,7 @@ PciExpressRead8 (
   UINT8 val;
   ASSERT_INVALID_PCI_ADDRESS (Address);
 
-  #if DROP_DEV1
-  if (GET_BUS_NUM(Address) ==0 && GET_DEV_NUM(Address) >= 1)
-  	return 0xff;
-  #endif
-  val = MmioRead8(set_cfg_address(Address));
+  val = MmioRead8(set_cfg_address(Address, PCIE_PROFILE_READ));
 
   return val;
 }
@@ -300,11 +371,7 @@ PciExpressWrite8 (
   IN      UINT8                     Value
   )
 {
-  #if DROP_DEV1
-  if (GET_BUS_NUM(Address) ==0 && GET_DEV_NUM(Address) >= 1)
-  	return Value;
-  #endif
-  return MmioWrite8(set_cfg_address(Address), Value);
+  return MmioWrite8(set_cfg_address(Address, PCIE_PROFILE_WRITE), Value);
 }
 
 /**
@@ -335,11 +402,7 @@ PciExpressOr8 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-  #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
-  return MmioOr8((UINTN)set_cfg_address (Address), OrData);
+  return MmioOr8((UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY), OrData);
 }
 
 /**
@@ -370,11 +433,7 @@ PciExpressAnd8 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
-  return MmioAnd8 ((UINTN)set_cfg_address(Address), AndData);
+  return MmioAnd8 ((UINTN)set_cfg_address(Address, PCIE_PROFILE_MODIFY), AndData);
 }
 
 /**
@@ -408,12 +467,8 @@ PciExpressAndThenOr8 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioAndThenOr8 (
-           (UINTN)set_cfg_address(Address),
+           (UINTN)set_cfg_address(Address, PCIE_PROFILE_MODIFY),
            AndData,
            OrData
            );
@@ -449,12 +504,8 @@ PciExpressBitFieldRead8 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldRead8 (
-           (UINTN)set_cfg_address(Address),
+           (UINTN)set_cfg_address(Address, PCIE_PROFILE_READ),
            StartBit,
            EndBit
            );
@@ -494,12 +545,8 @@ PciExpressBitFieldWrite8 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldWrite8 (
-           (UINTN)set_cfg_address(Address),
+           (UINTN)set_cfg_address(Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            Value
@@ -543,12 +590,8 @@ PciExpressBitFieldOr8 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldOr8 (
-           (UINTN)set_cfg_address(Address),
+           (UINTN)set_cfg_address(Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            OrData
@@ -592,12 +635,8 @@ PciExpressBitFieldAnd8 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldAnd8 (
-           (UINTN)set_cfg_address(Address),
+           (UINTN)set_cfg_address(Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            AndData
@@ -646,12 +685,8 @@ PciExpressBitFieldAndThenOr8 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldAndThenOr8 (
-           (UINTN)set_cfg_address(Address),
+           (UINTN)set_cfg_address(Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            AndData,
@@ -683,12 +718,7 @@ PciExpressRead16 (
 {
   UINT16 val;
   ASSERT_INVALID_PCI_ADDRESS (Address);
-  #if DROP_DEV1
-  if (GET_BUS_NUM(Address) ==0 && GET_DEV_NUM(Address) >= 1)
-  	return 0xffff;
-
-  #endif
-  val = MmioRead16 ((UINTN)set_cfg_address(Address));
+  val = MmioRead16 ((UINTN)set_cfg_address(Address, PCIE_PROFILE_READ));
 
   return val;
 }
@@ -718,11 +748,7 @@ PciExpressWrite16 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-  #if DROP_DEV1
-  if (GET_BUS_NUM(Address) ==0 && GET_DEV_NUM(Address) >= 1)
-  	return Value;
-  #endif
-  return MmioWrite16 ((UINTN)set_cfg_address (Address), Value);
+  return MmioWrite16 ((UINTN)set_cfg_address (Address, PCIE_PROFILE_WRITE), Value);
 }
 
 /**
@@ -754,11 +780,7 @@ PciExpressOr16 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
-  return MmioOr16 ((UINTN)set_cfg_address (Address), OrData);
+  return MmioOr16 ((UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY), OrData);
 }
 
 /**
@@ -790,11 +812,7 @@ PciExpressAnd16 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
-  return MmioAnd16 ((UINTN)set_cfg_address (Address), AndData);
+  return MmioAnd16 ((UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY), AndData);
 }
 
 /**
@@ -829,12 +847,8 @@ PciExpressAndThenOr16 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioAndThenOr16 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY),
            AndData,
            OrData
            );
@@ -871,12 +885,8 @@ PciExpressBitFieldRead16 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldRead16 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_READ),
            StartBit,
            EndBit
            );
@@ -917,12 +927,8 @@ PciExpressBitFieldWrite16 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldWrite16 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            Value
@@ -967,12 +973,8 @@ PciExpressBitFieldOr16 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldOr16 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            OrData
@@ -1017,12 +1019,8 @@ PciExpressBitFieldAnd16 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldAnd16 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            AndData
@@ -1072,12 +1070,8 @@ PciExpressBitFieldAndThenOr16 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldAndThenOr16 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            AndData,
@@ -1109,11 +1103,7 @@ PciExpressRead32 (
 {
   UINT32 val;
   ASSERT_INVALID_PCI_ADDRESS (Address);
-  #if DROP_DEV1
-    if (GET_BUS_NUM(Address) ==0 && GET_DEV_NUM(Address) >= 1)
-  		return 0xffffffff;	
-  #endif
-  val = MmioRead32 ((UINTN)set_cfg_address (Address));
+  val = MmioRead32 ((UINTN)set_cfg_address (Address, PCIE_PROFILE_READ));
   return val;
 
 }
@@ -1144,12 +1134,7 @@ PciExpressWrite32 (
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
 
-  #if DROP_DEV1
-      if (GET_BUS_NUM(Address) ==0 && GET_DEV_NUM(Address) >= 1)
-  		return Value;
-
-  #endif
-  return MmioWrite32 ((UINTN)set_cfg_address (Address), Value);
+  return MmioWrite32 ((UINTN)set_cfg_address (Address, PCIE_PROFILE_WRITE), Value);
 }
 
 /**
@@ -1181,11 +1166,7 @@ PciExpressOr32 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
-  return MmioOr32 ((UINTN)set_cfg_address (Address), OrData);
+  return MmioOr32 ((UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY), OrData);
 }
 
 /**
@@ -1217,11 +1198,7 @@ PciExpressAnd32 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
-  return MmioAnd32 ((UINTN)set_cfg_address (Address), AndData);
+  return MmioAnd32 ((UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY), AndData);
 }
 
 /**
@@ -1256,12 +1233,8 @@ PciExpressAndThenOr32 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioAndThenOr32 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY),
            AndData,
            OrData
            );
@@ -1298,12 +1271,8 @@ PciExpressBitFieldRead32 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldRead32 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_READ),
            StartBit,
            EndBit
            );
@@ -1344,12 +1313,8 @@ PciExpressBitFieldWrite32 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldWrite32 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            Value
@@ -1394,12 +1359,8 @@ PciExpressBitFieldOr32 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldOr32 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            OrData
@@ -1444,12 +1405,8 @@ PciExpressBitFieldAnd32 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldAnd32 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            AndData
@@ -1499,12 +1456,8 @@ PciExpressBitFieldAndThenOr32 (
   )
 {
   ASSERT_INVALID_PCI_ADDRESS (Address);
-    #if DROP_DEV1
-  if (GET_DEV_NUM(Address) >= 1)
-  	 ASSERT(1);
-  #endif
   return MmioBitFieldAndThenOr32 (
-           (UINTN)set_cfg_address (Address),
+           (UINTN)set_cfg_address (Address, PCIE_PROFILE_MODIFY),
            StartBit,
            EndBit,
            AndData,
@@ -1547,9 +1500,6 @@ PciExpressReadBuffer (
 
   ASSERT_INVALID_PCI_ADDRESS (StartAddress);
   //ASSERT (((StartAddress & 0xFFF) + Size) <= 0x1000);
-  if (GET_DEV_NUM(StartAddress) >= 1)
-  return 0xffffffff;
-  ASSERT(1);
 
   if (Size == 0) {
     return Size;
@@ -1650,8 +1600,6 @@ PciExpressWriteBuffer (
 
   ASSERT_INVALID_PCI_ADDRESS (StartAddress);
   //ASSERT (((StartAddress & 0xFFF) + Size) <= 0x1000);
-  if (GET_DEV_NUM(StartAddress) >= 1)
-  	return Size;
 
   if (Size == 0) {
     return 0;
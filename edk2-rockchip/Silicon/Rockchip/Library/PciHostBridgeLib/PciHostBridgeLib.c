@@ -8,6 +8,7 @@
 **/
 
 #include <PiDxe.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/DevicePathLib.h>
 #include <Library/MemoryAllocationLib.h>
@@ -16,6 +17,8 @@
 #include <Protocol/PciHostBridgeResourceAllocation.h>
 #include <Protocol/PciRootBridgeIo.h>
 
+#include <RK3588Pcie.h>
+
 GLOBAL_REMOVE_IF_UNREFERENCED
 STATIC CHAR16 CONST * CONST mPciHostBridgeLibAcpiAddressSpaceTypeStr[] = {
   L"Mem", L"I/O", L"Bus"
@@ -28,77 +31,40 @@ typedef struct {
 } EFI_PCI_ROOT_BRIDGE_DEVICE_PATH;
 #pragma pack ()
 
-STATIC EFI_PCI_ROOT_BRIDGE_DEVICE_PATH mEfiPciRootBridgeDevicePath[] = {
-  // PCIe
+STATIC CONST EFI_PCI_ROOT_BRIDGE_DEVICE_PATH mEfiPciRootBridgeDevicePathTemplate = {
   {
     {
+      ACPI_DEVICE_PATH,
+      ACPI_DP,
       {
-        ACPI_DEVICE_PATH,
-        ACPI_DP,
-        {
-          (UINT8)sizeof (ACPI_HID_DEVICE_PATH),
-          (UINT8)(sizeof (ACPI_HID_DEVICE_PATH) >> 8)
-        }
-      },
-      EISA_PNP_ID (0x0A08), // PCIe
-      0
-    },
-    {
-      END_DEVICE_PATH_TYPE,
-      END_ENTIRE_DEVICE_PATH_SUBTYPE,
-      {
-        END_DEVICE_PATH_LENGTH,
-        0
+        (UINT8)sizeof (ACPI_HID_DEVICE_PATH),
+        (UINT8)(sizeof (ACPI_HID_DEVICE_PATH) >> 8)
       }
-    }
-  }
-};
-
-
-STATIC PCI_ROOT_BRIDGE mPciRootBridge[] = {
+    },
+    EISA_PNP_ID (0x0A08), // PCIe
+    0                     // UID, the segment number
+  },
   {
-    0,                                              // Segment
-    0,                                              // Supports
-    0,                                              // Attributes
-    TRUE,                                           // DmaAbove4G
-    FALSE,                                          // NoExtendedConfigSpace
-    FALSE,                                          // ResourceAssigned
-    EFI_PCI_HOST_BRIDGE_COMBINE_MEM_PMEM |          // AllocationAttributes
-    EFI_PCI_HOST_BRIDGE_MEM64_DECODE,
+    END_DEVICE_PATH_TYPE,
+    END_ENTIRE_DEVICE_PATH_SUBTYPE,
     {
-      // Bus
-      0x0,
-      0xf
-    }, {
-      // Io disable
-      0x0,//FixedPcdGet32 (PcdPcieRootPort3x4IoBaseAddress),
-      0x10000 - 1,//FixedPcdGet32 (PcdPcieRootPort3x4IoBaseAddress) + FixedPcdGet32 (PcdPcieRootPort3x4IoSize) - 1,
-      MAX_UINT64 - 0xffff0000 + 1
-    }, {
-      // Mem
-      FixedPcdGet32 (PcdPcieRootPort3x4MemBaseAddress),
-      FixedPcdGet32 (PcdPcieRootPort3x4MemBaseAddress) + FixedPcdGet32 (PcdPcieRootPort3x4MemSize) - 1
-    }, {
-      // MemAbove4G
-	 FixedPcdGet64 (PcdPcieRootPort3x4MemBaseAddress64),
-	 FixedPcdGet64 (PcdPcieRootPort3x4MemBaseAddress64) + FixedPcdGet64 (PcdPcieRootPort3x4MemSize64) - 1
-
-    }, {
-      // PMem
-      MAX_UINT64,
-      0
-    }, {
-      // PMemAbove4G
-      MAX_UINT64,
+      END_DEVICE_PATH_LENGTH,
       0
-    },
-    (EFI_DEVICE_PATH_PROTOCOL *)&mEfiPciRootBridgeDevicePath[0]
+    }
   }
 };
 
+STATIC EFI_PCI_ROOT_BRIDGE_DEVICE_PATH mEfiPciRootBridgeDevicePath[PCIE_SEGMENT_COUNT];
+
 /**
   Return all the root bridge instances in an array.
 
+  There is one root bridge per root complex enabled in PcdPcieRootBridgeMask,
+  each in its own bus range as laid out in RK3588Pcie.h. They are all in
+  segment 0: BasePciSegmentLibPci asserts on any other segment, and the bus
+  ranges are disjoint anyway. The OS gets one segment per root complex from
+  the ACPI tables.
+
   @param Count  Return the count of root bridge instances.
 
   @return All the root bridge instances in an array.
@@ -111,9 +77,70 @@ PciHostBridgeGetRootBridges (
   UINTN                             *Count
   )
 {
-  *Count = ARRAY_SIZE (mPciRootBridge);
-  DEBUG((DEBUG_ERROR, "PciHostBridgeGetRootBridges\n"));
-  return mPciRootBridge;
+  PCI_ROOT_BRIDGE                   *Bridges;
+  PCI_ROOT_BRIDGE                   *Bridge;
+  UINT32                            Mask;
+  UINT32                            Segment;
+
+  *Count = 0;
+
+  Bridges = AllocateZeroPool (PCIE_SEGMENT_COUNT * sizeof (PCI_ROOT_BRIDGE));
+  if (Bridges == NULL) {
+    DEBUG ((DEBUG_ERROR, "%a: out of memory\n", __FUNCTION__));
+    return NULL;
+  }
+
+  Mask = FixedPcdGet32 (PcdPcieRootBridgeMask);
+  for (Segment = 0; Segment < PCIE_SEGMENT_COUNT; Segment++) {
+    if ((Mask & (1 << Segment)) == 0) {
+      continue;
+    }
+
+    Bridge = &Bridges[*Count];
+    Bridge->Segment               = 0;
+    Bridge->DmaAbove4G            = TRUE;
+    Bridge->NoExtendedConfigSpace = FALSE;
+    Bridge->ResourceAssigned      = FALSE;
+    Bridge->AllocationAttributes  = EFI_PCI_HOST_BRIDGE_MEM64_DECODE;
+
+    Bridge->Bus.Base              = PCIE_BUS_BASE (Segment);
+    Bridge->Bus.Limit             = PCIE_BUS_LIMIT (Segment);
+
+    // Io disable
+    Bridge->Io.Base               = 0x0;
+    Bridge->Io.Limit              = 0x10000 - 1;
+    Bridge->Io.Translation        = MAX_UINT64 - 0xffff0000 + 1;
+
+    //
+    // Everything sits behind the root port, whose non-prefetchable window is
+    // 32-bit only: 64-bit BARs can only go above 4G as prefetchable ones.
+    //
+    Bridge->Mem.Base              = PCIE_MEM_BASE (Segment);
+    Bridge->Mem.Limit             = PCIE_MEM_BASE (Segment) + PCIE_MEM_SIZE - 1;
+    Bridge->MemAbove4G.Base       = MAX_UINT64;
+    Bridge->MemAbove4G.Limit      = 0;
+    Bridge->PMem.Base             = MAX_UINT64;
+    Bridge->PMem.Limit            = 0;
+    Bridge->PMemAbove4G.Base      = PCIE_MEM64_BASE (Segment);
+    Bridge->PMemAbove4G.Limit     = PCIE_MEM64_BASE (Segment) + PCIE_MEM64_SIZE (Segment) - 1;
+
+    CopyMem (&mEfiPciRootBridgeDevicePath[Segment],
+      &mEfiPciRootBridgeDevicePathTemplate,
+      sizeof (EFI_PCI_ROOT_BRIDGE_DEVICE_PATH));
+    mEfiPciRootBridgeDevicePath[Segment].AcpiDevicePath.UID = Segment;
+    Bridge->DevicePath = (EFI_DEVICE_PATH_PROTOCOL *)&mEfiPciRootBridgeDevicePath[Segment];
+
+    DEBUG ((DEBUG_INFO, "PciHostBridge: root complex %d, bus %x-%x\n",
+      Segment, Bridge->Bus.Base, Bridge->Bus.Limit));
+    (*Count)++;
+  }
+
+  if (*Count == 0) {
+    FreePool (Bridges);
+    return NULL;
+  }
+
+  return Bridges;
 }
 
 /**
@@ -129,6 +156,9 @@ PciHostBridgeFreeRootBridges (
   UINTN                             Count
   )
 {
+  if (Bridges != NULL) {
+    FreePool (Bridges);
+  }
 }
 
 /**
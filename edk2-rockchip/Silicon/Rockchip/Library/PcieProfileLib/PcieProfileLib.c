@@ -0,0 +1,320 @@
+/** @file
+
+  Counters for the PCIe configuration accesses and link bring-up.
+
+  Every module linking PciExpressLib has its own copy of this library, but
+  they all count into the single ROCKCHIP_PCIE_PROFILE_PROTOCOL instance:
+  the first one to count something installs it, the others find it.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcieProfileLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+STATIC CONST CHAR8 *mPhaseNames[PcieProfilePhaseMax] = {
+  "Power",
+  "Detect",
+  "Training",
+  "Settle",
+  "Retrain"
+};
+
+STATIC ROCKCHIP_PCIE_PROFILE_PROTOCOL   *mProfile;
+STATIC BOOLEAN                          mExitBootServices;
+
+/**
+  Clear all the counters.
+
+  @param  This                The ROCKCHIP_PCIE_PROFILE_PROTOCOL instance.
+
+**/
+STATIC
+VOID
+EFIAPI
+PcieProfileReset (
+  IN ROCKCHIP_PCIE_PROFILE_PROTOCOL  *This
+  )
+{
+  EFI_TPL                     OldTpl;
+
+  //
+  // Configuration accesses may come from TPL_NOTIFY
+  //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  This->Dropped       = 0;
+  This->FunctionCount = 0;
+  ZeroMem (This->Functions, sizeof (This->Functions));
+  ZeroMem (This->Segments, sizeof (This->Segments));
+
+  gBS->RestoreTPL (OldTpl);
+}
+
+/**
+  Stop counting: the counters are boot services memory.
+
+  @param  Event               The ExitBootServices event.
+  @param  Context             Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+PcieProfileExitBootServices (
+  IN EFI_EVENT                Event,
+  IN VOID                     *Context
+  )
+{
+  mExitBootServices = TRUE;
+  mProfile          = NULL;
+}
+
+/**
+  Find the counters, installing them if no module did yet.
+
+  @return The counters, or NULL if they cannot be used now.
+
+**/
+STATIC
+ROCKCHIP_PCIE_PROFILE_PROTOCOL *
+PcieProfileGet (
+  VOID
+  )
+{
+  ROCKCHIP_PCIE_PROFILE_PROTOCOL  *Profile;
+  EFI_HANDLE                      Handle;
+  EFI_EVENT                       Event;
+  EFI_STATUS                      Status;
+  EFI_TPL                         OldTpl;
+
+  if ((mProfile != NULL) || mExitBootServices) {
+    return mProfile;
+  }
+
+  //
+  // The protocol database cannot be used above TPL_NOTIFY, try again on
+  // the next access
+  //
+  OldTpl = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+  gBS->RestoreTPL (OldTpl);
+  if (OldTpl > TPL_NOTIFY) {
+    return NULL;
+  }
+
+  Status = gBS->LocateProtocol (&gRockchipPcieProfileProtocolGuid, NULL, (VOID **) &Profile);
+  if (EFI_ERROR (Status)) {
+    Profile = AllocateZeroPool (sizeof (ROCKCHIP_PCIE_PROFILE_PROTOCOL));
+    if (Profile == NULL) {
+      return NULL;
+    }
+
+    Profile->Reset = PcieProfileReset;
+
+    Handle = NULL;
+    Status = gBS->InstallProtocolInterface (
+                    &Handle,
+                    &gRockchipPcieProfileProtocolGuid,
+                    EFI_NATIVE_INTERFACE,
+                    Profile
+                    );
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: %r\n", __FUNCTION__, Status));
+      FreePool (Profile);
+      return NULL;
+    }
+  }
+
+  Status = gBS->CreateEventEx (
+                  EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  PcieProfileExitBootServices,
+                  NULL,
+                  &gEfiEventExitBootServicesGuid,
+                  &Event
+                  );
+  if (EFI_ERROR (Status)) {
+    return NULL;
+  }
+
+  mProfile = Profile;
+  return mProfile;
+}
+
+/**
+  Account a configuration access.
+
+  @param  Segment             The PCI segment of the function.
+  @param  Bus                 The bus of the function.
+  @param  Device              The device of the function.
+  @param  Function            The function.
+  @param  Access              PCIE_PROFILE_READ, PCIE_PROFILE_WRITE or both.
+
+**/
+VOID
+PcieProfileConfigAccess (
+  IN UINTN                  Segment,
+  IN UINTN                  Bus,
+  IN UINTN                  Device,
+  IN UINTN                  Function,
+  IN UINTN                  Access
+  )
+{
+  ROCKCHIP_PCIE_PROFILE_PROTOCOL  *Profile;
+  PCIE_PROFILE_FUNCTION           *Entry;
+  UINTN                           Index;
+
+  Profile = PcieProfileGet ();
+  if (Profile == NULL) {
+    return;
+  }
+
+  for (Index = 0; Index < Profile->FunctionCount; Index++) {
+    Entry = &Profile->Functions[Index];
+    if ((Entry->Segment == Segment) && (Entry->Bus == Bus) &&
+        (Entry->Device == Device) && (Entry->Function == Function)) {
+      break;
+    }
+  }
+
+  if (Index == Profile->FunctionCount) {
+    if (Index == PCIE_PROFILE_MAX_FUNCTIONS) {
+      Profile->Dropped++;
+      return;
+    }
+
+    Entry           = &Profile->Functions[Index];
+    Entry->Segment  = (UINT8) Segment;
+    Entry->Bus      = (UINT8) Bus;
+    Entry->Device   = (UINT8) Device;
+    Entry->Function = (UINT8) Function;
+    Profile->FunctionCount++;
+  }
+
+  Entry = &Profile->Functions[Index];
+  if ((Access & PCIE_PROFILE_READ) != 0) {
+    Entry->Reads++;
+  }
+
+  if ((Access & PCIE_PROFILE_WRITE) != 0) {
+    Entry->Writes++;
+  }
+}
+
+/**
+  Account the programming of an outbound iATU region.
+
+  @param  Segment             The PCI segment of the root complex.
+
+**/
+VOID
+PcieProfileAtuProgram (
+  IN UINTN                  Segment
+  )
+{
+  ROCKCHIP_PCIE_PROFILE_PROTOCOL  *Profile;
+
+  Profile = PcieProfileGet ();
+  if ((Profile == NULL) || (Segment >= PCIE_PROFILE_MAX_SEGMENTS)) {
+    return;
+  }
+
+  Profile->Segments[Segment].AtuPrograms++;
+}
+
+/**
+  Account the time a root port spent in a phase of its link bring-up.
+
+  @param  Segment             The PCI segment of the root port.
+  @param  Phase               The phase.
+  @param  Microseconds        The time spent in it.
+
+**/
+VOID
+PcieProfilePhase (
+  IN UINTN                  Segment,
+  IN PCIE_PROFILE_PHASE     Phase,
+  IN UINT64                 Microseconds
+  )
+{
+  ROCKCHIP_PCIE_PROFILE_PROTOCOL  *Profile;
+
+  Profile = PcieProfileGet ();
+  if ((Profile == NULL) || (Segment >= PCIE_PROFILE_MAX_SEGMENTS) ||
+      (Phase >= PcieProfilePhaseMax)) {
+    return;
+  }
+
+  Profile->Segments[Segment].PhaseUs[Phase] += Microseconds;
+}
+
+/**
+  Log the counters with DEBUG_INFO.
+
+**/
+VOID
+PcieProfileLogSummary (
+  VOID
+  )
+{
+  ROCKCHIP_PCIE_PROFILE_PROTOCOL  *Profile;
+  PCIE_PROFILE_SEGMENT            *Segment;
+  PCIE_PROFILE_FUNCTION           *Entry;
+  UINTN                           Index;
+  UINTN                           Phase;
+  UINT64                          Total;
+
+  Profile = PcieProfileGet ();
+  if (Profile == NULL) {
+    return;
+  }
+
+  DEBUG ((DEBUG_INFO, "PCIe profile:\n"));
+  for (Index = 0; Index < PCIE_PROFILE_MAX_SEGMENTS; Index++) {
+    Segment = &Profile->Segments[Index];
+    Total   = 0;
+    for (Phase = 0; Phase < PcieProfilePhaseMax; Phase++) {
+      Total += Segment->PhaseUs[Phase];
+    }
+
+    if ((Total == 0) && (Segment->AtuPrograms == 0)) {
+      continue;
+    }
+
+    DEBUG ((DEBUG_INFO, "  Segment %d: %ld iATU writes, link bring-up %ld us\n", Index, Segment->AtuPrograms, Total));
+    for (Phase = 0; Phase < PcieProfilePhaseMax; Phase++) {
+      if (Segment->PhaseUs[Phase] != 0) {
+        DEBUG ((DEBUG_INFO, "    %-10a %8ld us\n", mPhaseNames[Phase], Segment->PhaseUs[Phase]));
+      }
+    }
+  }
+
+  if (Profile->FunctionCount != 0) {
+    DEBUG ((DEBUG_INFO, "  Seg Bus Dev Fn      Reads     Writes\n"));
+  }
+
+  for (Index = 0; Index < Profile->FunctionCount; Index++) {
+    Entry = &Profile->Functions[Index];
+    DEBUG ((
+      DEBUG_INFO,
+      "  %3d  %02x  %02x %2d %10ld %10ld\n",
+      Entry->Segment,
+      Entry->Bus,
+      Entry->Device,
+      Entry->Function,
+      Entry->Reads,
+      Entry->Writes
+      ));
+  }
+
+  if (Profile->Dropped != 0) {
+    DEBUG ((DEBUG_INFO, "  %ld accesses not counted, too many functions\n", Profile->Dropped));
+  }
+}
@@ -0,0 +1,74 @@
+/** @file
+
+  PcieProfileLib instance that counts nothing.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Base.h>
+
+#include <Library/PcieProfileLib.h>
+
+/**
+  Account a configuration access.
+
+  @param  Segment             The PCI segment of the function.
+  @param  Bus                 The bus of the function.
+  @param  Device              The device of the function.
+  @param  Function            The function.
+  @param  Access              PCIE_PROFILE_READ, PCIE_PROFILE_WRITE or both.
+
+**/
+VOID
+PcieProfileConfigAccess (
+  IN UINTN                  Segment,
+  IN UINTN                  Bus,
+  IN UINTN                  Device,
+  IN UINTN                  Function,
+  IN UINTN                  Access
+  )
+{
+}
+
+/**
+  Account the programming of an outbound iATU region.
+
+  @param  Segment             The PCI segment of the root complex.
+
+**/
+VOID
+PcieProfileAtuProgram (
+  IN UINTN                  Segment
+  )
+{
+}
+
+/**
+  Account the time a root port spent in a phase of its link bring-up.
+
+  @param  Segment             The PCI segment of the root port.
+  @param  Phase               The phase.
+  @param  Microseconds        The time spent in it.
+
+**/
+VOID
+PcieProfilePhase (
+  IN UINTN                  Segment,
+  IN PCIE_PROFILE_PHASE     Phase,
+  IN UINT64                 Microseconds
+  )
+{
+}
+
+/**
+  Log the counters with DEBUG_INFO.
+
+**/
+VOID
+PcieProfileLogSummary (
+  VOID
+  )
+{
+}
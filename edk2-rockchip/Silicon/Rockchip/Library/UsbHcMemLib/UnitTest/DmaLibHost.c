@@ -0,0 +1,127 @@
+/** @file
+
+  DmaLib for the host-based tests of UsbHcMemLib.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DmaLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include "DmaLibHost.h"
+
+typedef struct {
+  VOID                    *HostAddress;
+  UINTN                   NumberOfBytes;
+} DMA_HOST_MAPPING;
+
+UINTN    mDmaHostBuffers;
+UINTN    mDmaHostMappings;
+BOOLEAN  mDmaHostFailAllocate;
+
+EFI_STATUS
+EFIAPI
+DmaMap (
+  IN     DMA_MAP_OPERATION        Operation,
+  IN     VOID                     *HostAddress,
+  IN OUT UINTN                    *NumberOfBytes,
+  OUT    PHYSICAL_ADDRESS         *DeviceAddress,
+  OUT    VOID                     **Mapping
+  )
+{
+  DMA_HOST_MAPPING        *Map;
+
+  if ((HostAddress == NULL) || (NumberOfBytes == NULL) ||
+      (DeviceAddress == NULL) || (Mapping == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Map = AllocatePool (sizeof (DMA_HOST_MAPPING));
+  if (Map == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Map->HostAddress   = HostAddress;
+  Map->NumberOfBytes = *NumberOfBytes;
+
+  *DeviceAddress = (UINTN) HostAddress + DMA_HOST_BUS_OFFSET;
+  *Mapping       = Map;
+  mDmaHostMappings++;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+DmaUnmap (
+  IN  VOID                         *Mapping
+  )
+{
+  if (Mapping == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  ASSERT (mDmaHostMappings > 0);
+  mDmaHostMappings--;
+  FreePool (Mapping);
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+DmaAllocateBuffer (
+  IN  EFI_MEMORY_TYPE              MemoryType,
+  IN  UINTN                        Pages,
+  OUT VOID                         **HostAddress
+  )
+{
+  return DmaAllocateAlignedBuffer (MemoryType, Pages, 0, HostAddress);
+}
+
+EFI_STATUS
+EFIAPI
+DmaAllocateAlignedBuffer (
+  IN  EFI_MEMORY_TYPE              MemoryType,
+  IN  UINTN                        Pages,
+  IN  UINTN                        Alignment,
+  OUT VOID                         **HostAddress
+  )
+{
+  if ((Pages == 0) || (HostAddress == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (mDmaHostFailAllocate) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  *HostAddress = AllocateAlignedPages (Pages, MAX (Alignment, EFI_PAGE_SIZE));
+  if (*HostAddress == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  mDmaHostBuffers++;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+DmaFreeBuffer (
+  IN  UINTN                        Pages,
+  IN  VOID                         *HostAddress
+  )
+{
+  if (HostAddress == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  ASSERT (mDmaHostBuffers > 0);
+  mDmaHostBuffers--;
+  FreeAlignedPages (HostAddress, Pages);
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,28 @@
+/** @file
+
+  DmaLib for the host-based tests of UsbHcMemLib. Buffers come from
+  MemoryAllocationLib and are mapped at DMA_HOST_BUS_OFFSET above their host
+  address, so that host and bus addresses never match by accident.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _DMA_LIB_HOST_H_
+#define _DMA_LIB_HOST_H_
+
+#define DMA_HOST_BUS_OFFSET  BASE_1TB
+
+//
+// Number of buffers allocated and not freed, and of mappings not unmapped.
+//
+extern UINTN    mDmaHostBuffers;
+extern UINTN    mDmaHostMappings;
+
+//
+// Make DmaAllocateBuffer () fail while set.
+//
+extern BOOLEAN  mDmaHostFailAllocate;
+
+#endif
@@ -0,0 +1,239 @@
+/** @file
+
+  Host-based benchmark of UsbHcMemLib against the pool the USB host
+  controller drivers carried before it.
+
+  A pool is filled with a number of live allocations, then allocations are
+  freed and replaced at random, and finally the bus address of random live
+  allocations is looked up. The sizes follow what XhciDxe asks for: half
+  are single units (TRBs, contexts), a quarter are URB sized, 3/16 are 1KB
+  rings and 1/16 are 4KB segments. The same sequence of operations is
+  replayed on both pools.
+
+    UsbHcMemLibBenchmarkHost [Operations [Live ...]]
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UsbHcMemLib.h>
+
+#include "UsbHcMemReference.h"
+
+#define BENCH_DEFAULT_OPERATIONS  200000
+
+typedef struct {
+  CONST CHAR8             *Name;
+  VOID                    *(*Init)(VOID);
+  VOID                    (*Release)(VOID *Pool);
+  VOID                    *(*Allocate)(VOID *Pool, UINTN Size);
+  VOID                    (*Free)(VOID *Pool, VOID *Mem, UINTN Size);
+  EFI_PHYSICAL_ADDRESS    (*BusAddr)(VOID *Pool, VOID *Mem, UINTN Size);
+} BENCH_POOL;
+
+STATIC UINT64  mSeed;
+
+STATIC
+UINT32
+BenchRandom (
+  VOID
+  )
+{
+  mSeed ^= mSeed << 13;
+  mSeed ^= mSeed >> 7;
+  mSeed ^= mSeed << 17;
+  return (UINT32) mSeed;
+}
+
+STATIC
+UINTN
+BenchSize (
+  VOID
+  )
+{
+  UINT32  Kind;
+
+  Kind = BenchRandom () % 16;
+  if (Kind < 8) {
+    return USBHC_MEM_UNIT;
+  } else if (Kind < 12) {
+    return USBHC_MEM_UNIT + BenchRandom () % 448;
+  } else if (Kind < 15) {
+    return 1024;
+  }
+
+  return 4096;
+}
+
+STATIC
+UINT64
+BenchNow (
+  VOID
+  )
+{
+  struct timespec  Now;
+
+  clock_gettime (CLOCK_MONOTONIC, &Now);
+  return (UINT64) Now.tv_sec * 1000000000 + Now.tv_nsec;
+}
+
+STATIC VOID *NewInit (VOID) { return UsbHcInitMemPool (FALSE, 0); }
+STATIC VOID NewRelease (VOID *Pool) { UsbHcFreeMemPool (Pool); }
+STATIC VOID *NewAllocate (VOID *Pool, UINTN Size) { return UsbHcAllocateMem (Pool, Size); }
+STATIC VOID NewFree (VOID *Pool, VOID *Mem, UINTN Size) { UsbHcFreeMem (Pool, Mem, Size); }
+STATIC EFI_PHYSICAL_ADDRESS NewBusAddr (VOID *Pool, VOID *Mem, UINTN Size) { return UsbHcGetBusAddrForHostAddr (Pool, Mem, Size); }
+
+STATIC VOID *RefInit (VOID) { return RefUsbHcInitMemPool (); }
+STATIC VOID RefRelease (VOID *Pool) { RefUsbHcFreeMemPool (Pool); }
+STATIC VOID *RefAllocate (VOID *Pool, UINTN Size) { return RefUsbHcAllocateMem (Pool, Size); }
+STATIC VOID RefFree (VOID *Pool, VOID *Mem, UINTN Size) { RefUsbHcFreeMem (Pool, Mem, Size); }
+STATIC EFI_PHYSICAL_ADDRESS RefBusAddr (VOID *Pool, VOID *Mem, UINTN Size) { return RefUsbHcGetBusAddrForHostAddr (Pool, Mem, Size); }
+
+STATIC CONST BENCH_POOL  mPools[] = {
+  { "before", RefInit, RefRelease, RefAllocate, RefFree, RefBusAddr },
+  { "UsbHcMemLib", NewInit, NewRelease, NewAllocate, NewFree, NewBusAddr },
+};
+
+/**
+  Run the workload on one pool.
+
+  @param[in]   Pool         The pool to run it on.
+  @param[in]   Live         The number of live allocations.
+  @param[in]   Operations   The number of replacements and of lookups.
+  @param[out]  AllocNs      Nanoseconds per free and allocation pair.
+  @param[out]  LookupNs     Nanoseconds per host to bus lookup.
+
+  @retval EFI_SUCCESS           The workload ran.
+  @retval EFI_OUT_OF_RESOURCES  An allocation failed.
+
+**/
+STATIC
+EFI_STATUS
+BenchRun (
+  IN  CONST BENCH_POOL  *Pool,
+  IN  UINTN             Live,
+  IN  UINTN             Operations,
+  OUT UINT64            *AllocNs,
+  OUT UINT64            *LookupNs
+  )
+{
+  VOID                  *Handle;
+  VOID                  **Mem;
+  UINTN                 *Size;
+  UINTN                 Index;
+  UINTN                 Slot;
+  UINT64                Start;
+  UINT64                Sum;
+  EFI_STATUS            Status;
+
+  Status    = EFI_OUT_OF_RESOURCES;
+  mSeed     = 88172645463325252ULL;
+  *AllocNs  = 0;
+  *LookupNs = 0;
+
+  Handle = Pool->Init ();
+  Mem    = AllocateZeroPool (Live * sizeof (VOID *));
+  Size   = AllocateZeroPool (Live * sizeof (UINTN));
+  if ((Handle == NULL) || (Mem == NULL) || (Size == NULL)) {
+    goto EXIT;
+  }
+
+  for (Slot = 0; Slot < Live; Slot++) {
+    Size[Slot] = BenchSize ();
+    Mem[Slot]  = Pool->Allocate (Handle, Size[Slot]);
+    if (Mem[Slot] == NULL) {
+      goto EXIT;
+    }
+  }
+
+  Start = BenchNow ();
+  for (Index = 0; Index < Operations; Index++) {
+    Slot = BenchRandom () % Live;
+    Pool->Free (Handle, Mem[Slot], Size[Slot]);
+    Size[Slot] = BenchSize ();
+    Mem[Slot]  = Pool->Allocate (Handle, Size[Slot]);
+    if (Mem[Slot] == NULL) {
+      goto EXIT;
+    }
+  }
+  *AllocNs = (BenchNow () - Start) / Operations;
+
+  Sum   = 0;
+  Start = BenchNow ();
+  for (Index = 0; Index < Operations; Index++) {
+    Slot = BenchRandom () % Live;
+    Sum += Pool->BusAddr (Handle, Mem[Slot], Size[Slot]);
+  }
+  *LookupNs = (BenchNow () - Start) / Operations;
+
+  Status = (Sum != 0) ? EFI_SUCCESS : EFI_DEVICE_ERROR;
+
+EXIT:
+  if (Handle != NULL) {
+    Pool->Release (Handle);
+  }
+  if (Mem != NULL) {
+    FreePool (Mem);
+  }
+  if (Size != NULL) {
+    FreePool (Size);
+  }
+
+  return Status;
+}
+
+/**
+  Standard POSIX C entry point of the benchmark.
+**/
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  STATIC CONST UINTN  DefaultLive[] = { 64, 256, 1024 };
+  UINTN               Operations;
+  UINTN               Live;
+  UINTN               Index;
+  UINTN               Count;
+  UINTN               PoolIndex;
+  UINT64              AllocNs;
+  UINT64              LookupNs;
+
+  Operations = (argc > 1) ? strtoul (argv[1], NULL, 0) : BENCH_DEFAULT_OPERATIONS;
+  Count      = (argc > 2) ? (UINTN) argc - 2 : ARRAY_SIZE (DefaultLive);
+  if (Operations == 0) {
+    fprintf (stderr, "usage: %s [Operations [Live ...]]\n", argv[0]);
+    return 1;
+  }
+
+  printf ("%-12s %6s %16s %16s\n", "pool", "live", "free+alloc ns", "host->bus ns");
+
+  for (Index = 0; Index < Count; Index++) {
+    Live = (argc > 2) ? strtoul (argv[Index + 2], NULL, 0) : DefaultLive[Index];
+    if (Live == 0) {
+      continue;
+    }
+
+    for (PoolIndex = 0; PoolIndex < ARRAY_SIZE (mPools); PoolIndex++) {
+      if (EFI_ERROR (BenchRun (&mPools[PoolIndex], Live, Operations, &AllocNs, &LookupNs))) {
+        fprintf (stderr, "%s: allocation failed with %u live\n", mPools[PoolIndex].Name, (unsigned) Live);
+        return 1;
+      }
+
+      printf ("%-12s %6u %16llu %16llu\n", mPools[PoolIndex].Name, (unsigned) Live, (unsigned long long) AllocNs, (unsigned long long) LookupNs);
+    }
+  }
+
+  return 0;
+}
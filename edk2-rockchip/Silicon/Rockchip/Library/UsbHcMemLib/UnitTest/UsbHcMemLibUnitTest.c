@@ -0,0 +1,658 @@
+/** @file
+
+  Host-based unit tests of UsbHcMemLib: the word-at-a-time bitmap search,
+  the per-block hint, block allocation and release, and the host and bus
+  address lookups.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UnitTestLib.h>
+#include <Library/UsbHcMemLib.h>
+
+#include "DmaLibHost.h"
+
+#define UNIT_TEST_APP_NAME     "UsbHcMemLib Unit Tests"
+#define UNIT_TEST_APP_VERSION  "1.0"
+
+//
+// Number of units of a block of USBHC_MEM_DEFAULT_PAGES.
+//
+#define BLOCK_UNITS            (EFI_PAGES_TO_SIZE (USBHC_MEM_DEFAULT_PAGES) / USBHC_MEM_UNIT)
+
+#define STRESS_SLOTS           512
+#define STRESS_ROUNDS          20000
+
+STATIC USBHC_MEM_POOL  *mPool;
+STATIC VOID            *mUnits[BLOCK_UNITS];
+
+/**
+  Create the pool the test works on.
+
+  @param[in]  Context    Unused.
+
+  @retval UNIT_TEST_PASSED                 The pool was created.
+  @retval UNIT_TEST_ERROR_PREREQUISITE_NOT_MET  It could not be created.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+CreatePool (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  mDmaHostFailAllocate = FALSE;
+
+  mPool = UsbHcInitMemPool (FALSE, 0);
+  if ((mPool == NULL) || (mDmaHostBuffers != 1)) {
+    return UNIT_TEST_ERROR_PREREQUISITE_NOT_MET;
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Free the pool of the test.
+
+  @param[in]  Context    Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+DestroyPool (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  if (mPool != NULL) {
+    UsbHcFreeMemPool (mPool);
+    mPool = NULL;
+  }
+
+  mDmaHostFailAllocate = FALSE;
+}
+
+/**
+  Fill the head block of mPool with single units, recording them in mUnits.
+  The pool must be empty.
+
+  @return The first unit of the head block, or NULL on failure.
+
+**/
+STATIC
+UINT8 *
+FillHeadBlock (
+  VOID
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < BLOCK_UNITS; Index++) {
+    mUnits[Index] = UsbHcAllocateMem (mPool, USBHC_MEM_UNIT);
+    if ((mUnits[Index] == NULL) ||
+        ((UINT8 *) mUnits[Index] != (UINT8 *) mUnits[0] + Index * USBHC_MEM_UNIT)) {
+      return NULL;
+    }
+  }
+
+  return mUnits[0];
+}
+
+/**
+  Allocations are aligned to USBHC_MEM_UNIT and zeroed, also when they
+  reuse memory that was written before.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+AllocIsAlignedAndZeroed (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT8  *Mem;
+  UINT8  *Again;
+  UINTN  Index;
+
+  Mem = UsbHcAllocateMem (mPool, 100);
+  UT_ASSERT_NOT_NULL (Mem);
+  UT_ASSERT_EQUAL ((UINTN) Mem & USBHC_MEM_UNIT_MASK, 0);
+
+  SetMem (Mem, USBHC_MEM_ROUND (100), 0xA5);
+  UsbHcFreeMem (mPool, Mem, 100);
+
+  Again = UsbHcAllocateMem (mPool, 100);
+  UT_ASSERT_EQUAL ((UINTN) Again, (UINTN) Mem);
+  for (Index = 0; Index < 100; Index++) {
+    UT_ASSERT_EQUAL (Again[Index], 0);
+  }
+
+  UsbHcFreeMem (mPool, Again, 100);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  A freed unit is handed out again to the next request that fits in it,
+  and a larger request skips the hole.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+FreedUnitsAreReused (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT8  *A;
+  UINT8  *B;
+  UINT8  *C;
+  UINT8  *D;
+  UINT8  *E;
+
+  A = UsbHcAllocateMem (mPool, USBHC_MEM_UNIT);
+  B = UsbHcAllocateMem (mPool, USBHC_MEM_UNIT);
+  C = UsbHcAllocateMem (mPool, USBHC_MEM_UNIT);
+  UT_ASSERT_EQUAL ((UINTN) B, (UINTN) (A + USBHC_MEM_UNIT));
+  UT_ASSERT_EQUAL ((UINTN) C, (UINTN) (B + USBHC_MEM_UNIT));
+
+  UsbHcFreeMem (mPool, B, USBHC_MEM_UNIT);
+
+  E = UsbHcAllocateMem (mPool, 2 * USBHC_MEM_UNIT);
+  UT_ASSERT_EQUAL ((UINTN) E, (UINTN) (C + USBHC_MEM_UNIT));
+
+  D = UsbHcAllocateMem (mPool, USBHC_MEM_UNIT);
+  UT_ASSERT_EQUAL ((UINTN) D, (UINTN) B);
+
+  UsbHcFreeMem (mPool, A, USBHC_MEM_UNIT);
+  UsbHcFreeMem (mPool, C, USBHC_MEM_UNIT);
+  UsbHcFreeMem (mPool, D, USBHC_MEM_UNIT);
+  UsbHcFreeMem (mPool, E, 2 * USBHC_MEM_UNIT);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Runs of free units are found across the words of the bitmap.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+RunsCrossWords (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT8  *Base;
+  UINT8  *Pair;
+  UINT8  *Long;
+  UINTN  Index;
+
+  for (Index = 0; Index < 63; Index++) {
+    mUnits[Index] = UsbHcAllocateMem (mPool, USBHC_MEM_UNIT);
+    UT_ASSERT_NOT_NULL (mUnits[Index]);
+  }
+
+  Base = mUnits[0];
+
+  //
+  // Units 63 and 64 straddle the first two words.
+  //
+  Pair = UsbHcAllocateMem (mPool, 2 * USBHC_MEM_UNIT);
+  UT_ASSERT_EQUAL ((UINTN) Pair, (UINTN) (Base + 63 * USBHC_MEM_UNIT));
+
+  //
+  // 130 units span three words.
+  //
+  Long = UsbHcAllocateMem (mPool, 130 * USBHC_MEM_UNIT);
+  UT_ASSERT_EQUAL ((UINTN) Long, (UINTN) (Base + 65 * USBHC_MEM_UNIT));
+
+  //
+  // Once the front is free again the same run starts at the base.
+  //
+  for (Index = 0; Index < 63; Index++) {
+    UsbHcFreeMem (mPool, mUnits[Index], USBHC_MEM_UNIT);
+  }
+  UsbHcFreeMem (mPool, Pair, 2 * USBHC_MEM_UNIT);
+  UsbHcFreeMem (mPool, Long, 130 * USBHC_MEM_UNIT);
+
+  Long = UsbHcAllocateMem (mPool, 130 * USBHC_MEM_UNIT);
+  UT_ASSERT_EQUAL ((UINTN) Long, (UINTN) Base);
+
+  UsbHcFreeMem (mPool, Long, 130 * USBHC_MEM_UNIT);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Freeing memory in a full block lowers its hint, so the freed units are
+  found again, while a hole too small for a request is skipped.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+HintFollowsFrees (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT8  *Base;
+  UINT8  *Mem;
+  UINTN  Index;
+
+  Base = FillHeadBlock ();
+  UT_ASSERT_NOT_NULL (Base);
+
+  UsbHcFreeMem (mPool, mUnits[700], USBHC_MEM_UNIT);
+  Mem = UsbHcAllocateMem (mPool, USBHC_MEM_UNIT);
+  UT_ASSERT_EQUAL ((UINTN) Mem, (UINTN) mUnits[700]);
+
+  UsbHcFreeMem (mPool, mUnits[5], USBHC_MEM_UNIT);
+  UsbHcFreeMem (mPool, mUnits[6], USBHC_MEM_UNIT);
+  Mem = UsbHcAllocateMem (mPool, 2 * USBHC_MEM_UNIT);
+  UT_ASSERT_EQUAL ((UINTN) Mem, (UINTN) mUnits[5]);
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 1);
+
+  //
+  // A single free unit cannot hold two, that takes a new block.
+  //
+  UsbHcFreeMem (mPool, mUnits[9], USBHC_MEM_UNIT);
+  Mem = UsbHcAllocateMem (mPool, 2 * USBHC_MEM_UNIT);
+  UT_ASSERT_NOT_NULL (Mem);
+  UT_ASSERT_TRUE ((Mem < Base) || (Mem >= Base + EFI_PAGES_TO_SIZE (USBHC_MEM_DEFAULT_PAGES)));
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 2);
+
+  UsbHcFreeMem (mPool, Mem, 2 * USBHC_MEM_UNIT);
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 1);
+
+  for (Index = 0; Index < BLOCK_UNITS; Index++) {
+    if (Index != 9) {
+      UsbHcFreeMem (mPool, mUnits[Index], USBHC_MEM_UNIT);
+    }
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  A block other than the head is released once its last allocation is
+  freed. The head block is kept.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+EmptyBlockIsReleased (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  VOID   *Mem;
+  UINTN  Index;
+
+  UT_ASSERT_NOT_NULL (FillHeadBlock ());
+
+  Mem = UsbHcAllocateMem (mPool, USBHC_MEM_UNIT);
+  UT_ASSERT_NOT_NULL (Mem);
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 2);
+  UT_ASSERT_EQUAL (mDmaHostMappings, 2);
+
+  UsbHcFreeMem (mPool, Mem, USBHC_MEM_UNIT);
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 1);
+  UT_ASSERT_EQUAL (mDmaHostMappings, 1);
+
+  for (Index = 0; Index < BLOCK_UNITS; Index++) {
+    UsbHcFreeMem (mPool, mUnits[Index], USBHC_MEM_UNIT);
+  }
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 1);
+
+  //
+  // The emptied head block serves the next allocation.
+  //
+  Mem = UsbHcAllocateMem (mPool, USBHC_MEM_UNIT);
+  UT_ASSERT_EQUAL ((UINTN) Mem, (UINTN) mUnits[0]);
+  UsbHcFreeMem (mPool, Mem, USBHC_MEM_UNIT);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  A request larger than a default block gets a block of its own, which is
+  released with it.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+LargeAllocationGetsOwnBlock (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT8                 *Mem;
+  UINTN                 Size;
+  EFI_PHYSICAL_ADDRESS  Bus;
+
+  Size = EFI_PAGES_TO_SIZE (USBHC_MEM_DEFAULT_PAGES) + 4 * USBHC_MEM_UNIT;
+  Mem  = UsbHcAllocateMem (mPool, Size);
+  UT_ASSERT_NOT_NULL (Mem);
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 2);
+
+  Bus = UsbHcGetBusAddrForHostAddr (mPool, Mem, Size);
+  UT_ASSERT_EQUAL (Bus, (UINTN) Mem + DMA_HOST_BUS_OFFSET);
+  UT_ASSERT_EQUAL (
+    UsbHcGetHostAddrForBusAddr (mPool, (VOID *) (UINTN) (Bus + Size - 1), 1),
+    (UINTN) Mem + Size - 1
+    );
+
+  UsbHcFreeMem (mPool, Mem, Size);
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 1);
+  UT_ASSERT_EQUAL (mDmaHostMappings, 1);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  When no new block can be allocated the request fails without leaking.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+BlockAllocationFailure (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINTN  Index;
+
+  UT_ASSERT_NOT_NULL (FillHeadBlock ());
+
+  mDmaHostFailAllocate = TRUE;
+  UT_ASSERT_EQUAL ((UINTN) UsbHcAllocateMem (mPool, USBHC_MEM_UNIT), 0);
+  mDmaHostFailAllocate = FALSE;
+
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 1);
+  UT_ASSERT_EQUAL (mDmaHostMappings, 1);
+
+  for (Index = 0; Index < BLOCK_UNITS; Index++) {
+    UsbHcFreeMem (mPool, mUnits[Index], USBHC_MEM_UNIT);
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Host and bus addresses translate into each other, in every block of the
+  pool and at any offset of an allocation.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+AddressesTranslate (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT8                 *Mem[3];
+  UINTN                 Size[3];
+  UINTN                 Index;
+  UINTN                 Offset;
+  EFI_PHYSICAL_ADDRESS  Bus;
+
+  UT_ASSERT_NOT_NULL (FillHeadBlock ());
+
+  //
+  // One allocation in the head block, two in a second one.
+  //
+  UsbHcFreeMem (mPool, mUnits[300], USBHC_MEM_UNIT);
+  Size[0] = USBHC_MEM_UNIT;
+  Size[1] = 1024;
+  Size[2] = 4096;
+  for (Index = 0; Index < 3; Index++) {
+    Mem[Index] = UsbHcAllocateMem (mPool, Size[Index]);
+    UT_ASSERT_NOT_NULL (Mem[Index]);
+  }
+  UT_ASSERT_EQUAL ((UINTN) Mem[0], (UINTN) mUnits[300]);
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 2);
+
+  for (Index = 0; Index < 3; Index++) {
+    for (Offset = 0; Offset < Size[Index]; Offset += USBHC_MEM_UNIT / 2) {
+      Bus = UsbHcGetBusAddrForHostAddr (mPool, Mem[Index] + Offset, Size[Index] - Offset);
+      UT_ASSERT_EQUAL (Bus, (UINTN) (Mem[Index] + Offset) + DMA_HOST_BUS_OFFSET);
+      UT_ASSERT_EQUAL (
+        UsbHcGetHostAddrForBusAddr (mPool, (VOID *) (UINTN) Bus, Size[Index] - Offset),
+        (UINTN) (Mem[Index] + Offset)
+        );
+    }
+  }
+
+  UT_ASSERT_EQUAL (UsbHcGetBusAddrForHostAddr (mPool, NULL, USBHC_MEM_UNIT), 0);
+  UT_ASSERT_EQUAL (UsbHcGetHostAddrForBusAddr (mPool, NULL, USBHC_MEM_UNIT), 0);
+
+  for (Index = 0; Index < 3; Index++) {
+    UsbHcFreeMem (mPool, Mem[Index], Size[Index]);
+  }
+  for (Index = 0; Index < BLOCK_UNITS; Index++) {
+    if (Index != 300) {
+      UsbHcFreeMem (mPool, mUnits[Index], USBHC_MEM_UNIT);
+    }
+  }
+
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 1);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  A pool whose memory is not in the requested 4G window is not created,
+  and nothing is leaked.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+Check4GMismatch (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  //
+  // DMA_HOST_BUS_OFFSET puts every bus address above the first 4G.
+  //
+  UT_ASSERT_EQUAL ((UINTN) UsbHcInitMemPool (TRUE, 0), 0);
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 0);
+  UT_ASSERT_EQUAL (mDmaHostMappings, 0);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Releasing a pool frees every block it grew, and the pages of
+  UsbHcAllocateAlignedPages () are mapped and freed.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+PoolReleasesEverything (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  USBHC_MEM_POOL        *Pool;
+  UINTN                 Index;
+  VOID                  *Host;
+  VOID                  *Mapping;
+  EFI_PHYSICAL_ADDRESS  Bus;
+
+  Pool = UsbHcInitMemPool (FALSE, 0);
+  UT_ASSERT_NOT_NULL (Pool);
+
+  for (Index = 0; Index < 3 * BLOCK_UNITS / 16; Index++) {
+    UT_ASSERT_NOT_NULL (UsbHcAllocateMem (Pool, 16 * USBHC_MEM_UNIT));
+  }
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 3);
+
+  UT_ASSERT_STATUS_EQUAL (UsbHcFreeMemPool (Pool), EFI_SUCCESS);
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 0);
+  UT_ASSERT_EQUAL (mDmaHostMappings, 0);
+
+  UT_ASSERT_STATUS_EQUAL (UsbHcAllocateAlignedPages (2, EFI_PAGE_SIZE, &Host, &Bus, &Mapping), EFI_SUCCESS);
+  UT_ASSERT_EQUAL ((UINTN) Host & EFI_PAGE_MASK, 0);
+  UT_ASSERT_EQUAL (Bus, (UINTN) Host + DMA_HOST_BUS_OFFSET);
+  UsbHcFreeAlignedPages (Host, 2, Mapping);
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 0);
+  UT_ASSERT_EQUAL (mDmaHostMappings, 0);
+
+  UT_ASSERT_STATUS_EQUAL (UsbHcAllocateAlignedPages (0, EFI_PAGE_SIZE, &Host, &Bus, &Mapping), EFI_INVALID_PARAMETER);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Random allocations and frees of the sizes the host controller drivers
+  use. Every allocation is filled with a pattern that is checked before it
+  is freed, so overlapping allocations are caught.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+RandomAllocFree (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT8   **Mem;
+  UINTN   *Size;
+  UINT32  Seed;
+  UINTN   Round;
+  UINTN   Slot;
+  UINTN   Index;
+
+  Mem  = AllocateZeroPool (STRESS_SLOTS * sizeof (UINT8 *));
+  Size = AllocateZeroPool (STRESS_SLOTS * sizeof (UINTN));
+  UT_ASSERT_NOT_NULL (Mem);
+  UT_ASSERT_NOT_NULL (Size);
+
+  Seed = 0x2545F491;
+  for (Round = 0; Round < STRESS_ROUNDS; Round++) {
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    Slot = Seed % STRESS_SLOTS;
+
+    if (Mem[Slot] != NULL) {
+      for (Index = 0; Index < Size[Slot]; Index++) {
+        UT_ASSERT_EQUAL (Mem[Slot][Index], (UINT8) Slot);
+      }
+      UsbHcFreeMem (mPool, Mem[Slot], Size[Slot]);
+      Mem[Slot] = NULL;
+      continue;
+    }
+
+    switch ((Seed >> 16) % 16) {
+      case 15:
+        Size[Slot] = 4096;
+        break;
+      case 12: case 13: case 14:
+        Size[Slot] = 1024;
+        break;
+      case 8: case 9: case 10: case 11:
+        Size[Slot] = USBHC_MEM_UNIT + 1 + (Seed >> 20) % 447;
+        break;
+      default:
+        Size[Slot] = USBHC_MEM_UNIT;
+        break;
+    }
+
+    Mem[Slot] = UsbHcAllocateMem (mPool, Size[Slot]);
+    UT_ASSERT_NOT_NULL (Mem[Slot]);
+    UT_ASSERT_EQUAL (
+      UsbHcGetBusAddrForHostAddr (mPool, Mem[Slot], Size[Slot]),
+      (UINTN) Mem[Slot] + DMA_HOST_BUS_OFFSET
+      );
+    SetMem (Mem[Slot], Size[Slot], (UINT8) Slot);
+  }
+
+  for (Slot = 0; Slot < STRESS_SLOTS; Slot++) {
+    if (Mem[Slot] != NULL) {
+      for (Index = 0; Index < Size[Slot]; Index++) {
+        UT_ASSERT_EQUAL (Mem[Slot][Index], (UINT8) Slot);
+      }
+      UsbHcFreeMem (mPool, Mem[Slot], Size[Slot]);
+    }
+  }
+
+  UT_ASSERT_EQUAL (mDmaHostBuffers, 1);
+
+  FreePool (Mem);
+  FreePool (Size);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Initialize the unit test framework, suites and test cases of UsbHcMemLib,
+  then run them.
+
+  @retval EFI_SUCCESS           All the tests were executed.
+  @retval EFI_OUT_OF_RESOURCES  There are not enough resources for the tests.
+
+**/
+EFI_STATUS
+EFIAPI
+UnitTestingEntry (
+  VOID
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework;
+  UNIT_TEST_SUITE_HANDLE      AllocSuite;
+  UNIT_TEST_SUITE_HANDLE      AddressSuite;
+  UNIT_TEST_SUITE_HANDLE      PoolSuite;
+
+  Framework = NULL;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_APP_NAME, UNIT_TEST_APP_VERSION));
+
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_APP_NAME, gEfiCallerBaseName, UNIT_TEST_APP_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&AllocSuite, Framework, "Allocation Tests", "UsbHcMemLib.Alloc", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    goto EXIT;
+  }
+
+  AddTestCase (AllocSuite, "Allocations are aligned and zeroed", "AlignedZeroed", AllocIsAlignedAndZeroed, CreatePool, DestroyPool, NULL);
+  AddTestCase (AllocSuite, "Freed units are reused", "Reuse", FreedUnitsAreReused, CreatePool, DestroyPool, NULL);
+  AddTestCase (AllocSuite, "Free runs span bitmap words", "CrossWords", RunsCrossWords, CreatePool, DestroyPool, NULL);
+  AddTestCase (AllocSuite, "The block hint follows frees", "Hint", HintFollowsFrees, CreatePool, DestroyPool, NULL);
+  AddTestCase (AllocSuite, "Empty blocks are released", "Release", EmptyBlockIsReleased, CreatePool, DestroyPool, NULL);
+  AddTestCase (AllocSuite, "Large requests get their own block", "Large", LargeAllocationGetsOwnBlock, CreatePool, DestroyPool, NULL);
+  AddTestCase (AllocSuite, "Block allocation failure", "Failure", BlockAllocationFailure, CreatePool, DestroyPool, NULL);
+  AddTestCase (AllocSuite, "Random allocations do not overlap", "Random", RandomAllocFree, CreatePool, DestroyPool, NULL);
+
+  Status = CreateUnitTestSuite (&AddressSuite, Framework, "Address Tests", "UsbHcMemLib.Address", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    goto EXIT;
+  }
+
+  AddTestCase (AddressSuite, "Host and bus addresses translate", "Translate", AddressesTranslate, CreatePool, DestroyPool, NULL);
+
+  Status = CreateUnitTestSuite (&PoolSuite, Framework, "Pool Tests", "UsbHcMemLib.Pool", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    goto EXIT;
+  }
+
+  AddTestCase (PoolSuite, "Pools outside the 4G window fail", "Check4G", Check4GMismatch, NULL, NULL, NULL);
+  AddTestCase (PoolSuite, "Pools release all their memory", "FreePool", PoolReleasesEverything, NULL, NULL, NULL);
+
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
+
+/**
+  Standard POSIX C entry point for host based unit test execution.
+**/
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  return UnitTestingEntry ();
+}
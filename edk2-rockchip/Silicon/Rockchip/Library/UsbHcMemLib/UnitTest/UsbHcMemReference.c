@@ -0,0 +1,362 @@
+/** @file
+
+  The memory pool the XHCI, EHCI and OHCI drivers carried before
+  UsbHcMemLib, with its symbols renamed so that both can be linked into the
+  benchmark. The bitmap is searched and updated one bit at a time, and
+  freeing memory or translating an address walks the list of blocks.
+
+  Copyright (c) 2013 - 2018, Intel Corporation. All rights reserved.<BR>
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DmaLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UsbHcMemLib.h>
+
+#include "UsbHcMemReference.h"
+
+#define USB_HC_BIT(a)                  ((UINTN)(1 << (a)))
+
+#define USB_HC_BIT_IS_SET(Data, Bit)   \
+          ((BOOLEAN)(((Data) & USB_HC_BIT(Bit)) == USB_HC_BIT(Bit)))
+
+#define NEXT_BIT(Byte, Bit)   \
+          do {                \
+            (Bit)++;          \
+            if ((Bit) > 7) {  \
+              (Byte)++;       \
+              (Bit) = 0;      \
+            }                 \
+          } while (0)
+
+typedef struct _REF_USBHC_MEM_BLOCK REF_USBHC_MEM_BLOCK;
+
+struct _REF_USBHC_MEM_BLOCK {
+  UINT8                   *Bits;    // Bit array to record which unit is allocated
+  UINTN                   BitsLen;
+  UINT8                   *Buf;
+  UINT8                   *BufHost;
+  UINTN                   BufLen;   // Memory size in bytes
+  VOID                    *Mapping;
+  REF_USBHC_MEM_BLOCK     *Next;
+};
+
+struct _REF_USBHC_MEM_POOL {
+  REF_USBHC_MEM_BLOCK     *Head;
+};
+
+STATIC
+REF_USBHC_MEM_BLOCK *
+RefUsbHcAllocMemBlock (
+  IN  UINTN               Pages
+  )
+{
+  REF_USBHC_MEM_BLOCK     *Block;
+  VOID                    *BufHost;
+  VOID                    *Mapping;
+  EFI_PHYSICAL_ADDRESS    MappedAddr;
+  UINTN                   Bytes;
+  EFI_STATUS              Status;
+
+  Block = AllocateZeroPool (sizeof (REF_USBHC_MEM_BLOCK));
+  if (Block == NULL) {
+    return NULL;
+  }
+
+  Block->BufLen   = EFI_PAGES_TO_SIZE (Pages);
+  Block->BitsLen  = Block->BufLen / (USBHC_MEM_UNIT * 8);
+  Block->Bits     = AllocateZeroPool (Block->BitsLen);
+
+  if (Block->Bits == NULL) {
+    FreePool (Block);
+    return NULL;
+  }
+
+  Status = DmaAllocateBuffer (EfiBootServicesData, Pages, &BufHost);
+  if (EFI_ERROR (Status)) {
+    goto FREE_BITARRAY;
+  }
+
+  Bytes = EFI_PAGES_TO_SIZE (Pages);
+  Status = DmaMap (MapOperationBusMasterCommonBuffer, BufHost, &Bytes, &MappedAddr, &Mapping);
+  if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Pages))) {
+    goto FREE_BUFFER;
+  }
+
+  Block->BufHost  = BufHost;
+  Block->Buf      = (UINT8 *) ((UINTN) MappedAddr);
+  Block->Mapping  = Mapping;
+
+  return Block;
+
+FREE_BUFFER:
+  DmaFreeBuffer (Pages, BufHost);
+
+FREE_BITARRAY:
+  FreePool (Block->Bits);
+  FreePool (Block);
+  return NULL;
+}
+
+STATIC
+VOID
+RefUsbHcFreeMemBlock (
+  IN REF_USBHC_MEM_BLOCK  *Block
+  )
+{
+  DmaUnmap (Block->Mapping);
+  DmaFreeBuffer (EFI_SIZE_TO_PAGES (Block->BufLen), Block->BufHost);
+
+  FreePool (Block->Bits);
+  FreePool (Block);
+}
+
+STATIC
+VOID *
+RefUsbHcAllocMemFromBlock (
+  IN  REF_USBHC_MEM_BLOCK *Block,
+  IN  UINTN               Units
+  )
+{
+  UINTN                   Byte;
+  UINT8                   Bit;
+  UINTN                   StartByte;
+  UINT8                   StartBit;
+  UINTN                   Available;
+  UINTN                   Count;
+
+  StartByte  = 0;
+  StartBit   = 0;
+  Available  = 0;
+
+  for (Byte = 0, Bit = 0; Byte < Block->BitsLen;) {
+    if (!USB_HC_BIT_IS_SET (Block->Bits[Byte], Bit)) {
+      Available++;
+
+      if (Available >= Units) {
+        break;
+      }
+
+      NEXT_BIT (Byte, Bit);
+    } else {
+      NEXT_BIT (Byte, Bit);
+
+      Available  = 0;
+      StartByte  = Byte;
+      StartBit   = Bit;
+    }
+  }
+
+  if (Available < Units) {
+    return NULL;
+  }
+
+  Byte  = StartByte;
+  Bit   = StartBit;
+
+  for (Count = 0; Count < Units; Count++) {
+    ASSERT (!USB_HC_BIT_IS_SET (Block->Bits[Byte], Bit));
+
+    Block->Bits[Byte] = (UINT8) (Block->Bits[Byte] | USB_HC_BIT (Bit));
+    NEXT_BIT (Byte, Bit);
+  }
+
+  return Block->BufHost + (StartByte * 8 + StartBit) * USBHC_MEM_UNIT;
+}
+
+EFI_PHYSICAL_ADDRESS
+RefUsbHcGetBusAddrForHostAddr (
+  IN REF_USBHC_MEM_POOL   *Pool,
+  IN VOID                 *Mem,
+  IN UINTN                Size
+  )
+{
+  REF_USBHC_MEM_BLOCK     *Block;
+  UINTN                   AllocSize;
+
+  AllocSize = USBHC_MEM_ROUND (Size);
+
+  if (Mem == NULL) {
+    return 0;
+  }
+
+  for (Block = Pool->Head; Block != NULL; Block = Block->Next) {
+    if ((Block->BufHost <= (UINT8 *) Mem) && (((UINT8 *) Mem + AllocSize) <= (Block->BufHost + Block->BufLen))) {
+      break;
+    }
+  }
+
+  ASSERT (Block != NULL);
+  return (EFI_PHYSICAL_ADDRESS) (UINTN) (Block->Buf + ((UINT8 *) Mem - Block->BufHost));
+}
+
+STATIC
+BOOLEAN
+RefUsbHcIsMemBlockEmpty (
+  IN REF_USBHC_MEM_BLOCK  *Block
+  )
+{
+  UINTN                   Index;
+
+  for (Index = 0; Index < Block->BitsLen; Index++) {
+    if (Block->Bits[Index] != 0) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+STATIC
+VOID
+RefUsbHcUnlinkMemBlock (
+  IN REF_USBHC_MEM_BLOCK  *Head,
+  IN REF_USBHC_MEM_BLOCK  *BlockToUnlink
+  )
+{
+  REF_USBHC_MEM_BLOCK     *Block;
+
+  for (Block = Head; Block != NULL; Block = Block->Next) {
+    if (Block->Next == BlockToUnlink) {
+      Block->Next         = BlockToUnlink->Next;
+      BlockToUnlink->Next = NULL;
+      break;
+    }
+  }
+}
+
+REF_USBHC_MEM_POOL *
+RefUsbHcInitMemPool (
+  VOID
+  )
+{
+  REF_USBHC_MEM_POOL      *Pool;
+
+  Pool = AllocatePool (sizeof (REF_USBHC_MEM_POOL));
+  if (Pool == NULL) {
+    return Pool;
+  }
+
+  Pool->Head = RefUsbHcAllocMemBlock (USBHC_MEM_DEFAULT_PAGES);
+  if (Pool->Head == NULL) {
+    FreePool (Pool);
+    Pool = NULL;
+  }
+
+  return Pool;
+}
+
+EFI_STATUS
+RefUsbHcFreeMemPool (
+  IN REF_USBHC_MEM_POOL   *Pool
+  )
+{
+  REF_USBHC_MEM_BLOCK     *Block;
+
+  for (Block = Pool->Head->Next; Block != NULL; Block = Pool->Head->Next) {
+    RefUsbHcUnlinkMemBlock (Pool->Head, Block);
+    RefUsbHcFreeMemBlock (Block);
+  }
+
+  RefUsbHcFreeMemBlock (Pool->Head);
+  FreePool (Pool);
+  return EFI_SUCCESS;
+}
+
+VOID *
+RefUsbHcAllocateMem (
+  IN  REF_USBHC_MEM_POOL  *Pool,
+  IN  UINTN               Size
+  )
+{
+  REF_USBHC_MEM_BLOCK     *Head;
+  REF_USBHC_MEM_BLOCK     *Block;
+  REF_USBHC_MEM_BLOCK     *NewBlock;
+  VOID                    *Mem;
+  UINTN                   AllocSize;
+  UINTN                   Pages;
+
+  Mem       = NULL;
+  AllocSize = USBHC_MEM_ROUND (Size);
+  Head      = Pool->Head;
+
+  for (Block = Head; Block != NULL; Block = Block->Next) {
+    Mem = RefUsbHcAllocMemFromBlock (Block, AllocSize / USBHC_MEM_UNIT);
+
+    if (Mem != NULL) {
+      ZeroMem (Mem, Size);
+      return Mem;
+    }
+  }
+
+  if (AllocSize > EFI_PAGES_TO_SIZE (USBHC_MEM_DEFAULT_PAGES)) {
+    Pages = EFI_SIZE_TO_PAGES (AllocSize) + 1;
+  } else {
+    Pages = USBHC_MEM_DEFAULT_PAGES;
+  }
+
+  NewBlock = RefUsbHcAllocMemBlock (Pages);
+  if (NewBlock == NULL) {
+    return NULL;
+  }
+
+  NewBlock->Next = Head->Next;
+  Head->Next     = NewBlock;
+
+  Mem = RefUsbHcAllocMemFromBlock (NewBlock, AllocSize / USBHC_MEM_UNIT);
+  if (Mem != NULL) {
+    ZeroMem (Mem, Size);
+  }
+
+  return Mem;
+}
+
+VOID
+RefUsbHcFreeMem (
+  IN REF_USBHC_MEM_POOL   *Pool,
+  IN VOID                 *Mem,
+  IN UINTN                Size
+  )
+{
+  REF_USBHC_MEM_BLOCK     *Head;
+  REF_USBHC_MEM_BLOCK     *Block;
+  UINT8                   *ToFree;
+  UINTN                   AllocSize;
+  UINTN                   Byte;
+  UINTN                   Bit;
+  UINTN                   Count;
+
+  Head      = Pool->Head;
+  AllocSize = USBHC_MEM_ROUND (Size);
+  ToFree    = (UINT8 *) Mem;
+
+  for (Block = Head; Block != NULL; Block = Block->Next) {
+    if ((Block->BufHost <= ToFree) && ((ToFree + AllocSize) <= (Block->BufHost + Block->BufLen))) {
+      Byte  = ((ToFree - Block->BufHost) / USBHC_MEM_UNIT) / 8;
+      Bit   = ((ToFree - Block->BufHost) / USBHC_MEM_UNIT) % 8;
+
+      for (Count = 0; Count < (AllocSize / USBHC_MEM_UNIT); Count++) {
+        ASSERT (USB_HC_BIT_IS_SET (Block->Bits[Byte], Bit));
+
+        Block->Bits[Byte] = (UINT8) (Block->Bits[Byte] ^ USB_HC_BIT (Bit));
+        NEXT_BIT (Byte, Bit);
+      }
+
+      break;
+    }
+  }
+
+  ASSERT (Block != NULL);
+
+  if ((Block != Head) && RefUsbHcIsMemBlockEmpty (Block)) {
+    RefUsbHcUnlinkMemBlock (Head, Block);
+    RefUsbHcFreeMemBlock (Block);
+  }
+}
@@ -0,0 +1,47 @@
+/** @file
+
+  The memory pool the USB host controller drivers carried before
+  UsbHcMemLib, kept to benchmark the library against.
+
+  Copyright (c) 2013 - 2018, Intel Corporation. All rights reserved.<BR>
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _USB_HC_MEM_REFERENCE_H_
+#define _USB_HC_MEM_REFERENCE_H_
+
+typedef struct _REF_USBHC_MEM_POOL REF_USBHC_MEM_POOL;
+
+REF_USBHC_MEM_POOL *
+RefUsbHcInitMemPool (
+  VOID
+  );
+
+EFI_STATUS
+RefUsbHcFreeMemPool (
+  IN REF_USBHC_MEM_POOL   *Pool
+  );
+
+VOID *
+RefUsbHcAllocateMem (
+  IN  REF_USBHC_MEM_POOL  *Pool,
+  IN  UINTN               Size
+  );
+
+VOID
+RefUsbHcFreeMem (
+  IN REF_USBHC_MEM_POOL   *Pool,
+  IN VOID                 *Mem,
+  IN UINTN                Size
+  );
+
+EFI_PHYSICAL_ADDRESS
+RefUsbHcGetBusAddrForHostAddr (
+  IN REF_USBHC_MEM_POOL   *Pool,
+  IN VOID                 *Mem,
+  IN UINTN                Size
+  );
+
+#endif
@@ -0,0 +1,974 @@
+/** @file
+
+  Routine procedures for memory allocate/free, shared by the USB host
+  controller drivers.
+
+  Every memory block keeps a bitmap with one bit per USBHC_MEM_UNIT. The
+  bitmap is searched a word at a time: full words are skipped, and runs of
+  free and allocated units are measured with a count-trailing-zeros instead
+  of bit by bit. Each block remembers the first word that may still have a
+  free unit and the number of free units it has, so blocks that cannot
+  satisfy a request are skipped without touching their bitmap.
+
+  Blocks are registered in two small hash tables, keyed by the 64KB chunks
+  of their host and bus addresses. Freeing memory and translating between
+  host and bus addresses look up the owning block there, instead of walking
+  the list of blocks of the pool.
+
+  Copyright (c) 2013 - 2018, Intel Corporation. All rights reserved.<BR>
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DmaLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UsbHcMemLib.h>
+
+#define USBHC_MEM_WORD_BITS     (sizeof (UINTN) * 8)
+
+//
+// Size of the address chunks the blocks are hashed with, and the number of
+// hash buckets. A default block of USBHC_MEM_DEFAULT_PAGES covers at most
+// two chunks.
+//
+#define USBHC_MEM_HASH_SHIFT    16
+#define USBHC_MEM_HASH_SIZE     64
+
+#define USBHC_MEM_CHUNK(Addr)   ((UINTN) (Addr) >> USBHC_MEM_HASH_SHIFT)
+#define USBHC_MEM_HASH(Chunk)   ((Chunk) & (USBHC_MEM_HASH_SIZE - 1))
+
+typedef struct _USBHC_MEM_BLOCK     USBHC_MEM_BLOCK;
+typedef struct _USBHC_MEM_HASH_NODE USBHC_MEM_HASH_NODE;
+
+struct _USBHC_MEM_HASH_NODE {
+  USBHC_MEM_BLOCK         *Block;
+  USBHC_MEM_HASH_NODE     *Next;
+};
+
+struct _USBHC_MEM_BLOCK {
+  UINTN                   *Bits;      // Bit array to record which unit is allocated
+  UINTN                   BitsLen;    // Number of words in Bits
+  UINTN                   Units;      // Number of units in the block
+  UINTN                   FreeUnits;  // Number of units not allocated
+  UINTN                   Hint;       // All words of Bits below Hint are full
+  UINT8                   *Buf;
+  UINT8                   *BufHost;
+  UINTN                   BufLen;     // Memory size in bytes
+  VOID                    *Mapping;
+  USBHC_MEM_BLOCK         *Prev;
+  USBHC_MEM_BLOCK         *Next;
+  UINTN                   NodeCount;  // Number of chunks of each hash node array
+  USBHC_MEM_HASH_NODE     *HostNodes;
+  USBHC_MEM_HASH_NODE     *BusNodes;
+};
+
+struct _USBHC_MEM_POOL {
+  BOOLEAN                 Check4G;
+  UINT32                  Which4G;
+  USBHC_MEM_BLOCK         *Head;
+  USBHC_MEM_BLOCK         *Last;      // The block of the last allocation
+  USBHC_MEM_HASH_NODE     *HostHash[USBHC_MEM_HASH_SIZE];
+  USBHC_MEM_HASH_NODE     *BusHash[USBHC_MEM_HASH_SIZE];
+};
+
+/**
+  Count the trailing zero bits of a non-zero word.
+
+  @param  Value          The word, must not be zero.
+
+  @return The index of the lowest set bit.
+
+**/
+STATIC
+UINTN
+UsbHcLowBitSet (
+  IN UINTN                Value
+  )
+{
+  ASSERT (Value != 0);
+
+#if defined (__GNUC__) || defined (__clang__)
+  return (UINTN) __builtin_ctzll ((UINT64) Value);
+#else
+  return (UINTN) LowBitSet64 ((UINT64) Value);
+#endif
+}
+
+/**
+  Get the number of hash chunks a memory range touches.
+
+  @param  Base           The start of the range.
+  @param  Length         The length of the range.
+
+  @return The number of chunks.
+
+**/
+STATIC
+UINTN
+UsbHcChunkCount (
+  IN UINT8                *Base,
+  IN UINTN                Length
+  )
+{
+  return USBHC_MEM_CHUNK (Base + Length - 1) - USBHC_MEM_CHUNK (Base) + 1;
+}
+
+/**
+  Insert the chunks of a memory range in a hash table.
+
+  @param  Table          The hash table.
+  @param  Nodes          The hash nodes of the block, one per chunk.
+  @param  Block          The memory block.
+  @param  Base           The start of the range.
+
+**/
+STATIC
+VOID
+UsbHcHashInsert (
+  IN USBHC_MEM_HASH_NODE  **Table,
+  IN USBHC_MEM_HASH_NODE  *Nodes,
+  IN USBHC_MEM_BLOCK      *Block,
+  IN UINT8                *Base
+  )
+{
+  UINTN                   Chunk;
+  UINTN                   Index;
+
+  Chunk = USBHC_MEM_CHUNK (Base);
+
+  for (Index = 0; Index < Block->NodeCount; Index++, Chunk++) {
+    Nodes[Index].Block = Block;
+    Nodes[Index].Next  = Table[USBHC_MEM_HASH (Chunk)];
+    Table[USBHC_MEM_HASH (Chunk)] = &Nodes[Index];
+  }
+}
+
+/**
+  Remove the chunks of a memory range from a hash table.
+
+  @param  Table          The hash table.
+  @param  Nodes          The hash nodes of the block, one per chunk.
+  @param  Block          The memory block.
+  @param  Base           The start of the range.
+
+**/
+STATIC
+VOID
+UsbHcHashRemove (
+  IN USBHC_MEM_HASH_NODE  **Table,
+  IN USBHC_MEM_HASH_NODE  *Nodes,
+  IN USBHC_MEM_BLOCK      *Block,
+  IN UINT8                *Base
+  )
+{
+  USBHC_MEM_HASH_NODE     **Link;
+  UINTN                   Chunk;
+  UINTN                   Index;
+
+  Chunk = USBHC_MEM_CHUNK (Base);
+
+  for (Index = 0; Index < Block->NodeCount; Index++, Chunk++) {
+    for (Link = &Table[USBHC_MEM_HASH (Chunk)]; *Link != NULL; Link = &(*Link)->Next) {
+      if (*Link == &Nodes[Index]) {
+        *Link = Nodes[Index].Next;
+        break;
+      }
+    }
+  }
+}
+
+/**
+  Find the memory block that completely contains a memory range.
+
+  @param  Pool           The memory pool.
+  @param  BusAddr        TRUE if Mem is a bus address, FALSE if it is a host address.
+  @param  Mem            The start of the range.
+  @param  Size           The size of the range.
+
+  @return The memory block, or NULL if the range is not in the pool.
+
+**/
+STATIC
+USBHC_MEM_BLOCK *
+UsbHcFindMemBlock (
+  IN USBHC_MEM_POOL       *Pool,
+  IN BOOLEAN              BusAddr,
+  IN UINT8                *Mem,
+  IN UINTN                Size
+  )
+{
+  USBHC_MEM_HASH_NODE     *Node;
+  USBHC_MEM_BLOCK         *Block;
+  UINT8                   *Base;
+
+  Node = BusAddr ? Pool->BusHash[USBHC_MEM_HASH (USBHC_MEM_CHUNK (Mem))] :
+                   Pool->HostHash[USBHC_MEM_HASH (USBHC_MEM_CHUNK (Mem))];
+
+  for (; Node != NULL; Node = Node->Next) {
+    Block = Node->Block;
+    Base  = BusAddr ? Block->Buf : Block->BufHost;
+    if ((Base <= Mem) && ((Mem + Size) <= (Base + Block->BufLen))) {
+      return Block;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Allocate a block of memory to be used by the buffer pool.
+
+  @param  Pool           The buffer pool to allocate memory for.
+  @param  Pages          How many pages to allocate.
+
+  @return The allocated memory block or NULL if failed.
+
+**/
+STATIC
+USBHC_MEM_BLOCK *
+UsbHcAllocMemBlock (
+  IN  USBHC_MEM_POOL      *Pool,
+  IN  UINTN               Pages
+  )
+{
+  USBHC_MEM_BLOCK         *Block;
+  VOID                    *BufHost;
+  VOID                    *Mapping;
+  EFI_PHYSICAL_ADDRESS    MappedAddr;
+  UINTN                   Bytes;
+  UINTN                   NodeCount;
+  EFI_STATUS              Status;
+
+  Block = AllocateZeroPool (sizeof (USBHC_MEM_BLOCK));
+  if (Block == NULL) {
+    return NULL;
+  }
+
+  //
+  // each bit in the bit array represents USBHC_MEM_UNIT
+  // bytes of memory in the memory block.
+  //
+  ASSERT (USBHC_MEM_UNIT * USBHC_MEM_WORD_BITS <= EFI_PAGE_SIZE);
+
+  Block->BufLen    = EFI_PAGES_TO_SIZE (Pages);
+  Block->Units     = Block->BufLen / USBHC_MEM_UNIT;
+  Block->FreeUnits = Block->Units;
+  Block->BitsLen   = Block->Units / USBHC_MEM_WORD_BITS;
+  Block->Bits      = AllocateZeroPool (Block->BitsLen * sizeof (UINTN));
+
+  if (Block->Bits == NULL) {
+    FreePool (Block);
+    return NULL;
+  }
+
+  //
+  // Allocate the number of Pages of memory, then map it for
+  // bus master read and write.
+  //
+  Status = DmaAllocateBuffer (
+             EfiBootServicesData,
+             Pages,
+             &BufHost
+             );
+
+  if (EFI_ERROR (Status)) {
+    goto FREE_BITARRAY;
+  }
+
+  Bytes = EFI_PAGES_TO_SIZE (Pages);
+  Status = DmaMap (
+             MapOperationBusMasterCommonBuffer,
+             BufHost,
+             &Bytes,
+             &MappedAddr,
+             &Mapping
+             );
+
+  if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Pages))) {
+    goto FREE_BUFFER;
+  }
+
+  //
+  // Check whether the data structure used by the host controller
+  // should be restricted into the same 4G
+  //
+  if (Pool->Check4G && (Pool->Which4G != USB_HC_HIGH_32BIT (MappedAddr))) {
+    DmaUnmap (Mapping);
+    goto FREE_BUFFER;
+  }
+
+  Block->BufHost  = BufHost;
+  Block->Buf      = (UINT8 *) ((UINTN) MappedAddr);
+  Block->Mapping  = Mapping;
+
+  //
+  // The host and bus ranges may start at different offsets in their chunks,
+  // size both node arrays for the larger of the two.
+  //
+  NodeCount = MAX (
+                UsbHcChunkCount (Block->BufHost, Block->BufLen),
+                UsbHcChunkCount (Block->Buf, Block->BufLen)
+                );
+  Block->HostNodes = AllocateZeroPool (2 * NodeCount * sizeof (USBHC_MEM_HASH_NODE));
+  if (Block->HostNodes == NULL) {
+    DmaUnmap (Mapping);
+    goto FREE_BUFFER;
+  }
+  Block->BusNodes  = Block->HostNodes + NodeCount;
+  Block->NodeCount = NodeCount;
+
+  return Block;
+
+FREE_BUFFER:
+  DmaFreeBuffer (Pages, BufHost);
+
+FREE_BITARRAY:
+  FreePool (Block->Bits);
+  FreePool (Block);
+  return NULL;
+}
+
+/**
+  Free the memory block from the memory pool.
+
+  @param  Pool           The memory pool to free the block from.
+  @param  Block          The memory block to free.
+
+**/
+STATIC
+VOID
+UsbHcFreeMemBlock (
+  IN USBHC_MEM_POOL       *Pool,
+  IN USBHC_MEM_BLOCK      *Block
+  )
+{
+  ASSERT ((Pool != NULL) && (Block != NULL));
+
+  //
+  // Unmap the common buffer then free the structures
+  //
+  DmaUnmap (Block->Mapping);
+  DmaFreeBuffer (EFI_SIZE_TO_PAGES (Block->BufLen), Block->BufHost);
+
+  FreePool (Block->HostNodes);
+  FreePool (Block->Bits);
+  FreePool (Block);
+}
+
+/**
+  Insert the memory block to the pool's list of the blocks, and register
+  it for address lookups.
+
+  @param  Pool           The memory pool.
+  @param  Block          The memory block to insert.
+
+**/
+STATIC
+VOID
+UsbHcInsertMemBlockToPool (
+  IN USBHC_MEM_POOL       *Pool,
+  IN USBHC_MEM_BLOCK      *Block
+  )
+{
+  USBHC_MEM_BLOCK         *Head;
+
+  Head = Pool->Head;
+  if (Head == NULL) {
+    Pool->Head = Block;
+  } else {
+    Block->Prev = Head;
+    Block->Next = Head->Next;
+    if (Head->Next != NULL) {
+      Head->Next->Prev = Block;
+    }
+    Head->Next = Block;
+  }
+
+  UsbHcHashInsert (Pool->HostHash, Block->HostNodes, Block, Block->BufHost);
+  UsbHcHashInsert (Pool->BusHash, Block->BusNodes, Block, Block->Buf);
+}
+
+/**
+  Unlink the memory block from the pool's list and its address lookups.
+
+  @param  Pool           The memory pool.
+  @param  Block          The memory block to unlink.
+
+**/
+STATIC
+VOID
+UsbHcUnlinkMemBlock (
+  IN USBHC_MEM_POOL       *Pool,
+  IN USBHC_MEM_BLOCK      *Block
+  )
+{
+  ASSERT ((Pool != NULL) && (Block != NULL));
+
+  UsbHcHashRemove (Pool->HostHash, Block->HostNodes, Block, Block->BufHost);
+  UsbHcHashRemove (Pool->BusHash, Block->BusNodes, Block, Block->Buf);
+
+  if (Block->Prev != NULL) {
+    Block->Prev->Next = Block->Next;
+  } else {
+    Pool->Head = Block->Next;
+  }
+  if (Block->Next != NULL) {
+    Block->Next->Prev = Block->Prev;
+  }
+  Block->Prev = NULL;
+  Block->Next = NULL;
+
+  if (Pool->Last == Block) {
+    Pool->Last = NULL;
+  }
+}
+
+/**
+  Set or clear the bits of a range of units.
+
+  @param  Block          The memory block.
+  @param  Start          The first unit.
+  @param  Count          The number of units.
+  @param  Allocate       TRUE to mark the units allocated, FALSE to mark them free.
+
+**/
+STATIC
+VOID
+UsbHcMarkUnits (
+  IN USBHC_MEM_BLOCK      *Block,
+  IN UINTN                Start,
+  IN UINTN                Count,
+  IN BOOLEAN              Allocate
+  )
+{
+  UINTN                   Word;
+  UINTN                   Bit;
+  UINTN                   Bits;
+  UINTN                   Mask;
+
+  while (Count > 0) {
+    Word = Start / USBHC_MEM_WORD_BITS;
+    Bit  = Start % USBHC_MEM_WORD_BITS;
+    Bits = MIN (Count, USBHC_MEM_WORD_BITS - Bit);
+    Mask = (Bits == USBHC_MEM_WORD_BITS) ? MAX_UINTN : ((((UINTN) 1 << Bits) - 1) << Bit);
+
+    if (Allocate) {
+      ASSERT ((Block->Bits[Word] & Mask) == 0);
+      Block->Bits[Word] |= Mask;
+    } else {
+      ASSERT ((Block->Bits[Word] & Mask) == Mask);
+      Block->Bits[Word] &= ~Mask;
+    }
+
+    Start += Bits;
+    Count -= Bits;
+  }
+}
+
+/**
+  Alloc some memory from the block.
+
+  @param  Block          The memory block to allocate memory from.
+  @param  Units          Number of memory units to allocate.
+
+  @return The pointer to the allocated memory. If couldn't allocate the needed memory,
+          the return value is NULL.
+
+**/
+STATIC
+VOID *
+UsbHcAllocMemFromBlock (
+  IN  USBHC_MEM_BLOCK     *Block,
+  IN  UINTN               Units
+  )
+{
+  UINTN                   Index;
+  UINTN                   Start;
+  UINTN                   End;
+  UINTN                   Word;
+  UINTN                   Bit;
+  UINTN                   Value;
+
+  ASSERT ((Block != NULL) && (Units != 0));
+
+  if (Block->FreeUnits < Units) {
+    return NULL;
+  }
+
+  Index = Block->Hint * USBHC_MEM_WORD_BITS;
+
+  while (Index + Units <= Block->Units) {
+    //
+    // Skip the allocated units in front of Index, a whole word at a time
+    // when the rest of the word is allocated.
+    //
+    Word  = Index / USBHC_MEM_WORD_BITS;
+    Bit   = Index % USBHC_MEM_WORD_BITS;
+    Value = Block->Bits[Word] >> Bit;
+    if (Value == (MAX_UINTN >> Bit)) {
+      Index = (Word + 1) * USBHC_MEM_WORD_BITS;
+      continue;
+    }
+    Index += UsbHcLowBitSet (~Value);
+
+    //
+    // Measure the run of free units that starts at Index, stopping as soon
+    // as it is long enough.
+    //
+    Start = Index;
+    End   = Index;
+    while ((End < Block->Units) && (End - Start < Units)) {
+      Word  = End / USBHC_MEM_WORD_BITS;
+      Bit   = End % USBHC_MEM_WORD_BITS;
+      Value = Block->Bits[Word] >> Bit;
+      if (Value == 0) {
+        End = (Word + 1) * USBHC_MEM_WORD_BITS;
+      } else {
+        End += UsbHcLowBitSet (Value);
+        break;
+      }
+    }
+
+    if (End - Start >= Units) {
+      UsbHcMarkUnits (Block, Start, Units, TRUE);
+      Block->FreeUnits -= Units;
+
+      while ((Block->Hint < Block->BitsLen) && (Block->Bits[Block->Hint] == MAX_UINTN)) {
+        Block->Hint++;
+      }
+
+      return Block->BufHost + Start * USBHC_MEM_UNIT;
+    }
+
+    Index = End;
+  }
+
+  return NULL;
+}
+
+/**
+  Calculate the corresponding bus address according to the Mem parameter.
+
+  @param  Pool           The memory pool of the host controller.
+  @param  Mem            The pointer to host memory.
+  @param  Size           The size of the memory region.
+
+  @return                The bus memory address
+
+**/
+EFI_PHYSICAL_ADDRESS
+UsbHcGetBusAddrForHostAddr (
+  IN USBHC_MEM_POOL       *Pool,
+  IN VOID                 *Mem,
+  IN UINTN                Size
+  )
+{
+  USBHC_MEM_BLOCK         *Block;
+  UINTN                   Offset;
+
+  if (Mem == NULL) {
+    return 0;
+  }
+
+  Block = UsbHcFindMemBlock (Pool, FALSE, (UINT8 *) Mem, USBHC_MEM_ROUND (Size));
+  ASSERT ((Block != NULL));
+  if (Block == NULL) {
+    return 0;
+  }
+
+  //
+  // calculate the bus memory address for host memory address.
+  //
+  Offset = (UINT8 *) Mem - Block->BufHost;
+  return (EFI_PHYSICAL_ADDRESS) (UINTN) (Block->Buf + Offset);
+}
+
+/**
+  Calculate the corresponding host address according to the bus address.
+
+  @param  Pool           The memory pool of the host controller.
+  @param  Mem            The pointer to bus memory.
+  @param  Size           The size of the memory region.
+
+  @return                The host memory address
+
+**/
+EFI_PHYSICAL_ADDRESS
+UsbHcGetHostAddrForBusAddr (
+  IN USBHC_MEM_POOL       *Pool,
+  IN VOID                 *Mem,
+  IN UINTN                Size
+  )
+{
+  USBHC_MEM_BLOCK         *Block;
+  UINTN                   Offset;
+
+  if (Mem == NULL) {
+    return 0;
+  }
+
+  Block = UsbHcFindMemBlock (Pool, TRUE, (UINT8 *) Mem, USBHC_MEM_ROUND (Size));
+  ASSERT ((Block != NULL));
+  if (Block == NULL) {
+    return 0;
+  }
+
+  //
+  // calculate the host memory address for bus memory address.
+  //
+  Offset = (UINT8 *) Mem - Block->Buf;
+  return (EFI_PHYSICAL_ADDRESS) (UINTN) (Block->BufHost + Offset);
+}
+
+/**
+  Initialize the memory management pool for the host controller.
+
+  @param  Check4G             Whether the host controller requires allocated memory
+                              from one 4G address space.
+  @param  Which4G             The 4G memory area each memory allocated should be from.
+
+  @return The memory pool, or NULL if it could not be initialized.
+
+**/
+USBHC_MEM_POOL *
+UsbHcInitMemPool (
+  IN BOOLEAN              Check4G,
+  IN UINT32               Which4G
+  )
+{
+  USBHC_MEM_POOL          *Pool;
+  USBHC_MEM_BLOCK         *Block;
+
+  Pool = AllocateZeroPool (sizeof (USBHC_MEM_POOL));
+
+  if (Pool == NULL) {
+    return Pool;
+  }
+
+  Pool->Check4G = Check4G;
+  Pool->Which4G = Which4G;
+
+  Block = UsbHcAllocMemBlock (Pool, USBHC_MEM_DEFAULT_PAGES);
+
+  if (Block == NULL) {
+    FreePool (Pool);
+    return NULL;
+  }
+
+  UsbHcInsertMemBlockToPool (Pool, Block);
+  return Pool;
+}
+
+/**
+  Release the memory management pool.
+
+  @param  Pool              The USB memory pool to free.
+
+  @retval EFI_SUCCESS       The memory pool is freed.
+  @retval EFI_DEVICE_ERROR  Failed to free the memory pool.
+
+**/
+EFI_STATUS
+UsbHcFreeMemPool (
+  IN USBHC_MEM_POOL       *Pool
+  )
+{
+  USBHC_MEM_BLOCK         *Block;
+
+  ASSERT (Pool->Head != NULL);
+
+  while (Pool->Head != NULL) {
+    Block = Pool->Head;
+    UsbHcUnlinkMemBlock (Pool, Block);
+    UsbHcFreeMemBlock (Pool, Block);
+  }
+
+  FreePool (Pool);
+  return EFI_SUCCESS;
+}
+
+/**
+  Allocate some memory from the host controller's memory pool
+  which can be used to communicate with host controller.
+
+  @param  Pool           The host controller's memory pool.
+  @param  Size           Size of the memory to allocate.
+
+  @return The allocated memory or NULL.
+
+**/
+VOID *
+UsbHcAllocateMem (
+  IN  USBHC_MEM_POOL      *Pool,
+  IN  UINTN               Size
+  )
+{
+  USBHC_MEM_BLOCK         *Block;
+  USBHC_MEM_BLOCK         *NewBlock;
+  VOID                    *Mem;
+  UINTN                   AllocSize;
+  UINTN                   Units;
+  UINTN                   Pages;
+
+  Mem       = NULL;
+  AllocSize = USBHC_MEM_ROUND (Size);
+  Units     = AllocSize / USBHC_MEM_UNIT;
+  ASSERT (Pool->Head != NULL);
+
+  //
+  // Allocations come in bursts of the same kind, so try the block of the
+  // previous allocation first, then the other blocks that have enough free
+  // units left.
+  //
+  Block = Pool->Last;
+  if (Block != NULL) {
+    Mem = UsbHcAllocMemFromBlock (Block, Units);
+  }
+
+  for (Block = Pool->Head; (Mem == NULL) && (Block != NULL); Block = Block->Next) {
+    if (Block == Pool->Last) {
+      continue;
+    }
+
+    Mem = UsbHcAllocMemFromBlock (Block, Units);
+    if (Mem != NULL) {
+      Pool->Last = Block;
+    }
+  }
+
+  if (Mem != NULL) {
+    ZeroMem (Mem, Size);
+    return Mem;
+  }
+
+  //
+  // Create a new memory block if there is not enough memory
+  // in the pool. If the allocation size is larger than the
+  // default page number, just allocate a large enough memory
+  // block. Otherwise allocate default pages.
+  //
+  if (AllocSize > EFI_PAGES_TO_SIZE (USBHC_MEM_DEFAULT_PAGES)) {
+    Pages = EFI_SIZE_TO_PAGES (AllocSize) + 1;
+  } else {
+    Pages = USBHC_MEM_DEFAULT_PAGES;
+  }
+
+  NewBlock = UsbHcAllocMemBlock (Pool, Pages);
+
+  if (NewBlock == NULL) {
+    DEBUG ((EFI_D_ERROR, "UsbHcAllocateMem: failed to allocate block\n"));
+    return NULL;
+  }
+
+  //
+  // Add the new memory block to the pool, then allocate memory from it
+  //
+  UsbHcInsertMemBlockToPool (Pool, NewBlock);
+  Mem = UsbHcAllocMemFromBlock (NewBlock, Units);
+
+  if (Mem != NULL) {
+    Pool->Last = NewBlock;
+    ZeroMem (Mem, Size);
+  }
+
+  return Mem;
+}
+
+/**
+  Free the allocated memory back to the memory pool.
+
+  @param  Pool           The memory pool of the host controller.
+  @param  Mem            The memory to free.
+  @param  Size           The size of the memory to free.
+
+**/
+VOID
+UsbHcFreeMem (
+  IN USBHC_MEM_POOL       *Pool,
+  IN VOID                 *Mem,
+  IN UINTN                Size
+  )
+{
+  USBHC_MEM_BLOCK         *Block;
+  UINTN                   AllocSize;
+  UINTN                   Start;
+
+  AllocSize = USBHC_MEM_ROUND (Size);
+
+  //
+  // If Block == NULL, it means that the current memory isn't
+  // in the host controller's pool. This is critical because
+  // the caller has passed in a wrong memory point
+  //
+  Block = UsbHcFindMemBlock (Pool, FALSE, (UINT8 *) Mem, AllocSize);
+  ASSERT (Block != NULL);
+  if (Block == NULL) {
+    return;
+  }
+
+  Start = ((UINT8 *) Mem - Block->BufHost) / USBHC_MEM_UNIT;
+  UsbHcMarkUnits (Block, Start, AllocSize / USBHC_MEM_UNIT, FALSE);
+  Block->FreeUnits += AllocSize / USBHC_MEM_UNIT;
+  Block->Hint       = MIN (Block->Hint, Start / USBHC_MEM_WORD_BITS);
+
+  //
+  // Release the current memory block if it is empty and not the head
+  //
+  if ((Block != Pool->Head) && (Block->FreeUnits == Block->Units)) {
+    UsbHcUnlinkMemBlock (Pool, Block);
+    UsbHcFreeMemBlock (Pool, Block);
+  }
+}
+
+/**
+  Allocates pages at a specified alignment that are suitable for a
+  MapOperationBusMasterCommonBuffer mapping.
+
+  If Alignment is not a power of two and Alignment is not zero, then ASSERT().
+
+  @param  Pages                 The number of pages to allocate.
+  @param  Alignment             The requested alignment of the allocation.  Must be a power of two.
+  @param  HostAddress           The system memory address to map to the host controller.
+  @param  DeviceAddress         The resulting map address for the bus master controller to
+                                use to access the hosts HostAddress.
+  @param  Mapping               A resulting value to pass to Unmap().
+
+  @retval EFI_SUCCESS           Success to allocate aligned pages.
+  @retval EFI_INVALID_PARAMETER Pages or Alignment is not valid.
+  @retval EFI_OUT_OF_RESOURCES  Do not have enough resources to allocate memory.
+
+**/
+EFI_STATUS
+UsbHcAllocateAlignedPages (
+  IN UINTN                  Pages,
+  IN UINTN                  Alignment,
+  OUT VOID                  **HostAddress,
+  OUT EFI_PHYSICAL_ADDRESS  *DeviceAddress,
+  OUT VOID                  **Mapping
+  )
+{
+  EFI_STATUS            Status;
+  VOID                  *Memory;
+  UINTN                 AlignedMemory;
+  UINTN                 AlignmentMask;
+  UINTN                 UnalignedPages;
+  UINTN                 RealPages;
+  UINTN                 Bytes;
+
+  //
+  // Alignment must be a power of two or zero.
+  //
+  ASSERT ((Alignment & (Alignment - 1)) == 0);
+
+  if ((Alignment & (Alignment - 1)) != 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Pages == 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+  if (Alignment > EFI_PAGE_SIZE) {
+    //
+    // Calculate the total number of pages since alignment is larger than page size.
+    //
+    AlignmentMask  = Alignment - 1;
+    RealPages      = Pages + EFI_SIZE_TO_PAGES (Alignment);
+    //
+    // Make sure that Pages plus EFI_SIZE_TO_PAGES (Alignment) does not overflow.
+    //
+    ASSERT (RealPages > Pages);
+
+    Status = DmaAllocateBuffer (
+               EfiBootServicesData,
+               RealPages,
+               &Memory
+               );
+    if (EFI_ERROR (Status)) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+    AlignedMemory  = ((UINTN) Memory + AlignmentMask) & ~AlignmentMask;
+    UnalignedPages = EFI_SIZE_TO_PAGES (AlignedMemory - (UINTN) Memory);
+    if (UnalignedPages > 0) {
+      //
+      // Free first unaligned page(s).
+      //
+      Status = DmaFreeBuffer (UnalignedPages, Memory);
+      ASSERT_EFI_ERROR (Status);
+    }
+    Memory         = (VOID *)(UINTN)(AlignedMemory + EFI_PAGES_TO_SIZE (Pages));
+    UnalignedPages = RealPages - Pages - UnalignedPages;
+    if (UnalignedPages > 0) {
+      //
+      // Free last unaligned page(s).
+      //
+      Status = DmaFreeBuffer (UnalignedPages, Memory);
+      ASSERT_EFI_ERROR (Status);
+    }
+  } else {
+    //
+    // Do not over-allocate pages in this case.
+    //
+    Status = DmaAllocateBuffer (
+               EfiBootServicesData,
+               Pages,
+               &Memory
+               );
+    if (EFI_ERROR (Status)) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+    AlignedMemory  = (UINTN) Memory;
+  }
+
+  Bytes = EFI_PAGES_TO_SIZE (Pages);
+  Status = DmaMap (
+             MapOperationBusMasterCommonBuffer,
+             (VOID *) AlignedMemory,
+             &Bytes,
+             DeviceAddress,
+             Mapping
+             );
+
+  if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Pages))) {
+    Status = DmaFreeBuffer (Pages, (VOID *) AlignedMemory);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  *HostAddress = (VOID *) AlignedMemory;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Frees memory that was allocated with UsbHcAllocateAlignedPages().
+
+  @param  HostAddress           The system memory address to map to the host controller.
+  @param  Pages                 The number of 4 KB pages to free.
+  @param  Mapping               The mapping value returned from Map().
+
+**/
+VOID
+UsbHcFreeAlignedPages (
+  IN VOID                   *HostAddress,
+  IN UINTN                  Pages,
+  VOID                      *Mapping
+  )
+{
+  EFI_STATUS      Status;
+
+  ASSERT (Pages != 0);
+
+  Status = DmaUnmap (Mapping);
+  ASSERT_EFI_ERROR (Status);
+
+  Status = DmaFreeBuffer (
+             Pages,
+             HostAddress
+             );
+  ASSERT_EFI_ERROR (Status);
+}
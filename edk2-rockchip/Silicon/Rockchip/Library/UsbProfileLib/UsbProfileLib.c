@@ -0,0 +1,335 @@
+/** @file
+
+  Timing counters for the USB host controller drivers.
+
+  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Library/ArmGenericTimerCounterLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UsbProfileLib.h>
+
+//
+// Root ports whose debounce and reset are timed
+//
+#define USB_PROFILE_MAX_PORTS   32
+
+#define USB_PROFILE_SIGNATURE   SIGNATURE_32 ('u', 'p', 'r', 'f')
+
+struct _USB_PROFILE {
+  UINT32                          Signature;
+  ROCKCHIP_USB_PROFILE_PROTOCOL   Protocol;
+  EFI_HANDLE                      Controller;
+  UINT64                          ConnectTick[USB_PROFILE_MAX_PORTS];
+  UINT64                          ResetTick[USB_PROFILE_MAX_PORTS];
+};
+
+#define USB_PROFILE_FROM_THIS(a)  CR (a, USB_PROFILE, Protocol, USB_PROFILE_SIGNATURE)
+
+/**
+  Add a duration to a timing.
+
+  @param  Timing              The timing to update.
+  @param  Ticks               The duration.
+
+**/
+STATIC
+VOID
+UsbProfileAddTiming (
+  IN OUT USB_PROFILE_TIMING   *Timing,
+  IN     UINT64               Ticks
+  )
+{
+  if ((Timing->Count == 0) || (Ticks < Timing->Min)) {
+    Timing->Min = Ticks;
+  }
+
+  if (Ticks > Timing->Max) {
+    Timing->Max = Ticks;
+  }
+
+  Timing->Count++;
+  Timing->Total += Ticks;
+}
+
+/**
+  Clear all the counters of the controller.
+
+  @param  This                The ROCKCHIP_USB_PROFILE_PROTOCOL instance.
+
+**/
+STATIC
+VOID
+EFIAPI
+UsbProfileReset (
+  IN ROCKCHIP_USB_PROFILE_PROTOCOL  *This
+  )
+{
+  USB_PROFILE                 *Profile;
+  EFI_TPL                     OldTpl;
+
+  Profile = USB_PROFILE_FROM_THIS (This);
+
+  //
+  // The drivers update the counters at TPL_NOTIFY
+  //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  This->PollTicks   = 0;
+  This->Dropped     = 0;
+  This->DeviceCount = 0;
+  ZeroMem (&This->PortDebounce, sizeof (This->PortDebounce));
+  ZeroMem (&This->PortReset, sizeof (This->PortReset));
+  ZeroMem (This->Devices, sizeof (This->Devices));
+  ZeroMem (Profile->ConnectTick, sizeof (Profile->ConnectTick));
+  ZeroMem (Profile->ResetTick, sizeof (Profile->ResetTick));
+
+  gBS->RestoreTPL (OldTpl);
+}
+
+/**
+  Create the counters of a host controller and install
+  ROCKCHIP_USB_PROFILE_PROTOCOL on its handle.
+
+  @param  Controller          The host controller handle.
+  @param  ControllerName      The kind of controller, "XHCI", "EHCI" or "OHCI".
+  @param  BaseAddress         The MMIO base of the controller.
+
+  @return The counters, or NULL if they could not be created. The other
+          functions accept NULL and do nothing then.
+
+**/
+USB_PROFILE *
+UsbProfileCreate (
+  IN EFI_HANDLE             Controller,
+  IN CONST CHAR16           *ControllerName,
+  IN UINTN                  BaseAddress
+  )
+{
+  USB_PROFILE               *Profile;
+  EFI_STATUS                Status;
+
+  Profile = AllocateZeroPool (sizeof (USB_PROFILE));
+  if (Profile == NULL) {
+    return NULL;
+  }
+
+  Profile->Signature               = USB_PROFILE_SIGNATURE;
+  Profile->Controller              = Controller;
+  Profile->Protocol.ControllerName = ControllerName;
+  Profile->Protocol.BaseAddress    = BaseAddress;
+  Profile->Protocol.Frequency      = ArmGenericTimerGetTimerFreq ();
+  Profile->Protocol.Reset          = UsbProfileReset;
+
+  Status = gBS->InstallProtocolInterface (
+                  &Profile->Controller,
+                  &gRockchipUsbProfileProtocolGuid,
+                  EFI_NATIVE_INTERFACE,
+                  &Profile->Protocol
+                  );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: %s @ 0x%lx: %r\n", __FUNCTION__, ControllerName, (UINT64) BaseAddress, Status));
+    FreePool (Profile);
+    return NULL;
+  }
+
+  return Profile;
+}
+
+/**
+  Uninstall the protocol and free the counters of a host controller.
+
+  @param  Profile             The counters returned by UsbProfileCreate.
+
+**/
+VOID
+UsbProfileDestroy (
+  IN USB_PROFILE            *Profile
+  )
+{
+  if (Profile == NULL) {
+    return;
+  }
+
+  gBS->UninstallProtocolInterface (
+         Profile->Controller,
+         &gRockchipUsbProfileProtocolGuid,
+         &Profile->Protocol
+         );
+  FreePool (Profile);
+}
+
+/**
+  Read the ARM generic counter.
+
+  @return The current counter value.
+
+**/
+UINT64
+UsbProfileTimestamp (
+  VOID
+  )
+{
+  return ArmGenericTimerGetSystemCount ();
+}
+
+/**
+  Account a completed synchronous transfer.
+
+  @param  Profile             The counters of the controller.
+  @param  DeviceAddress       The device the transfer was for.
+  @param  Type                The kind of transfer.
+  @param  Bytes               The number of bytes transferred.
+  @param  StartTick           The counter value when the transfer was submitted.
+  @param  Status              The result of the transfer.
+
+**/
+VOID
+UsbProfileTransfer (
+  IN USB_PROFILE            *Profile,
+  IN UINT8                  DeviceAddress,
+  IN USB_PROFILE_TYPE       Type,
+  IN UINTN                  Bytes,
+  IN UINT64                 StartTick,
+  IN EFI_STATUS             Status
+  )
+{
+  ROCKCHIP_USB_PROFILE_PROTOCOL   *Counters;
+  USB_PROFILE_DEVICE              *Device;
+  UINT64                          Ticks;
+  UINTN                           Index;
+
+  if ((Profile == NULL) || (Type >= UsbProfileTypeMax)) {
+    return;
+  }
+
+  Ticks    = UsbProfileTimestamp () - StartTick;
+  Counters = &Profile->Protocol;
+
+  for (Index = 0; Index < Counters->DeviceCount; Index++) {
+    if (Counters->Devices[Index].DeviceAddress == DeviceAddress) {
+      break;
+    }
+  }
+
+  if (Index == Counters->DeviceCount) {
+    if (Index == USB_PROFILE_MAX_DEVICES) {
+      Counters->Dropped++;
+      return;
+    }
+
+    Counters->Devices[Index].DeviceAddress = DeviceAddress;
+    Counters->DeviceCount++;
+  }
+
+  Device = &Counters->Devices[Index];
+  if (EFI_ERROR (Status)) {
+    Device->Errors++;
+  }
+
+  Device->Bytes[Type] += Bytes;
+  UsbProfileAddTiming (&Device->Latency[Type], Ticks);
+}
+
+/**
+  Account the time spent polling for the completion of a transfer.
+
+  @param  Profile             The counters of the controller.
+  @param  StartTick           The counter value when polling started.
+
+**/
+VOID
+UsbProfilePoll (
+  IN USB_PROFILE            *Profile,
+  IN UINT64                 StartTick
+  )
+{
+  if (Profile == NULL) {
+    return;
+  }
+
+  Profile->Protocol.PollTicks += UsbProfileTimestamp () - StartTick;
+}
+
+/**
+  Note that a device was connected to a root port, the debounce time runs
+  from there until the port is reset.
+
+  @param  Profile             The counters of the controller.
+  @param  Port                The root port, zero based.
+
+**/
+VOID
+UsbProfilePortConnect (
+  IN USB_PROFILE            *Profile,
+  IN UINTN                  Port
+  )
+{
+  if ((Profile == NULL) || (Port >= USB_PROFILE_MAX_PORTS)) {
+    return;
+  }
+
+  //
+  // The connect change is reported until it is cleared, keep the first
+  //
+  if (Profile->ConnectTick[Port] == 0) {
+    Profile->ConnectTick[Port] = UsbProfileTimestamp ();
+  }
+}
+
+/**
+  Note that the reset of a root port starts.
+
+  @param  Profile             The counters of the controller.
+  @param  Port                The root port, zero based.
+
+**/
+VOID
+UsbProfilePortResetStart (
+  IN USB_PROFILE            *Profile,
+  IN UINTN                  Port
+  )
+{
+  UINT64                    Now;
+
+  if ((Profile == NULL) || (Port >= USB_PROFILE_MAX_PORTS)) {
+    return;
+  }
+
+  Now = UsbProfileTimestamp ();
+  if (Profile->ConnectTick[Port] != 0) {
+    UsbProfileAddTiming (&Profile->Protocol.PortDebounce, Now - Profile->ConnectTick[Port]);
+    Profile->ConnectTick[Port] = 0;
+  }
+
+  Profile->ResetTick[Port] = Now;
+}
+
+/**
+  Note that the reset of a root port completed.
+
+  @param  Profile             The counters of the controller.
+  @param  Port                The root port, zero based.
+
+**/
+VOID
+UsbProfilePortResetDone (
+  IN USB_PROFILE            *Profile,
+  IN UINTN                  Port
+  )
+{
+  if ((Profile == NULL) || (Port >= USB_PROFILE_MAX_PORTS) ||
+      (Profile->ResetTick[Port] == 0)) {
+    return;
+  }
+
+  UsbProfileAddTiming (&Profile->Protocol.PortReset, UsbProfileTimestamp () - Profile->ResetTick[Port]);
+  Profile->ResetTick[Port] = 0;
+}
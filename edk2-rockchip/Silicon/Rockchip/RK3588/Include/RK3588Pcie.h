@@ -0,0 +1,88 @@
+/** @file
+*
+*  Address map of the RK3588 PCIe root complexes.
+*
+*  Every root complex is its own PCI segment for the OS. The segments also
+*  use disjoint bus ranges, so that the bus number alone identifies the root
+*  complex: the firmware puts all its root bridges in segment 0, as the
+*  PciSegmentLib it uses only supports that one, and PciExpressLib finds the
+*  root complex from the bus.
+*
+*  Only plain macros are allowed here: the header is shared by C sources, the
+*  ACPI tables and the ASL.
+*
+*  Copyright (c) 2022, Rockchip Limited. All rights reserved.
+*
+*  SPDX-License-Identifier: BSD-2-Clause-Patent
+*
+**/
+
+#ifndef __RK3588_PCIE_H__
+#define __RK3588_PCIE_H__
+
+#define PCIE_SEGMENT_PCIE30X4           0
+#define PCIE_SEGMENT_PCIE30X2           1
+#define PCIE_SEGMENT_PCIE20L0           2
+#define PCIE_SEGMENT_PCIE20L1           3
+#define PCIE_SEGMENT_PCIE20L2           4
+#define PCIE_SEGMENT_COUNT              5
+
+//
+// Controller registers: APB (client/LTSSM) and DBI (DesignWare core, iATU)
+//
+#define PCIE_APB_BASE(Seg)              (0xFE150000 + (Seg) * 0x10000)
+#define PCIE_APB_SIZE                   0x10000
+#define PCIE_DBI_BASE(Seg)              (0xF5000000 + (Seg) * 0x400000)
+#define PCIE_DBI_SIZE                   0x400000
+
+//
+// 16 MB of 32-bit address space per segment: CFG window, then I/O, then MEM
+//
+#define PCIE_MMIO32_BASE(Seg)           (0xF0000000 + (Seg) * 0x1000000)
+#define PCIE_CFG_BASE(Seg)              PCIE_MMIO32_BASE (Seg)
+#define PCIE_CFG_SIZE                   0x100000
+#define PCIE_IO_BASE(Seg)               (PCIE_MMIO32_BASE (Seg) + 0x100000)
+#define PCIE_IO_SIZE                    0x10000
+#define PCIE_MEM_BASE(Seg)              (PCIE_MMIO32_BASE (Seg) + 0x200000)
+#define PCIE_MEM_SIZE                   0xE00000
+
+//
+// 1 GB of 64-bit address space per segment, which is all the SoC decodes for
+// a root complex. Written so that the product stays 64-bit in C.
+//
+// It starts with a configuration view laid out like ECAM, bus B being at
+// 1 MB * B from the start of the window, so that the bus number is in the
+// same address bits as in an ECAM region. Only the buses of the segment are
+// kept back for it (_CBA); the rest is the prefetchable window for the
+// 64-bit BARs.
+//
+#define PCIE_MMIO64_BASE(Seg)           (0x900000000 + (Seg) * 0x100000000 / 4)
+#define PCIE_MMIO64_SIZE                0x40000000
+#define PCIE_ECAM_BASE(Seg)             PCIE_MMIO64_BASE (Seg)
+#define PCIE_CBA_BASE(Seg)              (PCIE_ECAM_BASE (Seg) + PCIE_BUS_BASE (Seg) * 0x100000)
+#define PCIE_CBA_SIZE                   (PCIE_BUS_COUNT * 0x100000)
+#define PCIE_MEM64_BASE(Seg)            (PCIE_CBA_BASE (Seg) + PCIE_CBA_SIZE)
+#define PCIE_MEM64_SIZE(Seg)            (PCIE_MMIO64_BASE (Seg) + PCIE_MMIO64_SIZE - PCIE_MEM64_BASE (Seg))
+
+//
+// 48 buses per segment. The root port sits on the first one.
+//
+// The firmware has a single 256 bus space for all the root complexes, as
+// they all sit in its segment 0, so 5 * 48 is as far as it goes. PciBusDxe
+// leaves the bridges of a hierarchy that needs more buses than that without
+// a bus range.
+//
+#define PCIE_BUS_COUNT                  0x30
+#define PCIE_BUS_BASE(Seg)              ((Seg) * PCIE_BUS_COUNT)
+#define PCIE_BUS_LIMIT(Seg)             (PCIE_BUS_BASE (Seg) + PCIE_BUS_COUNT - 1)
+#define PCIE_SEGMENT_FROM_BUS(Bus)      ((Bus) / PCIE_BUS_COUNT)
+
+//
+// Link capabilities: the two 3.0 controllers share the 4 lanes of the
+// PCIe 3.0 PHY, the 2.0 controllers each use a combo PHY lane.
+//
+#define PCIE_MAX_GEN(Seg)               ((Seg) <= PCIE_SEGMENT_PCIE30X2 ? 3 : 2)
+#define PCIE_MAX_LANES(Seg)             ((Seg) == PCIE_SEGMENT_PCIE30X4 ? 4 : \
+                                         (Seg) == PCIE_SEGMENT_PCIE30X2 ? 2 : 1)
+
+#endif /* __RK3588_PCIE_H__ */